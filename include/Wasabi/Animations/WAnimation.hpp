@@ -62,6 +62,24 @@ struct W_SUB_ANIMATION {
 	}
 };
 
+/**
+ * Level of detail of the updates of an animation, see
+ * WAnimationManager::Update().
+ */
+struct W_ANIMATION_LOD {
+	/** Number of frames between two evaluations of the pose, 1 to evaluate
+	 *  it every frame */
+	uint32_t updateInterval;
+	/** Depth in the bone hierarchy (0 for the root) of the deepest bones that
+	 *  are sampled when the pose is evaluated, MAX to sample all the bones */
+	uint32_t maxBoneDepth;
+
+	W_ANIMATION_LOD() {
+		updateInterval = 1;
+		maxBoneDepth = std::numeric_limits<uint32_t>::max();
+	}
+};
+
 /**
  * @ingroup engineclass
  * This is an abstract base class that represents an animation which could be
@@ -69,6 +87,8 @@ struct W_SUB_ANIMATION {
  * subanimations and managing their playing and looping.
  */
 class WAnimation : public WFileAsset {
+	friend class WAnimationManager;
+
 protected:
 	virtual ~WAnimation();
 
@@ -85,12 +105,73 @@ public:
 	WAnimation(class Wasabi* const app, uint32_t ID = 0);
 
 	/**
-	 * Steps the state of the playing (or looping) subanimations forward. This is
-	 * usually called by the engine during normal execution each frame.
+	 * Steps the state of the playing (or looping) subanimations forward and
+	 * uploads the new state, this is the same as calling EvaluatePose()
+	 * followed by UploadPose().
 	 * @param fDeltaTime step time in seconds
 	 */
 	virtual void Update(float fDeltaTime);
 
+	/**
+	 * Steps the state of the playing (or looping) subanimations forward and
+	 * computes the resulting state of the animation (e.g. the bone matrices of
+	 * a skeleton) on the CPU. This is called by the engine each frame, for
+	 * different animations in parallel on the worker threads (see
+	 * WAnimationManager::Update()), so an implementation must only write to
+	 * data owned by this animation and must not use any GPU resource.
+	 * @param fDeltaTime step time in seconds
+	 */
+	virtual void EvaluatePose(float fDeltaTime);
+
+	/**
+	 * Uploads the state computed by the last EvaluatePose() to the animation's
+	 * GPU resources (e.g. the bone texture of a skeleton). This is called by
+	 * the engine on the main thread after all the animations are evaluated.
+	 */
+	virtual void UploadPose();
+
+	/**
+	 * Reports that an object using this animation is being rendered this
+	 * frame. This is called by WObject::Render() from the passes that render
+	 * the scene for a camera (G-buffer and forward), and is used by
+	 * WAnimationManager::Update() to pick the level of detail of the next
+	 * update.
+	 * @param fScreenSize Height of the object on the screen, as a fraction of
+	 *                    the screen's height
+	 */
+	void ReportVisibility(float fScreenSize);
+
+	/**
+	 * Sets the number of objects (WObject) that use this animation. This is
+	 * maintained by WObject::SetAnimation(). An animation that no object uses
+	 * is always updated at full detail.
+	 * @param numObjects Number of objects using this animation
+	 */
+	void SetNumObjects(uint32_t numObjects);
+
+	/**
+	 * Retrieves the number of objects (WObject) that use this animation.
+	 * @return Number of objects using this animation
+	 */
+	uint32_t GetNumObjects() const;
+
+	/**
+	 * Retrieves the level of detail picked for the last update of this
+	 * animation by WAnimationManager::Update().
+	 * @return The level of detail of the last update
+	 */
+	W_ANIMATION_LOD GetLOD() const;
+
+	/**
+	 * Retrieves the cost of evaluating the pose at a level of detail, which is
+	 * counted against the engine parameter "animationBoneBudget" by
+	 * WAnimationManager::Update(). The default implementation returns 1.
+	 * @param  lod Level of detail to evaluate the pose at
+	 * @return     Cost of evaluating the pose (e.g. the number of sampled
+	 *             bones of a skeleton)
+	 */
+	virtual uint32_t GetPoseCost(const W_ANIMATION_LOD& lod) const;
+
 	/**
 	 * Retrieves the texture that corresponds to the animation. This depends on
 	 * the implementation. For example, a skeletal animation implementation may
@@ -209,6 +290,12 @@ public:
 	 */
 	float GetTime(uint32_t subAnimation = 0) const;
 
+	/**
+	 * Retrieves the total time of the frames of the animation.
+	 * @return The sum of the durations of all the frames
+	 */
+	float GetTotalTime() const;
+
 	/**
 	 * Copies another WAnimation. This function is specific to the
 	 * implementation.
@@ -234,6 +321,22 @@ protected:
 	 */
 	void m_UpdateFirstFrame(uint32_t subAnimation = std::numeric_limits<uint32_t>::max());
 
+	/**
+	 * Rebuilds m_frameStartTimes and m_totalTime from the durations of the
+	 * frames. This must be called whenever frames are added or removed or
+	 * their durations change.
+	 */
+	void m_UpdateFrameTimes();
+
+	/**
+	 * Finds the frame that is playing at a given time, using a binary search
+	 * over m_frameStartTimes.
+	 * @param  fTime Time in the animation
+	 * @return       Index of the first frame that ends after fTime, or the
+	 *               number of frames if fTime is past the last frame
+	 */
+	uint32_t m_FindFrame(float fTime) const;
+
 	/**
 	 * true if this object owns the frames in m_frames, and can thus free them.
 	 * The owner of the frames is the one who allocated them.
@@ -241,10 +344,26 @@ protected:
 	bool m_bFramesOwner;
 	/** Total time of all the frames */
 	float m_totalTime;
+	/** Time at which every frame starts (the sum of the durations of the
+	 *  frames before it), followed by m_totalTime */
+	vector<float> m_frameStartTimes;
 	/** The frames of this animation */
 	vector<W_FRAME*> m_frames;
 	/** The subanimations of this animation */
 	vector<W_SUB_ANIMATION*> m_subAnimations;
+	/** Level of detail of the current update */
+	W_ANIMATION_LOD m_lod;
+	/** Whether the current EvaluatePose() computes a new pose. Otherwise, it
+	 *  only steps the subanimations and may blend towards the last computed
+	 *  pose (see W_ANIMATION_LOD::updateInterval) */
+	bool m_bEvaluatePose;
+	/** Number of frames since the pose was last computed */
+	uint32_t m_framesSinceEvaluation;
+	/** Largest screen size reported by ReportVisibility() since the last
+	 *  update, negative if the animation was not rendered */
+	float m_visibleScreenSize;
+	/** Number of objects using this animation */
+	uint32_t m_numObjects;
 };
 
 /**
@@ -265,8 +384,44 @@ public:
 	~WAnimationManager();
 
 	/**
-	 * Update (step) all registered animations.
+	 * Update (step) all registered animations. The animations are evaluated
+	 * (see WAnimation::EvaluatePose()) in parallel on the worker threads of
+	 * Wasabi::ThreadPool, then their results are uploaded one after the other
+	 * (see WAnimation::UploadPose()).
+	 *
+	 * If the engine parameter "animationLOD" is set (the default), the level
+	 * of detail of every animation is picked from how it was rendered in the
+	 * last frame (see WAnimation::ReportVisibility()):
+	 * * An animation rendered at or above "animationLODFullRateSize" percent
+	 *   of the screen's height is evaluated every frame. A smaller one is
+	 *   evaluated once every (that size / its size) frames, up to
+	 *   "animationLODMaxInterval" frames. An animation that was not rendered
+	 *   (off-screen or culled) uses the maximum interval.
+	 * * An animation rendered below "animationLODBoneDepthSize" percent of the
+	 *   screen's height, or not rendered, only samples the bones up to
+	 *   "animationLODBoneDepth" levels deep in the hierarchy.
+	 * * If "animationBoneBudget" is not 0, the animations that are due are
+	 *   evaluated by priority (screen size and time since their last
+	 *   evaluation) until the sum of their costs (see
+	 *   WAnimation::GetPoseCost()) reaches the budget. The others wait for a
+	 *   later frame.
+	 * Animations always step their time every frame. Between two evaluations,
+	 * the pose blends from the previous evaluation towards the last one.
+	 * Animations that no object uses are always evaluated every frame at full
+	 * detail.
 	 * @param fDeltaTime Time to step each animation
 	 */
 	void Update(float fDeltaTime);
+
+private:
+	/** The animations being updated by Update() */
+	vector<WAnimation*> m_updatedAnimations;
+	/** Scratch list of the animations that are due for an evaluation */
+	vector<WAnimation*> m_dueAnimations;
+
+	/**
+	 * Picks the level of detail of every animation in m_updatedAnimations and
+	 * which ones compute a new pose this frame.
+	 */
+	void _ScheduleUpdates();
 };
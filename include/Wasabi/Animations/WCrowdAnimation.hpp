@@ -0,0 +1,159 @@
+/** @file WCrowdAnimation.hpp
+ *  @brief Baked skeletal animation for instanced crowds
+ *
+ *  A crowd animation lets every instance of an instanced WObject play its own
+ *  skeletal animation without any per-frame CPU work:
+ *  * WCrowdAnimation::Bake() samples clips of skeletons (WSkeleton) at a
+ *  	fixed rate, once, and stores the bone matrices of every sample in a
+ *  	texture that all the instances share.
+ *  * Every instance picks a clip, a time offset and a playback speed (see
+ *  	WInstance::SetAnimationClip()). These are written to the instancing
+ *  	texture of the object, next to the instance's matrix.
+ *  * The vertex shader computes the time of the instance in its clip from the
+ *  	engine's elapsed time (W_GLOBAL_FRAME_DATA::time), and blends the bone
+ *  	matrices of the two samples around that time.
+ *  An object with a crowd animation and instances is rendered with the
+ *  EFFECT_FEATURE_CROWD_ANIMATED pipeline variant, so its effect has to
+ *  support that feature (the default animated effects do).
+ *
+ *  The baked texture is laid out as follows (4 floats per pixel):
+ *  * Pixel 0: x is the number of bone matrices in every sample.
+ *  * Pixel 1 + c for every clip c: x is the first matrix of the clip, y is
+ *  	the number of intervals between its samples (there is one more sample
+ *  	than intervals), z is its duration and w is 1 if it loops.
+ *  * The matrices start at the first multiple of 4 pixels after the clips.
+ *  	Every 4 pixels are a bone matrix, encoded the same way as in the bone
+ *  	texture of a WSkeleton, and every sample has the matrices of all its
+ *  	bones (by bone index).
+ *
+ *  @author Hasan Al-Jawaheri (hbj)
+ *  @bug No known bugs.
+ */
+#pragma once
+
+#include "Wasabi/Core/WCore.hpp"
+#include "Wasabi/Animations/WAnimation.hpp"
+
+/** Default number of samples per second of a baked clip */
+#define W_CROWD_ANIMATION_DEFAULT_SAMPLE_RATE 30.0f
+
+/**
+ * Describes a clip to bake into a WCrowdAnimation.
+ */
+struct W_CROWD_ANIMATION_CLIP {
+	/** Skeleton to sample the clip from (its first subanimation) */
+	class WSkeleton* skeleton;
+	/** Time in the skeleton at which the clip starts */
+	float fStartTime;
+	/** Time in the skeleton at which the clip ends, clamped to the total
+	 *  time of the skeleton */
+	float fEndTime;
+	/** Whether the clip loops (otherwise it holds its last pose) */
+	bool bLoop;
+
+	W_CROWD_ANIMATION_CLIP(class WSkeleton* s = nullptr, float start = 0.0f, float end = FLT_MAX, bool loop = true)
+		: skeleton(s), fStartTime(start), fEndTime(end), bLoop(loop) {}
+};
+
+/**
+ * @ingroup engineclass
+ * An animation baked from skeletal clips that instances of a WObject play
+ * independently on the GPU, as described in WCrowdAnimation.hpp.
+ */
+class WCrowdAnimation : public WAnimation {
+protected:
+	virtual ~WCrowdAnimation();
+
+public:
+	/**
+	 * Returns "CrowdAnimation" string.
+	 * @return Returns "CrowdAnimation" string
+	 */
+	static std::string _GetTypeName();
+	virtual std::string GetTypeName() const override;
+
+	WCrowdAnimation(Wasabi* const app, uint32_t ID = 0);
+
+	/**
+	 * Samples clips of skeletons and creates the baked texture from them,
+	 * replacing any previously baked clips. The skeletons are not modified.
+	 * All the clips must have the same number of bones.
+	 * @param  clips       Clips to bake, an instance refers to a clip by its
+	 *                     index in this list
+	 * @param  fSampleRate Number of samples per second of every clip
+	 * @return             Error code, see WError.h
+	 */
+	WError Bake(const vector<W_CROWD_ANIMATION_CLIP>& clips, float fSampleRate = W_CROWD_ANIMATION_DEFAULT_SAMPLE_RATE);
+
+	/**
+	 * Retrieves the number of baked clips.
+	 * @return Number of baked clips
+	 */
+	uint32_t GetNumClips() const;
+
+	/**
+	 * Retrieves the duration of a baked clip.
+	 * @param  clip Index of the clip
+	 * @return      Duration of the clip in seconds, 0 if it doesn't exist
+	 */
+	float GetClipDuration(uint32_t clip) const;
+
+	/**
+	 * Does nothing, a crowd animation is played by the vertex shader.
+	 * @param fDeltaTime step time in seconds
+	 */
+	virtual void EvaluatePose(float fDeltaTime) override;
+
+	/**
+	 * Retrieves the baked texture, as described in WCrowdAnimation.hpp.
+	 * @return The baked texture
+	 */
+	virtual WImage* GetTexture() const override;
+
+	/**
+	 * Copies the baked clips of another WCrowdAnimation.
+	 * @param  from Crowd animation to copy from
+	 * @return      Error code, see WError.h
+	 */
+	virtual WError CopyFrom(const WAnimation* const from) override;
+
+	/**
+	 * Uses the baked clips and texture of another WCrowdAnimation, without
+	 * copying them.
+	 * @param  anim Crowd animation to use its clips
+	 * @return      Error code, see WError.h
+	 */
+	virtual WError UseAnimationFrames(const WAnimation* const anim) override;
+
+	/**
+	 * Returns whether or not this crowd animation is valid. A valid crowd
+	 * animation is one that has baked clips.
+	 * @return true if the crowd animation is valid, false otherwise
+	 */
+	virtual bool Valid() const override;
+
+	static std::vector<void*> LoadArgs();
+	virtual WError SaveToStream(WFile* file, std::ostream& outputStream) override;
+	virtual WError LoadFromStream(WFile* file, std::istream& inputStream, std::vector<void*>& args, std::string nameSuffix) override;
+
+private:
+	/** The baked texture */
+	WImage* m_bakedTex;
+	/** Pixels of the baked texture (4 floats each) */
+	vector<float> m_bakedData;
+	/** Width (and height) of the baked texture */
+	uint32_t m_bakedTexWidth;
+	/** Duration of every baked clip */
+	vector<float> m_clipDurations;
+
+	/**
+	 * Creates m_bakedTex from m_bakedData.
+	 * @return Error code, see WError.h
+	 */
+	WError _CreateTexture();
+
+	/**
+	 * Frees the baked texture and clips.
+	 */
+	void _Destroy();
+};
@@ -12,6 +12,11 @@
  *  	a matrix for a bone at that index. The matrix is stored row by row, but
  *  	the last row is omitted and its' components are encoded in the first 3
  *  	rows' w component.
+ *  * Every keyframe keeps the local transformation (translation, rotation
+ *  	quaternion and scale) of its bones in a W_SKELETAL_POSE. A pose is
+ *  	evaluated by interpolating the transformations of the current and
+ *  	next keyframes, then walking the bones once (parents first) to compute
+ *  	their model-space matrices.
  *  * The bone texture and the animation vertex buffer are passed to the vertex
  *  	shader, which is free to use in any way. The default implementation
  *  	uses the boneIDs of every vertex (supplied by the animation vertex
@@ -27,6 +32,14 @@
 #include "Wasabi/Animations/WAnimation.hpp"
 #include <iostream>
 
+/** Default maximum error of a bone's position in a compressed skeleton */
+#define W_SKELETON_DEFAULT_POSITION_ERROR 0.0005f
+/** Default maximum error of a bone's rotation (in radians) in a compressed
+ *  skeleton */
+#define W_SKELETON_DEFAULT_ROTATION_ERROR 0.001f
+/** Default maximum error of a bone's scale in a compressed skeleton */
+#define W_SKELETON_DEFAULT_SCALE_ERROR 0.0005f
+
 /**
  * @ingroup engineclass
  * This class represents a single bone in a skeleton. The final matrix of this
@@ -210,6 +223,9 @@ struct W_SKELETAL_SUB_ANIMATION : public W_SUB_ANIMATION {
 	uint32_t parentIndex;
 	/** Index of the parent subanimation, MAX if none */
 	uint32_t parentSubAnimation;
+	/** Positions in the skeleton's pose of the bones in boneIndices, built by
+	 *  WSkeleton from the first keyframe */
+	vector<uint32_t> bonePositions;
 
 	W_SKELETAL_SUB_ANIMATION() {
 		parentIndex = std::numeric_limits<uint32_t>::max();
@@ -232,6 +248,66 @@ struct W_SKELETAL_SUB_ANIMATION : public W_SUB_ANIMATION {
 	}
 };
 
+/**
+ * Local transformations (relative to the parent bone) of the bones of a
+ * skeleton. Every component has its own array, indexed by the position of the
+ * bone in its keyframe (parents come before their children), so that poses
+ * can be interpolated many bones at a time.
+ */
+struct W_SKELETAL_POSE {
+	/** Translation components */
+	vector<float> tx, ty, tz;
+	/** Rotation quaternion components */
+	vector<float> qx, qy, qz, qw;
+	/** Scale components, a negative z scale mirrors the bone (like the root
+	 *  bone's matrix) */
+	vector<float> sx, sy, sz;
+
+	/**
+	 * Resizes the arrays of the pose.
+	 * @param numBones Number of bones in the pose
+	 */
+	void Resize(uint32_t numBones);
+
+	/**
+	 * Sets the transformation of a bone from its local matrix.
+	 * @param bone  Position of the bone in the pose
+	 * @param local Local matrix of the bone (see WBone::GetMatrix())
+	 */
+	void SetBone(uint32_t bone, const WMatrix& local);
+
+	/**
+	 * Computes the local matrix of a bone.
+	 * @param  bone Position of the bone in the pose
+	 * @return      The local matrix of the bone
+	 */
+	WMatrix GetBoneMatrix(uint32_t bone) const;
+
+	/**
+	 * Sets the transformations of a range of bones to the interpolation of
+	 * two poses. Translations and scales are interpolated linearly and
+	 * rotations with a normalized lerp (nlerp) on the shortest path.
+	 * @param from  Pose at t = 0
+	 * @param to    Pose at t = 1
+	 * @param t     Interpolation factor
+	 * @param begin Position of the first bone to interpolate
+	 * @param end   Position after the last bone to interpolate
+	 */
+	void Interpolate(const W_SKELETAL_POSE& from, const W_SKELETAL_POSE& to, float t, uint32_t begin, uint32_t end);
+
+	/**
+	 * Sets the transformation of a bone to the interpolation of two bones
+	 * that may be at other positions in their poses, see Interpolate().
+	 * @param from     Pose at t = 0
+	 * @param fromBone Position of the bone in from
+	 * @param to       Pose at t = 1
+	 * @param toBone   Position of the bone in to
+	 * @param t        Interpolation factor
+	 * @param bone     Position of the bone to set
+	 */
+	void InterpolateBone(const W_SKELETAL_POSE& from, uint32_t fromBone, const W_SKELETAL_POSE& to, uint32_t toBone, float t, uint32_t bone);
+};
+
 /**
  * @ingroup engineclass
  * This is the class implementing skeletal animation, as described in
@@ -287,11 +363,42 @@ public:
 								 uint32_t parentSubAnimation = std::numeric_limits<uint32_t>::max());
 
 	/**
-	 * Steps the state of the playing (or looping) subanimations forward. This is
-	 * usually called by the engine during normal execution each frame.
+	 * Steps the state of the playing (or looping) subanimations forward and
+	 * computes the bone matrices of the current pose. The keyframes are only
+	 * read (they may be shared with other skeletons, see
+	 * UseAnimationFrames()), and the pose is kept on the CPU until
+	 * UploadPose() is called.
+	 *
+	 * The pose follows the level of detail picked by
+	 * WAnimationManager::Update() (see W_ANIMATION_LOD):
+	 * * Only the bones up to maxBoneDepth levels deep are sampled, the deeper
+	 * 	bones keep their last local transformation. The bones that objects are
+	 * 	bound to (see BindToBone()) and their ancestors are always sampled.
+	 * * When the pose is evaluated once every updateInterval frames, the
+	 * 	displayed pose (the bone texture and the bound objects) blends from the
+	 * 	previous pose to the newly evaluated one over the following frames, so
+	 * 	it lags behind the animation's time by up to updateInterval frames.
+	 * The subanimations are stepped, and the root position (see
+	 * GetCurrentParentBonePosition()) is updated, every frame regardless.
 	 * @param fDeltaTime step time in seconds
 	 */
-	virtual void Update(float fDeltaTime);
+	virtual void EvaluatePose(float fDeltaTime);
+
+	/**
+	 * Retrieves the number of bones sampled when the pose is evaluated at a
+	 * level of detail.
+	 * @param  lod Level of detail to evaluate the pose at
+	 * @return     Number of sampled bones
+	 */
+	virtual uint32_t GetPoseCost(const W_ANIMATION_LOD& lod) const;
+
+	/**
+	 * Copies the pose computed by EvaluatePose() to the bone texture and sets
+	 * the binding matrices of the objects bound to the bones. The bone
+	 * texture has an image per buffering index, so writing it does not wait
+	 * for the frames in flight.
+	 */
+	virtual void UploadPose();
 
 	/**
 	 * Retrieves the animation texture, as described in WSkeletalAnimation.h
@@ -299,6 +406,13 @@ public:
 	 */
 	virtual WImage* GetTexture() const;
 
+	/**
+	 * Retrieves the bone matrices computed by the last EvaluatePose(), encoded
+	 * the same way as in the animation texture.
+	 * @return The bone matrices of the current pose, indexed by bone index
+	 */
+	const vector<WMatrix>& GetPose() const;
+
 	/**
 	 * Retrieves a pointer to a bone from a frame. Changing the returned bone
 	 * will impact the frame in real-time without any re-initialization.
@@ -411,6 +525,34 @@ public:
 	 */
 	bool Valid() const;
 
+	/**
+	 * Sets whether SaveToStream() compresses the keyframes, and the maximum
+	 * errors the compression may introduce. A compressed skeleton stores the
+	 * bone hierarchy once and a track of keys per bone for the position,
+	 * rotation and scale:
+	 * * A track whose values all stay within the error of the first value is
+	 *   stored as a single key.
+	 * * Otherwise, keys that can be interpolated from the kept keys around
+	 *   them within the error are dropped.
+	 * * Rotations are quantized to 48 bits (the three smallest components of
+	 *   the quaternion), positions and scales to 16 bits per component over
+	 *   the range of their track. The errors are checked before quantization.
+	 * A skeleton whose keyframes don't all have the same bones is always
+	 * saved uncompressed. Both formats can be loaded. Compression is enabled
+	 * by default with the W_SKELETON_DEFAULT_*_ERROR errors.
+	 * @param bCompress      Whether to compress the keyframes when saving
+	 * @param fPositionError Maximum distance between a saved bone position
+	 *                       and the original position
+	 * @param fRotationError Maximum angle (in radians) between a saved bone
+	 *                       rotation and the original rotation
+	 * @param fScaleError    Maximum difference between a saved bone scale
+	 *                       component and the original component
+	 */
+	void SetCompression(bool bCompress,
+						float fPositionError = W_SKELETON_DEFAULT_POSITION_ERROR,
+						float fRotationError = W_SKELETON_DEFAULT_ROTATION_ERROR,
+						float fScaleError = W_SKELETON_DEFAULT_SCALE_ERROR);
+
 	static std::vector<void*> LoadArgs();
 	virtual WError SaveToStream(WFile* file, std::ostream& outputStream);
 	virtual WError LoadFromStream(WFile* file, std::istream& inputStream, std::vector<void*>& args, std::string nameSuffix);
@@ -435,4 +577,122 @@ private:
 	WVector3 m_bindingScale;
 	/** The world-space position of the root of the skeleton */
 	WVector3 m_parentBonePos;
+	/**
+	 * Maps the bones of the first keyframe (the order of the bones in the
+	 * pose) to their positions in another keyframe.
+	 */
+	struct BONE_MAP {
+		/** Position in the keyframe of every bone of the pose, MAX if the
+		 *  keyframe doesn't have the bone */
+		vector<uint32_t> positions;
+		/** Whether every bone is at its own position */
+		bool bIdentity;
+	};
+
+	/** Bone map of every keyframe */
+	vector<BONE_MAP> m_boneMaps;
+	/** Whether SaveToStream() compresses the keyframes */
+	bool m_bCompress;
+	/** Maximum position error of the compression */
+	float m_compressionPositionError;
+	/** Maximum rotation error of the compression */
+	float m_compressionRotationError;
+	/** Maximum scale error of the compression */
+	float m_compressionScaleError;
+	/** Encoded bone matrices of the current pose, indexed by bone index */
+	vector<WMatrix> m_pose;
+	/** Binding matrices of the current pose (before m_bindingScale), indexed
+	 *  by bone index */
+	vector<WMatrix> m_bindingPose;
+	/** Encoded bone matrices of the last evaluated pose, which m_pose blends
+	 *  to */
+	vector<WMatrix> m_targetPose;
+	/** Binding matrices of the last evaluated pose */
+	vector<WMatrix> m_targetBindingPose;
+	/** Encoded bone matrices that m_pose blends from (m_pose when the last
+	 *  pose was evaluated) */
+	vector<WMatrix> m_previousPose;
+	/** Binding matrices that m_bindingPose blends from */
+	vector<WMatrix> m_previousBindingPose;
+	/** Blend factor of m_pose between m_previousPose and m_targetPose */
+	float m_poseBlend;
+	/** Amount m_poseBlend advances every frame */
+	float m_poseBlendStep;
+	/** Depth in the hierarchy of every bone (0 for the root), in keyframe
+	 *  order */
+	vector<uint32_t> m_boneDepths;
+	/** Whether every bone (in keyframe order) is sampled by the current
+	 *  evaluation */
+	vector<uint8_t> m_sampledBones;
+	/** Local transformations of the bones in the current pose, sampled from
+	 *  the keyframes of the subanimations */
+	W_SKELETAL_POSE m_localPose;
+	/** Scratch pose used to sample the ancestors of subanimation base bones */
+	W_SKELETAL_POSE m_ancestorsPose;
+	/** Model-space matrices of the bones in the current pose, in keyframe
+	 *  order */
+	vector<WMatrix> m_modelPose;
+	/** Index in m_parentOverrideMatrices of the matrix to use instead of the
+	 *  parent's model matrix for every bone, MAX to use the parent's */
+	vector<uint32_t> m_parentOverrides;
+	/** Parent matrices of the subanimation base bones that don't follow the
+	 *  pose of their parent bone */
+	vector<WMatrix> m_parentOverrideMatrices;
+
+	/**
+	 * Builds the bone map of a keyframe against the first keyframe.
+	 * @param  frame Index of the keyframe
+	 * @return       The bone map of the keyframe
+	 */
+	BONE_MAP _BuildBoneMap(uint32_t frame) const;
+
+	/**
+	 * Rebuilds the bone maps of all the keyframes and the bone positions of
+	 * the subanimations. This must be called when the first keyframe changes.
+	 */
+	void _BuildBoneMaps();
+
+	/**
+	 * Builds W_SKELETAL_SUB_ANIMATION::bonePositions of a subanimation.
+	 * @param subAnim Subanimation to build its bone positions
+	 */
+	void _BuildBonePositions(W_SKELETAL_SUB_ANIMATION* subAnim) const;
+
+	/**
+	 * Fills m_sampledBones for the current level of detail.
+	 */
+	void _UpdateSampledBones();
+
+	/**
+	 * Advances m_poseBlend and blends m_pose and m_bindingPose between the
+	 * previous and the last evaluated poses.
+	 */
+	void _BlendPose();
+
+	/**
+	 * Samples a bone of the pose from the current and next keyframes of a
+	 * subanimation into a pose. A bone missing from a keyframe is taken from
+	 * the first keyframe.
+	 * @param out        Pose to write the bone to
+	 * @param curFrame   Index of the current keyframe
+	 * @param nextFrame  Index of the next keyframe
+	 * @param fLerpValue Interpolation factor between the keyframes
+	 * @param bone       Position of the bone in the pose
+	 */
+	void _SampleBone(W_SKELETAL_POSE& out, uint32_t curFrame, uint32_t nextFrame, float fLerpValue, uint32_t bone) const;
+
+	/**
+	 * Saves the keyframes in the compressed format, see SetCompression().
+	 * @param  outputStream Stream to write to
+	 * @return              Error code, see WError.h, W_NOTVALID if the
+	 *                      keyframes can't be compressed (nothing is written)
+	 */
+	WError _SaveCompressed(std::ostream& outputStream);
+
+	/**
+	 * Loads keyframes saved by _SaveCompressed() and creates them.
+	 * @param  inputStream Stream to read from, after the format marker
+	 * @return             Error code, see WError.h
+	 */
+	WError _LoadCompressed(std::istream& inputStream);
 };
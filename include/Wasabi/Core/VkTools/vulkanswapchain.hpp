@@ -84,6 +84,9 @@ public:
 
 	VkSwapchainKHR swapChain = VK_NULL_HANDLE;
 
+	// Present mode the swap chain was created with
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+
 	uint32_t imageCount;
 	std::vector<VkImage> images;
 	std::vector<SwapChainBuffer> buffers;
@@ -209,7 +212,9 @@ public:
 	}
 
 	// Create the swap chain and get images with given width and height
-	void create(VkCommandBuffer cmdBuffer, uint32_t *width, uint32_t *height, uint32_t numDesiredSwapchainImages = std::numeric_limits<uint32_t>::max())
+	// If requestedPresentMode is VK_PRESENT_MODE_MAX_ENUM_KHR, the lowest latency mode is picked, otherwise the
+	// requested mode is used if the surface supports it (FIFO is used if not, it is always supported)
+	void create(VkCommandBuffer cmdBuffer, uint32_t *width, uint32_t *height, uint32_t numDesiredSwapchainImages = std::numeric_limits<uint32_t>::max(), VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_MAX_ENUM_KHR)
 	{
 		VkResult err;
 		VkSwapchainKHR oldSwapchain = swapChain;
@@ -247,20 +252,35 @@ public:
 			*height = surfCaps.currentExtent.height;
 		}
 
-		// Prefer mailbox mode if present, it's the lowest latency non-tearing present  mode
 		VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-		for (size_t i = 0; i < presentModeCount; i++)
+		if (requestedPresentMode != VK_PRESENT_MODE_MAX_ENUM_KHR)
 		{
-			if (presentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
+			for (size_t i = 0; i < presentModeCount; i++)
 			{
-				swapchainPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-				break;
+				if (presentModes[i] == requestedPresentMode)
+				{
+					swapchainPresentMode = requestedPresentMode;
+					break;
+				}
 			}
-			if ((swapchainPresentMode != VK_PRESENT_MODE_MAILBOX_KHR) && (presentModes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR))
+		}
+		else
+		{
+			// Prefer mailbox mode if present, it's the lowest latency non-tearing present  mode
+			for (size_t i = 0; i < presentModeCount; i++)
 			{
-				swapchainPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+				if (presentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
+				{
+					swapchainPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+					break;
+				}
+				if ((swapchainPresentMode != VK_PRESENT_MODE_MAILBOX_KHR) && (presentModes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR))
+				{
+					swapchainPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+				}
 			}
 		}
+		presentMode = swapchainPresentMode;
 
 		// Determine the number of images
 		uint32_t desiredNumberOfSwapchainImages = numDesiredSwapchainImages;
@@ -16,6 +16,7 @@
 #include <map>
 #include <unordered_map>
 #include <array>
+#include <algorithm>
 #include <chrono>
 
 #include "Wasabi/Core/WError.hpp"
@@ -40,3 +40,24 @@
 #define VK_USE_PLATFORM_XCB_KHR
 #endif
 #endif
+
+/**
+ * SIMD instruction sets. W_X86 is 1 when compiling for x86, where functions
+ * that use the intrinsics of an instruction set above the build's baseline
+ * are marked with its W_TARGET_* macro (GCC and Clang only allow them in
+ * functions compiled for it, MSVC allows them anywhere) and are only called
+ * when WUtil::CPUSupportsSSE41() or WUtil::CPUSupportsAVX2() says so.
+ */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define W_X86 1
+#else
+#define W_X86 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define W_TARGET_SSE41
+#define W_TARGET_AVX2
+#else
+#define W_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define W_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
@@ -19,6 +19,8 @@
 #include "Wasabi/Core/WBase.hpp"
 #include "Wasabi/Core/WOrientation.hpp"
 #include "Wasabi/Core/WUtilities.hpp"
+#include "Wasabi/Core/WFramePacer.hpp"
+#include "Wasabi/Core/WThreadPool.hpp"
 #include "Wasabi/Files/WFile.hpp"
 #include "Wasabi/Files/WAssimpImporter.hpp"
 #include "Wasabi/Memory/WVulkanMemoryManager.hpp"
@@ -26,6 +28,9 @@
 #include "Wasabi/Memory/WBufferedImage.hpp"
 #include "Wasabi/Memory/WBufferedFrameBuffer.hpp"
 
+#include <cstring>
+#include <type_traits>
+
 #define W_ENGINE_NAME "Wasabi"
 
 #define W_SAFE_REMOVEREF(x) { if (x) { (x)->RemoveReference(); x = nullptr; } }
@@ -48,12 +53,34 @@ public:
 		auto it = engineParams.find(paramName);
 		if (it == engineParams.end())
 			return fallback;
-		return (T)(reinterpret_cast<size_t>(it->second));
+		if constexpr (std::is_floating_point<T>::value) {
+			// floating point parameters hold the bits of a float (see FloatEngineParam())
+			uint32_t bits = (uint32_t)reinterpret_cast<size_t>(it->second);
+			float value;
+			memcpy(&value, &bits, sizeof(float));
+			return (T)value;
+		} else
+			return (T)(reinterpret_cast<size_t>(it->second));
 	}
 
 	template<typename T>
 	void SetEngineParam(std::string paramName, T value) {
-		engineParams[paramName] = reinterpret_cast<void*>((size_t)(value));
+		if constexpr (std::is_floating_point<T>::value)
+			engineParams[paramName] = FloatEngineParam((float)value);
+		else
+			engineParams[paramName] = reinterpret_cast<void*>((size_t)(value));
+	}
+
+	/**
+	 * Packs a floating point value into an engine parameter, which can then
+	 * be read with GetEngineParam<float>().
+	 * @param  value Value of the parameter
+	 * @return       The engine parameter holding value
+	 */
+	static void* FloatEngineParam(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(float));
+		return reinterpret_cast<void*>((size_t)bits);
 	}
 
 	/** Pointer to the vulkan memory manager */
@@ -100,6 +127,10 @@ public:
 
 	/** A timer object, which starts counting when the application starts */
 	WTimer Timer;
+	/** Limits the frame rate to maxFPS and measures the frame times */
+	WFramePacer FramePacer;
+	/** Worker threads used to split the engine's per-frame work */
+	WThreadPool ThreadPool;
 
 	/** Current FPS, set by the engine */
 	float FPS;
@@ -207,12 +238,39 @@ public:
 	 */
 	VkDevice GetVulkanDevice() const;
 
+	/**
+	 * Retrieves the features that the virtual device was created with (see
+	 * GetDeviceFeatures()).
+	 * @return The enabled Vulkan features
+	 */
+	VkPhysicalDeviceFeatures GetEnabledDeviceFeatures() const;
+
 	/**
 	 * Retrieves the currently used Vulkan graphics queue.
 	 * @return The Vulkan graphics queue
 	 */
 	VkQueue GetVulkanGraphicsQeueue() const;
 
+	/**
+	 * Retrieves the queue used for asynchronous compute work, created when
+	 * the engine parameter "asyncCompute" is set and the device has more than
+	 * one queue that supports compute.
+	 * @return The Vulkan compute queue, VK_NULL_HANDLE if compute work runs on
+	 *         the graphics queue
+	 */
+	VkQueue GetVulkanComputeQueue() const;
+
+	/**
+	 * @return The queue family index of the graphics queue
+	 */
+	uint32_t GetVulkanGraphicsQueueFamily() const;
+
+	/**
+	 * @return The queue family index of the compute queue (the graphics queue
+	 *         family if there is no separate compute queue)
+	 */
+	uint32_t GetVulkanComputeQueueFamily() const;
+
 	/**
 	 * Retrieves the currently used swap chain.
 	 * @return The swap chain
@@ -238,7 +296,9 @@ protected:
 
 	/**
 	 * Can be overloaded by the application. This function should return the
-	 * Vulkan features required by the application.
+	 * Vulkan features required by the application. The default features
+	 * include depthBounds if the device supports it (used by
+	 * WLightBufferRenderStage).
 	 */
 	virtual VkPhysicalDeviceFeatures GetDeviceFeatures();
 
@@ -295,8 +355,16 @@ protected:
 	VkPhysicalDevice m_vkPhysDev;
 	/** The used Vulkan virtual device */
 	VkDevice m_vkDevice;
+	/** Features enabled on m_vkDevice */
+	VkPhysicalDeviceFeatures m_vkFeatures;
 	/** The used graphics queue */
 	VkQueue m_graphicsQueue;
+	/** The queue used for asynchronous compute, VK_NULL_HANDLE if none */
+	VkQueue m_computeQueue;
+	/** Queue family of m_graphicsQueue */
+	uint32_t m_graphicsQueueFamily;
+	/** Queue family of m_computeQueue */
+	uint32_t m_computeQueueFamily;
 	/** The swap chain */
 	VulkanSwapChain m_swapChain;
 	/** true if the swap chain has been initialized yet, false otherwise */
@@ -328,6 +396,93 @@ protected:
 	 * 		attributes). Default is (void*)(false).
 	 * * "numGeneratedMips": Number of mipmaps to generate when a new image is
 	 * 		crated. Default is (void*)(1).
+	 * * "maxSceneObjects": Maximum number of entries in the renderer's scene
+	 * 		objects buffer (one per WObject). Default is (void*)(16384).
+	 * * "maxRenderTargets": Maximum number of render targets that can begin
+	 * 		rendering, each one holds the global per-frame data of its camera
+	 * 		(see WRenderer::GetGlobalFrameOffset()). Default is (void*)(128).
+	 * * "dynamicResolution": When set to true, the render stages flagged with
+	 * 		RENDER_STAGE_FLAG_DYNAMIC_RESOLUTION render to a scaled portion of
+	 * 		their targets, the scale is picked every frame from the measured GPU
+	 * 		frame time (see WRenderer::GetResolutionScale()). This has to be set
+	 * 		before the renderer's stages are created. Default is (void*)(false).
+	 * * "targetGPUFrameTime": GPU frame time (in milliseconds) the dynamic
+	 * 		resolution scale aims for. Default is (void*)(16).
+	 * * "minResolutionScale": Lowest dynamic resolution scale, in percent of
+	 * 		the screen size. Default is (void*)(50).
+	 * * "presentMode": VkPresentModeKHR of the swap chain, see
+	 * 		WRenderer::SetPresentMode(). Default is
+	 * 		(void*)(VK_PRESENT_MODE_MAX_ENUM_KHR) (lowest latency mode available).
+	 * * "frameJitterBound": How early (in microseconds) a frame may end when
+	 * 		the frame rate is capped by maxFPS, see WFramePacer. Lower values
+	 * 		spin more to reduce the frame time jitter. Default is (void*)(1000).
+	 * * "asyncCompute": When set to true, the engine creates a separate queue
+	 * 		for the compute work of the render stages (see
+	 * 		WRenderStage::RecordCompute()) so it can overlap with rendering. If
+	 * 		the device has no second queue, the compute work is recorded on the
+	 * 		graphics queue. Default is (void*)(false).
+	 * * "numWorkerThreads": Number of worker threads of the ThreadPool, which
+	 * 		evaluates the animations in parallel (see WAnimationManager::Update()),
+	 * 		builds the pipelines submitted by WEffect::BuildPipelineAsync() and
+	 * 		creates the shader modules of WShaderManager::LoadShaders(). 0 picks
+	 * 		one less than the number of hardware threads. Default is (void*)(0).
+	 * * "animationLOD": Whether the animations are updated at a lower rate and
+	 * 		detail when their objects are small on the screen or not rendered
+	 * 		(see WAnimationManager::Update()). Default is (void*)(true).
+	 * * "animationLODFullRateSize": Percentage of the screen's height at or
+	 * 		above which an animated object is updated every frame. Default is
+	 * 		(void*)(25).
+	 * * "animationLODMaxInterval": Largest number of frames between two
+	 * 		evaluations of an animation, used for the animations of objects
+	 * 		that are not rendered. Default is (void*)(8).
+	 * * "animationLODBoneDepthSize": Percentage of the screen's height below
+	 * 		which an animated object only samples the bones up to
+	 * 		"animationLODBoneDepth" levels deep. Default is (void*)(5).
+	 * * "animationLODBoneDepth": Deepest level of the bone hierarchy (0 for
+	 * 		the root) that small or hidden animated objects sample. Default is
+	 * 		(void*)(4).
+	 * * "animationBoneBudget": Largest number of bones that the animations
+	 * 		may sample in a frame (see WAnimation::GetPoseCost()), 0 for no
+	 * 		limit. Default is (void*)(0).
+	 * * "maxLights": Maximum number of lights that the forward and clustered
+	 * 		deferred lighting render at once (see WLightClusters). This has to
+	 * 		be set before the renderer's stages are created. Default is
+	 * 		(void*)(1024).
+	 * * "computeLightClusters": Whether the light clusters of the forward and
+	 * 		clustered deferred lighting are filled in a compute pass rather
+	 * 		than on the CPU (the lights are culled on the CPU either way).
+	 * 		This has to be set before the renderer's stages are created.
+	 * 		Default is (void*)(false).
+	 * * "forwardDepthPrepass": Whether WForwardRenderStage renders the depth
+	 * 		of the objects and terrains that use its default effects before
+	 * 		shading them. Default is (void*)(false).
+	 * * "clusteredDeferredLighting": Whether WLightBufferRenderStage
+	 * 		accumulates all lights in a single full-screen pass using the
+	 * 		clustered light lists, instead of rendering a light volume per
+	 * 		light. This has to be set before the renderer's stages are
+	 * 		created. Default is (void*)(true).
+	 * * "tiledDeferredLighting": Whether WLightBufferRenderStage accumulates
+	 * 		all lights in a compute pass over screen tiles, which culls the
+	 * 		lights against the depth bounds of every tile. Takes precedence
+	 * 		over "clusteredDeferredLighting". This has to be set before the
+	 * 		renderer's stages are created. Default is (void*)(false).
+	 * * "shadowAtlasSize": Width and height of the shadow atlas of
+	 * 		WShadowRenderStage. Default is (void*)(4096).
+	 * * "shadowTileSize": Width and height of a tile in the shadow atlas.
+	 * 		Default is (void*)(1024).
+	 * * "shadowCascades": Number of shadow cascades of directional lights.
+	 * 		Default is (void*)(3).
+	 * * "shadowDistance": View distance covered by the shadow cascades, a
+	 * 		float (see FloatEngineParam()). Default is 100.0f.
+	 * * "maxShadowTileUpdates": Maximum number of shadow tiles rendered per
+	 * 		frame. Default is (void*)(4).
+	 * * "computeSkinning": Whether the forward and deferred renderers skin the
+	 * 		animated objects once per frame in a compute pass (see
+	 * 		WSkinningRenderStage). This has to be set before the renderer's
+	 * 		stages are created. Default is (void*)(false).
+	 * * "maxSkinnedVertices": Maximum number of vertices skinned per frame by
+	 * 		WSkinningRenderStage, the vertices of the other animated objects
+	 * 		are skinned in the vertex shaders. Default is (void*)(262144).
 	 */
 	std::map<std::string, void*> engineParams;
 
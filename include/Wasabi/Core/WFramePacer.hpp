@@ -0,0 +1,126 @@
+/** @file WFramePacer.hpp
+ *  @brief Frame rate limiting and frame time statistics
+ *
+ *  @author Hasan Al-Jawaheri (hbj)
+ *  @bug No known bugs.
+ */
+
+#pragma once
+
+#include "Wasabi/Core/WCommon.hpp"
+
+/** Number of frames the frame pacing statistics are computed over */
+#define W_FRAME_PACER_HISTORY 120
+
+/**
+ * Frame time statistics of the last W_FRAME_PACER_HISTORY frames, all times
+ * are in milliseconds.
+ */
+struct W_FRAME_PACING_STATS {
+	/** Number of frames the statistics were computed over */
+	uint32_t numFrames;
+	/** Average time between two frames */
+	float averageFrameTime;
+	/** Shortest time between two frames */
+	float minFrameTime;
+	/** Longest time between two frames */
+	float maxFrameTime;
+	/** Standard deviation of the time between two frames */
+	float frameTimeJitter;
+	/** Average time spent working on a frame (before waiting) */
+	float averageWorkTime;
+	/** Average time spent sleeping to meet the frame rate cap */
+	float averageSleepTime;
+	/** Average time spent spinning to meet the frame rate cap */
+	float averageSpinTime;
+	/** Average time by which the frames missed their deadline (late or early) */
+	float averageDeadlineError;
+	/** Current estimate of how late the OS wakes up from a sleep */
+	float sleepOvershoot;
+};
+
+/**
+ * @ingroup engineclass
+ *
+ * Limits the frame rate of the engine's loop (see Wasabi::maxFPS) without
+ * keeping a core busy. Every frame gets a deadline (one frame period after the
+ * previous deadline) and the pacer waits for it in two steps:
+ * * It sleeps until the deadline minus the time the OS is expected to
+ *   oversleep by. That estimate is measured when the pacer starts and is then
+ *   updated from every sleep.
+ * * If the time left after waking up is within the engine parameter
+ *   "frameJitterBound" (in microseconds), the frame ends early by at most that
+ *   much. Otherwise the pacer yields in a loop until the deadline.
+ * A large "frameJitterBound" never spins (lowest CPU usage), a bound of 0
+ * spins for the last stretch of every frame (lowest jitter).
+ *
+ * On Windows, the system timer resolution is raised to 1ms while the pacer is
+ * running.
+ */
+class WFramePacer {
+public:
+	WFramePacer(class Wasabi* const app);
+	~WFramePacer();
+
+	/**
+	 * Calibrates the sleep overshoot and starts timing frames. This is called
+	 * by the engine before the first frame.
+	 */
+	void Start();
+
+	/**
+	 * Stops the pacer. This is called by the engine after the last frame.
+	 */
+	void Stop();
+
+	/**
+	 * Ends the current frame: waits for its deadline if maxFPS is set, then
+	 * records the frame's statistics. This is called by the engine at the end
+	 * of every frame.
+	 * @param  maxFPS Maximum frame rate, 0 to not wait
+	 * @return        Time since the previous frame ended, in seconds
+	 */
+	float EndFrame(float maxFPS);
+
+	/**
+	 * Retrieves the frame time statistics of the last W_FRAME_PACER_HISTORY
+	 * frames.
+	 * @return The frame pacing statistics
+	 */
+	W_FRAME_PACING_STATS GetStatistics() const;
+
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	/** Timings of a frame, in seconds */
+	struct FRAME_TIMES {
+		double frameTime;
+		double workTime;
+		double sleepTime;
+		double spinTime;
+		double deadlineError;
+	};
+
+	/** Pointer to the Wasabi application */
+	class Wasabi* m_app;
+	/** Whether Start() was called */
+	bool m_started;
+	/** Time at which the last frame ended */
+	Clock::time_point m_lastFrameEnd;
+	/** Deadline of the last frame */
+	Clock::time_point m_lastDeadline;
+	/** Estimate of how late the OS wakes up from a sleep (in seconds) */
+	double m_sleepOvershoot;
+	/** Ring buffer of the timings of the last frames */
+	std::array<FRAME_TIMES, W_FRAME_PACER_HISTORY> m_history;
+	/** Number of valid entries in m_history */
+	uint32_t m_historySize;
+	/** Index of the next entry to write in m_history */
+	uint32_t m_historyIndex;
+
+	/**
+	 * Sleeps and records how late the OS woke up.
+	 * @param seconds Time to sleep
+	 */
+	void _Sleep(double seconds);
+};
@@ -862,6 +862,21 @@ WMatrix WRotationMatrixZ(const float fAngle);
  */
 WMatrix WRotationMatrixAxis(const WVector3 axis, const float fAngle);
 
+/**
+ * Creates a matrix that performs the rotation of a quaternion.
+ * @param  q Rotation quaternion (normalized)
+ * @return   The resulting matrix
+ */
+WMatrix WRotationMatrixQuaternion(const WQuaternion q);
+
+/**
+ * Computes the quaternion of a rotation matrix.
+ * @param  m Matrix whose upper 3x3 part is a rotation (no scaling or
+ *           mirroring)
+ * @return   The rotation quaternion of m
+ */
+WQuaternion WQuaternionRotationMatrix(const WMatrix m);
+
 /**
  * Creates a matrix that performs scaling.
  * @param  fX Scaling on the X axis
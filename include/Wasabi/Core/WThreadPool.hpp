@@ -0,0 +1,136 @@
+/** @file WThreadPool.hpp
+ *  @brief Worker threads for data-parallel engine work
+ *
+ *  @author Hasan Al-Jawaheri (hbj)
+ *  @bug No known bugs.
+ */
+
+#pragma once
+
+#include "Wasabi/Core/WCommon.hpp"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+/**
+ * @ingroup engineclass
+ *
+ * A set of worker threads that the engine uses to split per-frame work (like
+ * evaluating the animations) across the CPU cores. The work is given as a
+ * range of indices that is cut into batches, the batches are picked up by the
+ * workers and by the calling thread until none are left. Longer background
+ * work (like building pipelines) is given as tasks with Submit(), which the
+ * workers run when they have no batches to run.
+ *
+ * The workers are created the first time they are needed, their number is
+ * the engine parameter "numWorkerThreads" (0 picks one less than the number
+ * of hardware threads).
+ */
+class WThreadPool {
+public:
+	WThreadPool(class Wasabi* const app);
+	~WThreadPool();
+
+	/**
+	 * Calls func on batches of the range [0, count) and returns when all the
+	 * batches are done. The batches run concurrently on the workers and the
+	 * calling thread, so func must only write to data that belongs to the
+	 * indices it is given. Calls made from a worker (from inside another
+	 * ParallelFor()) and calls with a single batch run on the calling thread.
+	 * @param count     Number of indices to run
+	 * @param batchSize Number of consecutive indices given to func at once
+	 * @param func      Function to call with the range [begin, end) of every
+	 *                  batch
+	 */
+	void ParallelFor(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t begin, uint32_t end)>& func);
+
+	/**
+	 * Queues a task to run on one of the workers and returns right away. The
+	 * tasks run in the order they are submitted, whenever a worker is not
+	 * running the batches of a ParallelFor(). The caller is responsible for
+	 * waiting for its tasks. If there are no workers, the task runs on the
+	 * calling thread before this returns.
+	 * @param task Task to run, called with the index of the thread running it
+	 *             (see GetThreadIndex())
+	 */
+	void Submit(std::function<void(uint32_t threadIndex)> task);
+
+	/**
+	 * Retrieves the index of the calling thread, which is in the range
+	 * [0, GetNumThreads()). The workers have the indices 1 and above, any
+	 * other thread has the index 0.
+	 * @return Index of the calling thread
+	 */
+	static uint32_t GetThreadIndex();
+
+	/**
+	 * Retrieves the number of threads that run the batches of a ParallelFor()
+	 * (the workers and the calling thread). This creates the workers if they
+	 * were not created yet.
+	 * @return Number of threads that run the batches
+	 */
+	uint32_t GetNumThreads();
+
+	/**
+	 * Stops and joins the workers, after they run the tasks that are still
+	 * queued. This is called by the engine when it is destroyed.
+	 */
+	void Stop();
+
+private:
+	/** Pointer to the Wasabi application */
+	class Wasabi* m_app;
+	/** The worker threads */
+	std::vector<std::thread> m_threads;
+	/** Whether the workers were created */
+	bool m_started;
+	/** Set to true to make the workers exit */
+	bool m_stop;
+	/** Serializes the ParallelFor() calls of different threads */
+	std::mutex m_callMutex;
+	/** Protects the creation of the workers */
+	std::mutex m_startMutex;
+	/** Protects the current job, the number of busy workers and the tasks */
+	std::mutex m_mutex;
+	/** Signaled when a job or a task is submitted or the workers need to
+	    stop */
+	std::condition_variable m_jobSubmittedCV;
+	/** Signaled when a worker is done with the current job */
+	std::condition_variable m_jobDoneCV;
+	/** Incremented for every job, so the workers can tell new jobs apart */
+	uint64_t m_jobGeneration;
+	/** Function of the current job */
+	const std::function<void(uint32_t, uint32_t)>* m_jobFunc;
+	/** Number of indices of the current job */
+	uint32_t m_jobCount;
+	/** Batch size of the current job */
+	uint32_t m_jobBatchSize;
+	/** First index of the next batch to run */
+	std::atomic<uint32_t> m_nextIndex;
+	/** Number of workers running batches of the current job */
+	uint32_t m_numBusyWorkers;
+	/** Tasks submitted by Submit() that no worker picked up yet */
+	std::deque<std::function<void(uint32_t)>> m_tasks;
+
+	/**
+	 * Creates the workers, if not already created.
+	 * @return Number of workers
+	 */
+	uint32_t _Start();
+
+	/**
+	 * Main function of a worker thread.
+	 * @param threadIndex Index of the worker, see GetThreadIndex()
+	 */
+	void _WorkerMain(uint32_t threadIndex);
+
+	/**
+	 * Runs the next batch of the current job.
+	 * @return false if no batches were left, true otherwise
+	 */
+	bool _RunBatch();
+};
@@ -61,4 +61,17 @@ namespace WUtil {
 	 * Returns a linear interpolation between x and y at factor f
 	 */
 	float flerp(float x, float y, float f);
+
+	/**
+	 * Checks if the CPU supports the SSE4.1 instructions (see W_TARGET_SSE41).
+	 * @return true if SSE4.1 is supported, always false on non-x86 CPUs
+	 */
+	bool CPUSupportsSSE41();
+
+	/**
+	 * Checks if the CPU supports the AVX2 instructions and the OS saves the
+	 * AVX registers (see W_TARGET_AVX2).
+	 * @return true if AVX2 is usable, always false on non-x86 CPUs
+	 */
+	bool CPUSupportsAVX2();
 };
\ No newline at end of file
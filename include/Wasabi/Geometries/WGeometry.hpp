@@ -599,6 +599,58 @@ public:
 	 */
 	WError Draw(class WRenderTarget* rt, uint32_t numIndices = std::numeric_limits<uint32_t>::max(), uint32_t numInstances = 1, bool bindAnimation = true);
 
+	/**
+	 * Draws the geometry's indices using another buffer as the vertex buffer
+	 * (bound to slot 0, no animation buffer is bound). This is used to draw
+	 * vertices that were transformed on the GPU, like the vertices skinned
+	 * by WSkinningRenderStage. The render target must have its Begin()
+	 * function called before this function is called.
+	 * @param  rt            Render target to draw to
+	 * @param  vertexBuffer  Buffer holding GetNumVertices() vertices in the
+	 *                       layout of GetVertexDescription(0)
+	 * @param  vertexOffset  Offset of the first vertex in vertexBuffer
+	 * @param  numIndices    Number of indices to draw, MAX for all. If the
+	 *                       geometry has no indices, this is the number of
+	 *                       vertices to draw, MAX for all
+	 * @param  numInstances  Number of instances to draw
+	 * @return               Error code, see WError.h
+	 */
+	WError DrawWithVertexBuffer(class WRenderTarget* rt, VkBuffer vertexBuffer, VkDeviceSize vertexOffset, uint32_t numIndices = std::numeric_limits<uint32_t>::max(), uint32_t numInstances = 1);
+
+	/**
+	 * Draws the geometry with the draw parameters read from a buffer, so the
+	 * number of instances can be decided on the GPU (like the particles
+	 * simulated by WParticles in compute shaders). The buffers are bound like
+	 * in Draw(). The render target must have its Begin() function called
+	 * before this function is called.
+	 * @param  rt             Render target to draw to
+	 * @param  argsBuffer     Buffer holding a VkDrawIndexedIndirectCommand if
+	 *                        the geometry has indices, a
+	 *                        VkDrawIndirectCommand otherwise. It must be
+	 *                        created with VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+	 * @param  argsOffset     Offset of the draw parameters in argsBuffer
+	 * @param  bindAnimation  true to bind the animation buffer (if
+	 *                        available), false otherwise
+	 * @return                Error code, see WError.h
+	 */
+	WError DrawIndirect(class WRenderTarget* rt, VkBuffer argsBuffer, VkDeviceSize argsOffset = 0, bool bindAnimation = false);
+
+	/**
+	 * Retrieves the vertex buffer of the geometry. The buffer can also be
+	 * bound as a storage buffer (W_TYPE_STORAGE_BUFFER) to read the vertices
+	 * in a compute shader.
+	 * @return The vertex buffer
+	 */
+	WBufferedBuffer* GetVertexBuffer();
+
+	/**
+	 * Retrieves the animation buffer of the geometry, which is not valid if
+	 * the geometry is not rigged (see IsRigged()). Like the vertex buffer, it
+	 * can be bound as a storage buffer.
+	 * @return The animation buffer
+	 */
+	WBufferedBuffer* GetAnimationBuffer();
+
 	/**
 	 * Retrieves the point that represents the minimum boundary of the geometry.
 	 * @return The minimum boundary for the geometry
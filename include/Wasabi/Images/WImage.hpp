@@ -18,6 +18,13 @@ enum W_IMAGE_CREATE_FLAGS: uint32_t {
 	W_IMAGE_CREATE_DYNAMIC = 2,
 	W_IMAGE_CREATE_REWRITE_EVERY_FRAME = 4,
 	W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT = 8,
+	/** The image can be read as an input attachment by a later subpass of the render pass it is rendered in */
+	W_IMAGE_CREATE_INPUT_ATTACHMENT = 16,
+	/** The image is a render target attachment whose contents never leave the render pass (it cannot be sampled,
+	 *  copied to or mapped). It is backed by lazily allocated memory when the device supports it */
+	W_IMAGE_CREATE_TRANSIENT_ATTACHMENT = 32,
+	/** The image can be bound as a storage image (W_TYPE_STORAGE_IMAGE) and written by compute shaders */
+	W_IMAGE_CREATE_STORAGE = 64,
 };
 
 inline W_IMAGE_CREATE_FLAGS operator | (W_IMAGE_CREATE_FLAGS lhs, W_IMAGE_CREATE_FLAGS rhs) {
@@ -215,6 +222,28 @@ public:
 	 */
 	void TransitionLayoutTo(VkCommandBuffer cmdBuf, VkImageLayout newLayout);
 
+	/**
+	 * Changes the tracked layout of the currently buffered image without
+	 * recording anything. This should be used when the layout of the image is
+	 * changed by something else, such as the subpasses of a render pass.
+	 * @param layout The current Vulkan layout of the underlying image
+	 */
+	void SetViewLayout(VkImageLayout layout);
+
+	/**
+	 * Changes the tracked layout of the currently buffered image without
+	 * recording anything, and returns the barrier that performs the transition.
+	 * The access masks of the barrier are left empty for the caller to fill,
+	 * which allows batching the transitions of several images in a single
+	 * vkCmdPipelineBarrier.
+	 * @param  newLayout       New Vulkan layout for the underlying image
+	 * @param  discardContents If true, the barrier transitions from
+	 *                         VK_IMAGE_LAYOUT_UNDEFINED and the current contents
+	 *                         of the image may be lost
+	 * @return                 The layout transition barrier
+	 */
+	VkImageMemoryBarrier GetLayoutTransitionBarrier(VkImageLayout newLayout, bool discardContents = false);
+
 	/**
 	 * Retrieves the Vulkan format used for this image.
 	 * @return The format of the image
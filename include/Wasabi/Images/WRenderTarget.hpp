@@ -20,6 +20,21 @@
 
 #include "Wasabi/Core/WCore.hpp"
 
+/**
+ * Description of a subpass of a render target (see
+ * WRenderTarget::SetSubpasses()). Attachments are referred to by their index as
+ * supplied to WRenderTarget::Create(), the depth attachment being the last one.
+ */
+struct W_RENDER_TARGET_SUBPASS {
+	/** Indices of the color attachments the subpass renders to */
+	std::vector<uint32_t> colorOutputs;
+	/** Indices of the attachments the subpass reads as input attachments. If
+	    the depth attachment is read, it is read-only in the subpass */
+	std::vector<uint32_t> inputs;
+	/** Whether the subpass uses the depth attachment for depth testing */
+	bool depthOutput;
+};
+
 /**
  * @ingroup engineclass
  *
@@ -30,6 +45,7 @@
  */
 class WRenderTarget : public WBase {
 	friend class WRenderTargetManager;
+	friend class WRenderer;
 
 protected:
 	virtual ~WRenderTarget();
@@ -105,7 +121,10 @@ public:
 				  VkFormat colorFormat, VkFormat depthFormat);
 
 	/**
-	 * Begin recording renders on this render target.
+	 * Begin recording renders on this render target. This writes the global
+	 * per-frame data of the render target's camera (see
+	 * WRenderer::GetGlobalFrameOffset()), which is read by the effects rendered
+	 * until End(), so the camera should not change in between.
 	 * @return Error code, see WError.h
 	 */
 	WError Begin();
@@ -143,6 +162,60 @@ public:
 	 */
 	void SetClearColor(WColor col, uint32_t index = 0);
 
+	/**
+	 * Sets whether or not the attachments keep their previous contents when
+	 * Begin() is called instead of being cleared. This only takes effect on the
+	 * next call to Create() that uses WImage targets. Regions that need clearing
+	 * can be cleared with vkCmdClearAttachments.
+	 * @param preserve true to load the previous contents, false to clear
+	 */
+	void SetPreserveContents(bool preserve);
+
+	/**
+	 * Sets whether the depth attachment is only tested against, never written.
+	 * A read-only depth attachment is loaded instead of cleared and stays in
+	 * VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, so the depth image can
+	 * also be sampled while the render target renders (e.g. to test light
+	 * volumes against the depth of a G-buffer that their shaders also read).
+	 * This only takes effect on the next call to Create() that uses WImage
+	 * targets.
+	 * @param readOnly true to make the depth attachment read-only
+	 */
+	void SetReadOnlyDepth(bool readOnly);
+
+	/**
+	 * Splits the render pass of the render target into subpasses. Later
+	 * subpasses can read the attachments rendered by the earlier ones as input
+	 * attachments (at the same pixel), which on tiled GPUs keeps them in tile
+	 * memory. A subpass can also render on top of the attachments of earlier
+	 * subpasses (e.g. depth-test against their depth), the dependencies
+	 * between the subpasses are derived from the attachments they use.
+	 * Attachments backed by images created with
+	 * W_IMAGE_CREATE_TRANSIENT_ATTACHMENT are not stored at the end of the
+	 * render pass. This only takes effect on the next call to Create() that
+	 * uses WImage targets, an empty list (default) creates a single subpass
+	 * that renders to all the attachments.
+	 * @param subpasses Subpasses of the render pass, in order
+	 */
+	void SetSubpasses(const std::vector<W_RENDER_TARGET_SUBPASS>& subpasses);
+
+	/**
+	 * Moves to the next subpass of the render pass. This must be called
+	 * between Begin() and End(), and the effects rendered after it must have
+	 * been created for that subpass (see WEffect::SetSubpass()).
+	 * @return Error code, see WError.h
+	 */
+	WError NextSubpass();
+
+	/**
+	 * Sets whether or not End() transitions the attachments to
+	 * VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL so they can be sampled. This is
+	 * enabled by default, it is disabled on the render targets of render stages
+	 * since the render graph (see WRenderGraph) places those transitions itself.
+	 * @param enable true to transition the attachments in End()
+	 */
+	void SetAutomaticLayoutTransitions(bool enable);
+
 	/**
 	 * Sets the camera that will be used when things are rendered using this
 	 * render target.
@@ -175,6 +248,25 @@ public:
 	 */
 	uint32_t GetNumColorOutputs() const;
 
+	/**
+	 * Retrieves the number of color attachments a subpass renders to.
+	 * @param  subpass Index of the subpass
+	 * @return         The number of color attachments of the subpass
+	 */
+	uint32_t GetNumSubpassColorOutputs(uint32_t subpass) const;
+
+	/**
+	 * Retrieves the number of subpasses of the render pass.
+	 * @return The number of subpasses
+	 */
+	uint32_t GetNumSubpasses() const;
+
+	/**
+	 * Retrieves the subpass currently being recorded (see NextSubpass()).
+	 * @return Index of the current subpass
+	 */
+	uint32_t GetCurrentSubpass() const;
+
 	/**
 	 * Checks whether or not the render target has a depth attachment.
 	 * @return True if the render target has a depth attachment, false otherwise
@@ -251,6 +343,21 @@ private:
 	uint32_t m_height;
 	/** The camera of this render target */
 	class WCamera* m_camera;
+	/** Slot of the renderer's global per-frame UBO holding the data of m_camera
+	    (written in Begin()), 0 if no slot is allocated yet */
+	uint32_t m_globalFrameSlot;
+	/** Whether the attachments are loaded instead of cleared in Begin() */
+	bool m_preserveContents;
+	/** Whether the depth attachment is read-only (see SetReadOnlyDepth()) */
+	bool m_readOnlyDepth;
+	/** Whether End() transitions the attachments to be sampled */
+	bool m_automaticLayoutTransitions;
+	/** Subpasses of the render pass (empty if it has a single subpass) */
+	std::vector<W_RENDER_TARGET_SUBPASS> m_subpasses;
+	/** Layout of every attachment during every subpass (VK_IMAGE_LAYOUT_UNDEFINED if unused) */
+	std::vector<std::vector<VkImageLayout>> m_subpassLayouts;
+	/** Subpass currently being recorded */
+	uint32_t m_currentSubpass;
 
 	/**
 	 * Free all the resources allocated by this render target.
@@ -261,6 +368,11 @@ private:
 	 * Create command buffers to use for this render target.
 	 */
 	WError _CreateCommandBuffers();
+
+	/**
+	 * @return Layout of the depth attachment while the render target renders
+	 */
+	VkImageLayout _GetDepthLayout() const;
 };
 
 /**
@@ -13,6 +13,9 @@
 
 #include "Wasabi/Core/WCore.hpp"
 #include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 /**
  * @ingroup engineclass
@@ -27,6 +30,9 @@ enum W_SHADER_TYPE: uint32_t {
 	W_PIXEL_SHADER = VK_SHADER_STAGE_FRAGMENT_BIT,
 	/** Geometry shader */
 	W_GEOMETRY_SHADER = VK_SHADER_STAGE_GEOMETRY_BIT,
+	/** Compute shader, an effect with a compute shader can't have any other
+	    shader bound (see WEffect::Dispatch()) */
+	W_COMPUTE_SHADER = VK_SHADER_STAGE_COMPUTE_BIT,
 };
 
 /**
@@ -65,6 +71,18 @@ enum W_SHADER_BOUND_RESOURCE_TYPE: uint8_t {
 	W_TYPE_TEXTURE = 1,
 	/** Bound resource is a push constant structure */
 	W_TYPE_PUSH_CONSTANT = 2,
+	/** Bound resource is an input attachment (a subpassInput read from an
+	    attachment written by an earlier subpass, see
+	    WRenderTarget::SetSubpasses()) */
+	W_TYPE_INPUT_ATTACHMENT = 3,
+	/** Bound resource is a storage buffer (a buffer the shader can read and
+	    write, see WMaterial::SetStorageBuffer()). Its variables describe one
+	    element of the buffer and are only informative */
+	W_TYPE_STORAGE_BUFFER = 4,
+	/** Bound resource is a storage image (an image the shader can read and
+	    write, created with W_IMAGE_CREATE_STORAGE and used in
+	    VK_IMAGE_LAYOUT_GENERAL, see WMaterial::SetTexture()) */
+	W_TYPE_STORAGE_IMAGE = 5,
 };
 
 /**
@@ -190,11 +208,12 @@ typedef struct W_BOUND_RESOURCE {
 	uint32_t binding_set;
 	/** Name of this bound resource */
 	std::string name;
-	/** Variables of this resource (in case of a UBO), which is empty for
-		textures */
+	/** Variables of this resource (in case of a UBO or a storage buffer),
+		which is empty for textures */
 	std::vector<W_SHADER_VARIABLE_INFO> variables;
 	/** Cached size of the variables, after automatically padding variables
-	    to be 16-byte-aligned. In case of a texture, this is the array size */
+	    to be 16-byte-aligned. In case of a texture or a storage image, this
+	    is the array size */
 	size_t _size;
 	/** Aligned offsets of variables elements in the UBO */
 	std::vector<size_t> _offsets;
@@ -302,6 +321,62 @@ inline W_EFFECT_RENDER_FLAGS& operator &= (W_EFFECT_RENDER_FLAGS& lhs, W_EFFECT_
 	return lhs;
 }
 
+/**
+ * Feature flags of a pipeline variant of a WEffect. Each feature corresponds
+ * to a boolean specialization constant in the effect's shaders, where bit N
+ * maps to the constant with constant_id = N, so a variant is compiled without
+ * the branches of the features it doesn't use.
+ */
+enum W_EFFECT_FEATURE_FLAGS : uint32_t {
+	/** No features */
+	EFFECT_FEATURE_NONE = 0,
+	/** The rendered entity uses geometry instancing (constant isInstanced) */
+	EFFECT_FEATURE_INSTANCED = (1 << 0),
+	/** The rendered entity samples its diffuse texture (constant isTextured) */
+	EFFECT_FEATURE_TEXTURED = (1 << 1),
+	/** The rendered entity's instances play a baked crowd animation (see
+	    WCrowdAnimation) (constant isCrowdAnimated) */
+	EFFECT_FEATURE_CROWD_ANIMATED = (1 << 2),
+};
+
+/** Number of bits used by W_EFFECT_FEATURE_FLAGS */
+#define W_NUM_EFFECT_FEATURES 3
+
+inline W_EFFECT_FEATURE_FLAGS operator | (W_EFFECT_FEATURE_FLAGS lhs, W_EFFECT_FEATURE_FLAGS rhs) {
+	using T = std::underlying_type_t <W_EFFECT_FEATURE_FLAGS>;
+	return static_cast<W_EFFECT_FEATURE_FLAGS>(static_cast<T>(lhs) | static_cast<T>(rhs));
+}
+
+inline W_EFFECT_FEATURE_FLAGS operator & (W_EFFECT_FEATURE_FLAGS lhs, W_EFFECT_FEATURE_FLAGS rhs) {
+	using T = std::underlying_type_t <W_EFFECT_FEATURE_FLAGS>;
+	return static_cast<W_EFFECT_FEATURE_FLAGS>(static_cast<T>(lhs) & static_cast<T>(rhs));
+}
+
+inline W_EFFECT_FEATURE_FLAGS& operator |= (W_EFFECT_FEATURE_FLAGS& lhs, W_EFFECT_FEATURE_FLAGS rhs) {
+	lhs = lhs | rhs;
+	return lhs;
+}
+
+inline W_EFFECT_FEATURE_FLAGS& operator &= (W_EFFECT_FEATURE_FLAGS& lhs, W_EFFECT_FEATURE_FLAGS rhs) {
+	lhs = lhs & rhs;
+	return lhs;
+}
+
+/**
+ * @ingroup engineclass
+ * Status of the pipeline of a WEffect.
+ */
+enum W_PIPELINE_STATUS : uint8_t {
+	/** No pipeline has been built (or it has been destroyed) */
+	W_PIPELINE_NOT_BUILT = 0,
+	/** The pipeline is being built on Wasabi::ThreadPool */
+	W_PIPELINE_BUILDING = 1,
+	/** The pipeline is built and the effect can be bound */
+	W_PIPELINE_READY = 2,
+	/** The last pipeline build failed */
+	W_PIPELINE_FAILED = 3,
+};
+
 /**
  * @ingroup engineclass
  * Encapsulation of a shader object. A shader is a small program bound to
@@ -421,6 +496,7 @@ inline W_EFFECT_RENDER_FLAGS& operator &= (W_EFFECT_RENDER_FLAGS& lhs, W_EFFECT_
 class WShader : public WFileAsset {
 	friend class WEffect;
 	friend class WMaterial;
+	friend class WShaderManager;
 
 	char* m_code;
 	int m_codeLen;
@@ -513,6 +589,18 @@ class WShaderManager : public WManager<WShader> {
 
 public:
 	WShaderManager(class Wasabi* const app);
+
+	/**
+	 * Calls WShader::Load() on all the given shaders, in parallel on
+	 * Wasabi::ThreadPool, and returns when they are all loaded. This is
+	 * useful when many shaders are created at once (like the default shaders
+	 * of the render stages), since their modules are then created
+	 * concurrently. The shaders' Load() must not touch anything but the
+	 * shader itself.
+	 * @param shaders   Shaders to load
+	 * @param bSaveData Passed to every WShader::Load()
+	 */
+	void LoadShaders(const std::vector<WShader*>& shaders, bool bSaveData = false);
 };
 
 /**
@@ -535,6 +623,11 @@ public:
  * vs->RemoveReference();
  * ps->RemoveReference();
  * @endcode
+ *
+ * Pipelines can also be built in the background using BuildPipelineAsync(),
+ * which lets many effects compile their pipelines concurrently. Calling
+ * WEffectManager::WaitForPipelineBuilds() (e.g. at the end of a loading
+ * screen) waits for all of them.
  */
 class WEffect : public WFileAsset {
 	friend class WMaterial;
@@ -592,7 +685,9 @@ public:
 
 	/**
 	 * Sets the depth stencil state in the Vulkan pipeline. This needs to be
-	 * called before BuildPipeline() for changes to be effective.
+	 * called before BuildPipeline() for changes to be effective. If the depth
+	 * bounds test is enabled, the bounds are a dynamic state that must be set
+	 * with vkCmdSetDepthBounds() before drawing.
 	 * @param state The new Vulkan depth stencil state
 	 */
 	void SetDepthStencilState(VkPipelineDepthStencilStateCreateInfo state);
@@ -604,28 +699,139 @@ public:
 	 */
 	void SetRasterizationState(VkPipelineRasterizationStateCreateInfo state);
 
+	/**
+	 * Sets the features that the effect's shaders specialize on (see
+	 * W_EFFECT_FEATURE_FLAGS). BuildPipeline() builds one pipeline variant for
+	 * every combination of these features, and Bind() picks the variant that
+	 * matches the features of what is being rendered. This needs to be called
+	 * before BuildPipeline() for changes to be effective.
+	 * @param features Features supported by the shaders of this effect
+	 */
+	void SetSupportedFeatures(W_EFFECT_FEATURE_FLAGS features);
+
+	/**
+	 * Sets the subpass of the render target that the pipelines are built for
+	 * (see WRenderTarget::SetSubpasses()). This needs to be called before
+	 * BuildPipeline() for changes to be effective.
+	 * @param subpass Index of the subpass, 0 by default
+	 */
+	void SetSubpass(uint32_t subpass);
+
+	/**
+	 * Retrieves the features this effect builds pipeline variants for. See
+	 * WEffect::SetSupportedFeatures.
+	 * @return Features supported by this effect
+	 */
+	W_EFFECT_FEATURE_FLAGS GetSupportedFeatures() const;
+
 	/**
 	 * Builds Vulkan pipelines corresponding to the currently bound shaders and
-	 * Vulkan states. This function will build several pipelines for different
+	 * Vulkan states. For compute effects (see IsCompute()), only the compute
+	 * pipeline variants are built and rt may be nullptr (the render states are
+	 * ignored). This function will build several pipelines for different
 	 * numbers of input layout supplied by the shaders. For instance, a shader
 	 * with two input layouts will have two pipelines, one that only uses one
 	 * input layout and another that uses both. This is done to provide
 	 * convenience when one wishes to use the same effect without supplying all
-	 * required vertex shaders.
+	 * required vertex shaders. A pipeline variant is also built for every
+	 * combination of the features set by SetSupportedFeatures().
 	 * @param  rt Render target that the effect plans on rendering to
 	 * @return    Error code, see WError.h
 	 */
 	WError BuildPipeline(class WRenderTarget* rt);
 
+	/**
+	 * Same as BuildPipeline(), except that the (expensive) creation of the
+	 * Vulkan pipeline is submitted as a task to Wasabi::ThreadPool (see
+	 * WThreadPool::Submit()) and this function returns immediately. The
+	 * descriptor set layouts and pipeline layout are created before
+	 * returning, so materials can be created for this effect right away. Use GetPipelineStatus() or
+	 * IsPipelineReady() to poll for readiness, or WaitForPipeline() to block
+	 * until the build is done. The render target must stay alive until the
+	 * build is done.
+	 * @param  rt Render target that the effect plans on rendering to (may be
+	 *            nullptr for compute effects)
+	 * @return    Error code, see WError.h
+	 */
+	WError BuildPipelineAsync(class WRenderTarget* rt);
+
+	/**
+	 * Retrieves the status of the pipeline of this effect.
+	 * @return Status of the pipeline, see W_PIPELINE_STATUS
+	 */
+	W_PIPELINE_STATUS GetPipelineStatus() const;
+
+	/**
+	 * @return true iff the pipeline of this effect is built and ready to be
+	 *         bound
+	 */
+	bool IsPipelineReady() const;
+
+	/**
+	 * Blocks until a pipeline build started by BuildPipelineAsync() is done.
+	 * @return Error code of the pipeline build, see WError.h
+	 */
+	WError WaitForPipeline();
+
 	/**
 	 * Binds the effect (pipeline) to render command buffer of the specified
 	 * render target. The render target must have its Begin() function called
 	 * before this function is called. Binding an effect means binding all
 	 * descriptor sets of all specified materials and binding the effect's pipeline.
-	 * @param  rt                 Render target to bind to its command buffer
-	 * @return                    Error code, see WError.h
+	 * If any of the bound shaders uses set W_GLOBAL_FRAME_SET_INDEX, the
+	 * renderer's global per-frame descriptor set is bound as well, with the data
+	 * of the render target's camera. If the pipeline is still being built by
+	 * BuildPipelineAsync(), this function waits for it.
+	 * @param  rt        Render target to bind to its command buffer
+	 * @param  features  Features of the pipeline variant to bind, features not
+	 *                   supported by this effect are ignored
+	 * @return           Error code, see WError.h
+	 */
+	WError Bind(class WRenderTarget* rt, W_EFFECT_FEATURE_FLAGS features = EFFECT_FEATURE_NONE);
+
+	/**
+	 * Binds the compute pipeline of a compute effect (see IsCompute()) to a
+	 * command buffer, along with the global per-frame descriptor set (if
+	 * used, with the data of the main camera) and the per-frame materials.
+	 * Compute work is recorded outside of render passes, for example in
+	 * WRenderStage::RecordCompute(). If the pipeline is still being built by
+	 * BuildPipelineAsync(), this function waits for it.
+	 * @param  cmdBuf    Command buffer to record to (must be recording)
+	 * @param  features  Features of the pipeline variant to bind, features not
+	 *                   supported by this effect are ignored
+	 * @return           Error code, see WError.h
+	 */
+	WError BindCompute(VkCommandBuffer cmdBuf, W_EFFECT_FEATURE_FLAGS features = EFFECT_FEATURE_NONE);
+
+	/**
+	 * Records a dispatch of the compute pipeline bound by BindCompute(). The
+	 * materials of the dispatch must be bound (see WMaterial::BindCompute())
+	 * before this is called.
+	 * @param  cmdBuf       Command buffer that the effect is bound to
+	 * @param  groupCountX  Number of work groups in the X dimension
+	 * @param  groupCountY  Number of work groups in the Y dimension
+	 * @param  groupCountZ  Number of work groups in the Z dimension
+	 * @return              Error code, see WError.h
 	 */
-	WError Bind(class WRenderTarget* rt);
+	WError Dispatch(VkCommandBuffer cmdBuf, uint32_t groupCountX, uint32_t groupCountY = 1, uint32_t groupCountZ = 1);
+
+	/**
+	 * Records a dispatch of the compute pipeline bound by BindCompute(), whose
+	 * work group counts are read from a buffer on the GPU (a
+	 * VkDispatchIndirectCommand), which lets earlier compute work decide the
+	 * size of the dispatch.
+	 * @param  cmdBuf  Command buffer that the effect is bound to
+	 * @param  buffer  Buffer holding the VkDispatchIndirectCommand, created
+	 *                 with VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+	 * @param  offset  Offset of the command in the buffer
+	 * @return         Error code, see WError.h
+	 */
+	WError DispatchIndirect(VkCommandBuffer cmdBuf, VkBuffer buffer, VkDeviceSize offset = 0);
+
+	/**
+	 * @return true if the bound shader is a compute shader (W_COMPUTE_SHADER)
+	 */
+	bool IsCompute() const;
 
 	/**
 	 * Sets the render flags of this effect. Render flags is a bitfield of
@@ -681,7 +887,7 @@ public:
 	/**
 	 * Checks the validity of the effect. An effect is valid if it has at least
 	 * one pipeline created and has a bound vertex shader that supplies a valid
-	 * input layout.
+	 * input layout, or only a bound compute shader.
 	 * @return true if the effect is valid, false otherwise
 	 */
 	virtual bool Valid() const override;
@@ -691,8 +897,19 @@ public:
 	virtual WError LoadFromStream(WFile* file, std::istream& inputStream, std::vector<void*>& args, std::string nameSuffix) override;
 
 private:
-	/** Vulkan pipeline created for this effect */
-	VkPipeline m_pipeline;
+	/** Vulkan pipelines created for this effect, one per combination of
+	    m_supportedFeatures (keyed by the variant's feature flags) */
+	std::unordered_map<uint32_t, VkPipeline> m_pipelines;
+	/** Features to build pipeline variants for */
+	W_EFFECT_FEATURE_FLAGS m_supportedFeatures;
+	/** Subpass of the render target to build the pipelines for */
+	uint32_t m_subpass;
+	/** Status of m_pipelines, see W_PIPELINE_STATUS. m_pipelines and
+	    m_pipelineBuildError are only safe to read when this is not
+	    W_PIPELINE_BUILDING */
+	std::atomic<uint8_t> m_pipelineStatus;
+	/** Result of the last pipeline build */
+	WError m_pipelineBuildError;
 	/** List of bound shaders */
 	std::vector<WShader*> m_shaders;
 	/** Index of the bound vertex shader (MAX if none is bound) */
@@ -701,6 +918,9 @@ private:
 	VkPipelineLayout m_pipelineLayout;
 	/** Descriptor set layout that can be used to make descriptor sets */
 	unordered_map<uint, VkDescriptorSetLayout> m_descriptorSetLayouts;
+	/** Whether or not any of the shaders reads the global per-frame UBO (set
+	    W_GLOBAL_FRAME_SET_INDEX), which is owned by the renderer */
+	bool m_usesGlobalFrameSet;
 
 	/** Vulkan primitive topology to use for the next pipeline generation */
 	VkPrimitiveTopology m_topology;
@@ -718,15 +938,56 @@ private:
 	 */
 	std::vector<class WMaterial*> m_perFrameMaterials;
 
+	/**
+	 * A snapshot of everything needed to create the Vulkan pipeline, so that
+	 * it can be created on a worker thread while the effect's states
+	 * are modified on the main thread.
+	 */
+	struct PIPELINE_CREATE_STATE {
+		bool isCompute;
+		VkRenderPass renderPass;
+		uint32_t subpass;
+		uint32_t numColorOutputs;
+		VkPipelineLayout layout;
+		VkPrimitiveTopology topology;
+		vector<VkPipelineColorBlendAttachmentState> blendStates;
+		VkPipelineDepthStencilStateCreateInfo depthStencilState;
+		VkPipelineRasterizationStateCreateInfo rasterizationState;
+		vector<VkPipelineShaderStageCreateInfo> shaderStages;
+		vector<W_INPUT_LAYOUT> inputLayouts;
+		W_EFFECT_FEATURE_FLAGS supportedFeatures;
+	};
+
 	/**
 	 * Frees all resources allocated by the effect.
 	 */
 	void _DestroyPipeline();
 
+	/**
+	 * Creates the descriptor set layouts and the pipeline layout from the bound
+	 * shaders' resources and fills the state needed to create the pipeline.
+	 * @param  rt     Render target that the effect plans on rendering to
+	 * @param  state  State to fill
+	 * @return        Error code, see WError.h
+	 */
+	WError _CreatePipelineLayout(class WRenderTarget* rt, PIPELINE_CREATE_STATE* state);
+
+	/**
+	 * Creates the Vulkan graphics (or compute) pipelines of all the feature
+	 * variants of an effect. This is safe to call from any thread.
+	 * @param  device     Vulkan device
+	 * @param  cache      Pipeline cache to use, must not be used by another
+	 *                    thread at the same time
+	 * @param  state      State of the pipelines to create
+	 * @param  pipelines  Created pipelines, keyed by their feature flags
+	 * @return            Error code, see WError.h
+	 */
+	static WError _CreatePipelines(VkDevice device, VkPipelineCache cache, const PIPELINE_CREATE_STATE& state, std::unordered_map<uint32_t, VkPipeline>* pipelines);
+
 	/**
 	 * Checks the validity of the bound shaders. The bound shaders are valid if
 	 * they contain at least one vertex buffer with at least one valid input
-	 * layout.
+	 * layout, or if the only bound shader is a valid compute shader.
 	 * @return true if the bound shaders are valid, false otherwise
 	 */
 	bool _ValidShaders() const;
@@ -745,6 +1006,59 @@ class WEffectManager : public WManager<WEffect> {
 	 */
 	virtual std::string GetTypeName() const;
 
+	/** Pipeline cache of every thread of Wasabi::ThreadPool, indexed by
+	    WThreadPool::GetThreadIndex() */
+	std::vector<VkPipelineCache> m_buildThreadCaches;
+	/** Cache that the threads' caches are merged into */
+	VkPipelineCache m_pipelineCache;
+	/** Number of submitted build jobs that are not done yet */
+	uint32_t m_numPendingJobs;
+	/** Whether or not the threads' caches have new pipelines since the last
+	    merge */
+	bool m_cachesDirty;
+	/** Protects all of the above */
+	std::mutex m_buildMutex;
+	/** Signaled when a job is done */
+	std::condition_variable m_jobDoneCV;
+
+	/**
+	 * Creates the pipeline caches of the threads, if not already created.
+	 * @return Error code, see WError.h
+	 */
+	WError _CreateBuildCaches();
+
+	/**
+	 * Submits a pipeline build job to Wasabi::ThreadPool.
+	 * @param  job  Job to run, called with the pipeline cache of the thread
+	 *              running it
+	 * @return      Error code, see WError.h
+	 */
+	WError _SubmitBuildJob(std::function<void(VkPipelineCache)> job);
+
+	/**
+	 * Blocks until the given condition is true. The condition is evaluated
+	 * every time a build job finishes.
+	 * @param condition  Condition to wait for
+	 */
+	void _WaitForBuildJobs(std::function<bool()> condition);
+
 public:
 	WEffectManager(class Wasabi* const app);
+	~WEffectManager();
+
+	/**
+	 * Blocks until all pipelines submitted by WEffect::BuildPipelineAsync()
+	 * are built, then merges the pipeline caches of the threads. This
+	 * is usually called at the end of a loading screen.
+	 * @return Error code, see WError.h
+	 */
+	WError WaitForPipelineBuilds();
+
+	/**
+	 * Retrieves the pipeline cache that the threads' caches are merged
+	 * into by WaitForPipelineBuilds(). Its data can be saved using
+	 * vkGetPipelineCacheData().
+	 * @return The merged pipeline cache
+	 */
+	VkPipelineCache GetPipelineCache() const;
 };
@@ -12,6 +12,7 @@
 #pragma once
 
 #include "Wasabi/Core/WCore.hpp"
+#include "Wasabi/Materials/WEffect.hpp"
 
 /**
  * @ingroup engineclass
@@ -63,6 +64,15 @@ public:
 	 */
 	virtual WError Bind(class WRenderTarget* rt, bool bindDescSet = true, bool bindPushConsts = true);
 
+	/**
+	 * Binds the resources to the compute pipeline, the material's effect must
+	 * be a compute effect bound with WEffect::BindCompute().
+	 * @param  cmdBuf         Command buffer to record to
+	 * @param  bindDescSet    Whether or not to bind the descriptor set
+	 * @param  bindPushConsts Whether or not to bind push constants
+	 * @return                Error code, see WError.h
+	 */
+	WError BindCompute(VkCommandBuffer cmdBuf, bool bindDescSet = true, bool bindPushConsts = true);
 	/**
 	 * Retrieves the Vulkan descriptor set created by this material.
 	 * @return Material's descriptor set
@@ -129,7 +139,11 @@ public:
 	WError SetTexture(uint32_t bindingIndex, class WImage* img, uint32_t arrayIndex = 0);
 
 	/**
-	 * Sets a texture in the bound effect.
+	 * Sets a texture in the bound effect. This also sets the images of input
+	 * attachments (W_TYPE_INPUT_ATTACHMENT), which must be attachments of the
+	 * render target the material is rendered in, and of storage images
+	 * (W_TYPE_STORAGE_IMAGE), which must be created with
+	 * W_IMAGE_CREATE_STORAGE.
 	 * @param  name        Name of the texture to bind to
 	 * @param  img         The image to set the texture to, can be nullptr
 	 * @param  arrayIndex  Index into the texture array (if its an array)
@@ -137,6 +151,48 @@ public:
 	 */
 	WError SetTexture(std::string name, class WImage* img, uint32_t arrayIndex = 0);
 
+	/**
+	 * Sets the buffer of a storage buffer (W_TYPE_STORAGE_BUFFER) in the bound
+	 * effect. The material doesn't own the buffer, which has to be created
+	 * with VK_BUFFER_USAGE_STORAGE_BUFFER_BIT and stay alive while the
+	 * material uses it. A storage buffer must be set before the material is
+	 * bound.
+	 * @param  name    Name of the storage buffer to bind to
+	 * @param  buffer  The buffer to use for all the buffering indices
+	 * @param  offset  Offset of the bound range in the buffer
+	 * @param  range   Size of the bound range, VK_WHOLE_SIZE for the rest of
+	 *                 the buffer
+	 * @return         Error code, see WError.h
+	 */
+	WError SetStorageBuffer(std::string name, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+	/**
+	 * Sets the buffers of a storage buffer (W_TYPE_STORAGE_BUFFER) in the
+	 * bound effect, using one buffer of a buffered buffer per buffering index
+	 * (so a frame can write its buffer while the GPU reads an earlier one).
+	 * @param  name    Name of the storage buffer to bind to
+	 * @param  buffer  The buffered buffer, with one buffer per buffering
+	 *                 index (or a single buffer used by all of them)
+	 * @return         Error code, see WError.h
+	 */
+	WError SetStorageBuffer(std::string name, WBufferedBuffer* buffer);
+
+	/**
+	 * Sets the effect features (see W_EFFECT_FEATURE_FLAGS) that this material
+	 * needs, which are used to select the pipeline variant of the effect when
+	 * rendering with this material. Features that the entity itself provides
+	 * (such as instancing) are added by the renderer.
+	 * @param features  Features needed by this material
+	 */
+	void SetFeatures(W_EFFECT_FEATURE_FLAGS features);
+
+	/**
+	 * Retrieves the effect features of this material. See
+	 * WMaterial::SetFeatures.
+	 * @return Features needed by this material
+	 */
+	W_EFFECT_FEATURE_FLAGS GetFeatures() const;
+
 	/**
 	 * Checks the validity of the material. A material is valid if it has a
 	 * valid effect assigned to it.
@@ -157,6 +213,8 @@ private:
 	std::vector<VkDescriptorSet> m_descriptorSets;
 	/** The set index of m_descriptorSet */
 	uint32_t m_setIndex;
+	/** Effect features needed by this material */
+	W_EFFECT_FEATURE_FLAGS m_features;
 	/** An array to hold write descriptor sets (filled/initialized on every
 	    Bind() call) */
 	std::vector<VkWriteDescriptorSet> m_writeDescriptorSets;
@@ -186,9 +244,20 @@ private:
 		/** Pointer to the texture description in the effect */
 		struct W_BOUND_RESOURCE* sampler_info;
 	};
-	/** List of all textures (or samplers) for the effect */
+	/** List of all textures (or samplers), input attachments and storage images for the effect */
 	std::vector<SAMPLER_INFO> m_samplers;
 
+	struct STORAGE_BUFFER_INFO {
+		/** Descriptor information for the buffer, one per buffered buffer */
+		std::vector<VkDescriptorBufferInfo> descriptors;
+		/** Specifies whether or not the descriptor changed and needs to be written (one flag per buffer) */
+		std::vector<bool> dirty;
+		/** Pointer to the storage buffer description in the effect */
+		struct W_BOUND_RESOURCE* buffer_info;
+	};
+	/** List of the storage buffers for the effect */
+	std::vector<STORAGE_BUFFER_INFO> m_storageBuffers;
+
 	struct PUSH_CONSTANT_INFO {
 		/** Data in the push constant buffer */
 		void* data;
@@ -203,6 +272,16 @@ private:
 	 * Frees all resources allocated for the material.
 	 */
 	void _DestroyResources();
+
+	/**
+	 * Updates the descriptors that changed and binds the material.
+	 * @param  cmdBuf         Command buffer to record to
+	 * @param  bindPoint      Pipeline bind point of the material's effect
+	 * @param  bindDescSet    Whether or not to bind the descriptor set
+	 * @param  bindPushConsts Whether or not to bind push constants
+	 * @return                Error code, see WError.h
+	 */
+	WError _Bind(VkCommandBuffer cmdBuf, VkPipelineBindPoint bindPoint, bool bindDescSet, bool bindPushConsts);
 };
 
 /**
@@ -224,6 +303,7 @@ public:
 	WError SetVariableData(const char* varName, void* data, size_t len);
 	WError SetTexture(uint32_t bindingIndex, class WImage* img, uint32_t arrayIndex = 0);
 	WError SetTexture(std::string name, class WImage* img, uint32_t arrayIndex = 0);
+	void SetFeatures(W_EFFECT_FEATURE_FLAGS features);
 };
 
 /**
@@ -37,6 +37,8 @@ public:
 	VkImageView GetView(class Wasabi* app, uint32_t bufferIndex) const;
 	VkImageLayout GetLayout(uint32_t bufferIndex) const;
 	void TransitionLayoutTo(VkCommandBuffer cmdBuf, VkImageLayout newLayout, uint32_t bufferIndex);
+	void SetLayout(VkImageLayout layout, uint32_t bufferIndex);
+	VkImageMemoryBarrier GetLayoutTransitionBarrier(VkImageLayout newLayout, uint32_t bufferIndex, bool discardContents = false);
 
 	bool Valid() const;
 	size_t GetMemorySize() const;
@@ -112,8 +112,10 @@ public:
 	 *                   memory type
 	 * @param properties The requested memory properties to be found
 	 * @param typeIndex  Pointer to an index to be filled
+	 * @return           true if a compatible memory type was found, false
+	 *                   otherwise (typeIndex is left unchanged)
 	 */
-	void GetMemoryType(uint32_t typeBits, VkFlags properties, uint* typeIndex) const;
+	bool GetMemoryType(uint32_t typeBits, VkFlags properties, uint* typeIndex) const;
 
 	/**
 	 * Starts recording commands on the copy command buffer, which can be
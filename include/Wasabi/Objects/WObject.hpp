@@ -15,6 +15,8 @@
 #include "Wasabi/Core/WCore.hpp"
 #include "Wasabi/Materials/WMaterialsStore.hpp"
 
+enum W_EFFECT_FEATURE_FLAGS : uint32_t;
+
 /**
  * @ingroup engineclass
  * An instance is used by a WObject to provide a way for users to easily access
@@ -54,6 +56,35 @@ public:
 	 */
 	WMatrix GetWorldMatrix();
 
+	/**
+	 * Sets the clip this instance plays from the crowd animation of its
+	 * object (see WCrowdAnimation). The time of the instance in the clip is
+	 * the engine's elapsed time (see Wasabi::Timer) * fSpeed + fTimeOffset.
+	 * @param clip        Index of the clip to play
+	 * @param fTimeOffset Time offset in the clip, in seconds
+	 * @param fSpeed      Playback speed multiplier
+	 */
+	void SetAnimationClip(uint32_t clip, float fTimeOffset = 0.0f, float fSpeed = 1.0f);
+
+	/**
+	 * Retrieves the clip this instance plays from the crowd animation of its
+	 * object.
+	 * @return Index of the clip
+	 */
+	uint32_t GetAnimationClip() const;
+
+	/**
+	 * Retrieves the time offset of this instance in its crowd animation clip.
+	 * @return Time offset in seconds
+	 */
+	float GetAnimationTimeOffset() const;
+
+	/**
+	 * Retrieves the playback speed of this instance's crowd animation clip.
+	 * @return Playback speed multiplier
+	 */
+	float GetAnimationSpeed() const;
+
 	/**
 	 * Updates the locally computed world matrix of this instance. This function
 	 * should only be called by WObject, otherwise changes might not be reflected
@@ -72,6 +103,12 @@ private:
 	bool m_bAltered;
 	/** The world matrix */
 	WMatrix m_worldM;
+	/** Crowd animation clip played by this instance */
+	uint32_t m_animationClip;
+	/** Time offset in the crowd animation clip */
+	float m_animationTimeOffset;
+	/** Playback speed of the crowd animation clip */
+	float m_animationSpeed;
 };
 
 /**
@@ -116,25 +153,64 @@ public:
 	 * it is within the viewing frustum of the render target's camera. Before an
 	 * object binds the provided material (WMaterial::Bind()), it will set the
 	 * following variables and resources in the material, if they exist:
-	 * * "worldMatrix" (WMatrix) will be set to the world matrix of this object.
-	 * * "isInstanced" (int) will be set to 1 if instancing data is available,
-	 * 		0 otherwise.
+	 * * "objectIndex" (uint32_t) will be set to the index of this object in
+	 *      the renderer's scene objects buffer (see GetSceneObjectIndex()),
+	 *      which holds the world matrix of this object.
 	 * * texture "animationTexture" will be assigned to the animation texture
 	 *      from the attached animation. This will only occur if the object's
 	 *      material is rigged and there is an animation supplied.
 	 * * texture "instancingTexture" will be assigned to the instancing texture
-	 * 	    created by this object. This will only occur if isInstanced was set
-	 *      to 1.
+	 * 	    created by this object. This will only occur if GetEffectFeatures()
+	 *      has EFFECT_FEATURE_INSTANCED set. Every instance has 4 pixels in
+	 *      the texture: its encoded world matrix in the first 3 and its crowd
+	 *      animation clip, time offset and speed (see
+	 *      WInstance::SetAnimationClip()) in the last one.
 	 *
 	 * If the object's instancing is initiated (see InitInstancing()), and there
 	 * is at least one instance created (see CreateInstance()), the object will
 	 * be rendered using geometry instancing.
 	 *
-	 * @param rt              Render target to render to.
-	 * @param material        Material to fill in with object data and bind
-	 * @param updateInstances Whether or not to update the instances data
+	 * If useSkinnedVertices is set and the object's vertices were skinned this
+	 * frame (see SetSkinnedVertices()), the skinned vertices are drawn as a
+	 * static vertex stream instead, and the animation texture is not set.
+	 *
+	 * If reportAnimationVisibility is set, the size of the object on the
+	 * screen of the render target's camera is reported to its animation (see
+	 * WAnimation::ReportVisibility()). Only the passes that render the scene
+	 * for its camera should report it, not the shadow or depth passes that
+	 * render the objects from other views.
+	 *
+	 * @param rt                        Render target to render to.
+	 * @param material                  Material to fill in with object data
+	 *                                  and bind
+	 * @param updateInstances           Whether or not to update the
+	 *                                  instances data
+	 * @param useSkinnedVertices        Whether or not to draw the skinned
+	 *                                  vertices, if any, in which case the
+	 *                                  material must be one of a
+	 *                                  non-animated effect
+	 * @param reportAnimationVisibility Whether or not to report the size of
+	 *                                  the object on the screen to its
+	 *                                  animation
+	 */
+	void Render(class WRenderTarget* rt, class WMaterial* material, bool updateInstances = true, bool useSkinnedVertices = false, bool reportAnimationVisibility = false);
+
+	/**
+	 * Sets the buffer holding the vertices of this object skinned by its
+	 * animation for the current frame, in the layout of the geometry's vertex
+	 * buffer. This is called every frame by WSkinningRenderStage.
+	 * @param buffer Buffer holding the skinned vertices, VK_NULL_HANDLE if
+	 *               the vertices were not skinned this frame
+	 * @param offset Offset of the first skinned vertex in buffer
 	 */
-	void Render(class WRenderTarget* rt, class WMaterial* material, bool updateInstances = true);
+	void SetSkinnedVertices(VkBuffer buffer, VkDeviceSize offset);
+
+	/**
+	 * Checks whether the vertices of this object were skinned for the current
+	 * frame (see SetSkinnedVertices()).
+	 * @return true if the object has skinned vertices, false otherwise
+	 */
+	bool HasSkinnedVertices() const;
 
 	/**
 	 * Sets the attached geometry.
@@ -162,6 +238,17 @@ public:
 	 */
 	class WAnimation* GetAnimation() const;
 
+	/**
+	 * Retrieves the effect features (see W_EFFECT_FEATURE_FLAGS) that this
+	 * object currently needs, which is EFFECT_FEATURE_INSTANCED if the object
+	 * is rendered with geometry instancing, and EFFECT_FEATURE_CROWD_ANIMATED
+	 * if its instances also play a crowd animation (see WCrowdAnimation). The
+	 * renderer combines these with the features of the object's material to
+	 * pick the effect's pipeline variant.
+	 * @return Effect features needed by this object
+	 */
+	W_EFFECT_FEATURE_FLAGS GetEffectFeatures() const;
+
 	/**
 	 * Initiates geometry instancing for this object. When geometry instancing
 	 * is initiated, and at least one instance is created (via CreateInstance()),
@@ -281,6 +368,16 @@ public:
 
 	virtual void OnStateChange(STATE_CHANGE_TYPE type) override;
 
+	/**
+	 * Retrieves the index of this object's entry in the renderer's scene
+	 * objects buffer (see WRenderer::AllocateSceneObject()). The entry holds
+	 * the world matrix of this object and is only uploaded when the object
+	 * moves.
+	 * @return Index of this object in the scene objects buffer, or
+	 *         W_INVALID_SCENE_OBJECT_INDEX if the buffer is full
+	 */
+	uint32_t GetSceneObjectIndex() const;
+
 	/**
 	 * Checks the validity of this object. An object is valid if it meets all the
 	 * following conditions:
@@ -292,7 +389,9 @@ public:
 	virtual bool Valid() const override;
 
 	/**
-	 * Animations can only be saved if they are an instance of WSkeleton
+	 * Animations can only be saved if they are an instance of WSkeleton or
+	 * WCrowdAnimation. The crowd animation clips of the instances are not
+	 * saved.
 	 */
 	static std::vector<void*> LoadArgs();
 	virtual WError SaveToStream(WFile* file, std::ostream& outputStream) override;
@@ -303,6 +402,13 @@ private:
 	class WGeometry* m_geometry;
 	/** Attached animation */
 	class WAnimation* m_animation;
+	/** true if the attached animation is a WCrowdAnimation */
+	bool m_bCrowdAnimation;
+	/** Buffer holding the skinned vertices of the current frame, see
+	 *  SetSkinnedVertices() */
+	VkBuffer m_skinnedVertexBuffer;
+	/** Offset of the skinned vertices in m_skinnedVertexBuffer */
+	VkDeviceSize m_skinnedVertexOffset;
 	/** true if the world matrix needs to be updated, false otherwise */
 	bool m_bAltered;
 	/** true if the object is hidden, false otherwise */
@@ -321,11 +427,28 @@ private:
 	bool m_instancesDirty;
 	/** List of created instances */
 	vector<WInstance*> m_instanceV;
+	/** Index of this object in the renderer's scene objects buffer */
+	uint32_t m_sceneObjectIndex;
+	/** true if the scene object of this object needs to be updated */
+	bool m_sceneObjectDirty;
 
 	/**
 	 * Updates all the instances and the instance buffer.
 	 */
 	void _UpdateInstanceBuffer();
+
+	/**
+	 * Reports the size of this object on the screen of a camera to its
+	 * animation (see WAnimation::ReportVisibility()).
+	 * @param cam Camera that the object is rendered with
+	 */
+	void _ReportAnimationVisibility(class WCamera* cam);
+
+	/**
+	 * Marks the scene object of this object to be updated before the next
+	 * frame renders.
+	 */
+	void _MarkSceneObjectDirty();
 };
 
 /**
@@ -366,6 +489,14 @@ public:
 	 */
 	WObject* CreateObject(class WEffect* fx, uint32_t bindingSet, uint32_t ID = 0) const;
 
+	/**
+	 * Writes the scene object data of all the objects that moved since the
+	 * last call to the renderer's scene objects buffer (see
+	 * WRenderer::UpdateSceneObject()). This is called by the renderer before
+	 * rendering every frame.
+	 */
+	void UpdateSceneObjects();
+
 	/**
 	 * Checks if an object is in the view in the default renderer's camera and
 	 * and part of that object is at the given (x,y) coordinates on the screen.
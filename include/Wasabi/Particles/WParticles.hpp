@@ -12,6 +12,7 @@
 
 #include "Wasabi/Core/WCore.hpp"
 #include "Wasabi/Materials/WMaterialsStore.hpp"
+#include "Wasabi/Memory/WBufferedBuffer.hpp"
 
 /** A vertex of a particle */
 struct WParticlesVertex {
@@ -58,37 +59,222 @@ enum W_DEFAULT_PARTICLE_EFFECT_TYPE: uint8_t {
 	W_DEFAULT_PARTICLES_SUBTRACTIVE = 3,
 };
 
+/** Number of particles updated together by WParticlesBehavior's kernels */
+#define W_PARTICLES_BATCH_SIZE 1024
+/** Number of samples in the color curve of a WParticlesBehavior */
+#define W_PARTICLES_COLOR_CURVE_SIZE 64
+
+/**
+ * Particles of a WParticlesBehavior, stored as a structure of arrays: the
+ * attribute a of particle i is a[i]. Every array has room for the maximum
+ * number of particles of the behavior, and the live particles are always the
+ * first count elements.
+ */
+struct WParticlesData {
+	/** Number of live particles */
+	uint32_t count;
+	/** Local-space position */
+	std::vector<float> posX, posY, posZ;
+	/** Local-space velocity, in units per second */
+	std::vector<float> velX, velY, velZ;
+	/** Time at which the particle was emitted */
+	std::vector<float> spawnTime;
+	/** Lifetime of the particle in seconds */
+	std::vector<float> lifetime;
+	/** Age of the particle as a fraction of its lifetime [0, 1), computed at
+	    the beginning of every update */
+	std::vector<float> age;
+	/** Size of the particle */
+	std::vector<float> size;
+	/** Color of the particle (multiplied by the texture color) */
+	std::vector<float> colorR, colorG, colorB, colorA;
+	/** UV coordinates of the top-left and bottom-right vertices */
+	std::vector<float> uvLeft, uvTop, uvRight, uvBottom;
+	/** Additional attributes of a derived behavior, see
+	    WParticlesBehavior::AddCustomAttribute() */
+	std::vector<std::vector<float>> custom;
+
+	/**
+	 * Retrieves the arrays of all the attributes.
+	 * @return The arrays of all the attributes, including the custom ones
+	 */
+	std::vector<std::vector<float>*> GetArrays();
+};
+
+/**
+ * Parameters of a frame of the GPU simulation of a particle system (see
+ * WParticlesBehavior::UpdateGPUSimulation()). The compute shaders emit the
+ * particles the way WDefaultParticleBehavior does: at random positions in a
+ * box, with the same velocity (or speed) and lifetime and a random tile of
+ * the texture. They then move the particles by their velocities and sample
+ * their sizes and colors from the size and color curves.
+ */
+struct W_PARTICLES_GPU_SIMULATION {
+	/** Number of particles emitted in the frame */
+	uint32_t numEmitted;
+	/** Seed of the random numbers of the particles emitted in the frame */
+	uint32_t randomSeed;
+	/** Spawn time of the first emitted particle */
+	float firstSpawnTime;
+	/** Time between the spawns of two consecutive emitted particles */
+	float emissionPeriod;
+	/** Center of the box where the particles are emitted */
+	WVector3 emissionPosition;
+	/** Dimensions of the box where the particles are emitted */
+	WVector3 emissionRandomness;
+	/** Velocity of the emitted particles */
+	WVector3 spawnVelocity;
+	/** If true, the velocity of an emitted particle points away from
+	    emissionPosition and its speed is the length of spawnVelocity */
+	bool moveOutwards;
+	/** Lifetime of the emitted particles in seconds */
+	float lifetime;
+	/** Number of columns of tiles in the texture */
+	uint32_t numTilesColumns;
+	/** Number of rows of tiles in the texture */
+	uint32_t numTilesRows;
+	/** Size of the particles at the beginning (x) and end (y) of their
+	    lives */
+	WVector2 sizeCurve;
+	/** Whether the size of the particles is applied in view space */
+	bool sizeInViewSpace;
+	/** Color curve of the particles (W_PARTICLES_COLOR_CURVE_SIZE samples of
+	    4 floats each) */
+	const float* colorCurve;
+};
+
 /**
  * This class can be derived to implement custom behavior for particles.
  * Custom behavior includes rules for emission, motion, growth, etc...
- * The typename T must have identical bytes to a WParticlesVertex at its
- * beginning.
+ *
+ * The particles are stored as a structure of arrays (see WParticlesData) and
+ * updated in batches of W_PARTICLES_BATCH_SIZE particles by loops over the
+ * arrays, using SSE4.1 or AVX2 when the CPU supports them (see
+ * WParticlesKernels). Every update:
+ * * UpdateSystem() emits new particles (see Emit()).
+ * * The age of every particle is computed and the dead particles are
+ *   removed.
+ * * UpdateBatch() is called for every batch of live particles. By default it
+ *   moves the particles by their velocities and samples their sizes and
+ *   colors from the size and color curves.
+ * * The instances of the particles are written to the instances buffer.
+ *
+ * The particle systems rendered in a frame are updated together on the worker
+ * threads of Wasabi::ThreadPool (see WParticlesManager::Update()), so
+ * UpdateSystem() and UpdateBatch() may be called from any thread and must
+ * only change the behavior's own data. The batches of a behavior are updated
+ * concurrently too.
+ *
+ * Alternatively, a behavior can have its particles simulated by compute
+ * shaders on the GPU (see UpdateGPUSimulation()), which is limited to the
+ * emission and motion rules of WDefaultParticleBehavior but scales to far
+ * more particles.
  */
 class WParticlesBehavior {
-	/** Maximum number of particles that the m_buffer can hold */
+	friend class WParticlesManager;
+
+	/** Maximum number of particles */
 	uint32_t m_maxParticles;
-	/** Size of each particle in m_buffer */
-	uint32_t m_particleSize;
-	/** Number of particles currently active */
-	uint32_t m_numParticles;
-	/** Buffer to store particles data (per-particle, not vertex) */
-	void* m_particlesData;
+	/** Time of the last update */
+	float m_lastUpdateTime;
+	/** Bounding box of the particles in local space */
+	WVector3 m_minPoint, m_maxPoint;
+
+	/**
+	 * Computes the ages of a range of (at most W_PARTICLES_BATCH_SIZE)
+	 * particles and moves the live ones to the beginning of the range
+	 * (keeping their order), then calls UpdateBatch() on them.
+	 * @param  curTime    The time elapsed since the beginning of the program
+	 * @param  deltaTime  Time since the last update
+	 * @param  begin      First particle of the range
+	 * @param  end        End of the range (exclusive)
+	 * @return            Number of live particles in the range
+	 */
+	uint32_t _UpdateRange(float curTime, float deltaTime, uint32_t begin, uint32_t end);
+
+	/**
+	 * Moves a range of particles down to another position in the arrays.
+	 * @param from   First particle to move
+	 * @param to     Where to move the first particle, at most from
+	 * @param count  Number of particles to move
+	 */
+	void _MoveParticles(uint32_t from, uint32_t to, uint32_t count);
+
+	/**
+	 * Begins an update by calling UpdateSystem().
+	 * @param  curTime     The time elapsed since the beginning of the program
+	 * @param  worldMatrix The world matrix of the particles system
+	 * @param  camera      The camera used to render the frame
+	 * @return             Time since the last update
+	 */
+	float _BeginUpdate(float curTime, const WMatrix& worldMatrix, class WCamera* camera);
+
+	/**
+	 * Ends an update once the dead particles are removed (see _UpdateRange()
+	 * and _MoveParticles()) by setting the number of live particles and
+	 * computing their bounding box.
+	 * @param numParticles  Number of live particles
+	 */
+	void _EndUpdate(uint32_t numParticles);
+
+	/**
+	 * Writes the instances of a range of live particles.
+	 * @param buffer     Buffer of the instances of all the particles
+	 * @param view       View matrix of the camera
+	 * @param worldView  World matrix of the particles system multiplied by
+	 *                   view
+	 * @param begin      First particle of the range
+	 * @param end        End of the range (exclusive)
+	 */
+	void _CopyRange(void* buffer, const WMatrix& view, const WMatrix& worldView, uint32_t begin, uint32_t end) const;
 
 protected:
+	/** The particles */
+	WParticlesData m_particles;
+	/** Size of the particles at the beginning (x) and end (y) of their
+	    lives, sampled by UpdateBatch() */
+	WVector2 m_sizeCurve;
+	/** Whether the size of the particles is applied in view space (so they
+	    always face the camera) or in local space (so they face up) */
+	bool m_sizeInViewSpace;
+	/** Colors of the particles over their lives, W_PARTICLES_COLOR_CURVE_SIZE
+	    evenly spaced samples of 4 floats each, see SetColorCurve() */
+	std::vector<float> m_colorCurve;
+
 	/**
-	 * Emits a particle if not at the limit. Emittion means placing the
-	 * particle data in m_buffer and incrementing m_numParticles.
-	 * @param particle  Particle to emit
+	 * Emits particles, as many as there is room for. The new particles are
+	 * the ones from the returned index up to m_particles.count. They are
+	 * emitted at the origin, with no velocity, a lifetime of 1 second, a size
+	 * of 1, a white color and the full texture, which the caller then changes
+	 * (at least their spawn time).
+	 * @param  count  Number of particles to emit
+	 * @return        Index of the first emitted particle
 	 */
-	void Emit(void* particle);
+	uint32_t Emit(uint32_t count = 1);
+
+	/**
+	 * Adds an attribute array to the particles (see WParticlesData::custom),
+	 * which is moved along with the particles. This should be called before
+	 * any particle is emitted.
+	 * @return Index of the attribute in m_particles.custom
+	 */
+	uint32_t AddCustomAttribute();
+
+	/**
+	 * Samples a color gradient into the color curve (m_colorCurve).
+	 * @param gradient  An array of (color, time) where color is the color at a
+	 *                  given time (starting from 0) and lasting for 'time',
+	 *                  changing linearly to the next color. The times should
+	 *                  add up to 1, after which the last color is used
+	 */
+	void SetColorCurve(const std::vector<std::pair<WColor, float>>& gradient);
 
 public:
 	/**
 	 * @param maxParticles  Maximum number of particles that the target system
 	 *                      can render
-	 * @param particleSize  Size of each particle structure
 	 */
-	WParticlesBehavior(uint32_t maxParticles, uint32_t particleSize);
+	WParticlesBehavior(uint32_t maxParticles);
 
 	virtual ~WParticlesBehavior();
 
@@ -105,10 +291,16 @@ public:
 	 */
 	uint32_t UpdateAndCopyToBuffer(float curTime, void* buffer, uint32_t maxParticles, const WMatrix& worldMatrix, class WCamera* camera);
 
+	/**
+	 * Retrieves the number of live particles.
+	 * @return Number of live particles
+	 */
+	uint32_t GetNumParticles() const;
+
 	/**
 	 * Must be implemented by a derived class to define the per-frame behavior
 	 * of the particle system. Typically this should control emission by
-	 * calling Emit() when a particle needs to be emitted.
+	 * calling Emit() when particles need to be emitted.
 	 * @param curTime     The time elapsed since the beginning of the program
 	 * @param worldMatrix The world matrix of the camera rendering the particles
 	 * @param camera      The camera used to render the frame
@@ -116,34 +308,44 @@ public:
 	virtual void UpdateSystem(float curTime, const WMatrix& worldMatrix, class WCamera* camera) = 0;
 
 	/**
-	 * Must be implemented by a derived class to define the per-frame behavior
-	 * of a single particle.
-	 * @param curTime        The time elapsed since the beginning of the program
-	 * @param particleData   A pointer to the beginning of the vertices memory to
-	 *                       fill. The memory will have sizeof(WParticlesInstance)
-	 *                       bytes to be filled with the 4 vertices of the particle
-	 *                       billboard. The output vertex must be in *VIEW SPACE*
-	 * @param outputInstance A pointer to the buffer to be filled with the instance
-	 *                       data for the particle particleData. The transformation
-	 *                       matrix is used as-is to transform from local space to
-	 *                       projection space
-	 * @param worldMatrix    The world matrix of the particles system
-	 * @param camera         The camera used to render the frame
-	 * @return  True if the particle should die, false otherwise
+	 * Updates a batch of live particles (their ages are already computed).
+	 * The default implementation moves the particles by their velocities and
+	 * samples their sizes from m_sizeCurve and their colors from
+	 * m_colorCurve. A derived class can override this to change the motion
+	 * or appearance of the particles, for example by changing their velocities
+	 * before calling the default implementation.
+	 * @param curTime    The time elapsed since the beginning of the program
+	 * @param deltaTime  Time since the last update
+	 * @param begin      First particle of the batch
+	 * @param end        End of the batch (exclusive)
 	 */
-	virtual bool UpdateParticle(float curTime, void* particleData, WParticlesInstance* outputInstance, const WMatrix& worldMatrix, class WCamera* camera) = 0;
+	virtual void UpdateBatch(float curTime, float deltaTime, uint32_t begin, uint32_t end);
 
 	/**
-	 * Must be implemented to return the minimum point in the bounding box of the
-	 * particles in local space of the instances.
+	 * Called by the WParticles implementation every frame, before rendering,
+	 * to check whether the particles are simulated by compute shaders on the
+	 * GPU instead of UpdateAndCopyToBuffer(). A behavior simulated on the GPU
+	 * fills in the parameters of the frame's simulation, which also controls
+	 * the emission. The particles restart when a system switches between
+	 * the two. The default implementation returns false.
+	 * @param  curTime     The time elapsed since the beginning of the program
+	 * @param  simulation  Parameters of the frame's simulation to fill in
+	 * @return             true if the particles are simulated on the GPU,
+	 *                     false otherwise
 	 */
-	virtual WVector3& GetMinPoint() = 0;
+	virtual bool UpdateGPUSimulation(float curTime, W_PARTICLES_GPU_SIMULATION* simulation);
 
 	/**
-	 * Must be implemented to return the maximum point in the bounding box of the
-	 * particles in local space of the instances.
+	 * Retrieves the minimum point in the bounding box of the particles in
+	 * local space of the instances.
 	 */
-	virtual WVector3& GetMaxPoint() = 0;
+	WVector3& GetMinPoint();
+
+	/**
+	 * Retrieves the maximum point in the bounding box of the particles in
+	 * local space of the instances.
+	 */
+	WVector3& GetMaxPoint();
 };
 
 /**
@@ -151,22 +353,29 @@ public:
  * systems.
  */
 class WDefaultParticleBehavior : public WParticlesBehavior {
-	struct Particle {
-		/** Spawn time of this particle */
-		float spawnTime;
-		/** UV coordinates of the top-left vertex */
-		WVector2 UVTopLeft;
-		/** UV coordinates of the bottom-right vertex */
-		WVector2 UVBottomRight;
-		/** Initial position of this particle */
-		WVector3 initialPos;
-		/** Velocity of this particle */
-		WVector3 velocity;
-	};
-
 	/** Time of last emission */
 	float m_lastEmit;
-	WVector3 m_minPoint, m_maxPoint;
+	/** Color gradient that the color curve was sampled from */
+	std::vector<std::pair<WColor, float>> m_sampledGradient;
+	/** State of the random numbers of the emission, which are not taken from
+	    rand() since the behaviors are updated on several threads */
+	uint32_t m_randomState;
+
+	/**
+	 * Generates the next random number of the emission.
+	 * @return A random number
+	 */
+	uint32_t _Random();
+
+	/**
+	 * Updates the size and color curves from the parameters.
+	 */
+	void _UpdateCurves();
+
+	/**
+	 * Computes the number of rows of tiles in the texture.
+	 */
+	uint32_t _GetNumTilesRows() const;
 
 public:
 
@@ -208,12 +417,19 @@ public:
 		in the vector elements should be equal to 1, where 1 is the time of the particle's death.
 		(default is {<(1,1,1,0), 0.2>, <(1,1,1,1), 0.8>, <(1,1,1,0), 0.0>} */
 	std::vector<std::pair<WColor, float>> m_colorGradient;
+	/** If set to true, the particles are simulated by compute shaders on the GPU (see
+	    WParticlesBehavior::UpdateGPUSimulation()), which can handle far more particles, and the
+	    emission is not limited to 10 particles per frame (default is false) */
+	bool m_gpuSimulation;
 
-	WDefaultParticleBehavior(uint32_t maxParticles);
+	/**
+	 * @param maxParticles Maximum number of particles
+	 * @param randomSeed   Seed of the random numbers of the emission, the
+	 *                     same seed always emits the same particles
+	 */
+	WDefaultParticleBehavior(uint32_t maxParticles, uint32_t randomSeed = 0);
 	virtual void UpdateSystem(float curTime, const WMatrix& worldMatrix, class WCamera* camera) override;
-	virtual inline bool UpdateParticle(float curTime, void* particleData, WParticlesInstance* outputInstance, const WMatrix& worldMatrix, class WCamera* camera) override;
-	virtual inline WVector3& GetMinPoint() override;
-	virtual inline WVector3& GetMaxPoint() override;
+	virtual bool UpdateGPUSimulation(float curTime, W_PARTICLES_GPU_SIMULATION* simulation) override;
 };
 
 /**
@@ -258,13 +474,30 @@ public:
 
 	/**
 	 * Checks whether a call to Render() will cause any rendering (draw call) to
-	 * happen.
+	 * happen. The particles simulated on the GPU are not frustum culled since
+	 * their bounding box is not known.
 	 */
 	bool WillRender(class WRenderTarget* rt);
 
 	/**
-	 * Renders the particle system to the given render target. If a material is
-	 * provided, the following variables will be set:
+	 * Records the frame's GPU simulation of the particles if the behavior
+	 * asks for it (see WParticlesBehavior::UpdateGPUSimulation()). This is
+	 * called by WParticlesRenderStage::RecordCompute() every frame, before
+	 * the particles are rendered.
+	 * @param  renderer  The renderer recording the frame
+	 * @param  cmdBuf    Command buffer to record the compute work to
+	 * @param  rt        Render target that the particles are rendered to
+	 * @return           Error code, see WError.h
+	 */
+	WError RecordSimulation(class WRenderer* renderer, VkCommandBuffer cmdBuf, class WRenderTarget* rt);
+
+	/**
+	 * Renders the particle system to the given render target. The particles
+	 * simulated on the GPU in this frame are drawn with the instance count
+	 * written by the simulation, and the particles updated by
+	 * WParticlesManager::Update() in this frame are drawn as they are.
+	 * Otherwise the behavior updates the particles on the CPU first. If a material is provided, the following variables
+	 * will be set:
 	 * * "worldMatrix": World matrix of the particles
 	 * * "viewMatrix": View matrix of the camera of rt
 	 * * "projectionMatrix": Projection matrix of the camera of rt
@@ -366,6 +599,40 @@ private:
 	WParticlesBehavior* m_behavior;
 	/** Texture containing instancing data */
 	class WImage* m_instancesTexture;
+	/** Whether the particles were updated and their instances written by
+	    WParticlesManager::Update() in the current frame */
+	bool m_updated;
+	/** Number of instances written by WParticlesManager::Update() */
+	uint32_t m_numUpdatedParticles;
+
+	/** Whether the behavior asked for the GPU simulation in the last frame */
+	bool m_gpuSimulating;
+	/** Whether the GPU simulation was recorded in the current frame */
+	bool m_gpuSimulated;
+	/** Time of the last GPU simulation */
+	float m_gpuLastTime;
+	/** Half of m_gpuParticles holding the live particles */
+	uint32_t m_gpuSource;
+	/** Material of the GPU simulation effect, nullptr until the behavior asks
+	    for the GPU simulation */
+	class WMaterial* m_gpuMaterial;
+	/** Particles of the GPU simulation, two halves of m_maxParticles
+	    particles that the simulation alternates between */
+	WBufferedBuffer m_gpuParticles;
+	/** Counters and dispatch parameters of the GPU simulation */
+	WBufferedBuffer m_gpuState;
+	/** Draw parameters written by the GPU simulation, one buffer per
+	    buffering index */
+	WBufferedBuffer m_gpuDrawArgs;
+	/** Instances written by the GPU simulation, one image per buffering
+	    index (in the layout of m_instancesTexture) */
+	std::vector<class WImage*> m_gpuInstances;
+
+	/**
+	 * Creates the resources of the GPU simulation.
+	 * @return Error code, see WError.h
+	 */
+	WError _CreateGPUResources();
 
 	/**
 	 * Destroys all resources held by this particles system
@@ -396,6 +663,19 @@ public:
 	 */
 	WError Load();
 
+	/**
+	 * Updates the particle systems that will be rendered to a render target
+	 * (see WParticles::WillRender()) and are not simulated on the GPU, and
+	 * writes their instances for the current buffering index. The systems
+	 * are updated in parallel on the worker threads of Wasabi::ThreadPool,
+	 * and so are the batches of W_PARTICLES_BATCH_SIZE particles of every
+	 * system. This is called by the renderer every frame before the render
+	 * stages are recorded.
+	 * @param rt  Render target that the particles are rendered to, the
+	 *            render target of the particles render stage
+	 */
+	void Update(class WRenderTarget* rt);
+
 	/**
 	 * Creates a WEffect that can be used to render particles
 	 * @return Newly allocated particle systems effect
@@ -420,6 +700,47 @@ private:
 	class WShader* m_vertexShader;
 	/** Default fragment shader used by the default effect */
 	class WShader* m_fragmentShader;
+	/** Compute effect of the GPU simulation of the particles */
+	class WEffect* m_simulationFX;
 	/** Geometry of a plain used to render a single particle */
 	class WGeometry* m_plainGeometry;
+
+	/** A particle system updated by Update() */
+	struct PARTICLES_UPDATE {
+		/** The particle system */
+		WParticles* particles;
+		/** Mapped instances of the particle system */
+		void* instances;
+		/** World matrix of the particle system */
+		WMatrix worldMatrix;
+		/** World matrix of the particle system multiplied by the view matrix */
+		WMatrix worldView;
+		/** Time since the particle system was last updated */
+		float deltaTime;
+		/** Index of the first batch of the particle system in m_batches */
+		uint32_t firstBatch;
+		/** Number of batches of the particle system */
+		uint32_t numBatches;
+	};
+	/** A batch of particles updated by Update() */
+	struct PARTICLES_BATCH {
+		/** Index of the particle system in m_updates */
+		uint32_t update;
+		/** First particle of the batch */
+		uint32_t begin;
+		/** End of the batch (exclusive) */
+		uint32_t end;
+		/** Number of live particles in the batch after its update */
+		uint32_t numAlive;
+	};
+	/** Particle systems updated in the current frame */
+	std::vector<PARTICLES_UPDATE> m_updates;
+	/** Batches of the particle systems updated in the current frame */
+	std::vector<PARTICLES_BATCH> m_batches;
+
+	/**
+	 * Cuts the particles of the particle systems in m_updates into batches
+	 * of W_PARTICLES_BATCH_SIZE particles.
+	 */
+	void _CreateBatches();
 };
@@ -0,0 +1,66 @@
+/** @file WParticlesKernels.hpp
+ *  @brief Particle update kernels with SIMD versions
+ *
+ *  The kernels that every particle goes through on every update (aging,
+ *  compaction of the dead particles and integration) have SSE4.1 and AVX2
+ *  versions next to the scalar ones, picked at runtime from what the CPU
+ *  supports.
+ *
+ *  @author Hasan Al-Jawaheri (hbj)
+ *  @bug No known bugs.
+ */
+
+#pragma once
+
+#include "Wasabi/Core/WCore.hpp"
+
+/** Instruction set of a set of particle kernels */
+enum W_PARTICLES_KERNELS_ISA {
+	/** Plain C++ loops, always supported */
+	W_PARTICLES_KERNELS_SCALAR = 0,
+	/** 4-wide SSE4.1 intrinsics */
+	W_PARTICLES_KERNELS_SSE41 = 1,
+	/** 8-wide AVX2 intrinsics */
+	W_PARTICLES_KERNELS_AVX2 = 2,
+};
+
+/**
+ * A set of particle update kernels (see WParticlesBehavior). All the sets
+ * compute exactly the same results, they only differ in speed.
+ */
+struct WParticlesKernels {
+	/**
+	 * Computes the ages of n particles as fractions of their lifetimes and
+	 * marks the live ones (younger than their lifetimes) in alive.
+	 * @return Number of live particles
+	 */
+	uint32_t (*Age)(float curTime, const float* spawnTime, const float* lifetime, float* age, uint8_t* alive, uint32_t n);
+
+	/**
+	 * Moves the elements of an array that are marked in alive to its
+	 * beginning, keeping their order. The elements after the moved ones are
+	 * left undefined.
+	 */
+	void (*Compact)(float* values, const uint8_t* alive, uint32_t n);
+
+	/**
+	 * Moves n particles along one axis by their velocities. A particle
+	 * emitted after the last update only moves for the time since its
+	 * emission.
+	 */
+	void (*Integrate)(float curTime, float deltaTime, const float* spawnTime, const float* vel, float* pos, uint32_t n);
+
+	/**
+	 * Retrieves the kernels of an instruction set.
+	 * @param  isa Instruction set of the kernels
+	 * @return     The kernels, or nullptr if the CPU does not support isa
+	 */
+	static const WParticlesKernels* Get(W_PARTICLES_KERNELS_ISA isa);
+
+	/**
+	 * Retrieves the fastest kernels that the CPU supports, these are the ones
+	 * WParticlesBehavior uses.
+	 * @return The fastest supported kernels
+	 */
+	static const WParticlesKernels* GetBest();
+};
@@ -13,15 +13,12 @@ public:
 };
 
 /*
- * Implementation of a forward rendering stage that renders objects and terrains with simple lighting.
- * Creating this stage adds the following engine parameters:
- * * "maxLights": Maximum number of lights that can be rendered at once (Default is (void*)16)
+ * Implementation of a render stage that renders the depth of the back faces of the objects to its
+ * "BackfaceDepth" output.
  */
 class WBackfaceDepthRenderStage : public WRenderStage {
 	WObjectsRenderFragment* m_objectsFragment;
 	WObjectsRenderFragment* m_animatedObjectsFragment;
-	class WMaterial* m_perFrameMaterial;
-	class WMaterial* m_perFrameAnimatedMaterial;
 
 public:
 	WBackfaceDepthRenderStage(class Wasabi* const app);
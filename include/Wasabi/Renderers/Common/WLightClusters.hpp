@@ -0,0 +1,235 @@
+/** @file WLightClusters.hpp
+ *  @brief Clustered light lists for forward shading
+ *
+ *  The view frustum is divided into a 3D grid of clusters (tiles on the
+ *  screen, exponential slices in depth) and every visible point and spot
+ *  light is assigned to the clusters its range touches. Pixel shaders find
+ *  their cluster and only loop over the lights of that cluster, see
+ *  `src/Wasabi/Renderers/Common/Shaders/light_clusters.glsl`.
+ *
+ *  @author Hasan Al-Jawaheri (hbj)
+ *  @bug No known bugs.
+ */
+
+#pragma once
+
+#include "Wasabi/Core/WCore.hpp"
+#include "Wasabi/Renderers/WRenderer.hpp"
+#include "Wasabi/Memory/WBufferedBuffer.hpp"
+
+/** Number of clusters along the screen's width */
+#define W_LIGHT_CLUSTERS_X 16
+/** Number of clusters along the screen's height */
+#define W_LIGHT_CLUSTERS_Y 9
+/** Number of (exponential) depth slices of clusters */
+#define W_LIGHT_CLUSTERS_Z 24
+/** Average number of lights per cluster that the light index list can hold */
+#define W_LIGHT_CLUSTERS_AVERAGE_LIGHTS 32
+
+/** How a WLightClusters fills its per-cluster light lists */
+enum W_LIGHT_CLUSTERS_BUILD {
+	/** Build() fills the lists on the CPU */
+	W_LIGHT_CLUSTERS_BUILD_CPU = 0,
+	/** A compute pass recorded by RecordBuild() fills the lists */
+	W_LIGHT_CLUSTERS_BUILD_COMPUTE = 1,
+	/** There are no lists, only the lights buffer is written (for passes
+	    that cull the lights themselves, like the tiled deferred lighting) */
+	W_LIGHT_CLUSTERS_BUILD_LIGHTS_ONLY = 2,
+};
+
+/**
+ * Builds the clustered light lists every frame and stores them in three
+ * storage buffers (one of each per buffering index):
+ * * Lights buffer: one LIGHT_DATA per light, directional lights first. The
+ *   shadow tiles index the shadow tiles texture of the WShadowRenderStage set
+ *   by SetShadows() (0 tiles means unshadowed).
+ * * Clusters buffer: one uvec2 per cluster at (z * W_LIGHT_CLUSTERS_Y + y) *
+ *   W_LIGHT_CLUSTERS_X + x, holding the offset and count of the cluster's
+ *   lights in the light indices buffer.
+ * * Light indices buffer: one uint per index into the lights buffer.
+ *
+ * The lights are always culled and sorted on the CPU. The clusters and light
+ * indices are either filled on the CPU by Build(), or, if created with
+ * W_LIGHT_CLUSTERS_BUILD_COMPUTE, by a compute pass recorded by RecordBuild()
+ * from the cluster ranges of the lights, which produces exactly the same
+ * lists. If created with W_LIGHT_CLUSTERS_BUILD_LIGHTS_ONLY, only the lights
+ * buffer exists.
+ *
+ * The clusters are built from the matrices of the engine-wide per-frame UBO
+ * (see W_GLOBAL_FRAME_DATA) so that shaders can locate a pixel's cluster using
+ * uboGlobalFrame.
+ */
+class WLightClusters {
+public:
+	/**
+	 * Parameters that shaders need to locate the cluster of a pixel, should be
+	 * copied to a UBO (see light_clusters.glsl).
+	 */
+	struct SHADER_PARAMS {
+		/** Number of clusters in x, y and z, w is the number of directional
+		    lights (which are not clustered and affect every pixel) */
+		uint32_t clusterGrid[4];
+		/** The depth slice of view-space depth d is log(d) * x - y */
+		WVector4 clusterDepth;
+	};
+
+	/**
+	 * A light in the lights buffer (std430 layout, see light_clusters.glsl).
+	 */
+	struct LIGHT_DATA {
+		/** rgb is the color, a is the intensity */
+		WVector4 color;
+		/** xyz is the L vector, w is the range */
+		WVector4 direction;
+		/** xyz is the position, w is the min cosine angle of spot lights */
+		WVector4 position;
+		/** Type of the light (see W_LIGHT_TYPE) */
+		uint32_t type;
+		/** First shadow tile of the light in the shadow tiles texture */
+		uint32_t firstShadowTile;
+		/** Number of shadow tiles of the light, 0 if it's not shadowed */
+		uint32_t numShadowTiles;
+		uint32_t padding;
+	};
+
+	WLightClusters(class Wasabi* const app);
+	~WLightClusters();
+
+	/**
+	 * Creates the buffers.
+	 * @param  maxLights Maximum number of lights that can be clustered in a
+	 *                   frame. If more lights are visible, the ones closest
+	 *                   to the camera are kept
+	 * @param  build     How the clusters and light indices are filled. With
+	 *                   W_LIGHT_CLUSTERS_BUILD_COMPUTE, the user must call
+	 *                   RecordBuild() every frame
+	 * @return           Error code, see WError.h
+	 */
+	WError Initialize(uint32_t maxLights, W_LIGHT_CLUSTERS_BUILD build = W_LIGHT_CLUSTERS_BUILD_CPU);
+
+	/**
+	 * Frees all the resources.
+	 */
+	void Cleanup();
+
+	/**
+	 * Records the compute pass that fills the clusters and light indices
+	 * buffers of the current buffering index, if the clusters were created
+	 * with W_LIGHT_CLUSTERS_BUILD_COMPUTE. Culls the lights against the view of the given frame
+	 * data first, so it must be called with the data that Build() is called
+	 * with later in the frame (see WRenderer::GetUpcomingGlobalFrameData()).
+	 * Should be called from WRenderStage::RecordCompute(), the outputs are
+	 * declared to the renderer as read by fragment shaders.
+	 * @param  renderer  The renderer
+	 * @param  cmdBuf    Command buffer to record the compute work to
+	 * @param  frameData Engine-wide per-frame data of the current frame
+	 * @return           Error code, see WError.h
+	 */
+	WError RecordBuild(class WRenderer* renderer, VkCommandBuffer cmdBuf, const W_GLOBAL_FRAME_DATA& frameData);
+
+	/**
+	 * Culls the lights against the view of the given frame data (unless
+	 * RecordBuild() already did this frame) and writes the lights buffer of
+	 * the current buffering index. If the clusters are built on the CPU, also
+	 * builds the per-cluster light lists into the clusters
+	 * and light indices buffers. Calling this multiple times in the same frame
+	 * only builds the lists once. If the light indices buffer is too small for
+	 * all the lists, the clusters with the most lights are capped to the same
+	 * number of lights and keep the ones closest to the camera.
+	 * @param frameData Engine-wide per-frame data of the current frame
+	 */
+	void Build(const W_GLOBAL_FRAME_DATA& frameData);
+
+	/**
+	 * Sets the shadow stage whose shadow tiles are referenced by the lights
+	 * buffer. The shadow stage must render before Build() is called in a frame.
+	 * @param shadows Shadow stage to use, or nullptr to disable shadows
+	 */
+	void SetShadows(class WShadowRenderStage* shadows);
+
+	/**
+	 * @return Number of lights in the lights buffer after the last Build()
+	 */
+	uint32_t GetNumLights() const;
+
+	/**
+	 * @return Parameters of the clusters built by the last Build()
+	 */
+	SHADER_PARAMS GetShaderParams() const;
+
+	/**
+	 * @return Whether the clusters are filled by the compute pass of
+	 *         RecordBuild()
+	 */
+	bool IsComputeBuilt() const;
+
+	WBufferedBuffer* GetLightsBuffer();
+	WBufferedBuffer* GetClustersBuffer();
+	WBufferedBuffer* GetLightIndicesBuffer();
+
+private:
+	/** Pointer to the Wasabi application */
+	class Wasabi* m_app;
+	/** Maximum number of lights in m_lights */
+	uint32_t m_maxLights;
+	/** Maximum number of indices in m_lightIndices */
+	uint32_t m_maxLightIndices;
+	/** Lights data buffers */
+	WBufferedBuffer m_lights;
+	/** Per-cluster offset and count buffers */
+	WBufferedBuffer m_clusters;
+	/** Per-cluster light index lists buffers */
+	WBufferedBuffer m_lightIndices;
+	/** Cluster ranges of the clustered lights, read by the compute pass */
+	WBufferedBuffer m_lightRanges;
+	/** How the lists are filled */
+	W_LIGHT_CLUSTERS_BUILD m_build;
+	/** Compute effect filling the clusters (nullptr if built on the CPU) */
+	class WEffect* m_buildFX;
+	/** Material of m_buildFX */
+	class WMaterial* m_buildMaterial;
+	/** Shadow stage providing the shadow tiles of the lights (can be nullptr) */
+	class WShadowRenderStage* m_shadows;
+	/** Parameters of the last built clusters */
+	SHADER_PARAMS m_params;
+	/** Number of lights written by the last Build() */
+	uint32_t m_numLights;
+	/** Frame index (from W_GLOBAL_FRAME_DATA) of the last Build() */
+	float m_lastBuiltFrame;
+	/** Frame index of the last culling of the lights */
+	float m_lastCulledFrame;
+
+	struct CLUSTERED_LIGHT {
+		class WLight* light;
+		/** Distance to the camera, used to keep the closest lights */
+		float distance;
+		/** Range of clusters touched by the light (inclusive) */
+		uint32_t minCluster[3];
+		uint32_t maxCluster[3];
+	};
+	/** Lights visible this frame (reused every frame to avoid allocations) */
+	std::vector<CLUSTERED_LIGHT> m_visibleLights;
+	/** Directional lights visible this frame */
+	std::vector<class WLight*> m_directionalLights;
+	/** Number of lights per cluster, then offsets of clusters */
+	std::vector<uint32_t> m_clusterCounts;
+	std::vector<uint32_t> m_clusterOffsets;
+
+	/**
+	 * Sets the cluster parameters for the view of the frame data, culls the
+	 * lights and sorts the visible ones closest first.
+	 */
+	void _CullLights(const W_GLOBAL_FRAME_DATA& frameData);
+
+	/**
+	 * Fills the mapped clusters and light indices buffers from the cluster
+	 * ranges of the visible lights (the CPU version of the compute pass).
+	 */
+	void _BuildClusters(uint32_t* clustersData, uint32_t* indicesData);
+
+	/**
+	 * Computes the range of clusters touched by a light.
+	 * @return false if the light is outside the view
+	 */
+	bool _GetClusterRange(const W_GLOBAL_FRAME_DATA& frameData, WVector3 viewPos, float range, CLUSTERED_LIGHT* light) const;
+};
@@ -4,6 +4,10 @@
 #include "Wasabi/Renderers/Common/WRenderFragment.hpp"
 #include "Wasabi/Particles/WParticles.hpp"
 
+/*
+ * Implementation of a render stage that renders the particle systems. The particle systems simulated on the GPU
+ * (see WParticlesBehavior::UpdateGPUSimulation()) are simulated in RecordCompute() before the frame is rendered.
+ */
 class WParticlesRenderStage : public WRenderStage {
 	WParticlesRenderFragment* m_particlesFragment;
 
@@ -11,6 +15,7 @@ public:
 	WParticlesRenderStage(class Wasabi* const app, bool backbuffer = false);
 	virtual WError Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height);
 	virtual WError Render(class WRenderer* renderer, class WRenderTarget* rt, uint32_t filter);
+	virtual WError RecordCompute(class WRenderer* renderer, VkCommandBuffer cmdBuf);
 	virtual void Cleanup();
 };
 
@@ -98,6 +98,7 @@ public:
 		UNREFERENCED_PARAMETER(renderer);
 
 		WEffect* boundFX = nullptr;
+		W_EFFECT_FEATURE_FLAGS boundFeatures = EFFECT_FEATURE_NONE;
 		for (auto it = m_allEntities.begin(); it != m_allEntities.end(); it++) {
 			EntityT* entity = it->second;
 			if (ShouldRenderEntity(entity)) {
@@ -114,9 +115,11 @@ public:
 					}
 				}
 				if (material && entity->WillRender(rt)) {
-					if (boundFX != effect) {
-						effect->Bind(rt);
+					W_EFFECT_FEATURE_FLAGS features = GetEntityFeatures(entity, material) & effect->GetSupportedFeatures();
+					if (boundFX != effect || boundFeatures != features) {
+						effect->Bind(rt, features);
 						boundFX = effect;
+						boundFeatures = features;
 					}
 					if (KeyChanged(entity, effect, it->first))
 						m_reindexEntities.push_back(std::make_pair(it->first, effect));
@@ -138,6 +141,15 @@ public:
 
 	virtual bool ShouldRenderEntity(EntityT*) { return true; };
 
+	/**
+	 * Retrieves the effect features used to pick the pipeline variant that an
+	 * entity is rendered with.
+	 */
+	virtual W_EFFECT_FEATURE_FLAGS GetEntityFeatures(EntityT* entity, class WMaterial* material) {
+		UNREFERENCED_PARAMETER(entity);
+		return material->GetFeatures();
+	}
+
 	virtual bool KeyChanged(EntityT* entity, class WEffect* effect, SortingKeyT key) = 0;
 
 	virtual void OnEntityAdded(EntityT* entity) {
@@ -156,44 +168,63 @@ public:
 
 struct WObjectSortingKey {
 	class WEffect* fx;
+	W_EFFECT_FEATURE_FLAGS features;
 	class WObject* obj;
 
 	WObjectSortingKey(class WObject* object, class WEffect* effect = nullptr) {
 		obj = object;
 		fx = effect;
+		features = object->GetEffectFeatures();
 	}
 
 	const bool operator< (const WObjectSortingKey& that) const {
-		return (void*)fx < (void*)that.fx ? true : fx == that.fx ? (obj < that.obj) : false;
+		if (fx != that.fx)
+			return (void*)fx < (void*)that.fx;
+		if (features != that.features)
+			return features < that.features;
+		return obj < that.obj;
 	}
 
 	class WObject* GetEntity() { return obj; }
 };
 
+/*
+ * Renders either the animated or the non-animated objects. With useSkinnedVertices, the animated objects whose
+ * vertices were skinned this frame (see WSkinningRenderStage) are rendered by the non-animated fragment, as a
+ * static vertex stream.
+ */
 class WObjectsRenderFragment : public WRenderFragment<WObject, WObjectSortingKey> {
 	bool m_animated;
 	bool m_addDefaultEffects;
+	bool m_useSkinnedVertices;
 
 public:
-	WObjectsRenderFragment(std::string fragmentName, bool animated, WEffect* fx, class Wasabi* wasabi, W_EFFECT_RENDER_FLAGS renderFlags, bool addDefaultEffects = true)
+	WObjectsRenderFragment(std::string fragmentName, bool animated, WEffect* fx, class Wasabi* wasabi, W_EFFECT_RENDER_FLAGS renderFlags, bool addDefaultEffects = true, bool useSkinnedVertices = false)
 		: WRenderFragment(fragmentName, fx, wasabi->ObjectManager) {
 		m_animated = animated;
 		m_addDefaultEffects = addDefaultEffects;
+		m_useSkinnedVertices = useSkinnedVertices;
 		m_requiredRenderFlags = renderFlags;
 		fx->SetRenderFlags(m_requiredRenderFlags);
 	}
 
 	virtual void RenderEntity(WObject* object, class WRenderTarget* rt, class WMaterial* material) override {
-		object->Render(rt, material);
+		// only the passes that shade the objects for the camera pick the animation LOD (not the shadow and depth passes)
+		bool isCameraPass = (m_requiredRenderFlags & (EFFECT_RENDER_FLAG_RENDER_GBUFFER | EFFECT_RENDER_FLAG_RENDER_FORWARD)) != 0;
+		object->Render(rt, material, true, m_useSkinnedVertices, isCameraPass);
 	}
 
 	virtual bool KeyChanged(WObject* obj, class WEffect* effect, WObjectSortingKey key) override {
-		UNREFERENCED_PARAMETER(obj);
-		return key.fx != effect;
+		return key.fx != effect || key.features != obj->GetEffectFeatures();
+	}
+
+	virtual W_EFFECT_FEATURE_FLAGS GetEntityFeatures(WObject* object, class WMaterial* material) override {
+		return material->GetFeatures() | object->GetEffectFeatures();
 	}
 
 	virtual bool ShouldRenderEntity(WObject* object) override {
-		return (object->GetAnimation() != nullptr) == m_animated;
+		bool animated = object->GetAnimation() != nullptr && !(m_useSkinnedVertices && object->HasSkinnedVertices());
+		return animated == m_animated;
 	};
 
 	virtual void OnEntityAdded(WObject* object) override {
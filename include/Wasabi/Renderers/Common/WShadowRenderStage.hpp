@@ -0,0 +1,187 @@
+#pragma once
+
+#include "Wasabi/Renderers/WRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WRenderFragment.hpp"
+#include "Wasabi/Materials/WEffect.hpp"
+#include "Wasabi/Materials/WMaterial.hpp"
+#include "Wasabi/Objects/WObject.hpp"
+
+class WShadowRenderStageObjectVS : public WShader {
+public:
+	WShadowRenderStageObjectVS(class Wasabi* const app);
+	virtual void Load(bool bSaveData = false);
+	static W_SHADER_DESC GetDesc();
+};
+
+class WShadowRenderStageAnimatedObjectVS : public WShader {
+public:
+	WShadowRenderStageAnimatedObjectVS(class Wasabi* const app);
+	virtual void Load(bool bSaveData = false);
+	static W_SHADER_DESC GetDesc();
+};
+
+class WShadowRenderStageObjectPS : public WShader {
+public:
+	WShadowRenderStageObjectPS(class Wasabi* const app);
+	virtual void Load(bool bSaveData = false);
+};
+
+/*
+ * A fragment that renders the depth of objects from the view of a shadow tile. Like the other depth passes, the
+ * animated objects that were skinned this frame (see WSkinningRenderStage) are drawn from their skinned vertices
+ * by the non-animated fragment instead of being skinned again for every tile.
+ */
+class WShadowRenderFragment : public WObjectsRenderFragment {
+	/** View-projection matrix of the tile being rendered */
+	WMatrix m_viewProjection;
+
+public:
+	WShadowRenderFragment(std::string fragmentName, bool animated, WEffect* fx, class Wasabi* wasabi)
+		: WObjectsRenderFragment(fragmentName, animated, fx, wasabi, EFFECT_RENDER_FLAG_RENDER_DEPTH_ONLY, true, true) {}
+
+	void SetViewProjection(WMatrix viewProjection) {
+		m_viewProjection = viewProjection;
+	}
+
+	virtual void RenderEntity(WObject* object, class WRenderTarget* rt, class WMaterial* material) override {
+		material->SetVariable<WMatrix>("shadowViewProjection", m_viewProjection);
+		WObjectsRenderFragment::RenderEntity(object, rt, material);
+	}
+};
+
+/*
+ * Implementation of a render stage that renders the shadow maps of the lights into one depth atlas (the
+ * "ShadowAtlas" output). The atlas is divided into square tiles:
+ * * Directional lights use one tile per cascade. The cascades split the first "shadowDistance" units of the
+ *   camera's view, each cascade is an orthographic projection around the bounding sphere of its slice.
+ * * Spot lights use one perspective tile covering their cone.
+ * * Point lights use 6 perspective tiles (one per cube face).
+ * Directional lights get tiles first, then the visible spot and point lights closest to the camera until the
+ * atlas is full. Every tile is culled and rendered with its own camera.
+ *
+ * The tiles are cached across frames (the atlas is never cleared as a whole). A tile is only re-rendered when
+ * its view changes or when a shadow caster inside it is added, removed, moved or animated, and at most
+ * "maxShadowTileUpdates" tiles are rendered per frame (cascades first). A tile that is waiting for an update
+ * keeps its previous depth and matrix so lookups stay consistent. Since the atlas is buffered per frame, the
+ * cache is tracked separately for every buffering index.
+ *
+ * Shaders find the tiles of a light through the shadow tiles texture (RGBA32F): 5 texels per tile holding
+ * the tile's view-projection matrix (4 texels, one GLSL column each) and its rectangle in the atlas (xy
+ * offset, zw size in UV units, zero size if the tile was never rendered). See GetLightShadowTiles() and
+ * `src/Wasabi/Renderers/Common/Shaders/shadows.glsl`.
+ *
+ * The stage is configured by the engine parameters "shadowAtlasSize", "shadowTileSize", "shadowCascades",
+ * "shadowDistance" and "maxShadowTileUpdates" (see Wasabi::engineParams).
+ */
+class WShadowRenderStage : public WRenderStage {
+	/** A square region of the atlas */
+	struct SHADOW_TILE {
+		/** Camera used to cull and render the tile */
+		class WCamera* camera;
+		/** Offset of the tile in the atlas (in pixels) */
+		uint32_t x, y;
+		/** Light that owns the tile, nullptr if the tile is free */
+		class WLight* light;
+		/** Index of the tile within its light (cascade or cube face) */
+		uint32_t lightTileIndex;
+		/** View-projection matrix of the tile this frame */
+		WMatrix viewProjection;
+		/** Incremented every time a caster inside the tile changes */
+		uint32_t version;
+		/** Version rendered in every buffered copy of the atlas, UINT_MAX if never rendered */
+		std::vector<uint32_t> renderedVersions;
+		/** View-projection matrix rendered in every buffered copy of the atlas */
+		std::vector<WMatrix> renderedViewProjections;
+	};
+
+	/** Last known state of a shadow caster */
+	struct SHADOW_CASTER {
+		/** Center of the caster's world-space bounding box */
+		WVector3 center;
+		/** Half-size of the caster's world-space bounding box */
+		WVector3 size;
+		/** Set while scanning the objects to find removed casters */
+		bool found;
+	};
+
+	/** Shadow data of a light */
+	struct LIGHT_SHADOW {
+		/** Indices of the light's tiles in m_tiles (cascades and cube faces are in order) */
+		std::vector<uint32_t> tiles;
+		/** Index of the light's first tile in the shadow tiles texture this frame */
+		uint32_t firstTile;
+		/** Set while allocating to find lights that lost their tiles */
+		bool kept;
+	};
+
+	WShadowRenderFragment* m_objectsFragment;
+	WShadowRenderFragment* m_animatedObjectsFragment;
+
+	/** Camera of the render target when no tile is being rendered */
+	class WCamera* m_atlasCamera;
+	/** Per-tile data of the shadow atlas tiles texture */
+	class WImage* m_shadowTilesTexture;
+
+	/** Width and height of the atlas */
+	uint32_t m_atlasSize;
+	/** Width and height of a tile */
+	uint32_t m_tileSize;
+	/** Number of cascades of directional lights */
+	uint32_t m_numCascades;
+	/** View distance covered by the cascades */
+	float m_shadowDistance;
+	/** Maximum tiles rendered per frame */
+	uint32_t m_maxTileUpdates;
+
+	/** All the tiles of the atlas */
+	std::vector<SHADOW_TILE> m_tiles;
+	/** Lights that currently own tiles */
+	std::unordered_map<class WLight*, LIGHT_SHADOW> m_lightShadows;
+	/** Lights that have shadows this frame, in order of priority */
+	std::vector<class WLight*> m_shadowedLights;
+	/** Last known bounds of the shadow casters */
+	std::unordered_map<class WObject*, SHADOW_CASTER> m_casters;
+
+	/** Picks the lights that have shadows this frame and assigns them tiles */
+	void AllocateTiles(const W_GLOBAL_FRAME_DATA& frameData);
+	/** Computes the view of a tile of a light */
+	void UpdateTileCamera(SHADOW_TILE& tile, const W_GLOBAL_FRAME_DATA& frameData);
+	/** Invalidates the tiles that see casters which changed since the last frame */
+	void InvalidateTiles();
+	/** Invalidates the tiles that can see a box */
+	void InvalidateTilesAt(WVector3 center, WVector3 size);
+	/** Frees the tiles of a light */
+	void FreeLightTiles(class WLight* light);
+	/** Called when a light is added or removed */
+	void OnLightsChange(class WLight* light, bool added);
+
+public:
+	WShadowRenderStage(class Wasabi* const app);
+
+	virtual WError Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height);
+	virtual WError Render(class WRenderer* renderer, class WRenderTarget* rt, uint32_t filter);
+	virtual void Cleanup();
+	/** The atlas has a fixed size ("shadowAtlasSize"), it does not follow the window size */
+	virtual WError Resize(uint32_t width, uint32_t height);
+
+	/**
+	 * Retrieves the tiles of a light in the shadow tiles texture for the
+	 * current frame. Only valid after this stage has rendered in the frame.
+	 * @param  light    Light to query
+	 * @param  firstTile Set to the index of the light's first tile
+	 * @param  numTiles  Set to the number of tiles of the light (0 if the light
+	 *                   has no shadows this frame)
+	 * @return          true if the light has shadows this frame
+	 */
+	bool GetLightShadowTiles(class WLight* light, uint32_t* firstTile, uint32_t* numTiles) const;
+
+	/**
+	 * @return The depth atlas holding all the shadow maps
+	 */
+	class WImage* GetShadowAtlas() const;
+
+	/**
+	 * @return The texture describing the tiles of the atlas (see above)
+	 */
+	class WImage* GetShadowTilesTexture() const;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Wasabi/Renderers/WRenderStage.hpp"
+#include "Wasabi/Materials/WEffect.hpp"
+#include "Wasabi/Memory/WBufferedBuffer.hpp"
+
+#include <unordered_map>
+
+class WSkinningRenderStageCS : public WShader {
+public:
+	WSkinningRenderStageCS(class Wasabi* const app);
+	virtual void Load(bool bSaveData = false);
+};
+
+/*
+ * Implementation of a render stage that skins the vertices of the animated objects once per frame in a compute
+ * shader (recorded in RecordCompute(), see RENDER_STAGE_FLAG_ASYNC_COMPUTE), so that the stages that render the
+ * objects more than once per frame don't skin them again. The skinned vertices of all the objects are written to
+ * one buffer per buffering index, in the layout of the default vertex (WDefaultVertex), and every object is given
+ * its range (see WObject::SetSkinnedVertices()). The stages whose object fragments are created with
+ * useSkinnedVertices (WGBufferRenderStage, WBackfaceDepthRenderStage, WForwardRenderStage and
+ * WShadowRenderStage) then render those objects with their non-animated effect.
+ *
+ * An object is skinned if it is visible, has a valid animation that is not a crowd animation, has a rigged
+ * geometry with the default vertex layout and only uses the engine's default materials. Other objects (and the
+ * objects that don't fit in the buffer) are skinned in the vertex shader as usual.
+ *
+ * This stage renders to the render target of the previous stage without drawing anything, it should come right
+ * after the first stage that renders the objects (so it's culled along with it).
+ * The number of vertices skinned per frame is capped by the engine parameter "maxSkinnedVertices" (see
+ * Wasabi::engineParams).
+ */
+class WSkinningRenderStage : public WRenderStage {
+	class WEffect* m_skinningFX;
+	/** Skinned vertices of the current frame, one buffer per buffering index */
+	WBufferedBuffer m_skinnedVertices;
+	/** Capacity of every buffer of m_skinnedVertices, in vertices */
+	uint32_t m_maxSkinnedVertices;
+	/** Material of the skinning effect of every object that was skinned */
+	std::unordered_map<class WObject*, class WMaterial*> m_objectMaterials;
+	/** Objects given skinned vertices in the last frame */
+	std::vector<class WObject*> m_skinnedObjects;
+
+	/**
+	 * Checks whether the vertices of an object can be skinned by this stage.
+	 * @param  object Object to check
+	 * @return        true if the object can be skinned, false otherwise
+	 */
+	bool _CanSkin(class WObject* object) const;
+
+	/**
+	 * Called by the object manager when an object is added or removed.
+	 * @param object The object
+	 * @param added  true if the object was added, false if it was removed
+	 */
+	void _OnObjectChange(class WObject* object, bool added);
+
+public:
+	WSkinningRenderStage(class Wasabi* const app);
+
+	virtual WError Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height);
+	virtual WError Render(class WRenderer* renderer, class WRenderTarget* rt, uint32_t filter);
+	virtual WError RecordCompute(class WRenderer* renderer, VkCommandBuffer cmdBuf);
+	virtual void Cleanup();
+	virtual WError Resize(uint32_t width, uint32_t height);
+};
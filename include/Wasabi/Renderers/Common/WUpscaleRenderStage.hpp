@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Wasabi/Renderers/WRenderStage.hpp"
+#include "Wasabi/Materials/WEffect.hpp"
+
+class WUpscaleRenderStagePS : public WShader {
+public:
+	WUpscaleRenderStagePS(class Wasabi* const app);
+	virtual void Load(bool bSaveData = false);
+};
+
+/*
+ * Implementation of a render stage that brings the output of a stage rendered at the dynamic resolution scale
+ * (see WRenderer::GetResolutionScale()) to the back buffer. The color is upscaled with a bicubic filter and the
+ * depth is copied so that the stages after this one (particles, sprites and texts) render at the native
+ * resolution and are still occluded by the scene.
+ */
+class WUpscaleRenderStage : public WRenderStage {
+	class WSprite* m_fullscreenSprite;
+	class WEffect* m_effect;
+	class WMaterial* m_material;
+	/** Names of the color and depth images to upscale */
+	std::string m_colorName, m_depthName;
+
+public:
+	/**
+	 * @param app       Wasabi application
+	 * @param colorName Name of the color output of a previous stage to upscale
+	 * @param depthName Name of the depth output of a previous stage to upscale
+	 */
+	WUpscaleRenderStage(class Wasabi* const app, std::string colorName = "ForwardColor", std::string depthName = "ForwardDepth");
+
+	virtual WError Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height);
+	virtual WError Render(class WRenderer* renderer, class WRenderTarget* rt, uint32_t filter);
+	virtual void Cleanup();
+	virtual WError Resize(uint32_t width, uint32_t height);
+};
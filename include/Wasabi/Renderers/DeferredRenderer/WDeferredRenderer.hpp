@@ -14,4 +14,17 @@
 
 #include "Wasabi/Core/WCore.hpp"
 
+/**
+ * Sets the render stages of a deferred renderer on the application's renderer.
+ * If the engine parameter "mergedDeferredPasses" is set (Default is false),
+ * the G-buffer, light buffer, scene composition and forward objects are
+ * rendered as subpasses of a single render pass (see WGBufferRenderStage) so
+ * the G-buffer can stay in tile memory on tiled GPUs, and the result is
+ * upscaled to the back buffer.
+ * If the engine parameter "computeSkinning" is set (Default is false), the
+ * animated objects are skinned in a compute pass (see WSkinningRenderStage)
+ * instead of in the vertex shaders of every pass that renders them.
+ * @param  app Wasabi application
+ * @return     Error code, see WError.h
+ */
 WError WInitializeDeferredRenderer(Wasabi* app);
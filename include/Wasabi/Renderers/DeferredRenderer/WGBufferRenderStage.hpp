@@ -32,13 +32,19 @@ public:
  * Color attachment 1: R16G16B16A16 - rg is packed normals, b is specular power, a is specular intensity
  * Code for packing and unpacking of normals can be found in `src/Wasabi/Renderers/Common/Shaders/utils.glsl`
  * (WasabiPackNormalSpheremapTransform and WasabiUnpackNormalSpheremapTransform)
+ *
+ * If created with mergedPasses, the stage's render target also holds the attachments of the merged
+ * WLightBufferRenderStage and WSceneCompositionRenderStage, which render in its next subpasses:
+ * * Subpass 0 (this stage): renders the G-buffer
+ * * Subpass 1: reads the normals and depth as input attachments and renders the LightBuffer
+ * * Subpass 2: reads the G-buffer and LightBuffer as input attachments and renders SceneColor (R8G8B8A8)
+ * * Subpass 3: renders the forward objects on top of SceneColor, depth-tested against the G-buffer depth
+ * The albedo, normals and LightBuffer are transient attachments (they never leave the render pass), only
+ * SceneColor and the depth are stored.
  */
 class WGBufferRenderStage : public WRenderStage {
 	WObjectsRenderFragment* m_objectsFragment;
-	class WMaterial* m_perFrameMaterial;
-
 	WObjectsRenderFragment* m_animatedObjectsFragment;
-	class WMaterial* m_perFrameAnimatedMaterial;
 
 	WGBufferVS* m_defaultVS;
 	WGBufferAnimatedVS* m_defaultAnimatedVS;
@@ -47,7 +53,12 @@ class WGBufferRenderStage : public WRenderStage {
 	WEffect* m_defaultAnimatedFX;
 
 public:
-	WGBufferRenderStage(class Wasabi* const app);
+	/**
+	 * @param app          Wasabi application
+	 * @param mergedPasses Set to true to render the lighting and the composition in subpasses of this stage's
+	 *                     render pass (see above)
+	 */
+	WGBufferRenderStage(class Wasabi* const app, bool mergedPasses = false);
 
 	virtual WError Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height);
 	virtual WError Render(class WRenderer* renderer, class WRenderTarget* rt, uint32_t filter);
@@ -1,11 +1,30 @@
 #pragma once
 
 #include "Wasabi/Renderers/WRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WLightClusters.hpp"
 
 class WShader;
 
-
-
+/*
+ * Implementation of a deferred light accumulation stage that renders the lights onto the LightBuffer output
+ * using the GBuffer normals and depth.
+ * With the engine parameter "clusteredDeferredLighting" set (see Wasabi::engineParams), all lights are
+ * accumulated in a single full-screen pass using the clustered light lists (see WLightClusters), otherwise a
+ * light volume is rendered per light. The point and spot light volumes are rendered in one instanced draw per
+ * light type, their back faces are tested against the G-buffer depth (which the stage then uses as a read-only
+ * depth attachment) and against the depth bounds of the visible volumes (if the device supports it).
+ * The clustered pass renders up to "maxLights" lights (see Wasabi::engineParams). With the engine parameter
+ * "computeLightClusters" set, the light clusters are filled in a compute pass recorded in RecordCompute().
+ * With the engine parameter "tiledDeferredLighting" set, the lights are instead accumulated by a compute pass
+ * recorded in RecordPassCompute(): every 16x16 pixels tile reduces the depth bounds of its pixels, culls the
+ * lights against its frustum clamped to those bounds and lights its pixels, the result is then copied onto
+ * the LightBuffer.
+ * If the renderer has a WShadowRenderStage, the clustered and tiled passes apply the shadows of the lights (the
+ * light volumes do not).
+ * If created with mergedPasses, the stage renders the clustered pass in the second subpass of the
+ * WGBufferRenderStage's render target (which must be the previous stage and owns the LightBuffer) and reads the
+ * G-buffer as input attachments, "clusteredDeferredLighting" and "tiledDeferredLighting" are ignored.
+ */
 class WLightBufferRenderStage : public WRenderStage {
 	/** blend state used for all light renders */
 	VkPipelineColorBlendAttachmentState m_blendState;
@@ -22,23 +41,59 @@ class WLightBufferRenderStage : public WRenderStage {
 		class WSprite* fullscreenSprite;
 		/** Per-frame material for this light type */
 		class WMaterial* perFrameMaterial;
-		/** Render materials for all lights of this type */
+		/** Render materials for all lights of this type (only used if lightsBuffer is null) */
 		unordered_map<class WLight*, class WMaterial*> materialMap;
+		/** Per-frame storage buffer of the visible lights of this type, 4 vec4 per light: (color, intensity),
+		    (view-space direction, range), (view-space position, min cos angle) and (spot radius, 0, 0, 0).
+		    If set, all lights of this type are rendered in one instanced draw of geometry, every instance
+		    reading its light at gl_InstanceIndex */
+		class WBufferedBuffer* lightsBuffer;
+		/** Number of lights that fit in lightsBuffer */
+		uint32_t lightsBufferCapacity;
 
-		LightTypeAssets() : geometry(nullptr), effect(nullptr), fullscreenSprite(nullptr), perFrameMaterial(nullptr) {}
+		LightTypeAssets() : geometry(nullptr), effect(nullptr), fullscreenSprite(nullptr), perFrameMaterial(nullptr), lightsBuffer(nullptr), lightsBufferCapacity(0) {}
 
 		/** Free the resources of this object */
-		void Destroy();
+		void Destroy(class Wasabi* app);
 	};
 	/** Map of light type -> LightTypeAssets to render that light */
 	std::unordered_map<int, LightTypeAssets> m_lightRenderingAssets;
 
+	/** Whether all lights are accumulated in one pass from the light clusters or using per-light volumes */
+	bool m_clusteredLighting;
+	/** Whether all lights are accumulated by the tiled compute pass (takes precedence over m_clusteredLighting) */
+	bool m_tiledLighting;
+	/** Whether the light volumes use the depth bounds test (if the device has the depthBounds feature) */
+	bool m_depthBoundsTest;
+	/** Whether the stage renders in a subpass of the G-buffer's render pass */
+	bool m_mergedPasses;
+	/** Per-cluster light lists used by the clustered pass, only its lights buffer is used by the tiled pass */
+	WLightClusters* m_lightClusters;
+	/** Assets used by the clustered pass, only fullscreenSprite, effect and perFrameMaterial are used */
+	LightTypeAssets m_clusteredLightsAssets;
+	/** Compute effect of the tiled pass */
+	class WEffect* m_tiledLightsFX;
+	/** Material of m_tiledLightsFX */
+	class WMaterial* m_tiledLightsMaterial;
+	/** Lighting written by the tiled pass, copied onto the LightBuffer */
+	class WImage* m_tiledLightsImage;
+	/** Assets used to copy m_tiledLightsImage, only fullscreenSprite, effect and perFrameMaterial are used */
+	LightTypeAssets m_tiledLightsAssets;
+
 	/** Initializes point lights assets */
 	WError LoadPointLightsAssets();
 	/** Initializes spot light assets */
 	WError LoadSpotLightsAssets();
 	/** Initializes directional lights assets */
 	WError LoadDirectionalLightsAssets();
+	/** Initializes the clustered lights pass assets */
+	WError LoadClusteredLightsAssets();
+	/** Initializes the tiled lights pass assets */
+	WError LoadTiledLightsAssets(uint32_t width, uint32_t height);
+	/** (Re)creates m_tiledLightsImage */
+	WError CreateTiledLightsImage(uint32_t width, uint32_t height);
+	/** (Re)creates the lights buffer of assets if it cannot hold numLights lights */
+	WError ReserveLightsBuffer(LightTypeAssets& assets, uint32_t numLights);
 
 	/**
 	 * Callback called whenever a light is added/removed from the lights manager
@@ -46,10 +101,16 @@ class WLightBufferRenderStage : public WRenderStage {
 	void OnLightsChange(class WLight* light, bool is_added);
 
 public:
-	WLightBufferRenderStage(class Wasabi* const app);
+	/**
+	 * @param app          Wasabi application
+	 * @param mergedPasses Set to true to render in a subpass of the G-buffer's render pass (see above)
+	 */
+	WLightBufferRenderStage(class Wasabi* const app, bool mergedPasses = false);
 
 	virtual WError Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height);
 	virtual WError Render(class WRenderer* renderer, class WRenderTarget* rt, uint32_t filter);
+	virtual WError RecordCompute(class WRenderer* renderer, VkCommandBuffer cmdBuf);
+	virtual WError RecordPassCompute(class WRenderer* renderer, VkCommandBuffer cmdBuf);
 	virtual void Cleanup();
 	virtual WError Resize(uint32_t width, uint32_t height);
 };
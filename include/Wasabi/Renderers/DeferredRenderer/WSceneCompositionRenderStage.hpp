@@ -3,15 +3,31 @@
 #include "Wasabi/Renderers/WRenderStage.hpp"
 #include "Wasabi/Renderers/ForwardRenderer/WForwardRenderStage.hpp"
 
+/*
+ * Render stage that composes the G-buffer, the light buffer and the SSAO into the back buffer, then renders
+ * the forward objects on top.
+ * If created with mergedPasses, the stage composes in the third subpass of the WGBufferRenderStage's render
+ * target (which must be the previous stage) into its "SceneColor" output, reading the G-buffer and the light
+ * buffer as input attachments, then renders the forward objects in the fourth subpass on top of
+ * "SceneColor", depth-tested against the G-buffer depth. Custom forward effects must then be built for the
+ * G-buffer stage's render target and subpass 3. In that mode the SSAO only uses the back-face depth (input
+ * attachments can't be sampled around the pixel).
+ */
 class WSceneCompositionRenderStage : public WForwardRenderStage {
 	class WSprite* m_fullscreenSprite;
 	class WEffect* m_effect;
 	class WMaterial* m_perFrameMaterial;
 	class WMaterial* m_constantsMaterial;
 	float m_currentCameraFarPlane;
+	/** Whether the stage renders in a subpass of the G-buffer's render pass */
+	bool m_mergedPasses;
 
 public:
-	WSceneCompositionRenderStage(class Wasabi* const app);
+	/**
+	 * @param app          Wasabi application
+	 * @param mergedPasses Set to true to compose in a subpass of the G-buffer's render pass (see above)
+	 */
+	WSceneCompositionRenderStage(class Wasabi* const app, bool mergedPasses = false);
 
 	virtual WError Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height);
 	virtual WError Render(class WRenderer* renderer, class WRenderTarget* rt, uint32_t filter);
@@ -2,18 +2,11 @@
 
 #include "Wasabi/Renderers/WRenderStage.hpp"
 #include "Wasabi/Renderers/Common/WRenderFragment.hpp"
+#include "Wasabi/Renderers/Common/WLightClusters.hpp"
 #include "Wasabi/Materials/WEffect.hpp"
 #include "Wasabi/Materials/WMaterial.hpp"
 #include "Wasabi/Objects/WObject.hpp"
 
-struct LightStruct {
-	WVector4 color;
-	WVector4 dir;
-	WVector4 pos;
-	int type;
-	int pad[3];
-};
-
 class WForwardRenderStageObjectVS : public WShader {
 public:
 	WForwardRenderStageObjectVS(class Wasabi* const app);
@@ -50,9 +43,84 @@ public:
 };
 
 /*
- * Implementation of a forward rendering stage that renders objects and terrains with simple lighting.
- * Creating this stage adds the following engine parameters:
- * * "maxLights": Maximum number of lights that can be rendered at once (Default is (void*)16)
+ * A fragment that renders the depth of the objects that the forward stage shades with its default effects.
+ * The depth-only materials are only created for (and kept on) the objects that have a material of the default
+ * forward effect, objects with custom forward effects may move their vertices differently and are depth-tested
+ * normally.
+ */
+class WForwardDepthPrepassFragment : public WObjectsRenderFragment {
+	/** Default forward effect of the objects rendered by this fragment */
+	class WEffect* m_forwardEffect;
+
+public:
+	WForwardDepthPrepassFragment(std::string fragmentName, bool animated, WEffect* fx, WEffect* forwardFx, class Wasabi* wasabi)
+		: WObjectsRenderFragment(fragmentName, animated, fx, wasabi, EFFECT_RENDER_FLAG_RENDER_DEPTH_ONLY, false, true) {
+		m_forwardEffect = forwardFx;
+	}
+
+	virtual bool ShouldRenderEntity(WObject* object) override {
+		bool usesDefaultEffect = object->GetMaterial(m_forwardEffect) != nullptr;
+		bool hasMaterial = object->GetMaterial(m_renderEffect) != nullptr;
+		if (usesDefaultEffect && !hasMaterial) {
+			object->AddEffect(m_renderEffect, 0);
+			class WMaterial* material = object->GetMaterial(m_renderEffect);
+			if (!material)
+				return false;
+			material->SetName(GenerateMaterialName());
+		} else if (!usesDefaultEffect && hasMaterial)
+			object->RemoveEffect(m_renderEffect);
+		return usesDefaultEffect && WObjectsRenderFragment::ShouldRenderEntity(object);
+	};
+};
+
+/*
+ * A fragment that renders the depth of the terrains that the forward stage shades with its default effect,
+ * see WForwardDepthPrepassFragment.
+ */
+class WForwardTerrainDepthPrepassFragment : public WTerrainRenderFragment {
+	/** Default forward effect of the terrains rendered by this fragment */
+	class WEffect* m_forwardEffect;
+
+public:
+	WForwardTerrainDepthPrepassFragment(std::string fragmentName, WEffect* fx, WEffect* forwardFx, class Wasabi* wasabi)
+		: WTerrainRenderFragment(fragmentName, fx, wasabi, EFFECT_RENDER_FLAG_RENDER_DEPTH_ONLY) {
+		m_forwardEffect = forwardFx;
+	}
+
+	virtual bool ShouldRenderEntity(WTerrain* terrain) override {
+		bool usesDefaultEffect = terrain->GetMaterial(m_forwardEffect) != nullptr;
+		bool hasMaterial = terrain->GetMaterial(m_renderEffect) != nullptr;
+		if (usesDefaultEffect && !hasMaterial) {
+			terrain->AddEffect(m_renderEffect, 0);
+			class WMaterial* material = terrain->GetMaterial(m_renderEffect);
+			if (!material)
+				return false;
+			material->SetName(GenerateMaterialName());
+		} else if (!usesDefaultEffect && hasMaterial)
+			terrain->RemoveEffect(m_renderEffect);
+		return usesDefaultEffect;
+	};
+
+	virtual void OnEntityAdded(WTerrain* terrain) override {
+		// the depth-only materials are created when the terrains are rendered, see ShouldRenderEntity()
+		UNREFERENCED_PARAMETER(terrain);
+	}
+};
+
+/*
+ * Implementation of a forward rendering stage that renders objects and terrains with clustered lighting
+ * (see WLightClusters). If the renderer has a WShadowRenderStage, the lights are shadowed using its atlas.
+ * The stage renders to the back buffer, or with backbuffer set to false, to its own "ForwardColor" and
+ * "ForwardDepth" outputs at the dynamic resolution scale (see WRenderer::GetResolutionScale()), in which
+ * case it has to be followed by a WUpscaleRenderStage.
+ * With the engine parameter "forwardDepthPrepass" set, the stage first renders the depth of the objects and
+ * terrains that use its default effects (same vertex shaders, no fragment shader), then shades them with an
+ * equal depth test so every pixel is shaded once. The prepass depth is in the stage's depth attachment, so
+ * the stages that render after it in the same target (such as particles) test against it, and with
+ * backbuffer set to false it can be sampled from the "ForwardDepth" output.
+ * The number of lights is capped by the engine parameter "maxLights" (see Wasabi::engineParams). With the
+ * engine parameter "computeLightClusters" set, the light clusters are filled in a compute pass recorded in
+ * RecordCompute().
  */
 class WForwardRenderStage : public WRenderStage {
 	WObjectsRenderFragment* m_objectsFragment;
@@ -63,16 +131,34 @@ class WForwardRenderStage : public WRenderStage {
 	WTerrainRenderFragment* m_terrainsFragment;
 	class WMaterial* m_perFrameTerrainsMaterial;
 
-	std::vector<LightStruct> m_lights;
+	WLightClusters* m_lightClusters;
+
+	/** Whether the depth prepass is rendered */
+	bool m_depthPrepass;
+	WForwardDepthPrepassFragment* m_prepassObjectsFragment;
+	WForwardDepthPrepassFragment* m_prepassAnimatedObjectsFragment;
+	WForwardTerrainDepthPrepassFragment* m_prepassTerrainsFragment;
+
+	/**
+	 * Creates an effect that only renders the depth of a forward vertex shader.
+	 * @param  name     Name of the effect
+	 * @param  vs       Vertex shader of the forward effect
+	 * @param  features Features supported by the forward effect
+	 * @return          The new effect, nullptr on failure
+	 */
+	class WEffect* _CreateDepthPrepassEffect(std::string name, class WShader* vs, W_EFFECT_FEATURE_FLAGS features);
 
 protected:
 	bool m_addDefaultEffects; // @TODO please fix this mess
+	/** Subpass of the render target that the stage's effects render in (see WEffect::SetSubpass()), 0 by default */
+	uint32_t m_subpass;
 
 public:
-	WForwardRenderStage(class Wasabi* const app);
+	WForwardRenderStage(class Wasabi* const app, bool backbuffer = true);
 
 	virtual WError Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height);
 	virtual WError Render(class WRenderer* renderer, class WRenderTarget* rt, uint32_t filter);
+	virtual WError RecordCompute(class WRenderer* renderer, VkCommandBuffer cmdBuf);
 	virtual void Cleanup();
 	virtual WError Resize(uint32_t width, uint32_t height);
 
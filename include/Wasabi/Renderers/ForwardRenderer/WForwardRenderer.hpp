@@ -9,4 +9,14 @@
 
 #include "Wasabi/Core/WCore.hpp"
 
+/**
+ * Sets the render stages of a forward renderer on the application's renderer.
+ * If the engine parameter "dynamicResolution" is set (Default is false), the
+ * scene is rendered offscreen and upscaled to the back buffer.
+ * If the engine parameter "computeSkinning" is set (Default is false), the
+ * animated objects are skinned in a compute pass (see WSkinningRenderStage)
+ * instead of in the vertex shaders of every pass that renders them.
+ * @param  app Wasabi application
+ * @return     Error code, see WError.h
+ */
 WError WInitializeForwardRenderer(Wasabi* app);
@@ -0,0 +1,182 @@
+/** @file WRenderGraph.hpp
+ *  @brief Dependency graph of the render stages
+ *
+ *  The render stages declare the images they write (their outputs) and the
+ *  images they sample (their inputs). From those declarations, the graph
+ *  finds the passes that contribute to the back buffer, places the layout
+ *  transitions and barriers between the passes and shares the images of
+ *  attachments that are not used at the same time.
+ *
+ *  @author Hasan Al-Jawaheri (hbj)
+ *  @bug No known bugs.
+ */
+
+#pragma once
+
+#include "Wasabi/Core/WCore.hpp"
+#include "Wasabi/Images/WImage.hpp"
+
+/**
+ * The render graph of a WRenderer, built from the render stages every time
+ * they are set (see WRenderer::SetRenderingStages()).
+ *
+ * A pass is a render stage that has its own render target followed by all the
+ * stages that render to the previous target. The graph:
+ * * Culls the passes that don't contribute to the back buffer: a pass is kept
+ *   if it renders to the back buffer, if it has an output that is not
+ *   transient (see WRenderStage::OUTPUT_IMAGE::transient, outputs are not
+ *   transient unless the stage says so) or if a kept pass reads or renders on
+ *   top of one of its outputs. Culled stages are not rendered.
+ * * Records the barriers of every pass in one vkCmdPipelineBarrier before the
+ *   pass begins: the images it samples are transitioned to
+ *   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL (waiting for the passes that
+ *   rendered them) and its attachments are transitioned to the attachment
+ *   layouts (waiting for the passes that sampled them). Images that no pass
+ *   samples are transitioned at the end of the frame so they can still be
+ *   sampled by the application.
+ * * Allocates the transient outputs of stages that render to a buffer.
+ *   Transient outputs that have the same format and whose lifetimes (from the
+ *   pass that renders them to the last pass that uses them) don't overlap
+ *   share the same image, and since their contents are not kept, the
+ *   transitions into their first pass discard them. Outputs created with
+ *   W_IMAGE_CREATE_TRANSIENT_ATTACHMENT only share images with other such
+ *   outputs and are never transitioned to be sampled. Note that in the
+ *   default forward and deferred pipelines every transient output is used
+ *   until the last pass that renders to a buffer, so none of them share an
+ *   image; sharing only happens in pipelines with longer chains of passes
+ *   (e.g. a post-processing stage whose input is no longer needed once its
+ *   output is rendered).
+ */
+class WRenderGraph {
+public:
+	WRenderGraph(class Wasabi* const app);
+	~WRenderGraph();
+
+	/**
+	 * Builds the graph of a list of render stages and creates the images of
+	 * the transient outputs. This should be called before the stages are
+	 * initialized, the stages take their transient outputs from the graph (see
+	 * GetTransientImage()).
+	 * @param  stages Render stages, in rendering order
+	 * @param  width  Width of the transient images
+	 * @param  height Height of the transient images
+	 * @return        Error code, see WError.h
+	 */
+	WError Build(const std::vector<class WRenderStage*>& stages, uint32_t width, uint32_t height);
+
+	/**
+	 * Frees the images of the graph and clears it.
+	 */
+	void Cleanup();
+
+	/**
+	 * Resizes the images of the transient outputs. This should be called
+	 * before the render stages are resized.
+	 * @param  width  New width
+	 * @param  height New height
+	 * @return        Error code, see WError.h
+	 */
+	WError Resize(uint32_t width, uint32_t height);
+
+	/**
+	 * @param  stageIndex Index of the stage in the list given to Build()
+	 * @return            true if the stage doesn't contribute to the back
+	 *                    buffer and should not be rendered
+	 */
+	bool IsStageCulled(uint32_t stageIndex) const;
+
+	/**
+	 * Records the barriers needed before the pass that starts at the given
+	 * stage. This should be called before the render target of the stage
+	 * begins.
+	 * @param cmdBuf     Command buffer to record to
+	 * @param stageIndex Index of the first stage of the pass
+	 */
+	void RecordPassBarriers(VkCommandBuffer cmdBuf, uint32_t stageIndex);
+
+	/**
+	 * Records the transitions of the rendered images that no pass sampled, so
+	 * that all the outputs are in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL at
+	 * the end of the frame. This should be called after the last pass ends.
+	 * @param cmdBuf Command buffer to record to
+	 */
+	void RecordFinalBarriers(VkCommandBuffer cmdBuf);
+
+	/**
+	 * Retrieves the image allocated by the graph for a transient output.
+	 * @param  stage Stage that renders the output
+	 * @param  name  Name of the output
+	 * @return       The image to use for the output, nullptr if the output is
+	 *               not transient or is not in the graph
+	 */
+	class WImage* GetTransientImage(const class WRenderStage* stage, std::string name) const;
+
+	/**
+	 * @return The number of images allocated for the transient outputs
+	 */
+	uint32_t GetNumTransientImages() const;
+
+private:
+	/** An image rendered by a stage */
+	struct RESOURCE {
+		/** Name of the output */
+		std::string name;
+		/** Stage that owns the output */
+		class WRenderStage* producer;
+		/** Format of the image */
+		VkFormat format;
+		/** Flags used to create the image */
+		W_IMAGE_CREATE_FLAGS imageFlags;
+		/** Whether the image is a depth attachment */
+		bool isDepth;
+		/** Whether the image is allocated by the graph */
+		bool transient;
+		/** Pass that renders the image first */
+		uint32_t firstPass;
+		/** Last (live) pass that renders or samples the image */
+		uint32_t lastPass;
+		/** Index of the image in m_images if transient */
+		uint32_t image;
+		/** Whether a live pass samples the image */
+		bool sampled;
+	};
+
+	/** A render target and the stages that render to it */
+	struct PASS {
+		/** Index of the first stage of the pass */
+		uint32_t firstStage;
+		/** Whether the pass renders to the back buffer */
+		bool backBuffer;
+		/** Whether the pass is rendered */
+		bool live;
+		/** Indices of the resources the pass renders to */
+		std::vector<uint32_t> writes;
+		/** Indices of the resources the pass samples */
+		std::vector<uint32_t> reads;
+	};
+
+	/** An image shared by transient resources */
+	struct TRANSIENT_IMAGE {
+		class WImage* image;
+		VkFormat format;
+		W_IMAGE_CREATE_FLAGS imageFlags;
+		/** Last pass that uses the image */
+		uint32_t lastPass;
+	};
+
+	/** Pointer to the Wasabi application */
+	class Wasabi* m_app;
+	/** Passes of the graph */
+	std::vector<PASS> m_passes;
+	/** Index of the pass of every stage */
+	std::vector<uint32_t> m_stagePasses;
+	/** All the outputs of the stages */
+	std::vector<RESOURCE> m_resources;
+	/** Images of the transient resources */
+	std::vector<TRANSIENT_IMAGE> m_images;
+
+	/** Finds a resource by its name, returns UINT_MAX if not found */
+	uint32_t _FindResource(std::string name) const;
+	/** Retrieves the current image of a resource */
+	class WImage* _GetResourceImage(const RESOURCE& resource) const;
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Wasabi/Core/WCore.hpp"
+#include "Wasabi/Images/WImage.hpp"
+#include "Wasabi/Images/WRenderTarget.hpp"
 
 enum W_RENDER_STAGE_TARGET: uint8_t {
 	RENDER_STAGE_TARGET_BUFFER = 0,
@@ -14,10 +16,17 @@ enum W_RENDER_STAGE_FLAGS: uint32_t {
 	RENDER_STAGE_FLAG_TEXTS_RENDER_STAGE = 2,
 	RENDER_STAGE_FLAG_PARTICLES_RENDER_STAGE = 4,
 	RENDER_STAGE_FLAG_PICKING_RENDER_STAGE = 8,
+	RENDER_STAGE_FLAG_DYNAMIC_RESOLUTION = 16,
+	/** The stage records compute work before the frame is rendered (see WRenderStage::RecordCompute()) */
+	RENDER_STAGE_FLAG_ASYNC_COMPUTE = 32,
+	/** The stage records compute work in the frame before its render target begins (see
+	    WRenderStage::RecordPassCompute()), only for stages that don't render to the previous target */
+	RENDER_STAGE_FLAG_PASS_COMPUTE = 64,
 };
 
 class WRenderStage {
 	friend class WRenderer;
+	friend class WRenderGraph;
 
 protected:
 	class Wasabi* m_app;
@@ -30,6 +39,16 @@ protected:
 		bool isFromPreviousStage;
 		VkFormat format;
 		WColor clearColor;
+		/** Set if the contents of the image are only used by the render stages within a frame (false by
+		    default). Outputs that are not transient may be used across frames or by the application (e.g. by
+		    materials or sprites), so their stage is never culled and they never share an image with other
+		    outputs. Transient outputs are allocated by the render graph and their stage is culled if no kept
+		    stage uses them */
+		bool transient;
+		/** Flags used to create the image (W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT by
+		    default). Images only read by later subpasses of the same render pass can be created with
+		    W_IMAGE_CREATE_INPUT_ATTACHMENT | W_IMAGE_CREATE_TRANSIENT_ATTACHMENT so they never leave the GPU tiles */
+		W_IMAGE_CREATE_FLAGS imageFlags;
 
 		OUTPUT_IMAGE();
 		OUTPUT_IMAGE(std::string name, WColor clear = WColor(-1000000.0f, -1.0f, -1.0f, -1.0f));
@@ -41,6 +60,15 @@ protected:
 		W_RENDER_STAGE_TARGET target;
 		std::vector<OUTPUT_IMAGE> colorOutputs;
 		OUTPUT_IMAGE depthOutput;
+		/** Names of the output images of previous stages that this stage samples. The render graph (see
+		    WRenderGraph) uses them to place the barriers and to cull stages whose outputs are not used. If the
+		    depthOutput of the stage is an input too (from a previous stage), the stage only tests against it and
+		    the depth attachment is read-only (see WRenderTarget::SetReadOnlyDepth()) */
+		std::vector<std::string> inputs;
+		/** Subpasses of the render target of a stage that renders to a buffer (see
+		    WRenderTarget::SetSubpasses()), empty for a single subpass. Stages that render to the previous
+		    target call WRenderTarget::NextSubpass() to render in the next subpass */
+		std::vector<W_RENDER_TARGET_SUBPASS> subpasses;
 		uint32_t flags;
 	} m_stageDescription;
 
@@ -52,6 +80,21 @@ public:
 
 	virtual WError Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height);
 	virtual WError Render(class WRenderer* renderer, class WRenderTarget* rt, uint32_t filter) = 0;
+	/**
+	 * Called every frame, before any stage renders, for the stages flagged with RENDER_STAGE_FLAG_ASYNC_COMPUTE.
+	 * The command buffer is submitted to the compute queue (see Wasabi::GetVulkanComputeQueue()), or is the
+	 * frame's graphics command buffer if there is no compute queue. Resources written here and read while
+	 * rendering must be declared with WRenderer::TransferComputeBuffer() or WRenderer::TransferComputeImage().
+	 */
+	virtual WError RecordCompute(class WRenderer* renderer, VkCommandBuffer cmdBuf);
+	/**
+	 * Called every frame for the stages flagged with RENDER_STAGE_FLAG_PASS_COMPUTE, right before the stage's
+	 * render target begins. The command buffer is the frame's graphics command buffer, outside of any render
+	 * pass, and the inputs of the stage are already readable by shaders (including compute shaders), so this
+	 * can process the outputs of the previous stages. The stage must record the barriers that make its compute
+	 * writes visible to its rendering.
+	 */
+	virtual WError RecordPassCompute(class WRenderer* renderer, VkCommandBuffer cmdBuf);
 	virtual void Cleanup();
 	virtual WError Resize(uint32_t width, uint32_t height);
 };
@@ -28,6 +28,71 @@ enum W_RENDER_FILTER: uint32_t {
 	RENDER_FILTER_TERRAIN = 16,
 };
 
+/** Index of the descriptor set reserved for the engine-wide per-frame UBO. Any
+		shader resource bound at this set is provided by the renderer (see
+		WRenderer::GetGlobalFrameDescriptorSet()) and is bound automatically by
+		WEffect::Bind() (with the data of the render target being rendered),
+		materials cannot be created for this set. */
+#define W_GLOBAL_FRAME_SET_INDEX 2
+
+/**
+ * Layout of the engine-wide per-frame UBO. The renderer writes this structure
+ * once per frame for the main camera, and once more for every render target
+ * when it begins (WRenderTarget::Begin()) with the camera of that render
+ * target. It is available to all effects at set W_GLOBAL_FRAME_SET_INDEX,
+ * binding 0, where WEffect::Bind() selects the copy of the render target being
+ * rendered. The GLSL counterpart can be found in
+ * `src/Wasabi/Renderers/Common/Shaders/global_frame.glsl`.
+ */
+struct W_GLOBAL_FRAME_DATA {
+	/** View matrix of the camera */
+	WMatrix viewMatrix;
+	/** Projection matrix of the camera */
+	WMatrix projectionMatrix;
+	/** viewMatrix * projectionMatrix */
+	WMatrix viewProjectionMatrix;
+	/** Inverse of projectionMatrix */
+	WMatrix projectionInverseMatrix;
+	/** xyz is the world position of the camera, w is the near clip plane */
+	WVector4 camPosW;
+	/** xyz is the look direction of the camera, w is the far clip plane */
+	WVector4 camDirW;
+	/** x is the elapsed time (in seconds), y is the frame delta time and z is
+			the frame index */
+	WVector4 time;
+	/** xy is the size of the screen in pixels, zw is 1 / xy */
+	WVector4 resolution;
+	/** xy is the fraction of the screen rendered by the dynamic resolution
+			stages (see WRenderer::GetResolutionScale()), zw is the size of that
+			region in pixels */
+	WVector4 resolutionScale;
+	/** Number of (non-hidden) lights in the scene */
+	int numLights;
+	int pad[3];
+};
+
+/** Binding index (in the W_GLOBAL_FRAME_SET_INDEX set) of the scene objects
+		storage buffer, see WRenderer::AllocateSceneObject() */
+#define W_SCENE_OBJECTS_BINDING_INDEX 1
+
+/** Returned by WRenderer::AllocateSceneObject() when the scene buffer is full */
+#define W_INVALID_SCENE_OBJECT_INDEX 0xFFFFFFFF
+
+/**
+ * Layout of a single entry in the renderer's scene objects storage buffer.
+ * Each entity that allocates a scene object (see
+ * WRenderer::AllocateSceneObject()) owns one entry at a stable index which
+ * shaders read using that index. The GLSL counterpart can be found in
+ * `src/Wasabi/Renderers/Common/Shaders/global_frame.glsl`.
+ */
+struct W_SCENE_OBJECT_DATA {
+	/** World matrix of the entity */
+	WMatrix worldMatrix;
+	/** Inverse transpose of worldMatrix, transforms the normals of the entity
+	    to world space (correct under non-uniform scaling) */
+	WMatrix normalMatrix;
+};
+
 /** Specifies the type of a texture sampler */
 enum W_TEXTURE_SAMPLER_TYPE: uint8_t {
 	/** Default renderer's sampler */
@@ -44,6 +109,7 @@ enum W_TEXTURE_SAMPLER_TYPE: uint8_t {
  */
 class WRenderer {
 	friend class Wasabi;
+	friend class WRenderTarget;
 	friend int RunWasabi(class Wasabi*);
 
 public:
@@ -88,7 +154,9 @@ public:
 	 * Destroys the previously set render stages and assigns the new ones. This
 	 * function will call Initialize on all the render stages. Render stages
 	 * define the sequence of rendering events that happen when each frame is
-	 * rendered.
+	 * rendered. The render graph of the stages is built from their declared
+	 * outputs and inputs (see WRenderGraph), so stages must list the images of
+	 * previous stages they sample in their inputs.
 	 * @param stages  Render stages to use
 	 * @return        Error code, see WError
 	 */
@@ -137,6 +205,12 @@ public:
 	 */
 	class WImage* GetRenderTargetImage(std::string imageName) const;
 
+	/**
+	 * Retrieves the render graph built from the current render stages.
+	 * @return The render graph
+	 */
+	class WRenderGraph* GetRenderGraph() const;
+
 	/**
 	 * Retrieves the swap chain.
 	 */
@@ -170,6 +244,166 @@ public:
 	 */
 	VkQueue GetQueue() const;
 
+	/**
+	 * Retrieves the descriptor set layout of the engine-wide per-frame UBO. This
+	 * layout is used by effects for set W_GLOBAL_FRAME_SET_INDEX.
+	 * @return Descriptor set layout of the global per-frame UBO
+	 */
+	VkDescriptorSetLayout GetGlobalFrameDescriptorSetLayout() const;
+
+	/**
+	 * Retrieves an empty descriptor set layout. Effects use this layout to fill
+	 * the descriptor set indices that none of their shaders use.
+	 * @return An empty descriptor set layout
+	 */
+	VkDescriptorSetLayout GetEmptyDescriptorSetLayout() const;
+
+	/**
+	 * Retrieves the descriptor set of the engine-wide per-frame UBO for the
+	 * current buffering index. The UBO is a dynamic uniform buffer, it has to be
+	 * bound with the offset returned by GetGlobalFrameOffset().
+	 * @return Descriptor set of the global per-frame UBO
+	 */
+	VkDescriptorSet GetGlobalFrameDescriptorSet() const;
+
+	/**
+	 * Retrieves the dynamic offset of the global per-frame data of a render
+	 * target in the global per-frame UBO. The data of a render target is
+	 * written by WRenderTarget::Begin() using the camera of the render target.
+	 * @param rt Render target to get the offset of, nullptr for the data of the
+	 *           main camera (the camera of the picking render stage)
+	 * @return   Offset to bind the global per-frame UBO with
+	 */
+	uint32_t GetGlobalFrameOffset(class WRenderTarget* rt = nullptr) const;
+
+	/**
+	 * Retrieves the data written to the engine-wide per-frame UBO this frame.
+	 * @param rt Render target to get the data of, nullptr for the data of the
+	 *           main camera (the camera of the picking render stage)
+	 * @return   The current global per-frame data
+	 */
+	const W_GLOBAL_FRAME_DATA& GetGlobalFrameData(class WRenderTarget* rt = nullptr) const;
+
+	/**
+	 * Computes the global per-frame data that WRenderTarget::Begin() will
+	 * write for a render target later in this frame, for the work that needs
+	 * it before the render target begins (see WRenderStage::RecordCompute()
+	 * and WRenderStage::RecordPassCompute()).
+	 * @param rt Render target to get the data of, nullptr for the data of the
+	 *           main camera
+	 * @return   The global per-frame data the render target will use
+	 */
+	W_GLOBAL_FRAME_DATA GetUpcomingGlobalFrameData(class WRenderTarget* rt);
+
+	/**
+	 * Retrieves the dynamic resolution scale used this frame. When the engine
+	 * parameter "dynamicResolution" is set, the render stages flagged with
+	 * RENDER_STAGE_FLAG_DYNAMIC_RESOLUTION render to the top-left region of
+	 * their targets with this scale, and the scale is adjusted every frame so
+	 * that the GPU frame time meets "targetGPUFrameTime". Stages that sample
+	 * those targets should use the resolutionScale of the global frame data
+	 * (see `src/Wasabi/Renderers/Common/Shaders/upscale.glsl`).
+	 * @return Scale of the width and height of the screen, in (0, 1]
+	 */
+	float GetResolutionScale() const;
+
+	/**
+	 * Retrieves the GPU time of the last measured frame. This is only measured
+	 * while the engine parameter "dynamicResolution" is set and the device
+	 * supports timestamp queries.
+	 * @return GPU frame time in milliseconds, 0 if not measured
+	 */
+	float GetGPUFrameTime() const;
+
+	/**
+	 * Sets the present mode of the swap chain and re-creates it. FIFO waits
+	 * for the vertical blank (no tearing, presenting may block), mailbox
+	 * replaces the queued image (no tearing, never blocks) and immediate
+	 * presents right away (may tear). VK_PRESENT_MODE_MAX_ENUM_KHR picks the
+	 * lowest latency mode available (mailbox, then immediate, then FIFO). The
+	 * initial mode is taken from the engine parameter "presentMode".
+	 * @param  mode Requested present mode, FIFO is used if the surface does not
+	 *              support it
+	 * @return      Error code, see WError.h
+	 */
+	WError SetPresentMode(VkPresentModeKHR mode);
+
+	/**
+	 * @return The present mode the swap chain was created with
+	 */
+	VkPresentModeKHR GetPresentMode() const;
+
+	/**
+	 * @return true if the compute work of the render stages is submitted to a
+	 *         separate compute queue, false if it is recorded on the graphics
+	 *         queue (see the engine parameter "asyncCompute")
+	 */
+	bool HasAsyncCompute() const;
+
+	/**
+	 * Declares a buffer that a render stage writes in its compute work (see
+	 * WRenderStage::RecordCompute()) and that is read while rendering the
+	 * frame. This must be called from WRenderStage::RecordCompute(). The
+	 * renderer places a barrier between the compute work and the rendering if
+	 * they are recorded on the same queue, otherwise the rendering waits for
+	 * the compute queue at the reading stages. Buffers and images that are not
+	 * attachments are shared by the graphics and compute queue families (see
+	 * WBufferedBuffer::Create() and WBufferedImage::Create()), so no ownership
+	 * transfer is needed in either direction. The compute work should use one
+	 * buffer per buffering index for the resources it writes (the renderer
+	 * waits for the previous frame using that index before recording its
+	 * compute work).
+	 * @param buffer    Buffer written by the compute work
+	 * @param dstStages Pipeline stages that read the buffer while rendering
+	 * @param dstAccess Access types of those reads
+	 */
+	void TransferComputeBuffer(VkBuffer buffer, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess);
+
+	/**
+	 * Declares an image that a render stage writes in its compute work, see
+	 * TransferComputeBuffer(). The image stays in the same layout.
+	 * @param image     Image written by the compute work
+	 * @param range     Subresources of the image written by the compute work
+	 * @param layout    Layout of the image while it is written and read
+	 * @param dstStages Pipeline stages that read the image while rendering
+	 * @param dstAccess Access types of those reads
+	 */
+	void TransferComputeImage(VkImage image, VkImageSubresourceRange range, VkImageLayout layout, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess);
+
+	/**
+	 * Retrieves a bound resource description of the engine-wide per-frame UBO
+	 * that can be added to a shader's bound resources to read the global
+	 * per-frame data (the shader should include global_frame.glsl).
+	 * @return Bound resource description of the global per-frame UBO
+	 */
+	static struct W_BOUND_RESOURCE GetGlobalFrameBoundResource();
+
+	/**
+	 * Allocates an entry in the scene objects storage buffer. The entry keeps
+	 * its index until it is freed using FreeSceneObject(), and shaders can read
+	 * it from the buffer at binding W_SCENE_OBJECTS_BINDING_INDEX of the set
+	 * W_GLOBAL_FRAME_SET_INDEX. The size of the buffer is set by the engine
+	 * parameter "maxSceneObjects".
+	 * @return Index of the allocated entry, W_INVALID_SCENE_OBJECT_INDEX if
+	 *         the buffer is full
+	 */
+	uint32_t AllocateSceneObject();
+
+	/**
+	 * Frees an entry allocated by AllocateSceneObject().
+	 * @param index Index of the entry to free
+	 */
+	void FreeSceneObject(uint32_t index);
+
+	/**
+	 * Sets the data of an entry in the scene objects storage buffer. The data
+	 * is only uploaded to the GPU for the entries that were updated, so this
+	 * should only be called when the data changes.
+	 * @param index Index of the entry, as returned by AllocateSceneObject()
+	 * @param data  New data of the entry
+	 */
+	void UpdateSceneObject(uint32_t index, const W_SCENE_OBJECT_DATA& data);
+
 private:
 	/** Pointer to the Wasabi application */
 	class Wasabi* m_app;
@@ -179,12 +413,26 @@ private:
 	VkQueue m_queue;
 	/** Vulkan swap chain */
 	VulkanSwapChain* m_swapChain;
+	/** Present mode requested for the swap chain (see SetPresentMode()) */
+	VkPresentModeKHR m_presentMode;
+	/** Compute queue used by the stages' compute work, VK_NULL_HANDLE to use the graphics queue */
+	VkQueue m_computeQueue;
+	/** Command pool for the compute queue's family */
+	VkCommandPool m_computeCommandPool;
+	/** Barriers of the buffers written by the compute work this frame (used when there is no compute queue) */
+	std::vector<VkBufferMemoryBarrier> m_computeBufferTransfers;
+	/** Barriers of the images written by the compute work this frame (used when there is no compute queue) */
+	std::vector<VkImageMemoryBarrier> m_computeImageTransfers;
+	/** Pipeline stages that read the resources written by the compute work this frame */
+	VkPipelineStageFlags m_computeTransferStages;
 	/** Default Vulkan sampler */
 	VkSampler m_sampler;
 	/** Currently set rendering stages */
 	std::vector<class WRenderStage*> m_renderStages;
 	/** Currently set rendering stages, stored in an unordered map for quick access */
 	std::unordered_map<std::string, class WRenderStage*> m_renderStageMap;
+	/** Dependency graph of the currently set rendering stages */
+	class WRenderGraph* m_renderGraph;
 	/** Name of the currently set render stage that renders to the back buffer */
 	std::string m_backbufferRenderStageName;
 	/** Name of the currently set render stage for sprites */
@@ -213,14 +461,160 @@ private:
 			means that previous frame which used this buffer index is done with the
 			memory and it is safe to write to it) */
 		std::vector<VkFence> memoryFences;
+		/** Command buffers of the compute queue, one per buffer (empty without a
+		    compute queue). The graphics submission waits for them, so the memory
+		    fences also cover them */
+		std::vector<VkCommandBuffer> computeCommandBuffers;
+		/** Semaphores signalled when the compute work of a buffer is done */
+		std::vector<VkSemaphore> computeComplete;
+		/** Pool of computeCommandBuffers */
+		VkCommandPool computeCommandPool;
 		/** Index currently used, this is not the same as the framebuffer returned
 		    by VkAcquireNExtImageKHR, it is independent and round-robin'd */
 		uint32_t curIndex;
 
-		VkResult Create(class Wasabi* app, uint32_t numBuffers);
+		VkResult Create(class Wasabi* app, uint32_t numBuffers, VkCommandPool computePool);
 		void Destroy(class Wasabi* app);
 	} m_perBufferResources;
 
+	/** Engine-wide per-frame UBO, one buffer per buffered frame. Each buffer
+	    holds one W_GLOBAL_FRAME_DATA slot for the main camera (slot 0) and one
+	    for every render target that began (see WRenderTarget::Begin()) */
+	WBufferedBuffer m_globalFrameBuffer;
+	/** CPU copies of the data written to the slots of m_globalFrameBuffer this
+	    frame, indexed by slot */
+	std::vector<W_GLOBAL_FRAME_DATA> m_globalFrameData;
+	/** Size of a slot in m_globalFrameBuffer (aligned to the device's minimum
+	    uniform buffer offset alignment) */
+	uint32_t m_globalFrameSlotSize;
+	/** Maximum number of slots in m_globalFrameBuffer */
+	uint32_t m_maxGlobalFrameSlots;
+	/** Render target slots of m_globalFrameBuffer that were freed, to be reused */
+	std::vector<uint32_t> m_freeGlobalFrameSlots;
+	/** Descriptor set layout of the global per-frame UBO */
+	VkDescriptorSetLayout m_globalFrameSetLayout;
+	/** An empty descriptor set layout used by effects for unused set indices */
+	VkDescriptorSetLayout m_emptySetLayout;
+	/** Descriptor pool for m_globalFrameSets */
+	VkDescriptorPool m_globalFrameDescriptorPool;
+	/** Descriptor sets of the global per-frame UBO, one per buffered frame */
+	std::vector<VkDescriptorSet> m_globalFrameSets;
+	/** Scene objects storage buffer, one buffer per buffered frame */
+	WBufferedBuffer m_sceneObjectsBuffer;
+	/** Maximum number of entries in m_sceneObjectsBuffer */
+	uint32_t m_maxSceneObjects;
+	/** CPU copy of the scene objects data */
+	std::vector<W_SCENE_OBJECT_DATA> m_sceneObjects;
+	/** Number of buffered frames each scene object still needs to be written to */
+	std::vector<uint8_t> m_sceneObjectsPendingWrites;
+	/** Indices of the scene objects that need to be written to the buffers */
+	std::vector<uint32_t> m_dirtySceneObjects;
+	/** Indices of freed scene objects, to be reused by AllocateSceneObject() */
+	std::vector<uint32_t> m_freeSceneObjects;
+	/** Number of frames rendered so far */
+	uint32_t m_frameIndex;
+	/** Elapsed time of the last rendered frame */
+	float m_lastFrameTime;
+	/** Timestamp queries at the start and end of every buffered frame */
+	VkQueryPool m_timestampQueryPool;
+	/** Nanoseconds per timestamp tick */
+	float m_timestampPeriod;
+	/** Resolution scale each buffered frame was recorded with, 0 if its
+	    timestamps were not written */
+	std::vector<float> m_timestampScales;
+	/** GPU time of the last measured frame (in milliseconds) */
+	float m_gpuFrameTime;
+	/** Current dynamic resolution scale */
+	float m_resolutionScale;
+	/** Size of the region rendered by the dynamic resolution stages */
+	uint32_t m_scaledWidth, m_scaledHeight;
+
+	/**
+	 * Creates the global per-frame UBO, the scene objects buffer and their
+	 * descriptor sets.
+	 * @return Error code, see WError.h
+	 */
+	WError _CreateGlobalFrameResources();
+
+	/**
+	 * Frees the global per-frame UBO and scene objects buffer resources.
+	 */
+	void _DestroyGlobalFrameResources();
+
+	/**
+	 * Fills the main camera's slot of the global per-frame UBO of the current
+	 * buffering index.
+	 */
+	void _UpdateGlobalFrameData();
+
+	/**
+	 * Allocates a slot in the global per-frame UBO for a render target.
+	 * @return Index of the allocated slot, 0 if the UBO is full
+	 */
+	uint32_t _AllocateGlobalFrameSlot();
+
+	/**
+	 * Frees a slot allocated by _AllocateGlobalFrameSlot().
+	 * @param slot Index of the slot to free
+	 */
+	void _FreeGlobalFrameSlot(uint32_t slot);
+
+	/**
+	 * Writes the global per-frame data of a camera to a slot of the global
+	 * per-frame UBO of the current buffering index. Fields that don't depend on
+	 * the camera are copied from the main camera's slot.
+	 * @param slot Index of the slot to write
+	 * @param cam  Camera to write the data of
+	 */
+	void _WriteGlobalFrameSlot(uint32_t slot, class WCamera* cam);
+
+	/**
+	 * Sets the fields of global per-frame data that depend on the camera.
+	 * @param frameData Data to set the fields of
+	 * @param cam       Camera to set the fields from
+	 */
+	void _SetGlobalFrameCamera(W_GLOBAL_FRAME_DATA& frameData, class WCamera* cam);
+
+	/**
+	 * Creates the timestamp queries used to measure the GPU frame time, if
+	 * dynamic resolution is enabled and the device supports them.
+	 */
+	void _CreateTimestampQueries();
+
+	/**
+	 * Frees the timestamp queries.
+	 */
+	void _DestroyTimestampQueries();
+
+	/**
+	 * Reads the GPU time of the last frame that used the current buffering
+	 * index and picks the dynamic resolution scale of this frame.
+	 */
+	void _UpdateResolutionScale();
+
+	/**
+	 * Records the compute work of the render stages and their transfers to the
+	 * graphics queue, and submits it to the compute queue if there is one.
+	 * @param  graphicsCmdBuf Graphics command buffer of this frame, already
+	 *                        recording
+	 * @return                true if compute work was submitted to the compute
+	 *                        queue (the graphics submission has to wait for it)
+	 */
+	bool _RecordCompute(VkCommandBuffer graphicsCmdBuf);
+
+	/**
+	 * Sets the viewport and scissor of the currently recording render target
+	 * to either the full screen or the dynamic resolution region.
+	 * @param scaled Whether to use the dynamic resolution region
+	 */
+	void _SetStageViewport(bool scaled);
+
+	/**
+	 * Writes the scene objects that changed to the scene objects buffer of the
+	 * current buffering index.
+	 */
+	void _UpdateSceneObjects();
+
 	/** Current width of the screen (window client) */
 	uint32_t m_width;
 	/** Current height of the screen (window client) */
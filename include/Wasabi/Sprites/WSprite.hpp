@@ -274,6 +274,8 @@ public:
 	 *            depth/stencil state will be used
 	 * @param bs  Rasterization state to use. If none is provided, the default
 	 *            rasterization state will be used
+	 * @param subpass Subpass of rt the effect renders in (see
+	 *            WEffect::SetSubpass())
 	 * @return    Newly created effect, or nullptr on failure
 	 */
 	class WEffect* CreateSpriteEffect(
@@ -281,7 +283,8 @@ public:
 		class WShader* ps = nullptr,
 		VkPipelineColorBlendAttachmentState bs = {},
 		VkPipelineDepthStencilStateCreateInfo dss = {},
-		VkPipelineRasterizationStateCreateInfo rs = {}
+		VkPipelineRasterizationStateCreateInfo rs = {},
+		uint32_t subpass = 0
 	) const;
 
 private:
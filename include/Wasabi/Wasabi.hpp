@@ -23,7 +23,9 @@
 #include "Wasabi/Lights/WLight.hpp"
 #include "Wasabi/Animations/WAnimation.hpp"
 #include "Wasabi/Animations/WSkeletalAnimation.hpp"
+#include "Wasabi/Animations/WCrowdAnimation.hpp"
 #include "Wasabi/Particles/WParticles.hpp"
+#include "Wasabi/Particles/WParticlesKernels.hpp"
 #include "Wasabi/Terrains/WTerrain.hpp"
 
 /**
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "TestSuite.hpp"
+#include <Wasabi/Renderers/ForwardRenderer/WForwardRenderer.hpp>
+
+/**
+ * Saves a skeleton compressed, reloads it and checks that every bone of
+ * every keyframe is within the compression errors of the original, then
+ * plays the reloaded skeleton.
+ */
+class AnimationCompressionDemo : public WTestState {
+	WObject* character;
+	float maxPositionError, maxRotationError;
+
+public:
+	AnimationCompressionDemo(Wasabi* const app);
+
+	virtual void Load();
+	virtual void Update(float fDeltaTime);
+	virtual void Cleanup();
+
+	virtual WError SetupRenderer() { return WInitializeForwardRenderer(m_app); }
+};
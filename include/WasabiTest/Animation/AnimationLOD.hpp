@@ -0,0 +1,28 @@
+#pragma once
+
+#include "TestSuite.hpp"
+#include <Wasabi/Renderers/ForwardRenderer/WForwardRenderer.hpp>
+
+/**
+ * Renders an animated character in view and another one outside the view of
+ * the camera but between the first one and the light, so it is drawn into the
+ * shadow atlas. The character outside the view must stay at the off-screen
+ * animation LOD (see WAnimationManager::Update()) since only the camera's
+ * passes report the visibility of the animations.
+ */
+class AnimationLODDemo : public WTestState {
+	WObject* visibleCharacter;
+	WObject* offscreenCharacter;
+	/** Number of consecutive frames in which offscreenCharacter was outside
+	    the camera's view */
+	uint32_t framesOffscreen;
+
+public:
+	AnimationLODDemo(Wasabi* const app);
+
+	virtual void Load();
+	virtual void Update(float fDeltaTime);
+	virtual void Cleanup();
+
+	virtual WError SetupRenderer() { return WInitializeForwardRenderer(m_app); }
+};
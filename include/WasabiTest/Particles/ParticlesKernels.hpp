@@ -0,0 +1,22 @@
+#pragma once
+
+#include "TestSuite.hpp"
+#include <Wasabi/Renderers/ForwardRenderer/WForwardRenderer.hpp>
+
+/**
+ * Runs the particle kernels of every instruction set the CPU supports on
+ * random particles and checks that they give exactly the same results as the
+ * scalar kernels.
+ */
+class ParticlesKernelsDemo : public WTestState {
+	std::string m_results;
+
+public:
+	ParticlesKernelsDemo(Wasabi* const app);
+
+	virtual void Load();
+	virtual void Update(float fDeltaTime);
+	virtual void Cleanup();
+
+	virtual WError SetupRenderer() { return WInitializeForwardRenderer(m_app); }
+};
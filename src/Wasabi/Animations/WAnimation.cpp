@@ -6,9 +6,83 @@ WAnimationManager::~WAnimationManager() {
 }
 void WAnimationManager::Update(float fDeltaTime) {
 	uint32_t entitiyCount = GetEntitiesCount();
+	m_updatedAnimations.resize(entitiyCount);
 	for (uint32_t i = 0; i < entitiyCount; i++)
-		GetEntityByIndex(i)->Update(fDeltaTime);
+		m_updatedAnimations[i] = GetEntityByIndex(i);
+
+	_ScheduleUpdates();
+
+	// evaluate the poses on the worker threads, then upload them from this thread
+	m_app->ThreadPool.ParallelFor(entitiyCount, 1, [this, fDeltaTime](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++)
+			m_updatedAnimations[i]->EvaluatePose(fDeltaTime);
+	});
+	for (uint32_t i = 0; i < entitiyCount; i++) {
+		WAnimation* anim = m_updatedAnimations[i];
+		anim->UploadPose();
+		if (anim->m_bEvaluatePose)
+			anim->m_framesSinceEvaluation = 0;
+		anim->m_framesSinceEvaluation = std::min(anim->m_framesSinceEvaluation + 1, std::numeric_limits<uint32_t>::max() - 1);
+		anim->m_bEvaluatePose = true;
+		anim->m_visibleScreenSize = -1.0f;
+	}
 }
+
+void WAnimationManager::_ScheduleUpdates() {
+	if (!m_app->GetEngineParam<bool>("animationLOD", true)) {
+		for (uint32_t i = 0; i < m_updatedAnimations.size(); i++) {
+			m_updatedAnimations[i]->m_lod = W_ANIMATION_LOD();
+			m_updatedAnimations[i]->m_bEvaluatePose = true;
+		}
+		return;
+	}
+
+	float fFullRateSize = (float)m_app->GetEngineParam<int>("animationLODFullRateSize", 25) / 100.0f;
+	float fBoneDepthSize = (float)m_app->GetEngineParam<int>("animationLODBoneDepthSize", 5) / 100.0f;
+	uint32_t maxInterval = std::max(m_app->GetEngineParam<uint32_t>("animationLODMaxInterval", 8), 1u);
+	uint32_t boneDepth = m_app->GetEngineParam<uint32_t>("animationLODBoneDepth", 4);
+	uint32_t boneBudget = m_app->GetEngineParam<uint32_t>("animationBoneBudget", 0);
+
+	m_dueAnimations.clear();
+	for (uint32_t i = 0; i < m_updatedAnimations.size(); i++) {
+		WAnimation* anim = m_updatedAnimations[i];
+		W_ANIMATION_LOD lod;
+		if (anim->m_numObjects > 0) {
+			float fSize = anim->m_visibleScreenSize;
+			if (fSize <= 0.0f) {
+				lod.updateInterval = maxInterval;
+				lod.maxBoneDepth = boneDepth;
+			} else {
+				if (fSize < fFullRateSize)
+					lod.updateInterval = std::min((uint32_t)(fFullRateSize / fSize), maxInterval);
+				if (fSize < fBoneDepthSize)
+					lod.maxBoneDepth = boneDepth;
+			}
+		}
+		anim->m_lod = lod;
+		anim->m_bEvaluatePose = anim->m_framesSinceEvaluation >= lod.updateInterval;
+		if (anim->m_bEvaluatePose)
+			m_dueAnimations.push_back(anim);
+	}
+
+	if (boneBudget == 0 || m_dueAnimations.size() <= 1)
+		return;
+
+	// evaluate the most visible and most overdue animations first, the rest wait for a later frame
+	auto priority = [](const WAnimation* anim) {
+		return (std::max(anim->m_visibleScreenSize, 0.0f) + 0.01f) * (float)anim->m_framesSinceEvaluation;
+	};
+	std::sort(m_dueAnimations.begin(), m_dueAnimations.end(), [&priority](const WAnimation* a, const WAnimation* b) {
+		return priority(a) > priority(b);
+	});
+	uint32_t cost = 0;
+	for (uint32_t i = 0; i < m_dueAnimations.size(); i++) {
+		cost += m_dueAnimations[i]->GetPoseCost(m_dueAnimations[i]->m_lod);
+		if (cost > boneBudget && i > 0)
+			m_dueAnimations[i]->m_bEvaluatePose = false;
+	}
+}
+
 std::string WAnimationManager::GetTypeName() const {
 	return "Animation";
 }
@@ -18,6 +92,10 @@ WAnimation::WAnimation(Wasabi* const app, uint32_t ID) : WFileAsset(app, ID) {
 
 	m_bFramesOwner = true;
 	m_totalTime = 0.0f;
+	m_bEvaluatePose = true;
+	m_framesSinceEvaluation = std::numeric_limits<uint32_t>::max() - 1;
+	m_visibleScreenSize = -1.0f;
+	m_numObjects = 0;
 
 	//register the object
 	m_app->AnimationManager->AddEntity(this);
@@ -54,32 +132,51 @@ void WAnimation::SetName(std::string newName) {
 }
 
 void WAnimation::m_UpdateFirstFrame(uint32_t subAnimation) {
+	if (m_frameStartTimes.size() != m_frames.size() + 1)
+		m_UpdateFrameTimes();
+
+	auto framesBegin = m_frameStartTimes.begin();
+	auto framesEnd = m_frameStartTimes.begin() + m_frames.size();
 	if (subAnimation == std::numeric_limits<uint32_t>::max()) {
 		for (uint32_t i = 0; i < m_subAnimations.size(); i++) {
 			float fStartTime = ((W_SUB_ANIMATION*)m_subAnimations[i])->fPlayStartTime;
-			float fCurTime = 0.0f;
-			for (uint32_t n = 0; n < m_frames.size(); n++) {
-				if (fCurTime > fStartTime) {
-					((W_SUB_ANIMATION*)m_subAnimations[i])->firstFrame = n;
-					break;
-				}
-				fCurTime += ((W_FRAME*)m_frames[n])->fTime;
-			}
+			auto it = std::upper_bound(framesBegin, framesEnd, fStartTime);
+			if (it != framesEnd)
+				((W_SUB_ANIMATION*)m_subAnimations[i])->firstFrame = (uint32_t)(it - framesBegin);
 		}
 	} else {
 		float fStartTime = ((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fPlayStartTime;
-		float fCurTime = 0.0f;
-		for (uint32_t n = 0; n < m_frames.size(); n++) {
-			if (fCurTime >= fStartTime) {
-				((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->firstFrame = n;
-				break;
-			}
-			fCurTime += ((W_FRAME*)m_frames[n])->fTime;
-		}
+		auto it = std::lower_bound(framesBegin, framesEnd, fStartTime);
+		if (it != framesEnd)
+			((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->firstFrame = (uint32_t)(it - framesBegin);
 	}
 }
 
+void WAnimation::m_UpdateFrameTimes() {
+	m_frameStartTimes.resize(m_frames.size() + 1);
+	m_totalTime = 0.0f;
+	for (uint32_t i = 0; i < m_frames.size(); i++) {
+		m_frameStartTimes[i] = m_totalTime;
+		m_totalTime += ((W_FRAME*)m_frames[i])->fTime;
+	}
+	m_frameStartTimes[m_frames.size()] = m_totalTime;
+}
+
+uint32_t WAnimation::m_FindFrame(float fTime) const {
+	//the end time of frame i is the start time of frame i+1
+	auto endTimesBegin = m_frameStartTimes.begin() + 1;
+	return (uint32_t)(std::upper_bound(endTimesBegin, m_frameStartTimes.end(), fTime) - endTimesBegin);
+}
+
 void WAnimation::Update(float fDeltaTime) {
+	EvaluatePose(fDeltaTime);
+	UploadPose();
+}
+
+void WAnimation::EvaluatePose(float fDeltaTime) {
+	if (m_frameStartTimes.size() != m_frames.size() + 1)
+		m_UpdateFrameTimes();
+
 	for (uint32_t anim = 0; anim < m_subAnimations.size(); anim++) {
 		W_SUB_ANIMATION* curSubAnimation = (W_SUB_ANIMATION*)m_subAnimations[anim];
 		if (curSubAnimation->bPlaying)
@@ -88,22 +185,15 @@ void WAnimation::Update(float fDeltaTime) {
 		while (true) {
 			//if we passed the end time provided, don't search for next frame because we're done already
 			if (curSubAnimation->fCurrentTime < curSubAnimation->fPlayEndTime) {
-				float fTotalTime = 0.0f;
-				bool bContinue = true;
-				for (uint32_t i = 0; i < m_frames.size(); i++) {
-					fTotalTime += ((W_FRAME*)(m_frames[i]))->fTime;
-					if (curSubAnimation->fCurrentTime < fTotalTime) {
-						curSubAnimation->curFrame = i;
-						curSubAnimation->nextFrame = i + 1;
-						//if its the last frame, loop the next to the first
-						if (fTotalTime > curSubAnimation->fPlayEndTime - 0.001f || curSubAnimation->nextFrame == m_frames.size())
-							curSubAnimation->nextFrame = curSubAnimation->firstFrame;
-						bContinue = false;
-						break;
-					}
-				}
-				if (!bContinue)
+				uint32_t i = m_FindFrame(curSubAnimation->fCurrentTime);
+				if (i < m_frames.size()) {
+					curSubAnimation->curFrame = i;
+					curSubAnimation->nextFrame = i + 1;
+					//if its the last frame, loop the next to the first
+					if (m_frameStartTimes[i + 1] > curSubAnimation->fPlayEndTime - 0.001f || curSubAnimation->nextFrame == m_frames.size())
+						curSubAnimation->nextFrame = curSubAnimation->firstFrame;
 					break; // done with this animation for this iteration
+				}
 			}
 
 			//passed the total time, loop or not?
@@ -120,6 +210,30 @@ void WAnimation::Update(float fDeltaTime) {
 	}
 }
 
+void WAnimation::UploadPose() {
+}
+
+void WAnimation::ReportVisibility(float fScreenSize) {
+	m_visibleScreenSize = fmax(m_visibleScreenSize, fScreenSize);
+}
+
+void WAnimation::SetNumObjects(uint32_t numObjects) {
+	m_numObjects = numObjects;
+}
+
+uint32_t WAnimation::GetNumObjects() const {
+	return m_numObjects;
+}
+
+W_ANIMATION_LOD WAnimation::GetLOD() const {
+	return m_lod;
+}
+
+uint32_t WAnimation::GetPoseCost(const W_ANIMATION_LOD& lod) const {
+	UNREFERENCED_PARAMETER(lod);
+	return 1;
+}
+
 void WAnimation::AddSubAnimation() {
 	m_subAnimations.push_back(new W_SUB_ANIMATION);
 }
@@ -138,6 +252,7 @@ WError WAnimation::SetKeyFrameTime(uint32_t frame, float fTime) {
 		fTime += 0.01f;
 
 	((W_FRAME*)m_frames[frame])->fTime = fTime;
+	m_UpdateFrameTimes();
 
 	return WError(W_SUCCEEDED);
 }
@@ -157,44 +272,39 @@ void WAnimation::SetCurrentFrame(uint32_t frame, uint32_t subAnimation) {
 		return;
 	if (frame >= m_frames.size())
 		return;
+	if (m_frameStartTimes.size() != m_frames.size() + 1)
+		m_UpdateFrameTimes();
 
-	float fTotalTime = 0.0f;
-	for (uint32_t i = 0; i < m_frames.size(); i++) {
-		if (frame == i) {
-			if (subAnimation == std::numeric_limits<uint32_t>::max()) {
-				for (uint32_t n = 0; n < m_subAnimations.size(); n++) {
-					((W_SUB_ANIMATION*)m_subAnimations[n])->fCurrentTime = fTotalTime;
-					((W_SUB_ANIMATION*)m_subAnimations[n])->curFrame = i;
-				}
-			} else {
-				((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fCurrentTime = fTotalTime;
-				((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->curFrame = i;
-			}
-			return;
+	float fTotalTime = m_frameStartTimes[frame];
+	if (subAnimation == std::numeric_limits<uint32_t>::max()) {
+		for (uint32_t n = 0; n < m_subAnimations.size(); n++) {
+			((W_SUB_ANIMATION*)m_subAnimations[n])->fCurrentTime = fTotalTime;
+			((W_SUB_ANIMATION*)m_subAnimations[n])->curFrame = frame;
 		}
-		fTotalTime += ((W_FRAME*)(m_frames[i]))->fTime;
+	} else {
+		((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fCurrentTime = fTotalTime;
+		((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->curFrame = frame;
 	}
 }
 
 void WAnimation::SetCurrentTime(float fTime, uint32_t subAnimation) {
 	if (subAnimation >= m_subAnimations.size() && subAnimation != std::numeric_limits<uint32_t>::max())
 		return;
+	if (m_frameStartTimes.size() != m_frames.size() + 1)
+		m_UpdateFrameTimes();
 
-	float fTotalTime = 0.0f;
-	for (uint32_t i = 0; i < m_frames.size(); i++) {
-		fTotalTime += ((W_FRAME*)(m_frames[i]))->fTime;
-		if (fTime < fTotalTime) {
-			if (subAnimation == std::numeric_limits<uint32_t>::max()) {
-				for (uint32_t n = 0; n < m_subAnimations.size(); n++) {
-					((W_SUB_ANIMATION*)m_subAnimations[n])->fCurrentTime = fTime;
-					((W_SUB_ANIMATION*)m_subAnimations[n])->curFrame = i;
-				}
-			} else {
-				((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fCurrentTime = fTime;
-				((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->curFrame = i;
-			}
-			return;
+	uint32_t i = m_FindFrame(fTime);
+	if (i >= m_frames.size())
+		return;
+
+	if (subAnimation == std::numeric_limits<uint32_t>::max()) {
+		for (uint32_t n = 0; n < m_subAnimations.size(); n++) {
+			((W_SUB_ANIMATION*)m_subAnimations[n])->fCurrentTime = fTime;
+			((W_SUB_ANIMATION*)m_subAnimations[n])->curFrame = i;
 		}
+	} else {
+		((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fCurrentTime = fTime;
+		((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->curFrame = i;
 	}
 }
 
@@ -205,26 +315,19 @@ void WAnimation::SetPlayingBounds(uint32_t startFrame, uint32_t endFrame, uint32
 		endFrame = (uint32_t)m_frames.size() - 1;
 	if (startFrame > endFrame)
 		return;
+	if (m_frameStartTimes.size() != m_frames.size() + 1)
+		m_UpdateFrameTimes();
 
-	float fTotalTime = 0.0f;
-	for (uint32_t i = 0; i < m_frames.size(); i++) {
-		if (startFrame == i) {
-			if (subAnimation == std::numeric_limits<uint32_t>::max())
-				for (uint32_t n = 0; n < m_subAnimations.size(); n++)
-					((W_SUB_ANIMATION*)m_subAnimations[n])->fPlayStartTime = fTotalTime;
-			else
-				((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fPlayStartTime = fTotalTime;
-		}
-
-		fTotalTime += ((W_FRAME*)(m_frames[i]))->fTime;
-
-		if (endFrame == i) {
-			if (subAnimation == std::numeric_limits<uint32_t>::max())
-				for (uint32_t n = 0; n < m_subAnimations.size(); n++)
-					((W_SUB_ANIMATION*)m_subAnimations[n])->fPlayEndTime = fTotalTime;
-			else
-				((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fPlayEndTime = fTotalTime;
+	float fStartTime = m_frameStartTimes[startFrame];
+	float fEndTime = m_frameStartTimes[endFrame + 1];
+	if (subAnimation == std::numeric_limits<uint32_t>::max()) {
+		for (uint32_t n = 0; n < m_subAnimations.size(); n++) {
+			((W_SUB_ANIMATION*)m_subAnimations[n])->fPlayStartTime = fStartTime;
+			((W_SUB_ANIMATION*)m_subAnimations[n])->fPlayEndTime = fEndTime;
 		}
+	} else {
+		((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fPlayStartTime = fStartTime;
+		((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fPlayEndTime = fEndTime;
 	}
 
 	m_UpdateFirstFrame(subAnimation);
@@ -345,3 +448,7 @@ float WAnimation::GetTime(uint32_t subAnimation) const {
 
 	return ((W_SUB_ANIMATION*)m_subAnimations[subAnimation])->fCurrentTime;
 }
+
+float WAnimation::GetTotalTime() const {
+	return m_totalTime;
+}
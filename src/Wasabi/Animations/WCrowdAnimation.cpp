@@ -0,0 +1,228 @@
+#include "Wasabi/Animations/WCrowdAnimation.hpp"
+#include "Wasabi/Animations/WSkeletalAnimation.hpp"
+#include "Wasabi/Images/WImage.hpp"
+
+/** Number of pixels of a matrix in the baked texture */
+#define W_CROWD_MATRIX_PIXELS 4
+
+WCrowdAnimation::WCrowdAnimation(Wasabi* const app, uint32_t ID) : WAnimation(app, ID) {
+	m_bakedTex = nullptr;
+	m_bakedTexWidth = 0;
+}
+
+WCrowdAnimation::~WCrowdAnimation() {
+	_Destroy();
+}
+
+std::string WCrowdAnimation::_GetTypeName() {
+	return "CrowdAnimation";
+}
+
+std::string WCrowdAnimation::GetTypeName() const {
+	return _GetTypeName();
+}
+
+void WCrowdAnimation::_Destroy() {
+	W_SAFE_REMOVEREF(m_bakedTex);
+	m_bakedData.clear();
+	m_bakedTexWidth = 0;
+	m_clipDurations.clear();
+}
+
+WError WCrowdAnimation::_CreateTexture() {
+	int oldMips = m_app->GetEngineParam<int>("numGeneratedMips");
+	m_app->SetEngineParam<int>("numGeneratedMips", 1);
+	m_bakedTex = m_app->ImageManager->CreateImage(m_bakedData.data(), m_bakedTexWidth, m_bakedTexWidth, VK_FORMAT_R32G32B32A32_SFLOAT, W_IMAGE_CREATE_TEXTURE);
+	m_app->SetEngineParam<int>("numGeneratedMips", oldMips);
+	if (!m_bakedTex)
+		return WError(W_OUTOFMEMORY);
+	return WError(W_SUCCEEDED);
+}
+
+WError WCrowdAnimation::Bake(const vector<W_CROWD_ANIMATION_CLIP>& clips, float fSampleRate) {
+	if (!clips.size() || fSampleRate <= 0.0f)
+		return WError(W_INVALIDPARAM);
+	for (uint32_t c = 0; c < clips.size(); c++)
+		if (!clips[c].skeleton || !clips[c].skeleton->Valid())
+			return WError(W_INVALIDPARAM);
+
+	_Destroy();
+
+	//sample the clips with a skeleton that shares their frames, so that the
+	//playing state of the given skeletons is not touched
+	WSkeleton* sampler = new WSkeleton(m_app);
+	vector<vector<WMatrix>> samples(clips.size());
+	vector<uint32_t> numIntervals(clips.size());
+	uint32_t numBones = 0;
+	WError err(W_SUCCEEDED);
+	for (uint32_t c = 0; c < clips.size() && err; c++) {
+		err = sampler->UseAnimationFrames(clips[c].skeleton);
+		if (!err)
+			break;
+
+		float fStartTime = fmax(clips[c].fStartTime, 0.0f);
+		float fEndTime = fmin(clips[c].fEndTime, sampler->GetTotalTime());
+		if (fEndTime <= fStartTime) {
+			err = WError(W_INVALIDPARAM);
+			break;
+		}
+		sampler->SetPlayingBounds_Time(fStartTime, fEndTime);
+		float fDuration = fEndTime - fStartTime;
+		numIntervals[c] = std::max((uint32_t)ceilf(fDuration * fSampleRate), 1u);
+
+		for (uint32_t i = 0; i <= numIntervals[c]; i++) {
+			//the last sample is taken right before the end, like the skeleton's own playback
+			float fTime = fmin(fStartTime + fDuration * (float)i / (float)numIntervals[c], nextafterf(fEndTime, fStartTime));
+			sampler->SetCurrentTime(fTime);
+			sampler->EvaluatePose(0.0f);
+			const vector<WMatrix>& pose = sampler->GetPose();
+			if (c == 0 && i == 0)
+				numBones = (uint32_t)pose.size();
+			if (pose.size() != numBones || numBones == 0) {
+				err = WError(W_INVALIDPARAM); // all the clips must have the same bones
+				break;
+			}
+			samples[c].insert(samples[c].end(), pose.begin(), pose.end());
+		}
+		m_clipDurations.push_back(fDuration);
+	}
+	sampler->RemoveReference();
+	if (!err) {
+		_Destroy();
+		return err;
+	}
+
+	//the header pixels come first, then the matrices (aligned to a matrix)
+	uint32_t numHeaderPixels = 1 + (uint32_t)clips.size();
+	uint32_t numMatrices = (numHeaderPixels + W_CROWD_MATRIX_PIXELS - 1) / W_CROWD_MATRIX_PIXELS;
+	vector<uint32_t> firstMatrices(clips.size());
+	for (uint32_t c = 0; c < clips.size(); c++) {
+		firstMatrices[c] = numMatrices;
+		numMatrices += (uint32_t)samples[c].size();
+	}
+
+	float fExactWidth = sqrtf((float)numMatrices * W_CROWD_MATRIX_PIXELS);
+	m_bakedTexWidth = 2;
+	while (fExactWidth > m_bakedTexWidth)
+		m_bakedTexWidth *= 2;
+
+	m_bakedData.assign(m_bakedTexWidth * m_bakedTexWidth * 4, 0.0f);
+	m_bakedData[0] = (float)numBones;
+	for (uint32_t c = 0; c < clips.size(); c++) {
+		float* clipPixel = &m_bakedData[(1 + c) * 4];
+		clipPixel[0] = (float)firstMatrices[c];
+		clipPixel[1] = (float)numIntervals[c];
+		clipPixel[2] = m_clipDurations[c];
+		clipPixel[3] = clips[c].bLoop ? 1.0f : 0.0f;
+		memcpy(&m_bakedData[firstMatrices[c] * W_CROWD_MATRIX_PIXELS * 4], samples[c].data(), samples[c].size() * sizeof(WMatrix));
+	}
+
+	err = _CreateTexture();
+	if (!err)
+		_Destroy();
+	return err;
+}
+
+uint32_t WCrowdAnimation::GetNumClips() const {
+	return (uint32_t)m_clipDurations.size();
+}
+
+float WCrowdAnimation::GetClipDuration(uint32_t clip) const {
+	if (clip < m_clipDurations.size())
+		return m_clipDurations[clip];
+	return 0.0f;
+}
+
+void WCrowdAnimation::EvaluatePose(float fDeltaTime) {
+	UNREFERENCED_PARAMETER(fDeltaTime);
+}
+
+WImage* WCrowdAnimation::GetTexture() const {
+	return m_bakedTex;
+}
+
+WError WCrowdAnimation::CopyFrom(const WAnimation* const from) {
+	if (!from || !from->Valid() || from->GetTypeName() != _GetTypeName())
+		return WError(W_INVALIDPARAM);
+
+	_Destroy();
+
+	WCrowdAnimation* fromC = (WCrowdAnimation*)from;
+	m_bakedData = fromC->m_bakedData;
+	m_bakedTexWidth = fromC->m_bakedTexWidth;
+	m_clipDurations = fromC->m_clipDurations;
+
+	WError err = _CreateTexture();
+	if (!err)
+		_Destroy();
+	return err;
+}
+
+WError WCrowdAnimation::UseAnimationFrames(const WAnimation* const anim) {
+	if (!anim || !anim->Valid() || anim->GetTypeName() != _GetTypeName())
+		return WError(W_INVALIDPARAM);
+
+	_Destroy();
+
+	WCrowdAnimation* fromC = (WCrowdAnimation*)anim;
+	m_bakedTex = fromC->m_bakedTex;
+	m_bakedTex->AddReference();
+	m_bakedData = fromC->m_bakedData;
+	m_bakedTexWidth = fromC->m_bakedTexWidth;
+	m_clipDurations = fromC->m_clipDurations;
+
+	return WError(W_SUCCEEDED);
+}
+
+bool WCrowdAnimation::Valid() const {
+	return m_bakedTex && m_clipDurations.size();
+}
+
+std::vector<void*> WCrowdAnimation::LoadArgs() {
+	return std::vector<void*>();
+}
+
+WError WCrowdAnimation::SaveToStream(WFile* file, std::ostream& outputStream) {
+	UNREFERENCED_PARAMETER(file);
+
+	if (!Valid())
+		return WError(W_NOTVALID);
+
+	//Format: <NUMCLIPS><TEXWIDTH><PIXELS:TEXWIDTH*TEXWIDTH*4 floats>
+	uint32_t numClips = (uint32_t)m_clipDurations.size();
+	outputStream.write((char*)&numClips, 4);
+	outputStream.write((char*)&m_bakedTexWidth, 4);
+	outputStream.write((char*)m_bakedData.data(), m_bakedData.size() * sizeof(float));
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WCrowdAnimation::LoadFromStream(WFile* file, std::istream& inputStream, std::vector<void*>& args, std::string nameSuffix) {
+	UNREFERENCED_PARAMETER(file);
+	UNREFERENCED_PARAMETER(args);
+	UNREFERENCED_PARAMETER(nameSuffix);
+
+	_Destroy();
+
+	uint32_t numClips = 0;
+	inputStream.read((char*)&numClips, 4);
+	inputStream.read((char*)&m_bakedTexWidth, 4);
+	if (inputStream.fail() || numClips == 0 || m_bakedTexWidth == 0 || m_bakedTexWidth > 16384 || 1 + numClips > m_bakedTexWidth * m_bakedTexWidth) {
+		_Destroy();
+		return WError(W_INVALIDFILEFORMAT);
+	}
+
+	m_bakedData.resize(m_bakedTexWidth * m_bakedTexWidth * 4);
+	inputStream.read((char*)m_bakedData.data(), m_bakedData.size() * sizeof(float));
+	if (inputStream.fail()) {
+		_Destroy();
+		return WError(W_INVALIDFILEFORMAT);
+	}
+	for (uint32_t c = 0; c < numClips; c++)
+		m_clipDurations.push_back(m_bakedData[(1 + c) * 4 + 2]);
+
+	WError err = _CreateTexture();
+	if (!err)
+		_Destroy();
+	return err;
+}
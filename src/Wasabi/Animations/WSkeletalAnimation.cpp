@@ -1,8 +1,20 @@
 #include "Wasabi/Animations/WSkeletalAnimation.hpp"
 #include "Wasabi/Images/WImage.hpp"
 
+#include <functional>
+#include <mutex>
+
+#if W_X86
+#include <immintrin.h>
+#endif
+
 const uint32_t sizeofBoneNoPtrs = 4 + 64 + sizeof(bool) + sizeof(WVector3) + 2 * sizeof(WMatrix);
 
+/** First word of a compressed skeleton, where an uncompressed one has its number of frames */
+#define W_SKELETON_COMPRESSED_MARKER 0xFFFFFFFF
+/** Version of the compressed skeleton format */
+#define W_SKELETON_COMPRESSED_VERSION 1
+
 WBone::WBone() {
 	m_scale = WVector3(1.0f, 1.0f, 1.0f);
 	m_worldM = WMatrix();
@@ -69,6 +81,7 @@ void WBone::ClearChildren() {
 
 void WBone::SetInvBindingPose(WMatrix mtx) {
 	m_invBindingPose = mtx;
+	m_bAltered = true;
 }
 
 void WBone::Scale(float x, float y, float z) {
@@ -173,17 +186,262 @@ WError WBone::Save(std::ostream& outputStream) const {
 	return WError(W_SUCCEEDED);
 }
 
+void W_SKELETAL_POSE::Resize(uint32_t numBones) {
+	tx.resize(numBones); ty.resize(numBones); tz.resize(numBones);
+	qx.resize(numBones); qy.resize(numBones); qz.resize(numBones); qw.resize(numBones, 1.0f);
+	sx.resize(numBones, 1.0f); sy.resize(numBones, 1.0f); sz.resize(numBones, 1.0f);
+}
+
+void W_SKELETAL_POSE::SetBone(uint32_t bone, const WMatrix& local) {
+	WVector3 axes[3];
+	float scale[3];
+	for (uint32_t i = 0; i < 3; i++) {
+		axes[i] = WVector3(local(i, 0), local(i, 1), local(i, 2));
+		scale[i] = WVec3Length(axes[i]);
+		if (scale[i] > 0.0f)
+			axes[i] = axes[i] / scale[i];
+	}
+	//a mirrored bone (like the root) can't be rotated into place, move the mirroring to the z scale
+	if (WVec3Dot(WVec3Cross(axes[0], axes[1]), axes[2]) < 0.0f) {
+		scale[2] = -scale[2];
+		axes[2] = axes[2] * -1.0f;
+	}
+	WQuaternion q = WQuaternionRotationMatrix(WMatrix(axes[0].x, axes[0].y, axes[0].z, 0.0f,
+													  axes[1].x, axes[1].y, axes[1].z, 0.0f,
+													  axes[2].x, axes[2].y, axes[2].z, 0.0f,
+													  0.0f, 0.0f, 0.0f, 1.0f));
+
+	tx[bone] = local(3, 0); ty[bone] = local(3, 1); tz[bone] = local(3, 2);
+	qx[bone] = q.x; qy[bone] = q.y; qz[bone] = q.z; qw[bone] = q.w;
+	sx[bone] = scale[0]; sy[bone] = scale[1]; sz[bone] = scale[2];
+}
+
+WMatrix W_SKELETAL_POSE::GetBoneMatrix(uint32_t bone) const {
+	//same as WScalingMatrix(s) * WRotationMatrixQuaternion(q) * WTranslationMatrix(t)
+	float X = qx[bone], Y = qy[bone], Z = qz[bone], W = qw[bone];
+	float sX = sx[bone], sY = sy[bone], sZ = sz[bone];
+	return WMatrix(sX * (1 - 2 * (Y*Y + Z*Z)), sX * 2 * (X*Y + Z*W), sX * 2 * (X*Z - Y*W), 0.0f,
+				   sY * 2 * (X*Y - Z*W), sY * (1 - 2 * (X*X + Z*Z)), sY * 2 * (Y*Z + X*W), 0.0f,
+				   sZ * 2 * (X*Z + Y*W), sZ * 2 * (Y*Z - X*W), sZ * (1 - 2 * (X*X + Y*Y)), 0.0f,
+				   tx[bone], ty[bone], tz[bone], 1.0f);
+}
+
+/**
+ * Linearly interpolates n components of two arrays. Written over restricted
+ * pointers so that the compiler vectorizes it.
+ */
+static void _LerpComponents(const float* __restrict from, const float* __restrict to, float* __restrict out, uint32_t n, float t) {
+	for (uint32_t i = 0; i < n; i++)
+		out[i] = from[i] + (to[i] - from[i]) * t;
+}
+
+/**
+ * Arrays of the quaternion components of a range of bones.
+ */
+struct W_QUATERNION_ARRAYS {
+	const float* __restrict x;
+	const float* __restrict y;
+	const float* __restrict z;
+	const float* __restrict w;
+};
+
+/**
+ * Normalized lerp of n quaternions, flipping the target quaternion when it is
+ * on the other hemisphere, starting at the first'th quaternion. The SIMD
+ * versions below compute the same operations in the same order, so all the
+ * versions give the same results.
+ */
+static void _NlerpScalar(W_QUATERNION_ARRAYS a, W_QUATERNION_ARRAYS b, float* __restrict ox, float* __restrict oy, float* __restrict oz, float* __restrict ow,
+	uint32_t first, uint32_t n, float t) {
+	for (uint32_t i = first; i < n; i++) {
+		float dot = a.x[i] * b.x[i] + a.y[i] * b.y[i] + a.z[i] * b.z[i] + a.w[i] * b.w[i];
+		float wFrom = 1.0f - t;
+		float wTo = dot < 0.0f ? -t : t;
+		float x = a.x[i] * wFrom + b.x[i] * wTo;
+		float y = a.y[i] * wFrom + b.y[i] * wTo;
+		float z = a.z[i] * wFrom + b.z[i] * wTo;
+		float w = a.w[i] * wFrom + b.w[i] * wTo;
+		float invLength = 1.0f / sqrtf(x * x + y * y + z * z + w * w);
+		ox[i] = x * invLength;
+		oy[i] = y * invLength;
+		oz[i] = z * invLength;
+		ow[i] = w * invLength;
+	}
+}
+
+#if W_X86
+
+W_TARGET_SSE41 static void _NlerpSSE41(W_QUATERNION_ARRAYS a, W_QUATERNION_ARRAYS b, float* __restrict ox, float* __restrict oy, float* __restrict oz, float* __restrict ow,
+	uint32_t first, uint32_t n, float t) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 wFrom = _mm_set1_ps(1.0f - t);
+	const __m128 tPos = _mm_set1_ps(t);
+	const __m128 tNeg = _mm_set1_ps(-t);
+	uint32_t i = first;
+	for (; i + 4 <= n; i += 4) {
+		__m128 ax = _mm_loadu_ps(&a.x[i]), ay = _mm_loadu_ps(&a.y[i]), az = _mm_loadu_ps(&a.z[i]), aw = _mm_loadu_ps(&a.w[i]);
+		__m128 bx = _mm_loadu_ps(&b.x[i]), by = _mm_loadu_ps(&b.y[i]), bz = _mm_loadu_ps(&b.z[i]), bw = _mm_loadu_ps(&b.w[i]);
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz)), _mm_mul_ps(aw, bw));
+		__m128 wTo = _mm_blendv_ps(tPos, tNeg, _mm_cmplt_ps(dot, zero));
+		__m128 x = _mm_add_ps(_mm_mul_ps(ax, wFrom), _mm_mul_ps(bx, wTo));
+		__m128 y = _mm_add_ps(_mm_mul_ps(ay, wFrom), _mm_mul_ps(by, wTo));
+		__m128 z = _mm_add_ps(_mm_mul_ps(az, wFrom), _mm_mul_ps(bz, wTo));
+		__m128 w = _mm_add_ps(_mm_mul_ps(aw, wFrom), _mm_mul_ps(bw, wTo));
+		__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)), _mm_mul_ps(w, w));
+		// a full division and square root (not _mm_rsqrt_ps) to match the scalar version
+		__m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+		_mm_storeu_ps(&ox[i], _mm_mul_ps(x, invLength));
+		_mm_storeu_ps(&oy[i], _mm_mul_ps(y, invLength));
+		_mm_storeu_ps(&oz[i], _mm_mul_ps(z, invLength));
+		_mm_storeu_ps(&ow[i], _mm_mul_ps(w, invLength));
+	}
+	_NlerpScalar(a, b, ox, oy, oz, ow, i, n, t);
+}
+
+W_TARGET_AVX2 static void _NlerpAVX2(W_QUATERNION_ARRAYS a, W_QUATERNION_ARRAYS b, float* __restrict ox, float* __restrict oy, float* __restrict oz, float* __restrict ow,
+	uint32_t first, uint32_t n, float t) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 wFrom = _mm256_set1_ps(1.0f - t);
+	const __m256 tPos = _mm256_set1_ps(t);
+	const __m256 tNeg = _mm256_set1_ps(-t);
+	uint32_t i = first;
+	for (; i + 8 <= n; i += 8) {
+		__m256 ax = _mm256_loadu_ps(&a.x[i]), ay = _mm256_loadu_ps(&a.y[i]), az = _mm256_loadu_ps(&a.z[i]), aw = _mm256_loadu_ps(&a.w[i]);
+		__m256 bx = _mm256_loadu_ps(&b.x[i]), by = _mm256_loadu_ps(&b.y[i]), bz = _mm256_loadu_ps(&b.z[i]), bw = _mm256_loadu_ps(&b.w[i]);
+		// no FMA, so that the results match the scalar version
+		__m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz)), _mm256_mul_ps(aw, bw));
+		__m256 wTo = _mm256_blendv_ps(tPos, tNeg, _mm256_cmp_ps(dot, zero, _CMP_LT_OQ));
+		__m256 x = _mm256_add_ps(_mm256_mul_ps(ax, wFrom), _mm256_mul_ps(bx, wTo));
+		__m256 y = _mm256_add_ps(_mm256_mul_ps(ay, wFrom), _mm256_mul_ps(by, wTo));
+		__m256 z = _mm256_add_ps(_mm256_mul_ps(az, wFrom), _mm256_mul_ps(bz, wTo));
+		__m256 w = _mm256_add_ps(_mm256_mul_ps(aw, wFrom), _mm256_mul_ps(bw, wTo));
+		__m256 lengthSq = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)), _mm256_mul_ps(w, w));
+		__m256 invLength = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSq));
+		_mm256_storeu_ps(&ox[i], _mm256_mul_ps(x, invLength));
+		_mm256_storeu_ps(&oy[i], _mm256_mul_ps(y, invLength));
+		_mm256_storeu_ps(&oz[i], _mm256_mul_ps(z, invLength));
+		_mm256_storeu_ps(&ow[i], _mm256_mul_ps(w, invLength));
+	}
+	_NlerpScalar(a, b, ox, oy, oz, ow, i, n, t);
+}
+
+#endif
+
+/** A version of the nlerp kernel */
+typedef void (*W_NLERP_KERNEL)(W_QUATERNION_ARRAYS, W_QUATERNION_ARRAYS, float*, float*, float*, float*, uint32_t, uint32_t, float);
+
+/**
+ * Picks the fastest version of the nlerp kernel that the CPU supports.
+ */
+static W_NLERP_KERNEL _GetNlerpKernel() {
+	static const W_NLERP_KERNEL kernel = []() -> W_NLERP_KERNEL {
+#if W_X86
+		if (WUtil::CPUSupportsAVX2())
+			return _NlerpAVX2;
+		if (WUtil::CPUSupportsSSE41())
+			return _NlerpSSE41;
+#endif
+		return _NlerpScalar;
+	}();
+	return kernel;
+}
+
+void W_SKELETAL_POSE::Interpolate(const W_SKELETAL_POSE& from, const W_SKELETAL_POSE& to, float t, uint32_t begin, uint32_t end) {
+	uint32_t n = end - begin;
+	_LerpComponents(&from.tx[begin], &to.tx[begin], &tx[begin], n, t);
+	_LerpComponents(&from.ty[begin], &to.ty[begin], &ty[begin], n, t);
+	_LerpComponents(&from.tz[begin], &to.tz[begin], &tz[begin], n, t);
+	_LerpComponents(&from.sx[begin], &to.sx[begin], &sx[begin], n, t);
+	_LerpComponents(&from.sy[begin], &to.sy[begin], &sy[begin], n, t);
+	_LerpComponents(&from.sz[begin], &to.sz[begin], &sz[begin], n, t);
+
+	W_QUATERNION_ARRAYS a = { &from.qx[begin], &from.qy[begin], &from.qz[begin], &from.qw[begin] };
+	W_QUATERNION_ARRAYS b = { &to.qx[begin], &to.qy[begin], &to.qz[begin], &to.qw[begin] };
+	_GetNlerpKernel()(a, b, &qx[begin], &qy[begin], &qz[begin], &qw[begin], 0, n, t);
+}
+
+void W_SKELETAL_POSE::InterpolateBone(const W_SKELETAL_POSE& from, uint32_t fromBone, const W_SKELETAL_POSE& to, uint32_t toBone, float t, uint32_t bone) {
+	tx[bone] = from.tx[fromBone] + (to.tx[toBone] - from.tx[fromBone]) * t;
+	ty[bone] = from.ty[fromBone] + (to.ty[toBone] - from.ty[fromBone]) * t;
+	tz[bone] = from.tz[fromBone] + (to.tz[toBone] - from.tz[fromBone]) * t;
+	sx[bone] = from.sx[fromBone] + (to.sx[toBone] - from.sx[fromBone]) * t;
+	sy[bone] = from.sy[fromBone] + (to.sy[toBone] - from.sy[fromBone]) * t;
+	sz[bone] = from.sz[fromBone] + (to.sz[toBone] - from.sz[fromBone]) * t;
+
+	float dot = from.qx[fromBone] * to.qx[toBone] + from.qy[fromBone] * to.qy[toBone] +
+				from.qz[fromBone] * to.qz[toBone] + from.qw[fromBone] * to.qw[toBone];
+	float wFrom = 1.0f - t;
+	float wTo = dot < 0.0f ? -t : t;
+	float x = from.qx[fromBone] * wFrom + to.qx[toBone] * wTo;
+	float y = from.qy[fromBone] * wFrom + to.qy[toBone] * wTo;
+	float z = from.qz[fromBone] * wFrom + to.qz[toBone] * wTo;
+	float w = from.qw[fromBone] * wFrom + to.qw[toBone] * wTo;
+	float invLength = 1.0f / sqrtf(x * x + y * y + z * z + w * w);
+	qx[bone] = x * invLength;
+	qy[bone] = y * invLength;
+	qz[bone] = z * invLength;
+	qw[bone] = w * invLength;
+}
+
 struct _WSkeletalFrame : public W_FRAME {
 	WBone* baseBone;
 	vector<WBone*> boneV;
+	/** Local transformations of the bones in boneV */
+	W_SKELETAL_POSE pose;
+	/** Position in boneV of the parent of every bone, MAX for the root */
+	vector<uint32_t> parents;
+	/** Index of every bone in boneV */
+	vector<uint32_t> boneIndices;
+	/** Inverse binding pose of every bone in boneV */
+	vector<WMatrix> invBindingPoses;
+	/** Whether pose, parents, boneIndices and invBindingPoses were built */
+	bool bPoseBuilt;
+	/** Guards the lazy update of the pose from the bones, the frame may be
+	 *  evaluated by several skeletons at once */
+	std::mutex mutex;
 
 	_WSkeletalFrame() {
 		baseBone = nullptr;
+		bPoseBuilt = false;
 	};
 	~_WSkeletalFrame() {
 		W_SAFE_DELETE(baseBone);
 	}
 
+	/**
+	 * Updates the pose of the frame from the bones that were changed since the
+	 * last update (building it the first time), after which the frame can be
+	 * read from any thread.
+	 */
+	void UpdateBones() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!bPoseBuilt) {
+			uint32_t numBones = (uint32_t)boneV.size();
+			pose.Resize(numBones);
+			parents.resize(numBones);
+			boneIndices.resize(numBones);
+			invBindingPoses.resize(numBones);
+			std::unordered_map<WBone*, uint32_t> positions;
+			for (uint32_t i = 0; i < numBones; i++)
+				positions[boneV[i]] = i;
+			for (uint32_t i = 0; i < numBones; i++) {
+				auto it = positions.find(boneV[i]->GetParent());
+				parents[i] = it == positions.end() ? std::numeric_limits<uint32_t>::max() : it->second;
+				boneIndices[i] = boneV[i]->GetIndex();
+			}
+		}
+
+		for (uint32_t i = 0; i < boneV.size(); i++) {
+			if (boneV[i]->UpdateLocals() || !bPoseBuilt) {
+				pose.SetBone(i, boneV[i]->GetMatrix());
+				invBindingPoses[i] = boneV[i]->GetInvBindingPose();
+			}
+		}
+		bPoseBuilt = true;
+	}
+
 	void ConstructHierarchyFromBase(WBone* base, WBone* currentBone, uint32_t* index) {
 		base->UpdateLocals();
 		boneV.push_back(currentBone);
@@ -193,6 +451,7 @@ struct _WSkeletalFrame : public W_FRAME {
 		currentBone->SetName(baseName);
 		currentBone->SetToRotation(base);
 		currentBone->SetPosition(base->GetPosition());
+		currentBone->Scale(base->GetScale());
 		currentBone->SetInvBindingPose(base->GetInvBindingPose());
 		currentBone->UpdateLocals();
 		if (index)
@@ -221,6 +480,9 @@ WSkeleton::WSkeleton(Wasabi* const app, uint32_t ID) : WAnimation(app, ID) {
 	m_boneTex = nullptr;
 	m_bindingScale = WVector3(1.0f, 1.0f, 1.0f);
 	m_parentBonePos = WVector3(0, 0, 0);
+	m_poseBlend = 1.0f;
+	m_poseBlendStep = 1.0f;
+	SetCompression(true);
 }
 
 WSkeleton::~WSkeleton() {
@@ -247,6 +509,12 @@ WError WSkeleton::CreateKeyFrame(WBone* baseBone, float fTime) {
 	f->baseBone = new WBone();
 	uint32_t index = 0;
 	f->ConstructHierarchyFromBase(baseBone, f->baseBone, baseBone->GetIndex() == std::numeric_limits<uint32_t>::max() ? &index : nullptr);
+	f->UpdateBones();
+	m_UpdateFrameTimes();
+	if (WAnimation::m_frames.size() == 1 || m_boneMaps.size() != WAnimation::m_frames.size() - 1)
+		_BuildBoneMaps();
+	else
+		m_boneMaps.push_back(_BuildBoneMap((uint32_t)WAnimation::m_frames.size() - 1));
 
 	WError err = WError(W_SUCCEEDED);
 
@@ -281,6 +549,11 @@ WError WSkeleton::DeleteKeyFrame(uint32_t frame) {
 	if (WAnimation::m_bFramesOwner)
 		delete WAnimation::m_frames[frame];
 	WAnimation::m_frames.erase(WAnimation::m_frames.begin() + frame);
+	m_UpdateFrameTimes();
+	if (frame == 0 || m_boneMaps.size() != WAnimation::m_frames.size() + 1)
+		_BuildBoneMaps();
+	else
+		m_boneMaps.erase(m_boneMaps.begin() + frame);
 
 	return WError(W_SUCCEEDED);
 }
@@ -313,6 +586,7 @@ void WSkeleton::SetSubAnimationBaseBone(uint32_t subAnimation, uint32_t boneInde
 		//get all involved bones, start with the parent (at boneIndex) and store all children indices
 		WBone* baseBone = ((_WSkeletalFrame*)WAnimation::m_frames[0])->boneV[indexInVector];
 		((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[subAnimation])->BuildIndices(baseBone);
+		_BuildBonePositions((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[subAnimation]);
 		if (parentSubAnimation != std::numeric_limits<uint32_t>::max()) {
 			if (baseBone->GetParent()) {
 				uint32_t parentIndex = baseBone->GetParent()->GetIndex();
@@ -320,158 +594,280 @@ void WSkeleton::SetSubAnimationBaseBone(uint32_t subAnimation, uint32_t boneInde
 				((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[subAnimation])->parentSubAnimation = parentSubAnimation;
 			}
 		}
-	} else // std::numeric_limits<uint32_t>::max() means all bones are involved, so clear the indices to specify that
+	} else { // std::numeric_limits<uint32_t>::max() means all bones are involved, so clear the indices to specify that
 		((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[subAnimation])->boneIndices.clear();
+		((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[subAnimation])->bonePositions.clear();
+	}
 }
 
-void WSkeleton::Update(float fDeltaTime) {
-	WAnimation::Update(fDeltaTime);
+WSkeleton::BONE_MAP WSkeleton::_BuildBoneMap(uint32_t frame) const {
+	_WSkeletalFrame* layoutFrame = (_WSkeletalFrame*)WAnimation::m_frames[0];
+	_WSkeletalFrame* curFrame = (_WSkeletalFrame*)WAnimation::m_frames[frame];
+	std::unordered_map<uint32_t, uint32_t> positions;
+	for (uint32_t i = 0; i < curFrame->boneIndices.size(); i++)
+		positions[curFrame->boneIndices[i]] = i;
+
+	BONE_MAP map;
+	map.bIdentity = curFrame->boneIndices.size() == layoutFrame->boneIndices.size();
+	map.positions.resize(layoutFrame->boneIndices.size());
+	for (uint32_t i = 0; i < layoutFrame->boneIndices.size(); i++) {
+		auto it = positions.find(layoutFrame->boneIndices[i]);
+		map.positions[i] = it == positions.end() ? std::numeric_limits<uint32_t>::max() : it->second;
+		if (map.positions[i] != i)
+			map.bIdentity = false;
+	}
+	return map;
+}
 
-	if (WAnimation::m_frames.size()) {
-		float* texData = nullptr;
-		m_boneTex->MapPixels((void**)&texData, W_MAP_WRITE);
-		if (!texData)
-			return;
+void WSkeleton::_BuildBoneMaps() {
+	m_boneDepths.clear();
+	m_boneMaps.resize(WAnimation::m_frames.size());
+	for (uint32_t i = 0; i < WAnimation::m_frames.size(); i++)
+		m_boneMaps[i] = _BuildBoneMap(i);
+	for (uint32_t i = 0; i < WAnimation::m_subAnimations.size(); i++)
+		_BuildBonePositions((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[i]);
+}
 
-		for (uint32_t anim = 0; anim < WAnimation::m_subAnimations.size(); anim++) {
-			W_SKELETAL_SUB_ANIMATION* curSubAnim = ((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[anim]);
-			uint32_t curFrameIndex = curSubAnim->curFrame;
-			uint32_t nextFrameIndex = curSubAnim->nextFrame;
-			_WSkeletalFrame* curFrame = (_WSkeletalFrame*)(WAnimation::m_frames[curFrameIndex]);
-			_WSkeletalFrame* nextFrame = (_WSkeletalFrame*)(WAnimation::m_frames[nextFrameIndex]);
-
-			/*if ( curFrameIndex + 1 < WAnimation::m_frames.size ( ) ) {
-			nextFrame = (_WSkeletalFrame*)(WAnimation::m_frames[curFrameIndex+1]);
-			else //we're on last frame, next is the first
-			nextFrame = (_WSkeletalFrame*)(WAnimation::m_frames[curSubAnim->firstFrame]);*/
-
-			float fTimeBeforeFrame = 0.0f;
-			for (uint32_t i = 0; i < curFrameIndex; i++)
-				fTimeBeforeFrame += ((_WSkeletalFrame*)WAnimation::m_frames[i])->fTime;
-
-			float fLerpValue = (curSubAnim->fCurrentTime - fTimeBeforeFrame) / curFrame->fTime;
-			if (fLerpValue >= 1.0f)
-				fLerpValue = 1.0f;
-
-			if (curSubAnim->boneIndices.size()) //if we have any specified indices
-			{
-				//first, ajust parents to synchronize with the parent sub animation
-				WBone* curFrameOldParent = nullptr;
-				WBone* nextFrameOldParent = nullptr;
-				if (curSubAnim->parentSubAnimation != std::numeric_limits<uint32_t>::max()) {
-					uint32_t boneIndex = curSubAnim->boneIndices[0];
-					uint32_t boneInVector = std::numeric_limits<uint32_t>::max();
-					for (uint32_t k = 0; k < curFrame->boneV.size() && boneInVector == std::numeric_limits<uint32_t>::max(); k++)
-						if (curFrame->boneV[k]->GetIndex() == boneIndex)
-							boneInVector = k;
-					WBone* curFrameBone = curFrame->boneV[boneInVector];
-					WBone* nextFrameBone = nextFrame->boneV[boneInVector];
-					curFrameOldParent = curFrameBone->GetParent();
-					nextFrameOldParent = nextFrameBone->GetParent();
-					W_SKELETAL_SUB_ANIMATION* parentSubAnim =
-						((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[curSubAnim->parentSubAnimation]);
-					_WSkeletalFrame* parentFrame =
-						(_WSkeletalFrame*)(WAnimation::m_frames[parentSubAnim->curFrame]);
-					for (uint32_t k = 0; k < parentFrame->boneV.size(); k++)
-						if (parentFrame->boneV[k]->GetIndex() == curSubAnim->parentIndex) {
-							curFrameBone->SetParent(parentFrame->boneV[k]);
-							nextFrameBone->SetParent(parentFrame->boneV[k]);
-						}
-				}
+void WSkeleton::_BuildBonePositions(W_SKELETAL_SUB_ANIMATION* subAnim) const {
+	subAnim->bonePositions.clear();
+	if (!WAnimation::m_frames.size())
+		return;
 
-				for (uint32_t i = 0; i < curSubAnim->boneIndices.size(); i++) {
-					uint32_t boneIndex = curSubAnim->boneIndices[i];
-					uint32_t boneInVector = std::numeric_limits<uint32_t>::max();
-					for (uint32_t k = 0; k < curFrame->boneV.size() && boneInVector == std::numeric_limits<uint32_t>::max(); k++)
-						if (curFrame->boneV[k]->GetIndex() == boneIndex)
-							boneInVector = k;
-
-					WBone* curFrameBone = curFrame->boneV[boneInVector];
-					WBone* nextFrameBone = nextFrame->boneV[boneInVector];
-					//update each frame's bones
-					curFrameBone->UpdateLocals();
-					nextFrameBone->UpdateLocals();
-
-					//lerp the bones' matrices to get the matrix for the current, in-between frame
-					WMatrix curFrameMtx = curFrameBone->GetRelativeMatrix();
-					WMatrix nextFrameMtx = nextFrameBone->GetRelativeMatrix();
-					WMatrix curFrameMtxF = curFrameBone->GetInvBindingPose() * curFrameMtx;
-					WMatrix nextFrameMtxF = nextFrameBone->GetInvBindingPose() * nextFrameMtx;
-					WMatrix finalMatrix = curFrameMtxF * (1.0f - fLerpValue) + nextFrameMtxF * fLerpValue;
-
-					if (m_bindings.size()) {
-						WMatrix bindMtx = curFrameMtx * (1.0f - fLerpValue) + nextFrameMtx * fLerpValue;
-						for (int j = 0; j < 4; j++)
-							bindMtx(2, j) = -bindMtx(2, j);
-						for (uint32_t j = 0; j < m_bindings.size(); j++)
-							if (m_bindings[j].boneID == boneIndex)
-								m_bindings[j].obj->SetBindingMatrix(bindMtx * WScalingMatrix(m_bindingScale));
-					}
-
-					//encode the matrix (decoded in the shader to save a texture fetch in the VS)
-					finalMatrix(0, 3) = finalMatrix(3, 0);
-					finalMatrix(1, 3) = finalMatrix(3, 1);
-					finalMatrix(2, 3) = finalMatrix(3, 2);
-					memcpy(&((char*)texData)[boneIndex * sizeof(WMatrix)], &finalMatrix, sizeof(WMatrix) - sizeof(float) * 4);
-				}
+	_WSkeletalFrame* layoutFrame = (_WSkeletalFrame*)WAnimation::m_frames[0];
+	std::unordered_map<uint32_t, uint32_t> positions;
+	for (uint32_t i = 0; i < layoutFrame->boneIndices.size(); i++)
+		positions[layoutFrame->boneIndices[i]] = i;
+	for (uint32_t i = 0; i < subAnim->boneIndices.size(); i++) {
+		auto it = positions.find(subAnim->boneIndices[i]);
+		if (it != positions.end())
+			subAnim->bonePositions.push_back(it->second);
+	}
+}
 
-				//set parents back to normal
-				if (curSubAnim->parentSubAnimation != std::numeric_limits<uint32_t>::max()) {
-					uint32_t boneIndex = curSubAnim->boneIndices[0];
-					uint32_t boneInVector = std::numeric_limits<uint32_t>::max();
-					for (uint32_t k = 0; k < curFrame->boneV.size() && boneInVector == std::numeric_limits<uint32_t>::max(); k++)
-						if (curFrame->boneV[k]->GetIndex() == boneIndex)
-							boneInVector = k;
-					curFrame->boneV[boneInVector]->SetParent(curFrameOldParent);
-					nextFrame->boneV[boneInVector]->SetParent(nextFrameOldParent);
-				}
-			} else //no indices means all bones
-			{
-				for (uint32_t i = 0; i < curFrame->boneV.size(); i++) {
-					//update parent position
-					if (curFrame->boneV[i]->GetParent() == nullptr)
-						m_parentBonePos = curFrame->boneV[i]->GetPosition();
-
-					uint32_t boneIndex = curFrame->boneV[i]->GetIndex();
-
-					WBone* curFrameBone = curFrame->boneV[i];
-					WBone* nextFrameBone = nextFrame->boneV[i];
-					//update each frame's bones
-					curFrameBone->UpdateLocals();
-					nextFrameBone->UpdateLocals();
-					//lerp the bones' matrices to get the matrix for the current, in-between frame
-					WMatrix curFrameMtx = curFrameBone->GetRelativeMatrix();
-					WMatrix nextFrameMtx = nextFrameBone->GetRelativeMatrix();
-					WMatrix curFrameMtxF = curFrameBone->GetInvBindingPose() * curFrameMtx;
-					WMatrix nextFrameMtxF = nextFrameBone->GetInvBindingPose() * nextFrameMtx;
-					WMatrix finalMatrix = curFrameMtxF * (1.0f - fLerpValue) + nextFrameMtxF * fLerpValue;
-
-					if (m_bindings.size()) {
-						WMatrix bindMtx = curFrameMtx * (1.0f - fLerpValue) + nextFrameMtx * fLerpValue;
-						for (int j = 0; j < 4; j++)
-							bindMtx(2, j) = -bindMtx(2, j);
-						for (uint32_t j = 0; j < m_bindings.size(); j++)
-							if (m_bindings[j].boneID == boneIndex)
-								m_bindings[j].obj->SetBindingMatrix(bindMtx * WScalingMatrix(m_bindingScale));
-					}
-
-					//encode the matrix (decoded in the shader to save a texture fetch in the VS)
-					finalMatrix(0, 3) = finalMatrix(3, 0);
-					finalMatrix(1, 3) = finalMatrix(3, 1);
-					finalMatrix(2, 3) = finalMatrix(3, 2);
-					memcpy(&((char*)texData)[boneIndex * sizeof(WMatrix)], &finalMatrix, sizeof(WMatrix) - sizeof(float) * 4);
+void WSkeleton::_SampleBone(W_SKELETAL_POSE& out, uint32_t curFrame, uint32_t nextFrame, float fLerpValue, uint32_t bone) const {
+	_WSkeletalFrame* layoutFrame = (_WSkeletalFrame*)WAnimation::m_frames[0];
+	_WSkeletalFrame* from = (_WSkeletalFrame*)WAnimation::m_frames[curFrame];
+	_WSkeletalFrame* to = (_WSkeletalFrame*)WAnimation::m_frames[nextFrame];
+	uint32_t fromBone = m_boneMaps[curFrame].positions[bone];
+	uint32_t toBone = m_boneMaps[nextFrame].positions[bone];
+	if (fromBone == std::numeric_limits<uint32_t>::max()) {
+		from = layoutFrame;
+		fromBone = bone;
+	}
+	if (toBone == std::numeric_limits<uint32_t>::max()) {
+		to = layoutFrame;
+		toBone = bone;
+	}
+	out.InterpolateBone(from->pose, fromBone, to->pose, toBone, fLerpValue, bone);
+}
+
+void WSkeleton::_UpdateSampledBones() {
+	_WSkeletalFrame* layoutFrame = (_WSkeletalFrame*)WAnimation::m_frames[0];
+	uint32_t numBones = (uint32_t)layoutFrame->boneIndices.size();
+	m_sampledBones.assign(numBones, 1);
+	if (m_lod.maxBoneDepth == std::numeric_limits<uint32_t>::max() || m_boneDepths.size() != numBones)
+		return;
+
+	for (uint32_t i = 0; i < numBones; i++)
+		m_sampledBones[i] = m_boneDepths[i] <= m_lod.maxBoneDepth ? 1 : 0;
+
+	//the bones that objects are bound to (and their ancestors) are always sampled
+	for (uint32_t j = 0; j < m_bindings.size(); j++) {
+		for (uint32_t i = 0; i < numBones; i++) {
+			if (layoutFrame->boneIndices[i] == m_bindings[j].boneID) {
+				for (uint32_t bone = i; bone != std::numeric_limits<uint32_t>::max() && !m_sampledBones[bone]; bone = layoutFrame->parents[bone])
+					m_sampledBones[bone] = 1;
+				break;
+			}
+		}
+	}
+}
+
+void WSkeleton::_BlendPose() {
+	m_poseBlend = fmin(m_poseBlend + m_poseBlendStep, 1.0f);
+	if (m_pose.size() != m_targetPose.size() || m_previousPose.size() != m_targetPose.size() || m_poseBlend >= 1.0f) {
+		m_pose = m_targetPose;
+		m_bindingPose = m_targetBindingPose;
+		return;
+	}
+
+	float fBlend = m_poseBlend;
+	for (uint32_t i = 0; i < m_pose.size(); i++)
+		m_pose[i] = m_previousPose[i] * (1.0f - fBlend) + m_targetPose[i] * fBlend;
+	if (m_bindings.size() && m_previousBindingPose.size() == m_targetBindingPose.size()) {
+		for (uint32_t i = 0; i < m_bindingPose.size(); i++)
+			m_bindingPose[i] = m_previousBindingPose[i] * (1.0f - fBlend) + m_targetBindingPose[i] * fBlend;
+	} else
+		m_bindingPose = m_targetBindingPose;
+}
+
+void WSkeleton::EvaluatePose(float fDeltaTime) {
+	WAnimation::EvaluatePose(fDeltaTime);
+
+	if (!WAnimation::m_frames.size())
+		return;
+	if (m_boneMaps.size() != WAnimation::m_frames.size())
+		_BuildBoneMaps();
+
+	//the root position follows the stepped time even when the pose is not evaluated
+	for (uint32_t anim = 0; anim < WAnimation::m_subAnimations.size(); anim++) {
+		W_SKELETAL_SUB_ANIMATION* curSubAnim = ((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[anim]);
+		if (!curSubAnim->boneIndices.size())
+			m_parentBonePos = ((_WSkeletalFrame*)WAnimation::m_frames[curSubAnim->curFrame])->baseBone->GetPosition();
+	}
+
+	if (!WAnimation::m_bEvaluatePose) {
+		_BlendPose();
+		return;
+	}
+
+	//the first frame defines the order of the bones in the pose
+	_WSkeletalFrame* layoutFrame = (_WSkeletalFrame*)WAnimation::m_frames[0];
+	layoutFrame->UpdateBones();
+	uint32_t numBones = (uint32_t)layoutFrame->boneV.size();
+	if (m_boneDepths.size() != numBones) {
+		m_boneDepths.resize(numBones);
+		for (uint32_t i = 0; i < numBones; i++) {
+			uint32_t parent = layoutFrame->parents[i];
+			m_boneDepths[i] = parent == std::numeric_limits<uint32_t>::max() ? 0 : m_boneDepths[parent] + 1;
+		}
+	}
+	//bones that are not sampled keep their last local transformation, so all of them are sampled at first
+	bool bAllBones = m_localPose.tx.size() != numBones;
+	m_localPose.Resize(numBones);
+	m_modelPose.resize(numBones);
+	m_parentOverrides.assign(numBones, std::numeric_limits<uint32_t>::max());
+	m_parentOverrideMatrices.clear();
+	_UpdateSampledBones();
+	if (bAllBones)
+		m_sampledBones.assign(numBones, 1);
+	bAllBones = std::find(m_sampledBones.begin(), m_sampledBones.end(), 0) == m_sampledBones.end();
+
+	//sample the local transformations of the bones of every subanimation
+	for (uint32_t anim = 0; anim < WAnimation::m_subAnimations.size(); anim++) {
+		W_SKELETAL_SUB_ANIMATION* curSubAnim = ((W_SKELETAL_SUB_ANIMATION*)WAnimation::m_subAnimations[anim]);
+		uint32_t curFrameIndex = curSubAnim->curFrame;
+		uint32_t nextFrameIndex = curSubAnim->nextFrame;
+		_WSkeletalFrame* curFrame = (_WSkeletalFrame*)(WAnimation::m_frames[curFrameIndex]);
+		_WSkeletalFrame* nextFrame = (_WSkeletalFrame*)(WAnimation::m_frames[nextFrameIndex]);
+		curFrame->UpdateBones();
+		nextFrame->UpdateBones();
+
+		float fLerpValue = (curSubAnim->fCurrentTime - WAnimation::m_frameStartTimes[curFrameIndex]) / curFrame->fTime;
+		if (fLerpValue >= 1.0f)
+			fLerpValue = 1.0f;
+
+		if (curSubAnim->boneIndices.size()) //if we have any specified indices
+		{
+			if (!curSubAnim->bonePositions.size())
+				continue;
+			for (uint32_t i = 0; i < curSubAnim->bonePositions.size(); i++)
+				if (m_sampledBones[curSubAnim->bonePositions[i]])
+					_SampleBone(m_localPose, curFrameIndex, nextFrameIndex, fLerpValue, curSubAnim->bonePositions[i]);
+
+			//with a parent subanimation, the base bone follows the pose of its parent bone (sampled by the parent
+			//subanimation). otherwise, it follows its ancestors as they are in this subanimation's frames
+			uint32_t basePosition = curSubAnim->bonePositions[0];
+			uint32_t ancestor = layoutFrame->parents[basePosition];
+			if (curSubAnim->parentSubAnimation == std::numeric_limits<uint32_t>::max() && ancestor != std::numeric_limits<uint32_t>::max()) {
+				m_ancestorsPose.Resize(numBones);
+				WMatrix parentMtx = WMatrix();
+				for (; ancestor != std::numeric_limits<uint32_t>::max(); ancestor = layoutFrame->parents[ancestor]) {
+					_SampleBone(m_ancestorsPose, curFrameIndex, nextFrameIndex, fLerpValue, ancestor);
+					parentMtx *= m_ancestorsPose.GetBoneMatrix(ancestor);
 				}
+				m_parentOverrides[basePosition] = (uint32_t)m_parentOverrideMatrices.size();
+				m_parentOverrideMatrices.push_back(parentMtx);
+			}
+		} else //no indices means all bones
+		{
+			if (bAllBones && m_boneMaps[curFrameIndex].bIdentity && m_boneMaps[nextFrameIndex].bIdentity)
+				m_localPose.Interpolate(curFrame->pose, nextFrame->pose, fLerpValue, 0, numBones);
+			else {
+				for (uint32_t i = 0; i < numBones; i++)
+					if (m_sampledBones[i])
+						_SampleBone(m_localPose, curFrameIndex, nextFrameIndex, fLerpValue, i);
 			}
 		}
+	}
+
+	//compute the model-space matrices, parents come before their children
+	for (uint32_t i = 0; i < numBones; i++) {
+		WMatrix localMtx = m_localPose.GetBoneMatrix(i);
+		uint32_t parent = layoutFrame->parents[i];
+		if (m_parentOverrides[i] != std::numeric_limits<uint32_t>::max())
+			m_modelPose[i] = localMtx * m_parentOverrideMatrices[m_parentOverrides[i]];
+		else if (parent != std::numeric_limits<uint32_t>::max())
+			m_modelPose[i] = localMtx * m_modelPose[parent];
+		else
+			m_modelPose[i] = localMtx;
+	}
+
+	//the new pose is the target that the displayed pose blends to until the next evaluation
+	m_previousPose = m_pose;
+	m_previousBindingPose = m_bindingPose;
+	for (uint32_t i = 0; i < numBones; i++) {
+		uint32_t boneIndex = layoutFrame->boneIndices[i];
+		if (boneIndex >= m_targetPose.size()) {
+			m_targetPose.resize(boneIndex + 1);
+			m_targetBindingPose.resize(boneIndex + 1);
+		}
+
+		if (m_bindings.size()) {
+			WMatrix bindMtx = m_modelPose[i];
+			for (int j = 0; j < 4; j++)
+				bindMtx(2, j) = -bindMtx(2, j);
+			m_targetBindingPose[boneIndex] = bindMtx;
+		}
 
-		m_boneTex->UnmapPixels();
+		//encode the matrix (decoded in the shader to save a texture fetch in the VS)
+		WMatrix finalMatrix = layoutFrame->invBindingPoses[i] * m_modelPose[i];
+		finalMatrix(0, 3) = finalMatrix(3, 0);
+		finalMatrix(1, 3) = finalMatrix(3, 1);
+		finalMatrix(2, 3) = finalMatrix(3, 2);
+		m_targetPose[boneIndex] = finalMatrix;
 	}
+
+	m_poseBlend = 0.0f;
+	m_poseBlendStep = 1.0f / (float)std::max(m_lod.updateInterval, 1u);
+	_BlendPose();
+}
+
+uint32_t WSkeleton::GetPoseCost(const W_ANIMATION_LOD& lod) const {
+	if (lod.maxBoneDepth == std::numeric_limits<uint32_t>::max() || !m_boneDepths.size())
+		return std::max((uint32_t)m_boneDepths.size(), 1u);
+	uint32_t cost = 0;
+	for (uint32_t i = 0; i < m_boneDepths.size(); i++)
+		if (m_boneDepths[i] <= lod.maxBoneDepth)
+			cost++;
+	return std::max(cost, 1u);
+}
+
+void WSkeleton::UploadPose() {
+	if (!m_boneTex || !m_pose.size())
+		return;
+
+	float* texData = nullptr;
+	m_boneTex->MapPixels((void**)&texData, W_MAP_WRITE);
+	if (!texData)
+		return;
+	size_t texSize = m_boneTex->GetWidth() * m_boneTex->GetHeight() * 4 * sizeof(float);
+	memcpy(texData, m_pose.data(), std::min(m_pose.size() * sizeof(WMatrix), texSize));
+	m_boneTex->UnmapPixels();
+
+	for (uint32_t j = 0; j < m_bindings.size(); j++)
+		if (m_bindings[j].boneID < m_bindingPose.size())
+			m_bindings[j].obj->SetBindingMatrix(m_bindingPose[m_bindings[j].boneID] * WScalingMatrix(m_bindingScale));
 }
 
 WImage* WSkeleton::GetTexture() const {
 	return m_boneTex;
 }
 
+const vector<WMatrix>& WSkeleton::GetPose() const {
+	return m_pose;
+}
+
 WBone* WSkeleton::GetBone(uint32_t frame, uint32_t index) const {
 	if (frame < WAnimation::m_frames.size()) {
 		for (uint32_t i = 0; i < ((_WSkeletalFrame*)WAnimation::m_frames[frame])->boneV.size(); i++)
@@ -539,6 +935,13 @@ void WSkeleton::SetBindingScale(WVector3 scale) {
 	m_bindingScale = scale;
 }
 
+void WSkeleton::SetCompression(bool bCompress, float fPositionError, float fRotationError, float fScaleError) {
+	m_bCompress = bCompress;
+	m_compressionPositionError = fPositionError;
+	m_compressionRotationError = fRotationError;
+	m_compressionScaleError = fScaleError;
+}
+
 WVector3 WSkeleton::GetCurrentParentBonePosition() {
 	return m_parentBonePos;
 }
@@ -555,6 +958,7 @@ WError	WSkeleton::CopyFrom(const WAnimation* const from) {
 		for (uint32_t i = 0; i < WAnimation::m_frames.size(); i++)
 			W_SAFE_DELETE(WAnimation::m_frames[i]);
 	m_frames.clear();
+	m_boneMaps.clear();
 	m_totalTime = 0.0f;
 	//delete all subanimations - start a fresh object with only 1
 	for (uint32_t i = 0; i < m_subAnimations.size(); i++)
@@ -588,6 +992,7 @@ WError WSkeleton::UseAnimationFrames(const WAnimation* const anim) {
 		for (uint32_t i = 0; i < WAnimation::m_frames.size(); i++)
 			W_SAFE_DELETE(WAnimation::m_frames[i]);
 	m_frames.clear();
+	m_boneMaps.clear();
 	m_totalTime = 0.0f;
 	//delete all subanimations - start a fresh object with only 1
 	for (uint32_t i = 0; i < m_subAnimations.size(); i++)
@@ -603,6 +1008,8 @@ WError WSkeleton::UseAnimationFrames(const WAnimation* const anim) {
 		WAnimation::m_frames.push_back(fromS->WAnimation::m_frames[i]);
 		m_totalTime += fromS->WAnimation::m_frames[i]->fTime;
 	}
+	m_UpdateFrameTimes();
+	_BuildBoneMaps();
 	int oldMips = m_app->GetEngineParam<int>("numGeneratedMips");
 	m_app->SetEngineParam<int>("numGeneratedMips", 1);
 	m_boneTex = m_app->ImageManager->CreateImage(fromS->m_boneTex, W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_DYNAMIC | W_IMAGE_CREATE_REWRITE_EVERY_FRAME);
@@ -623,6 +1030,13 @@ WError WSkeleton::SaveToStream(WFile* file, std::ostream& outputStream) {
 	if (!Valid())
 		return WError(W_NOTVALID);
 
+	if (m_bCompress) {
+		WError err = _SaveCompressed(outputStream);
+		if (err.m_error != W_NOTVALID)
+			return err;
+		//the keyframes can't be compressed, save them uncompressed
+	}
+
 	//Format: <NUMFRAMES><FRAME 1><FRAME 2>...<FRAME NUMFRAMES-1>
 	//Format: where <FRAME n>: <fTime><BASICBONE:sizeofBoneNoPtrs><NUMCHILDREN><BASICBONE><NUMCHILDREN> (recursize)
 	uint32_t numFrames = (uint32_t)WAnimation::m_frames.size();
@@ -663,6 +1077,7 @@ WError WSkeleton::LoadFromStream(WFile* file, std::istream& inputStream, std::ve
 		for (uint32_t i = 0; i < WAnimation::m_frames.size(); i++)
 			W_SAFE_DELETE(WAnimation::m_frames[i]);
 	m_frames.clear();
+	m_boneMaps.clear();
 	m_totalTime = 0.0f;
 	//delete all subanimations - start a fresh object with only 1
 	for (uint32_t i = 0; i < m_subAnimations.size(); i++)
@@ -678,6 +1093,8 @@ WError WSkeleton::LoadFromStream(WFile* file, std::istream& inputStream, std::ve
 	//Format: where <FRAME n>: <fTime><BASICBONE:sizeofBoneNoPtrs><NUMCHILDREN><BASICBONE><NUMCHILDREN> (recursize)
 	uint32_t numFrames = 0;
 	inputStream.read((char*)&numFrames, 4);
+	if (numFrames == W_SKELETON_COMPRESSED_MARKER)
+		return _LoadCompressed(inputStream);
 	for (uint32_t i = 0; i < numFrames; i++) {
 		float fTime = 0.0f;
 		inputStream.read((char*)&fTime, 4);
@@ -695,3 +1112,405 @@ WError WSkeleton::LoadFromStream(WFile* file, std::istream& inputStream, std::ve
 
 	return ret;
 }
+
+/** A compressed position, rotation or scale track of a bone */
+struct _WCompressedTrack {
+	/** Frames of the kept keys, a constant track has a single key at frame 0 */
+	vector<uint32_t> keyFrames;
+	/** Quantized components of the keys, 3 per key */
+	vector<uint16_t> values;
+	/** Smallest value of every component (positions and scales) */
+	WVector3 rangeMin;
+	/** Range of every component (positions and scales) */
+	WVector3 rangeExtent;
+};
+
+/**
+ * Computes how far a frame is between two keys, in time.
+ */
+static float _KeyFactor(const vector<float>& times, uint32_t a, uint32_t b, uint32_t f) {
+	if (a == b)
+		return 0.0f;
+	return (times[f] - times[a]) / (times[b] - times[a]);
+}
+
+/**
+ * Normalized lerp between two quaternions on the shortest path.
+ */
+static WQuaternion _NlerpQuaternion(const WQuaternion& a, const WQuaternion& b, float t) {
+	float dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+	float wTo = dot < 0.0f ? -t : t;
+	WQuaternion q(a.x * (1.0f - t) + b.x * wTo, a.y * (1.0f - t) + b.y * wTo, a.z * (1.0f - t) + b.z * wTo, a.w * (1.0f - t) + b.w * wTo);
+	float invLength = 1.0f / sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+	return WQuaternion(q.x * invLength, q.y * invLength, q.z * invLength, q.w * invLength);
+}
+
+/**
+ * Picks the keys of a track to keep. A track whose frames are all within
+ * maxError of the first frame keeps a single key. Otherwise the first and
+ * last keys are kept, and every segment between two kept keys keeps the key
+ * that is furthest from the interpolation of the segment, until all the
+ * dropped keys are within maxError.
+ * @param  numFrames Number of frames in the track
+ * @param  maxError  Maximum error of a dropped key
+ * @param  error     Returns the error of frame f when interpolated between
+ *                   the keys at frames a and b (a == b to compare to a)
+ * @return           Frames of the kept keys, in order
+ */
+static vector<uint32_t> _ReduceKeys(uint32_t numFrames, float maxError, const std::function<float(uint32_t, uint32_t, uint32_t)>& error) {
+	vector<uint32_t> keys;
+	bool bConstant = true;
+	for (uint32_t f = 1; f < numFrames && bConstant; f++)
+		bConstant = error(0, 0, f) <= maxError;
+	if (bConstant) {
+		keys.push_back(0);
+		return keys;
+	}
+
+	vector<bool> kept(numFrames, false);
+	kept[0] = kept[numFrames - 1] = true;
+	vector<std::pair<uint32_t, uint32_t>> segments = { std::make_pair(0u, numFrames - 1) };
+	while (segments.size()) {
+		std::pair<uint32_t, uint32_t> segment = segments.back();
+		segments.pop_back();
+		float maxSegmentError = 0.0f;
+		uint32_t worstFrame = std::numeric_limits<uint32_t>::max();
+		for (uint32_t f = segment.first + 1; f < segment.second; f++) {
+			float frameError = error(segment.first, segment.second, f);
+			if (frameError > maxSegmentError) {
+				maxSegmentError = frameError;
+				worstFrame = f;
+			}
+		}
+		if (maxSegmentError > maxError) {
+			kept[worstFrame] = true;
+			segments.push_back(std::make_pair(segment.first, worstFrame));
+			segments.push_back(std::make_pair(worstFrame, segment.second));
+		}
+	}
+
+	for (uint32_t f = 0; f < numFrames; f++)
+		if (kept[f])
+			keys.push_back(f);
+	return keys;
+}
+
+/**
+ * Compresses a position or scale track.
+ */
+static _WCompressedTrack _CompressVectorTrack(const vector<WVector3>& values, const vector<float>& times, float maxError) {
+	_WCompressedTrack track;
+	track.keyFrames = _ReduceKeys((uint32_t)values.size(), maxError, [&values, &times](uint32_t a, uint32_t b, uint32_t f) {
+		WVector3 v = values[a] + (values[b] - values[a]) * _KeyFactor(times, a, b, f);
+		return WVec3Length(v - values[f]);
+	});
+
+	WVector3 rangeMax = track.rangeMin = values[track.keyFrames[0]];
+	for (auto it = track.keyFrames.begin(); it != track.keyFrames.end(); it++) {
+		for (uint32_t c = 0; c < 3; c++) {
+			track.rangeMin.components[c] = fmin(track.rangeMin.components[c], values[*it].components[c]);
+			rangeMax.components[c] = fmax(rangeMax.components[c], values[*it].components[c]);
+		}
+	}
+	track.rangeExtent = rangeMax - track.rangeMin;
+
+	for (auto it = track.keyFrames.begin(); it != track.keyFrames.end(); it++) {
+		for (uint32_t c = 0; c < 3; c++) {
+			float extent = track.rangeExtent.components[c];
+			float unit = extent > 0.0f ? (values[*it].components[c] - track.rangeMin.components[c]) / extent : 0.0f;
+			track.values.push_back((uint16_t)(fmin(fmax(unit, 0.0f), 1.0f) * 65535.0f + 0.5f));
+		}
+	}
+	return track;
+}
+
+/**
+ * Quantizes a quaternion to 48 bits: 2 bits for the index of its largest
+ * component and 15 bits for each of the other three. The quaternion is
+ * negated if needed so that the largest component is positive, which then
+ * follows from the other three.
+ */
+static void _PackQuaternion(WQuaternion q, uint16_t* packed) {
+	uint32_t largest = 0;
+	for (uint32_t c = 1; c < 4; c++)
+		if (fabs(q.components[c]) > fabs(q.components[largest]))
+			largest = c;
+	float sign = q.components[largest] < 0.0f ? -1.0f : 1.0f;
+
+	//the other components are within [-1/sqrt(2), 1/sqrt(2)]
+	uint64_t bits = largest;
+	for (uint32_t c = 0; c < 4; c++) {
+		if (c == largest)
+			continue;
+		float unit = (q.components[c] * sign * sqrtf(2.0f)) * 0.5f + 0.5f;
+		bits = (bits << 15) | (uint64_t)(fmin(fmax(unit, 0.0f), 1.0f) * 32767.0f + 0.5f);
+	}
+	packed[0] = (uint16_t)(bits >> 32);
+	packed[1] = (uint16_t)(bits >> 16);
+	packed[2] = (uint16_t)bits;
+}
+
+/**
+ * Restores a quaternion quantized by _PackQuaternion().
+ */
+static WQuaternion _UnpackQuaternion(const uint16_t* packed) {
+	uint64_t bits = ((uint64_t)packed[0] << 32) | ((uint64_t)packed[1] << 16) | (uint64_t)packed[2];
+	uint32_t largest = (uint32_t)(bits >> 45) & 3;
+	WQuaternion q;
+	float sumSquares = 0.0f;
+	uint32_t shift = 30;
+	for (uint32_t c = 0; c < 4; c++) {
+		if (c == largest)
+			continue;
+		float unit = (float)((bits >> shift) & 0x7FFF) / 32767.0f;
+		q.components[c] = (unit * 2.0f - 1.0f) / sqrtf(2.0f);
+		sumSquares += q.components[c] * q.components[c];
+		shift -= 15;
+	}
+	q.components[largest] = sqrtf(fmax(1.0f - sumSquares, 0.0f));
+	return q;
+}
+
+/**
+ * Compresses a rotation track.
+ */
+static _WCompressedTrack _CompressRotationTrack(const vector<WQuaternion>& values, const vector<float>& times, float maxError) {
+	_WCompressedTrack track;
+	track.keyFrames = _ReduceKeys((uint32_t)values.size(), maxError, [&values, &times](uint32_t a, uint32_t b, uint32_t f) {
+		WQuaternion q = _NlerpQuaternion(values[a], values[b], _KeyFactor(times, a, b, f));
+		float dot = fabs(q.x * values[f].x + q.y * values[f].y + q.z * values[f].z + q.w * values[f].w);
+		return 2.0f * acosf(fmin(dot, 1.0f));
+	});
+
+	track.values.resize(track.keyFrames.size() * 3);
+	for (uint32_t k = 0; k < track.keyFrames.size(); k++)
+		_PackQuaternion(values[track.keyFrames[k]], &track.values[k * 3]);
+	return track;
+}
+
+/**
+ * Finds, for every frame, the key at or before it in a track.
+ */
+static uint32_t _FindKey(const _WCompressedTrack& track, uint32_t frame, uint32_t key) {
+	while (key + 1 < track.keyFrames.size() && track.keyFrames[key + 1] <= frame)
+		key++;
+	return key;
+}
+
+/**
+ * Decompresses a position or scale track to a value per frame.
+ */
+static void _DecompressVectorTrack(const _WCompressedTrack& track, const vector<float>& times, vector<WVector3>& values) {
+	vector<WVector3> keys(track.keyFrames.size());
+	for (uint32_t k = 0; k < keys.size(); k++)
+		for (uint32_t c = 0; c < 3; c++)
+			keys[k].components[c] = track.rangeMin.components[c] + (float)track.values[k * 3 + c] / 65535.0f * track.rangeExtent.components[c];
+
+	values.resize(times.size());
+	uint32_t key = 0;
+	for (uint32_t f = 0; f < values.size(); f++) {
+		key = _FindKey(track, f, key);
+		if (key + 1 < keys.size())
+			values[f] = keys[key] + (keys[key + 1] - keys[key]) * _KeyFactor(times, track.keyFrames[key], track.keyFrames[key + 1], f);
+		else
+			values[f] = keys[key];
+	}
+}
+
+/**
+ * Decompresses a rotation track to a value per frame.
+ */
+static void _DecompressRotationTrack(const _WCompressedTrack& track, const vector<float>& times, vector<WQuaternion>& values) {
+	vector<WQuaternion> keys(track.keyFrames.size());
+	for (uint32_t k = 0; k < keys.size(); k++)
+		keys[k] = _UnpackQuaternion(&track.values[k * 3]);
+
+	values.resize(times.size());
+	uint32_t key = 0;
+	for (uint32_t f = 0; f < values.size(); f++) {
+		key = _FindKey(track, f, key);
+		if (key + 1 < keys.size())
+			values[f] = _NlerpQuaternion(keys[key], keys[key + 1], _KeyFactor(times, track.keyFrames[key], track.keyFrames[key + 1], f));
+		else
+			values[f] = keys[key];
+	}
+}
+
+WError WSkeleton::_SaveCompressed(std::ostream& outputStream) {
+	uint32_t numFrames = (uint32_t)WAnimation::m_frames.size();
+	if (numFrames == 0)
+		return WError(W_NOTVALID);
+	m_UpdateFrameTimes();
+	if (m_boneMaps.size() != numFrames)
+		_BuildBoneMaps();
+	for (uint32_t f = 0; f < numFrames; f++) {
+		((_WSkeletalFrame*)WAnimation::m_frames[f])->UpdateBones();
+		if (((_WSkeletalFrame*)WAnimation::m_frames[f])->boneV.size() != m_boneMaps[f].positions.size())
+			return WError(W_NOTVALID); // the keyframes have different bones
+		for (auto it = m_boneMaps[f].positions.begin(); it != m_boneMaps[f].positions.end(); it++)
+			if (*it == std::numeric_limits<uint32_t>::max())
+				return WError(W_NOTVALID); // the keyframes have different bones
+	}
+
+	_WSkeletalFrame* layoutFrame = (_WSkeletalFrame*)WAnimation::m_frames[0];
+	uint32_t numBones = (uint32_t)layoutFrame->boneV.size();
+	vector<float> times(WAnimation::m_frameStartTimes.begin(), WAnimation::m_frameStartTimes.begin() + numFrames);
+
+	//compress the position, rotation and scale tracks of every bone
+	vector<_WCompressedTrack> tracks(numBones * 3);
+	vector<WVector3> positions(numFrames), scales(numFrames);
+	vector<WQuaternion> rotations(numFrames);
+	for (uint32_t i = 0; i < numBones; i++) {
+		for (uint32_t f = 0; f < numFrames; f++) {
+			WBone* bone = ((_WSkeletalFrame*)WAnimation::m_frames[f])->boneV[m_boneMaps[f].positions[i]];
+			WVector3 r = bone->GetRVector();
+			WVector3 u = bone->GetUVector();
+			WVector3 l = bone->GetLVector();
+			if (WVec3Dot(WVec3Cross(r, u), l) < 0.0f)
+				return WError(W_NOTVALID); // a mirrored orientation is not a rotation
+			positions[f] = bone->GetPosition();
+			scales[f] = bone->GetScale();
+			rotations[f] = WQuaternionRotationMatrix(WMatrix(r.x, r.y, r.z, 0.0f,
+															 u.x, u.y, u.z, 0.0f,
+															 l.x, l.y, l.z, 0.0f,
+															 0.0f, 0.0f, 0.0f, 1.0f));
+		}
+		tracks[i * 3 + 0] = _CompressVectorTrack(positions, times, m_compressionPositionError);
+		tracks[i * 3 + 1] = _CompressRotationTrack(rotations, times, m_compressionRotationError);
+		tracks[i * 3 + 2] = _CompressVectorTrack(scales, times, m_compressionScaleError);
+	}
+
+	//Format: <MARKER><VERSION><NUMFRAMES><NUMBONES><fTime x NUMFRAMES><BONE x NUMBONES><TRACK x NUMBONES*3>
+	//Format: where <BONE>: <INDEX><PARENT POSITION><NAME:64><INVBINDINGPOSE>
+	//Format: and <TRACK>: <NUMKEYS>[<KEYFRAMES:uint16 or uint32 x NUMKEYS if NUMKEYS > 1>][<RANGEMIN><RANGEEXTENT> if not rotation]<VALUES:uint16 x 3*NUMKEYS>
+	uint32_t header[4] = { W_SKELETON_COMPRESSED_MARKER, W_SKELETON_COMPRESSED_VERSION, numFrames, numBones };
+	outputStream.write((char*)header, sizeof(header));
+	for (uint32_t f = 0; f < numFrames; f++)
+		outputStream.write((char*)&WAnimation::m_frames[f]->fTime, 4);
+	for (uint32_t i = 0; i < numBones; i++) {
+		char name[64] = {};
+		layoutFrame->boneV[i]->GetName(name, 64);
+		WMatrix invBindingPose = layoutFrame->invBindingPoses[i];
+		outputStream.write((char*)&layoutFrame->boneIndices[i], 4);
+		outputStream.write((char*)&layoutFrame->parents[i], 4);
+		outputStream.write(name, 64);
+		outputStream.write((char*)&invBindingPose, sizeof(WMatrix));
+	}
+	for (uint32_t t = 0; t < tracks.size(); t++) {
+		uint32_t numKeys = (uint32_t)tracks[t].keyFrames.size();
+		outputStream.write((char*)&numKeys, 4);
+		if (numKeys > 1) {
+			for (auto it = tracks[t].keyFrames.begin(); it != tracks[t].keyFrames.end(); it++) {
+				if (numFrames <= 0x10000) {
+					uint16_t keyFrame = (uint16_t)*it;
+					outputStream.write((char*)&keyFrame, 2);
+				} else
+					outputStream.write((char*)&(*it), 4);
+			}
+		}
+		if (t % 3 != 1) {
+			outputStream.write((char*)&tracks[t].rangeMin, sizeof(WVector3));
+			outputStream.write((char*)&tracks[t].rangeExtent, sizeof(WVector3));
+		}
+		outputStream.write((char*)tracks[t].values.data(), tracks[t].values.size() * sizeof(uint16_t));
+	}
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WSkeleton::_LoadCompressed(std::istream& inputStream) {
+	uint32_t header[3];
+	inputStream.read((char*)header, sizeof(header));
+	if (header[0] != W_SKELETON_COMPRESSED_VERSION)
+		return WError(W_INVALIDFILEFORMAT);
+	uint32_t numFrames = header[1];
+	uint32_t numBones = header[2];
+	if (numBones == 0)
+		return WError(W_INVALIDFILEFORMAT);
+
+	vector<float> frameTimes(numFrames), times(numFrames);
+	if (numFrames)
+		inputStream.read((char*)frameTimes.data(), numFrames * 4);
+	for (uint32_t f = 1; f < numFrames; f++)
+		times[f] = times[f - 1] + frameTimes[f - 1];
+
+	vector<uint32_t> indices(numBones), parents(numBones);
+	vector<std::array<char, 64>> names(numBones);
+	vector<WMatrix> invBindingPoses(numBones);
+	for (uint32_t i = 0; i < numBones; i++) {
+		inputStream.read((char*)&indices[i], 4);
+		inputStream.read((char*)&parents[i], 4);
+		inputStream.read(names[i].data(), 64);
+		names[i][63] = '\0';
+		inputStream.read((char*)&invBindingPoses[i], sizeof(WMatrix));
+		if ((i == 0) != (parents[i] == std::numeric_limits<uint32_t>::max()) || (i > 0 && parents[i] >= i))
+			return WError(W_INVALIDFILEFORMAT); // parents must come before their children
+	}
+
+	//decompress the tracks to a value per frame
+	vector<vector<WVector3>> positions(numBones), scales(numBones);
+	vector<vector<WQuaternion>> rotations(numBones);
+	for (uint32_t t = 0; t < numBones * 3; t++) {
+		_WCompressedTrack track;
+		uint32_t numKeys = 0;
+		inputStream.read((char*)&numKeys, 4);
+		if (numKeys == 0 || numKeys > std::max(numFrames, 1u) || inputStream.fail())
+			return WError(W_INVALIDFILEFORMAT);
+		track.keyFrames.resize(numKeys, 0);
+		if (numKeys > 1) {
+			for (uint32_t k = 0; k < numKeys; k++) {
+				if (numFrames <= 0x10000) {
+					uint16_t keyFrame = 0;
+					inputStream.read((char*)&keyFrame, 2);
+					track.keyFrames[k] = keyFrame;
+				} else
+					inputStream.read((char*)&track.keyFrames[k], 4);
+				if (track.keyFrames[k] >= numFrames || (k > 0 && track.keyFrames[k] <= track.keyFrames[k - 1]))
+					return WError(W_INVALIDFILEFORMAT);
+			}
+		}
+		if (t % 3 != 1) {
+			inputStream.read((char*)&track.rangeMin, sizeof(WVector3));
+			inputStream.read((char*)&track.rangeExtent, sizeof(WVector3));
+		}
+		track.values.resize(numKeys * 3);
+		inputStream.read((char*)track.values.data(), track.values.size() * sizeof(uint16_t));
+
+		if (t % 3 == 0)
+			_DecompressVectorTrack(track, times, positions[t / 3]);
+		else if (t % 3 == 1)
+			_DecompressRotationTrack(track, times, rotations[t / 3]);
+		else
+			_DecompressVectorTrack(track, times, scales[t / 3]);
+	}
+	if (inputStream.fail())
+		return WError(W_INVALIDFILEFORMAT);
+
+	//rebuild the bones of every frame and create the keyframes
+	for (uint32_t f = 0; f < numFrames; f++) {
+		vector<WBone*> bones(numBones);
+		for (uint32_t i = 0; i < numBones; i++) {
+			bones[i] = new WBone();
+			bones[i]->SetIndex(indices[i]);
+			bones[i]->SetName(names[i].data());
+			bones[i]->SetInvBindingPose(invBindingPoses[i]);
+			bones[i]->SetPosition(positions[i][f]);
+			WMatrix rotation = WRotationMatrixQuaternion(rotations[i][f]);
+			bones[i]->SetULRVectors(WVector3(rotation(1, 0), rotation(1, 1), rotation(1, 2)),
+									WVector3(rotation(2, 0), rotation(2, 1), rotation(2, 2)),
+									WVector3(rotation(0, 0), rotation(0, 1), rotation(0, 2)));
+			bones[i]->Scale(scales[i][f]);
+			if (i > 0) {
+				bones[i]->SetParent(bones[parents[i]]);
+				bones[parents[i]]->AddChild(bones[i]);
+			}
+		}
+
+		WError err = CreateKeyFrame(bones[0], frameTimes[f]);
+		delete bones[0];
+		if (!err)
+			return err;
+	}
+
+	return WError(W_SUCCEEDED);
+}
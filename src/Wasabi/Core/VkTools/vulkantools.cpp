@@ -218,6 +218,14 @@ namespace vkTools
 			destStageFlags = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
 		}
 
+		// New layout is read-only depth attachment (that can also be sampled)
+		// Make sure any writes to the image have been finished
+		if (newImageLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
+		{
+			imageMemoryBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+			destStageFlags = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		}
+
 		// New layout is shader read (sampler, input attachment)
 		// Make sure any writes to the image have been finished
 		if (newImageLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
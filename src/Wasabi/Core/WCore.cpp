@@ -61,8 +61,8 @@ int RunWasabi(Wasabi* app) {
 			float maxFPSReached = app->maxFPS > 0.001f ? app->maxFPS : 60.0f;
 			float deltaTime = 1.0f / maxFPSReached;
 			app->FPS = 0;
+			app->FramePacer.Start();
 			while (!app->__EXIT) {
-				auto tStart = std::chrono::high_resolution_clock::now();
 				app->Timer.GetElapsedTime(true); // record elapsed time
 
 				if (app->WindowAndInputComponent && !app->WindowAndInputComponent->Loop())
@@ -88,33 +88,24 @@ int RunWasabi(Wasabi* app) {
 
 				numFrames++;
 
-				auto tEnd = std::chrono::high_resolution_clock::now();
-				auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-				deltaTime = (float)tDiff / 1000.0f;
-				maxFPSReached = fmax(maxFPSReached, 1.0f / deltaTime);
+				// wait for the frame's deadline if the FPS is capped, deltaTime is the full time between frames
+				deltaTime = app->FramePacer.EndFrame(app->maxFPS);
+				maxFPSReached = fmax(maxFPSReached, 1.0f / fmax(deltaTime, W_EPSILON));
 
 				// update FPS
+				auto tEnd = std::chrono::high_resolution_clock::now();
 				if (std::chrono::duration<double, std::milli>(tEnd - fpsTimer).count() / 1000.0f > 0.5f) {
 					app->FPS = (float)numFrames / 0.5f;
 					fpsTimer = std::chrono::high_resolution_clock::now();
 					numFrames = 0;
 				}
 
-				if (app->maxFPS > 0.001) {
-					float maxDeltaTime = 1.0f / app->maxFPS; // delta time at max FPS
-					if (deltaTime < maxDeltaTime) {
-						auto sleepStart = std::chrono::high_resolution_clock::now();
-						double diff;
-						do {
-							auto sleepNow = std::chrono::high_resolution_clock::now();
-							diff = std::chrono::duration<double, std::milli>(sleepNow - sleepStart).count();
-						} while ((float)diff / 1000.0f < (maxDeltaTime - deltaTime));
-						deltaTime = maxDeltaTime;
-					}
+				if (app->maxFPS > 0.001)
 					deltaTime = fmax(deltaTime, 1.0f / app->maxFPS); // dont let deltaTime be 0
-				} else
+				else
 					deltaTime = fmax(deltaTime, 1.0f / maxFPSReached); // dont let deltaTime be 0
 			}
+			app->FramePacer.Stop();
 		}
 		app->Cleanup();
 	}
@@ -141,7 +132,7 @@ VKAPI_ATTR VkBool32 VKAPI_CALL VulkanDebugReportCallback(
 	return VK_FALSE;
 }
 
-Wasabi::Wasabi() : Timer(W_TIMER_SECONDS, true) {
+Wasabi::Wasabi() : Timer(W_TIMER_SECONDS, true), FramePacer(this), ThreadPool(this) {
 	engineParams = {
 		{ "appName", (void*)"Wasabi" }, // LPCSTR
 		{ "fontBmpSize", (void*)(512) }, // int
@@ -152,6 +143,33 @@ Wasabi::Wasabi() : Timer(W_TIMER_SECONDS, true) {
 		{ "numGeneratedMips", (void*)(1) }, // int
 		{ "bufferingCount", (void*)(2) }, // int
 		{ "enableVulkanValidation", (void*)(true) }, // bool
+		{ "maxSceneObjects", (void*)(16384) }, // int
+		{ "maxRenderTargets", (void*)(128) }, // int
+		{ "dynamicResolution", (void*)(false) }, // bool
+		{ "targetGPUFrameTime", (void*)(16) }, // int
+		{ "minResolutionScale", (void*)(50) }, // int
+		{ "presentMode", (void*)(VK_PRESENT_MODE_MAX_ENUM_KHR) }, // VkPresentModeKHR
+		{ "frameJitterBound", (void*)(1000) }, // int
+		{ "asyncCompute", (void*)(false) }, // bool
+		{ "numWorkerThreads", (void*)(0) }, // int
+		{ "animationLOD", (void*)(true) }, // bool
+		{ "animationLODFullRateSize", (void*)(25) }, // int
+		{ "animationLODMaxInterval", (void*)(8) }, // int
+		{ "animationLODBoneDepthSize", (void*)(5) }, // int
+		{ "animationLODBoneDepth", (void*)(4) }, // int
+		{ "animationBoneBudget", (void*)(0) }, // int
+		{ "maxLights", (void*)(1024) }, // int
+		{ "computeLightClusters", (void*)(false) }, // bool
+		{ "forwardDepthPrepass", (void*)(false) }, // bool
+		{ "clusteredDeferredLighting", (void*)(true) }, // bool
+		{ "tiledDeferredLighting", (void*)(false) }, // bool
+		{ "shadowAtlasSize", (void*)(4096) }, // int
+		{ "shadowTileSize", (void*)(1024) }, // int
+		{ "shadowCascades", (void*)(3) }, // int
+		{ "shadowDistance", FloatEngineParam(100.0f) }, // float
+		{ "maxShadowTileUpdates", (void*)(4) }, // int
+		{ "computeSkinning", (void*)(false) }, // bool
+		{ "maxSkinnedVertices", (void*)(262144) }, // int
 	};
 	m_swapChainInitialized = false;
 
@@ -178,7 +196,11 @@ Wasabi::Wasabi() : Timer(W_TIMER_SECONDS, true) {
 	TerrainManager = nullptr;
 
 	m_vkDevice = VK_NULL_HANDLE;
+	m_vkFeatures = {};
 	m_vkInstance = VK_NULL_HANDLE;
+	m_graphicsQueue = VK_NULL_HANDLE;
+	m_computeQueue = VK_NULL_HANDLE;
+	m_graphicsQueueFamily = m_computeQueueFamily = 0;
 
 	curState = nullptr;
 	__EXIT = false;
@@ -366,24 +388,50 @@ WError Wasabi::StartEngine(int width, int height) {
 	if (graphicsQueueIndex == queueCount)
 		return WError(W_HARDWARENOTSUPPORTED);
 
+	// Find a separate queue for compute work: a compute-only family (usually backed by dedicated hardware
+	// queues), otherwise a second queue of the graphics family. Devices with a single queue (like lavapipe)
+	// run the compute work on the graphics queue
+	uint32_t computeQueueIndex = graphicsQueueIndex;
+	uint32_t computeQueueInFamily = 0;
+	if (GetEngineParam<bool>("asyncCompute", false)) {
+		for (uint32_t i = 0; i < queueCount; i++) {
+			if ((queueProps[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+				computeQueueIndex = i;
+				break;
+			}
+		}
+		if (computeQueueIndex == graphicsQueueIndex && queueProps[graphicsQueueIndex].queueCount > 1 &&
+			(queueProps[graphicsQueueIndex].queueFlags & VK_QUEUE_COMPUTE_BIT))
+			computeQueueInFamily = 1;
+	}
+	bool separateComputeQueue = computeQueueIndex != graphicsQueueIndex || computeQueueInFamily != 0;
+
 	//
 	// Create Vulkan device
 	//
-	std::array<float, 1> queuePriorities = { 0.0f };
+	std::array<float, 2> queuePriorities = { 0.0f, 0.0f };
+	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	VkDeviceQueueCreateInfo queueCreateInfo = {};
 	queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 	queueCreateInfo.queueFamilyIndex = graphicsQueueIndex;
-	queueCreateInfo.queueCount = 1;
+	queueCreateInfo.queueCount = 1 + computeQueueInFamily;
 	queueCreateInfo.pQueuePriorities = queuePriorities.data();
+	queueCreateInfos.push_back(queueCreateInfo);
+	if (computeQueueIndex != graphicsQueueIndex) {
+		queueCreateInfo.queueFamilyIndex = computeQueueIndex;
+		queueCreateInfo.queueCount = 1;
+		queueCreateInfos.push_back(queueCreateInfo);
+	}
 
 	std::vector<const char*> enabledExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
 	VkPhysicalDeviceFeatures features = GetDeviceFeatures();
+	m_vkFeatures = features;
 	VkDeviceCreateInfo deviceCreateInfo = {};
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.pNext = NULL;
-	deviceCreateInfo.queueCreateInfoCount = 1;
-	deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+	deviceCreateInfo.queueCreateInfoCount = (uint32_t)queueCreateInfos.size();
+	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 	deviceCreateInfo.pEnabledFeatures = &features;
 
 	if (enabledExtensions.size() > 0) {
@@ -395,8 +443,15 @@ WError Wasabi::StartEngine(int width, int height) {
 	if (err != VK_SUCCESS)
 		return WError(W_UNABLETOCREATEDEVICE);
 
-	// Get the graphics queue
+	// Get the graphics and compute queues
 	vkGetDeviceQueue(m_vkDevice, graphicsQueueIndex, 0, &m_graphicsQueue);
+	m_graphicsQueueFamily = graphicsQueueIndex;
+	m_computeQueue = VK_NULL_HANDLE;
+	m_computeQueueFamily = graphicsQueueIndex;
+	if (separateComputeQueue) {
+		vkGetDeviceQueue(m_vkDevice, computeQueueIndex, computeQueueInFamily, &m_computeQueue);
+		m_computeQueueFamily = computeQueueIndex;
+	}
 
 	MemoryManager = new WVulkanMemoryManager();
 	WError werr = MemoryManager->Initialize(m_vkPhysDev, m_vkDevice, m_graphicsQueue, graphicsQueueIndex);
@@ -461,6 +516,11 @@ WError Wasabi::StartEngine(int width, int height) {
 	if (!werr)
 		return WError(W_ERRORUNK);
 
+	// default effects build their pipelines in the background
+	werr = EffectManager->WaitForPipelineBuilds();
+	if (!werr)
+		return werr;
+
 	return WError(W_SUCCEEDED);
 }
 
@@ -477,12 +537,24 @@ VkInstance Wasabi::GetVulkanInstance() const {
 VkPhysicalDevice Wasabi::GetVulkanPhysicalDevice() const {
 	return m_vkPhysDev;
 }
+VkPhysicalDeviceFeatures Wasabi::GetEnabledDeviceFeatures() const {
+	return m_vkFeatures;
+}
 VkDevice Wasabi::GetVulkanDevice() const {
 	return m_vkDevice;
 }
 VkQueue Wasabi::GetVulkanGraphicsQeueue() const {
 	return m_graphicsQueue;
 }
+VkQueue Wasabi::GetVulkanComputeQueue() const {
+	return m_computeQueue;
+}
+uint32_t Wasabi::GetVulkanGraphicsQueueFamily() const {
+	return m_graphicsQueueFamily;
+}
+uint32_t Wasabi::GetVulkanComputeQueueFamily() const {
+	return m_computeQueueFamily;
+}
 
 VulkanSwapChain* Wasabi::GetSwapChain() {
 	return &m_swapChain;
@@ -500,6 +572,9 @@ VkPhysicalDeviceFeatures Wasabi::GetDeviceFeatures() {
 	VkPhysicalDeviceFeatures features = {};
 	features.samplerAnisotropy = VK_TRUE;
 	features.fillModeNonSolid = VK_TRUE;
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(m_vkPhysDev, &supportedFeatures);
+	features.depthBounds = supportedFeatures.depthBounds;
 #if !defined(__APPLE__)
 	// MoltenVK doesn't support geometry shaders (boo)
 	features.geometryShader = VK_TRUE;
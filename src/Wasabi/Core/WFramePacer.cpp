@@ -0,0 +1,154 @@
+#include "Wasabi/Core/WFramePacer.hpp"
+#include "Wasabi/Core/WCore.hpp"
+
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+/** Number of sleeps measured to calibrate the sleep overshoot */
+#define W_FRAME_PACER_CALIBRATION_SLEEPS 8
+/** Length of the sleeps measured to calibrate the sleep overshoot (in seconds) */
+#define W_FRAME_PACER_CALIBRATION_SLEEP 0.001
+/** Lowest sleep overshoot estimate (in seconds) */
+#define W_FRAME_PACER_MIN_OVERSHOOT 0.00005
+
+WFramePacer::WFramePacer(Wasabi* const app) : m_app(app) {
+	m_started = false;
+	m_sleepOvershoot = W_FRAME_PACER_CALIBRATION_SLEEP;
+	m_history = {};
+	m_historySize = 0;
+	m_historyIndex = 0;
+}
+
+WFramePacer::~WFramePacer() {
+	Stop();
+}
+
+void WFramePacer::Start() {
+	Stop();
+
+#ifdef _WIN32
+	timeBeginPeriod(1);
+#endif
+
+	// measure how late the OS wakes up, the worst sleep is the starting estimate
+	m_sleepOvershoot = W_FRAME_PACER_MIN_OVERSHOOT;
+	for (uint32_t i = 0; i < W_FRAME_PACER_CALIBRATION_SLEEPS; i++) {
+		auto sleepStart = Clock::now();
+		std::this_thread::sleep_for(std::chrono::duration<double>(W_FRAME_PACER_CALIBRATION_SLEEP));
+		double overshoot = std::chrono::duration<double>(Clock::now() - sleepStart).count() - W_FRAME_PACER_CALIBRATION_SLEEP;
+		m_sleepOvershoot = fmax(m_sleepOvershoot, overshoot);
+	}
+
+	m_historySize = 0;
+	m_historyIndex = 0;
+	m_lastFrameEnd = m_lastDeadline = Clock::now();
+	m_started = true;
+}
+
+void WFramePacer::Stop() {
+	if (!m_started)
+		return;
+	m_started = false;
+
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
+
+void WFramePacer::_Sleep(double seconds) {
+	auto sleepStart = Clock::now();
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	double overshoot = std::chrono::duration<double>(Clock::now() - sleepStart).count() - seconds;
+
+	// follow a worse overshoot right away and decay slowly towards a better one
+	if (overshoot > m_sleepOvershoot)
+		m_sleepOvershoot = overshoot;
+	else
+		m_sleepOvershoot = fmax(m_sleepOvershoot * 0.95 + overshoot * 0.05, W_FRAME_PACER_MIN_OVERSHOOT);
+}
+
+float WFramePacer::EndFrame(float maxFPS) {
+	FRAME_TIMES times = {};
+	auto workEnd = Clock::now();
+	times.workTime = std::chrono::duration<double>(workEnd - m_lastFrameEnd).count();
+
+	if (maxFPS > 0.001f) {
+		auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / maxFPS));
+		auto deadline = m_lastDeadline + period;
+		if (deadline < workEnd - period)
+			deadline = workEnd; // more than a frame behind, don't try to catch up
+
+		double jitterBound = (double)m_app->GetEngineParam<int>("frameJitterBound", 1000) / 1000000.0;
+		auto now = workEnd;
+		while (now < deadline) {
+			double remaining = std::chrono::duration<double>(deadline - now).count();
+			if (remaining > m_sleepOvershoot) {
+				auto sleepStart = now;
+				_Sleep(remaining - m_sleepOvershoot);
+				now = Clock::now();
+				times.sleepTime += std::chrono::duration<double>(now - sleepStart).count();
+			} else if (remaining <= jitterBound) {
+				break; // close enough, end the frame early
+			} else {
+				auto spinStart = now;
+				while ((now = Clock::now()) < deadline)
+					std::this_thread::yield();
+				times.spinTime += std::chrono::duration<double>(now - spinStart).count();
+			}
+		}
+
+		times.deadlineError = std::chrono::duration<double>(now - deadline).count();
+		m_lastDeadline = deadline;
+	} else
+		m_lastDeadline = workEnd;
+
+	auto frameEnd = Clock::now();
+	times.frameTime = std::chrono::duration<double>(frameEnd - m_lastFrameEnd).count();
+	m_lastFrameEnd = frameEnd;
+
+	m_history[m_historyIndex] = times;
+	m_historyIndex = (m_historyIndex + 1) % W_FRAME_PACER_HISTORY;
+	m_historySize = std::min(m_historySize + 1, (uint32_t)W_FRAME_PACER_HISTORY);
+
+	return (float)times.frameTime;
+}
+
+W_FRAME_PACING_STATS WFramePacer::GetStatistics() const {
+	W_FRAME_PACING_STATS stats = {};
+	stats.sleepOvershoot = (float)(m_sleepOvershoot * 1000.0);
+	if (m_historySize == 0)
+		return stats;
+
+	double sumFrameTimes = 0.0, sumSquaredFrameTimes = 0.0;
+	double minFrameTime = DBL_MAX, maxFrameTime = 0.0;
+	double sumWorkTimes = 0.0, sumSleepTimes = 0.0, sumSpinTimes = 0.0, sumDeadlineErrors = 0.0;
+	for (uint32_t i = 0; i < m_historySize; i++) {
+		const FRAME_TIMES& times = m_history[i];
+		sumFrameTimes += times.frameTime;
+		sumSquaredFrameTimes += times.frameTime * times.frameTime;
+		minFrameTime = fmin(minFrameTime, times.frameTime);
+		maxFrameTime = fmax(maxFrameTime, times.frameTime);
+		sumWorkTimes += times.workTime;
+		sumSleepTimes += times.sleepTime;
+		sumSpinTimes += times.spinTime;
+		sumDeadlineErrors += fabs(times.deadlineError);
+	}
+
+	double n = (double)m_historySize;
+	double average = sumFrameTimes / n;
+	stats.numFrames = m_historySize;
+	stats.averageFrameTime = (float)(average * 1000.0);
+	stats.minFrameTime = (float)(minFrameTime * 1000.0);
+	stats.maxFrameTime = (float)(maxFrameTime * 1000.0);
+	stats.frameTimeJitter = (float)(sqrt(fmax(sumSquaredFrameTimes / n - average * average, 0.0)) * 1000.0);
+	stats.averageWorkTime = (float)(sumWorkTimes / n * 1000.0);
+	stats.averageSleepTime = (float)(sumSleepTimes / n * 1000.0);
+	stats.averageSpinTime = (float)(sumSpinTimes / n * 1000.0);
+	stats.averageDeadlineError = (float)(sumDeadlineErrors / n * 1000.0);
+	return stats;
+}
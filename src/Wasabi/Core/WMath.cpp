@@ -297,6 +297,32 @@ WMatrix WRotationMatrixAxis(const WVector3 axis, const float fAngle) {
 		t*X*Z + s*Y, t*Y*Z - s*X, t*Z*Z + c, 0,
 		0, 0, 0, 1);
 }
+WMatrix WRotationMatrixQuaternion(const WQuaternion q) {
+	float X = q.x;
+	float Y = q.y;
+	float Z = q.z;
+	float W = q.w;
+
+	return WMatrix(1 - 2 * (Y*Y + Z*Z), 2 * (X*Y + Z*W), 2 * (X*Z - Y*W), 0,
+		2 * (X*Y - Z*W), 1 - 2 * (X*X + Z*Z), 2 * (Y*Z + X*W), 0,
+		2 * (X*Z + Y*W), 2 * (Y*Z - X*W), 1 - 2 * (X*X + Y*Y), 0,
+		0, 0, 0, 1);
+}
+WQuaternion WQuaternionRotationMatrix(const WMatrix m) {
+	float trace = m(0, 0) + m(1, 1) + m(2, 2);
+	if (trace > 0.0f) {
+		float s = sqrtf(trace + 1.0f) * 2.0f;
+		return WQuaternion((m(1, 2) - m(2, 1)) / s, (m(2, 0) - m(0, 2)) / s, (m(0, 1) - m(1, 0)) / s, 0.25f * s);
+	} else if (m(0, 0) > m(1, 1) && m(0, 0) > m(2, 2)) {
+		float s = sqrtf(1.0f + m(0, 0) - m(1, 1) - m(2, 2)) * 2.0f;
+		return WQuaternion(0.25f * s, (m(0, 1) + m(1, 0)) / s, (m(0, 2) + m(2, 0)) / s, (m(1, 2) - m(2, 1)) / s);
+	} else if (m(1, 1) > m(2, 2)) {
+		float s = sqrtf(1.0f + m(1, 1) - m(0, 0) - m(2, 2)) * 2.0f;
+		return WQuaternion((m(0, 1) + m(1, 0)) / s, 0.25f * s, (m(1, 2) + m(2, 1)) / s, (m(2, 0) - m(0, 2)) / s);
+	}
+	float s = sqrtf(1.0f + m(2, 2) - m(0, 0) - m(1, 1)) * 2.0f;
+	return WQuaternion((m(0, 2) + m(2, 0)) / s, (m(1, 2) + m(2, 1)) / s, 0.25f * s, (m(0, 1) - m(1, 0)) / s);
+}
 WMatrix WScalingMatrix(const float fX, const float fY, const float fZ) {
 	WMatrix out = WMatrix();
 	out(0, 0) = fX;
@@ -0,0 +1,169 @@
+#include "Wasabi/Core/WThreadPool.hpp"
+#include "Wasabi/Core/WCore.hpp"
+
+/** Whether the current thread is a worker of a WThreadPool */
+static thread_local bool g_isPoolWorker = false;
+/** Index of the current thread, see WThreadPool::GetThreadIndex() */
+static thread_local uint32_t g_poolThreadIndex = 0;
+
+WThreadPool::WThreadPool(Wasabi* const app) : m_app(app) {
+	m_started = false;
+	m_stop = false;
+	m_jobGeneration = 0;
+	m_jobFunc = nullptr;
+	m_jobCount = 0;
+	m_jobBatchSize = 1;
+	m_nextIndex = 0;
+	m_numBusyWorkers = 0;
+}
+
+WThreadPool::~WThreadPool() {
+	Stop();
+}
+
+uint32_t WThreadPool::_Start() {
+	std::lock_guard<std::mutex> startLock(m_startMutex);
+	if (m_started)
+		return (uint32_t)m_threads.size();
+	m_started = true;
+
+	uint32_t numThreads = m_app->GetEngineParam<uint32_t>("numWorkerThreads", 0);
+	if (numThreads == 0)
+		numThreads = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = false;
+	}
+	for (uint32_t i = 0; i < numThreads; i++)
+		m_threads.push_back(std::thread(&WThreadPool::_WorkerMain, this, i + 1));
+	return numThreads;
+}
+
+void WThreadPool::Stop() {
+	// the workers are joined without holding m_startMutex, so the tasks they
+	// still run can submit more tasks (those run on the submitting thread)
+	std::vector<std::thread> threads;
+	{
+		std::lock_guard<std::mutex> startLock(m_startMutex);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		threads.swap(m_threads);
+	}
+	m_jobSubmittedCV.notify_all();
+	for (auto it = threads.begin(); it != threads.end(); it++)
+		it->join();
+
+	std::lock_guard<std::mutex> startLock(m_startMutex);
+	m_started = false;
+}
+
+uint32_t WThreadPool::GetNumThreads() {
+	return _Start() + 1;
+}
+
+uint32_t WThreadPool::GetThreadIndex() {
+	return g_poolThreadIndex;
+}
+
+void WThreadPool::_WorkerMain(uint32_t threadIndex) {
+	g_isPoolWorker = true;
+	g_poolThreadIndex = threadIndex;
+	uint64_t lastGeneration = 0;
+	while (true) {
+		std::function<void(uint32_t)> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobSubmittedCV.wait(lock, [this, lastGeneration]() {
+				return m_stop || m_jobGeneration != lastGeneration || m_tasks.size() > 0;
+			});
+			// a worker that wakes up after all the batches were taken must not
+			// touch the job, its caller may have returned already
+			bool hasBatches = m_jobGeneration != lastGeneration && m_nextIndex < m_jobCount;
+			lastGeneration = m_jobGeneration;
+			if (hasBatches) {
+				m_numBusyWorkers++;
+			} else if (m_tasks.size() > 0) {
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+			} else if (m_stop) {
+				return;
+			} else {
+				continue;
+			}
+		}
+
+		if (task) {
+			task(threadIndex);
+			continue;
+		}
+
+		while (_RunBatch());
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_numBusyWorkers--;
+		}
+		m_jobDoneCV.notify_all();
+	}
+}
+
+bool WThreadPool::_RunBatch() {
+	uint32_t begin = m_nextIndex.fetch_add(m_jobBatchSize);
+	if (begin >= m_jobCount)
+		return false;
+	(*m_jobFunc)(begin, std::min(begin + m_jobBatchSize, m_jobCount));
+	return true;
+}
+
+void WThreadPool::ParallelFor(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t begin, uint32_t end)>& func) {
+	if (count == 0)
+		return;
+	batchSize = std::max(batchSize, 1u);
+	if (count <= batchSize || g_isPoolWorker) {
+		func(0, count);
+		return;
+	}
+
+	std::lock_guard<std::mutex> callLock(m_callMutex);
+	if (_Start() == 0) {
+		func(0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobFunc = &func;
+		m_jobCount = count;
+		m_jobBatchSize = batchSize;
+		m_nextIndex = 0;
+		m_jobGeneration++;
+	}
+	m_jobSubmittedCV.notify_all();
+
+	while (_RunBatch());
+
+	// all the batches are taken, wait for the workers still running one
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_jobDoneCV.wait(lock, [this]() { return m_numBusyWorkers == 0; });
+	m_jobFunc = nullptr;
+}
+
+void WThreadPool::Submit(std::function<void(uint32_t threadIndex)> task) {
+	bool queued = false;
+	if (_Start() > 0) {
+		// the workers may have been told to stop since, and would not see it
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_stop) {
+			m_tasks.push_back(std::move(task));
+			queued = true;
+		}
+	}
+
+	if (queued)
+		m_jobSubmittedCV.notify_one();
+	else
+		task(GetThreadIndex());
+}
@@ -5,6 +5,10 @@
 #include "Wasabi/Images/WRenderTarget.hpp"
 #include "Wasabi/WindowAndInput/WWindowAndInputComponent.hpp"
 
+#if W_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 bool WUtil::Point3DToScreen2D(Wasabi* app, WVector3 point, double* _x, double* _y) {
 	WCamera* cam = app->Renderer->GetRenderTarget(app->Renderer->GetPickingRenderStageName())->GetCamera();
 	float width = (float)app->WindowAndInputComponent->GetWindowWidth(false);
@@ -225,3 +229,46 @@ float WUtil::frand_0_1() {
 float WUtil::flerp(float x, float y, float f) {
 	return x * (1 - f) + y * f;
 }
+
+/** Instruction sets that the CPU supports */
+struct W_CPU_FEATURES {
+	bool sse41;
+	bool avx2;
+
+	W_CPU_FEATURES() {
+		sse41 = avx2 = false;
+#if W_X86
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+		sse41 = (info[2] & (1 << 19)) != 0;
+		// AVX can only be used when the OS saves the AVX registers (OSXSAVE and XCR0)
+		bool osSavesAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		if (maxLeaf >= 7 && osSavesAVX) {
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+#else
+		// the AVX features are only reported when the OS saves their registers
+		__builtin_cpu_init();
+		sse41 = __builtin_cpu_supports("sse4.1");
+		avx2 = __builtin_cpu_supports("avx2");
+#endif
+#endif
+	}
+};
+
+static const W_CPU_FEATURES& _GetCPUFeatures() {
+	static const W_CPU_FEATURES features;
+	return features;
+}
+
+bool WUtil::CPUSupportsSSE41() {
+	return _GetCPUFeatures().sse41;
+}
+
+bool WUtil::CPUSupportsAVX2() {
+	return _GetCPUFeatures().avx2;
+}
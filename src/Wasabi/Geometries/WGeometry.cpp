@@ -264,7 +264,7 @@ WError WGeometry::CreateFromData(void* vb, uint32_t numVerts, void* ib, uint32_t
 	uint32_t numBuffersIB = (flags & W_GEOMETRY_CREATE_IB_DYNAMIC) ? m_app->GetEngineParam<uint32_t>("bufferingCount") : 1;
 
 	W_MEMORY_STORAGE memory = (flags & W_GEOMETRY_CREATE_VB_DYNAMIC) ? W_MEMORY_HOST_VISIBLE : W_MEMORY_DEVICE_LOCAL_HOST_COPY;
-	VkResult result = m_vertices.Create(m_app, numBuffersVB, vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vb, memory);
+	VkResult result = m_vertices.Create(m_app, numBuffersVB, vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, vb, memory);
 	if (result == VK_SUCCESS && indexBufferSize > 0) {
 		memory = (flags & W_GEOMETRY_CREATE_AB_DYNAMIC) ? W_MEMORY_HOST_VISIBLE : W_MEMORY_DEVICE_LOCAL_HOST_COPY;
 		result = m_indices.Create(m_app, numBuffersIB, indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, ib, memory);
@@ -309,7 +309,7 @@ WError WGeometry::CreateAnimationData(void* ab, W_GEOMETRY_CREATE_FLAGS flags) {
 	size_t animBufferSize = m_numVertices * GetVertexDescription(1).GetSize();
 	uint32_t numBuffers = (flags & W_GEOMETRY_CREATE_AB_DYNAMIC) ? m_app->GetEngineParam<uint32_t>("bufferingCount") : 1;
 	W_MEMORY_STORAGE memory = (flags & W_GEOMETRY_CREATE_AB_DYNAMIC) ? W_MEMORY_HOST_VISIBLE : W_MEMORY_DEVICE_LOCAL_HOST_COPY;
-	VkResult result = m_animationbuf.Create(m_app, numBuffers, animBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, ab, memory);
+	VkResult result = m_animationbuf.Create(m_app, numBuffers, animBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, ab, memory);
 	if (result != VK_SUCCESS)
 		return WError(W_OUTOFMEMORY);
 
@@ -1301,6 +1301,61 @@ WError WGeometry::Draw(WRenderTarget* rt, uint32_t numIndices, uint32_t numInsta
 	return WError(W_SUCCEEDED);
 }
 
+WError WGeometry::DrawWithVertexBuffer(WRenderTarget* rt, VkBuffer vertexBuffer, VkDeviceSize vertexOffset, uint32_t numIndices, uint32_t numInstances) {
+	VkCommandBuffer renderCmdBuffer = rt->GetCommnadBuffer();
+	if (!renderCmdBuffer)
+		return WError(W_NORENDERTARGET);
+	if (vertexBuffer == VK_NULL_HANDLE)
+		return WError(W_INVALIDPARAM);
+
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	vkCmdBindVertexBuffers(renderCmdBuffer, 0, 1, &vertexBuffer, &vertexOffset);
+
+	if (m_indices.Valid()) {
+		if (numIndices == std::numeric_limits<uint32_t>::max() || numIndices > m_numIndices)
+			numIndices = m_numIndices;
+		vkCmdBindIndexBuffer(renderCmdBuffer, m_indices.GetBuffer(m_app, bufferIndex), 0, VK_INDEX_TYPE_UINT32);
+		vkCmdDrawIndexed(renderCmdBuffer, numIndices, numInstances, 0, 0, 0);
+	} else {
+		if (numIndices == std::numeric_limits<uint32_t>::max() || numIndices > m_numVertices)
+			numIndices = m_numVertices;
+		vkCmdDraw(renderCmdBuffer, numIndices, numInstances, 0, 0);
+	}
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WGeometry::DrawIndirect(WRenderTarget* rt, VkBuffer argsBuffer, VkDeviceSize argsOffset, bool bind_animation) {
+	VkCommandBuffer renderCmdBuffer = rt->GetCommnadBuffer();
+	if (!renderCmdBuffer)
+		return WError(W_NORENDERTARGET);
+	if (argsBuffer == VK_NULL_HANDLE)
+		return WError(W_INVALIDPARAM);
+
+	VkDeviceSize offsets[] = { 0, 0 };
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	VkBuffer bindings[] = { m_vertices.GetBuffer(m_app, bufferIndex), VK_NULL_HANDLE };
+	if (bind_animation && m_animationbuf.Valid())
+		bindings[1] = m_animationbuf.GetBuffer(m_app, bufferIndex);
+	vkCmdBindVertexBuffers(renderCmdBuffer, 0, bindings[1] == VK_NULL_HANDLE ? 1 : 2, bindings, offsets);
+
+	if (m_indices.Valid()) {
+		vkCmdBindIndexBuffer(renderCmdBuffer, m_indices.GetBuffer(m_app, bufferIndex), 0, VK_INDEX_TYPE_UINT32);
+		vkCmdDrawIndexedIndirect(renderCmdBuffer, argsBuffer, argsOffset, 1, sizeof(VkDrawIndexedIndirectCommand));
+	} else
+		vkCmdDrawIndirect(renderCmdBuffer, argsBuffer, argsOffset, 1, sizeof(VkDrawIndirectCommand));
+
+	return WError(W_SUCCEEDED);
+}
+
+WBufferedBuffer* WGeometry::GetVertexBuffer() {
+	return &m_vertices;
+}
+
+WBufferedBuffer* WGeometry::GetAnimationBuffer() {
+	return &m_animationbuf;
+}
+
 WVector3 WGeometry::GetMaxPoint() const {
 	return m_maxPt;
 }
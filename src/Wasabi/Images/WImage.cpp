@@ -184,6 +184,13 @@ WError WImage::CreateFromPixelsArray(
 	if (flags & W_IMAGE_CREATE_TEXTURE) usageFlags |= VK_IMAGE_USAGE_SAMPLED_BIT;
 	if (flags & W_IMAGE_CREATE_DYNAMIC) usageFlags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	if (flags & W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT) usageFlags |= (isDepth ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+	if (flags & W_IMAGE_CREATE_INPUT_ATTACHMENT) usageFlags |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+	if (flags & W_IMAGE_CREATE_STORAGE) usageFlags |= VK_IMAGE_USAGE_STORAGE_BIT;
+	if (flags & W_IMAGE_CREATE_TRANSIENT_ATTACHMENT) {
+		// transient attachments may only be used as attachments
+		usageFlags &= (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT);
+		usageFlags |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	}
 	W_MEMORY_STORAGE memory = flags & W_IMAGE_CREATE_DYNAMIC ? W_MEMORY_HOST_VISIBLE : W_MEMORY_DEVICE_LOCAL;
 	uint32_t numBuffers = (flags & (W_IMAGE_CREATE_DYNAMIC | W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT)) ? m_app->GetEngineParam<uint32_t>("bufferingCount") : 1;
 	VkResult result = m_bufferedImage.Create(m_app, numBuffers, width, height, depth, WBufferedImageProperties(format, memory, usageFlags, arraySize), pixels);
@@ -343,6 +350,16 @@ void WImage::TransitionLayoutTo(VkCommandBuffer cmdBuf, VkImageLayout newLayout)
 	return m_bufferedImage.TransitionLayoutTo(cmdBuf, newLayout, bufferIndex);
 }
 
+void WImage::SetViewLayout(VkImageLayout layout) {
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	m_bufferedImage.SetLayout(layout, bufferIndex);
+}
+
+VkImageMemoryBarrier WImage::GetLayoutTransitionBarrier(VkImageLayout newLayout, bool discardContents) {
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	return m_bufferedImage.GetLayoutTransitionBarrier(newLayout, bufferIndex, discardContents);
+}
+
 VkImageLayout WImage::GetViewLayout() const {
 	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
 	return m_bufferedImage.GetLayout(bufferIndex);
@@ -35,6 +35,11 @@ WRenderTarget::WRenderTarget(Wasabi* const app, uint32_t ID) : WBase(app, ID) {
 	m_depthFormat = VK_FORMAT_UNDEFINED;
 	m_renderPass = VK_NULL_HANDLE;
 	m_pipelineCache = VK_NULL_HANDLE;
+	m_preserveContents = false;
+	m_readOnlyDepth = false;
+	m_automaticLayoutTransitions = true;
+	m_currentSubpass = 0;
+	m_globalFrameSlot = 0;
 
 	m_app->RenderTargetManager->AddEntity(this);
 }
@@ -42,6 +47,9 @@ WRenderTarget::WRenderTarget(Wasabi* const app, uint32_t ID) : WBase(app, ID) {
 WRenderTarget::~WRenderTarget() {
 	_DestroyResources();
 
+	if (m_app->Renderer)
+		m_app->Renderer->_FreeGlobalFrameSlot(m_globalFrameSlot);
+
 	m_app->RenderTargetManager->RemoveEntity(this);
 }
 
@@ -82,6 +90,7 @@ void WRenderTarget::_DestroyResources() {
 	for (auto it = m_targets.begin(); it != m_targets.end(); it++)
 		W_SAFE_REMOVEREF((*it));
 	m_targets.clear();
+	m_subpassLayouts.clear();
 }
 
 WError WRenderTarget::_CreateCommandBuffers() {
@@ -149,17 +158,18 @@ WError WRenderTarget::Create(uint32_t width, uint32_t height, vector<class WImag
 	vector<VkAttachmentDescription> attachmentDescs;
 	VkAttachmentDescription attachment = {};
 	attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachment.loadOp = m_preserveContents ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
 	attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 	attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-	// Color attachments
+	// Color attachments (transient attachments are only used within the render pass and are never stored)
 	m_colorFormats.clear();
 	for (auto it = targets.begin(); it != targets.end(); it++) {
 		attachment.format = (*it)->GetFormat();
+		attachment.storeOp = ((*it)->m_bufferedImage.GetProperties().usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
 		attachmentDescs.push_back(attachment);
 		m_colorFormats.push_back(attachment.format);
 	}
@@ -167,47 +177,145 @@ WError WRenderTarget::Create(uint32_t width, uint32_t height, vector<class WImag
 	if (depth) {
 		// Depth attachment
 		attachment.format = depth->GetFormat();
-		attachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-		attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		attachment.storeOp = (depth->m_bufferedImage.GetProperties().usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+		attachment.initialLayout = _GetDepthLayout();
+		attachment.finalLayout = _GetDepthLayout();
+		if (m_readOnlyDepth)
+			attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD; // the depth is rendered by someone else
 		attachmentDescs.push_back(attachment);
 		m_depthFormat = attachment.format;
 	}
 
-	vector<VkAttachmentReference> colorReferences;
-	for (auto it = targets.begin(); it != targets.end(); it++) {
-		VkAttachmentReference attachmentRef = {};
-		attachmentRef.attachment = (uint32_t)colorReferences.size();
-		attachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-		colorReferences.push_back(attachmentRef);
+	// a single subpass renders to all the attachments unless subpasses were set
+	std::vector<W_RENDER_TARGET_SUBPASS> subpassDescs = m_subpasses;
+	if (subpassDescs.empty()) {
+		W_RENDER_TARGET_SUBPASS subpassDesc = {};
+		for (uint32_t i = 0; i < targets.size(); i++)
+			subpassDesc.colorOutputs.push_back(i);
+		subpassDesc.depthOutput = depth != nullptr;
+		subpassDescs.push_back(subpassDesc);
+	}
+	uint32_t numAttachments = (uint32_t)attachmentDescs.size();
+	uint32_t depthIndex = depth ? (uint32_t)targets.size() : UINT_MAX;
+	uint32_t numSubpasses = (uint32_t)subpassDescs.size();
+
+	vector<vector<VkAttachmentReference>> colorReferences(numSubpasses);
+	vector<vector<VkAttachmentReference>> inputReferences(numSubpasses);
+	vector<vector<uint32_t>> preserveReferences(numSubpasses);
+	vector<VkAttachmentReference> depthReferences(numSubpasses);
+	m_subpassLayouts.assign(numSubpasses, vector<VkImageLayout>(numAttachments, VK_IMAGE_LAYOUT_UNDEFINED));
+	for (uint32_t s = 0; s < numSubpasses; s++) {
+		vector<VkImageLayout>& layouts = m_subpassLayouts[s];
+		for (auto index : subpassDescs[s].colorOutputs) {
+			if (index >= targets.size()) {
+				_DestroyResources();
+				return WError(W_INVALIDPARAM);
+			}
+			colorReferences[s].push_back({ index, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+			layouts[index] = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		}
+		bool readsDepth = false;
+		for (auto index : subpassDescs[s].inputs) {
+			if (index >= numAttachments) {
+				_DestroyResources();
+				return WError(W_INVALIDPARAM);
+			}
+			VkImageLayout layout = index == depthIndex ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			inputReferences[s].push_back({ index, layout });
+			layouts[index] = layout;
+			readsDepth |= index == depthIndex;
+		}
+		if (depth && subpassDescs[s].depthOutput) {
+			depthReferences[s] = { depthIndex, (readsDepth || m_readOnlyDepth) ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+			layouts[depthIndex] = depthReferences[s].layout;
+		}
 	}
 
-	VkAttachmentReference depthReference = {};
-	if (depth) {
-		depthReference.attachment = (uint32_t)targets.size();
-		depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	// attachments that a subpass doesn't use but that are used before and after it must be preserved through it
+	for (uint32_t s = 1; s + 1 < numSubpasses; s++) {
+		for (uint32_t a = 0; a < numAttachments; a++) {
+			if (m_subpassLayouts[s][a] != VK_IMAGE_LAYOUT_UNDEFINED)
+				continue;
+			bool usedBefore = false, usedAfter = false;
+			for (uint32_t p = 0; p < s; p++)
+				usedBefore |= m_subpassLayouts[p][a] != VK_IMAGE_LAYOUT_UNDEFINED;
+			for (uint32_t p = s + 1; p < numSubpasses; p++)
+				usedAfter |= m_subpassLayouts[p][a] != VK_IMAGE_LAYOUT_UNDEFINED;
+			if (usedBefore && usedAfter)
+				preserveReferences[s].push_back(a);
+		}
 	}
 
-	VkSubpassDescription subpass = {};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.flags = 0;
-	subpass.inputAttachmentCount = 0;
-	subpass.pInputAttachments = NULL;
-	subpass.colorAttachmentCount = (uint32_t)colorReferences.size();
-	subpass.pColorAttachments = colorReferences.data();
-	subpass.pResolveAttachments = NULL;
-	subpass.pDepthStencilAttachment = depth ? &depthReference : NULL;
-	subpass.preserveAttachmentCount = 0;
-	subpass.pPreserveAttachments = NULL;
+	vector<VkSubpassDescription> subpasses(numSubpasses);
+	for (uint32_t s = 0; s < numSubpasses; s++) {
+		VkSubpassDescription& subpass = subpasses[s];
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.flags = 0;
+		subpass.inputAttachmentCount = (uint32_t)inputReferences[s].size();
+		subpass.pInputAttachments = inputReferences[s].data();
+		subpass.colorAttachmentCount = (uint32_t)colorReferences[s].size();
+		subpass.pColorAttachments = colorReferences[s].data();
+		subpass.pResolveAttachments = NULL;
+		subpass.pDepthStencilAttachment = (depth && subpassDescs[s].depthOutput) ? &depthReferences[s] : NULL;
+		subpass.preserveAttachmentCount = (uint32_t)preserveReferences[s].size();
+		subpass.pPreserveAttachments = preserveReferences[s].data();
+	}
+
+	// a subpass that uses an attachment waits for the earlier subpasses that rendered it (or that read it, if it
+	// renders to it), only at the same pixel so tiled GPUs can keep the attachment in tile memory
+	auto isWritten = [](VkImageLayout layout) {
+		return layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL || layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	};
+	vector<VkSubpassDependency> dependencies;
+	for (uint32_t dst = 1; dst < numSubpasses; dst++) {
+		for (uint32_t src = 0; src < dst; src++) {
+			VkSubpassDependency dependency = {};
+			for (uint32_t a = 0; a < numAttachments; a++) {
+				VkImageLayout srcLayout = m_subpassLayouts[src][a];
+				VkImageLayout dstLayout = m_subpassLayouts[dst][a];
+				if (srcLayout == VK_IMAGE_LAYOUT_UNDEFINED || dstLayout == VK_IMAGE_LAYOUT_UNDEFINED || (!isWritten(srcLayout) && !isWritten(dstLayout)))
+					continue;
+
+				if (srcLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) {
+					dependency.srcStageMask |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+					dependency.srcAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+				} else if (srcLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+					dependency.srcStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+					dependency.srcAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+				} else // read as an input attachment, only the execution needs to be ordered
+					dependency.srcStageMask |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+				if (std::find(subpassDescs[dst].inputs.begin(), subpassDescs[dst].inputs.end(), a) != subpassDescs[dst].inputs.end()) {
+					dependency.dstStageMask |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+					dependency.dstAccessMask |= VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+				}
+				if (dstLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) {
+					dependency.dstStageMask |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+					dependency.dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+				} else if (a == depthIndex && subpassDescs[dst].depthOutput) {
+					dependency.dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+					dependency.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+						(dstLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0);
+				}
+			}
+			if (dependency.srcStageMask == 0)
+				continue;
+			dependency.srcSubpass = src;
+			dependency.dstSubpass = dst;
+			dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+			dependencies.push_back(dependency);
+		}
+	}
 
 	VkRenderPassCreateInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 	renderPassInfo.pNext = NULL;
 	renderPassInfo.attachmentCount = (uint32_t)attachmentDescs.size();
 	renderPassInfo.pAttachments = attachmentDescs.data();
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 0;
-	renderPassInfo.pDependencies = NULL;
+	renderPassInfo.subpassCount = numSubpasses;
+	renderPassInfo.pSubpasses = subpasses.data();
+	renderPassInfo.dependencyCount = (uint32_t)dependencies.size();
+	renderPassInfo.pDependencies = dependencies.data();
 
 	err = vkCreateRenderPass(device, &renderPassInfo, nullptr, &m_renderPass);
 	if (err != VK_SUCCESS) {
@@ -356,6 +464,12 @@ WError WRenderTarget::Create(uint32_t width, uint32_t height, VkImageView* views
 WError WRenderTarget::Begin() {
 	VkDevice device = m_app->GetVulkanDevice();
 
+	// the effects rendered on this render target read the global per-frame data of its camera from this slot
+	if (m_globalFrameSlot == 0)
+		m_globalFrameSlot = m_app->Renderer->_AllocateGlobalFrameSlot();
+	if (m_globalFrameSlot == 0)
+		return WError(W_OUTOFMEMORY);
+
 	if (!m_renderCmdBuffers.empty()) {
 		uint32_t bufferingIndex = m_app->Renderer->GetCurrentBufferingIndex();
 		VkResult err = vkWaitForFences(device, 1, &m_renderCmdBufferFences[bufferingIndex], VK_TRUE, std::numeric_limits<uint64_t>::max());
@@ -378,8 +492,8 @@ WError WRenderTarget::Begin() {
 		if (imgTarget->GetViewLayout() != VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
 			imgTarget->TransitionLayoutTo(GetCommnadBuffer(), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 	}
-	if (m_depthTarget && m_depthTarget->GetViewLayout() != VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-		m_depthTarget->TransitionLayoutTo(GetCommnadBuffer(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	if (m_depthTarget && m_depthTarget->GetViewLayout() != _GetDepthLayout())
+		m_depthTarget->TransitionLayoutTo(GetCommnadBuffer(), _GetDepthLayout());
 
 	VkRenderPassBeginInfo renderPassBeginInfo = vkTools::initializers::renderPassBeginInfo();
 	renderPassBeginInfo.renderPass = m_renderPass;
@@ -395,6 +509,7 @@ WError WRenderTarget::Begin() {
 	renderPassBeginInfo.framebuffer = m_bufferedFrameBuffer.GetFrameBuffer(bufferIndex);
 
 	vkCmdBeginRenderPass(GetCommnadBuffer(), &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	m_currentSubpass = 0;
 
 	VkViewport viewport = vkTools::initializers::viewport(
 		(float)m_width,
@@ -411,6 +526,25 @@ WError WRenderTarget::Begin() {
 	vkCmdSetScissor(GetCommnadBuffer(), 0, 1, &scissor);
 
 	m_camera->Render(m_width, m_height);
+	m_app->Renderer->_WriteGlobalFrameSlot(m_globalFrameSlot, m_camera);
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WRenderTarget::NextSubpass() {
+	if (m_currentSubpass + 1 >= GetNumSubpasses())
+		return WError(W_INVALIDPARAM);
+
+	vkCmdNextSubpass(GetCommnadBuffer(), VK_SUBPASS_CONTENTS_INLINE);
+	m_currentSubpass++;
+
+	// the render pass transitions the attachments between subpasses, keep track of it so that the descriptors of
+	// the input attachments use the right layouts
+	const vector<VkImageLayout>& layouts = m_subpassLayouts[m_currentSubpass];
+	for (uint32_t i = 0; i < layouts.size(); i++) {
+		if (layouts[i] != VK_IMAGE_LAYOUT_UNDEFINED)
+			(i < m_targets.size() ? m_targets[i] : m_depthTarget)->SetViewLayout(layouts[i]);
+	}
 
 	return WError(W_SUCCEEDED);
 }
@@ -418,11 +552,21 @@ WError WRenderTarget::Begin() {
 WError WRenderTarget::End(bool bSubmit) {
 	vkCmdEndRenderPass(GetCommnadBuffer());
 
-	for (auto imgTarget : m_targets) {
-		imgTarget->TransitionLayoutTo(GetCommnadBuffer(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	if (m_subpassLayouts.size() > 1) {
+		// the render pass ends with the attachments in their final layouts
+		for (auto imgTarget : m_targets)
+			imgTarget->SetViewLayout(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		if (m_depthTarget)
+			m_depthTarget->SetViewLayout(_GetDepthLayout());
+	}
+
+	if (m_automaticLayoutTransitions) {
+		for (auto imgTarget : m_targets) {
+			imgTarget->TransitionLayoutTo(GetCommnadBuffer(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		}
+		if (m_depthTarget)
+			m_depthTarget->TransitionLayoutTo(GetCommnadBuffer(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 	}
-	if (m_depthTarget)
-		m_depthTarget->TransitionLayoutTo(GetCommnadBuffer(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 	if (!m_renderCmdBuffers.empty()) {
 		uint32_t bufferingIndex = m_app->Renderer->GetCurrentBufferingIndex();
@@ -477,6 +621,26 @@ WError WRenderTarget::Submit(VkSubmitInfo submitInfo) {
 	return WError(W_SUCCEEDED);
 }
 
+void WRenderTarget::SetPreserveContents(bool preserve) {
+	m_preserveContents = preserve;
+}
+
+void WRenderTarget::SetReadOnlyDepth(bool readOnly) {
+	m_readOnlyDepth = readOnly;
+}
+
+VkImageLayout WRenderTarget::_GetDepthLayout() const {
+	return m_readOnlyDepth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+}
+
+void WRenderTarget::SetSubpasses(const std::vector<W_RENDER_TARGET_SUBPASS>& subpasses) {
+	m_subpasses = subpasses;
+}
+
+void WRenderTarget::SetAutomaticLayoutTransitions(bool enable) {
+	m_automaticLayoutTransitions = enable;
+}
+
 void WRenderTarget::SetClearColor(WColor col, uint32_t index) {
 	if (index >= m_clearValues.size())
 		return;
@@ -515,6 +679,24 @@ uint32_t WRenderTarget::GetNumColorOutputs() const {
 	return !Valid() ? 0 : (m_targets.empty() ? 1 : (uint32_t)m_targets.size());
 }
 
+uint32_t WRenderTarget::GetNumSubpassColorOutputs(uint32_t subpass) const {
+	if (subpass >= m_subpassLayouts.size())
+		return GetNumColorOutputs();
+	uint32_t numOutputs = 0;
+	for (uint32_t i = 0; i < m_targets.size(); i++)
+		if (m_subpassLayouts[subpass][i] == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
+			numOutputs++;
+	return numOutputs;
+}
+
+uint32_t WRenderTarget::GetNumSubpasses() const {
+	return m_subpassLayouts.empty() ? 1 : (uint32_t)m_subpassLayouts.size();
+}
+
+uint32_t WRenderTarget::GetCurrentSubpass() const {
+	return m_currentSubpass;
+}
+
 bool WRenderTarget::HasDepthOutput() const {
 	return m_depthTarget != nullptr || (Valid() && m_targets.empty());
 }
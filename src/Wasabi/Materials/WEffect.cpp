@@ -4,7 +4,14 @@
 #include "Wasabi/Renderers/WRenderer.hpp"
 
 #include <iostream>
+#include <memory>
 #include <unordered_map>
+
+/** First word of a saved effect that has a format version, where older effects have their topology */
+#define W_EFFECT_FORMAT_MARKER 0xFFFFFFFF
+/** Version of the saved effect format, 1 added the supported features */
+#define W_EFFECT_FORMAT_VERSION 1
+
 using std::unordered_map;
 
 size_t W_SHADER_VARIABLE_TYPE_SIZES[] = { 4, 4, 4, 2, 0, 8, 12, 16, 64 };
@@ -145,7 +152,7 @@ W_BOUND_RESOURCE::W_BOUND_RESOURCE(
 	std::vector<W_SHADER_VARIABLE_INFO> v,
 	uint32_t textureArraySize
 ) : type(t), binding_index(index), binding_set(set), name(_name), variables(v) {
-	if (t == W_TYPE_UBO || t == W_TYPE_PUSH_CONSTANT) {
+	if (t == W_TYPE_UBO || t == W_TYPE_PUSH_CONSTANT || t == W_TYPE_STORAGE_BUFFER) {
 		size_t curOffset = 0;
 		_offsets.resize(variables.size());
 		for (uint32_t i = 0; i < variables.size(); i++) {
@@ -163,7 +170,7 @@ W_BOUND_RESOURCE::W_BOUND_RESOURCE(
 				_offsets[i] += binding_index;
 			binding_index = std::numeric_limits<uint32_t>::max();
 		}
-	} else if (t == W_TYPE_TEXTURE) {
+	} else if (t == W_TYPE_TEXTURE || t == W_TYPE_INPUT_ATTACHMENT || t == W_TYPE_STORAGE_IMAGE) {
 		_size = textureArraySize;
 	}
 }
@@ -202,6 +209,17 @@ std::string WShaderManager::GetTypeName(void) const {
 WShaderManager::WShaderManager(class Wasabi* const app) : WManager<WShader>(app) {
 }
 
+void WShaderManager::LoadShaders(const std::vector<WShader*>& shaders, bool bSaveData) {
+	// the old modules are released here, the memory manager is not thread-safe
+	for (auto shader : shaders)
+		m_app->MemoryManager->ReleaseShaderModule(shader->m_module, m_app->GetCurrentBufferingIndex());
+
+	m_app->ThreadPool.ParallelFor((uint32_t)shaders.size(), 1, [&shaders, bSaveData](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++)
+			shaders[i]->Load(bSaveData);
+	});
+}
+
 std::string WShader::_GetTypeName() {
 	return "Shader";
 }
@@ -474,6 +492,102 @@ std::string WEffectManager::GetTypeName(void) const {
 }
 
 WEffectManager::WEffectManager(class Wasabi* const app) : WManager<WEffect>(app) {
+	m_pipelineCache = VK_NULL_HANDLE;
+	m_numPendingJobs = 0;
+	m_cachesDirty = false;
+}
+
+WEffectManager::~WEffectManager() {
+	// the jobs still queued on the thread pool use the caches
+	WaitForPipelineBuilds();
+
+	uint32_t bufferingIndex = m_app->GetCurrentBufferingIndex();
+	for (auto& cache : m_buildThreadCaches)
+		m_app->MemoryManager->ReleasePipelineCache(cache, bufferingIndex);
+	m_buildThreadCaches.clear();
+	m_app->MemoryManager->ReleasePipelineCache(m_pipelineCache, bufferingIndex);
+}
+
+WError WEffectManager::_CreateBuildCaches() {
+	if (m_buildThreadCaches.size() > 0)
+		return WError(W_SUCCEEDED);
+
+	VkDevice device = m_app->GetVulkanDevice();
+	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+	pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	if (vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &m_pipelineCache) != VK_SUCCESS)
+		return WError(W_OUTOFMEMORY);
+
+	uint32_t numThreads = m_app->ThreadPool.GetNumThreads();
+	std::vector<VkPipelineCache> caches(numThreads, VK_NULL_HANDLE);
+	for (uint32_t i = 0; i < numThreads; i++) {
+		if (vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &caches[i]) != VK_SUCCESS) {
+			// no pipeline was built with the caches yet, so they can be destroyed right away
+			for (uint32_t j = 0; j < i; j++)
+				vkDestroyPipelineCache(device, caches[j], nullptr);
+			vkDestroyPipelineCache(device, m_pipelineCache, nullptr);
+			m_pipelineCache = VK_NULL_HANDLE;
+			return WError(W_OUTOFMEMORY);
+		}
+	}
+	m_buildThreadCaches = caches;
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WEffectManager::_SubmitBuildJob(std::function<void(VkPipelineCache)> job) {
+	{
+		std::lock_guard<std::mutex> lock(m_buildMutex);
+		WError err = _CreateBuildCaches();
+		if (!err)
+			return err;
+		m_numPendingJobs++;
+	}
+
+	m_app->ThreadPool.Submit([this, job](uint32_t threadIndex) {
+		// threads that are not pool workers (index 0) may share a cache, which
+		// is fine since pipeline caches are synchronized by the driver
+		job(m_buildThreadCaches[std::min(threadIndex, (uint32_t)m_buildThreadCaches.size() - 1)]);
+
+		{
+			std::lock_guard<std::mutex> lock(m_buildMutex);
+			m_numPendingJobs--;
+			m_cachesDirty = true;
+		}
+		m_jobDoneCV.notify_all();
+	});
+
+	return WError(W_SUCCEEDED);
+}
+
+void WEffectManager::_WaitForBuildJobs(std::function<bool()> condition) {
+	std::unique_lock<std::mutex> lock(m_buildMutex);
+	m_jobDoneCV.wait(lock, condition);
+}
+
+WError WEffectManager::WaitForPipelineBuilds() {
+	std::unique_lock<std::mutex> lock(m_buildMutex);
+	m_jobDoneCV.wait(lock, [this]() { return m_numPendingJobs == 0; });
+
+	// no job is pending and none can be submitted while we hold the lock, so
+	// the threads' caches are not in use
+	if (m_cachesDirty && m_buildThreadCaches.size() > 0) {
+		VkDevice device = m_app->GetVulkanDevice();
+		if (vkMergePipelineCaches(device, m_pipelineCache, (uint32_t)m_buildThreadCaches.size(), m_buildThreadCaches.data()) != VK_SUCCESS)
+			return WError(W_OUTOFMEMORY);
+		// share what every thread has built with every other thread
+		for (auto cache : m_buildThreadCaches) {
+			if (vkMergePipelineCaches(device, cache, 1, &m_pipelineCache) != VK_SUCCESS)
+				return WError(W_OUTOFMEMORY);
+		}
+		m_cachesDirty = false;
+	}
+
+	return WError(W_SUCCEEDED);
+}
+
+VkPipelineCache WEffectManager::GetPipelineCache() const {
+	return m_pipelineCache;
 }
 
 WEffect::WEffect(Wasabi* const app, uint32_t ID) : WFileAsset(app, ID), m_depthStencilState({}) {
@@ -482,8 +596,11 @@ WEffect::WEffect(Wasabi* const app, uint32_t ID) : WFileAsset(app, ID), m_depthS
 	m_topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	m_flags = EFFECT_RENDER_FLAG_RENDER_GBUFFER | EFFECT_RENDER_FLAG_RENDER_FORWARD | EFFECT_RENDER_FLAG_TRANSLUCENT;
 
-	m_pipeline = VK_NULL_HANDLE;
+	m_supportedFeatures = EFFECT_FEATURE_NONE;
+	m_subpass = 0;
+	m_pipelineStatus = W_PIPELINE_NOT_BUILT;
 	m_pipelineLayout = VK_NULL_HANDLE;
+	m_usesGlobalFrameSet = false;
 
 	VkPipelineColorBlendAttachmentState blendState = {};
 	blendState.colorWriteMask = 0xf;
@@ -550,6 +667,10 @@ void WEffect::SetName(std::string newName) {
 }
 
 bool WEffect::_ValidShaders() const {
+	// a compute shader can't be combined with other shaders
+	if (IsCompute())
+		return m_shaders.size() == 1 && m_shaders[0]->Valid();
+
 	// valid when at least one shader has input layout (vertex shader)
 	for (uint32_t i = 0; i < m_shaders.size(); i++)
 		if (m_shaders[i]->m_desc.type == W_VERTEX_SHADER &&
@@ -561,13 +682,16 @@ bool WEffect::_ValidShaders() const {
 }
 
 bool WEffect::Valid() const {
-	return _ValidShaders() && m_pipeline != VK_NULL_HANDLE;
+	return _ValidShaders() && IsPipelineReady();
 }
 
 WError WEffect::BindShader(WShader* shader) {
 	if (!shader)
 		return WError(W_INVALIDPARAM);
 
+	// a pending pipeline build may still be using the bound shaders' modules
+	WaitForPipeline();
+
 	for (uint32_t i = 0; i < m_shaders.size(); i++) {
 		if (m_shaders[i]->m_desc.type == shader->m_desc.type) {
 			m_shaders[i]->RemoveReference();
@@ -586,6 +710,8 @@ WError WEffect::BindShader(WShader* shader) {
 }
 
 WError WEffect::UnbindShader(W_SHADER_TYPE type) {
+	WaitForPipeline();
+
 	for (uint32_t i = 0; i < m_shaders.size(); i++) {
 		if (m_shaders[i]->m_desc.type == type) {
 			m_shaders[i]->RemoveReference();
@@ -607,12 +733,18 @@ void WEffect::SetPrimitiveTopology(VkPrimitiveTopology topology) {
 }
 
 void WEffect::_DestroyPipeline() {
+	WaitForPipeline();
+
 	uint32_t bufferingIndex = m_app->GetCurrentBufferingIndex();
 	m_app->MemoryManager->ReleasePipelineLayout(m_pipelineLayout, bufferingIndex);
 	for (auto it = m_descriptorSetLayouts.begin(); it != m_descriptorSetLayouts.end(); it++)
 		m_app->MemoryManager->ReleaseDescriptorSetLayout(it->second, bufferingIndex);
 	m_descriptorSetLayouts.clear();
-	m_app->MemoryManager->ReleasePipeline(m_pipeline, bufferingIndex);
+	for (auto it = m_pipelines.begin(); it != m_pipelines.end(); it++)
+		m_app->MemoryManager->ReleasePipeline(it->second, bufferingIndex);
+	m_pipelines.clear();
+	m_pipelineStatus = W_PIPELINE_NOT_BUILT;
+	m_usesGlobalFrameSet = false;
 }
 
 void WEffect::SetBlendingState(VkPipelineColorBlendAttachmentState state) {
@@ -631,14 +763,85 @@ void WEffect::SetRasterizationState(VkPipelineRasterizationStateCreateInfo state
 	m_rasterizationState = state;
 }
 
+void WEffect::SetSupportedFeatures(W_EFFECT_FEATURE_FLAGS features) {
+	m_supportedFeatures = features;
+}
+
+void WEffect::SetSubpass(uint32_t subpass) {
+	m_subpass = subpass;
+}
+
+W_EFFECT_FEATURE_FLAGS WEffect::GetSupportedFeatures() const {
+	return m_supportedFeatures;
+}
+
 WError WEffect::BuildPipeline(WRenderTarget* rt) {
-	VkDevice device = m_app->GetVulkanDevice();
+	if (!_ValidShaders())
+		return WError(W_NOTVALID);
+
+	_DestroyPipeline();
+
+	PIPELINE_CREATE_STATE state;
+	WError err = _CreatePipelineLayout(rt, &state);
+	if (err) {
+		// compute pipelines don't need a render target
+		VkPipelineCache cache = rt ? rt->GetPipelineCache() : m_app->EffectManager->GetPipelineCache();
+		err = _CreatePipelines(m_app->GetVulkanDevice(), cache, state, &m_pipelines);
+	}
+	m_pipelineBuildError = err;
+	m_pipelineStatus = err ? W_PIPELINE_READY : W_PIPELINE_FAILED;
+	return err;
+}
 
+WError WEffect::BuildPipelineAsync(WRenderTarget* rt) {
 	if (!_ValidShaders())
 		return WError(W_NOTVALID);
 
 	_DestroyPipeline();
 
+	// layouts are created here since materials need them right away
+	std::shared_ptr<PIPELINE_CREATE_STATE> state = std::make_shared<PIPELINE_CREATE_STATE>();
+	WError err = _CreatePipelineLayout(rt, state.get());
+	if (!err) {
+		m_pipelineBuildError = err;
+		m_pipelineStatus = W_PIPELINE_FAILED;
+		return err;
+	}
+
+	m_pipelineStatus = W_PIPELINE_BUILDING;
+	VkDevice device = m_app->GetVulkanDevice();
+	err = m_app->EffectManager->_SubmitBuildJob([this, device, state](VkPipelineCache cache) {
+		// the effect waits for this job before destroying or modifying anything it uses
+		m_pipelineBuildError = _CreatePipelines(device, cache, *state, &m_pipelines);
+		m_pipelineStatus = m_pipelineBuildError ? W_PIPELINE_READY : W_PIPELINE_FAILED;
+	});
+	if (!err) {
+		m_pipelineBuildError = err;
+		m_pipelineStatus = W_PIPELINE_FAILED;
+	}
+
+	return err;
+}
+
+W_PIPELINE_STATUS WEffect::GetPipelineStatus() const {
+	return (W_PIPELINE_STATUS)m_pipelineStatus.load();
+}
+
+bool WEffect::IsPipelineReady() const {
+	return m_pipelineStatus == W_PIPELINE_READY;
+}
+
+WError WEffect::WaitForPipeline() {
+	if (m_pipelineStatus == W_PIPELINE_BUILDING)
+		m_app->EffectManager->_WaitForBuildJobs([this]() { return m_pipelineStatus != W_PIPELINE_BUILDING; });
+	if (m_pipelineStatus == W_PIPELINE_NOT_BUILT)
+		return WError(W_NOTVALID);
+	return m_pipelineBuildError;
+}
+
+WError WEffect::_CreatePipelineLayout(WRenderTarget* rt, PIPELINE_CREATE_STATE* state) {
+	VkDevice device = m_app->GetVulkanDevice();
+
 	//
 	// Create descriptor set layout
 	//
@@ -648,7 +851,13 @@ WError WEffect::BuildPipeline(WRenderTarget* rt) {
 	for (uint32_t i = 0; i < m_shaders.size(); i++) {
 		for (uint32_t j = 0; j < m_shaders[i]->m_desc.bound_resources.size(); j++) {
 			W_BOUND_RESOURCE* boundResource = &m_shaders[i]->m_desc.bound_resources[j];
-			if (boundResource->type == W_TYPE_UBO || boundResource->type == W_TYPE_TEXTURE) {
+			if (boundResource->binding_set == W_GLOBAL_FRAME_SET_INDEX && boundResource->type != W_TYPE_PUSH_CONSTANT) {
+				// the global per-frame set is owned by the renderer, use its layout instead of making one
+				m_usesGlobalFrameSet = true;
+				continue;
+			}
+			if (boundResource->type == W_TYPE_UBO || boundResource->type == W_TYPE_TEXTURE || boundResource->type == W_TYPE_INPUT_ATTACHMENT ||
+				boundResource->type == W_TYPE_STORAGE_BUFFER || boundResource->type == W_TYPE_STORAGE_IMAGE) {
 				VkDescriptorSetLayoutBinding layoutBinding = {};
 				layoutBinding.stageFlags = (VkShaderStageFlagBits)m_shaders[i]->m_desc.type;
 				layoutBinding.pImmutableSamplers = NULL;
@@ -677,6 +886,18 @@ WError WEffect::BuildPipeline(WRenderTarget* rt) {
 					layoutBinding.binding = boundResource->binding_index;
 					layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 					layoutBinding.descriptorCount = (uint32_t)boundResource->GetSize();
+				} else if (boundResource->type == W_TYPE_INPUT_ATTACHMENT) {
+					layoutBinding.binding = boundResource->binding_index;
+					layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+					layoutBinding.descriptorCount = (uint32_t)boundResource->GetSize();
+				} else if (boundResource->type == W_TYPE_STORAGE_BUFFER) {
+					layoutBinding.binding = boundResource->binding_index;
+					layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+					layoutBinding.descriptorCount = 1;
+				} else if (boundResource->type == W_TYPE_STORAGE_IMAGE) {
+					layoutBinding.binding = boundResource->binding_index;
+					layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+					layoutBinding.descriptorCount = (uint32_t)boundResource->GetSize();
 				}
 				auto iter = layoutBindingsMap.find(boundResource->binding_set);
 				if (iter == layoutBindingsMap.end()) {
@@ -695,7 +916,13 @@ WError WEffect::BuildPipeline(WRenderTarget* rt) {
 
 	VkResult err;
 
-	vector<VkDescriptorSetLayout> descriptorSetLayoutVector(layoutBindingsMap.size());
+	// set indices must be contiguous in the pipeline layout, so unused sets get an empty layout
+	uint32_t numSets = m_usesGlobalFrameSet ? W_GLOBAL_FRAME_SET_INDEX + 1 : 0;
+	for (auto it = layoutBindingsMap.begin(); it != layoutBindingsMap.end(); it++)
+		numSets = std::max(numSets, it->first + 1);
+	vector<VkDescriptorSetLayout> descriptorSetLayoutVector(numSets, m_app->Renderer->GetEmptyDescriptorSetLayout());
+	if (m_usesGlobalFrameSet)
+		descriptorSetLayoutVector[W_GLOBAL_FRAME_SET_INDEX] = m_app->Renderer->GetGlobalFrameDescriptorSetLayout();
 	for (auto it = layoutBindingsMap.begin(); it != layoutBindingsMap.end(); it++) {
 		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo = {};
 		descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -725,19 +952,54 @@ WError WEffect::BuildPipeline(WRenderTarget* rt) {
 	if (err)
 		return WError(W_FAILEDTOCREATEPIPELINELAYOUT);
 
+	state->isCompute = IsCompute();
+	state->renderPass = rt && !state->isCompute ? rt->GetRenderPass() : VK_NULL_HANDLE;
+	state->subpass = m_subpass;
+	state->numColorOutputs = rt && !state->isCompute ? rt->GetNumSubpassColorOutputs(m_subpass) : 0;
+	state->layout = m_pipelineLayout;
+	state->topology = m_topology;
+	state->blendStates = m_blendStates;
+	state->depthStencilState = m_depthStencilState;
+	state->rasterizationState = m_rasterizationState;
+	state->supportedFeatures = m_supportedFeatures;
+
+	// Load shaders
+	// Shaders are loaded from the SPIR-V format, which can be generated from glsl
+	state->shaderStages.clear();
+	for (uint32_t i = 0; i < m_shaders.size(); i++) {
+		VkPipelineShaderStageCreateInfo stage = {};
+		stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stage.pName = "main";
+		stage.module = m_shaders[i]->m_module;
+		stage.stage = (VkShaderStageFlagBits)m_shaders[i]->m_desc.type;
+		state->shaderStages.push_back(stage);
+	}
+
+	state->inputLayouts.clear(); // all ILs for this effect
+	for (uint32_t i = 0; i < m_shaders.size(); i++) {
+		if (m_shaders[i]->m_desc.type == W_VERTEX_SHADER) {
+			for (uint32_t j = 0; j < m_shaders[i]->m_desc.input_layouts.size(); j++)
+				state->inputLayouts.push_back(m_shaders[i]->m_desc.input_layouts[j]);
+		}
+	}
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WEffect::_CreatePipelines(VkDevice device, VkPipelineCache cache, const PIPELINE_CREATE_STATE& state, std::unordered_map<uint32_t, VkPipeline>* pipelines) {
 	//IA state
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
 	inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssemblyState.topology = m_topology;
+	inputAssemblyState.topology = state.topology;
 
 	// Color blend state
 	VkPipelineColorBlendStateCreateInfo colorBlendState = {};
 	colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 	// One blend attachment state
 	vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates;
-	if (m_blendStates.size()) {
-		for (uint32_t i = 0; i < rt->GetNumColorOutputs(); i++)
-			blendAttachmentStates.push_back(i < m_blendStates.size() ? m_blendStates[i] : m_blendStates[0]);
+	if (state.blendStates.size()) {
+		for (uint32_t i = 0; i < state.numColorOutputs; i++)
+			blendAttachmentStates.push_back(i < state.blendStates.size() ? state.blendStates[i] : state.blendStates[0]);
 		colorBlendState.attachmentCount = (uint32_t)blendAttachmentStates.size();
 		colorBlendState.pAttachments = blendAttachmentStates.data();
 	}
@@ -752,6 +1014,8 @@ WError WEffect::BuildPipeline(WRenderTarget* rt) {
 	std::vector<VkDynamicState> dynamicStateEnables;
 	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT);
 	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR);
+	if (m_depthStencilState.depthBoundsTestEnable)
+		dynamicStateEnables.push_back(VK_DYNAMIC_STATE_DEPTH_BOUNDS);
 	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
 	dynamicState.pDynamicStates = dynamicStateEnables.data();
 	dynamicState.dynamicStateCount = (uint32_t)dynamicStateEnables.size();
@@ -775,42 +1039,24 @@ WError WEffect::BuildPipeline(WRenderTarget* rt) {
 	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
 	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 
-	// Load shaders
-	// Shaders are loaded from the SPIR-V format, which can be generated from glsl
-	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
-	for (uint32_t i = 0; i < m_shaders.size(); i++) {
-		VkPipelineShaderStageCreateInfo stage = {};
-		stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		stage.pName = "main";
-		stage.module = m_shaders[i]->m_module;
-		stage.stage = (VkShaderStageFlagBits)m_shaders[i]->m_desc.type;
-		shaderStages.push_back(stage);
-	}
-
-	pipelineCreateInfo.layout = m_pipelineLayout;
+	pipelineCreateInfo.layout = state.layout;
 	pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
-	pipelineCreateInfo.stageCount = (uint32_t)shaderStages.size();
-	pipelineCreateInfo.pStages = shaderStages.data();
-	pipelineCreateInfo.pRasterizationState = &m_rasterizationState;
+	pipelineCreateInfo.stageCount = (uint32_t)state.shaderStages.size();
+	pipelineCreateInfo.pStages = state.shaderStages.data();
+	pipelineCreateInfo.pRasterizationState = &state.rasterizationState;
 	pipelineCreateInfo.pColorBlendState = &colorBlendState;
 	pipelineCreateInfo.pMultisampleState = &multisampleState;
 	pipelineCreateInfo.pViewportState = &viewportState;
-	pipelineCreateInfo.pDepthStencilState = &m_depthStencilState;
-	pipelineCreateInfo.renderPass = rt->GetRenderPass();
+	pipelineCreateInfo.pDepthStencilState = &state.depthStencilState;
+	pipelineCreateInfo.renderPass = state.renderPass;
+	pipelineCreateInfo.subpass = state.subpass;
 	pipelineCreateInfo.pDynamicState = &dynamicState;
 
-	// Create rendering pipelines, one for each VB count (starting from 0)
-	std::vector<VkGraphicsPipelineCreateInfo> pipelineCreateInfos;
-
-	vector<W_INPUT_LAYOUT*> ILs; // all ILs for this effect
+	vector<const W_INPUT_LAYOUT*> ILs; // all ILs for this effect
 	uint32_t num_attributes = 0;
-	for (uint32_t i = 0; i < m_shaders.size(); i++) {
-		if (m_shaders[i]->m_desc.type == W_VERTEX_SHADER) {
-			for (uint32_t j = 0; j < m_shaders[i]->m_desc.input_layouts.size(); j++) {
-				ILs.push_back(&m_shaders[i]->m_desc.input_layouts[j]);
-				num_attributes += (uint32_t)m_shaders[i]->m_desc.input_layouts[j].attributes.size();
-			}
-		}
+	for (uint32_t i = 0; i < state.inputLayouts.size(); i++) {
+		ILs.push_back(&state.inputLayouts[i]);
+		num_attributes += (uint32_t)state.inputLayouts[i].attributes.size();
 	}
 
 	std::vector<VkVertexInputBindingDescription> bindingDesc(ILs.size());
@@ -853,22 +1099,88 @@ WError WEffect::BuildPipeline(WRenderTarget* rt) {
 
 	pipelineCreateInfo.pVertexInputState = &inputState;
 
-	err = vkCreateGraphicsPipelines(device, rt->GetPipelineCache(), 1, &pipelineCreateInfo, nullptr, &m_pipeline);
+	// Specialization constant N of every stage is set from bit N of the variant's feature flags,
+	// constants of unsupported features are not specialized and keep their default in the shader
+	vector<VkSpecializationMapEntry> specializationEntries;
+	for (uint32_t i = 0; i < W_NUM_EFFECT_FEATURES; i++) {
+		if (state.supportedFeatures & (1 << i)) {
+			VkSpecializationMapEntry entry = {};
+			entry.constantID = i;
+			entry.offset = i * sizeof(VkBool32);
+			entry.size = sizeof(VkBool32);
+			specializationEntries.push_back(entry);
+		}
+	}
+
+	// One variant for every subset of the supported features
+	vector<uint32_t> variants;
+	for (uint32_t variant = state.supportedFeatures; ; variant = (variant - 1) & state.supportedFeatures) {
+		variants.push_back(variant);
+		if (variant == 0)
+			break;
+	}
+
+	vector<vector<VkBool32>> specializationData(variants.size(), vector<VkBool32>(W_NUM_EFFECT_FEATURES));
+	vector<VkSpecializationInfo> specializationInfos(variants.size());
+	vector<vector<VkPipelineShaderStageCreateInfo>> variantStages(variants.size(), state.shaderStages);
+	vector<VkGraphicsPipelineCreateInfo> pipelineCreateInfos(variants.size(), pipelineCreateInfo);
+	for (uint32_t v = 0; v < variants.size(); v++) {
+		for (uint32_t i = 0; i < W_NUM_EFFECT_FEATURES; i++)
+			specializationData[v][i] = (variants[v] & (1 << i)) ? VK_TRUE : VK_FALSE;
+		specializationInfos[v].mapEntryCount = (uint32_t)specializationEntries.size();
+		specializationInfos[v].pMapEntries = specializationEntries.data();
+		specializationInfos[v].dataSize = specializationData[v].size() * sizeof(VkBool32);
+		specializationInfos[v].pData = specializationData[v].data();
+		for (auto& stage : variantStages[v])
+			stage.pSpecializationInfo = &specializationInfos[v];
+		pipelineCreateInfos[v].pStages = variantStages[v].data();
+	}
+
+	vector<VkPipeline> createdPipelines(variants.size(), VK_NULL_HANDLE);
+	VkResult err;
+	if (state.isCompute) {
+		// compute pipelines only have the (specialized) compute stage
+		vector<VkComputePipelineCreateInfo> computeCreateInfos(variants.size());
+		for (uint32_t v = 0; v < variants.size(); v++) {
+			computeCreateInfos[v] = {};
+			computeCreateInfos[v].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+			computeCreateInfos[v].stage = variantStages[v][0];
+			computeCreateInfos[v].layout = state.layout;
+		}
+		err = vkCreateComputePipelines(device, cache, (uint32_t)computeCreateInfos.size(), computeCreateInfos.data(), nullptr, createdPipelines.data());
+	} else
+		err = vkCreateGraphicsPipelines(device, cache, (uint32_t)pipelineCreateInfos.size(), pipelineCreateInfos.data(), nullptr, createdPipelines.data());
+	for (uint32_t v = 0; v < variants.size(); v++) {
+		if (createdPipelines[v] != VK_NULL_HANDLE)
+			(*pipelines)[variants[v]] = createdPipelines[v];
+	}
 	if (err)
 		return WError(W_FAILEDTOCREATEPIPELINE);
 
 	return WError(W_SUCCEEDED);
 }
 
-WError WEffect::Bind(WRenderTarget* rt) {
-	if (!Valid())
+WError WEffect::Bind(WRenderTarget* rt, W_EFFECT_FEATURE_FLAGS features) {
+	WaitForPipeline();
+	if (!Valid() || IsCompute())
+		return WError(W_NOTVALID);
+
+	auto pipelineIt = m_pipelines.find(features & m_supportedFeatures);
+	if (pipelineIt == m_pipelines.end())
 		return WError(W_NOTVALID);
 
 	VkCommandBuffer renderCmdBuffer = rt->GetCommnadBuffer();
 	if (!renderCmdBuffer)
 		return WError(W_NORENDERTARGET);
 
-	vkCmdBindPipeline(renderCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+	vkCmdBindPipeline(renderCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineIt->second);
+
+	if (m_usesGlobalFrameSet) {
+		// the global per-frame data of the render target's camera
+		VkDescriptorSet globalFrameSet = m_app->Renderer->GetGlobalFrameDescriptorSet();
+		uint32_t globalFrameOffset = m_app->Renderer->GetGlobalFrameOffset(rt);
+		vkCmdBindDescriptorSets(renderCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, W_GLOBAL_FRAME_SET_INDEX, 1, &globalFrameSet, 1, &globalFrameOffset);
+	}
 
 	for (auto material : m_perFrameMaterials) {
 		WError err = material->Bind(rt);
@@ -879,6 +1191,61 @@ WError WEffect::Bind(WRenderTarget* rt) {
 	return WError(W_SUCCEEDED);
 }
 
+WError WEffect::BindCompute(VkCommandBuffer cmdBuf, W_EFFECT_FEATURE_FLAGS features) {
+	WaitForPipeline();
+	if (!Valid() || !IsCompute())
+		return WError(W_NOTVALID);
+
+	auto pipelineIt = m_pipelines.find(features & m_supportedFeatures);
+	if (pipelineIt == m_pipelines.end())
+		return WError(W_NOTVALID);
+
+	if (!cmdBuf)
+		return WError(W_INVALIDPARAM);
+
+	vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineIt->second);
+
+	if (m_usesGlobalFrameSet) {
+		// compute work is not tied to a render target, it reads the data of the main camera
+		VkDescriptorSet globalFrameSet = m_app->Renderer->GetGlobalFrameDescriptorSet();
+		uint32_t globalFrameOffset = m_app->Renderer->GetGlobalFrameOffset();
+		vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, W_GLOBAL_FRAME_SET_INDEX, 1, &globalFrameSet, 1, &globalFrameOffset);
+	}
+
+	for (auto material : m_perFrameMaterials) {
+		WError err = material->BindCompute(cmdBuf);
+		if (!err)
+			return err;
+	}
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WEffect::Dispatch(VkCommandBuffer cmdBuf, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ) {
+	if (!IsCompute() || !cmdBuf)
+		return WError(W_NOTVALID);
+
+	vkCmdDispatch(cmdBuf, groupCountX, groupCountY, groupCountZ);
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WEffect::DispatchIndirect(VkCommandBuffer cmdBuf, VkBuffer buffer, VkDeviceSize offset) {
+	if (!IsCompute() || !cmdBuf || buffer == VK_NULL_HANDLE)
+		return WError(W_NOTVALID);
+
+	vkCmdDispatchIndirect(cmdBuf, buffer, offset);
+
+	return WError(W_SUCCEEDED);
+}
+
+bool WEffect::IsCompute() const {
+	for (uint32_t i = 0; i < m_shaders.size(); i++)
+		if (m_shaders[i]->m_desc.type == W_COMPUTE_SHADER)
+			return true;
+	return false;
+}
+
 void WEffect::SetRenderFlags(W_EFFECT_RENDER_FLAGS flags) {
 	m_flags = flags;
 }
@@ -925,14 +1292,17 @@ WError WEffect::SaveToStream(WFile* file, std::ostream& outputStream) {
 	if (!Valid())
 		return WError(W_NOTVALID);
 
-	uint32_t tmp;
+	uint32_t header[2] = { W_EFFECT_FORMAT_MARKER, W_EFFECT_FORMAT_VERSION };
+	outputStream.write((char*)header, sizeof(header));
 
+	uint32_t tmp;
 	outputStream.write((char*)&m_topology, sizeof(m_topology));
 	outputStream.write((char*)&m_depthStencilState, sizeof(m_depthStencilState));
 	outputStream.write((char*)&m_rasterizationState, sizeof(m_rasterizationState));
 	tmp = (uint32_t)m_blendStates.size();
 	outputStream.write((char*)&tmp, sizeof(tmp));
 	outputStream.write((char*)m_blendStates.data(), m_blendStates.size() * sizeof(VkPipelineColorBlendAttachmentState));
+	outputStream.write((char*)&m_supportedFeatures, sizeof(m_supportedFeatures));
 
 	tmp = (uint32_t)m_shaders.size();
 	outputStream.write((char*)&tmp, sizeof(tmp));
@@ -966,13 +1336,24 @@ WError WEffect::LoadFromStream(WFile* file, std::istream& inputStream, std::vect
 
 	_DestroyPipeline();
 
-	uint32_t tmp;
-	inputStream.read((char*)&m_topology, sizeof(m_topology));
+	// effects saved before the format had a version start with the topology and have no supported features
+	uint32_t tmp, version = 0;
+	inputStream.read((char*)&tmp, sizeof(tmp));
+	if (tmp == W_EFFECT_FORMAT_MARKER) {
+		inputStream.read((char*)&version, sizeof(version));
+		if (version == 0 || version > W_EFFECT_FORMAT_VERSION)
+			return WError(W_INVALIDFILEFORMAT);
+		inputStream.read((char*)&tmp, sizeof(tmp));
+	}
+	m_topology = (VkPrimitiveTopology)tmp;
 	inputStream.read((char*)&m_depthStencilState, sizeof(m_depthStencilState));
 	inputStream.read((char*)&m_rasterizationState, sizeof(m_rasterizationState));
 	inputStream.read((char*)&tmp, sizeof(tmp));
 	m_blendStates.resize(tmp);
 	inputStream.read((char*)m_blendStates.data(), m_blendStates.size() * sizeof(VkPipelineColorBlendAttachmentState));
+	m_supportedFeatures = EFFECT_FEATURE_NONE;
+	if (version >= 1)
+		inputStream.read((char*)&m_supportedFeatures, sizeof(m_supportedFeatures));
 
 	inputStream.read((char*)&tmp, sizeof(tmp));
 
@@ -4,6 +4,11 @@
 #include "Wasabi/Images/WRenderTarget.hpp"
 #include "Wasabi/Renderers/WRenderer.hpp"
 
+/** First word of a saved material that has a format version, where older materials have their number of UBOs */
+#define W_MATERIAL_FORMAT_MARKER 0xFFFFFFFF
+/** Version of the saved material format, 1 added the effect features */
+#define W_MATERIAL_FORMAT_VERSION 1
+
 std::string WMaterialManager::GetTypeName() const {
 	return "Material";
 }
@@ -14,6 +19,7 @@ WMaterialManager::WMaterialManager(class Wasabi* const app) : WManager<WMaterial
 WMaterial::WMaterial(Wasabi* const app, uint32_t ID) : WFileAsset(app, ID) {
 	m_descriptorPool = VK_NULL_HANDLE;
 	m_effect = nullptr;
+	m_features = EFFECT_FEATURE_NONE;
 
 	app->MaterialManager->AddEntity(this);
 }
@@ -43,6 +49,14 @@ void WMaterial::SetName(std::string newName) {
 	m_app->MaterialManager->OnEntityNameChanged(this, newName);
 }
 
+void WMaterial::SetFeatures(W_EFFECT_FEATURE_FLAGS features) {
+	m_features = features;
+}
+
+W_EFFECT_FEATURE_FLAGS WMaterial::GetFeatures() const {
+	return m_features;
+}
+
 bool WMaterial::Valid() const {
 	return m_descriptorSets.size() > 0;
 }
@@ -62,6 +76,8 @@ void WMaterial::_DestroyResources() {
 	}
 	m_samplers.clear();
 
+	m_storageBuffers.clear();
+
 	for (uint32_t i = 0; i < m_pushConstants.size(); i++)
 		W_SAFE_FREE(m_pushConstants[i].data);
 	m_pushConstants.clear();
@@ -86,7 +102,15 @@ void WMaterial::_DestroyResources() {
 WError WMaterial::CreateForEffect(WEffect* const effect, uint32_t bindingSet) {
 	VkDevice device = m_app->GetVulkanDevice();
 
-	if (effect && !effect->Valid())
+	// only the effect's layouts are needed, its pipeline may still be building
+	if (effect) {
+		W_PIPELINE_STATUS status = effect->GetPipelineStatus();
+		if (!effect->_ValidShaders() || (status != W_PIPELINE_READY && status != W_PIPELINE_BUILDING))
+			return WError(W_INVALIDPARAM);
+	}
+
+	// the global per-frame set is owned by the renderer
+	if (bindingSet == W_GLOBAL_FRAME_SET_INDEX)
 		return WError(W_INVALIDPARAM);
 
 	_DestroyResources();
@@ -136,7 +160,8 @@ WError WMaterial::CreateForEffect(WEffect* const effect, uint32_t bindingSet) {
 
 				m_uniformBuffers.push_back(ubo);
 				writeDescriptorsSize += ubo.descriptorBufferInfos.size();
-			} else if (shader->m_desc.bound_resources[j].type == W_TYPE_TEXTURE) {
+			} else if (shader->m_desc.bound_resources[j].type == W_TYPE_TEXTURE || shader->m_desc.bound_resources[j].type == W_TYPE_INPUT_ATTACHMENT ||
+					   shader->m_desc.bound_resources[j].type == W_TYPE_STORAGE_IMAGE) {
 				bool already_added = false;
 				for (uint32_t k = 0; k < m_samplers.size(); k++) {
 					if (m_samplers[k].sampler_info->binding_index == shader->m_desc.bound_resources[j].binding_index) {
@@ -160,7 +185,9 @@ WError WMaterial::CreateForEffect(WEffect* const effect, uint32_t bindingSet) {
 				for (auto descriptors = sampler.descriptors.begin(); descriptors != sampler.descriptors.end(); descriptors++) {
 					descriptors->resize(textureArraySize);
 					for (auto descriptor = descriptors->begin(); descriptor != descriptors->end(); descriptor++) {
-						descriptor->sampler = m_app->Renderer->GetTextureSampler();
+						// input attachments are read at the current pixel and storage images are loaded/stored, without a sampler
+						bool isSampled = shader->m_desc.bound_resources[j].type == W_TYPE_TEXTURE;
+						descriptor->sampler = isSampled ? m_app->Renderer->GetTextureSampler() : VK_NULL_HANDLE;
 						descriptor->imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 						descriptor->imageView = VK_NULL_HANDLE; // // will be assigned in the Bind() function
 					}
@@ -168,6 +195,22 @@ WError WMaterial::CreateForEffect(WEffect* const effect, uint32_t bindingSet) {
 				sampler.sampler_info = &shader->m_desc.bound_resources[j];
 				m_samplers.push_back(sampler);
 				writeDescriptorsSize += sampler.descriptors.size() * sampler.descriptors[0].size();
+			} else if (shader->m_desc.bound_resources[j].type == W_TYPE_STORAGE_BUFFER) {
+				bool already_added = false;
+				for (uint32_t k = 0; k < m_storageBuffers.size(); k++) {
+					if (m_storageBuffers[k].buffer_info->binding_index == shader->m_desc.bound_resources[j].binding_index)
+						already_added = true;
+				}
+				if (already_added)
+					continue;
+
+				// the buffers are owned by the user, their descriptors are written once they are set
+				STORAGE_BUFFER_INFO storageBuffer = {};
+				storageBuffer.buffer_info = &shader->m_desc.bound_resources[j];
+				storageBuffer.descriptors.resize(numBuffers, { VK_NULL_HANDLE, 0, VK_WHOLE_SIZE });
+				storageBuffer.dirty.resize(numBuffers, false);
+				m_storageBuffers.push_back(storageBuffer);
+				writeDescriptorsSize += numBuffers;
 			} else if (shader->m_desc.bound_resources[j].type == W_TYPE_PUSH_CONSTANT) {
 				bool already_added = false;
 				for (uint32_t k = 0; k < m_pushConstants.size(); k++) {
@@ -206,8 +249,31 @@ WError WMaterial::CreateForEffect(WEffect* const effect, uint32_t bindingSet) {
 		VkDescriptorPoolSize s;
 		s.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		s.descriptorCount = 0;
-		for (uint32_t i = 0; i < m_samplers.size(); i++)
-			s.descriptorCount += (uint32_t)m_samplers[i].images.size() * numBuffers;
+		VkDescriptorPoolSize inputs;
+		inputs.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		inputs.descriptorCount = 0;
+		VkDescriptorPoolSize storageImages;
+		storageImages.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		storageImages.descriptorCount = 0;
+		for (uint32_t i = 0; i < m_samplers.size(); i++) {
+			if (m_samplers[i].sampler_info->type == W_TYPE_INPUT_ATTACHMENT)
+				inputs.descriptorCount += (uint32_t)m_samplers[i].images.size() * numBuffers;
+			else if (m_samplers[i].sampler_info->type == W_TYPE_STORAGE_IMAGE)
+				storageImages.descriptorCount += (uint32_t)m_samplers[i].images.size() * numBuffers;
+			else
+				s.descriptorCount += (uint32_t)m_samplers[i].images.size() * numBuffers;
+		}
+		if (s.descriptorCount > 0)
+			typeCounts.push_back(s);
+		if (inputs.descriptorCount > 0)
+			typeCounts.push_back(inputs);
+		if (storageImages.descriptorCount > 0)
+			typeCounts.push_back(storageImages);
+	}
+	if (m_storageBuffers.size() > 0) {
+		VkDescriptorPoolSize s;
+		s.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		s.descriptorCount = (uint32_t)m_storageBuffers.size() * numBuffers;
 		typeCounts.push_back(s);
 	}
 
@@ -249,6 +315,23 @@ WError WMaterial::CreateForEffect(WEffect* const effect, uint32_t bindingSet) {
 			_DestroyResources();
 			return WError(W_OUTOFMEMORY);
 		}
+
+		// the UBO buffers never change, so their descriptors are written only once
+		uint32_t numUBODescriptors = 0;
+		for (auto ubo = m_uniformBuffers.begin(); ubo != m_uniformBuffers.end(); ubo++) {
+			for (uint32_t b = 0; b < numBuffers; b++) {
+				VkWriteDescriptorSet writeDescriptorSet = {};
+				writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writeDescriptorSet.dstSet = m_descriptorSets[b];
+				writeDescriptorSet.descriptorCount = 1;
+				writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				writeDescriptorSet.pBufferInfo = &ubo->descriptorBufferInfos[b];
+				writeDescriptorSet.dstBinding = ubo->ubo_info->binding_index;
+				m_writeDescriptorSets[numUBODescriptors++] = writeDescriptorSet;
+			}
+		}
+		if (numUBODescriptors > 0)
+			vkUpdateDescriptorSets(device, numUBODescriptors, m_writeDescriptorSets.data(), 0, nullptr);
 	}
 
 	m_effect = effect;
@@ -262,17 +345,31 @@ WError WMaterial::Bind(WRenderTarget* rt, bool bindDescSet, bool bindPushConsts)
 	if (!Valid())
 		return WError(W_NOTVALID);
 
-	VkDevice device = m_app->GetVulkanDevice();
-
 	VkCommandBuffer renderCmdBuffer = rt->GetCommnadBuffer();
 	if (!renderCmdBuffer)
 		return WError(W_NORENDERTARGET);
 
+	return _Bind(renderCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bindDescSet, bindPushConsts);
+}
+
+WError WMaterial::BindCompute(VkCommandBuffer cmdBuf, bool bindDescSet, bool bindPushConsts) {
+	if (!Valid() || !m_effect->IsCompute())
+		return WError(W_NOTVALID);
+
+	if (!cmdBuf)
+		return WError(W_INVALIDPARAM);
+
+	return _Bind(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, bindDescSet, bindPushConsts);
+}
+
+WError WMaterial::_Bind(VkCommandBuffer renderCmdBuffer, VkPipelineBindPoint bindPoint, bool bindDescSet, bool bindPushConsts) {
+	VkDevice device = m_app->GetVulkanDevice();
+
 	if (bindDescSet) {
 		int numUpdateDescriptors = 0;
 		uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
 
-		// update UBOs that changed
+		// update UBOs that changed (their descriptors are written once in CreateForEffect)
 		for (auto ubo = m_uniformBuffers.begin(); ubo != m_uniformBuffers.end(); ubo++) {
 			if (ubo->dirty[bufferIndex]) {
 				void* pBufferData;
@@ -281,16 +378,6 @@ WError WMaterial::Bind(WRenderTarget* rt, bool bindDescSet, bool bindPushConsts)
 				ubo->buffer.Unmap(m_app, bufferIndex);
 				ubo->dirty[bufferIndex] = false;
 			}
-
-			VkWriteDescriptorSet writeDescriptorSet = {};
-			writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			writeDescriptorSet.dstSet = m_descriptorSets[bufferIndex];
-			writeDescriptorSet.descriptorCount = 1;
-			writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			writeDescriptorSet.pBufferInfo = &ubo->descriptorBufferInfos[bufferIndex];
-			writeDescriptorSet.dstBinding = ubo->ubo_info->binding_index;
-
-			m_writeDescriptorSets[numUpdateDescriptors++] = writeDescriptorSet;
 		}
 
 		// update textures that changed
@@ -299,9 +386,13 @@ WError WMaterial::Bind(WRenderTarget* rt, bool bindDescSet, bool bindPushConsts)
 			bool bChanged = false;
 			for (uint32_t textureArrayIndex = 0; textureArrayIndex < (uint32_t)sampler->images.size(); textureArrayIndex++) {
 				if (sampler->images[textureArrayIndex] && sampler->images[textureArrayIndex]->Valid()) {
-					if (sampler->descriptors[bufferIndex][textureArrayIndex].imageView != sampler->images[textureArrayIndex]->GetView()) {
+					// the layout changes too when the same image is read in different subpasses of a render pass,
+					// storage images are always accessed in the general layout
+					VkImageLayout layout = info->type == W_TYPE_STORAGE_IMAGE ? VK_IMAGE_LAYOUT_GENERAL : sampler->images[textureArrayIndex]->GetViewLayout();
+					if (sampler->descriptors[bufferIndex][textureArrayIndex].imageView != sampler->images[textureArrayIndex]->GetView() ||
+						sampler->descriptors[bufferIndex][textureArrayIndex].imageLayout != layout) {
 						sampler->descriptors[bufferIndex][textureArrayIndex].imageView = sampler->images[textureArrayIndex]->GetView();
-						sampler->descriptors[bufferIndex][textureArrayIndex].imageLayout = sampler->images[textureArrayIndex]->GetViewLayout();
+						sampler->descriptors[bufferIndex][textureArrayIndex].imageLayout = layout;
 						bChanged = true;
 					}
 				}
@@ -310,7 +401,12 @@ WError WMaterial::Bind(WRenderTarget* rt, bool bindDescSet, bool bindPushConsts)
 				VkWriteDescriptorSet writeDescriptorSet = {};
 				writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 				writeDescriptorSet.dstSet = m_descriptorSets[bufferIndex];
-				writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				if (info->type == W_TYPE_INPUT_ATTACHMENT)
+					writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+				else if (info->type == W_TYPE_STORAGE_IMAGE)
+					writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+				else
+					writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 				writeDescriptorSet.descriptorCount = (uint32_t)sampler->descriptors[bufferIndex].size();
 				writeDescriptorSet.pImageInfo = sampler->descriptors[bufferIndex].data();
 				writeDescriptorSet.dstBinding = info->binding_index;
@@ -318,10 +414,27 @@ WError WMaterial::Bind(WRenderTarget* rt, bool bindDescSet, bool bindPushConsts)
 				m_writeDescriptorSets[numUpdateDescriptors++] = writeDescriptorSet;
 			}
 		}
+
+		// update storage buffers that were set since this buffer's descriptor set was last bound
+		for (auto storageBuffer = m_storageBuffers.begin(); storageBuffer != m_storageBuffers.end(); storageBuffer++) {
+			if (storageBuffer->dirty[bufferIndex]) {
+				VkWriteDescriptorSet writeDescriptorSet = {};
+				writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writeDescriptorSet.dstSet = m_descriptorSets[bufferIndex];
+				writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writeDescriptorSet.descriptorCount = 1;
+				writeDescriptorSet.pBufferInfo = &storageBuffer->descriptors[bufferIndex];
+				writeDescriptorSet.dstBinding = storageBuffer->buffer_info->binding_index;
+
+				m_writeDescriptorSets[numUpdateDescriptors++] = writeDescriptorSet;
+				storageBuffer->dirty[bufferIndex] = false;
+			}
+		}
+
 		if (numUpdateDescriptors > 0)
 			vkUpdateDescriptorSets(device, numUpdateDescriptors, m_writeDescriptorSets.data(), 0, NULL);
 
-		vkCmdBindDescriptorSets(renderCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_effect->GetPipelineLayout(), m_setIndex, 1, &m_descriptorSets[bufferIndex], 0, nullptr);
+		vkCmdBindDescriptorSets(renderCmdBuffer, bindPoint, m_effect->GetPipelineLayout(), m_setIndex, 1, &m_descriptorSets[bufferIndex], 0, nullptr);
 	}
 
 	if (bindPushConsts) {
@@ -370,6 +483,7 @@ WError WMaterial::SetVariableData(const char* varName, void* data, size_t len) {
 				if (varsize < len || offset + len > pc->pc_info->GetSize())
 					return WError(W_INVALIDPARAM);
 				memcpy((char*)pc->data + offset, data, len);
+				isFound = true;
 			}
 		}
 	}
@@ -426,10 +540,55 @@ WError WMaterial::SetTexture(std::string name, WImage* img, uint32_t arrayIndex)
 	return WError(isFound ? W_SUCCEEDED : W_INVALIDPARAM);
 }
 
+WError WMaterial::SetStorageBuffer(std::string name, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+	bool isFound = false;
+	for (auto storageBuffer = m_storageBuffers.begin(); storageBuffer != m_storageBuffers.end(); storageBuffer++) {
+		if (storageBuffer->buffer_info->name == name) {
+			for (uint32_t b = 0; b < storageBuffer->descriptors.size(); b++) {
+				VkDescriptorBufferInfo& descriptor = storageBuffer->descriptors[b];
+				if (descriptor.buffer != buffer || descriptor.offset != offset || descriptor.range != range) {
+					descriptor.buffer = buffer;
+					descriptor.offset = offset;
+					descriptor.range = range;
+					storageBuffer->dirty[b] = true;
+				}
+			}
+			isFound = true;
+		}
+	}
+	return WError(isFound ? W_SUCCEEDED : W_INVALIDPARAM);
+}
+
+WError WMaterial::SetStorageBuffer(std::string name, WBufferedBuffer* buffer) {
+	if (!buffer || !buffer->Valid())
+		return WError(W_INVALIDPARAM);
+
+	bool isFound = false;
+	for (auto storageBuffer = m_storageBuffers.begin(); storageBuffer != m_storageBuffers.end(); storageBuffer++) {
+		if (storageBuffer->buffer_info->name == name) {
+			for (uint32_t b = 0; b < storageBuffer->descriptors.size(); b++) {
+				VkDescriptorBufferInfo& descriptor = storageBuffer->descriptors[b];
+				VkBuffer bufferAtIndex = buffer->GetBuffer(m_app, b);
+				if (descriptor.buffer != bufferAtIndex || descriptor.offset != 0 || descriptor.range != VK_WHOLE_SIZE) {
+					descriptor.buffer = bufferAtIndex;
+					descriptor.offset = 0;
+					descriptor.range = VK_WHOLE_SIZE;
+					storageBuffer->dirty[b] = true;
+				}
+			}
+			isFound = true;
+		}
+	}
+	return WError(isFound ? W_SUCCEEDED : W_INVALIDPARAM);
+}
+
 WError WMaterial::SaveToStream(WFile* file, std::ostream& outputStream) {
 	if (!Valid())
 		return WError(W_NOTVALID);
 
+	uint32_t header[2] = { W_MATERIAL_FORMAT_MARKER, W_MATERIAL_FORMAT_VERSION };
+	outputStream.write((char*)header, sizeof(header));
+
 	// write the UBO data
 	uint32_t tmp = (uint32_t)m_uniformBuffers.size();
 	outputStream.write((char*)&tmp, sizeof(tmp));
@@ -455,6 +614,7 @@ WError WMaterial::SaveToStream(WFile* file, std::ostream& outputStream) {
 		}
 	}
 	outputStream.write((char*)&m_setIndex, sizeof(m_setIndex));
+	outputStream.write((char*)&m_features, sizeof(m_features));
 
 	strcpy_s(tmpName, W_MAX_ASSET_NAME_SIZE, m_effect->GetName().c_str());
 	outputStream.write(tmpName, W_MAX_ASSET_NAME_SIZE);
@@ -484,10 +644,18 @@ WError WMaterial::LoadFromStream(WFile* file, std::istream& inputStream, std::ve
 
 	_DestroyResources();
 
+	// materials saved before the format had a version start with the number of UBOs and have no features
+	uint32_t numUBOs, version = 0;
+	inputStream.read((char*)&numUBOs, sizeof(numUBOs));
+	if (numUBOs == W_MATERIAL_FORMAT_MARKER) {
+		inputStream.read((char*)&version, sizeof(version));
+		if (version == 0 || version > W_MATERIAL_FORMAT_VERSION)
+			return WError(W_INVALIDFILEFORMAT);
+		inputStream.read((char*)&numUBOs, sizeof(numUBOs));
+	}
+
 	// read the UBO data
-	uint32_t numUBOs;
 	std::vector<std::pair<VkDeviceSize, void*>> uboData;
-	inputStream.read((char*)&numUBOs, sizeof(numUBOs));
 	for (uint32_t i = 0; i < numUBOs; i++) {
 		VkDeviceSize size;
 		inputStream.read((char*)&size, sizeof(size));
@@ -512,6 +680,9 @@ WError WMaterial::LoadFromStream(WFile* file, std::istream& inputStream, std::ve
 		textureData.push_back(std::make_pair(index, names));
 	}
 	inputStream.read((char*)&m_setIndex, sizeof(m_setIndex));
+	m_features = EFFECT_FEATURE_NONE;
+	if (version >= 1)
+		inputStream.read((char*)&m_features, sizeof(m_features));
 	char effectName[W_MAX_ASSET_NAME_SIZE];
 	inputStream.read(effectName, W_MAX_ASSET_NAME_SIZE);
 
@@ -562,6 +733,11 @@ WError WMaterial::LoadFromStream(WFile* file, std::istream& inputStream, std::ve
 	return err;
 }
 
+void WMaterialCollection::SetFeatures(W_EFFECT_FEATURE_FLAGS features) {
+	for (auto it : m_materials)
+		it.first->SetFeatures(features);
+}
+
 WError WMaterialCollection::SetVariableData(const char* varName, void* data, size_t len) {
 	WError ret = WError(W_NOTVALID);
 	for (auto it : m_materials) {
@@ -17,6 +17,12 @@ VkResult WBufferedBuffer::Create(Wasabi* app, uint32_t numBuffers, size_t size,
 
 	m_bufferSize = size;
 
+	// buffers may be used by both the graphics queue and the compute queue (see WRenderStage::RecordCompute()),
+	// if those are of different families the buffers are shared by both rather than transferring their ownership
+	// every time the other queue uses them
+	uint32_t queueFamilies[2] = { app->GetVulkanGraphicsQueueFamily(), app->GetVulkanComputeQueueFamily() };
+	bool sharedByQueueFamilies = queueFamilies[0] != queueFamilies[1];
+
 	WVulkanBuffer stagingBuffer;
 	for (uint32_t i = 0; i < numBuffers; i++) {
 		VkMemoryPropertyFlags bufferMemoryFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT; // device local means only GPU can access it, more efficient
@@ -37,6 +43,11 @@ VkResult WBufferedBuffer::Create(Wasabi* app, uint32_t numBuffers, size_t size,
 		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferCreateInfo.size = size;
 		bufferCreateInfo.usage = usage;
+		if (sharedByQueueFamilies) {
+			bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			bufferCreateInfo.queueFamilyIndexCount = 2;
+			bufferCreateInfo.pQueueFamilyIndices = queueFamilies;
+		}
 
 		WVulkanBuffer buffer;
 		result = buffer.Create(app, bufferCreateInfo, bufferMemoryFlags);
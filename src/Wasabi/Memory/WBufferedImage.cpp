@@ -16,7 +16,13 @@ VkResult WBufferedImage::Create(Wasabi* app, uint32_t numBuffers, uint32_t width
 
 	VkResult result = VK_SUCCESS;
 	VkMemoryPropertyFlags imageMemoryFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT; // device local means only GPU can access it, more efficient
-	properties.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	// transient attachments only live inside a render pass, they are never copied to and can be backed by lazily
+	// allocated (tile) memory
+	bool isTransient = (properties.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+	if (isTransient)
+		imageMemoryFlags |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+	else
+		properties.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
 	m_aspect =
 		(properties.format == VK_FORMAT_D16_UNORM || properties.format == VK_FORMAT_X8_D24_UNORM_PACK32 || properties.format == VK_FORMAT_D32_SFLOAT)
@@ -33,6 +39,14 @@ VkResult WBufferedImage::Create(Wasabi* app, uint32_t numBuffers, uint32_t width
 	std::pair<int, int> pixelSize = g_formatSizes[properties.format];
 	m_bufferSize = (pixelSize.second/8) * width * height * depth * properties.arraySize;
 
+	// images that the compute queue may use (see WRenderStage::RecordCompute()) are shared by the graphics and
+	// compute queue families if those differ, rather than transferring their ownership every time the other queue
+	// uses them. Attachments are only used by the graphics queue and stay exclusive (concurrent sharing can disable
+	// their compression on some GPUs)
+	uint32_t queueFamilies[2] = { app->GetVulkanGraphicsQueueFamily(), app->GetVulkanComputeQueueFamily() };
+	bool sharedByQueueFamilies = queueFamilies[0] != queueFamilies[1] &&
+		!(properties.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT));
+
 	WVulkanBuffer stagingBuffer;
 	for (uint32_t i = 0; i < numBuffers; i++) {
 		//
@@ -47,8 +61,10 @@ VkResult WBufferedImage::Create(Wasabi* app, uint32_t numBuffers, uint32_t width
 		imageCreateInfo.arrayLayers = properties.arraySize;
 		imageCreateInfo.samples = properties.sampleCount;
 		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
+		imageCreateInfo.sharingMode = sharedByQueueFamilies ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+		imageCreateInfo.queueFamilyIndexCount = sharedByQueueFamilies ? 2 : 0;
+		imageCreateInfo.pQueueFamilyIndices = sharedByQueueFamilies ? queueFamilies : nullptr;
+		imageCreateInfo.initialLayout = isTransient ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_PREINITIALIZED;
 		imageCreateInfo.extent = { width, height, depth };
 		imageCreateInfo.usage = m_properties.usage;
 
@@ -83,6 +99,9 @@ VkResult WBufferedImage::Create(Wasabi* app, uint32_t numBuffers, uint32_t width
 		m_images.push_back(image);
 		m_layouts.push_back(imageCreateInfo.initialLayout);
 
+		if (isTransient)
+			continue;
+
 		//
 		// Create a host-visible staging buffer that contains the raw image data.
 		// we will later copy that buffer's contents into the newly created image.
@@ -216,6 +235,7 @@ void WBufferedImage::Destroy(Wasabi* app) {
 		it->Destroy(app);
 	m_images.clear();
 	m_stagingBuffers.clear();
+	m_layouts.clear();
 	m_bufferSize = 0;
 	W_SAFE_FREE(m_readOnlyMemory);
 }
@@ -282,6 +302,26 @@ void WBufferedImage::TransitionLayoutTo(VkCommandBuffer cmdBuf, VkImageLayout ne
 	m_layouts[bufferIndex] = newLayout;
 }
 
+void WBufferedImage::SetLayout(VkImageLayout layout, uint32_t bufferIndex) {
+	bufferIndex = bufferIndex % m_images.size();
+	m_layouts[bufferIndex] = layout;
+}
+
+VkImageMemoryBarrier WBufferedImage::GetLayoutTransitionBarrier(VkImageLayout newLayout, uint32_t bufferIndex, bool discardContents) {
+	bufferIndex = bufferIndex % m_images.size();
+	VkImageMemoryBarrier barrier = vkTools::initializers::imageMemoryBarrier();
+	barrier.oldLayout = discardContents ? VK_IMAGE_LAYOUT_UNDEFINED : m_layouts[bufferIndex];
+	barrier.newLayout = newLayout;
+	barrier.image = m_images[bufferIndex].img;
+	barrier.subresourceRange.aspectMask = m_aspect;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	m_layouts[bufferIndex] = newLayout;
+	return barrier;
+}
+
 bool WBufferedImage::Valid() const {
 	return m_bufferSize > 0;
 }
@@ -66,7 +66,11 @@ VkResult WVulkanImage::Create(class Wasabi* app, VkImageCreateInfo createInfo, V
 		memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 		memAllocInfo.allocationSize = memReqs.size;
 		// Get memory type index for a host visible buffer
-		app->MemoryManager->GetMemoryType(memReqs.memoryTypeBits, memoryType, &memAllocInfo.memoryTypeIndex);
+		if (!app->MemoryManager->GetMemoryType(memReqs.memoryTypeBits, memoryType, &memAllocInfo.memoryTypeIndex)) {
+			// lazily allocated memory is only available on tiled GPUs, fall back to regular memory elsewhere
+			memoryType &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+			app->MemoryManager->GetMemoryType(memReqs.memoryTypeBits, memoryType, &memAllocInfo.memoryTypeIndex);
+		}
 
 		result = vkAllocateMemory(device, &memAllocInfo, nullptr, &mem);
 		if (result == VK_SUCCESS) {
@@ -144,16 +148,17 @@ WError WVulkanMemoryManager::Initialize(VkPhysicalDevice physicalDevice, VkDevic
 	return WError(W_SUCCEEDED);
 }
 
-void WVulkanMemoryManager::GetMemoryType(uint32_t typeBits, VkFlags properties, uint32_t * typeIndex) const {
+bool WVulkanMemoryManager::GetMemoryType(uint32_t typeBits, VkFlags properties, uint32_t * typeIndex) const {
 	for (uint32_t i = 0; i < 32; i++) {
 		if ((typeBits & 1) == 1) {
 			if ((m_deviceMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
 				*typeIndex = i;
-				return;
+				return true;
 			}
 		}
 		typeBits >>= 1;
 	}
+	return false;
 }
 
 VkCommandPool WVulkanMemoryManager::GetCommandPool() const {
@@ -11,6 +11,7 @@
 #include "Wasabi/WindowAndInput/WWindowAndInputComponent.hpp"
 #include "Wasabi/Animations/WAnimation.hpp"
 #include "Wasabi/Animations/WSkeletalAnimation.hpp"
+#include "Wasabi/Animations/WCrowdAnimation.hpp"
 
 std::string WObjectManager::GetTypeName() const {
 	return "Object";
@@ -32,6 +33,22 @@ WObject* WObjectManager::CreateObject(WEffect* fx, uint32_t bindingSet, uint32_t
 	return object;
 }
 
+void WObjectManager::UpdateSceneObjects() {
+	// only the objects that moved are sent to the renderer, which uploads nothing for the others
+	for (uint32_t j = 0; j < W_HASHTABLESIZE; j++) {
+		for (uint32_t i = 0; i < m_entities[j].size(); i++) {
+			WObject* object = m_entities[j][i];
+			if (!object->m_sceneObjectDirty)
+				continue;
+			W_SCENE_OBJECT_DATA data;
+			data.worldMatrix = object->GetWorldMatrix();
+			data.normalMatrix = WMatrixTranspose(WMatrixInverse(data.worldMatrix));
+			m_app->Renderer->UpdateSceneObject(object->m_sceneObjectIndex, data);
+			object->m_sceneObjectDirty = false;
+		}
+	}
+}
+
 WObject* WObjectManager::PickObject(double x, double y, bool bAnyHit, uint32_t iObjStartID, uint32_t iObjEndID, WVector3* _pt, WVector2* uv, uint32_t* faceIndex) const {
 	struct pickStruct {
 		WObject* obj;
@@ -128,6 +145,9 @@ WObject* WObjectManager::PickObject(double x, double y, bool bAnyHit, uint32_t i
 
 WInstance::WInstance() {
 	m_scale = WVector3(1.0f, 1.0f, 1.0f);
+	m_animationClip = 0;
+	m_animationTimeOffset = 0.0f;
+	m_animationSpeed = 1.0f;
 }
 
 WInstance::~WInstance() {
@@ -157,6 +177,25 @@ WMatrix WInstance::GetWorldMatrix() {
 	return m;
 }
 
+void WInstance::SetAnimationClip(uint32_t clip, float fTimeOffset, float fSpeed) {
+	m_animationClip = clip;
+	m_animationTimeOffset = fTimeOffset;
+	m_animationSpeed = fSpeed;
+	m_bAltered = true;
+}
+
+uint32_t WInstance::GetAnimationClip() const {
+	return m_animationClip;
+}
+
+float WInstance::GetAnimationTimeOffset() const {
+	return m_animationTimeOffset;
+}
+
+float WInstance::GetAnimationSpeed() const {
+	return m_animationSpeed;
+}
+
 bool WInstance::UpdateLocals() {
 	if (m_bAltered) {
 		m_bAltered = false;
@@ -187,6 +226,9 @@ WObject::WObject(Wasabi* const app, uint32_t ID) : WObject(app, nullptr, 0, ID)
 WObject::WObject(Wasabi* const app, WEffect* fx, uint32_t bindingSet, uint32_t ID) : WFileAsset(app, ID), m_instanceV(0) {
 	m_geometry = nullptr;
 	m_animation = nullptr;
+	m_bCrowdAnimation = false;
+	m_skinnedVertexBuffer = VK_NULL_HANDLE;
+	m_skinnedVertexOffset = 0;
 
 	m_hidden = false;
 	m_bAltered = true;
@@ -197,6 +239,10 @@ WObject::WObject(Wasabi* const app, WEffect* fx, uint32_t bindingSet, uint32_t I
 
 	m_instanceTexture = nullptr;
 
+	m_sceneObjectIndex = app->Renderer ? app->Renderer->AllocateSceneObject() : W_INVALID_SCENE_OBJECT_INDEX;
+	m_sceneObjectDirty = false;
+	_MarkSceneObjectDirty();
+
 	if (fx)
 		AddEffect(fx, bindingSet);
 
@@ -205,10 +251,13 @@ WObject::WObject(Wasabi* const app, WEffect* fx, uint32_t bindingSet, uint32_t I
 
 WObject::~WObject() {
 	W_SAFE_REMOVEREF(m_geometry);
-	W_SAFE_REMOVEREF(m_animation);
+	SetAnimation(nullptr);
 
 	DestroyInstancingResources();
 
+	if (m_app->Renderer)
+		m_app->Renderer->FreeSceneObject(m_sceneObjectIndex);
+
 	m_app->ObjectManager->RemoveEntity(this);
 }
 
@@ -239,11 +288,11 @@ void WObject::OnMaterialAdded(WMaterial* newMaterial) {
 	newMaterial->SetVariable<WColor>("color", WColor(0.0f, 0.0f, 0.0f, 0.0f));
 	newMaterial->SetVariable<float>("specularPower", 1.0f);
 	newMaterial->SetVariable<float>("specularIntensity", 0.0f);
-	newMaterial->SetVariable<int>("isTextured", 1);
+	newMaterial->SetFeatures(EFFECT_FEATURE_TEXTURED);
 }
 
 bool WObject::WillRender(WRenderTarget* rt) {
-	if (Valid() && !m_hidden) {
+	if (Valid() && !m_hidden && m_sceneObjectIndex != W_INVALID_SCENE_OBJECT_INDEX) {
 		WCamera* cam = rt->GetCamera();
 		if (m_bFrustumCull) {
 			if (!InCameraView(cam))
@@ -254,20 +303,22 @@ bool WObject::WillRender(WRenderTarget* rt) {
 	return false;
 }
 
-void WObject::Render(WRenderTarget* rt, WMaterial* material, bool updateInstances) {
+void WObject::Render(WRenderTarget* rt, WMaterial* material, bool updateInstances, bool useSkinnedVertices, bool reportAnimationVisibility) {
 	if (updateInstances)
 		_UpdateInstanceBuffer();
 
 	bool is_animated = m_animation && m_animation->Valid() && m_geometry->IsRigged();
 	bool is_instanced = m_instanceV.size() > 0;
+	bool is_skinned = useSkinnedVertices && is_animated && m_skinnedVertexBuffer != VK_NULL_HANDLE;
+
+	if (is_animated && reportAnimationVisibility)
+		_ReportAnimationVisibility(rt->GetCamera());
 
 	if (material) {
-		WMatrix worldM = GetWorldMatrix();
-		material->SetVariable<WMatrix>("worldMatrix", worldM);
-		// animation variables
-		material->SetVariable<int>("isAnimated", is_animated ? 1 : 0);
-		material->SetVariable<int>("isInstanced", is_instanced ? 1 : 0);
-		if (is_animated) {
+		// the world matrix is read from the renderer's scene objects buffer
+		material->SetVariable<uint32_t>("objectIndex", m_sceneObjectIndex);
+		// animation variables (instancing is selected by the effect's pipeline variant)
+		if (is_animated && !is_skinned) {
 			WImage* animTex = m_animation->GetTexture();
 			material->SetTexture("animationTexture", animTex);
 		}
@@ -278,10 +329,35 @@ void WObject::Render(WRenderTarget* rt, WMaterial* material, bool updateInstance
 		material->Bind(rt);
 	}
 
-	WError err = m_geometry->Draw(rt, std::numeric_limits<uint32_t>::max(), std::max((uint32_t)m_instanceV.size(), (uint32_t)1), is_animated);
+	WError err;
+	if (is_skinned)
+		err = m_geometry->DrawWithVertexBuffer(rt, m_skinnedVertexBuffer, m_skinnedVertexOffset, std::numeric_limits<uint32_t>::max(), std::max((uint32_t)m_instanceV.size(), (uint32_t)1));
+	else
+		err = m_geometry->Draw(rt, std::numeric_limits<uint32_t>::max(), std::max((uint32_t)m_instanceV.size(), (uint32_t)1), is_animated);
 	(void)err;
 }
 
+void WObject::SetSkinnedVertices(VkBuffer buffer, VkDeviceSize offset) {
+	m_skinnedVertexBuffer = buffer;
+	m_skinnedVertexOffset = offset;
+}
+
+bool WObject::HasSkinnedVertices() const {
+	return m_skinnedVertexBuffer != VK_NULL_HANDLE;
+}
+
+void WObject::_ReportAnimationVisibility(WCamera* cam) {
+	if (!cam)
+		return;
+
+	// height of the bounding sphere on the screen, as a fraction of the screen's height
+	WVector3 scale = GetScale();
+	float fRadius = WVec3Length(m_geometry->GetMaxPoint() - m_geometry->GetMinPoint()) / 2.0f;
+	fRadius *= fmax(fabs(scale.x), fmax(fabs(scale.y), fabs(scale.z)));
+	float fDistance = fmax(WVec3Length(GetPosition() - cam->GetPosition()), cam->GetMinRange());
+	m_animation->ReportVisibility(fRadius * cam->GetProjectionMatrix()(1, 1) / fDistance);
+}
+
 WError WObject::SetGeometry(class WGeometry* geometry) {
 	if (m_geometry)
 		m_geometry->RemoveReference();
@@ -295,17 +371,28 @@ WError WObject::SetGeometry(class WGeometry* geometry) {
 }
 
 WError WObject::SetAnimation(class WAnimation* animation) {
-	if (m_animation)
+	if (m_animation) {
+		m_animation->SetNumObjects(m_animation->GetNumObjects() - 1);
 		m_animation->RemoveReference();
+	}
 
 	m_animation = animation;
+	m_bCrowdAnimation = false;
 	if (animation) {
 		m_animation->AddReference();
+		m_animation->SetNumObjects(m_animation->GetNumObjects() + 1);
+		m_bCrowdAnimation = animation->GetTypeName() == WCrowdAnimation::_GetTypeName();
 	}
 
 	return WError(W_SUCCEEDED);
 }
 
+W_EFFECT_FEATURE_FLAGS WObject::GetEffectFeatures() const {
+	if (m_instanceV.size() == 0)
+		return EFFECT_FEATURE_NONE;
+	return m_bCrowdAnimation ? EFFECT_FEATURE_INSTANCED | EFFECT_FEATURE_CROWD_ANIMATED : EFFECT_FEATURE_INSTANCED;
+}
+
 WError WObject::InitInstancing(uint32_t maxInstances) {
 	DestroyInstancingResources();
 
@@ -385,6 +472,10 @@ void WObject::_UpdateInstanceBuffer() {
 			if (ret) {
 				for (uint32_t i = 0; i < m_instanceV.size(); i++) {
 					WMatrix m = m_instanceV[i]->m_worldM;
+					// the 4th pixel holds the crowd animation state instead of the 4th matrix row (encoded in the first 3)
+					m(3, 0) = (float)m_instanceV[i]->m_animationClip;
+					m(3, 1) = m_instanceV[i]->m_animationTimeOffset;
+					m(3, 2) = m_instanceV[i]->m_animationSpeed;
 					memcpy(&((char*)pData)[i * sizeof(WMatrix)], &m, sizeof(WMatrix) - sizeof(float));
 				}
 				m_instanceTexture->UnmapPixels();
@@ -438,6 +529,7 @@ WVector3 WObject::GetScale() const {
 void WObject::Scale(WVector3 scale) {
 	m_bAltered = true;
 	m_scale = scale;
+	_MarkSceneObjectDirty();
 }
 
 WMatrix WObject::GetWorldMatrix() {
@@ -462,6 +554,16 @@ bool WObject::UpdateLocals() {
 void WObject::OnStateChange(STATE_CHANGE_TYPE type) { //virtual method of the orientation device
 	WOrientation::OnStateChange(type); //do the default OnStateChange first
 	m_bAltered = true;
+	_MarkSceneObjectDirty();
+}
+
+uint32_t WObject::GetSceneObjectIndex() const {
+	return m_sceneObjectIndex;
+}
+
+void WObject::_MarkSceneObjectDirty() {
+	if (m_sceneObjectIndex != W_INVALID_SCENE_OBJECT_INDEX)
+		m_sceneObjectDirty = true;
 }
 
 WError WObject::SaveToStream(WFile* file, std::ostream& outputStream) {
@@ -564,7 +666,7 @@ WError WObject::LoadFromStream(WFile* file, std::istream& inputStream, std::vect
 	}
 
 	WGeometry* geometry = nullptr;
-	WSkeleton* animation = nullptr;
+	WAnimation* animation = nullptr;
 
 	if (dependencies[0] != "" && status)
 		status = file->LoadAsset<WGeometry>(dependencies[0], &geometry, WGeometry::LoadArgs(), ""); // never copy the geometry
@@ -572,8 +674,13 @@ WError WObject::LoadFromStream(WFile* file, std::istream& inputStream, std::vect
 		status = SetGeometry(geometry);
 	W_SAFE_REMOVEREF(geometry);
 
-	if (dependencies[1] != "" && status)
-		status = file->LoadAsset<WSkeleton>(dependencies[1], &animation, WSkeleton::LoadArgs(), nameSuffix); // copy the skeleton (if required)
+	if (dependencies[1] != "" && status) {
+		// copy the animation (if required)
+		if (file->GetAssetInfo(dependencies[1]).second == WCrowdAnimation::_GetTypeName())
+			status = file->LoadAsset<WCrowdAnimation>(dependencies[1], (WCrowdAnimation**)&animation, WCrowdAnimation::LoadArgs(), nameSuffix);
+		else
+			status = file->LoadAsset<WSkeleton>(dependencies[1], (WSkeleton**)&animation, WSkeleton::LoadArgs(), nameSuffix);
+	}
 	if (status)
 		SetAnimation(animation);
 	W_SAFE_REMOVEREF(animation);
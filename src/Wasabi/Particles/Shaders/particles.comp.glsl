@@ -0,0 +1,164 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// one invocation per particle in the simulation pass, must match W_PARTICLES_GPU_GROUP_SIZE
+layout(local_size_x = 64) in;
+
+// The passes of a frame, recorded in this order by WParticles::RecordSimulation()
+const uint PASS_BEGIN = 0; // one invocation: prepares the counters and the dispatch of the simulation pass
+const uint PASS_SIMULATE = 1; // one invocation per live or emitted particle
+const uint PASS_END = 2; // one invocation: writes the draw parameters
+
+struct Particle {
+	vec4 posAndSpawnTime; // local-space position and time of emission
+	vec4 velAndLifetime; // local-space velocity and lifetime in seconds
+	vec4 uvs; // left, top, right, bottom
+};
+
+// Two halves of maxParticles particles, the live particles are in the source half and the simulation pass
+// writes the particles it keeps to the other half
+layout(std430, set = 0, binding = 0) buffer Particles {
+	Particle particles[];
+};
+
+layout(std430, set = 0, binding = 1) buffer State {
+	uint numParticles; // live particles in the source half
+	uint numKept; // particles kept by the simulation pass
+	uint numEmitted; // particles emitted in this frame
+	uint pad;
+	uvec4 dispatchArgs; // VkDispatchIndirectCommand of the simulation pass
+} state;
+
+layout(std430, set = 0, binding = 2) writeonly buffer DrawArgs {
+	uint vertexCount;
+	uint instanceCount;
+	uint firstVertex;
+	uint firstInstance;
+} drawArgs;
+
+// instances in the layout of WParticlesInstance (5 pixels each), read by the particles vertex shader
+layout(set = 0, binding = 3, rgba32f) uniform writeonly image2D instances;
+
+layout(set = 0, binding = 4) uniform UBO {
+	mat4x4 worldView;
+	mat4x4 view;
+	vec4 emissionPosition; // w: lifetime of the emitted particles
+	vec4 emissionRandomness; // w: 1 if the emitted particles move outwards
+	vec4 spawnVelocity; // w: speed of the particles moving outwards
+	vec4 time; // x: current time, y: time since the last frame, z: spawn time of the first emitted particle, w: emission period
+	vec4 sizes; // x: size at birth, y: size at death, z: 1 if the size is applied in view space
+	uvec4 emission; // x: number of emitted particles, y: random seed, z: columns of tiles, w: rows of tiles
+	vec4 colorCurve[64]; // W_PARTICLES_COLOR_CURVE_SIZE samples
+} uboParams;
+
+layout(push_constant) uniform PushConstant {
+	uint pass;
+	uint source; // half of the particles buffer holding the live particles
+	uint maxParticles;
+	uint reset; // 1 to discard the live particles
+} pcSimulation;
+
+uint Hash(uint x) {
+	uint s = x * 747796405u + 2891336453u;
+	uint word = ((s >> ((s >> 28u) + 4u)) ^ s) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// random number in [0, 1)
+float Random(inout uint seed) {
+	seed = Hash(seed);
+	return float(seed >> 8) / 16777216.0f;
+}
+
+// Emits a particle the way WDefaultParticleBehavior does
+Particle Emit(uint index) {
+	uint seed = Hash(uboParams.emission.y ^ Hash(index));
+	vec3 offset = vec3(Random(seed), Random(seed), Random(seed)) - 0.5f;
+	vec3 pos = uboParams.emissionPosition.xyz + uboParams.emissionRandomness.xyz * offset;
+	vec3 vel = uboParams.spawnVelocity.xyz;
+	vec3 outwards = pos - uboParams.emissionPosition.xyz;
+	if (uboParams.emissionRandomness.w > 0.5f && dot(outwards, outwards) > 0.0f)
+		vel = normalize(outwards) * uboParams.spawnVelocity.w;
+
+	uint numColumns = uboParams.emission.z;
+	seed = Hash(seed);
+	uint x = seed % numColumns;
+	seed = Hash(seed);
+	uint y = seed % uboParams.emission.w;
+
+	Particle p;
+	p.posAndSpawnTime = vec4(pos, uboParams.time.z + float(index) * uboParams.time.w);
+	p.velAndLifetime = vec4(vel, uboParams.emissionPosition.w);
+	p.uvs = vec4(float(x), float(y), float(x + 1), float(y + 1)) / float(numColumns);
+	return p;
+}
+
+void StorePixel(uint pixel, vec4 value) {
+	int width = imageSize(instances).x;
+	imageStore(instances, ivec2(int(pixel) % width, int(pixel) / width), value);
+}
+
+// Writes the instance of a particle, see _WriteInstancesKernel() in WParticles.cpp
+void WriteInstance(uint index, Particle p, float age) {
+	vec3 viewPos = (uboParams.worldView * vec4(p.posAndSpawnTime.xyz, 1.0f)).xyz;
+
+	float size = mix(uboParams.sizes.x, uboParams.sizes.y, age);
+
+	float curvePos = clamp(age, 0.0f, 1.0f) * 63.0f;
+	float curveSample = min(floor(curvePos), 62.0f);
+	vec4 color = mix(uboParams.colorCurve[int(curveSample)], uboParams.colorCurve[int(curveSample) + 1], curvePos - curveSample);
+
+	uint base = index * 5;
+	StorePixel(base + 0, vec4(uboParams.view[0].xyz, viewPos.x));
+	StorePixel(base + 1, vec4(uboParams.view[1].xyz, viewPos.y));
+	StorePixel(base + 2, vec4(uboParams.view[2].xyz, viewPos.z));
+	StorePixel(base + 3, floor(color * 255.1f) + p.uvs * 0.98f + 0.01f);
+	StorePixel(base + 4, uboParams.sizes.z > 0.5f ? vec4(0.0f, size, 0.0f, 0.0f) : vec4(size, 0.0f, 0.0f, 0.0f));
+}
+
+void main() {
+	if (pcSimulation.pass == PASS_BEGIN) {
+		if (gl_GlobalInvocationID.x > 0)
+			return;
+		if (pcSimulation.reset > 0)
+			state.numParticles = 0;
+		state.numKept = 0;
+		state.numEmitted = min(uboParams.emission.x, pcSimulation.maxParticles);
+		state.dispatchArgs = uvec4((state.numParticles + state.numEmitted + 63) / 64, 1, 1, 0);
+	} else if (pcSimulation.pass == PASS_SIMULATE) {
+		uint i = gl_GlobalInvocationID.x;
+		uint numParticles = state.numParticles;
+		if (i >= numParticles + state.numEmitted)
+			return;
+
+		Particle p;
+		if (i < numParticles)
+			p = particles[pcSimulation.source * pcSimulation.maxParticles + i];
+		else
+			p = Emit(i - numParticles);
+
+		// dead particles are dropped, the live ones are moved (a particle emitted in this frame only moves
+		// for the time since its emission) and compacted in the other half
+		float curTime = uboParams.time.x;
+		float age = (curTime - p.posAndSpawnTime.w) / p.velAndLifetime.w;
+		if (age >= 1.0f)
+			return;
+		p.posAndSpawnTime.xyz += p.velAndLifetime.xyz * min(uboParams.time.y, curTime - p.posAndSpawnTime.w);
+
+		uint index = atomicAdd(state.numKept, 1);
+		if (index >= pcSimulation.maxParticles)
+			return;
+		particles[(1 - pcSimulation.source) * pcSimulation.maxParticles + index] = p;
+		WriteInstance(index, p, age);
+	} else if (pcSimulation.pass == PASS_END) {
+		if (gl_GlobalInvocationID.x > 0)
+			return;
+		state.numParticles = min(state.numKept, pcSimulation.maxParticles);
+		drawArgs.vertexCount = 4;
+		drawArgs.instanceCount = state.numParticles;
+		drawArgs.firstVertex = 0;
+		drawArgs.firstInstance = 0;
+	}
+}
@@ -1,4 +1,5 @@
 #include "Wasabi/Particles/WParticles.hpp"
+#include "Wasabi/Particles/WParticlesKernels.hpp"
 #include "Wasabi/Cameras/WCamera.hpp"
 #include "Wasabi/Images/WRenderTarget.hpp"
 #include "Wasabi/Geometries/WGeometry.hpp"
@@ -70,6 +71,83 @@ public:
 	}
 };
 
+/** Number of particles simulated by a work group of the simulation shader */
+#define W_PARTICLES_GPU_GROUP_SIZE 64
+
+/** Passes of the simulation shader, recorded in this order every frame */
+enum W_PARTICLES_GPU_PASS: uint32_t {
+	/** Prepares the counters and the dispatch parameters of the simulation pass */
+	W_PARTICLES_GPU_PASS_BEGIN = 0,
+	/** Emits, moves and compacts the particles and writes their instances */
+	W_PARTICLES_GPU_PASS_SIMULATE = 1,
+	/** Writes the draw parameters */
+	W_PARTICLES_GPU_PASS_END = 2,
+};
+
+/** A particle of the GPU simulation, see particles.comp.glsl */
+struct WParticlesGPUParticle {
+	WVector4 posAndSpawnTime;
+	WVector4 velAndLifetime;
+	WVector4 uvs;
+};
+
+/** Counters of the GPU simulation, see particles.comp.glsl */
+struct WParticlesGPUState {
+	uint32_t numParticles;
+	uint32_t numKept;
+	uint32_t numEmitted;
+	uint32_t pad;
+	VkDispatchIndirectCommand dispatchArgs;
+	uint32_t pad2;
+};
+
+class ParticlesCS : public WShader {
+public:
+	ParticlesCS(class Wasabi* const app) : WShader(app) {}
+
+	virtual void Load(bool bSaveData = false) {
+		m_desc.type = W_COMPUTE_SHADER;
+		m_desc.bound_resources = {
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 0, 0, "particles"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 1, 0, "state"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 2, 0, "drawArgs"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_IMAGE, 3, 0, "instances"),
+			W_BOUND_RESOURCE(W_TYPE_UBO, 4, 0, "uboParams", {
+				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "worldView"),
+				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "view"),
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "emissionPosition"), // w: lifetime
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "emissionRandomness"), // w: 1 if moving outwards
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "spawnVelocity"), // w: speed
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "time"), // current, delta, first spawn, emission period
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "sizes"), // birth, death, 1 if in view space
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, 4, "emission"), // emitted, seed, tile columns, tile rows
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, W_PARTICLES_COLOR_CURVE_SIZE, "colorCurve"),
+			}),
+			W_BOUND_RESOURCE(W_TYPE_PUSH_CONSTANT, 0, "pcSimulation", {
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "pass"), // see W_PARTICLES_GPU_PASS
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "source"), // half of the particles buffer holding the live particles
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "maxParticles"),
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "reset"), // 1 to discard the live particles
+			}),
+		};
+		vector<uint8_t> code {
+			#include "Shaders/particles.comp.glsl.spv"
+		};
+		LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+	}
+};
+
+/**
+ * Records a barrier between the compute shader writes recorded so far and the given later accesses.
+ */
+static void _ComputeBarrier(VkCommandBuffer cmdBuf, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess) {
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+	vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
 inline void WParticlesInstance::SetParameters(const WMatrix& WVP, WColor color, WVector2 uvTopLeft, WVector2 uvBottomRight, float localSize, float viewSize) {
 	mat1 = WVector4(WVP(0, 0), WVP(0, 1), WVP(0, 2), WVP(3, 0));
 	mat2 = WVector4(WVP(1, 0), WVP(1, 1), WVP(1, 2), WVP(3, 1));
@@ -83,48 +161,295 @@ inline void WParticlesInstance::SetParameters(const WMatrix& WVP, WColor color,
 	sizeViewSpace = viewSize;
 }
 
-WParticlesBehavior::WParticlesBehavior(uint32_t maxParticles, uint32_t particleSize) {
+/*
+ * The particle kernels below are branch-free loops over restricted float arrays, so that the compiler can
+ * vectorize them. The aging, compaction and integration kernels have hand-written SIMD versions instead
+ * (see WParticlesKernels).
+ */
+
+/**
+ * Linearly interpolates the sizes of n particles between their sizes at birth and at death.
+ */
+static void _SizeCurveKernel(float birthSize, float deathSize, const float* __restrict age, float* __restrict size, uint32_t n) {
+	for (uint32_t i = 0; i < n; i++)
+		size[i] = birthSize + (deathSize - birthSize) * age[i];
+}
+
+/**
+ * Samples the colors of n particles from a color curve of W_PARTICLES_COLOR_CURVE_SIZE evenly spaced
+ * samples (4 floats each), interpolating between the two samples around every particle's age.
+ */
+static void _ColorCurveKernel(const float* __restrict curve, const float* __restrict age,
+	float* __restrict r, float* __restrict g, float* __restrict b, float* __restrict a, uint32_t n) {
+	const float scale = (float)(W_PARTICLES_COLOR_CURVE_SIZE - 1);
+	for (uint32_t i = 0; i < n; i++) {
+		float pos = std::min(std::max(age[i], 0.0f), 1.0f) * scale;
+		float sample = std::min(std::floor(pos), scale - 1.0f);
+		float f = pos - sample;
+		const float* c1 = &curve[(int)sample * 4];
+		const float* c2 = c1 + 4;
+		r[i] = c1[0] + (c2[0] - c1[0]) * f;
+		g[i] = c1[1] + (c2[1] - c1[1]) * f;
+		b[i] = c1[2] + (c2[2] - c1[2]) * f;
+		a[i] = c1[3] + (c2[3] - c1[3]) * f;
+	}
+}
+
+/**
+ * Expands the bounding box (minPoint, maxPoint) to contain n positions.
+ */
+static void _BoundsKernel(const float* __restrict x, const float* __restrict y, const float* __restrict z, uint32_t n, WVector3& minPoint, WVector3& maxPoint) {
+	float minX = minPoint.x, minY = minPoint.y, minZ = minPoint.z;
+	float maxX = maxPoint.x, maxY = maxPoint.y, maxZ = maxPoint.z;
+	for (uint32_t i = 0; i < n; i++) {
+		minX = std::min(minX, x[i]);
+		minY = std::min(minY, y[i]);
+		minZ = std::min(minZ, z[i]);
+		maxX = std::max(maxX, x[i]);
+		maxY = std::max(maxY, y[i]);
+		maxZ = std::max(maxZ, z[i]);
+	}
+	minPoint = WVector3(minX, minY, minZ);
+	maxPoint = WVector3(maxX, maxY, maxZ);
+}
+
+/**
+ * Writes the instances of n particles (see WParticlesInstance::SetParameters()). The transformation of a
+ * particle is a translation to its world position followed by the view matrix, so only the translation
+ * (its position transformed by worldView) differs between particles.
+ */
+static void _WriteInstancesKernel(const WMatrix& view, const WMatrix& worldView, bool sizeInViewSpace, const WParticlesData& particles,
+	uint32_t begin, uint32_t n, WParticlesInstance* __restrict instances) {
+	const float* __restrict x = &particles.posX[begin];
+	const float* __restrict y = &particles.posY[begin];
+	const float* __restrict z = &particles.posZ[begin];
+	const float* __restrict size = &particles.size[begin];
+	const float* __restrict r = &particles.colorR[begin];
+	const float* __restrict g = &particles.colorG[begin];
+	const float* __restrict b = &particles.colorB[begin];
+	const float* __restrict a = &particles.colorA[begin];
+	const float* __restrict uvLeft = &particles.uvLeft[begin];
+	const float* __restrict uvTop = &particles.uvTop[begin];
+	const float* __restrict uvRight = &particles.uvRight[begin];
+	const float* __restrict uvBottom = &particles.uvBottom[begin];
+	float localSizeScale = sizeInViewSpace ? 0.0f : 1.0f;
+	float viewSizeScale = sizeInViewSpace ? 1.0f : 0.0f;
+	for (uint32_t i = 0; i < n; i++) {
+		WParticlesInstance& instance = instances[i];
+		instance.mat1 = WVector4(view(0, 0), view(0, 1), view(0, 2), x[i] * worldView(0, 0) + y[i] * worldView(1, 0) + z[i] * worldView(2, 0) + worldView(3, 0));
+		instance.mat2 = WVector4(view(1, 0), view(1, 1), view(1, 2), x[i] * worldView(0, 1) + y[i] * worldView(1, 1) + z[i] * worldView(2, 1) + worldView(3, 1));
+		instance.mat3 = WVector4(view(2, 0), view(2, 1), view(2, 2), x[i] * worldView(0, 2) + y[i] * worldView(1, 2) + z[i] * worldView(2, 2) + worldView(3, 2));
+		instance.colorAndUVs = WVector4(
+			std::floor(r[i] * 255.1f) + uvLeft[i] * 0.98f + 0.01f,
+			std::floor(g[i] * 255.1f) + uvTop[i] * 0.98f + 0.01f,
+			std::floor(b[i] * 255.1f) + uvRight[i] * 0.98f + 0.01f,
+			std::floor(a[i] * 255.1f) + uvBottom[i] * 0.98f + 0.01f
+		);
+		instance.sizeLocalSpace = size[i] * localSizeScale;
+		instance.sizeViewSpace = size[i] * viewSizeScale;
+	}
+}
+
+std::vector<std::vector<float>*> WParticlesData::GetArrays() {
+	std::vector<std::vector<float>*> arrays = {
+		&posX, &posY, &posZ,
+		&velX, &velY, &velZ,
+		&spawnTime, &lifetime, &age, &size,
+		&colorR, &colorG, &colorB, &colorA,
+		&uvLeft, &uvTop, &uvRight, &uvBottom,
+	};
+	for (auto& attribute : custom)
+		arrays.push_back(&attribute);
+	return arrays;
+}
+
+WParticlesBehavior::WParticlesBehavior(uint32_t maxParticles) {
 	m_maxParticles = maxParticles;
-	m_particleSize = particleSize;
-	m_numParticles = 0;
-	m_particlesData = (void*)new char[m_maxParticles*m_particleSize];
+	m_lastUpdateTime = 0.0f;
+	m_particles.count = 0;
+	for (auto array : m_particles.GetArrays())
+		array->resize(m_maxParticles);
+	m_sizeCurve = WVector2(1.0f, 1.0f);
+	m_sizeInViewSpace = true;
+	SetColorCurve({});
+	// initially infinite bounding box
+	m_minPoint = WVector3(std::numeric_limits<float>::min(), std::numeric_limits<float>::min(), std::numeric_limits<float>::min());
+	m_maxPoint = WVector3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
 }
 
 WParticlesBehavior::~WParticlesBehavior() {
-	delete[] static_cast<char*>(m_particlesData);
 }
 
-void WParticlesBehavior::Emit(void* particle) {
-	if (m_numParticles < m_maxParticles) {
-		memcpy((char*)m_particlesData + (m_numParticles*m_particleSize), particle, m_particleSize);
-		m_numParticles++;
+uint32_t WParticlesBehavior::Emit(uint32_t count) {
+	uint32_t first = m_particles.count;
+	uint32_t end = first + std::min(count, m_maxParticles - first);
+	auto fill = [first, end](std::vector<float>& values, float value) {
+		std::fill(values.begin() + first, values.begin() + end, value);
+	};
+	fill(m_particles.posX, 0.0f);
+	fill(m_particles.posY, 0.0f);
+	fill(m_particles.posZ, 0.0f);
+	fill(m_particles.velX, 0.0f);
+	fill(m_particles.velY, 0.0f);
+	fill(m_particles.velZ, 0.0f);
+	fill(m_particles.spawnTime, 0.0f);
+	fill(m_particles.lifetime, 1.0f);
+	fill(m_particles.age, 0.0f);
+	fill(m_particles.size, 1.0f);
+	fill(m_particles.colorR, 1.0f);
+	fill(m_particles.colorG, 1.0f);
+	fill(m_particles.colorB, 1.0f);
+	fill(m_particles.colorA, 1.0f);
+	fill(m_particles.uvLeft, 0.0f);
+	fill(m_particles.uvTop, 0.0f);
+	fill(m_particles.uvRight, 1.0f);
+	fill(m_particles.uvBottom, 1.0f);
+	for (auto& attribute : m_particles.custom)
+		fill(attribute, 0.0f);
+	m_particles.count = end;
+	return first;
+}
+
+uint32_t WParticlesBehavior::AddCustomAttribute() {
+	m_particles.custom.push_back(std::vector<float>(m_maxParticles, 0.0f));
+	return (uint32_t)m_particles.custom.size() - 1;
+}
+
+void WParticlesBehavior::SetColorCurve(const std::vector<std::pair<WColor, float>>& gradient) {
+	m_colorCurve.resize(W_PARTICLES_COLOR_CURVE_SIZE * 4);
+	for (uint32_t s = 0; s < W_PARTICLES_COLOR_CURVE_SIZE; s++) {
+		float t = (float)s / (float)(W_PARTICLES_COLOR_CURVE_SIZE - 1);
+		WColor color = gradient.size() > 0 ? gradient.back().first : WColor(1.0f, 1.0f, 1.0f, 1.0f);
+		float segmentStart = 0.0f;
+		for (uint32_t i = 0; i + 1 < gradient.size(); i++) {
+			if (t < segmentStart + gradient[i].second) {
+				color = WColorLerp(gradient[i].first, gradient[i + 1].first, (t - segmentStart) / gradient[i].second);
+				break;
+			}
+			segmentStart += gradient[i].second;
+		}
+		m_colorCurve[s * 4 + 0] = color.r;
+		m_colorCurve[s * 4 + 1] = color.g;
+		m_colorCurve[s * 4 + 2] = color.b;
+		m_colorCurve[s * 4 + 3] = color.a;
+	}
+}
+
+uint32_t WParticlesBehavior::_UpdateRange(float curTime, float deltaTime, uint32_t begin, uint32_t end) {
+	uint32_t n = end - begin;
+	const WParticlesKernels* kernels = WParticlesKernels::GetBest();
+	uint8_t alive[W_PARTICLES_BATCH_SIZE];
+	uint32_t numAlive = kernels->Age(curTime, &m_particles.spawnTime[begin], &m_particles.lifetime[begin], &m_particles.age[begin], alive, n);
+	if (numAlive < n) {
+		for (auto array : m_particles.GetArrays())
+			kernels->Compact(&(*array)[begin], alive, n);
 	}
+	if (numAlive > 0)
+		UpdateBatch(curTime, deltaTime, begin, begin + numAlive);
+	return numAlive;
+}
+
+void WParticlesBehavior::_MoveParticles(uint32_t from, uint32_t to, uint32_t count) {
+	if (from == to || count == 0)
+		return;
+	for (auto array : m_particles.GetArrays())
+		memmove(&(*array)[to], &(*array)[from], count * sizeof(float));
+}
+
+void WParticlesBehavior::UpdateBatch(float curTime, float deltaTime, uint32_t begin, uint32_t end) {
+	uint32_t n = end - begin;
+	const float* spawnTime = &m_particles.spawnTime[begin];
+	const float* age = &m_particles.age[begin];
+	const WParticlesKernels* kernels = WParticlesKernels::GetBest();
+	kernels->Integrate(curTime, deltaTime, spawnTime, &m_particles.velX[begin], &m_particles.posX[begin], n);
+	kernels->Integrate(curTime, deltaTime, spawnTime, &m_particles.velY[begin], &m_particles.posY[begin], n);
+	kernels->Integrate(curTime, deltaTime, spawnTime, &m_particles.velZ[begin], &m_particles.posZ[begin], n);
+	_SizeCurveKernel(m_sizeCurve.x, m_sizeCurve.y, age, &m_particles.size[begin], n);
+	_ColorCurveKernel(m_colorCurve.data(), age,
+		&m_particles.colorR[begin], &m_particles.colorG[begin], &m_particles.colorB[begin], &m_particles.colorA[begin], n);
+}
+
+float WParticlesBehavior::_BeginUpdate(float curTime, const WMatrix& worldMatrix, WCamera* camera) {
+	UpdateSystem(curTime, worldMatrix, camera);
+
+	float deltaTime = std::max(curTime - m_lastUpdateTime, 0.0f);
+	m_lastUpdateTime = curTime;
+	return deltaTime;
+}
+
+void WParticlesBehavior::_EndUpdate(uint32_t numParticles) {
+	m_particles.count = numParticles;
+
+	// the bounding box is kept while there are no particles
+	if (numParticles > 0) {
+		m_minPoint = WVector3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+		m_maxPoint = WVector3(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+		_BoundsKernel(m_particles.posX.data(), m_particles.posY.data(), m_particles.posZ.data(), numParticles, m_minPoint, m_maxPoint);
+	}
+}
+
+void WParticlesBehavior::_CopyRange(void* buffer, const WMatrix& view, const WMatrix& worldView, uint32_t begin, uint32_t end) const {
+	WParticlesInstance* instances = reinterpret_cast<WParticlesInstance*>(buffer);
+	_WriteInstancesKernel(view, worldView, m_sizeInViewSpace, m_particles, begin, end - begin, instances + begin);
 }
 
 uint32_t WParticlesBehavior::UpdateAndCopyToBuffer(float curTime, void* buffer, uint32_t maxParticles, const WMatrix& worldMatrix, WCamera* camera) {
 	UNREFERENCED_PARAMETER(maxParticles);
 
-	UpdateSystem(curTime, worldMatrix, camera);
+	float deltaTime = _BeginUpdate(curTime, worldMatrix, camera);
 
-	for (uint32_t i = 0; i < m_numParticles; i++) {
-		void* curParticleData = (char*)m_particlesData + (m_particleSize * i);
-		WParticlesInstance* outputStart = (reinterpret_cast<WParticlesInstance*>(buffer)) + i;
-		if (!UpdateParticle(curTime, curParticleData, outputStart, worldMatrix, camera)) {
-			if (m_numParticles > 1) {
-				// put the last particle in this particle's place, then decrementing m_numParticles effectively removes this particle
-				memcpy(curParticleData, (char*)m_particlesData + (m_particleSize * (m_numParticles - 1)), m_particleSize);
-				memcpy(outputStart, reinterpret_cast<WParticlesInstance*>(buffer) + (m_numParticles - 1), sizeof(WParticlesInstance));
-			}
-			m_numParticles--;
-			i--;
-		}
+	// update every batch, then close the gap its dead particles left
+	uint32_t numParticles = 0;
+	for (uint32_t begin = 0; begin < m_particles.count; begin += W_PARTICLES_BATCH_SIZE) {
+		uint32_t end = std::min(begin + W_PARTICLES_BATCH_SIZE, m_particles.count);
+		uint32_t numAlive = _UpdateRange(curTime, deltaTime, begin, end);
+		_MoveParticles(begin, numParticles, numAlive);
+		numParticles += numAlive;
 	}
+	_EndUpdate(numParticles);
+
+	WMatrix view = camera->GetViewMatrix();
+	WMatrix worldView = worldMatrix * view;
+	for (uint32_t begin = 0; begin < numParticles; begin += W_PARTICLES_BATCH_SIZE)
+		_CopyRange(buffer, view, worldView, begin, std::min(begin + W_PARTICLES_BATCH_SIZE, numParticles));
+
+	return numParticles;
+}
+
+bool WParticlesBehavior::UpdateGPUSimulation(float curTime, W_PARTICLES_GPU_SIMULATION* simulation) {
+	UNREFERENCED_PARAMETER(curTime);
+	UNREFERENCED_PARAMETER(simulation);
+	return false;
+}
+
+uint32_t WParticlesBehavior::GetNumParticles() const {
+	return m_particles.count;
+}
 
-	return m_numParticles;
+WVector3& WParticlesBehavior::GetMinPoint() {
+	return m_minPoint;
+}
+
+WVector3& WParticlesBehavior::GetMaxPoint() {
+	return m_maxPoint;
+}
+
+/**
+ * Checks whether two color gradients are identical.
+ */
+static bool _SameGradient(const std::vector<std::pair<WColor, float>>& g1, const std::vector<std::pair<WColor, float>>& g2) {
+	if (g1.size() != g2.size())
+		return false;
+	for (uint32_t i = 0; i < g1.size(); i++) {
+		if (g1[i].first.r != g2[i].first.r || g1[i].first.g != g2[i].first.g || g1[i].first.b != g2[i].first.b ||
+			g1[i].first.a != g2[i].first.a || g1[i].second != g2[i].second)
+			return false;
+	}
+	return true;
 }
 
-WDefaultParticleBehavior::WDefaultParticleBehavior(uint32_t maxParticles)
-	: WParticlesBehavior(maxParticles, sizeof(WDefaultParticleBehavior::Particle)) {
+WDefaultParticleBehavior::WDefaultParticleBehavior(uint32_t maxParticles, uint32_t randomSeed)
+	: WParticlesBehavior(maxParticles) {
 	m_lastEmit = 0.0f;
 	m_emissionPosition = WVector3(0.0f, 0.0f, 0.0f);
 	m_emissionRandomness = WVector3(1.0f, 1.0f, 1.0f);
@@ -142,96 +467,119 @@ WDefaultParticleBehavior::WDefaultParticleBehavior(uint32_t maxParticles)
 		std::make_pair(WColor(1.0f, 1.0f, 1.0f, 1.0f), 0.8f),
 		std::make_pair(WColor(1.0f, 1.0f, 1.0f, 0.0f), 0.0f)
 	};
-	// initially infinite bounding box
-	m_minPoint = WVector3(std::numeric_limits<float>::min(), std::numeric_limits<float>::min(), std::numeric_limits<float>::min());
-	m_maxPoint = WVector3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	m_gpuSimulation = false;
+	// spread the seed over the state, xorshift32 never leaves a zero state
+	m_randomState = randomSeed * 2654435761u + 0x9E3779B9u;
+	if (m_randomState == 0)
+		m_randomState = 1;
+}
+
+uint32_t WDefaultParticleBehavior::_Random() {
+	// xorshift32
+	m_randomState ^= m_randomState << 13;
+	m_randomState ^= m_randomState >> 17;
+	m_randomState ^= m_randomState << 5;
+	return m_randomState;
+}
+
+void WDefaultParticleBehavior::_UpdateCurves() {
+	// the color curve is only sampled again when the gradient changes
+	if (!_SameGradient(m_colorGradient, m_sampledGradient)) {
+		SetColorCurve(m_colorGradient);
+		m_sampledGradient = m_colorGradient;
+	}
+	m_sizeCurve = WVector2(m_emissionSize, m_deathSize);
+	m_sizeInViewSpace = m_type == WDefaultParticleBehavior::Type::BILLBOARD;
+}
+
+uint32_t WDefaultParticleBehavior::_GetNumTilesRows() const {
+	return (uint)(ceilf((float)m_numTiles / (float)m_numTilesColumns) + 0.01f);
 }
 
 void WDefaultParticleBehavior::UpdateSystem(float curTime, const WMatrix& worldMatrix, WCamera* camera) {
 	UNREFERENCED_PARAMETER(worldMatrix);
 	UNREFERENCED_PARAMETER(camera);
 
-	uint32_t numTilesRows = (uint)(ceilf((float)m_numTiles / (float)m_numTilesColumns) + 0.01f);
-	int num_emitted = 0;
-	while (curTime > m_lastEmit + 1.0f / m_emissionFrequency && num_emitted++ < 10) {
+	_UpdateCurves();
+
+	float spawnTimes[10];
+	uint32_t numToEmit = 0;
+	while (curTime > m_lastEmit + 1.0f / m_emissionFrequency && numToEmit < 10) {
 		m_lastEmit += 1.0f / m_emissionFrequency;
-		Particle p = {};
-		p.initialPos = m_emissionPosition + m_emissionRandomness * WVector3(WUtil::frand_0_1() - 0.5f, WUtil::frand_0_1() - 0.5f, WUtil::frand_0_1() - 0.5f);
-		p.velocity = m_particleSpawnVelocity;
-		p.spawnTime = m_lastEmit;
-		if (m_moveOutwards)
-			p.velocity = WVec3Normalize(p.initialPos - m_emissionPosition) * WVec3Length(m_particleSpawnVelocity);
+		spawnTimes[numToEmit++] = m_lastEmit;
+	}
+
+	uint32_t numTilesRows = _GetNumTilesRows();
+	float speed = WVec3Length(m_particleSpawnVelocity);
+	uint32_t first = Emit(numToEmit);
+	for (uint32_t i = first; i < m_particles.count; i++) {
+		WVector3 offset = WVector3((float)(_Random() >> 8), (float)(_Random() >> 8), (float)(_Random() >> 8)) / 16777216.0f - WVector3(0.5f, 0.5f, 0.5f);
+		WVector3 pos = m_emissionPosition + m_emissionRandomness * offset;
+		WVector3 velocity = m_moveOutwards ? WVec3Normalize(pos - m_emissionPosition) * speed : m_particleSpawnVelocity;
+		m_particles.posX[i] = pos.x;
+		m_particles.posY[i] = pos.y;
+		m_particles.posZ[i] = pos.z;
+		m_particles.velX[i] = velocity.x;
+		m_particles.velY[i] = velocity.y;
+		m_particles.velZ[i] = velocity.z;
+		m_particles.spawnTime[i] = spawnTimes[i - first];
+		m_particles.lifetime[i] = m_particleLife;
 
 		// calculate tiling
-		uint32_t x = rand() % m_numTilesColumns;
-		uint32_t y = rand() % numTilesRows;
-		p.UVTopLeft = WVector2((float)x / m_numTilesColumns, (float)y / m_numTilesColumns);
-		p.UVBottomRight = WVector2((float)(x+1) / m_numTilesColumns, (float)(y + 1) / m_numTilesColumns);
-		Emit((void*)&p);
+		uint32_t x = _Random() % m_numTilesColumns;
+		uint32_t y = _Random() % numTilesRows;
+		m_particles.uvLeft[i] = (float)x / m_numTilesColumns;
+		m_particles.uvTop[i] = (float)y / m_numTilesColumns;
+		m_particles.uvRight[i] = (float)(x + 1) / m_numTilesColumns;
+		m_particles.uvBottom[i] = (float)(y + 1) / m_numTilesColumns;
 	}
-
-	// flip those and update them in UpdateParticle
-	m_minPoint = WVector3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-	m_maxPoint = WVector3(std::numeric_limits<float>::min(), std::numeric_limits<float>::min(), std::numeric_limits<float>::min());
 }
 
-inline bool WDefaultParticleBehavior::UpdateParticle(float curTime, void* particleData, WParticlesInstance* outputInstance, const WMatrix& worldMatrix, WCamera* camera) {
-	WDefaultParticleBehavior::Particle* p = (WDefaultParticleBehavior::Particle*)particleData;
-	float lifePercentage = (curTime - p->spawnTime) / m_particleLife;
-	if (lifePercentage >= 1.0f)
+bool WDefaultParticleBehavior::UpdateGPUSimulation(float curTime, W_PARTICLES_GPU_SIMULATION* simulation) {
+	if (!m_gpuSimulation)
 		return false;
 
-	float size = WUtil::flerp(m_emissionSize, m_deathSize, lifePercentage);
-	WVector3 particlePosition = p->initialPos + lifePercentage * m_particleLife * p->velocity;
-	WColor particleColor;
-	float curColorPos = 0.0f;
-	for (uint32_t i = 0; i < m_colorGradient.size() - 1; i++) {
-		if (lifePercentage < curColorPos + m_colorGradient[i].second) {
-			particleColor = WColorLerp(m_colorGradient[i].first, m_colorGradient[i + 1].first, (lifePercentage - curColorPos) / m_colorGradient[i].second);
-			break;
-		}
-		curColorPos += m_colorGradient[i].second;
-	}
-
-	/*
-	 * The geometry is a nova by default (a plain facing up, pointing to Z+).
-	 * Scaling is done in the vertex shader (to decide billboard vs nova)
-	 */
-	WVector3 particleWroldPosition = WVec3TransformCoord(particlePosition, worldMatrix);
-	WMatrix transformation = WTranslationMatrix(particleWroldPosition) * camera->GetViewMatrix();
-	outputInstance->SetParameters(transformation, particleColor, p->UVTopLeft, p->UVBottomRight,
-		m_type == WDefaultParticleBehavior::Type::BILLBOARD ? 0.0f : size,
-		m_type == WDefaultParticleBehavior::Type::BILLBOARD ? size : 0.0f
-	);
-
-	m_minPoint.x = std::min(m_minPoint.x, particleWroldPosition.x);
-	m_minPoint.y = std::min(m_minPoint.y, particleWroldPosition.y);
-	m_minPoint.z = std::min(m_minPoint.z, particleWroldPosition.z);
-	m_maxPoint.x = std::max(m_maxPoint.x, particleWroldPosition.x);
-	m_maxPoint.y = std::max(m_maxPoint.y, particleWroldPosition.y);
-	m_maxPoint.z = std::max(m_maxPoint.z, particleWroldPosition.z);
-
-	return true;
-}
+	_UpdateCurves();
 
-inline WVector3& WDefaultParticleBehavior::GetMinPoint() {
-	return m_minPoint;
-}
+	// the particles that would already be dead are not emitted
+	uint32_t numToEmit = 0;
+	float period = 1.0f / m_emissionFrequency;
+	if (m_emissionFrequency > 0.0f) {
+		m_lastEmit = std::max(m_lastEmit, curTime - m_particleLife);
+		numToEmit = (uint32_t)std::max(floorf((curTime - m_lastEmit) * m_emissionFrequency), 0.0f);
+	}
 
-inline WVector3& WDefaultParticleBehavior::GetMaxPoint() {
-	return m_maxPoint;
+	simulation->numEmitted = numToEmit;
+	simulation->randomSeed = _Random();
+	simulation->firstSpawnTime = m_lastEmit + period;
+	simulation->emissionPeriod = period;
+	simulation->emissionPosition = m_emissionPosition;
+	simulation->emissionRandomness = m_emissionRandomness;
+	simulation->spawnVelocity = m_particleSpawnVelocity;
+	simulation->moveOutwards = m_moveOutwards;
+	simulation->lifetime = m_particleLife;
+	simulation->numTilesColumns = std::max(m_numTilesColumns, 1u);
+	simulation->numTilesRows = std::max(_GetNumTilesRows(), 1u);
+	simulation->sizeCurve = m_sizeCurve;
+	simulation->sizeInViewSpace = m_sizeInViewSpace;
+	simulation->colorCurve = m_colorCurve.data();
+
+	m_lastEmit += (float)numToEmit * period;
+	return true;
 }
 
 WParticlesManager::WParticlesManager(class Wasabi* const app)
 	: WManager<WParticles>(app) {
 	m_vertexShader = nullptr;
 	m_fragmentShader = nullptr;
+	m_simulationFX = nullptr;
 	m_plainGeometry = nullptr;
 }
 
 WParticlesManager::~WParticlesManager() {
 	W_SAFE_REMOVEREF(m_vertexShader);
 	W_SAFE_REMOVEREF(m_fragmentShader);
+	W_SAFE_REMOVEREF(m_simulationFX);
 	W_SAFE_REMOVEREF(m_plainGeometry);
 }
 
@@ -249,13 +597,27 @@ WError WParticlesManager::Load() {
 	m_app->FileManager->AddDefaultAsset(m_fragmentShader->GetName(), m_fragmentShader);
 	m_fragmentShader->Load();
 
+	WShader* computeShader = new ParticlesCS(m_app);
+	computeShader->SetName("DefaultParticlesCS");
+	m_app->FileManager->AddDefaultAsset(computeShader->GetName(), computeShader);
+	computeShader->Load();
+	m_simulationFX = new WEffect(m_app);
+	m_simulationFX->SetName("DefaultParticlesSimulationFX");
+	m_app->FileManager->AddDefaultAsset(m_simulationFX->GetName(), m_simulationFX);
+	WError err = m_simulationFX->BindShader(computeShader);
+	if (err)
+		err = m_simulationFX->BuildPipelineAsync(nullptr);
+	W_SAFE_REMOVEREF(computeShader);
+	if (!err)
+		return err;
+
 	m_plainGeometry = new PositionOnlyGeometry(m_app);
 	WParticlesVertex vertices[4];
 	vertices[0].pos = WVector3(-1.0f, 0.0f,  1.0f) * 0.5f;
 	vertices[1].pos = WVector3( 1.0f, 0.0f,  1.0f) * 0.5f;
 	vertices[2].pos = WVector3(-1.0f, 0.0f, -1.0f) * 0.5f;
 	vertices[3].pos = WVector3( 1.0f, 0.0f, -1.0f) * 0.5f;
-	WError err = m_plainGeometry->CreateFromData(static_cast<void*>(vertices), 4, nullptr, 0, W_GEOMETRY_CREATE_STATIC);
+	err = m_plainGeometry->CreateFromData(static_cast<void*>(vertices), 4, nullptr, 0, W_GEOMETRY_CREATE_STATIC);
 	if (err != W_SUCCEEDED) {
 		return err;
 	}
@@ -263,6 +625,93 @@ WError WParticlesManager::Load() {
 	return WError(W_SUCCEEDED);
 }
 
+void WParticlesManager::_CreateBatches() {
+	m_batches.clear();
+	for (uint32_t u = 0; u < m_updates.size(); u++) {
+		uint32_t count = m_updates[u].particles->m_behavior->m_particles.count;
+		m_updates[u].firstBatch = (uint32_t)m_batches.size();
+		for (uint32_t begin = 0; begin < count; begin += W_PARTICLES_BATCH_SIZE)
+			m_batches.push_back({ u, begin, std::min(begin + W_PARTICLES_BATCH_SIZE, count), 0 });
+		m_updates[u].numBatches = (uint32_t)m_batches.size() - m_updates[u].firstBatch;
+	}
+}
+
+void WParticlesManager::Update(WRenderTarget* rt) {
+	m_updates.clear();
+	uint32_t numEntities = GetEntitiesCount();
+	for (uint32_t i = 0; i < numEntities; i++) {
+		WParticles* particles = GetEntityByIndex(i);
+		if (particles)
+			particles->m_updated = false;
+	}
+	if (!rt || !rt->GetCamera())
+		return;
+
+	WCamera* camera = rt->GetCamera();
+	WMatrix view = camera->GetViewMatrix();
+	float curTime = m_app->Timer.GetElapsedTime();
+
+	// the instance buffers are mapped and the world matrices are computed on this thread, the systems
+	// simulated on the GPU are updated by their own compute work
+	for (uint32_t i = 0; i < numEntities; i++) {
+		WParticles* particles = GetEntityByIndex(i);
+		if (!particles || particles->m_gpuSimulating || !particles->WillRender(rt))
+			continue;
+		PARTICLES_UPDATE update = {};
+		if (!particles->m_instancesTexture->MapPixels(&update.instances, W_MAP_WRITE))
+			continue;
+		update.particles = particles;
+		update.worldMatrix = particles->GetWorldMatrix();
+		update.worldView = update.worldMatrix * view;
+		m_updates.push_back(update);
+	}
+	if (m_updates.size() == 0)
+		return;
+
+	// every system emits its particles, then all the batches of all the systems are updated together
+	m_app->ThreadPool.ParallelFor((uint32_t)m_updates.size(), 1, [this, curTime, camera](uint32_t begin, uint32_t end) {
+		for (uint32_t u = begin; u < end; u++)
+			m_updates[u].deltaTime = m_updates[u].particles->m_behavior->_BeginUpdate(curTime, m_updates[u].worldMatrix, camera);
+	});
+	_CreateBatches();
+	m_app->ThreadPool.ParallelFor((uint32_t)m_batches.size(), 1, [this, curTime](uint32_t begin, uint32_t end) {
+		for (uint32_t b = begin; b < end; b++) {
+			PARTICLES_BATCH& batch = m_batches[b];
+			const PARTICLES_UPDATE& update = m_updates[batch.update];
+			batch.numAlive = update.particles->m_behavior->_UpdateRange(curTime, update.deltaTime, batch.begin, batch.end);
+		}
+	});
+
+	// every system closes the gaps its dead particles left
+	m_app->ThreadPool.ParallelFor((uint32_t)m_updates.size(), 1, [this](uint32_t begin, uint32_t end) {
+		for (uint32_t u = begin; u < end; u++) {
+			WParticlesBehavior* behavior = m_updates[u].particles->m_behavior;
+			uint32_t numParticles = 0;
+			for (uint32_t b = m_updates[u].firstBatch; b < m_updates[u].firstBatch + m_updates[u].numBatches; b++) {
+				behavior->_MoveParticles(m_batches[b].begin, numParticles, m_batches[b].numAlive);
+				numParticles += m_batches[b].numAlive;
+			}
+			behavior->_EndUpdate(numParticles);
+		}
+	});
+
+	// the instances of all the batches of the live particles are written together
+	_CreateBatches();
+	m_app->ThreadPool.ParallelFor((uint32_t)m_batches.size(), 1, [this, &view](uint32_t begin, uint32_t end) {
+		for (uint32_t b = begin; b < end; b++) {
+			const PARTICLES_BATCH& batch = m_batches[b];
+			const PARTICLES_UPDATE& update = m_updates[batch.update];
+			update.particles->m_behavior->_CopyRange(update.instances, view, update.worldView, batch.begin, batch.end);
+		}
+	});
+
+	for (auto& update : m_updates) {
+		update.particles->m_instancesTexture->UnmapPixels();
+		update.particles->m_numUpdatedParticles = update.particles->m_behavior->GetNumParticles();
+		update.particles->m_updated = true;
+	}
+}
+
 class WEffect* WParticlesManager::CreateParticlesEffect(W_DEFAULT_PARTICLE_EFFECT_TYPE type) const {
 	VkPipelineColorBlendAttachmentState blendState = {};
 	VkPipelineRasterizationStateCreateInfo rasterizationState = {};
@@ -360,6 +809,14 @@ WParticles::WParticles(class Wasabi* const app, W_DEFAULT_PARTICLE_EFFECT_TYPE t
 
 	m_behavior = nullptr;
 	m_instancesTexture = nullptr;
+	m_updated = false;
+	m_numUpdatedParticles = 0;
+
+	m_gpuSimulating = false;
+	m_gpuSimulated = false;
+	m_gpuLastTime = 0.0f;
+	m_gpuSource = 0;
+	m_gpuMaterial = nullptr;
 
 	app->ParticlesManager->AddEntity(this);
 }
@@ -392,6 +849,54 @@ void WParticles::SetName(std::string newName) {
 void WParticles::_DestroyResources() {
 	W_SAFE_DELETE(m_behavior);
 	W_SAFE_REMOVEREF(m_instancesTexture);
+	m_updated = false;
+
+	W_SAFE_REMOVEREF(m_gpuMaterial);
+	m_gpuParticles.Destroy(m_app);
+	m_gpuState.Destroy(m_app);
+	m_gpuDrawArgs.Destroy(m_app);
+	for (auto image : m_gpuInstances)
+		W_SAFE_REMOVEREF(image);
+	m_gpuInstances.clear();
+	m_gpuSimulating = false;
+	m_gpuSimulated = false;
+}
+
+WError WParticles::_CreateGPUResources() {
+	for (auto image : m_gpuInstances)
+		W_SAFE_REMOVEREF(image);
+	m_gpuInstances.clear();
+
+	uint32_t numBuffers = m_app->GetEngineParam<uint32_t>("bufferingCount");
+	if (m_gpuParticles.Create(m_app, 1, 2 * (size_t)m_maxParticles * sizeof(WParticlesGPUParticle), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) != VK_SUCCESS ||
+		m_gpuState.Create(m_app, 1, sizeof(WParticlesGPUState), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT) != VK_SUCCESS ||
+		m_gpuDrawArgs.Create(m_app, numBuffers, sizeof(VkDrawIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT) != VK_SUCCESS)
+		return WError(W_OUTOFMEMORY);
+
+	// the instances are written in a compute shader and fetched by the vertex shader, so they have a single mip
+	int oldMips = m_app->GetEngineParam<int>("numGeneratedMips");
+	m_app->SetEngineParam<int>("numGeneratedMips", 1);
+	for (uint32_t i = 0; i < numBuffers; i++) {
+		WImage* image = m_app->ImageManager->CreateImage(nullptr, m_instancesTexture->GetWidth(), m_instancesTexture->GetHeight(),
+			VK_FORMAT_R32G32B32A32_SFLOAT, W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_STORAGE);
+		if (!image)
+			break;
+		m_gpuInstances.push_back(image);
+	}
+	m_app->SetEngineParam<int>("numGeneratedMips", oldMips);
+	if (m_gpuInstances.size() != numBuffers)
+		return WError(W_OUTOFMEMORY);
+
+	m_gpuMaterial = m_app->ParticlesManager->m_simulationFX->CreateMaterial(0);
+	if (!m_gpuMaterial)
+		return WError(W_OUTOFMEMORY);
+	m_gpuMaterial->SetName(m_name + "-Simulation");
+	m_gpuMaterial->SetStorageBuffer("particles", &m_gpuParticles);
+	m_gpuMaterial->SetStorageBuffer("state", &m_gpuState);
+	m_gpuMaterial->SetStorageBuffer("drawArgs", &m_gpuDrawArgs);
+	m_gpuMaterial->SetVariable<uint32_t>("maxParticles", m_maxParticles);
+
+	return WError(W_SUCCEEDED);
 }
 
 WParticlesBehavior* WParticles::GetBehavior() const {
@@ -458,7 +963,7 @@ WError WParticles::Create(uint32_t maxParticles, WParticlesBehavior* behavior) {
 		return WError(W_OUTOFMEMORY);
 	}
 
-	m_behavior = behavior ? behavior : new WDefaultParticleBehavior(maxParticles);
+	m_behavior = behavior ? behavior : new WDefaultParticleBehavior(maxParticles, GetID());
 	m_maxParticles = maxParticles;
 
 	return WError(W_SUCCEEDED);
@@ -466,23 +971,128 @@ WError WParticles::Create(uint32_t maxParticles, WParticlesBehavior* behavior) {
 
 bool WParticles::WillRender(WRenderTarget* rt) {
 	if (Valid() && !m_hidden)
-		return !m_bFrustumCull || InCameraView(rt->GetCamera());
+		return !m_bFrustumCull || m_gpuSimulating || InCameraView(rt->GetCamera());
 	return false;
 }
 
+WError WParticles::RecordSimulation(WRenderer* renderer, VkCommandBuffer cmdBuf, WRenderTarget* rt) {
+	m_gpuSimulated = false;
+	if (!Valid() || m_hidden)
+		return WError(W_SUCCEEDED);
+
+	float curTime = m_app->Timer.GetElapsedTime();
+	W_PARTICLES_GPU_SIMULATION simulation = {};
+	bool wasSimulating = m_gpuSimulating;
+	m_gpuSimulating = m_behavior->UpdateGPUSimulation(curTime, &simulation);
+	if (!m_gpuSimulating)
+		return WError(W_SUCCEEDED);
+
+	if (!m_gpuMaterial) {
+		WError err = _CreateGPUResources();
+		if (!err) {
+			m_gpuSimulating = false;
+			return err;
+		}
+	}
+
+	WEffect* fx = m_app->ParticlesManager->m_simulationFX;
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	WImage* instances = m_gpuInstances[bufferIndex];
+	WMatrix view = rt->GetCamera()->GetViewMatrix();
+	float deltaTime = wasSimulating ? std::max(curTime - m_gpuLastTime, 0.0f) : 0.0f;
+	m_gpuLastTime = curTime;
+
+	m_gpuMaterial->SetTexture("instances", instances);
+	m_gpuMaterial->SetVariable<WMatrix>("worldView", GetWorldMatrix() * view);
+	m_gpuMaterial->SetVariable<WMatrix>("view", view);
+	m_gpuMaterial->SetVariable<WVector4>("emissionPosition", WVector4(simulation.emissionPosition.x, simulation.emissionPosition.y, simulation.emissionPosition.z, simulation.lifetime));
+	m_gpuMaterial->SetVariable<WVector4>("emissionRandomness", WVector4(simulation.emissionRandomness.x, simulation.emissionRandomness.y, simulation.emissionRandomness.z, simulation.moveOutwards ? 1.0f : 0.0f));
+	m_gpuMaterial->SetVariable<WVector4>("spawnVelocity", WVector4(simulation.spawnVelocity.x, simulation.spawnVelocity.y, simulation.spawnVelocity.z, WVec3Length(simulation.spawnVelocity)));
+	m_gpuMaterial->SetVariable<WVector4>("time", WVector4(curTime, deltaTime, simulation.firstSpawnTime, simulation.emissionPeriod));
+	m_gpuMaterial->SetVariable<WVector4>("sizes", WVector4(simulation.sizeCurve.x, simulation.sizeCurve.y, simulation.sizeInViewSpace ? 1.0f : 0.0f, 0.0f));
+	uint32_t emission[4] = { simulation.numEmitted, simulation.randomSeed, simulation.numTilesColumns, simulation.numTilesRows };
+	m_gpuMaterial->SetVariableArray<uint32_t>("emission", emission, 4);
+	m_gpuMaterial->SetVariableData("colorCurve", (void*)simulation.colorCurve, W_PARTICLES_COLOR_CURVE_SIZE * 4 * sizeof(float));
+	m_gpuMaterial->SetVariable<uint32_t>("source", m_gpuSource);
+	m_gpuMaterial->SetVariable<uint32_t>("reset", wasSimulating ? 0 : 1);
+
+	// wait for the simulation of the previous frame (recorded on the same queue), and move the instances image to
+	// the general layout the first time it's used (its previous contents are not needed)
+	bool firstUse = instances->GetViewLayout() != VK_IMAGE_LAYOUT_GENERAL;
+	VkImageMemoryBarrier imageBarrier = instances->GetLayoutTransitionBarrier(VK_IMAGE_LAYOUT_GENERAL, firstUse);
+	imageBarrier.srcAccessMask = 0;
+	imageBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0,
+		1, &barrier, 0, nullptr, firstUse ? 1 : 0, &imageBarrier);
+
+	WError err = fx->BindCompute(cmdBuf);
+	if (!err)
+		return err;
+
+	m_gpuMaterial->SetVariable<uint32_t>("pass", W_PARTICLES_GPU_PASS_BEGIN);
+	err = m_gpuMaterial->BindCompute(cmdBuf);
+	if (!err)
+		return err;
+	fx->Dispatch(cmdBuf, 1);
+	_ComputeBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+
+	m_gpuMaterial->SetVariable<uint32_t>("pass", W_PARTICLES_GPU_PASS_SIMULATE);
+	err = m_gpuMaterial->BindCompute(cmdBuf, false, true);
+	if (!err)
+		return err;
+	fx->DispatchIndirect(cmdBuf, m_gpuState.GetBuffer(m_app, 0), offsetof(WParticlesGPUState, dispatchArgs));
+	_ComputeBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	m_gpuMaterial->SetVariable<uint32_t>("pass", W_PARTICLES_GPU_PASS_END);
+	err = m_gpuMaterial->BindCompute(cmdBuf, false, true);
+	if (!err)
+		return err;
+	fx->Dispatch(cmdBuf, 1);
+
+	// the vertex shader fetches the instances and the draw reads its parameters
+	renderer->TransferComputeBuffer(m_gpuDrawArgs.GetBuffer(m_app, bufferIndex), VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	renderer->TransferComputeImage(imageBarrier.image, imageBarrier.subresourceRange, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	m_gpuSource = 1 - m_gpuSource;
+	m_gpuSimulated = true;
+	return WError(W_SUCCEEDED);
+}
+
 void WParticles::Render(WRenderTarget* const rt, WMaterial* material) {
+	if (m_gpuSimulating) {
+		// the particles are only drawn in the frames they are simulated in
+		if (!m_gpuSimulated)
+			return;
+		if (material) {
+			material->SetTexture("instancingTexture", m_gpuInstances[m_app->GetCurrentBufferingIndex()]);
+			material->SetVariable<WMatrix>("projection", rt->GetCamera()->GetProjectionMatrix());
+			material->Bind(rt);
+		}
+		m_app->ParticlesManager->m_plainGeometry->DrawIndirect(rt, m_gpuDrawArgs.GetBuffer(m_app, m_app->GetCurrentBufferingIndex()));
+		return;
+	}
+
 	if (material) {
 		material->SetTexture("instancingTexture", m_instancesTexture);
 		material->SetVariable<WMatrix>("projection", rt->GetCamera()->GetProjectionMatrix());
 		material->Bind(rt);
 	}
 
-	// update the geometry
-	void* instances;
-	m_instancesTexture->MapPixels(&instances, W_MAP_WRITE);
-	float curTime = m_app->Timer.GetElapsedTime();
-	uint32_t numParticles = m_behavior->UpdateAndCopyToBuffer(curTime, instances, m_maxParticles, GetWorldMatrix(), rt->GetCamera());
-	m_instancesTexture->UnmapPixels();
+	// update the geometry, unless WParticlesManager::Update() already did in this frame
+	uint32_t numParticles = m_numUpdatedParticles;
+	if (!m_updated) {
+		void* instances;
+		m_instancesTexture->MapPixels(&instances, W_MAP_WRITE);
+		float curTime = m_app->Timer.GetElapsedTime();
+		numParticles = m_behavior->UpdateAndCopyToBuffer(curTime, instances, m_maxParticles, GetWorldMatrix(), rt->GetCamera());
+		m_instancesTexture->UnmapPixels();
+	}
+	m_updated = false;
 
 	if (numParticles > 0)
 		m_app->ParticlesManager->m_plainGeometry->Draw(rt, UINT32_MAX, numParticles, false);
@@ -0,0 +1,199 @@
+#include "Wasabi/Particles/WParticlesKernels.hpp"
+
+#if W_X86
+#include <immintrin.h>
+#endif
+
+static uint32_t _AgeScalar(float curTime, const float* __restrict spawnTime, const float* __restrict lifetime, float* __restrict age, uint8_t* __restrict alive, uint32_t n) {
+	uint32_t numAlive = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		age[i] = (curTime - spawnTime[i]) / lifetime[i];
+		alive[i] = age[i] < 1.0f ? 1 : 0;
+		numAlive += alive[i];
+	}
+	return numAlive;
+}
+
+static void _CompactScalar(float* values, const uint8_t* __restrict alive, uint32_t n) {
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		values[kept] = values[i];
+		kept += alive[i];
+	}
+}
+
+static void _IntegrateScalar(float curTime, float deltaTime, const float* __restrict spawnTime, const float* __restrict vel, float* __restrict pos, uint32_t n) {
+	for (uint32_t i = 0; i < n; i++)
+		pos[i] += vel[i] * std::min(deltaTime, curTime - spawnTime[i]);
+}
+
+static const WParticlesKernels g_scalarKernels = { _AgeScalar, _CompactScalar, _IntegrateScalar };
+
+#if W_X86
+
+/**
+ * Lookup tables indexed by a mask of live particles (bit i set when particle
+ * i of a group is alive).
+ */
+struct W_PARTICLES_KERNEL_TABLES {
+	/** The alive flags of the mask, one byte per particle */
+	uint64_t aliveFlags[256];
+	/** Number of bits set in the mask */
+	uint8_t numAlive[256];
+	/** For 8 particles, the lanes of the live particles packed to the front */
+	int32_t lanes8[256][8];
+	/** For 4 particles, the bytes of the live particles packed to the front */
+	uint8_t bytes4[16][16];
+
+	W_PARTICLES_KERNEL_TABLES() {
+		memset(this, 0, sizeof(*this));
+		for (uint32_t mask = 0; mask < 256; mask++) {
+			uint32_t count = 0;
+			for (uint32_t lane = 0; lane < 8; lane++) {
+				if (mask & (1 << lane)) {
+					aliveFlags[mask] |= 1ull << (lane * 8);
+					lanes8[mask][count] = (int32_t)lane;
+					if (mask < 16) {
+						for (uint32_t b = 0; b < 4; b++)
+							bytes4[mask][count * 4 + b] = (uint8_t)(lane * 4 + b);
+					}
+					count++;
+				}
+			}
+			numAlive[mask] = (uint8_t)count;
+		}
+	}
+};
+
+static const W_PARTICLES_KERNEL_TABLES& _GetTables() {
+	static const W_PARTICLES_KERNEL_TABLES tables;
+	return tables;
+}
+
+W_TARGET_SSE41 static uint32_t _AgeSSE41(float curTime, const float* __restrict spawnTime, const float* __restrict lifetime, float* __restrict age, uint8_t* __restrict alive, uint32_t n) {
+	const W_PARTICLES_KERNEL_TABLES& tables = _GetTables();
+	const __m128 time = _mm_set1_ps(curTime);
+	const __m128 one = _mm_set1_ps(1.0f);
+	uint32_t numAlive = 0;
+	uint32_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 a = _mm_div_ps(_mm_sub_ps(time, _mm_loadu_ps(&spawnTime[i])), _mm_loadu_ps(&lifetime[i]));
+		_mm_storeu_ps(&age[i], a);
+		uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(a, one));
+		memcpy(&alive[i], &tables.aliveFlags[mask], 4);
+		numAlive += tables.numAlive[mask];
+	}
+	return numAlive + _AgeScalar(curTime, &spawnTime[i], &lifetime[i], &age[i], &alive[i], n - i);
+}
+
+W_TARGET_SSE41 static void _CompactSSE41(float* values, const uint8_t* __restrict alive, uint32_t n) {
+	const W_PARTICLES_KERNEL_TABLES& tables = _GetTables();
+	const __m128i zero = _mm_setzero_si128();
+	uint32_t kept = 0;
+	uint32_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		int32_t flags;
+		memcpy(&flags, &alive[i], 4);
+		__m128i live = _mm_cmpgt_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(flags)), zero);
+		uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(live));
+		// the store covers at most the group that was just loaded, so it can't
+		// overwrite values that are not read yet
+		__m128i v = _mm_castps_si128(_mm_loadu_ps(&values[i]));
+		__m128i packed = _mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i*)tables.bytes4[mask]));
+		_mm_storeu_ps(&values[kept], _mm_castsi128_ps(packed));
+		kept += tables.numAlive[mask];
+	}
+	for (; i < n; i++) {
+		values[kept] = values[i];
+		kept += alive[i];
+	}
+}
+
+W_TARGET_SSE41 static void _IntegrateSSE41(float curTime, float deltaTime, const float* __restrict spawnTime, const float* __restrict vel, float* __restrict pos, uint32_t n) {
+	const __m128 time = _mm_set1_ps(curTime);
+	const __m128 delta = _mm_set1_ps(deltaTime);
+	uint32_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		// min(a, b) is a < b ? a : b, the same as std::min(deltaTime, elapsed)
+		__m128 elapsed = _mm_min_ps(_mm_sub_ps(time, _mm_loadu_ps(&spawnTime[i])), delta);
+		_mm_storeu_ps(&pos[i], _mm_add_ps(_mm_loadu_ps(&pos[i]), _mm_mul_ps(_mm_loadu_ps(&vel[i]), elapsed)));
+	}
+	_IntegrateScalar(curTime, deltaTime, &spawnTime[i], &vel[i], &pos[i], n - i);
+}
+
+W_TARGET_AVX2 static uint32_t _AgeAVX2(float curTime, const float* __restrict spawnTime, const float* __restrict lifetime, float* __restrict age, uint8_t* __restrict alive, uint32_t n) {
+	const W_PARTICLES_KERNEL_TABLES& tables = _GetTables();
+	const __m256 time = _mm256_set1_ps(curTime);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	uint32_t numAlive = 0;
+	uint32_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 a = _mm256_div_ps(_mm256_sub_ps(time, _mm256_loadu_ps(&spawnTime[i])), _mm256_loadu_ps(&lifetime[i]));
+		_mm256_storeu_ps(&age[i], a);
+		uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(a, one, _CMP_LT_OQ));
+		memcpy(&alive[i], &tables.aliveFlags[mask], 8);
+		numAlive += tables.numAlive[mask];
+	}
+	return numAlive + _AgeScalar(curTime, &spawnTime[i], &lifetime[i], &age[i], &alive[i], n - i);
+}
+
+W_TARGET_AVX2 static void _CompactAVX2(float* values, const uint8_t* __restrict alive, uint32_t n) {
+	const W_PARTICLES_KERNEL_TABLES& tables = _GetTables();
+	const __m256i zero = _mm256_setzero_si256();
+	uint32_t kept = 0;
+	uint32_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i live = _mm256_cmpgt_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&alive[i])), zero);
+		uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(live));
+		// the store covers at most the group that was just loaded, so it can't
+		// overwrite values that are not read yet
+		__m256 packed = _mm256_permutevar8x32_ps(_mm256_loadu_ps(&values[i]), _mm256_loadu_si256((const __m256i*)tables.lanes8[mask]));
+		_mm256_storeu_ps(&values[kept], packed);
+		kept += tables.numAlive[mask];
+	}
+	for (; i < n; i++) {
+		values[kept] = values[i];
+		kept += alive[i];
+	}
+}
+
+W_TARGET_AVX2 static void _IntegrateAVX2(float curTime, float deltaTime, const float* __restrict spawnTime, const float* __restrict vel, float* __restrict pos, uint32_t n) {
+	const __m256 time = _mm256_set1_ps(curTime);
+	const __m256 delta = _mm256_set1_ps(deltaTime);
+	uint32_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		// no FMA, so that the results match the scalar kernel exactly
+		__m256 elapsed = _mm256_min_ps(_mm256_sub_ps(time, _mm256_loadu_ps(&spawnTime[i])), delta);
+		_mm256_storeu_ps(&pos[i], _mm256_add_ps(_mm256_loadu_ps(&pos[i]), _mm256_mul_ps(_mm256_loadu_ps(&vel[i]), elapsed)));
+	}
+	_IntegrateScalar(curTime, deltaTime, &spawnTime[i], &vel[i], &pos[i], n - i);
+}
+
+static const WParticlesKernels g_sse41Kernels = { _AgeSSE41, _CompactSSE41, _IntegrateSSE41 };
+static const WParticlesKernels g_avx2Kernels = { _AgeAVX2, _CompactAVX2, _IntegrateAVX2 };
+
+#endif
+
+const WParticlesKernels* WParticlesKernels::Get(W_PARTICLES_KERNELS_ISA isa) {
+	if (isa == W_PARTICLES_KERNELS_SCALAR)
+		return &g_scalarKernels;
+#if W_X86
+	if (isa == W_PARTICLES_KERNELS_SSE41 && WUtil::CPUSupportsSSE41())
+		return &g_sse41Kernels;
+	if (isa == W_PARTICLES_KERNELS_AVX2 && WUtil::CPUSupportsAVX2())
+		return &g_avx2Kernels;
+#endif
+	return nullptr;
+}
+
+const WParticlesKernels* WParticlesKernels::GetBest() {
+	static const WParticlesKernels* best = []() {
+		const WParticlesKernels* kernels = Get(W_PARTICLES_KERNELS_AVX2);
+		if (!kernels)
+			kernels = Get(W_PARTICLES_KERNELS_SSE41);
+		if (!kernels)
+			kernels = Get(W_PARTICLES_KERNELS_SCALAR);
+		return kernels;
+	}();
+	return best;
+}
@@ -0,0 +1,42 @@
+// Crowd animation (see WCrowdAnimation.hpp for the layout of the baked animation texture).
+// Requires object_utils.glsl, global_frame.glsl and effect_features.glsl to be included first.
+
+// Finds where an instance is in its crowd animation clip. The clip, time offset and speed of the
+// instance are in the 4th pixel of its entry in the instancing texture. Returns the first matrices of
+// the two samples around the instance's time (x and y) and the blend factor between them (z)
+vec3 SampleCrowdAnimation(
+	in int instance,
+	in sampler2D instancingTexture,
+	in sampler2D animationTexture
+) {
+	if (!isCrowdAnimated)
+		return vec3(0.0f);
+
+	int animationTextureWidth = textureSize(animationTexture, 0).x;
+	vec4 instanceAnimation = LoadVector4FromTexture(4 * instance + 3, instancingTexture, textureSize(instancingTexture, 0).x);
+	float numBones = LoadVector4FromTexture(0, animationTexture, animationTextureWidth).x;
+	vec4 clip = LoadVector4FromTexture(1 + int(instanceAnimation.x), animationTexture, animationTextureWidth);
+
+	float phase = (uboGlobalFrame.time.x * instanceAnimation.z + instanceAnimation.y) / clip.z;
+	phase = clip.w > 0.5f ? fract(phase) : clamp(phase, 0.0f, 1.0f);
+	float samplePos = phase * clip.y;
+	float firstSample = min(floor(samplePos), clip.y - 1.0f);
+	float firstMatrix = clip.x + firstSample * numBones;
+	return vec3(firstMatrix, firstMatrix + numBones, samplePos - firstSample);
+}
+
+// Loads the matrix of a bone from the animation texture. For a crowd animation, the matrix is blended
+// from the two samples found by SampleCrowdAnimation()
+mat4x4 LoadBoneMatrix(
+	in int bone,
+	in vec3 crowdSample,
+	in sampler2D animationTexture,
+	in int textureWidth
+) {
+	if (!isCrowdAnimated)
+		return LoadMatrixFromTexture(bone, animationTexture, textureWidth);
+
+	mat4x4 m1 = LoadMatrixFromTexture(int(crowdSample.x) + bone, animationTexture, textureWidth);
+	mat4x4 m2 = LoadMatrixFromTexture(int(crowdSample.y) + bone, animationTexture, textureWidth);
+	return m1 * (1.0f - crowdSample.z) + m2 * crowdSample.z;
+}
@@ -0,0 +1,6 @@
+// Feature flags of an effect's pipeline variant (see W_EFFECT_FEATURE_FLAGS). The
+// constant with constant_id = N is true iff bit N is set in the variant's flags, or
+// keeps the default below if the effect doesn't build variants for that feature.
+layout(constant_id = 0) const bool isInstanced = false;
+layout(constant_id = 1) const bool isTextured = true;
+layout(constant_id = 2) const bool isCrowdAnimated = false;
@@ -0,0 +1,27 @@
+// Engine-wide per-frame UBO, written once per frame by the renderer and bound
+// automatically by WEffect::Bind(). Must match W_GLOBAL_FRAME_DATA and
+// WRenderer::GetGlobalFrameBoundResource() (set = W_GLOBAL_FRAME_SET_INDEX).
+layout(set = 2, binding = 0) uniform UBOGlobalFrame {
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 viewProjectionMatrix;
+	mat4 projectionInverseMatrix;
+	vec4 camPosW; // w: near clip plane
+	vec4 camDirW; // w: far clip plane
+	vec4 time; // x: elapsed time, y: delta time, z: frame index
+	vec4 resolution; // xy: screen size, zw: 1 / screen size
+	vec4 resolutionScale; // xy: fraction of the screen rendered by dynamic resolution stages, zw: size of that region
+	int numLights;
+} uboGlobalFrame;
+
+// Renderer-owned scene objects buffer, indexed by the stable index each object
+// gets from WRenderer::AllocateSceneObject(). Must match W_SCENE_OBJECT_DATA
+// (binding = W_SCENE_OBJECTS_BINDING_INDEX).
+struct SceneObject {
+	mat4 worldMatrix;
+	mat4 normalMatrix; // inverse transpose of worldMatrix
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer SceneObjects {
+	SceneObject objects[];
+} sceneObjects;
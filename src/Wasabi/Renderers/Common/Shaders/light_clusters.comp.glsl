@@ -0,0 +1,164 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Fills the clusters and light indices buffers of WLightClusters, see WLightClusters::RecordBuild. Every pass
+// computes exactly what the CPU version (WLightClusters::_BuildClusters) computes.
+
+// must match W_LIGHT_CLUSTERS_X, W_LIGHT_CLUSTERS_Y and W_LIGHT_CLUSTERS_Z
+#define NUM_CLUSTERS_X 16
+#define NUM_CLUSTERS_Y 9
+#define NUM_CLUSTERS_Z 24
+#define NUM_CLUSTERS (NUM_CLUSTERS_X * NUM_CLUSTERS_Y * NUM_CLUSTERS_Z)
+
+// must match W_LIGHT_CLUSTERS_GROUP_SIZE
+#define GROUP_SIZE 64
+#define CLUSTERS_PER_THREAD ((NUM_CLUSTERS + GROUP_SIZE - 1) / GROUP_SIZE)
+
+// passes, see W_LIGHT_CLUSTERS_PASS
+#define PASS_COUNT 0
+#define PASS_OFFSETS 1
+#define PASS_FILL 2
+
+layout(local_size_x = GROUP_SIZE) in;
+
+// cluster range of every clustered light (closest first), x is the first cluster and y is the last one, both
+// packed as x | y << 8 | z << 16
+layout(std430, set = 0, binding = 0) readonly buffer LightRanges {
+	uvec2 ranges[];
+} lightRanges;
+
+// offset and count of the lights of every cluster, the count pass writes the uncapped counts
+layout(std430, set = 0, binding = 1) buffer Clusters {
+	uvec2 clusters[];
+} clusters;
+
+layout(std430, set = 0, binding = 2) writeonly buffer LightIndices {
+	uint indices[];
+} lightIndices;
+
+layout(push_constant) uniform PushConstant {
+	uint pass;
+	uint numLights; // number of clustered lights
+	uint firstLightIndex; // index of the first clustered light in the lights buffer
+	uint maxLightIndices; // capacity of lightIndices
+} pcBuild;
+
+shared uint sharedValues[GROUP_SIZE];
+
+uvec3 ClusterCoordinates(uint cluster) {
+	return uvec3(cluster % NUM_CLUSTERS_X, (cluster / NUM_CLUSTERS_X) % NUM_CLUSTERS_Y, cluster / (NUM_CLUSTERS_X * NUM_CLUSTERS_Y));
+}
+
+bool LightTouchesCluster(uint light, uvec3 cluster) {
+	uvec2 range = lightRanges.ranges[light];
+	uvec3 minCluster = uvec3(range.x, range.x >> 8, range.x >> 16) & 0xFF;
+	uvec3 maxCluster = uvec3(range.y, range.y >> 8, range.y >> 16) & 0xFF;
+	return all(greaterThanEqual(cluster, minCluster)) && all(lessThanEqual(cluster, maxCluster));
+}
+
+// reduces a value over the threads of the group, all the threads must call it and get the result
+uint GroupReduce(uint value, bool isMax) {
+	sharedValues[gl_LocalInvocationIndex] = value;
+	memoryBarrierShared();
+	barrier();
+	for (uint stride = GROUP_SIZE / 2; stride > 0; stride /= 2) {
+		if (gl_LocalInvocationIndex < stride) {
+			uint other = sharedValues[gl_LocalInvocationIndex + stride];
+			uint mine = sharedValues[gl_LocalInvocationIndex];
+			sharedValues[gl_LocalInvocationIndex] = isMax ? max(mine, other) : mine + other;
+		}
+		memoryBarrierShared();
+		barrier();
+	}
+	uint result = sharedValues[0];
+	barrier();
+	return result;
+}
+
+void main() {
+	if (pcBuild.pass == PASS_COUNT) {
+		// one thread per cluster
+		uint cluster = gl_GlobalInvocationID.x;
+		if (cluster >= NUM_CLUSTERS)
+			return;
+		uvec3 coordinates = ClusterCoordinates(cluster);
+		uint count = 0;
+		for (uint i = 0; i < pcBuild.numLights; i++) {
+			if (LightTouchesCluster(i, coordinates))
+				count++;
+		}
+		clusters.clusters[cluster] = uvec2(0, count);
+	} else if (pcBuild.pass == PASS_OFFSETS) {
+		// a single group, every thread owns a contiguous run of clusters
+		uint first = min(gl_LocalInvocationIndex * CLUSTERS_PER_THREAD, NUM_CLUSTERS);
+		uint last = min(first + CLUSTERS_PER_THREAD, NUM_CLUSTERS);
+
+		uint threadTotal = 0;
+		uint threadMax = 0;
+		for (uint c = first; c < last; c++) {
+			uint count = clusters.clusters[c].y;
+			threadTotal += count;
+			threadMax = max(threadMax, count);
+		}
+		uint maxClusterLights = GroupReduce(threadMax, true);
+
+		// if the indices list overflows, find the largest per-cluster cap that fits (the results of GroupReduce are
+		// the same in all the threads, so they all take the same branches)
+		if (GroupReduce(threadTotal, false) > pcBuild.maxLightIndices) {
+			uint minCap = 0;
+			uint maxCap = maxClusterLights;
+			while (minCap < maxCap) {
+				uint cap = (minCap + maxCap + 1) / 2;
+				uint threadCapped = 0;
+				for (uint c = first; c < last; c++)
+					threadCapped += min(clusters.clusters[c].y, cap);
+				if (GroupReduce(threadCapped, false) <= pcBuild.maxLightIndices)
+					minCap = cap;
+				else
+					maxCap = cap - 1;
+			}
+			maxClusterLights = minCap;
+		}
+
+		// exclusive prefix sum of the capped counts of the threads' runs, then of the clusters of every run
+		uint threadCapped = 0;
+		for (uint c = first; c < last; c++)
+			threadCapped += min(clusters.clusters[c].y, maxClusterLights);
+		sharedValues[gl_LocalInvocationIndex] = threadCapped;
+		memoryBarrierShared();
+		barrier();
+		if (gl_LocalInvocationIndex == 0) {
+			uint offset = 0;
+			for (uint i = 0; i < GROUP_SIZE; i++) {
+				uint runCount = sharedValues[i];
+				sharedValues[i] = offset;
+				offset += runCount;
+			}
+		}
+		memoryBarrierShared();
+		barrier();
+
+		uint offset = sharedValues[gl_LocalInvocationIndex];
+		for (uint c = first; c < last; c++) {
+			uint count = min(clusters.clusters[c].y, maxClusterLights);
+			clusters.clusters[c] = uvec2(offset, count);
+			offset += count;
+		}
+	} else if (pcBuild.pass == PASS_FILL) {
+		// one thread per cluster, lights are added closest first so capped clusters keep their closest lights
+		uint cluster = gl_GlobalInvocationID.x;
+		if (cluster >= NUM_CLUSTERS)
+			return;
+		uvec3 coordinates = ClusterCoordinates(cluster);
+		uvec2 list = clusters.clusters[cluster];
+		uint numAdded = 0;
+		for (uint i = 0; i < pcBuild.numLights && numAdded < list.y; i++) {
+			if (LightTouchesCluster(i, coordinates)) {
+				lightIndices.indices[list.x + numAdded] = pcBuild.firstLightIndex + i;
+				numAdded++;
+			}
+		}
+	}
+}
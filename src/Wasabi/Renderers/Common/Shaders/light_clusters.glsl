@@ -0,0 +1,95 @@
+// Clustered lighting, the light lists are built by WLightClusters (see WLightClusters.hpp for
+// the layout of the buffers). utils.glsl, object_utils.glsl, global_frame.glsl and shadows.glsl
+// must be included before this file, and W_LIGHT_CLUSTERS_SET and W_LIGHT_CLUSTERS_BINDING must
+// be defined to the descriptor set and first binding of the lights, clusters and light indices
+// buffers (in consecutive bindings). If W_LIGHT_CLUSTERS_LIGHTS_ONLY is defined, only the lights
+// buffer is declared (W_LIGHT_CLUSTERS_BUILD_LIGHTS_ONLY) and global_frame.glsl is not needed.
+
+// see WLightClusters::LIGHT_DATA
+struct WasabiClusteredLight {
+	vec4 color; // rgb: color, a: intensity
+	vec4 direction; // xyz: L vector, w: range
+	vec4 position; // xyz: position, w: min cosine angle
+	uvec4 shadow; // x: type, y: first shadow tile, z: number of shadow tiles
+};
+
+layout(std430, set = W_LIGHT_CLUSTERS_SET, binding = W_LIGHT_CLUSTERS_BINDING) readonly buffer LightsBuffer {
+	WasabiClusteredLight lights[];
+} lightsBuffer;
+
+// Returns the lighting of a pixel from one light of the lights buffer, the specular term is
+// already multiplied by specularIntensity
+vec3 WasabiClusteredLightContribution(
+	in uint lightIndex,
+	in vec3 pixelPos,
+	in vec3 pixelNorm,
+	in vec3 camDir,
+	in float specularPower,
+	in float specularIntensity,
+	in sampler2D shadowAtlas,
+	in sampler2D shadowTilesTexture
+) {
+	WasabiClusteredLight clusteredLight = lightsBuffer.lights[lightIndex];
+	vec4 lightColor = clusteredLight.color;
+	vec4 lightDir = clusteredLight.direction;
+	vec4 lightPos = clusteredLight.position;
+	uvec4 lightShadow = clusteredLight.shadow; // type, first shadow tile, number of shadow tiles
+	uint lightType = lightShadow.x;
+
+	vec4 light;
+	if (lightType == 0) {
+		light = WasabiDirectionalLight(pixelPos, pixelNorm, camDir, specularPower, lightDir.xyz, lightColor.rgb);
+	} else if (lightType == 1) {
+		light = WasabiPointLight(pixelPos, pixelNorm, camDir, specularPower, lightPos.xyz, lightColor.rgb, lightDir.a);
+	} else {
+		light = WasabiSpotLight(pixelPos, pixelNorm, camDir, specularPower, lightPos.xyz, lightDir.xyz, lightColor.rgb, lightDir.a, lightPos.a);
+	}
+	if (lightShadow.z > 0 && dot(light.rgb, light.rgb) > 0.0f)
+		light *= WasabiShadowFactor(pixelPos, int(lightShadow.y), int(lightShadow.z), shadowAtlas, shadowTilesTexture);
+	return light.rgb * lightColor.a + light.rgb * light.a * specularIntensity;
+}
+
+#ifndef W_LIGHT_CLUSTERS_LIGHTS_ONLY
+
+layout(std430, set = W_LIGHT_CLUSTERS_SET, binding = W_LIGHT_CLUSTERS_BINDING + 1) readonly buffer ClustersBuffer {
+	uvec2 clusters[]; // offset and count of the lights of every cluster
+} clustersBuffer;
+
+layout(std430, set = W_LIGHT_CLUSTERS_SET, binding = W_LIGHT_CLUSTERS_BINDING + 2) readonly buffer LightIndicesBuffer {
+	uint indices[];
+} lightIndicesBuffer;
+
+// Returns the lighting of a pixel from the lights of its cluster (and all directional lights).
+// rgb is the total lighting and the specular terms are already multiplied by specularIntensity
+vec3 WasabiClusteredLighting(
+	in vec3 pixelPos,
+	in vec3 pixelNorm,
+	in float specularPower,
+	in float specularIntensity,
+	in uvec4 clusterGrid, // xyz: number of clusters, w: number of directional lights
+	in vec4 clusterDepth, // slice of view-space depth d is log(d) * x - y
+	in sampler2D shadowAtlas,
+	in sampler2D shadowTilesTexture
+) {
+	vec3 camDir = uboGlobalFrame.camDirW.xyz;
+
+	// find the cluster of this pixel (same mapping as WLightClusters::_GetClusterRange)
+	vec4 viewPos = uboGlobalFrame.viewMatrix * vec4(pixelPos, 1.0f);
+	vec4 clipPos = uboGlobalFrame.projectionMatrix * viewPos;
+	vec2 tile = clamp((clipPos.xy / clipPos.w * 0.5f + 0.5f) * vec2(clusterGrid.xy), vec2(0.0f), vec2(clusterGrid.xy) - 1.0f);
+	float slice = clamp(log(max(viewPos.z, 0.0001f)) * clusterDepth.x - clusterDepth.y, 0.0f, float(clusterGrid.z) - 1.0f);
+	uvec2 cluster = clustersBuffer.clusters[(uint(slice) * clusterGrid.y + uint(tile.y)) * clusterGrid.x + uint(tile.x)];
+
+	// directional lights are first in the lights buffer, then the cluster's lights
+	uint numLights = clusterGrid.w + cluster.y;
+	vec3 totalLighting = vec3(0, 0, 0);
+	for (uint i = 0; i < numLights; i++) {
+		uint lightIndex = i;
+		if (i >= clusterGrid.w)
+			lightIndex = lightIndicesBuffer.indices[cluster.x + i - clusterGrid.w];
+		totalLighting += WasabiClusteredLightContribution(lightIndex, pixelPos, pixelNorm, camDir, specularPower, specularIntensity, shadowAtlas, shadowTilesTexture);
+	}
+	return totalLighting;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "object_utils.glsl"
+#include "global_frame.glsl"
+#include "effect_features.glsl"
+#include "crowd_animation.glsl"
+
+layout(location = 0) in vec3 inPos;
+layout(location = 1) in vec3 inTang;
+layout(location = 2) in vec3 inNorm;
+layout(location = 3) in vec2 inUV;
+layout(location = 4) in uint inTexIndex;
+layout(location = 5) in uvec4 inBoneIndex;
+layout(location = 6) in vec4 inBoneWeight;
+
+layout(push_constant) uniform PushConstant {
+	uint objectIndex;
+	mat4 shadowViewProjection;
+} pcPerObject;
+
+layout(set = 0, binding = 2) uniform sampler2D animationTexture;
+layout(set = 0, binding = 3) uniform sampler2D instancingTexture;
+
+void main() {
+	mat4x4 worldMatrix = sceneObjects.objects[pcPerObject.objectIndex].worldMatrix;
+	mat4x4 animMtx = mat4x4(0.0f);
+	mat4x4 instMtx =
+		isInstanced
+		? LoadMatrixFromTexture(gl_InstanceIndex, instancingTexture, textureSize(instancingTexture, 0).x)
+		: mat4x4(1.0f);
+	if (inBoneWeight.x > 0.001f) {
+		int animationTextureWidth = textureSize(animationTexture, 0).x;
+		vec3 crowdSample = SampleCrowdAnimation(gl_InstanceIndex, instancingTexture, animationTexture);
+		animMtx += inBoneWeight.x * LoadBoneMatrix(int(inBoneIndex.x), crowdSample, animationTexture, animationTextureWidth);
+		if (inBoneWeight.y > 0.001f) {
+			animMtx += inBoneWeight.y * LoadBoneMatrix(int(inBoneIndex.y), crowdSample, animationTexture, animationTextureWidth);
+			if (inBoneWeight.z > 0.001f) {
+				animMtx += inBoneWeight.z * LoadBoneMatrix(int(inBoneIndex.z), crowdSample, animationTexture, animationTextureWidth);
+				if (inBoneWeight.w > 0.001f) {
+					animMtx += inBoneWeight.w * LoadBoneMatrix(int(inBoneIndex.w), crowdSample, animationTexture, animationTextureWidth);
+				}
+			}
+		}
+	}
+
+	vec4 localPos1 = animMtx * vec4(inPos.xyz, 1.0);
+	vec4 localPos2 = instMtx * vec4(localPos1.xyz, 1.0);
+	gl_Position = pcPerObject.shadowViewProjection * (worldMatrix * localPos2);
+}
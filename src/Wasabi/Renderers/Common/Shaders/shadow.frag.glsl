@@ -0,0 +1,8 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// shadow maps only need depth
+void main() {
+}
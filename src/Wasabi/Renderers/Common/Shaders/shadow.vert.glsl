@@ -0,0 +1,33 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "object_utils.glsl"
+#include "global_frame.glsl"
+#include "effect_features.glsl"
+
+layout(location = 0) in vec3 inPos;
+layout(location = 1) in vec3 inTang;
+layout(location = 2) in vec3 inNorm;
+layout(location = 3) in vec2 inUV;
+layout(location = 4) in uint inTexIndex;
+
+layout(push_constant) uniform PushConstant {
+	uint objectIndex;
+	mat4 shadowViewProjection;
+} pcPerObject;
+
+layout(set = 0, binding = 3) uniform sampler2D instancingTexture;
+
+void main() {
+	mat4x4 worldMatrix = sceneObjects.objects[pcPerObject.objectIndex].worldMatrix;
+	mat4x4 instMtx =
+		isInstanced
+		? LoadMatrixFromTexture(gl_InstanceIndex, instancingTexture, textureSize(instancingTexture, 0).x)
+		: mat4x4(1.0f);
+
+	vec4 localPos = instMtx * vec4(inPos.xyz, 1.0);
+	gl_Position = pcPerObject.shadowViewProjection * (worldMatrix * vec4(localPos.xyz, 1.0f));
+}
@@ -0,0 +1,59 @@
+// Shadow lookups into the shadow atlas rendered by WShadowRenderStage (see WShadowRenderStage.hpp for
+// the layout of the shadow tiles texture). object_utils.glsl must be included before this file.
+
+// Number of texels per tile in the shadow tiles texture
+#define W_SHADOW_TILE_TEXELS 5
+// Depth bias applied on top of the rasterization depth bias of the shadow maps
+#define W_SHADOW_DEPTH_BIAS 0.0005f
+
+// Returns the fraction (0 to 1) of a light that reaches a world-space position. The light's shadow tiles
+// are tiles [firstTile, firstTile + numTiles) of shadowTilesTexture (cascades are ordered closest first,
+// so the first tile that covers the position is used). Positions outside all tiles are lit
+float WasabiShadowFactor(
+	in vec3 pixelPos,
+	in int firstTile,
+	in int numTiles,
+	in sampler2D shadowAtlas,
+	in sampler2D shadowTilesTexture
+) {
+	int tilesTextureWidth = textureSize(shadowTilesTexture, 0).x;
+	vec2 atlasTexelSize = 1.0f / vec2(textureSize(shadowAtlas, 0));
+
+	for (int tile = firstTile; tile < firstTile + numTiles; tile++) {
+		int baseTexel = tile * W_SHADOW_TILE_TEXELS;
+		mat4 viewProjection = mat4(
+			LoadVector4FromTexture(baseTexel + 0, shadowTilesTexture, tilesTextureWidth),
+			LoadVector4FromTexture(baseTexel + 1, shadowTilesTexture, tilesTextureWidth),
+			LoadVector4FromTexture(baseTexel + 2, shadowTilesTexture, tilesTextureWidth),
+			LoadVector4FromTexture(baseTexel + 3, shadowTilesTexture, tilesTextureWidth)
+		);
+		vec4 clipPos = viewProjection * vec4(pixelPos, 1.0f);
+		if (clipPos.w <= 0.0f)
+			continue;
+		vec3 ndc = clipPos.xyz / clipPos.w;
+		vec2 uv = ndc.xy * 0.5f + 0.5f;
+		if (any(lessThan(uv, vec2(0.0f))) || any(greaterThan(uv, vec2(1.0f))) || ndc.z < 0.0f || ndc.z > 1.0f)
+			continue;
+
+		// xy: offset of the tile in the atlas, zw: size of the tile (zero if the tile was never rendered)
+		vec4 tileRect = LoadVector4FromTexture(baseTexel + 4, shadowTilesTexture, tilesTextureWidth);
+		if (tileRect.z <= 0.0f)
+			return 1.0f;
+
+		// 2x2 percentage-closer filtering, clamped so that neighboring tiles are never sampled
+		vec2 atlasUV = tileRect.xy + uv * tileRect.zw;
+		vec2 minUV = tileRect.xy + atlasTexelSize * 0.5f;
+		vec2 maxUV = tileRect.xy + tileRect.zw - atlasTexelSize * 0.5f;
+		float depth = ndc.z - W_SHADOW_DEPTH_BIAS;
+		float lit = 0.0f;
+		for (int y = 0; y < 2; y++) {
+			for (int x = 0; x < 2; x++) {
+				vec2 sampleUV = clamp(atlasUV + (vec2(x, y) - 0.5f) * atlasTexelSize, minUV, maxUV);
+				lit += texture(shadowAtlas, sampleUV).r >= depth ? 1.0f : 0.0f;
+			}
+		}
+		return lit * 0.25f;
+	}
+
+	return 1.0f;
+}
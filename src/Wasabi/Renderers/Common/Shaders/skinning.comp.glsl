@@ -0,0 +1,92 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "object_utils.glsl"
+
+// one invocation per vertex, must match W_SKINNING_GROUP_SIZE
+layout(local_size_x = 64) in;
+
+// The vertices are read and written as words in the layouts of WDefaultVertex (12 words: position,
+// tangent, normal, UV and texture index) and WDefaultVertex_Animation (8 words: bone indices and weights)
+layout(std430, set = 0, binding = 0) readonly buffer InputVertices {
+	uint words[];
+} inputVertices;
+
+layout(std430, set = 0, binding = 1) readonly buffer InputAnimation {
+	uint words[];
+} inputAnimation;
+
+layout(std430, set = 0, binding = 2) writeonly buffer OutputVertices {
+	uint words[];
+} outputVertices;
+
+layout(set = 0, binding = 3) uniform sampler2D animationTexture;
+
+layout(push_constant) uniform PushConstant {
+	uint numVertices;
+	uint outputOffset;
+} pcSkinning;
+
+vec3 LoadVector3(uint base) {
+	return vec3(
+		uintBitsToFloat(inputVertices.words[base + 0]),
+		uintBitsToFloat(inputVertices.words[base + 1]),
+		uintBitsToFloat(inputVertices.words[base + 2])
+	);
+}
+
+void StoreVector3(uint base, vec3 v) {
+	outputVertices.words[base + 0] = floatBitsToUint(v.x);
+	outputVertices.words[base + 1] = floatBitsToUint(v.y);
+	outputVertices.words[base + 2] = floatBitsToUint(v.z);
+}
+
+void main() {
+	uint vertex = gl_GlobalInvocationID.x;
+	if (vertex >= pcSkinning.numVertices)
+		return;
+
+	uint inBase = vertex * 12;
+	uint animBase = vertex * 8;
+	uint outBase = (pcSkinning.outputOffset + vertex) * 12;
+
+	uvec4 boneIndex = uvec4(
+		inputAnimation.words[animBase + 0],
+		inputAnimation.words[animBase + 1],
+		inputAnimation.words[animBase + 2],
+		inputAnimation.words[animBase + 3]
+	);
+	vec4 boneWeight = vec4(
+		uintBitsToFloat(inputAnimation.words[animBase + 4]),
+		uintBitsToFloat(inputAnimation.words[animBase + 5]),
+		uintBitsToFloat(inputAnimation.words[animBase + 6]),
+		uintBitsToFloat(inputAnimation.words[animBase + 7])
+	);
+
+	// same weighting as the animated vertex shaders, vertices without bones are not moved
+	mat4x4 animMtx = mat4x4(1.0f);
+	if (boneWeight.x > 0.001f) {
+		int animationTextureWidth = textureSize(animationTexture, 0).x;
+		animMtx = boneWeight.x * LoadMatrixFromTexture(int(boneIndex.x), animationTexture, animationTextureWidth);
+		if (boneWeight.y > 0.001f) {
+			animMtx += boneWeight.y * LoadMatrixFromTexture(int(boneIndex.y), animationTexture, animationTextureWidth);
+			if (boneWeight.z > 0.001f) {
+				animMtx += boneWeight.z * LoadMatrixFromTexture(int(boneIndex.z), animationTexture, animationTextureWidth);
+				if (boneWeight.w > 0.001f) {
+					animMtx += boneWeight.w * LoadMatrixFromTexture(int(boneIndex.w), animationTexture, animationTextureWidth);
+				}
+			}
+		}
+	}
+
+	StoreVector3(outBase + 0, (animMtx * vec4(LoadVector3(inBase + 0), 1.0f)).xyz); // position
+	StoreVector3(outBase + 3, (animMtx * vec4(LoadVector3(inBase + 3), 0.0f)).xyz); // tangent
+	StoreVector3(outBase + 6, (animMtx * vec4(LoadVector3(inBase + 6), 0.0f)).xyz); // normal
+	// UV and texture index are copied as they are
+	outputVertices.words[outBase + 9] = inputVertices.words[inBase + 9];
+	outputVertices.words[outBase + 10] = inputVertices.words[inBase + 10];
+	outputVertices.words[outBase + 11] = inputVertices.words[inBase + 11];
+}
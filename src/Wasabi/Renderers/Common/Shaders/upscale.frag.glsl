@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "global_frame.glsl"
+#include "upscale.glsl"
+
+layout(set = 0, binding = 0) uniform sampler2D colorTexture;
+layout(set = 0, binding = 1) uniform sampler2D depthTexture;
+
+layout(location = 0) in vec2 inUV;
+layout(location = 0) out vec4 outFragColor;
+
+void main() {
+	outFragColor = WasabiSampleScaledBicubic(colorTexture, inUV);
+	gl_FragDepth = WasabiSampleScaled(depthTexture, inUV).r;
+}
@@ -0,0 +1,54 @@
+// Sampling of images rendered by dynamic resolution stages, which only fill the top-left region of
+// their targets (see WRenderer::GetResolutionScale()). global_frame.glsl must be included before this file.
+
+// Maps a UV of the full screen to the rendered region
+vec2 WasabiScaledUV(in vec2 uv) {
+	return uv * uboGlobalFrame.resolutionScale.xy;
+}
+
+// Samples an image rendered by a dynamic resolution stage at a UV of the full screen using a Catmull-Rom
+// (bicubic) filter. The filter is done in 9 bilinear taps which are clamped to the rendered region so the
+// rest of the image never bleeds in.
+vec4 WasabiSampleScaledBicubic(in sampler2D tex, in vec2 uv) {
+	if (uboGlobalFrame.resolutionScale.x >= 1.0f && uboGlobalFrame.resolutionScale.y >= 1.0f)
+		return textureLod(tex, uv, 0);
+
+	vec2 texSize = vec2(textureSize(tex, 0));
+	vec2 invTexSize = 1.0f / texSize;
+	vec2 minUV = 0.5f * invTexSize;
+	vec2 maxUV = uboGlobalFrame.resolutionScale.xy - 0.5f * invTexSize;
+
+	vec2 samplePos = WasabiScaledUV(uv) * texSize;
+	vec2 texPos1 = floor(samplePos - 0.5f) + 0.5f;
+	vec2 f = samplePos - texPos1;
+
+	// Catmull-Rom weights of the 4 texels around the sample, the middle two are merged into one bilinear tap
+	vec2 w0 = f * (-0.5f + f * (1.0f - 0.5f * f));
+	vec2 w1 = 1.0f + f * f * (-2.5f + 1.5f * f);
+	vec2 w2 = f * (0.5f + f * (2.0f - 1.5f * f));
+	vec2 w3 = f * f * (-0.5f + 0.5f * f);
+	vec2 w12 = w1 + w2;
+
+	vec2 texPos0 = clamp((texPos1 - 1.0f) * invTexSize, minUV, maxUV);
+	vec2 texPos3 = clamp((texPos1 + 2.0f) * invTexSize, minUV, maxUV);
+	vec2 texPos12 = clamp((texPos1 + w2 / w12) * invTexSize, minUV, maxUV);
+
+	vec4 result = vec4(0.0f);
+	result += textureLod(tex, vec2(texPos0.x, texPos0.y), 0) * w0.x * w0.y;
+	result += textureLod(tex, vec2(texPos12.x, texPos0.y), 0) * w12.x * w0.y;
+	result += textureLod(tex, vec2(texPos3.x, texPos0.y), 0) * w3.x * w0.y;
+	result += textureLod(tex, vec2(texPos0.x, texPos12.y), 0) * w0.x * w12.y;
+	result += textureLod(tex, vec2(texPos12.x, texPos12.y), 0) * w12.x * w12.y;
+	result += textureLod(tex, vec2(texPos3.x, texPos12.y), 0) * w3.x * w12.y;
+	result += textureLod(tex, vec2(texPos0.x, texPos3.y), 0) * w0.x * w3.y;
+	result += textureLod(tex, vec2(texPos12.x, texPos3.y), 0) * w12.x * w3.y;
+	result += textureLod(tex, vec2(texPos3.x, texPos3.y), 0) * w3.x * w3.y;
+	return max(result, vec4(0.0f)); // the negative lobes can undershoot around sharp edges
+}
+
+// Samples an image rendered by a dynamic resolution stage at a UV of the full screen with the image's
+// sampler, clamped to the rendered region (for data that shouldn't be filtered across, like depth)
+vec4 WasabiSampleScaled(in sampler2D tex, in vec2 uv) {
+	vec2 halfTexel = 0.5f / vec2(textureSize(tex, 0));
+	return textureLod(tex, clamp(WasabiScaledUV(uv), halfTexel, uboGlobalFrame.resolutionScale.xy - halfTexel), 0);
+}
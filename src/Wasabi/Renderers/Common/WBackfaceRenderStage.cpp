@@ -25,9 +25,9 @@ WBackfaceDepthRenderStage::WBackfaceDepthRenderStage(Wasabi* const app) : WRende
 	m_stageDescription.name = __func__;
 	m_stageDescription.target = RENDER_STAGE_TARGET_BUFFER;
 	m_stageDescription.depthOutput = WRenderStage::OUTPUT_IMAGE("BackfaceDepth", VK_FORMAT_D16_UNORM, WColor(1.0f, 0.0f, 0.0f, 0.0f));
+	m_stageDescription.depthOutput.transient = true; // only read by the scene composition
+	m_stageDescription.flags = RENDER_STAGE_FLAG_DYNAMIC_RESOLUTION;
 
-	m_perFrameMaterial = nullptr;
-	m_perFrameAnimatedMaterial = nullptr;
 	m_objectsFragment = nullptr;
 	m_animatedObjectsFragment = nullptr;
 }
@@ -40,25 +40,26 @@ WError WBackfaceDepthRenderStage::Initialize(std::vector<WRenderStage*>& previou
 	WForwardRenderStageObjectVS* vs = new WForwardRenderStageObjectVS(m_app);
 	vs->SetName("DefaultBackfaceVS");
 	m_app->FileManager->AddDefaultAsset(vs->GetName(), vs);
-	vs->Load();
 
 	WForwardRenderStageAnimatedObjectVS* vsa = new WForwardRenderStageAnimatedObjectVS(m_app);
 	vsa->SetName("DefaultBackfaceAnimatedVS");
 	m_app->FileManager->AddDefaultAsset(vsa->GetName(), vsa);
-	vsa->Load();
 
 	WBackfaceDepthRenderStageObjectPS* ps = new WBackfaceDepthRenderStageObjectPS(m_app);
 	ps->SetName("DefaultBackfacePS");
 	m_app->FileManager->AddDefaultAsset(ps->GetName(), ps);
-	ps->Load();
+
+	m_app->ShaderManager->LoadShaders({ vs, vsa, ps });
 
 	WEffect* fx = new WEffect(m_app);
 	fx->SetName("DefaultBackfaceEffect");
 	m_app->FileManager->AddDefaultAsset(fx->GetName(), fx);
+	fx->SetSupportedFeatures(EFFECT_FEATURE_INSTANCED); // depth-only, the diffuse texture is never sampled
 
 	WEffect* fxa = new WEffect(m_app);
 	fxa->SetName("DefaultBackfaceAnimatedEffect");
 	m_app->FileManager->AddDefaultAsset(fxa->GetName(), fxa);
+	fxa->SetSupportedFeatures(EFFECT_FEATURE_INSTANCED | EFFECT_FEATURE_CROWD_ANIMATED);
 
 	VkPipelineRasterizationStateCreateInfo rs = {};
 	rs.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -75,14 +76,14 @@ WError WBackfaceDepthRenderStage::Initialize(std::vector<WRenderStage*>& previou
 		err = fx->BindShader(ps);
 		if (err) {
 			fx->SetRasterizationState(rs);
-			err = fx->BuildPipeline(m_renderTarget);
+			err = fx->BuildPipelineAsync(m_renderTarget);
 			if (err) {
 				err = fxa->BindShader(vsa);
 				if (err) {
 					err = fxa->BindShader(ps);
 					if (err) {
 						fxa->SetRasterizationState(rs);
-						err = fxa->BuildPipeline(m_renderTarget);
+						err = fxa->BuildPipelineAsync(m_renderTarget);
 					}
 				}
 			}
@@ -97,49 +98,22 @@ WError WBackfaceDepthRenderStage::Initialize(std::vector<WRenderStage*>& previou
 		return err;
 	}
 
-	m_objectsFragment = new WObjectsRenderFragment(m_stageDescription.name, false, fx, m_app, EFFECT_RENDER_FLAG_RENDER_DEPTH_ONLY);
-	m_animatedObjectsFragment = new WObjectsRenderFragment(m_stageDescription.name + "-animated", true, fxa, m_app, EFFECT_RENDER_FLAG_RENDER_DEPTH_ONLY);
-
-	m_perFrameMaterial = m_objectsFragment->GetEffect()->CreateMaterial(1, true);
-	if (!m_perFrameMaterial) {
-		err = WError(W_ERRORUNK);
-	} else {
-		m_perFrameMaterial->SetName("PerFrameForwardMaterial");
-		m_app->FileManager->AddDefaultAsset(m_perFrameMaterial->GetName(), m_perFrameMaterial);
-	}
-
-	m_perFrameAnimatedMaterial = m_animatedObjectsFragment->GetEffect()->CreateMaterial(1, true);
-	if (!m_perFrameAnimatedMaterial) {
-		err = WError(W_ERRORUNK);
-	} else {
-		m_perFrameAnimatedMaterial->SetName("PerFrameForwardAnimatedMaterial");
-		m_app->FileManager->AddDefaultAsset(m_perFrameAnimatedMaterial->GetName(), m_perFrameAnimatedMaterial);
-	}
+	// objects skinned by a WSkinningRenderStage are rendered with the non-animated effect
+	m_objectsFragment = new WObjectsRenderFragment(m_stageDescription.name, false, fx, m_app, EFFECT_RENDER_FLAG_RENDER_DEPTH_ONLY, true, true);
+	m_animatedObjectsFragment = new WObjectsRenderFragment(m_stageDescription.name + "-animated", true, fxa, m_app, EFFECT_RENDER_FLAG_RENDER_DEPTH_ONLY, true, true);
 
 	return err;
 }
 
 void WBackfaceDepthRenderStage::Cleanup() {
 	WRenderStage::Cleanup();
-	W_SAFE_REMOVEREF(m_perFrameMaterial);
-	W_SAFE_REMOVEREF(m_perFrameAnimatedMaterial);
 	W_SAFE_DELETE(m_objectsFragment);
 	W_SAFE_DELETE(m_animatedObjectsFragment);
 }
 
 WError WBackfaceDepthRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, uint32_t filter) {
 	if (filter & RENDER_FILTER_OBJECTS) {
-		WCamera* cam = rt->GetCamera();
-
-		// create the per-frame UBO data
-		m_perFrameMaterial->SetVariable<WMatrix>("viewMatrix", cam->GetViewMatrix());
-		m_perFrameMaterial->SetVariable<WMatrix>("projectionMatrix", cam->GetProjectionMatrix());
-		m_perFrameMaterial->SetVariable<WVector3>("camDirW", cam->GetLVector());
-
-		m_perFrameAnimatedMaterial->SetVariable<WMatrix>("viewMatrix", cam->GetViewMatrix());
-		m_perFrameAnimatedMaterial->SetVariable<WMatrix>("projectionMatrix", cam->GetProjectionMatrix());
-		m_perFrameAnimatedMaterial->SetVariable<WVector3>("camDirW", cam->GetLVector());
-
+		// the camera matrices come from the renderer's global per-frame UBO
 		m_objectsFragment->Render(renderer, rt);
 
 		m_animatedObjectsFragment->Render(renderer, rt);
@@ -0,0 +1,434 @@
+#include "Wasabi/Renderers/Common/WLightClusters.hpp"
+#include "Wasabi/Renderers/Common/WShadowRenderStage.hpp"
+#include "Wasabi/Materials/WEffect.hpp"
+#include "Wasabi/Materials/WMaterial.hpp"
+#include "Wasabi/Lights/WLight.hpp"
+
+/** Number of clusters handled by a work group of the cluster building shader */
+#define W_LIGHT_CLUSTERS_GROUP_SIZE 64
+
+/** Total number of clusters */
+#define W_LIGHT_CLUSTERS_COUNT (W_LIGHT_CLUSTERS_X * W_LIGHT_CLUSTERS_Y * W_LIGHT_CLUSTERS_Z)
+
+// the cluster ranges of the lights are packed with 8 bits per coordinate
+static_assert(W_LIGHT_CLUSTERS_X <= 256 && W_LIGHT_CLUSTERS_Y <= 256 && W_LIGHT_CLUSTERS_Z <= 256, "Too many light clusters");
+
+/** Passes of the cluster building shader, in the order they are dispatched */
+enum W_LIGHT_CLUSTERS_PASS {
+	/** One thread per cluster counts the lights touching the cluster */
+	W_LIGHT_CLUSTERS_PASS_COUNT = 0,
+	/** A single group caps the counts (if the indices overflow) and computes the offsets of the clusters */
+	W_LIGHT_CLUSTERS_PASS_OFFSETS = 1,
+	/** One thread per cluster writes the indices of the cluster's lights */
+	W_LIGHT_CLUSTERS_PASS_FILL = 2,
+};
+
+class WLightClustersCS : public WShader {
+public:
+	WLightClustersCS(class Wasabi* const app) : WShader(app) {}
+
+	virtual void Load(bool bSaveData = false) {
+		m_desc.type = W_COMPUTE_SHADER;
+		m_desc.bound_resources = {
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 0, 0, "lightRanges"), // cluster ranges of the clustered lights
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 1, 0, "clusters"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 2, 0, "lightIndices"),
+			W_BOUND_RESOURCE(W_TYPE_PUSH_CONSTANT, 0, "pcBuild", {
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "pass"), // see W_LIGHT_CLUSTERS_PASS
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "numLights"), // number of clustered lights
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "firstLightIndex"), // index of the first clustered light in the lights buffer
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "maxLightIndices"), // capacity of the light indices buffer
+			}),
+		};
+		vector<uint8_t> code {
+			#include "Shaders/light_clusters.comp.glsl.spv"
+		};
+		LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+	}
+};
+
+/**
+ * Records a barrier between the compute shader writes recorded so far and the next compute shader accesses.
+ */
+static void _ComputeBarrier(VkCommandBuffer cmdBuf) {
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+WLightClusters::WLightClusters(Wasabi* const app) : m_app(app) {
+	m_maxLights = 0;
+	m_maxLightIndices = 0;
+	m_buildFX = nullptr;
+	m_buildMaterial = nullptr;
+	m_build = W_LIGHT_CLUSTERS_BUILD_CPU;
+	m_shadows = nullptr;
+	m_params = {};
+	m_numLights = 0;
+	m_lastBuiltFrame = -1.0f;
+	m_lastCulledFrame = -1.0f;
+}
+
+WLightClusters::~WLightClusters() {
+	Cleanup();
+}
+
+WError WLightClusters::Initialize(uint32_t maxLights, W_LIGHT_CLUSTERS_BUILD build) {
+	Cleanup();
+
+	m_build = build;
+	m_maxLights = std::max(maxLights, (uint32_t)1);
+	m_maxLightIndices = build == W_LIGHT_CLUSTERS_BUILD_LIGHTS_ONLY ? 0 : W_LIGHT_CLUSTERS_COUNT * W_LIGHT_CLUSTERS_AVERAGE_LIGHTS;
+
+	if (build == W_LIGHT_CLUSTERS_BUILD_COMPUTE) {
+		WShader* cs = new WLightClustersCS(m_app);
+		cs->Load();
+		m_buildFX = new WEffect(m_app);
+		WError err = m_buildFX->BindShader(cs);
+		if (err)
+			err = m_buildFX->BuildPipelineAsync(nullptr);
+		W_SAFE_REMOVEREF(cs);
+		if (err) {
+			m_buildMaterial = m_buildFX->CreateMaterial(0);
+			if (!m_buildMaterial)
+				err = WError(W_OUTOFMEMORY);
+		}
+		if (!err) {
+			Cleanup();
+			return err;
+		}
+	}
+
+	// the lights are written by the CPU every frame, the clusters and indices too unless the compute pass fills them
+	uint32_t numBuffers = m_app->GetEngineParam<uint32_t>("bufferingCount");
+	W_MEMORY_STORAGE clustersMemory = m_buildFX ? W_MEMORY_DEVICE_LOCAL : W_MEMORY_HOST_VISIBLE;
+	VkResult result = m_lights.Create(m_app, numBuffers, m_maxLights * sizeof(LIGHT_DATA), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nullptr, W_MEMORY_HOST_VISIBLE);
+	if (result == VK_SUCCESS && build != W_LIGHT_CLUSTERS_BUILD_LIGHTS_ONLY)
+		result = m_clusters.Create(m_app, numBuffers, W_LIGHT_CLUSTERS_COUNT * 2 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nullptr, clustersMemory);
+	if (result == VK_SUCCESS && build != W_LIGHT_CLUSTERS_BUILD_LIGHTS_ONLY)
+		result = m_lightIndices.Create(m_app, numBuffers, m_maxLightIndices * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nullptr, clustersMemory);
+	if (result == VK_SUCCESS && m_buildFX)
+		result = m_lightRanges.Create(m_app, numBuffers, m_maxLights * 2 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nullptr, W_MEMORY_HOST_VISIBLE);
+	if (result != VK_SUCCESS) {
+		Cleanup();
+		return WError(W_OUTOFMEMORY);
+	}
+
+	if (m_buildMaterial) {
+		m_buildMaterial->SetStorageBuffer("lightRanges", &m_lightRanges);
+		m_buildMaterial->SetStorageBuffer("clusters", &m_clusters);
+		m_buildMaterial->SetStorageBuffer("lightIndices", &m_lightIndices);
+	}
+
+	m_clusterCounts.resize(W_LIGHT_CLUSTERS_COUNT);
+	m_clusterOffsets.resize(W_LIGHT_CLUSTERS_COUNT);
+	m_visibleLights.reserve(m_maxLights);
+	m_lastBuiltFrame = -1.0f;
+	m_lastCulledFrame = -1.0f;
+
+	return WError(W_SUCCEEDED);
+}
+
+void WLightClusters::Cleanup() {
+	W_SAFE_REMOVEREF(m_buildMaterial);
+	W_SAFE_REMOVEREF(m_buildFX);
+	m_lights.Destroy(m_app);
+	m_clusters.Destroy(m_app);
+	m_lightIndices.Destroy(m_app);
+	m_lightRanges.Destroy(m_app);
+	m_numLights = 0;
+}
+
+bool WLightClusters::_GetClusterRange(const W_GLOBAL_FRAME_DATA& frameData, WVector3 viewPos, float range, CLUSTERED_LIGHT* light) const {
+	float nearPlane = frameData.camPosW.w;
+	float farPlane = frameData.camDirW.w;
+	if (viewPos.z + range < nearPlane || viewPos.z - range > farPlane)
+		return false;
+
+	// depth slices (same mapping as light_clusters.glsl)
+	float minZ = std::max(viewPos.z - range, nearPlane);
+	float maxZ = std::min(viewPos.z + range, farPlane);
+	float minSlice = logf(minZ) * m_params.clusterDepth.x - m_params.clusterDepth.y;
+	float maxSlice = logf(maxZ) * m_params.clusterDepth.x - m_params.clusterDepth.y;
+	light->minCluster[2] = (uint32_t)std::min(std::max(minSlice, 0.0f), (float)(W_LIGHT_CLUSTERS_Z - 1));
+	light->maxCluster[2] = (uint32_t)std::min(std::max(maxSlice, 0.0f), (float)(W_LIGHT_CLUSTERS_Z - 1));
+
+	// screen tiles: project the corners of the light's view-space bounding box, the projection of the
+	// box contains the projection of the sphere. If the box crosses the near plane, use the whole screen
+	WVector2 minNDC(-1.0f, -1.0f), maxNDC(1.0f, 1.0f);
+	if (viewPos.z - range > nearPlane) {
+		minNDC = WVector2(FLT_MAX, FLT_MAX);
+		maxNDC = WVector2(-FLT_MAX, -FLT_MAX);
+		for (uint32_t corner = 0; corner < 8; corner++) {
+			WVector3 c = viewPos + WVector3(corner & 1 ? range : -range, corner & 2 ? range : -range, corner & 4 ? range : -range);
+			WVector3 ndc = WVec3TransformCoord(c, frameData.projectionMatrix);
+			minNDC = WVector2(std::min(minNDC.x, ndc.x), std::min(minNDC.y, ndc.y));
+			maxNDC = WVector2(std::max(maxNDC.x, ndc.x), std::max(maxNDC.y, ndc.y));
+		}
+		if (minNDC.x > 1.0f || minNDC.y > 1.0f || maxNDC.x < -1.0f || maxNDC.y < -1.0f)
+			return false;
+	}
+
+	const float gridSize[2] = { (float)W_LIGHT_CLUSTERS_X, (float)W_LIGHT_CLUSTERS_Y };
+	const float ndcMin[2] = { minNDC.x, minNDC.y };
+	const float ndcMax[2] = { maxNDC.x, maxNDC.y };
+	for (uint32_t axis = 0; axis < 2; axis++) {
+		float tileMin = (ndcMin[axis] * 0.5f + 0.5f) * gridSize[axis];
+		float tileMax = (ndcMax[axis] * 0.5f + 0.5f) * gridSize[axis];
+		light->minCluster[axis] = (uint32_t)std::min(std::max(tileMin, 0.0f), gridSize[axis] - 1.0f);
+		light->maxCluster[axis] = (uint32_t)std::min(std::max(tileMax, 0.0f), gridSize[axis] - 1.0f);
+	}
+
+	return true;
+}
+
+void WLightClusters::_CullLights(const W_GLOBAL_FRAME_DATA& frameData) {
+	if (m_lastCulledFrame == frameData.time.z)
+		return;
+	m_lastCulledFrame = frameData.time.z;
+
+	float nearPlane = std::max(frameData.camPosW.w, 0.0001f);
+	float farPlane = std::max(frameData.camDirW.w, nearPlane * 1.001f);
+	float logDepthRange = logf(farPlane / nearPlane);
+	m_params.clusterGrid[0] = W_LIGHT_CLUSTERS_X;
+	m_params.clusterGrid[1] = W_LIGHT_CLUSTERS_Y;
+	m_params.clusterGrid[2] = W_LIGHT_CLUSTERS_Z;
+	m_params.clusterDepth = WVector4(
+		(float)W_LIGHT_CLUSTERS_Z / logDepthRange,
+		(float)W_LIGHT_CLUSTERS_Z * logf(nearPlane) / logDepthRange,
+		0.0f, 0.0f);
+
+	//
+	// Cull the lights and find the clusters each light touches
+	//
+	m_visibleLights.clear();
+	m_directionalLights.clear();
+	for (uint32_t i = 0; ; i++) {
+		WLight* light = m_app->LightManager->GetEntityByIndex(i);
+		if (!light)
+			break;
+		if (light->Hidden())
+			continue;
+
+		if (light->GetType() == W_LIGHT_DIRECTIONAL) {
+			m_directionalLights.push_back(light);
+			continue;
+		}
+
+		// spot lights are clustered using the sphere around their range, which contains their cone
+		WVector3 viewPos = WVec3TransformCoord(light->GetPosition(), frameData.viewMatrix);
+		CLUSTERED_LIGHT clusteredLight;
+		clusteredLight.light = light;
+		clusteredLight.distance = WVec3Length(viewPos);
+		if (_GetClusterRange(frameData, viewPos, light->GetRange(), &clusteredLight))
+			m_visibleLights.push_back(clusteredLight);
+	}
+
+	// closest lights first, so that the most relevant lights are kept if there are too many lights (or
+	// too many lights in a cluster)
+	std::sort(m_visibleLights.begin(), m_visibleLights.end(),
+		[](const CLUSTERED_LIGHT& a, const CLUSTERED_LIGHT& b) { return a.distance < b.distance; });
+	if (m_directionalLights.size() > m_maxLights)
+		m_directionalLights.resize(m_maxLights);
+	uint32_t maxClusteredLights = m_maxLights - (uint32_t)m_directionalLights.size();
+	if (m_visibleLights.size() > maxClusteredLights)
+		m_visibleLights.resize(maxClusteredLights);
+
+	m_params.clusterGrid[3] = (uint32_t)m_directionalLights.size();
+	m_numLights = (uint32_t)(m_directionalLights.size() + m_visibleLights.size());
+}
+
+WError WLightClusters::RecordBuild(WRenderer* renderer, VkCommandBuffer cmdBuf, const W_GLOBAL_FRAME_DATA& frameData) {
+	if (!m_buildFX)
+		return WError(W_SUCCEEDED);
+
+	_CullLights(frameData);
+
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	uint32_t* rangesData;
+	if (m_lightRanges.Map(m_app, bufferIndex, (void**)&rangesData, W_MAP_WRITE) != VK_SUCCESS)
+		return WError(W_UNABLETOMAPBUFFER);
+	for (uint32_t i = 0; i < m_visibleLights.size(); i++) {
+		const CLUSTERED_LIGHT& light = m_visibleLights[i];
+		rangesData[i * 2 + 0] = light.minCluster[0] | (light.minCluster[1] << 8) | (light.minCluster[2] << 16);
+		rangesData[i * 2 + 1] = light.maxCluster[0] | (light.maxCluster[1] << 8) | (light.maxCluster[2] << 16);
+	}
+	m_lightRanges.Unmap(m_app, bufferIndex);
+
+	m_buildMaterial->SetVariable<uint32_t>("numLights", (uint32_t)m_visibleLights.size());
+	m_buildMaterial->SetVariable<uint32_t>("firstLightIndex", (uint32_t)m_directionalLights.size());
+	m_buildMaterial->SetVariable<uint32_t>("maxLightIndices", m_maxLightIndices);
+
+	WError err = m_buildFX->BindCompute(cmdBuf);
+	if (!err)
+		return err;
+
+	const uint32_t numGroups = (W_LIGHT_CLUSTERS_COUNT + W_LIGHT_CLUSTERS_GROUP_SIZE - 1) / W_LIGHT_CLUSTERS_GROUP_SIZE;
+	m_buildMaterial->SetVariable<uint32_t>("pass", W_LIGHT_CLUSTERS_PASS_COUNT);
+	err = m_buildMaterial->BindCompute(cmdBuf);
+	if (!err)
+		return err;
+	m_buildFX->Dispatch(cmdBuf, numGroups);
+	_ComputeBarrier(cmdBuf);
+
+	m_buildMaterial->SetVariable<uint32_t>("pass", W_LIGHT_CLUSTERS_PASS_OFFSETS);
+	err = m_buildMaterial->BindCompute(cmdBuf, false, true);
+	if (!err)
+		return err;
+	m_buildFX->Dispatch(cmdBuf, 1);
+	_ComputeBarrier(cmdBuf);
+
+	m_buildMaterial->SetVariable<uint32_t>("pass", W_LIGHT_CLUSTERS_PASS_FILL);
+	err = m_buildMaterial->BindCompute(cmdBuf, false, true);
+	if (!err)
+		return err;
+	m_buildFX->Dispatch(cmdBuf, numGroups);
+
+	// the lighting shaders read the lists
+	renderer->TransferComputeBuffer(m_clusters.GetBuffer(m_app, bufferIndex), VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	renderer->TransferComputeBuffer(m_lightIndices.GetBuffer(m_app, bufferIndex), VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	return WError(W_SUCCEEDED);
+}
+
+void WLightClusters::Build(const W_GLOBAL_FRAME_DATA& frameData) {
+	if (!m_lights.Valid() || m_lastBuiltFrame == frameData.time.z)
+		return;
+	m_lastBuiltFrame = frameData.time.z;
+
+	_CullLights(frameData);
+
+	//
+	// Write the lights buffer, the shadow tiles of the lights are only known once the shadow stage rendered
+	//
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	LIGHT_DATA* lightsData;
+	if (m_lights.Map(m_app, bufferIndex, (void**)&lightsData, W_MAP_WRITE) != VK_SUCCESS)
+		return;
+	for (uint32_t i = 0; i < m_numLights; i++) {
+		WLight* light = i < m_directionalLights.size() ? m_directionalLights[i] : m_visibleLights[i - m_directionalLights.size()].light;
+		WColor c = light->GetColor();
+		WVector3 l = light->GetLVector();
+		WVector3 p = light->GetPosition();
+		lightsData[i].color = WVector4(c.r, c.g, c.b, light->GetIntensity());
+		lightsData[i].direction = WVector4(l.x, l.y, l.z, light->GetRange());
+		lightsData[i].position = WVector4(p.x, p.y, p.z, light->GetMinCosAngle());
+		lightsData[i].type = (uint32_t)light->GetType();
+		lightsData[i].firstShadowTile = 0;
+		lightsData[i].numShadowTiles = 0;
+		lightsData[i].padding = 0;
+		if (m_shadows)
+			m_shadows->GetLightShadowTiles(light, &lightsData[i].firstShadowTile, &lightsData[i].numShadowTiles);
+	}
+	m_lights.Unmap(m_app, bufferIndex);
+
+	// the compute pass fills the lists (see RecordBuild()), if there are any
+	if (m_build != W_LIGHT_CLUSTERS_BUILD_CPU)
+		return;
+
+	uint32_t* clustersData;
+	if (m_clusters.Map(m_app, bufferIndex, (void**)&clustersData, W_MAP_WRITE) != VK_SUCCESS)
+		return;
+	uint32_t* indicesData;
+	if (m_lightIndices.Map(m_app, bufferIndex, (void**)&indicesData, W_MAP_WRITE) != VK_SUCCESS) {
+		m_clusters.Unmap(m_app, bufferIndex);
+		return;
+	}
+	_BuildClusters(clustersData, indicesData);
+	m_lightIndices.Unmap(m_app, bufferIndex);
+	m_clusters.Unmap(m_app, bufferIndex);
+}
+
+void WLightClusters::_BuildClusters(uint32_t* clustersData, uint32_t* indicesData) {
+	//
+	// Count the lights of every cluster, then assign each cluster a range in the indices list
+	//
+	std::fill(m_clusterCounts.begin(), m_clusterCounts.end(), 0);
+	for (auto it = m_visibleLights.begin(); it != m_visibleLights.end(); it++)
+		for (uint32_t z = it->minCluster[2]; z <= it->maxCluster[2]; z++)
+			for (uint32_t y = it->minCluster[1]; y <= it->maxCluster[1]; y++)
+				for (uint32_t x = it->minCluster[0]; x <= it->maxCluster[0]; x++)
+					m_clusterCounts[(z * W_LIGHT_CLUSTERS_Y + y) * W_LIGHT_CLUSTERS_X + x]++;
+
+	// if the indices list overflows, every cluster is capped to the same maximum number of lights (the largest
+	// one that fits, at least W_LIGHT_CLUSTERS_AVERAGE_LIGHTS) so that only the most crowded clusters lose their
+	// furthest lights
+	uint32_t maxClusterLights = 0;
+	uint32_t totalIndices = 0;
+	for (uint32_t i = 0; i < m_clusterCounts.size(); i++) {
+		maxClusterLights = std::max(maxClusterLights, m_clusterCounts[i]);
+		totalIndices += m_clusterCounts[i];
+	}
+	if (totalIndices > m_maxLightIndices) {
+		uint32_t minCap = 0, maxCap = maxClusterLights;
+		while (minCap < maxCap) {
+			uint32_t cap = (minCap + maxCap + 1) / 2;
+			uint32_t numCapped = 0;
+			for (uint32_t i = 0; i < m_clusterCounts.size(); i++)
+				numCapped += std::min(m_clusterCounts[i], cap);
+			if (numCapped <= m_maxLightIndices)
+				minCap = cap;
+			else
+				maxCap = cap - 1;
+		}
+		maxClusterLights = minCap;
+	}
+
+	uint32_t numIndices = 0;
+	for (uint32_t i = 0; i < m_clusterCounts.size(); i++) {
+		uint32_t count = std::min(m_clusterCounts[i], maxClusterLights);
+		clustersData[i * 2 + 0] = numIndices;
+		clustersData[i * 2 + 1] = count;
+		m_clusterOffsets[i] = numIndices;
+		m_clusterCounts[i] = count;
+		numIndices += count;
+	}
+
+	//
+	// Fill the indices list, lights are added closest first so capped clusters keep their closest lights
+	//
+	uint32_t lightIndex = (uint32_t)m_directionalLights.size();
+	for (auto it = m_visibleLights.begin(); it != m_visibleLights.end(); it++, lightIndex++) {
+		for (uint32_t z = it->minCluster[2]; z <= it->maxCluster[2]; z++) {
+			for (uint32_t y = it->minCluster[1]; y <= it->maxCluster[1]; y++) {
+				for (uint32_t x = it->minCluster[0]; x <= it->maxCluster[0]; x++) {
+					uint32_t cluster = (z * W_LIGHT_CLUSTERS_Y + y) * W_LIGHT_CLUSTERS_X + x;
+					if (m_clusterCounts[cluster] > 0) {
+						indicesData[m_clusterOffsets[cluster]++] = lightIndex;
+						m_clusterCounts[cluster]--;
+					}
+				}
+			}
+		}
+	}
+}
+
+void WLightClusters::SetShadows(WShadowRenderStage* shadows) {
+	m_shadows = shadows;
+}
+
+uint32_t WLightClusters::GetNumLights() const {
+	return m_numLights;
+}
+
+WLightClusters::SHADER_PARAMS WLightClusters::GetShaderParams() const {
+	return m_params;
+}
+
+bool WLightClusters::IsComputeBuilt() const {
+	return m_build == W_LIGHT_CLUSTERS_BUILD_COMPUTE;
+}
+
+WBufferedBuffer* WLightClusters::GetLightsBuffer() {
+	return &m_lights;
+}
+
+WBufferedBuffer* WLightClusters::GetClustersBuffer() {
+	return &m_clusters;
+}
+
+WBufferedBuffer* WLightClusters::GetLightIndicesBuffer() {
+	return &m_lightIndices;
+}
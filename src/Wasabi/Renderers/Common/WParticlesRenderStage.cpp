@@ -9,7 +9,7 @@
 WParticlesRenderStage::WParticlesRenderStage(Wasabi* const app, bool backbuffer) : WRenderStage(app) {
 	m_stageDescription.name = __func__;
 	m_stageDescription.target = backbuffer ? RENDER_STAGE_TARGET_BACK_BUFFER : RENDER_STAGE_TARGET_PREVIOUS;
-	m_stageDescription.flags = RENDER_STAGE_FLAG_PARTICLES_RENDER_STAGE;
+	m_stageDescription.flags = RENDER_STAGE_FLAG_PARTICLES_RENDER_STAGE | RENDER_STAGE_FLAG_ASYNC_COMPUTE;
 
 	m_particlesFragment = nullptr;;
 }
@@ -52,3 +52,15 @@ WError WParticlesRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, uin
 
 	return WError(W_SUCCEEDED);
 }
+
+WError WParticlesRenderStage::RecordCompute(WRenderer* renderer, VkCommandBuffer cmdBuf) {
+	uint32_t numEntities = m_app->ParticlesManager->GetEntitiesCount();
+	for (uint32_t i = 0; i < numEntities; i++) {
+		// a system that fails to simulate is not drawn, the others still are
+		WParticles* particles = m_app->ParticlesManager->GetEntityByIndex(i);
+		if (particles)
+			particles->RecordSimulation(renderer, cmdBuf, m_renderTarget);
+	}
+
+	return WError(W_SUCCEEDED);
+}
@@ -0,0 +1,594 @@
+#include "Wasabi/Renderers/Common/WShadowRenderStage.hpp"
+#include "Wasabi/Core/WCore.hpp"
+#include "Wasabi/Renderers/WRenderer.hpp"
+#include "Wasabi/Lights/WLight.hpp"
+#include "Wasabi/Images/WImage.hpp"
+#include "Wasabi/Images/WRenderTarget.hpp"
+#include "Wasabi/Objects/WObject.hpp"
+#include "Wasabi/Geometries/WGeometry.hpp"
+#include "Wasabi/Materials/WMaterial.hpp"
+#include "Wasabi/Cameras/WCamera.hpp"
+
+/** Number of RGBA32F texels per tile in the shadow tiles texture (must match shadows.glsl) */
+#define W_SHADOW_TILE_TEXELS 5
+/** Blend between logarithmic (1) and uniform (0) cascade splits */
+#define W_SHADOW_CASCADE_SPLIT_LAMBDA 0.75f
+
+WShadowRenderStageObjectVS::WShadowRenderStageObjectVS(Wasabi* const app) : WShader(app) {}
+
+void WShadowRenderStageObjectVS::Load(bool bSaveData) {
+	m_desc = GetDesc();
+	vector<uint8_t> code {
+		#include "Shaders/shadow.vert.glsl.spv"
+	};
+	LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+}
+
+W_SHADER_DESC WShadowRenderStageObjectVS::GetDesc() {
+	W_SHADER_DESC desc;
+	desc.type = W_VERTEX_SHADER;
+	desc.bound_resources = {
+		WRenderer::GetGlobalFrameBoundResource(),
+		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 3, 0, "instancingTexture"),
+		W_BOUND_RESOURCE(W_TYPE_PUSH_CONSTANT, 0, "pcPerObject", {
+			W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "objectIndex"), // index into the renderer's scene objects buffer
+			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "shadowViewProjection"), // view-projection of the tile being rendered
+		}),
+	};
+	desc.input_layouts = { W_INPUT_LAYOUT({
+		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3), // position
+		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3), // tangent
+		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3), // normal
+		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_2), // UV
+		W_SHADER_VARIABLE_INFO(W_TYPE_UINT, 1), // texture index
+	}) };
+	return desc;
+}
+
+WShadowRenderStageAnimatedObjectVS::WShadowRenderStageAnimatedObjectVS(Wasabi* const app) : WShader(app) {}
+
+void WShadowRenderStageAnimatedObjectVS::Load(bool bSaveData) {
+	m_desc = GetDesc();
+	vector<uint8_t> code {
+		#include "Shaders/shadow-animated.vert.glsl.spv"
+	};
+	LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+}
+
+W_SHADER_DESC WShadowRenderStageAnimatedObjectVS::GetDesc() {
+	W_SHADER_DESC desc;
+	desc.type = W_VERTEX_SHADER;
+	desc.bound_resources = {
+		WShadowRenderStageObjectVS::GetDesc().bound_resources[0],
+		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 2, 0, "animationTexture"),
+		WShadowRenderStageObjectVS::GetDesc().bound_resources[1],
+		WShadowRenderStageObjectVS::GetDesc().bound_resources[2],
+	};
+	desc.input_layouts = {
+		WShadowRenderStageObjectVS::GetDesc().input_layouts[0], W_INPUT_LAYOUT({
+		W_SHADER_VARIABLE_INFO(W_TYPE_UINT, 4), // bone indices
+		W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, 4), // bone weights
+	}) };
+	return desc;
+}
+
+WShadowRenderStageObjectPS::WShadowRenderStageObjectPS(Wasabi* const app) : WShader(app) {}
+
+void WShadowRenderStageObjectPS::Load(bool bSaveData) {
+	m_desc.type = W_FRAGMENT_SHADER;
+	m_desc.bound_resources = {};
+	vector<uint8_t> code {
+		#include "Shaders/shadow.frag.glsl.spv"
+	};
+	LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+}
+
+WShadowRenderStage::WShadowRenderStage(Wasabi* const app) : WRenderStage(app) {
+	m_stageDescription.name = __func__;
+	m_stageDescription.target = RENDER_STAGE_TARGET_BUFFER;
+	m_stageDescription.depthOutput = WRenderStage::OUTPUT_IMAGE("ShadowAtlas", VK_FORMAT_D32_SFLOAT, WColor(1.0f, 0.0f, 0.0f, 0.0f)); // not transient, the tiles are cached across frames
+
+	m_objectsFragment = nullptr;
+	m_animatedObjectsFragment = nullptr;
+	m_atlasCamera = nullptr;
+	m_shadowTilesTexture = nullptr;
+	m_atlasSize = 0;
+	m_tileSize = 0;
+	m_numCascades = 0;
+	m_shadowDistance = 0.0f;
+	m_maxTileUpdates = 0;
+}
+
+WError WShadowRenderStage::Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height) {
+	// the atlas size is needed by Resize(), which is called by WRenderStage::Initialize
+	m_atlasSize = (uint32_t)std::max(m_app->GetEngineParam<int>("shadowAtlasSize"), 1);
+	m_tileSize = std::min((uint32_t)std::max(m_app->GetEngineParam<int>("shadowTileSize"), 1), m_atlasSize);
+	m_numCascades = (uint32_t)std::min(std::max(m_app->GetEngineParam<int>("shadowCascades"), 1), 8);
+	m_shadowDistance = std::max(m_app->GetEngineParam<float>("shadowDistance"), 0.01f);
+	m_maxTileUpdates = (uint32_t)std::max(m_app->GetEngineParam<int>("maxShadowTileUpdates"), 1);
+
+	WError err = WRenderStage::Initialize(previousStages, width, height);
+	if (!err)
+		return err;
+
+	// the render target's camera is rendered at the atlas size in WRenderTarget::Begin(), use a private one
+	// so that the default camera is not affected
+	m_atlasCamera = new WCamera(m_app);
+	m_atlasCamera->SetName("ShadowAtlasCamera");
+	m_renderTarget->SetCamera(m_atlasCamera);
+
+	uint32_t numBuffers = m_app->GetEngineParam<uint32_t>("bufferingCount");
+	uint32_t tilesPerRow = m_atlasSize / m_tileSize;
+	for (uint32_t y = 0; y < tilesPerRow; y++) {
+		for (uint32_t x = 0; x < tilesPerRow; x++) {
+			SHADOW_TILE tile;
+			tile.camera = new WCamera(m_app);
+			tile.camera->DisableAutoAspect();
+			tile.camera->SetAspect(1.0f);
+			tile.x = x * m_tileSize;
+			tile.y = y * m_tileSize;
+			tile.light = nullptr;
+			tile.lightTileIndex = 0;
+			tile.version = 0;
+			tile.renderedVersions.resize(numBuffers, UINT_MAX);
+			tile.renderedViewProjections.resize(numBuffers);
+			m_tiles.push_back(tile);
+		}
+	}
+
+	uint32_t texWidth = 2;
+	while (texWidth * texWidth < m_tiles.size() * W_SHADOW_TILE_TEXELS)
+		texWidth *= 2;
+	m_shadowTilesTexture = m_app->ImageManager->CreateImage(nullptr, texWidth, texWidth, VK_FORMAT_R32G32B32A32_SFLOAT,
+		W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_DYNAMIC | W_IMAGE_CREATE_REWRITE_EVERY_FRAME);
+	if (!m_shadowTilesTexture)
+		return WError(W_OUTOFMEMORY);
+
+	WShadowRenderStageObjectVS* vs = new WShadowRenderStageObjectVS(m_app);
+	vs->SetName("DefaultShadowVS");
+	m_app->FileManager->AddDefaultAsset(vs->GetName(), vs);
+
+	WShadowRenderStageAnimatedObjectVS* vsa = new WShadowRenderStageAnimatedObjectVS(m_app);
+	vsa->SetName("DefaultShadowAnimatedVS");
+	m_app->FileManager->AddDefaultAsset(vsa->GetName(), vsa);
+
+	WShadowRenderStageObjectPS* ps = new WShadowRenderStageObjectPS(m_app);
+	ps->SetName("DefaultShadowPS");
+	m_app->FileManager->AddDefaultAsset(ps->GetName(), ps);
+
+	m_app->ShaderManager->LoadShaders({ vs, vsa, ps });
+
+	WEffect* fx = new WEffect(m_app);
+	fx->SetName("DefaultShadowEffect");
+	m_app->FileManager->AddDefaultAsset(fx->GetName(), fx);
+	fx->SetSupportedFeatures(EFFECT_FEATURE_INSTANCED);
+
+	WEffect* fxa = new WEffect(m_app);
+	fxa->SetName("DefaultShadowAnimatedEffect");
+	m_app->FileManager->AddDefaultAsset(fxa->GetName(), fxa);
+	fxa->SetSupportedFeatures(EFFECT_FEATURE_INSTANCED | EFFECT_FEATURE_CROWD_ANIMATED);
+
+	// both faces cast shadows (so that open meshes and planes do too), the slope-scaled bias takes care of acne
+	VkPipelineRasterizationStateCreateInfo rs = {};
+	rs.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rs.polygonMode = VK_POLYGON_MODE_FILL;
+	rs.cullMode = VK_CULL_MODE_NONE;
+	rs.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	rs.depthClampEnable = VK_FALSE;
+	rs.rasterizerDiscardEnable = VK_FALSE;
+	rs.depthBiasEnable = VK_TRUE;
+	rs.depthBiasConstantFactor = 1.25f;
+	rs.depthBiasSlopeFactor = 1.75f;
+	rs.lineWidth = 1.0f;
+
+	err = fx->BindShader(vs);
+	if (err) {
+		err = fx->BindShader(ps);
+		if (err) {
+			fx->SetRasterizationState(rs);
+			err = fx->BuildPipelineAsync(m_renderTarget);
+			if (err) {
+				err = fxa->BindShader(vsa);
+				if (err) {
+					err = fxa->BindShader(ps);
+					if (err) {
+						fxa->SetRasterizationState(rs);
+						err = fxa->BuildPipelineAsync(m_renderTarget);
+					}
+				}
+			}
+		}
+	}
+	W_SAFE_REMOVEREF(vs);
+	W_SAFE_REMOVEREF(vsa);
+	W_SAFE_REMOVEREF(ps);
+	if (!err) {
+		W_SAFE_REMOVEREF(fx);
+		W_SAFE_REMOVEREF(fxa);
+		return err;
+	}
+
+	m_objectsFragment = new WShadowRenderFragment(m_stageDescription.name, false, fx, m_app);
+	m_animatedObjectsFragment = new WShadowRenderFragment(m_stageDescription.name + "-animated", true, fxa, m_app);
+
+	m_app->LightManager->RegisterChangeCallback(m_stageDescription.name, [this](WLight* l, bool add) { this->OnLightsChange(l, add); });
+
+	return err;
+}
+
+void WShadowRenderStage::Cleanup() {
+	WRenderStage::Cleanup();
+	m_app->LightManager->RemoveChangeCallback(m_stageDescription.name);
+	W_SAFE_DELETE(m_objectsFragment);
+	W_SAFE_DELETE(m_animatedObjectsFragment);
+	for (auto it = m_tiles.begin(); it != m_tiles.end(); it++)
+		W_SAFE_REMOVEREF(it->camera);
+	m_tiles.clear();
+	m_lightShadows.clear();
+	m_shadowedLights.clear();
+	m_casters.clear();
+	W_SAFE_REMOVEREF(m_shadowTilesTexture);
+	W_SAFE_REMOVEREF(m_atlasCamera);
+}
+
+WError WShadowRenderStage::Resize(uint32_t width, uint32_t height) {
+	UNREFERENCED_PARAMETER(width);
+	UNREFERENCED_PARAMETER(height);
+
+	// tiles are cleared individually when they are rendered, the rest of the atlas keeps the cached tiles
+	if (m_renderTarget)
+		m_renderTarget->SetPreserveContents(true);
+	WError err = WRenderStage::Resize(m_atlasSize, m_atlasSize);
+
+	// the atlas images are recreated, nothing is cached anymore
+	for (auto it = m_tiles.begin(); it != m_tiles.end(); it++)
+		std::fill(it->renderedVersions.begin(), it->renderedVersions.end(), UINT_MAX);
+
+	return err;
+}
+
+void WShadowRenderStage::OnLightsChange(WLight* light, bool added) {
+	if (!added) {
+		FreeLightTiles(light);
+		m_shadowedLights.erase(std::remove(m_shadowedLights.begin(), m_shadowedLights.end(), light), m_shadowedLights.end());
+	}
+}
+
+void WShadowRenderStage::FreeLightTiles(WLight* light) {
+	auto it = m_lightShadows.find(light);
+	if (it != m_lightShadows.end()) {
+		for (auto tileIndex : it->second.tiles)
+			m_tiles[tileIndex].light = nullptr;
+		m_lightShadows.erase(it);
+	}
+}
+
+void WShadowRenderStage::AllocateTiles(const W_GLOBAL_FRAME_DATA& frameData) {
+	WVector3 camPos = WVector3(frameData.camPosW.x, frameData.camPosW.y, frameData.camPosW.z);
+	WVector3 camDir = WVector3(frameData.camDirW.x, frameData.camDirW.y, frameData.camDirW.z);
+	float farPlane = frameData.camDirW.w;
+
+	// directional lights have the highest priority, then the lights closest to the camera. Lights
+	// that cannot light anything in front of the camera are skipped
+	std::vector<std::pair<float, WLight*>> candidates;
+	for (uint32_t i = 0; ; i++) {
+		WLight* light = m_app->LightManager->GetEntityByIndex(i);
+		if (!light)
+			break;
+		if (light->Hidden())
+			continue;
+
+		if (light->GetType() == W_LIGHT_DIRECTIONAL) {
+			candidates.push_back(std::make_pair(-1.0f, light));
+		} else {
+			WVector3 toLight = light->GetPosition() - camPos;
+			float distance = WVec3Length(toLight);
+			if (WVec3Dot(toLight, camDir) < -light->GetRange() || distance - light->GetRange() > farPlane)
+				continue;
+			candidates.push_back(std::make_pair(distance, light));
+		}
+	}
+	std::stable_sort(candidates.begin(), candidates.end(),
+		[](const std::pair<float, WLight*>& a, const std::pair<float, WLight*>& b) { return a.first < b.first; });
+
+	// pick the lights that fit in the atlas, lights that keep their tiles keep their cached shadows
+	for (auto it = m_lightShadows.begin(); it != m_lightShadows.end(); it++)
+		it->second.kept = false;
+	m_shadowedLights.clear();
+	uint32_t usedTiles = 0;
+	for (auto candidate : candidates) {
+		WLight* light = candidate.second;
+		uint32_t numTiles = light->GetType() == W_LIGHT_DIRECTIONAL ? m_numCascades : light->GetType() == W_LIGHT_SPOT ? 1 : 6;
+		if (usedTiles + numTiles > m_tiles.size())
+			continue;
+		usedTiles += numTiles;
+		m_shadowedLights.push_back(light);
+		auto it = m_lightShadows.find(light);
+		if (it != m_lightShadows.end() && it->second.tiles.size() == numTiles)
+			it->second.kept = true;
+	}
+
+	std::vector<WLight*> lightsToFree;
+	for (auto it = m_lightShadows.begin(); it != m_lightShadows.end(); it++)
+		if (!it->second.kept)
+			lightsToFree.push_back(it->first);
+	for (auto light : lightsToFree)
+		FreeLightTiles(light);
+
+	uint32_t nextFreeTile = 0;
+	for (auto light : m_shadowedLights) {
+		if (m_lightShadows.find(light) != m_lightShadows.end())
+			continue;
+
+		LIGHT_SHADOW shadow;
+		shadow.firstTile = 0;
+		shadow.kept = true;
+		uint32_t numTiles = light->GetType() == W_LIGHT_DIRECTIONAL ? m_numCascades : light->GetType() == W_LIGHT_SPOT ? 1 : 6;
+		for (uint32_t i = 0; i < numTiles; i++) {
+			while (m_tiles[nextFreeTile].light)
+				nextFreeTile++;
+			SHADOW_TILE& tile = m_tiles[nextFreeTile];
+			tile.light = light;
+			tile.lightTileIndex = i;
+			tile.version++;
+			std::fill(tile.renderedVersions.begin(), tile.renderedVersions.end(), UINT_MAX);
+			shadow.tiles.push_back(nextFreeTile);
+		}
+		m_lightShadows.insert(std::make_pair(light, shadow));
+	}
+
+	for (auto light : m_shadowedLights)
+		for (auto tileIndex : m_lightShadows[light].tiles)
+			UpdateTileCamera(m_tiles[tileIndex], frameData);
+}
+
+void WShadowRenderStage::UpdateTileCamera(SHADOW_TILE& tile, const W_GLOBAL_FRAME_DATA& frameData) {
+	WLight* light = tile.light;
+	WCamera* camera = tile.camera;
+
+	// builds an orthonormal basis around a look direction
+	auto getBasis = [](WVector3 look, WVector3* up, WVector3* right) {
+		WVector3 upHint = fabsf(look.y) > 0.99f ? WVector3(0.0f, 0.0f, 1.0f) : WVector3(0.0f, 1.0f, 0.0f);
+		*right = WVec3Normalize(WVec3Cross(upHint, look));
+		*up = WVec3Cross(look, *right);
+	};
+
+	WVector3 look, up, right, position;
+	if (light->GetType() == W_LIGHT_DIRECTIONAL) {
+		look = WVec3Normalize(light->GetLVector());
+		getBasis(look, &up, &right);
+
+		// practical split scheme (blend of logarithmic and uniform splits) over [near, shadowDistance]
+		float nearPlane = std::max(frameData.camPosW.w, 0.0001f);
+		float farPlane = std::max(std::min(frameData.camDirW.w, m_shadowDistance), nearPlane * 1.001f);
+		auto getSplit = [nearPlane, farPlane](uint32_t split, uint32_t numSplits) {
+			float fraction = (float)split / (float)numSplits;
+			float logSplit = nearPlane * powf(farPlane / nearPlane, fraction);
+			float uniformSplit = nearPlane + (farPlane - nearPlane) * fraction;
+			return W_SHADOW_CASCADE_SPLIT_LAMBDA * logSplit + (1.0f - W_SHADOW_CASCADE_SPLIT_LAMBDA) * uniformSplit;
+		};
+		float sliceDepths[2] = { getSplit(tile.lightTileIndex, m_numCascades), getSplit(tile.lightTileIndex + 1, m_numCascades) };
+
+		// corners of the view slice, the camera basis is in the columns of the view matrix
+		const WMatrix& view = frameData.viewMatrix;
+		const WMatrix& proj = frameData.projectionMatrix;
+		WVector3 camPos = WVector3(frameData.camPosW.x, frameData.camPosW.y, frameData.camPosW.z);
+		WVector3 camRight = WVector3(view(0, 0), view(1, 0), view(2, 0));
+		WVector3 camUp = WVector3(view(0, 1), view(1, 1), view(2, 1));
+		WVector3 camLook = WVector3(view(0, 2), view(1, 2), view(2, 2));
+		bool isPerspective = proj(2, 3) > 0.5f;
+		float halfWidth = 1.0f / proj(0, 0);
+		float halfHeight = 1.0f / fabsf(proj(1, 1));
+		WVector3 corners[8];
+		WVector3 center = WVector3(0.0f, 0.0f, 0.0f);
+		for (uint32_t i = 0; i < 8; i++) {
+			float depth = sliceDepths[i / 4];
+			float scale = isPerspective ? depth : 1.0f;
+			corners[i] = camPos + camLook * depth +
+				camRight * (halfWidth * scale * (i & 1 ? 1.0f : -1.0f)) +
+				camUp * (halfHeight * scale * (i & 2 ? 1.0f : -1.0f));
+			center += corners[i] / 8.0f;
+		}
+		float radius = 0.0f;
+		for (uint32_t i = 0; i < 8; i++)
+			radius = std::max(radius, WVec3Length(corners[i] - center));
+
+		// the bounding sphere does not change size when the camera rotates, and snapping its center to whole
+		// texels of the light's view keeps the tile stable while the camera moves (no shimmering, and the
+		// cached tile stays valid)
+		float size = ceilf(radius * 2.0f);
+		float texelSize = size / (float)m_tileSize;
+		float snappedRight = floorf(WVec3Dot(center, right) / texelSize) * texelSize;
+		float snappedUp = floorf(WVec3Dot(center, up) / texelSize) * texelSize;
+		float snappedLook = floorf(WVec3Dot(center, look) / texelSize) * texelSize;
+		center = right * snappedRight + up * snappedUp + look * snappedLook;
+
+		// casters up to shadowDistance behind the slice (towards the light) are included
+		position = center - look * (size * 0.5f + m_shadowDistance);
+		camera->SetProjectionType(PROJECTION_ORTHOGONAL);
+		camera->SetRange(0.0f, size + m_shadowDistance);
+		camera->SetPosition(position);
+		camera->SetULRVectors(up, look, right);
+		camera->Render((uint32_t)size, (uint32_t)size);
+	} else {
+		float fov = 90.0f;
+		if (light->GetType() == W_LIGHT_SPOT) {
+			look = WVec3Normalize(light->GetLVector());
+			fov = std::min(std::max(W_RADTODEG(2.0f * acosf(light->GetMinCosAngle())) + 2.0f, 1.0f), 170.0f);
+		} else {
+			const WVector3 cubeFaces[6] = {
+				WVector3(1.0f, 0.0f, 0.0f), WVector3(-1.0f, 0.0f, 0.0f),
+				WVector3(0.0f, 1.0f, 0.0f), WVector3(0.0f, -1.0f, 0.0f),
+				WVector3(0.0f, 0.0f, 1.0f), WVector3(0.0f, 0.0f, -1.0f),
+			};
+			look = cubeFaces[tile.lightTileIndex];
+		}
+		getBasis(look, &up, &right);
+
+		camera->SetProjectionType(PROJECTION_PERSPECTIVE);
+		camera->SetFOV(fov);
+		camera->SetRange(std::max(light->GetRange() * 0.01f, 0.05f), light->GetRange());
+		camera->SetPosition(light->GetPosition());
+		camera->SetULRVectors(up, look, right);
+		camera->Render(m_tileSize, m_tileSize);
+	}
+
+	tile.viewProjection = camera->GetViewMatrix() * camera->GetProjectionMatrix();
+}
+
+void WShadowRenderStage::InvalidateTilesAt(WVector3 center, WVector3 size) {
+	for (auto it = m_tiles.begin(); it != m_tiles.end(); it++)
+		if (it->light && it->camera->CheckBoxInFrustum(center, size))
+			it->version++;
+}
+
+void WShadowRenderStage::InvalidateTiles() {
+	for (auto it = m_casters.begin(); it != m_casters.end(); it++)
+		it->second.found = false;
+
+	for (uint32_t i = 0; ; i++) {
+		WObject* object = m_app->ObjectManager->GetEntityByIndex(i);
+		if (!object)
+			break;
+		WGeometry* geometry = object->GetGeometry();
+		if (!object->Valid() || object->Hidden() || !geometry)
+			continue;
+
+		// same bounds as WObject::InCameraView
+		WMatrix worldM = object->GetWorldMatrix();
+		WVector3 minPoint = WVec3TransformCoord(geometry->GetMinPoint(), worldM);
+		WVector3 maxPoint = WVec3TransformCoord(geometry->GetMaxPoint(), worldM);
+		WVector3 center = (maxPoint + minPoint) / 2.0f;
+		WVector3 size = (maxPoint - minPoint) / 2.0f;
+
+		// animated and instanced objects can change without their bounds changing
+		bool isDynamic = object->GetAnimation() != nullptr || object->GetInstancesCount() > 0;
+
+		auto it = m_casters.find(object);
+		if (it == m_casters.end()) {
+			InvalidateTilesAt(center, size);
+			SHADOW_CASTER caster;
+			caster.center = center;
+			caster.size = size;
+			caster.found = true;
+			m_casters.insert(std::make_pair(object, caster));
+		} else {
+			it->second.found = true;
+			if (isDynamic || it->second.center != center || it->second.size != size) {
+				InvalidateTilesAt(it->second.center, it->second.size);
+				InvalidateTilesAt(center, size);
+				it->second.center = center;
+				it->second.size = size;
+			}
+		}
+	}
+
+	// removed (or hidden) casters leave a hole in the tiles they were in
+	for (auto it = m_casters.begin(); it != m_casters.end();) {
+		if (!it->second.found) {
+			InvalidateTilesAt(it->second.center, it->second.size);
+			it = m_casters.erase(it);
+		} else
+			it++;
+	}
+}
+
+WError WShadowRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, uint32_t filter) {
+	if (!(filter & RENDER_FILTER_OBJECTS))
+		return WError(W_SUCCEEDED);
+
+	AllocateTiles(renderer->GetGlobalFrameData());
+	InvalidateTiles();
+
+	//
+	// Render the stale tiles in order of priority, up to the per-frame budget
+	//
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	VkCommandBuffer cmdBuffer = rt->GetCommnadBuffer();
+	uint32_t numUpdates = 0;
+	for (auto light : m_shadowedLights) {
+		for (auto tileIndex : m_lightShadows[light].tiles) {
+			SHADOW_TILE& tile = m_tiles[tileIndex];
+			bool isStale = tile.renderedVersions[bufferIndex] != tile.version ||
+				memcmp(tile.renderedViewProjections[bufferIndex].mat, tile.viewProjection.mat, sizeof(tile.viewProjection.mat)) != 0;
+			if (!isStale || numUpdates >= m_maxTileUpdates)
+				continue;
+			numUpdates++;
+
+			VkViewport viewport = vkTools::initializers::viewport((float)m_tileSize, (float)m_tileSize, 0.0f, 1.0f);
+			viewport.x = (float)tile.x;
+			viewport.y = (float)tile.y;
+			vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+			VkRect2D scissor = vkTools::initializers::rect2D(m_tileSize, m_tileSize, tile.x, tile.y);
+			vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+
+			VkClearAttachment clearAttachment = {};
+			clearAttachment.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+			clearAttachment.clearValue.depthStencil = { 1.0f, 0 };
+			VkClearRect clearRect = {};
+			clearRect.rect = scissor;
+			clearRect.baseArrayLayer = 0;
+			clearRect.layerCount = 1;
+			vkCmdClearAttachments(cmdBuffer, 1, &clearAttachment, 1, &clearRect);
+
+			// objects are culled against the render target's camera
+			rt->SetCamera(tile.camera);
+			m_objectsFragment->SetViewProjection(tile.viewProjection);
+			m_objectsFragment->Render(renderer, rt);
+			m_animatedObjectsFragment->SetViewProjection(tile.viewProjection);
+			m_animatedObjectsFragment->Render(renderer, rt);
+
+			tile.renderedVersions[bufferIndex] = tile.version;
+			tile.renderedViewProjections[bufferIndex] = tile.viewProjection;
+		}
+	}
+	rt->SetCamera(m_atlasCamera);
+
+	//
+	// Describe the tiles of this buffer's atlas, using the matrices they were actually rendered with
+	//
+	WVector4* tilesData;
+	if (!m_shadowTilesTexture->MapPixels((void**)&tilesData, W_MAP_WRITE))
+		return WError(W_ERRORUNK);
+	uint32_t tileOffset = 0;
+	float atlasScale = 1.0f / (float)m_atlasSize;
+	for (auto light : m_shadowedLights) {
+		LIGHT_SHADOW& shadow = m_lightShadows[light];
+		shadow.firstTile = tileOffset;
+		for (auto tileIndex : shadow.tiles) {
+			const SHADOW_TILE& tile = m_tiles[tileIndex];
+			const WMatrix& m = tile.renderedViewProjections[bufferIndex];
+			WVector4* texels = &tilesData[tileOffset * W_SHADOW_TILE_TEXELS];
+			for (uint32_t row = 0; row < 4; row++)
+				texels[row] = WVector4(m(row, 0), m(row, 1), m(row, 2), m(row, 3));
+			if (tile.renderedVersions[bufferIndex] == UINT_MAX)
+				texels[4] = WVector4(0.0f, 0.0f, 0.0f, 0.0f);
+			else
+				texels[4] = WVector4((float)tile.x * atlasScale, (float)tile.y * atlasScale, (float)m_tileSize * atlasScale, (float)m_tileSize * atlasScale);
+			tileOffset++;
+		}
+	}
+	m_shadowTilesTexture->UnmapPixels();
+
+	return WError(W_SUCCEEDED);
+}
+
+bool WShadowRenderStage::GetLightShadowTiles(WLight* light, uint32_t* firstTile, uint32_t* numTiles) const {
+	auto it = m_lightShadows.find(light);
+	if (it == m_lightShadows.end()) {
+		*firstTile = 0;
+		*numTiles = 0;
+		return false;
+	}
+	*firstTile = it->second.firstTile;
+	*numTiles = (uint32_t)it->second.tiles.size();
+	return true;
+}
+
+WImage* WShadowRenderStage::GetShadowAtlas() const {
+	return m_depthOutput;
+}
+
+WImage* WShadowRenderStage::GetShadowTilesTexture() const {
+	return m_shadowTilesTexture;
+}
@@ -0,0 +1,208 @@
+#include "Wasabi/Renderers/Common/WSkinningRenderStage.hpp"
+#include "Wasabi/Renderers/WRenderer.hpp"
+#include "Wasabi/Core/WCore.hpp"
+#include "Wasabi/Images/WRenderTarget.hpp"
+#include "Wasabi/Materials/WMaterial.hpp"
+#include "Wasabi/Objects/WObject.hpp"
+#include "Wasabi/Geometries/WGeometry.hpp"
+#include "Wasabi/Animations/WAnimation.hpp"
+
+/** Number of vertices skinned by a work group of the skinning shader */
+#define W_SKINNING_GROUP_SIZE 64
+
+WSkinningRenderStageCS::WSkinningRenderStageCS(Wasabi* const app) : WShader(app) {}
+
+void WSkinningRenderStageCS::Load(bool bSaveData) {
+	m_desc.type = W_COMPUTE_SHADER;
+	m_desc.bound_resources = {
+		W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 0, 0, "inputVertices"), // geometry's vertices (WDefaultVertex)
+		W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 1, 0, "inputAnimation"), // geometry's bone indices and weights (WDefaultVertex_Animation)
+		W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 2, 0, "outputVertices"), // skinned vertices (WDefaultVertex)
+		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 3, 0, "animationTexture"),
+		W_BOUND_RESOURCE(W_TYPE_PUSH_CONSTANT, 0, "pcSkinning", {
+			W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "numVertices"), // number of vertices to skin
+			W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "outputOffset"), // index of the first skinned vertex in outputVertices
+		}),
+	};
+	vector<uint8_t> code {
+		#include "Shaders/skinning.comp.glsl.spv"
+	};
+	LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+}
+
+WSkinningRenderStage::WSkinningRenderStage(Wasabi* const app) : WRenderStage(app) {
+	m_stageDescription.name = __func__;
+	m_stageDescription.target = RENDER_STAGE_TARGET_PREVIOUS;
+	m_stageDescription.flags = RENDER_STAGE_FLAG_ASYNC_COMPUTE;
+
+	m_skinningFX = nullptr;
+	m_maxSkinnedVertices = 0;
+}
+
+WError WSkinningRenderStage::Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height) {
+	WError err = WRenderStage::Initialize(previousStages, width, height);
+	if (!err)
+		return err;
+
+	WSkinningRenderStageCS* cs = new WSkinningRenderStageCS(m_app);
+	cs->SetName("DefaultSkinningCS");
+	m_app->FileManager->AddDefaultAsset(cs->GetName(), cs);
+	cs->Load();
+
+	m_skinningFX = new WEffect(m_app);
+	m_skinningFX->SetName("DefaultSkinningEffect");
+	m_app->FileManager->AddDefaultAsset(m_skinningFX->GetName(), m_skinningFX);
+
+	err = m_skinningFX->BindShader(cs);
+	if (err)
+		err = m_skinningFX->BuildPipelineAsync(nullptr);
+	W_SAFE_REMOVEREF(cs);
+	if (!err)
+		return err;
+
+	m_maxSkinnedVertices = m_app->GetEngineParam<uint32_t>("maxSkinnedVertices");
+	uint32_t numBuffers = m_app->GetEngineParam<uint32_t>("bufferingCount");
+	VkResult result = m_skinnedVertices.Create(m_app, numBuffers, (size_t)m_maxSkinnedVertices * sizeof(WDefaultVertex),
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	if (result != VK_SUCCESS)
+		return WError(W_OUTOFMEMORY);
+
+	m_app->ObjectManager->RegisterChangeCallback(m_stageDescription.name, [this](WObject* o, bool add) { this->_OnObjectChange(o, add); });
+
+	return err;
+}
+
+void WSkinningRenderStage::_OnObjectChange(WObject* object, bool added) {
+	if (added)
+		return;
+
+	auto it = m_objectMaterials.find(object);
+	if (it != m_objectMaterials.end()) {
+		W_SAFE_REMOVEREF(it->second);
+		m_objectMaterials.erase(it);
+	}
+	for (uint32_t i = 0; i < m_skinnedObjects.size(); i++) {
+		if (m_skinnedObjects[i] == object) {
+			m_skinnedObjects.erase(m_skinnedObjects.begin() + i);
+			break;
+		}
+	}
+}
+
+bool WSkinningRenderStage::_CanSkin(WObject* object) const {
+	WAnimation* animation = object->GetAnimation();
+	WGeometry* geometry = object->GetGeometry();
+	if (!animation || !animation->Valid() || !geometry || !geometry->IsRigged())
+		return false;
+
+	// crowd animations are sampled per instance, which only the vertex shader can do
+	if (object->GetEffectFeatures() & EFFECT_FEATURE_CROWD_ANIMATED)
+		return false;
+
+	// custom effects may skin (or not) the vertices in their own way
+	for (auto mat : object->GetMaterials().m_materials)
+		if (!m_app->FileManager->IsDefaultAsset(mat.first->GetEffect()->GetName()))
+			return false;
+
+	// the shader reads and writes the vertices in the layout of the default vertex
+	W_VERTEX_DESCRIPTION vertexDesc = geometry->GetVertexDescription(0);
+	W_VERTEX_DESCRIPTION animationDesc = geometry->GetVertexDescription(1);
+	return vertexDesc.GetSize() == sizeof(WDefaultVertex) &&
+		vertexDesc.GetOffset(W_ATTRIBUTE_POSITION.name) == offsetof(WDefaultVertex, pos) &&
+		vertexDesc.GetOffset(W_ATTRIBUTE_TANGENT.name) == offsetof(WDefaultVertex, tang) &&
+		vertexDesc.GetOffset(W_ATTRIBUTE_NORMAL.name) == offsetof(WDefaultVertex, norm) &&
+		animationDesc.GetSize() == sizeof(WDefaultVertex_Animation) &&
+		animationDesc.GetOffset(W_ATTRIBUTE_BONE_INDEX.name) == offsetof(WDefaultVertex_Animation, boneIDs) &&
+		animationDesc.GetOffset(W_ATTRIBUTE_BONE_WEIGHT.name) == offsetof(WDefaultVertex_Animation, weights);
+}
+
+WError WSkinningRenderStage::RecordCompute(WRenderer* renderer, VkCommandBuffer cmdBuf) {
+	// objects skinned in the last frame use their animated effect again unless they are skinned below
+	for (auto object : m_skinnedObjects)
+		object->SetSkinnedVertices(VK_NULL_HANDLE, 0);
+	m_skinnedObjects.clear();
+
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	VkBuffer outputBuffer = m_skinnedVertices.GetBuffer(m_app, bufferIndex);
+	uint32_t numSkinnedVertices = 0;
+	bool effectBound = false;
+
+	uint32_t numEntities = m_app->ObjectManager->GetEntitiesCount();
+	for (uint32_t i = 0; i < numEntities; i++) {
+		WObject* object = m_app->ObjectManager->GetEntityByIndex(i);
+		if (!object || !object->WillRender(m_renderTarget) || !_CanSkin(object))
+			continue;
+
+		WGeometry* geometry = object->GetGeometry();
+		uint32_t numVertices = geometry->GetNumVertices();
+		if (numVertices == 0 || numVertices > m_maxSkinnedVertices - numSkinnedVertices)
+			continue; // doesn't fit, the vertex shader skins it
+
+		WMaterial* material = nullptr;
+		auto materialIt = m_objectMaterials.find(object);
+		if (materialIt != m_objectMaterials.end())
+			material = materialIt->second;
+		else {
+			material = m_skinningFX->CreateMaterial(0);
+			if (!material)
+				continue;
+			material->SetName(m_stageDescription.name + "-" + std::to_string(object->GetID()));
+			material->SetStorageBuffer("outputVertices", &m_skinnedVertices);
+			m_objectMaterials.insert(std::make_pair(object, material));
+		}
+
+		// the geometry and animation of an object may change between frames, so they are always set
+		material->SetStorageBuffer("inputVertices", geometry->GetVertexBuffer());
+		material->SetStorageBuffer("inputAnimation", geometry->GetAnimationBuffer());
+		material->SetTexture("animationTexture", object->GetAnimation()->GetTexture());
+		material->SetVariable<uint32_t>("numVertices", numVertices);
+		material->SetVariable<uint32_t>("outputOffset", numSkinnedVertices);
+
+		if (!effectBound) {
+			WError err = m_skinningFX->BindCompute(cmdBuf);
+			if (!err)
+				return err;
+			effectBound = true;
+		}
+		WError err = material->BindCompute(cmdBuf);
+		if (!err)
+			continue;
+		m_skinningFX->Dispatch(cmdBuf, (numVertices + W_SKINNING_GROUP_SIZE - 1) / W_SKINNING_GROUP_SIZE);
+
+		object->SetSkinnedVertices(outputBuffer, (VkDeviceSize)numSkinnedVertices * sizeof(WDefaultVertex));
+		m_skinnedObjects.push_back(object);
+		numSkinnedVertices += numVertices;
+	}
+
+	// the geometry passes read the skinned vertices as vertex attributes
+	if (numSkinnedVertices > 0)
+		renderer->TransferComputeBuffer(outputBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WSkinningRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, uint32_t filter) {
+	UNREFERENCED_PARAMETER(renderer);
+	UNREFERENCED_PARAMETER(rt);
+	UNREFERENCED_PARAMETER(filter);
+
+	// the vertices are skinned in RecordCompute(), before any stage renders
+	return WError(W_SUCCEEDED);
+}
+
+void WSkinningRenderStage::Cleanup() {
+	WRenderStage::Cleanup();
+	m_app->ObjectManager->RemoveChangeCallback(m_stageDescription.name);
+	for (auto object : m_skinnedObjects)
+		object->SetSkinnedVertices(VK_NULL_HANDLE, 0);
+	m_skinnedObjects.clear();
+	for (auto it = m_objectMaterials.begin(); it != m_objectMaterials.end(); it++)
+		W_SAFE_REMOVEREF(it->second);
+	m_objectMaterials.clear();
+	W_SAFE_REMOVEREF(m_skinningFX);
+	m_skinnedVertices.Destroy(m_app);
+}
+
+WError WSkinningRenderStage::Resize(uint32_t width, uint32_t height) {
+	return WRenderStage::Resize(width, height);
+}
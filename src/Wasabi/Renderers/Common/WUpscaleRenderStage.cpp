@@ -0,0 +1,106 @@
+#include "Wasabi/Renderers/Common/WUpscaleRenderStage.hpp"
+#include "Wasabi/Core/WCore.hpp"
+#include "Wasabi/Renderers/WRenderer.hpp"
+#include "Wasabi/Images/WRenderTarget.hpp"
+#include "Wasabi/Images/WImage.hpp"
+#include "Wasabi/Sprites/WSprite.hpp"
+#include "Wasabi/Materials/WMaterial.hpp"
+
+WUpscaleRenderStagePS::WUpscaleRenderStagePS(Wasabi* const app) : WShader(app) {}
+
+void WUpscaleRenderStagePS::Load(bool bSaveData) {
+	m_desc.type = W_FRAGMENT_SHADER;
+	m_desc.bound_resources = {
+		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 0, 0, "colorTexture"),
+		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 1, 0, "depthTexture"),
+		WRenderer::GetGlobalFrameBoundResource(),
+	};
+	vector<uint8_t> code {
+		#include "Shaders/upscale.frag.glsl.spv"
+	};
+	LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+}
+
+WUpscaleRenderStage::WUpscaleRenderStage(Wasabi* const app, std::string colorName, std::string depthName) : WRenderStage(app) {
+	m_stageDescription.name = __func__;
+	m_stageDescription.target = RENDER_STAGE_TARGET_BACK_BUFFER;
+	m_stageDescription.inputs = std::vector<std::string>({colorName, depthName});
+	m_stageDescription.flags = RENDER_STAGE_FLAG_NONE;
+
+	m_colorName = colorName;
+	m_depthName = depthName;
+	m_fullscreenSprite = nullptr;
+	m_effect = nullptr;
+	m_material = nullptr;
+}
+
+WError WUpscaleRenderStage::Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height) {
+	WError err = WRenderStage::Initialize(previousStages, width, height);
+	if (!err)
+		return err;
+
+	WImage* colorImg = m_app->Renderer->GetRenderTargetImage(m_colorName);
+	WImage* depthImg = m_app->Renderer->GetRenderTargetImage(m_depthName);
+	if (!colorImg || !depthImg)
+		return WError(W_NOTVALID);
+
+	m_fullscreenSprite = m_app->SpriteManager->CreateSprite();
+	if (!m_fullscreenSprite)
+		return WError(W_OUTOFMEMORY);
+	m_fullscreenSprite->SetName("UpscaleFullscreenSprite");
+	m_fullscreenSprite->SetSize(WVector2((float)width, (float)height));
+	m_fullscreenSprite->Hide();
+
+	// The fullscreen sprite outputs the upscaled depth so the stages after this one are occluded by the scene
+	VkPipelineDepthStencilStateCreateInfo dss = {};
+	dss.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	dss.depthTestEnable = VK_TRUE;
+	dss.depthWriteEnable = VK_TRUE;
+	dss.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+	dss.depthBoundsTestEnable = VK_FALSE;
+	dss.back.failOp = VK_STENCIL_OP_KEEP;
+	dss.back.passOp = VK_STENCIL_OP_KEEP;
+	dss.back.compareOp = VK_COMPARE_OP_ALWAYS;
+	dss.stencilTestEnable = VK_FALSE;
+	dss.front = dss.back;
+
+	WUpscaleRenderStagePS* pixelShader = new WUpscaleRenderStagePS(m_app);
+	pixelShader->Load();
+
+	m_effect = m_app->SpriteManager->CreateSpriteEffect(m_renderTarget, pixelShader, {}, dss);
+	W_SAFE_REMOVEREF(pixelShader);
+	if (!m_effect)
+		return WError(W_OUTOFMEMORY);
+
+	m_material = m_effect->CreateMaterial(0, true);
+	if (!m_material)
+		return WError(W_ERRORUNK);
+
+	m_material->SetTexture("colorTexture", colorImg);
+	m_material->SetTexture("depthTexture", depthImg);
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WUpscaleRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, uint32_t filter) {
+	UNREFERENCED_PARAMETER(renderer);
+	UNREFERENCED_PARAMETER(filter);
+
+	m_effect->Bind(rt);
+	m_fullscreenSprite->Render(rt);
+
+	return WError(W_SUCCEEDED);
+}
+
+void WUpscaleRenderStage::Cleanup() {
+	WRenderStage::Cleanup();
+	W_SAFE_REMOVEREF(m_fullscreenSprite);
+	W_SAFE_REMOVEREF(m_effect);
+	W_SAFE_REMOVEREF(m_material);
+}
+
+WError WUpscaleRenderStage::Resize(uint32_t width, uint32_t height) {
+	if (m_fullscreenSprite)
+		m_fullscreenSprite->SetSize(WVector2((float)width, (float)height));
+	return WRenderStage::Resize(width, height);
+}
@@ -0,0 +1,17 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "clusteredlights.glsl"
+
+layout(set = 0, binding = 1) uniform sampler2D normalTexture;
+layout(set = 0, binding = 2) uniform sampler2D depthTexture;
+
+void main() {
+	// the G-buffer and this pass are rendered at the dynamic resolution scale
+	vec2 gbufferUV = WasabiScaledUV(inUV);
+	float z = texture(depthTexture, gbufferUV).r;
+	vec4 normalAndSpec = texture(normalTexture, gbufferUV);
+	outFragColor = vec4(ClusteredLightsShadePixel(z, normalAndSpec), 1);
+}
@@ -0,0 +1,53 @@
+/*
+ * Shared code of the clustered lights pass, included by clusteredlights.frag.glsl (reads the G-buffer as textures)
+ * and clusteredlights_subpass.frag.glsl (reads the G-buffer as input attachments in a merged render pass).
+ */
+
+#include "../../Common/Shaders/utils.glsl"
+#include "../../Common/Shaders/object_utils.glsl"
+#include "../../Common/Shaders/global_frame.glsl"
+#include "../../Common/Shaders/upscale.glsl"
+#include "../../Common/Shaders/shadows.glsl"
+// the light clusters buffers are at bindings 3, 4 and 5
+#define W_LIGHT_CLUSTERS_SET 0
+#define W_LIGHT_CLUSTERS_BINDING 3
+#include "../../Common/Shaders/light_clusters.glsl"
+
+layout(location = 0) in vec2 inUV;
+layout(location = 0) out vec4 outFragColor;
+
+layout(set = 0, binding = 0) uniform UBOPerFrame {
+	uvec4 clusterGrid;
+	vec4 clusterDepth;
+} uboPerFrame;
+
+layout(set = 0, binding = 6) uniform sampler2D shadowAtlas;
+layout(set = 0, binding = 7) uniform sampler2D shadowTilesTexture;
+
+vec3 ClusteredLightsShadePixel(float z, vec4 normalAndSpec) {
+	float x = inUV.x * 2.0f - 1.0f;
+	float y = inUV.y * 2.0f - 1.0f;
+	vec4 vPositionVS = uboGlobalFrame.projectionInverseMatrix * vec4 (x, y, z, 1.0f);
+	vec3 pixelPositionV = vPositionVS.xyz / vPositionVS.w;
+
+	//rg=packed-normal, b=specPower, a=specIntensityy
+	vec3 pixelNormalV = WasabiUnpackNormalSpheremapTransform(normalAndSpec.xy);
+	float specularPower = normalAndSpec.b;
+	float specularIntensity = normalAndSpec.a;
+
+	// lights are clustered in world space, the view matrix is a rotation and a translation so its inverse is cheap
+	mat3 viewRotationInv = transpose(mat3(uboGlobalFrame.viewMatrix));
+	vec3 pixelPositionW = viewRotationInv * (pixelPositionV - uboGlobalFrame.viewMatrix[3].xyz);
+	vec3 pixelNormalW = viewRotationInv * pixelNormalV;
+
+	return WasabiClusteredLighting(
+		pixelPositionW,
+		pixelNormalW,
+		specularPower,
+		specularIntensity,
+		uboPerFrame.clusterGrid,
+		uboPerFrame.clusterDepth,
+		shadowAtlas,
+		shadowTilesTexture
+	);
+}
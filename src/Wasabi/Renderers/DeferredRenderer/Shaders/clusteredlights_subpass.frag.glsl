@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "clusteredlights.glsl"
+
+layout(input_attachment_index = 0, set = 0, binding = 1) uniform subpassInput normalTexture;
+layout(input_attachment_index = 1, set = 0, binding = 2) uniform subpassInput depthTexture;
+
+void main() {
+	// the G-buffer was rendered by the previous subpass, read it at this pixel
+	float z = subpassLoad(depthTexture).r;
+	vec4 normalAndSpec = subpassLoad(normalTexture);
+	outFragColor = vec4(ClusteredLightsShadePixel(z, normalAndSpec), 1);
+}
@@ -4,6 +4,8 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "../../Common/Shaders/utils.glsl"
+#include "../../Common/Shaders/global_frame.glsl"
+#include "../../Common/Shaders/upscale.glsl"
 
 layout(location = 0) in vec2 inUV;
 layout(location = 0) out vec4 outFragColor;
@@ -26,13 +28,15 @@ layout(set = 1, binding = 3) uniform UBO {
 } uboPerFrame;
 
 void main() {
-	float z = texture(depthTexture, inUV).r;
+	// the G-buffer and this pass are rendered at the dynamic resolution scale
+	vec2 gbufferUV = WasabiScaledUV(inUV);
+	float z = texture(depthTexture, gbufferUV).r;
 	float x = inUV.x * 2.0f - 1.0f;
 	float y = inUV.y * 2.0f - 1.0f;
 	vec4 vPositionVS = uboPerFrame.projInv * vec4 (x, y, z, 1.0f);
 	vec3 pixelPositionV = vPositionVS.xyz / vPositionVS.w;
 
-	vec4 normalAndSpec = texture(normalTexture, inUV); //rg=packed-normal, b=specPower, a=specIntensityy
+	vec4 normalAndSpec = texture(normalTexture, gbufferUV); //rg=packed-normal, b=specPower, a=specIntensityy
 	vec3 pixelNormalV = WasabiUnpackNormalSpheremapTransform(normalAndSpec.xy);
 	float specularPower = normalAndSpec.b;
 	float specularIntensity = normalAndSpec.a;
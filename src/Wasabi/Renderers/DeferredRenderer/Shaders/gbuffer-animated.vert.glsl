@@ -5,6 +5,9 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "../../Common/Shaders/object_utils.glsl"
+#include "../../Common/Shaders/global_frame.glsl"
+#include "../../Common/Shaders/effect_features.glsl"
+#include "../../Common/Shaders/crowd_animation.glsl"
 
 layout(location = 0) in vec3 inPos;
 layout(location = 1) in vec3 inTang;
@@ -15,16 +18,12 @@ layout(location = 5) in uvec4 inBoneIndex;
 layout(location = 6) in vec4 inBoneWeight;
 
 layout(set = 0, binding = 0) uniform UBOPerObject {
-	mat4 worldMatrix;
 	vec4 color;
-	int isInstanced;
-	int isTextured;
 } uboPerObject;
 
-layout(set = 1, binding = 1) uniform UBOPerFrame {
-	mat4 viewMatrix;
-	mat4 projectionMatrix;
-} uboPerFrame;
+layout(push_constant) uniform PushConstant {
+	uint objectIndex;
+} pcPerObject;
 
 layout(set = 0, binding = 2) uniform sampler2D animationTexture;
 layout(set = 0, binding = 3) uniform sampler2D instancingTexture;
@@ -35,20 +34,23 @@ layout(location = 2) out vec3 outViewNorm;
 layout(location = 3) flat out uint outTexIndex;
 
 void main() {
+	mat4x4 worldMatrix = sceneObjects.objects[pcPerObject.objectIndex].worldMatrix;
+	mat4x4 normalMatrix = sceneObjects.objects[pcPerObject.objectIndex].normalMatrix;
 	mat4x4 animMtx = mat4x4(1.0);
 	mat4x4 instMtx =
-		uboPerObject.isInstanced == 1
+		isInstanced
 		? LoadMatrixFromTexture(gl_InstanceIndex, instancingTexture, textureSize(instancingTexture, 0).x)
 		: mat4x4(1.0f);
 	if (inBoneWeight.x  > 0.001f) {
 		int animationTextureWidth = textureSize(animationTexture, 0).x;
-		animMtx += inBoneWeight.x * LoadMatrixFromTexture(int(inBoneIndex.x), animationTexture, animationTextureWidth);
+		vec3 crowdSample = SampleCrowdAnimation(gl_InstanceIndex, instancingTexture, animationTexture);
+		animMtx += inBoneWeight.x * LoadBoneMatrix(int(inBoneIndex.x), crowdSample, animationTexture, animationTextureWidth);
 		if (inBoneWeight.y > 0.001f) {
-			animMtx += inBoneWeight.y * LoadMatrixFromTexture(int(inBoneIndex.y), animationTexture, animationTextureWidth);
+			animMtx += inBoneWeight.y * LoadBoneMatrix(int(inBoneIndex.y), crowdSample, animationTexture, animationTextureWidth);
 			if (inBoneWeight.z > 0.001f) {
-				animMtx += inBoneWeight.z * LoadMatrixFromTexture(int(inBoneIndex.z), animationTexture, animationTextureWidth);
+				animMtx += inBoneWeight.z * LoadBoneMatrix(int(inBoneIndex.z), crowdSample, animationTexture, animationTextureWidth);
 				if (inBoneWeight.w > 0.001f) {
-					animMtx += inBoneWeight.w * LoadMatrixFromTexture(int(inBoneIndex.w), animationTexture, animationTextureWidth);
+					animMtx += inBoneWeight.w * LoadBoneMatrix(int(inBoneIndex.w), crowdSample, animationTexture, animationTextureWidth);
 				}
 			}
 		}
@@ -58,9 +60,9 @@ void main() {
 	vec4 localPos2 = instMtx * vec4(localPos1.xyz, 1.0);
 	vec4 localNorm1 = animMtx * vec4(inNorm.xyz, 0.0f);
 	vec4 localNorm2 = instMtx * vec4(localNorm1.xyz, 0.0f);
-	outViewPos = (uboPerFrame.viewMatrix * uboPerObject.worldMatrix * localPos2).xyz;
-	outViewNorm = (uboPerFrame.viewMatrix * uboPerObject.worldMatrix * localNorm2).xyz;
+	outViewPos = (uboGlobalFrame.viewMatrix * worldMatrix * localPos2).xyz;
+	outViewNorm = (uboGlobalFrame.viewMatrix * normalMatrix * localNorm2).xyz;
 	outUV = inUV;
 	outTexIndex = inTexIndex;
-	gl_Position = uboPerFrame.projectionMatrix * vec4(outViewPos, 1.0);
+	gl_Position = uboGlobalFrame.projectionMatrix * vec4(outViewPos, 1.0);
 }
\ No newline at end of file
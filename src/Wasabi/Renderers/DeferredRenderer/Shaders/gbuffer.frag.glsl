@@ -4,14 +4,12 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "../../Common/Shaders/utils.glsl"
+#include "../../Common/Shaders/effect_features.glsl"
 
 layout(set = 0, binding = 0) uniform UBOPerObject {
-	mat4 worldMatrix;
 	vec4 color;
 	float specularPower;
 	float specularIntensity;
-	int isInstanced;
-	int isTextured;
 } uboPerObject;
 
 layout(set = 0, binding = 4) uniform sampler2D diffuseTexture[8];
@@ -25,7 +23,9 @@ layout(location = 0) out vec4 outColor;
 layout(location = 1) out vec4 outNormals;
 
 void main() {
-	outColor = texture(diffuseTexture[inTexIndex], inUV) * uboPerObject.isTextured + uboPerObject.color;
+	outColor = uboPerObject.color;
+	if (isTextured)
+		outColor += texture(diffuseTexture[inTexIndex], inUV);
     outNormals.rg = WasabiPackNormalSpheremapTransform(inViewNorm);
 	outNormals.ba = vec2(uboPerObject.specularPower, uboPerObject.specularIntensity);
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "../../Common/Shaders/object_utils.glsl"
+#include "../../Common/Shaders/global_frame.glsl"
+#include "../../Common/Shaders/effect_features.glsl"
 
 layout(location = 0) in vec3 inPos;
 layout(location = 1) in vec3 inTang;
@@ -13,17 +15,13 @@ layout(location = 3) in vec2 inUV;
 layout(location = 4) in uint inTexIndex;
 
 layout(set = 0, binding = 0) uniform UBOPerObject {
-	mat4 worldMatrix;
 	vec4 color;
 	float specular;
-	int isInstanced;
-	int isTextured;
 } uboPerObject;
 
-layout(set = 1, binding = 1) uniform UBOPerFrame {
-	mat4 viewMatrix;
-	mat4 projectionMatrix;
-} uboPerFrame;
+layout(push_constant) uniform PushConstant {
+	uint objectIndex;
+} pcPerObject;
 
 layout(set = 0, binding = 3) uniform sampler2D instancingTexture;
 
@@ -33,16 +31,18 @@ layout(location = 2) out vec3 outViewNorm;
 layout(location = 3) flat out uint outTexIndex;
 
 void main() {
+	mat4x4 worldMatrix = sceneObjects.objects[pcPerObject.objectIndex].worldMatrix;
+	mat4x4 normalMatrix = sceneObjects.objects[pcPerObject.objectIndex].normalMatrix;
 	mat4x4 instMtx =
-		uboPerObject.isInstanced == 1
+		isInstanced
 		? LoadMatrixFromTexture(gl_InstanceIndex, instancingTexture, textureSize(instancingTexture, 0).x)
 		: mat4x4(1.0f);
 
 	vec4 localPos = instMtx * vec4(inPos.xyz, 1.0);
 	vec4 localNorm = instMtx * vec4(inNorm.xyz, 0.0f);
-	outViewPos = (uboPerFrame.viewMatrix * uboPerObject.worldMatrix * localPos).xyz;
-	outViewNorm = (uboPerFrame.viewMatrix * uboPerObject.worldMatrix * localNorm).xyz;
+	outViewPos = (uboGlobalFrame.viewMatrix * worldMatrix * localPos).xyz;
+	outViewNorm = (uboGlobalFrame.viewMatrix * normalMatrix * localNorm).xyz;
 	outUV = inUV;
 	outTexIndex = inTexIndex;
-	gl_Position = uboPerFrame.projectionMatrix * vec4(outViewPos, 1.0);
+	gl_Position = uboGlobalFrame.projectionMatrix * vec4(outViewPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+/*
+ * Shared declarations of the instanced point and spot light volumes (pointlight.*.glsl and spotlight.*.glsl), every
+ * instance of the volume reads its light at gl_InstanceIndex.
+ */
+
+// see WLightBufferRenderStage::LightTypeAssets::lightsBuffer
+struct LightVolume {
+	vec4 color; // rgb: color, a: intensity
+	vec4 direction; // xyz: view-space direction, w: range
+	vec4 position; // xyz: view-space position, w: min cos angle
+	vec4 spot; // x: spot radius
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer LightsBuffer {
+	LightVolume lights[];
+} lightsBuffer;
+
+layout(set = 0, binding = 3) uniform UBOPerFrame {
+	mat4 proj;
+	mat4 projInv;
+} uboPerFrame;
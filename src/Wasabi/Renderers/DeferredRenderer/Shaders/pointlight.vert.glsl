@@ -1,20 +1,20 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "lightvolumes.glsl"
 
 layout(location = 0) in vec3 inPos;
 layout(location = 0) out vec4 outPos;
-
-layout(set = 0, binding = 0) uniform UBOPerLight {
-	mat4 wvp;
-	vec3 lightDir;
-	float range;
-	vec3 lightColor;
-	float intensity;
-	vec3 position;
-} uboPerLight;
+layout(location = 1) flat out int outLightIndex;
 
 void main() {
-	gl_Position = uboPerLight.wvp * vec4(inPos.xyz * uboPerLight.range * 1.05f, 1.0); // scale a bit more to make the sphere big enough so edges don't make a seam
+	vec4 lightDir = lightsBuffer.lights[gl_InstanceIndex].direction;
+	vec4 lightPos = lightsBuffer.lights[gl_InstanceIndex].position;
+
+	vec3 viewPos = lightPos.xyz + inPos.xyz * lightDir.w * 1.05f; // scale a bit more to make the sphere big enough so edges don't make a seam
+	gl_Position = uboPerFrame.proj * vec4(viewPos, 1.0);
 	outPos = gl_Position;
-}
\ No newline at end of file
+	outLightIndex = gl_InstanceIndex;
+}
@@ -0,0 +1,117 @@
+/*
+ * Shared code of the scene composition, included by scene_composition.frag.glsl (reads the G-buffer as textures)
+ * and scene_composition_subpass.frag.glsl (reads the G-buffer as input attachments in a merged render pass).
+ * The including shader defines SCENE_COMPOSITION_FRONT_DEPTH_AO if it can sample the G-buffer depth around the
+ * pixel (depthTexture), otherwise the ambient occlusion only uses the back-face depth.
+ */
+
+#include "../../Common/Shaders/utils.glsl"
+#include "../../Common/Shaders/global_frame.glsl"
+#include "../../Common/Shaders/upscale.glsl"
+
+layout(set = 1, binding = 6) uniform sampler2D backfaceDepthTexture;
+layout(set = 1, binding = 7) uniform sampler2D randomTexture;
+#ifdef SCENE_COMPOSITION_FRONT_DEPTH_AO
+layout(set = 1, binding = 5) uniform sampler2D depthTexture;
+#endif
+
+layout(location = 0) in vec2 inUV;
+layout(location = 0) out vec4 outFragColor;
+
+layout(set = 0, binding = 0) uniform UBOPerFrame {
+	mat4x4 projInv;
+} uboPerFrame;
+
+layout(set = 1, binding = 1) uniform UBOParams {
+	vec4 ambient;
+	float SSAOSampleRadius;
+	float SSAOIntensity;
+	float SSAODistanceScale;
+	float SSAOAngleBias;
+	float camFarClip;
+} uboParams;
+
+vec3 getPosition_depth(vec2 uv, float z) {
+	float x = uv.x * 2.0f - 1.0f;
+	float y = uv.y * 2.0f - 1.0f;
+	vec4 vPositionVS = uboPerFrame.projInv * vec4 (x, y, z, 1.0f);
+	return vPositionVS.xyz / vPositionVS.w;
+}
+
+vec3 getPositionBackface(vec2 uv) {
+	float z = WasabiSampleScaled(backfaceDepthTexture, uv).r;
+	float x = uv.x * 2.0f - 1.0f;
+	float y = uv.y * 2.0f - 1.0f;
+	vec4 vPositionVS = uboPerFrame.projInv * vec4 (x, y, z, 1.0f);
+	return vPositionVS.xyz / vPositionVS.w;
+}
+
+vec2 getRandom(vec2 uv) {
+	return vec2(0,0);//texture(randomTexture, vec2(2500,1000) * uv / 100).xy * 2.0f - 1.0f;
+}
+
+#ifdef SCENE_COMPOSITION_FRONT_DEPTH_AO
+vec3 getPosition(vec2 uv) {
+	float z = WasabiSampleScaled(depthTexture, uv).r;
+	return getPosition_depth(uv, z);
+}
+
+float getAmbientOcclusion(vec2 tcoord, vec2 uv, vec3 p, vec3 cnorm) {
+	float intensity = 2;
+	float scale = 1;
+	float bias = 0.2;
+
+	vec3 diff = getPosition(tcoord + uv) - p;
+	vec3 v = normalize(diff);
+	float d = length(diff) * uboParams.SSAODistanceScale;
+	return max(0.0, dot(cnorm,v)-uboParams.SSAOAngleBias) * (1.0/(1.0+d)) * uboParams.SSAOIntensity;
+}
+#endif
+
+float getBackfaceAmbientOcclusion(vec2 tcoord, vec2 uv, vec3 p, vec3 cnorm) {
+	float intensity = 2;
+	float scale = 1;
+	float bias = 0.2;
+
+	vec3 diff = getPositionBackface(tcoord + uv) - p;
+	vec3 v = normalize(diff);
+	float d = length(diff) * uboParams.SSAODistanceScale;
+	return max(0.0, dot(cnorm,v)-uboParams.SSAOAngleBias) * (1.0/(1.0+d)) * uboParams.SSAOIntensity;
+}
+
+float SceneCompositionAmbientOcclusion(vec3 occluderPos, vec3 occluderNorm) {
+	vec2 occludersUVs[4] = {vec2(1, 0), vec2(-1, 0), vec2(0, 1), vec2(0, -1)};
+	vec2 rand = getRandom(inUV);
+	float rad = uboParams.SSAOSampleRadius / occluderPos.z;
+
+	float ao = 0.0f;
+	int iterations = int(mix(6.0, 2.0, occluderPos.z / uboParams.camFarClip));
+	for (int i = 0; i < iterations; i++) {
+		vec2 coord1 = reflect(occludersUVs[i], rand) * rad;
+		vec2 coord2 = vec2(coord1.x*0.707 - coord1.y*0.707, coord1.x*0.707 + coord1.y*0.707);
+
+#ifdef SCENE_COMPOSITION_FRONT_DEPTH_AO
+		ao += getAmbientOcclusion(inUV, coord1*0.25, occluderPos, occluderNorm);
+		ao += getAmbientOcclusion(inUV, coord2*0.5, occluderPos, occluderNorm);
+		ao += getAmbientOcclusion(inUV, coord1*0.75, occluderPos, occluderNorm);
+		ao += getAmbientOcclusion(inUV, coord2*1.0, occluderPos, occluderNorm);
+#endif
+
+		ao += getBackfaceAmbientOcclusion(inUV, coord1*(0.25+0.125), occluderPos, occluderNorm);
+		ao += getBackfaceAmbientOcclusion(inUV, coord2*(0.5+0.125), occluderPos, occluderNorm);
+		ao += getBackfaceAmbientOcclusion(inUV, coord1*(0.75), occluderPos, occluderNorm);
+		ao += getBackfaceAmbientOcclusion(inUV, coord2*(1.0+0.125), occluderPos, occluderNorm);
+	}
+
+#ifdef SCENE_COMPOSITION_FRONT_DEPTH_AO
+	return ao / (iterations * 8.0f);
+#else
+	return ao / (iterations * 4.0f);
+#endif
+}
+
+vec4 SceneCompositionShade(vec4 color, vec4 light, float ao) {
+	vec3 ambientLight = max(vec3(0,0,0), color.rgb * uboParams.ambient.rgb - vec3(ao));
+	vec3 lit = color.rgb * light.rgb;
+	return vec4(ambientLight + lit, color.a);
+}
@@ -0,0 +1,24 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "scene_composition.glsl"
+
+layout(input_attachment_index = 0, set = 1, binding = 2) uniform subpassInput diffuseTexture;
+layout(input_attachment_index = 1, set = 1, binding = 3) uniform subpassInput lightTexture;
+layout(input_attachment_index = 2, set = 1, binding = 4) uniform subpassInput normalTexture;
+layout(input_attachment_index = 3, set = 1, binding = 5) uniform subpassInput depthTexture;
+
+void main() {
+	// the G-buffer and light buffer were rendered at this pixel by the previous subpasses, at the dynamic
+	// resolution scale (a WUpscaleRenderStage brings the composed scene to the screen)
+	vec4 color = subpassLoad(diffuseTexture);
+	vec4 light = subpassLoad(lightTexture);
+
+	float depth = subpassLoad(depthTexture).r;
+	vec3 occluderPos = getPosition_depth(inUV, depth);
+	vec3 occluderNorm = WasabiUnpackNormalSpheremapTransform(subpassLoad(normalTexture).xy);
+
+	outFragColor = SceneCompositionShade(color, light, SceneCompositionAmbientOcclusion(occluderPos, occluderNorm));
+}
@@ -4,37 +4,43 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "../../Common/Shaders/utils.glsl"
+#include "../../Common/Shaders/object_utils.glsl"
+#include "../../Common/Shaders/global_frame.glsl"
+#include "../../Common/Shaders/upscale.glsl"
+#include "lightvolumes.glsl"
+
+// the depth test and depth bounds test reject the pixels out of the volume before shading them (even though the
+// shader discards)
+layout(early_fragment_tests) in;
 
 layout(location = 0) in vec4 inPos;
+layout(location = 1) flat in int inLightIndex;
 layout(location = 0) out vec4 outFragColor;
 
-layout(set = 1, binding = 1) uniform sampler2D normalTexture;
-layout(set = 1, binding = 2) uniform sampler2D depthTexture;
-
-layout(set = 0, binding = 0) uniform UBOPerLight {
-	mat4 wvp;
-	vec3 lightDir;
-	float range;
-	vec3 lightColor;
-	float intensity;
-	vec3 position;
-	float minCosAngle;
-	float spotRadius;
-} uboPerLight;
-
-layout(set = 1, binding = 3) uniform UBOPerFrame {
-	mat4 projInv;
-} uboPerFrame;
+layout(set = 0, binding = 1) uniform sampler2D normalTexture;
+layout(set = 0, binding = 2) uniform sampler2D depthTexture;
 
 void main() {
+	LightVolume lightVolume = lightsBuffer.lights[inLightIndex];
+	vec4 lightColor = lightVolume.color;
+	vec4 lightDir = lightVolume.direction;
+	vec4 lightPos = lightVolume.position;
+
 	vec2 uv = (inPos.xy/inPos.w + 1) / 2;
-	float z = texture(depthTexture, uv).r;
+	vec2 gbufferUV = WasabiScaledUV(uv); // the G-buffer and this pass are rendered at the dynamic resolution scale
+	float z = texture(depthTexture, gbufferUV).r;
 	float x = uv.x * 2.0f - 1.0f;
 	float y = uv.y * 2.0f - 1.0f;
 	vec4 vPositionVS = uboPerFrame.projInv * vec4 (x, y, z, 1.0f);
 	vec3 pixelPositionV = vPositionVS.xyz / vPositionVS.w;
 
-	vec4 normalAndSpec = texture(normalTexture, uv); //rg=packed-normal, b=specPower, a=specIntensityy
+	// pixels behind the volume failed the depth test, reject the ones in front of it that are out of the light's range or cone
+	vec3 lightVec = pixelPositionV - lightPos.xyz;
+	float lightDistSq = dot(lightVec, lightVec);
+	if (lightDistSq > lightDir.w * lightDir.w || dot(lightVec, normalize(lightDir.xyz)) < lightPos.w * sqrt(lightDistSq))
+		discard;
+
+	vec4 normalAndSpec = texture(normalTexture, gbufferUV); //rg=packed-normal, b=specPower, a=specIntensityy
 	vec3 pixelNormalV = WasabiUnpackNormalSpheremapTransform(normalAndSpec.xy);
 	float specularPower = normalAndSpec.b;
 	float specularIntensity = normalAndSpec.a;
@@ -45,11 +51,11 @@ void main() {
 		pixelNormalV,
 		camDirV,
 		specularPower,
-		uboPerLight.position,
-		uboPerLight.lightDir,
-		uboPerLight.lightColor,
-		uboPerLight.range,
-		uboPerLight.minCosAngle
+		lightPos.xyz,
+		lightDir.xyz,
+		lightColor.rgb,
+		lightDir.w,
+		lightPos.w
 	);
-	outFragColor = vec4(light.rgb * uboPerLight.intensity + light.rgb * light.a * specularIntensity, 1);
-}
\ No newline at end of file
+	outFragColor = vec4(light.rgb * lightColor.a + light.rgb * light.a * specularIntensity, 1);
+}
@@ -1,23 +1,26 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "lightvolumes.glsl"
 
 layout(location = 0) in vec3 inPos;
 layout(location = 0) out vec4 outPos;
-
-layout(set = 0, binding = 0) uniform UBOPerLight {
-	mat4 wvp;
-	vec3 lightDir;
-	float range;
-	vec3 lightColor;
-	float intensity;
-	vec3 position;
-	float minCosAngle;
-	float spotRadius;
-} uboPerLight;
+layout(location = 1) flat out int outLightIndex;
 
 void main() {
-	vec3 localPos = inPos.xyz * vec3(uboPerLight.spotRadius, uboPerLight.spotRadius, uboPerLight.range);
-	gl_Position = uboPerLight.wvp * vec4(localPos, 1.0);
+	vec4 lightDir = lightsBuffer.lights[gl_InstanceIndex].direction;
+	vec4 lightPos = lightsBuffer.lights[gl_InstanceIndex].position;
+	float spotRadius = lightsBuffer.lights[gl_InstanceIndex].spot.x;
+
+	// the cone is along +z, any basis around the light direction works since the cone is symmetric
+	vec3 forward = normalize(lightDir.xyz);
+	vec3 right = normalize(cross(abs(forward.y) < 0.99f ? vec3(0, 1, 0) : vec3(1, 0, 0), forward));
+	vec3 up = cross(forward, right);
+	vec3 localPos = inPos.xyz * vec3(spotRadius, spotRadius, lightDir.w);
+	vec3 viewPos = lightPos.xyz + right * localPos.x + up * localPos.y + forward * localPos.z;
+	gl_Position = uboPerFrame.proj * vec4(viewPos, 1.0);
 	outPos = gl_Position;
-}
\ No newline at end of file
+	outLightIndex = gl_InstanceIndex;
+}
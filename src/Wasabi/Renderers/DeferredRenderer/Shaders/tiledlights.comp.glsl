@@ -0,0 +1,152 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+// Tiled deferred lighting, see WLightBufferRenderStage::RecordPassCompute. Every work group lights one tile
+// of the screen: it reduces the view-space depth bounds of the tile's pixels, culls the lights against the
+// tile's frustum clamped to those bounds and lights every pixel of the tile with the lights that passed.
+
+#include "../../Common/Shaders/utils.glsl"
+#include "../../Common/Shaders/object_utils.glsl"
+#include "../../Common/Shaders/shadows.glsl"
+// only the lights buffer of WLightClusters, at binding 3
+#define W_LIGHT_CLUSTERS_SET 0
+#define W_LIGHT_CLUSTERS_BINDING 3
+#define W_LIGHT_CLUSTERS_LIGHTS_ONLY
+#include "../../Common/Shaders/light_clusters.glsl"
+
+// must match W_TILED_LIGHTS_TILE_SIZE and W_TILED_LIGHTS_MAX_TILE_LIGHTS
+#define TILE_SIZE 16
+#define MAX_TILE_LIGHTS 256
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+layout(set = 0, binding = 0) uniform UBOPerFrame {
+	mat4 viewMatrix;
+	mat4 projInv; // inverse of projection
+	vec4 camDir; // xyz: camera direction (world space)
+	uvec4 size; // xy: size of the rendered region, z: number of directional lights, w: number of lights
+} uboPerFrame;
+
+layout(set = 0, binding = 1) uniform sampler2D normalTexture;
+layout(set = 0, binding = 2) uniform sampler2D depthTexture;
+layout(set = 0, binding = 4) uniform sampler2D shadowAtlas;
+layout(set = 0, binding = 5) uniform sampler2D shadowTilesTexture;
+layout(set = 0, binding = 6, rgba16f) uniform writeonly image2D outputImage;
+
+shared uint tileMinDepth;
+shared uint tileMaxDepth;
+shared uint tileNumLights;
+shared uint tileLights[MAX_TILE_LIGHTS];
+
+vec3 ViewPosition(vec2 ndc, float z) {
+	vec4 positionV = uboPerFrame.projInv * vec4(ndc, z, 1.0f);
+	return positionV.xyz / positionV.w;
+}
+
+void main() {
+	uvec2 pixel = gl_GlobalInvocationID.xy;
+	bool inRegion = all(lessThan(pixel, uboPerFrame.size.xy));
+	vec2 ndc = (vec2(pixel) + 0.5f) / vec2(uboPerFrame.size.xy) * 2.0f - 1.0f;
+
+	// the depth is cleared to 1, pixels at the far plane have no geometry to light
+	float z = inRegion ? texelFetch(depthTexture, ivec2(pixel), 0).r : 1.0f;
+	bool hasGeometry = z < 1.0f;
+	vec3 pixelPositionV = ViewPosition(ndc, z);
+
+	//
+	// View-space depth bounds of the tile (positive depths compare like their bits)
+	//
+	if (gl_LocalInvocationIndex == 0) {
+		tileMinDepth = floatBitsToUint(3.402823e38f);
+		tileMaxDepth = 0;
+		tileNumLights = 0;
+	}
+	barrier();
+	if (hasGeometry) {
+		atomicMin(tileMinDepth, floatBitsToUint(max(pixelPositionV.z, 0.0f)));
+		atomicMax(tileMaxDepth, floatBitsToUint(max(pixelPositionV.z, 0.0f)));
+	}
+	memoryBarrierShared();
+	barrier();
+	float minDepth = uintBitsToFloat(tileMinDepth);
+	float maxDepth = uintBitsToFloat(tileMaxDepth);
+
+	//
+	// Cull the point and spot lights against the tile's frustum and depth bounds, every thread tests one light
+	// at a time. Lights are sorted closest first, so if the tile has too many lights it keeps the closest ones
+	// (up to the order within a batch of lights)
+	//
+	uint numDirectional = uboPerFrame.size.z;
+	uint numLights = uboPerFrame.size.w;
+	if (minDepth <= maxDepth) {
+		// side planes of the tile through the camera (the origin), with normals pointing inside
+		vec2 tileMin = vec2(gl_WorkGroupID.xy * TILE_SIZE) / vec2(uboPerFrame.size.xy) * 2.0f - 1.0f;
+		vec2 tileMax = vec2((gl_WorkGroupID.xy + 1) * TILE_SIZE) / vec2(uboPerFrame.size.xy) * 2.0f - 1.0f;
+		vec3 corners[4] = {
+			ViewPosition(vec2(tileMin.x, tileMin.y), 1.0f),
+			ViewPosition(vec2(tileMax.x, tileMin.y), 1.0f),
+			ViewPosition(vec2(tileMax.x, tileMax.y), 1.0f),
+			ViewPosition(vec2(tileMin.x, tileMax.y), 1.0f)
+		};
+		vec3 tileCenter = corners[0] + corners[1] + corners[2] + corners[3];
+		vec3 planes[4];
+		for (int i = 0; i < 4; i++) {
+			planes[i] = normalize(cross(corners[i], corners[(i + 1) % 4]));
+			if (dot(planes[i], tileCenter) < 0.0f)
+				planes[i] = -planes[i];
+		}
+
+		for (uint first = numDirectional; first < numLights; first += TILE_SIZE * TILE_SIZE) {
+			uint lightIndex = first + gl_LocalInvocationIndex;
+			if (lightIndex < numLights) {
+				// spot lights are culled using the sphere around their range, which contains their cone
+				WasabiClusteredLight light = lightsBuffer.lights[lightIndex];
+				vec3 center = (uboPerFrame.viewMatrix * vec4(light.position.xyz, 1.0f)).xyz;
+				float range = light.direction.w;
+				bool inTile = center.z + range >= minDepth && center.z - range <= maxDepth;
+				for (int i = 0; i < 4 && inTile; i++)
+					inTile = dot(planes[i], center) >= -range;
+				if (inTile) {
+					uint slot = atomicAdd(tileNumLights, 1);
+					if (slot < MAX_TILE_LIGHTS)
+						tileLights[slot] = lightIndex;
+				}
+			}
+			memoryBarrierShared();
+			barrier();
+			// all the threads must read the count before any of them adds lights of the next batch
+			uint numAdded = tileNumLights;
+			barrier();
+			if (numAdded >= MAX_TILE_LIGHTS)
+				break;
+		}
+	}
+
+	if (!inRegion)
+		return;
+
+	vec3 totalLighting = vec3(0.0f);
+	if (hasGeometry) {
+		//rg=packed-normal, b=specPower, a=specIntensity
+		vec4 normalAndSpec = texelFetch(normalTexture, ivec2(pixel), 0);
+		vec3 pixelNormalV = WasabiUnpackNormalSpheremapTransform(normalAndSpec.xy);
+		float specularPower = normalAndSpec.b;
+		float specularIntensity = normalAndSpec.a;
+
+		// lights are in world space, the view matrix is a rotation and a translation so its inverse is cheap
+		mat3 viewRotationInv = transpose(mat3(uboPerFrame.viewMatrix));
+		vec3 pixelPositionW = viewRotationInv * (pixelPositionV - uboPerFrame.viewMatrix[3].xyz);
+		vec3 pixelNormalW = viewRotationInv * pixelNormalV;
+		vec3 camDir = uboPerFrame.camDir.xyz;
+
+		// directional lights are first in the lights buffer and light every tile
+		for (uint i = 0; i < numDirectional; i++)
+			totalLighting += WasabiClusteredLightContribution(i, pixelPositionW, pixelNormalW, camDir, specularPower, specularIntensity, shadowAtlas, shadowTilesTexture);
+		uint numTileLights = min(tileNumLights, uint(MAX_TILE_LIGHTS));
+		for (uint i = 0; i < numTileLights; i++)
+			totalLighting += WasabiClusteredLightContribution(tileLights[i], pixelPositionW, pixelNormalW, camDir, specularPower, specularIntensity, shadowAtlas, shadowTilesTexture);
+	}
+	imageStore(outputImage, ivec2(pixel), vec4(totalLighting, 1.0f));
+}
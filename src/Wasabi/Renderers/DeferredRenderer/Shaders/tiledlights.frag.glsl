@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+// Copies the lighting of the tiled compute pass (see tiledlights.comp.glsl) to the LightBuffer, both cover the
+// same (dynamic resolution) region so the pixels map one to one
+
+layout(set = 0, binding = 0) uniform sampler2D tiledLightsTexture;
+
+layout(location = 0) in vec2 inUV;
+layout(location = 0) out vec4 outFragColor;
+
+void main() {
+	outFragColor = texelFetch(tiledLightsTexture, ivec2(gl_FragCoord.xy), 0);
+}
@@ -7,10 +7,42 @@
 #include "Wasabi/Renderers/Common/WTextRenderStage.hpp"
 #include "Wasabi/Renderers/Common/WParticlesRenderStage.hpp"
 #include "Wasabi/Renderers/Common/WBackfaceDepthRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WShadowRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WUpscaleRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WSkinningRenderStage.hpp"
 
 WError WInitializeDeferredRenderer(Wasabi* app) {
-	return app->Renderer->SetRenderingStages({
+	// animated objects are skinned once per frame for both the G-buffer and the backface depth passes
+	bool computeSkinning = app->GetEngineParam<bool>("computeSkinning", false);
+
+	if (app->GetEngineParam<bool>("mergedDeferredPasses", false)) {
+		// the G-buffer, lighting and composition are subpasses of one render pass, the composed scene is
+		// upscaled to the back buffer
+		std::vector<WRenderStage*> stages = {
+			new WShadowRenderStage(app),
+			new WBackfaceDepthRenderStage(app),
+			new WGBufferRenderStage(app, true),
+		};
+		if (computeSkinning)
+			stages.push_back(new WSkinningRenderStage(app));
+		stages.insert(stages.end(), {
+			new WLightBufferRenderStage(app, true),
+			new WSceneCompositionRenderStage(app, true),
+			new WUpscaleRenderStage(app, "SceneColor", "GBufferDepth"),
+			new WParticlesRenderStage(app),
+			new WSpritesRenderStage(app),
+			new WTextsRenderStage(app),
+		});
+		return app->Renderer->SetRenderingStages(stages);
+	}
+
+	std::vector<WRenderStage*> stages = {
+		new WShadowRenderStage(app),
 		new WGBufferRenderStage(app),
+	};
+	if (computeSkinning)
+		stages.push_back(new WSkinningRenderStage(app));
+	stages.insert(stages.end(), {
 		new WBackfaceDepthRenderStage(app),
 		new WLightBufferRenderStage(app),
 		new WSceneCompositionRenderStage(app),
@@ -18,4 +50,5 @@ WError WInitializeDeferredRenderer(Wasabi* app) {
 		new WSpritesRenderStage(app),
 		new WTextsRenderStage(app),
 	});
+	return app->Renderer->SetRenderingStages(stages);
 }
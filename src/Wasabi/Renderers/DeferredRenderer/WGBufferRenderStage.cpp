@@ -21,18 +21,15 @@ W_SHADER_DESC WGBufferVS::GetDesc() {
 	desc.type = W_VERTEX_SHADER;
 	desc.bound_resources = {
 		W_BOUND_RESOURCE(W_TYPE_UBO, 0, 0, "uboPerObject", {
-			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "worldMatrix"), // world
 			W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "color"), // object color
 			W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "specularPower"), // specular power (dot raised to this power)
 			W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "specularIntensity"), // specular intensity (specular term is multiplied by this)
-			W_SHADER_VARIABLE_INFO(W_TYPE_INT, "isInstanced"), // whether or not instancing is enabled
-			W_SHADER_VARIABLE_INFO(W_TYPE_INT, "isTextured"), // whether or not to use diffuse texture
-		}),
-		W_BOUND_RESOURCE(W_TYPE_UBO, 1, 1, "uboPerFrame", {
-			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "viewMatrix"), // view
-			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projectionMatrix"), // projection
 		}),
+		WRenderer::GetGlobalFrameBoundResource(),
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 3, 0, "instancingTexture"),
+		W_BOUND_RESOURCE(W_TYPE_PUSH_CONSTANT, 0, "pcPerObject", {
+			W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "objectIndex"), // index into the renderer's scene objects buffer
+		}),
 	};
 	desc.input_layouts = { W_INPUT_LAYOUT({
 		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3), // position
@@ -62,6 +59,7 @@ W_SHADER_DESC WGBufferAnimatedVS::GetDesc() {
 		WGBufferVS::GetDesc().bound_resources[1],
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 2, 0, "animationTexture"),
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 3, 0, "instancingTexture"),
+		WGBufferVS::GetDesc().bound_resources[3],
 	};
 	desc.input_layouts = {
 		WGBufferVS::GetDesc().input_layouts[0], W_INPUT_LAYOUT({
@@ -91,7 +89,7 @@ W_SHADER_DESC WGBufferPS::GetDesc() {
 	return desc;
 }
 
-WGBufferRenderStage::WGBufferRenderStage(Wasabi* const app) : WRenderStage(app) {
+WGBufferRenderStage::WGBufferRenderStage(Wasabi* const app, bool mergedPasses) : WRenderStage(app) {
 	m_stageDescription.name = __func__;
 	m_stageDescription.target = RENDER_STAGE_TARGET_BUFFER;
 	m_stageDescription.depthOutput = WRenderStage::OUTPUT_IMAGE("GBufferDepth", VK_FORMAT_D16_UNORM, WColor(1.0f, 0.0f, 0.0f, 0.0f));
@@ -99,12 +97,32 @@ WGBufferRenderStage::WGBufferRenderStage(Wasabi* const app) : WRenderStage(app)
 		WRenderStage::OUTPUT_IMAGE("GBufferDiffuse", VK_FORMAT_R8G8B8A8_UNORM, WColor(0.0f, 0.0f, 0.0f, 0.0f)),
 		WRenderStage::OUTPUT_IMAGE("GBufferViewSpaceNormal", VK_FORMAT_R16G16B16A16_SFLOAT, WColor(0.0f, 0.0f, 0.0f, 0.0f)),
 	});
-	m_stageDescription.flags = RENDER_STAGE_FLAG_PICKING_RENDER_STAGE;
+	// the G-buffer is only read by the lighting and composition stages
+	m_stageDescription.depthOutput.transient = true;
+	for (auto& output : m_stageDescription.colorOutputs)
+		output.transient = true;
+	if (mergedPasses) {
+		// the lighting and composition subpasses read the G-buffer at the same pixel, so it can stay in tile memory
+		m_stageDescription.colorOutputs.push_back(WRenderStage::OUTPUT_IMAGE("LightBuffer", VK_FORMAT_R16G16B16A16_SFLOAT, WColor(0.0f, 0.0f, 0.0f, 0.0f)));
+		m_stageDescription.colorOutputs[2].transient = true;
+		for (uint32_t i = 0; i < 3; i++)
+			m_stageDescription.colorOutputs[i].imageFlags = W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT | W_IMAGE_CREATE_INPUT_ATTACHMENT | W_IMAGE_CREATE_TRANSIENT_ATTACHMENT;
+		m_stageDescription.colorOutputs.push_back(WRenderStage::OUTPUT_IMAGE("SceneColor", VK_FORMAT_R8G8B8A8_UNORM, WColor(0.0f, 0.0f, 0.0f, 0.0f)));
+		m_stageDescription.colorOutputs[3].transient = true; // only read by the upscale
+		m_stageDescription.depthOutput.imageFlags |= W_IMAGE_CREATE_INPUT_ATTACHMENT;
+
+		// attachments: 0 diffuse, 1 normals, 2 light buffer, 3 scene color, 4 depth
+		m_stageDescription.subpasses = std::vector<W_RENDER_TARGET_SUBPASS>({
+			{ { 0, 1 }, {}, true }, // G-buffer
+			{ { 2 }, { 1, 4 }, false }, // lighting (see WLightBufferRenderStage)
+			{ { 3 }, { 0, 2, 1, 4 }, false }, // composition (see WSceneCompositionRenderStage)
+			{ { 3 }, {}, true }, // forward objects (see WSceneCompositionRenderStage)
+		});
+	}
+	m_stageDescription.flags = RENDER_STAGE_FLAG_PICKING_RENDER_STAGE | RENDER_STAGE_FLAG_DYNAMIC_RESOLUTION;
 
 	m_objectsFragment = nullptr;
 	m_animatedObjectsFragment = nullptr;
-	m_perFrameMaterial = nullptr;
-	m_perFrameAnimatedMaterial = nullptr;
 
 	m_defaultVS = nullptr;
 	m_defaultAnimatedVS = nullptr;
@@ -121,37 +139,38 @@ WError WGBufferRenderStage::Initialize(std::vector<WRenderStage*>& previousStage
 	m_defaultVS = new WGBufferVS(m_app);
 	m_defaultVS->SetName("GBufferDefaultVS");
 	m_app->FileManager->AddDefaultAsset(m_defaultVS->GetName(), m_defaultVS);
-	m_defaultVS->Load();
 
 	m_defaultAnimatedVS = new WGBufferAnimatedVS(m_app);
 	m_defaultAnimatedVS->SetName("GBufferDefaultAnimatedVS");
 	m_app->FileManager->AddDefaultAsset(m_defaultAnimatedVS->GetName(), m_defaultAnimatedVS);
-	m_defaultAnimatedVS->Load();
 
 	m_defaultPS = new WGBufferPS(m_app);
 	m_defaultPS->SetName("GBufferDefaultPS");
 	m_app->FileManager->AddDefaultAsset(m_defaultPS->GetName(), m_defaultPS);
-	m_defaultPS->Load();
+
+	m_app->ShaderManager->LoadShaders({ m_defaultVS, m_defaultAnimatedVS, m_defaultPS });
 
 	m_defaultFX = new WEffect(m_app);
 	m_defaultFX->SetName("GBufferDefaultEffect");
 	m_app->FileManager->AddDefaultAsset(m_defaultFX->GetName(), m_defaultFX);
+	m_defaultFX->SetSupportedFeatures(EFFECT_FEATURE_INSTANCED | EFFECT_FEATURE_TEXTURED);
 
 	m_defaultAnimatedFX = new WEffect(m_app);
 	m_defaultAnimatedFX->SetName("GBufferDefaultAnimatedEffect");
 	m_app->FileManager->AddDefaultAsset(m_defaultAnimatedFX->GetName(), m_defaultAnimatedFX);
+	m_defaultAnimatedFX->SetSupportedFeatures(EFFECT_FEATURE_INSTANCED | EFFECT_FEATURE_TEXTURED | EFFECT_FEATURE_CROWD_ANIMATED);
 
 	err = m_defaultFX->BindShader(m_defaultVS);
 	if (err) {
 		err = m_defaultFX->BindShader(m_defaultPS);
 		if (err) {
-			err = m_defaultFX->BuildPipeline(m_renderTarget);
+			err = m_defaultFX->BuildPipelineAsync(m_renderTarget);
 			if (err) {
 				err = m_defaultAnimatedFX->BindShader(m_defaultAnimatedVS);
 				if (err) {
 					err = m_defaultAnimatedFX->BindShader(m_defaultPS);
 					if (err) {
-						err = m_defaultAnimatedFX->BuildPipeline(m_renderTarget);
+						err = m_defaultAnimatedFX->BuildPipelineAsync(m_renderTarget);
 					}
 				}
 			}
@@ -160,28 +179,15 @@ WError WGBufferRenderStage::Initialize(std::vector<WRenderStage*>& previousStage
 	if (!err)
 		return err;
 
-	m_objectsFragment = new WObjectsRenderFragment(m_stageDescription.name, false, m_defaultFX, m_app, EFFECT_RENDER_FLAG_RENDER_GBUFFER);
-	m_animatedObjectsFragment = new WObjectsRenderFragment(m_stageDescription.name + "-animated", true, m_defaultAnimatedFX, m_app, EFFECT_RENDER_FLAG_RENDER_GBUFFER);
-
-	m_perFrameMaterial = m_objectsFragment->GetEffect()->CreateMaterial(1, true);
-	if (!m_perFrameMaterial)
-		return WError(W_ERRORUNK);
-	m_perFrameMaterial->SetName("GBufferPerFrameMaterial");
-	m_app->FileManager->AddDefaultAsset(m_perFrameMaterial->GetName(), m_perFrameMaterial);
-
-	m_perFrameAnimatedMaterial = m_animatedObjectsFragment->GetEffect()->CreateMaterial(1, true);
-	if (!m_perFrameAnimatedMaterial)
-		return WError(W_ERRORUNK);
-	m_perFrameAnimatedMaterial->SetName("GBufferPerFrameAnimatedMaterial");
-	m_app->FileManager->AddDefaultAsset(m_perFrameAnimatedMaterial->GetName(), m_perFrameAnimatedMaterial);
+	// objects skinned by a WSkinningRenderStage are rendered with the non-animated effect
+	m_objectsFragment = new WObjectsRenderFragment(m_stageDescription.name, false, m_defaultFX, m_app, EFFECT_RENDER_FLAG_RENDER_GBUFFER, true, true);
+	m_animatedObjectsFragment = new WObjectsRenderFragment(m_stageDescription.name + "-animated", true, m_defaultAnimatedFX, m_app, EFFECT_RENDER_FLAG_RENDER_GBUFFER, true, true);
 
 	return WError(W_SUCCEEDED);
 }
 
 void WGBufferRenderStage::Cleanup() {
 	WRenderStage::Cleanup();
-	W_SAFE_REMOVEREF(m_perFrameMaterial);
-	W_SAFE_REMOVEREF(m_perFrameAnimatedMaterial);
 	W_SAFE_DELETE(m_objectsFragment);
 	W_SAFE_DELETE(m_animatedObjectsFragment);
 	W_SAFE_REMOVEREF(m_defaultVS);
@@ -191,14 +197,7 @@ void WGBufferRenderStage::Cleanup() {
 
 WError WGBufferRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, uint32_t filter) {
 	if (filter & RENDER_FILTER_OBJECTS) {
-		WCamera* cam = rt->GetCamera();
-
-		m_perFrameMaterial->SetVariable<WMatrix>("viewMatrix", cam->GetViewMatrix());
-		m_perFrameMaterial->SetVariable<WMatrix>("projectionMatrix", cam->GetProjectionMatrix());
-
-		m_perFrameAnimatedMaterial->SetVariable<WMatrix>("viewMatrix", cam->GetViewMatrix());
-		m_perFrameAnimatedMaterial->SetVariable<WMatrix>("projectionMatrix", cam->GetProjectionMatrix());
-
+		// the camera matrices come from the renderer's global per-frame UBO
 		m_objectsFragment->Render(renderer, rt);
 
 		m_animatedObjectsFragment->Render(renderer, rt);
@@ -1,15 +1,23 @@
 #include "Wasabi/Renderers/DeferredRenderer/WLightBufferRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WShadowRenderStage.hpp"
 #include "Wasabi/Renderers/WRenderer.hpp"
 #include "Wasabi/Core/WCore.hpp"
 #include "Wasabi/Images/WRenderTarget.hpp"
+#include "Wasabi/Images/WImage.hpp"
 #include "Wasabi/Materials/WEffect.hpp"
 #include "Wasabi/Materials/WMaterial.hpp"
+#include "Wasabi/Memory/WBufferedBuffer.hpp"
 #include "Wasabi/Lights/WLight.hpp"
 #include "Wasabi/Geometries/WGeometry.hpp"
 #include "Wasabi/Sprites/WSprite.hpp"
 #include "Wasabi/Cameras/WCamera.hpp"
 #include "Wasabi/WindowAndInput/WWindowAndInputComponent.hpp"
 
+/** Width and height (in pixels) of the screen tiles of the tiled lights pass */
+#define W_TILED_LIGHTS_TILE_SIZE 16
+/** Maximum number of point and spot lights that light a tile of the tiled lights pass */
+#define W_TILED_LIGHTS_MAX_TILE_LIGHTS 256
+
 class OnlyPositionGeometry : public WGeometry {
 	const W_VERTEX_DESCRIPTION m_desc = W_VERTEX_DESCRIPTION({ W_ATTRIBUTE_POSITION });
 
@@ -36,28 +44,50 @@ public:
 	}
 };
 
+/** Bound resources shared by the instanced (point and spot) light volume shaders */
+static vector<W_BOUND_RESOURCE> GetLightVolumeBoundResources() {
+	return {
+		W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 0, 0, "lightsBuffer"), // see LightTypeAssets::lightsBuffer
+		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 1, 0, "normalTexture"),
+		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 2, 0, "depthTexture"),
+		W_BOUND_RESOURCE(W_TYPE_UBO, 3, 0, "uboPerFrame", {
+			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "proj"), // projection
+			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projInv"), // inverse of projection
+		}),
+	};
+}
+
+/**
+ * Depth state of the instanced light volumes: their back faces are tested against the G-buffer depth (read-only,
+ * see the WLightBufferRenderStage constructor) so pixels whose geometry is behind a volume are rejected before
+ * shading, and the depth bounds (if enabled, set per draw) reject pixels out of the depth range of all the volumes.
+ */
+static VkPipelineDepthStencilStateCreateInfo GetLightVolumeDepthState(bool depthBoundsTest) {
+	VkPipelineDepthStencilStateCreateInfo depthState = {};
+	depthState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthState.depthTestEnable = VK_TRUE;
+	depthState.depthWriteEnable = VK_FALSE;
+	depthState.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+	depthState.depthBoundsTestEnable = depthBoundsTest ? VK_TRUE : VK_FALSE;
+	depthState.minDepthBounds = 0.0f;
+	depthState.maxDepthBounds = 1.0f;
+	depthState.back.failOp = VK_STENCIL_OP_KEEP;
+	depthState.back.passOp = VK_STENCIL_OP_KEEP;
+	depthState.back.compareOp = VK_COMPARE_OP_ALWAYS;
+	depthState.front = depthState.back;
+	return depthState;
+}
+
 class SpotLightVS : public WShader {
 public:
 	SpotLightVS(class Wasabi* const app) : WShader(app) {}
 
-	static vector<W_BOUND_RESOURCE> GetBoundResources() {
-		return {
-			W_BOUND_RESOURCE(W_TYPE_UBO, 0, 0, "uboPerLight", {
-				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "wvp"), // world * view * projection
-				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3, "lightDir"), // light direction (L vector)
-				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "range"), // light range
-				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3, "lightColor"), // light color
-				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "intensity"), // light intensity
-				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3, "position"), // light color
-				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "minCosAngle"), // used for spot light (angle of beam precomputed)
-				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "spotRadius"), // radius of the circle at the end of the cone
-			}),
-		};
-	}
-
 	virtual void Load(bool bSaveData = false) {
 		m_desc.type = W_VERTEX_SHADER;
-		m_desc.bound_resources = GetBoundResources();
+		m_desc.bound_resources = {
+			GetLightVolumeBoundResources()[0],
+			GetLightVolumeBoundResources()[3],
+		};
 		m_desc.input_layouts = {W_INPUT_LAYOUT({
 			W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3), // position
 		})};
@@ -74,14 +104,8 @@ public:
 
 	virtual void Load(bool bSaveData = false) {
 		m_desc.type = W_FRAGMENT_SHADER;
-		m_desc.bound_resources = {
-			SpotLightVS::GetBoundResources()[0],
-			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 1, 1, "normalTexture"),
-			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 2, 1, "depthTexture"),
-			W_BOUND_RESOURCE(W_TYPE_UBO, 3, 1, "uboPerFrame", {
-				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projInv"), // inverse of projection
-			}),
-		};
+		m_desc.bound_resources = GetLightVolumeBoundResources();
+		m_desc.bound_resources.push_back(WRenderer::GetGlobalFrameBoundResource());
 		vector<uint8_t> code {
 			#include "Shaders/spotlight.frag.glsl.spv"
 		};
@@ -93,22 +117,12 @@ class PointLightVS : public WShader {
 public:
 	PointLightVS(class Wasabi* const app) : WShader(app) {}
 
-	static vector<W_BOUND_RESOURCE> GetBoundResources() {
-		return {
-			W_BOUND_RESOURCE(W_TYPE_UBO, 0, 0, "uboPerLight", {
-				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "wvp"), // world * view * projection
-				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3, "lightDir"), // light direction (L vector)
-				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "range"), // light range
-				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3, "lightColor"), // light color
-				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "intensity"), // light intensity
-				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3, "position"), // light position
-			}),
-		};
-	}
-
 	virtual void Load(bool bSaveData = false) {
 		m_desc.type = W_VERTEX_SHADER;
-		m_desc.bound_resources = GetBoundResources();
+		m_desc.bound_resources = {
+			GetLightVolumeBoundResources()[0],
+			GetLightVolumeBoundResources()[3],
+		};
 		m_desc.input_layouts = { W_INPUT_LAYOUT({
 			W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3), // position
 		}) };
@@ -125,14 +139,8 @@ public:
 
 	virtual void Load(bool bSaveData = false) {
 		m_desc.type = W_FRAGMENT_SHADER;
-		m_desc.bound_resources = {
-			PointLightVS::GetBoundResources()[0],
-			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 1, 1, "normalTexture"),
-			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 2, 1, "depthTexture"),
-			W_BOUND_RESOURCE(W_TYPE_UBO, 3, 1, "uboPerFrame", {
-				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projInv"), // inverse of projection
-			}),
-		};
+		m_desc.bound_resources = GetLightVolumeBoundResources();
+		m_desc.bound_resources.push_back(WRenderer::GetGlobalFrameBoundResource());
 		vector<uint8_t> code {
 			#include "Shaders/pointlight.frag.glsl.spv"
 		};
@@ -161,6 +169,7 @@ public:
 			W_BOUND_RESOURCE(W_TYPE_UBO, 3, 1, "uboPerFrame", {
 				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projInv"), // inverse of projection
 			}),
+			WRenderer::GetGlobalFrameBoundResource(),
 		};
 		vector<uint8_t> code {
 			#include "Shaders/dirlight.frag.glsl.spv"
@@ -169,12 +178,133 @@ public:
 	}
 };
 
-WLightBufferRenderStage::WLightBufferRenderStage(Wasabi* const app) : WRenderStage(app) {
+class ClusteredLightsPS : public WShader {
+public:
+	ClusteredLightsPS(class Wasabi* const app) : WShader(app) {}
+
+	virtual void Load(bool bSaveData = false) {
+		m_desc.type = W_FRAGMENT_SHADER;
+		m_desc.bound_resources = {
+			W_BOUND_RESOURCE(W_TYPE_UBO, 0, 0, "uboPerFrame", {
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, 4, "clusterGrid"), // see WLightClusters::SHADER_PARAMS
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "clusterDepth"),
+			}),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 1, 0, "normalTexture"),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 2, 0, "depthTexture"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 3, 0, "lightsBuffer"), // see WLightClusters
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 4, 0, "clustersBuffer"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 5, 0, "lightIndicesBuffer"),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 6, 0, "shadowAtlas"),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 7, 0, "shadowTilesTexture"),
+			WRenderer::GetGlobalFrameBoundResource(),
+		};
+		vector<uint8_t> code {
+			#include "Shaders/clusteredlights.frag.glsl.spv"
+		};
+		LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+	}
+};
+
+class ClusteredLightsSubpassPS : public WShader {
+public:
+	ClusteredLightsSubpassPS(class Wasabi* const app) : WShader(app) {}
+
+	virtual void Load(bool bSaveData = false) {
+		m_desc.type = W_FRAGMENT_SHADER;
+		m_desc.bound_resources = {
+			W_BOUND_RESOURCE(W_TYPE_UBO, 0, 0, "uboPerFrame", {
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, 4, "clusterGrid"), // see WLightClusters::SHADER_PARAMS
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "clusterDepth"),
+			}),
+			W_BOUND_RESOURCE(W_TYPE_INPUT_ATTACHMENT, 1, 0, "normalTexture"),
+			W_BOUND_RESOURCE(W_TYPE_INPUT_ATTACHMENT, 2, 0, "depthTexture"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 3, 0, "lightsBuffer"), // see WLightClusters
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 4, 0, "clustersBuffer"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 5, 0, "lightIndicesBuffer"),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 6, 0, "shadowAtlas"),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 7, 0, "shadowTilesTexture"),
+			WRenderer::GetGlobalFrameBoundResource(),
+		};
+		vector<uint8_t> code {
+			#include "Shaders/clusteredlights_subpass.frag.glsl.spv"
+		};
+		LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+	}
+};
+
+class TiledLightsCS : public WShader {
+public:
+	TiledLightsCS(class Wasabi* const app) : WShader(app) {}
+
+	virtual void Load(bool bSaveData = false) {
+		m_desc.type = W_COMPUTE_SHADER;
+		m_desc.bound_resources = {
+			W_BOUND_RESOURCE(W_TYPE_UBO, 0, 0, "uboPerFrame", {
+				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "viewMatrix"),
+				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projInv"), // inverse of projection
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "camDir"), // camera direction (world space)
+				W_SHADER_VARIABLE_INFO(W_TYPE_UINT, 4, "size"), // rendered region, number of directional lights, number of lights
+			}),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 1, 0, "normalTexture"),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 2, 0, "depthTexture"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 3, 0, "lightsBuffer"), // see WLightClusters
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 4, 0, "shadowAtlas"),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 5, 0, "shadowTilesTexture"),
+			W_BOUND_RESOURCE(W_TYPE_STORAGE_IMAGE, 6, 0, "outputImage"),
+		};
+		vector<uint8_t> code {
+			#include "Shaders/tiledlights.comp.glsl.spv"
+		};
+		LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+	}
+};
+
+class TiledLightsPS : public WShader {
+public:
+	TiledLightsPS(class Wasabi* const app) : WShader(app) {}
+
+	virtual void Load(bool bSaveData = false) {
+		m_desc.type = W_FRAGMENT_SHADER;
+		m_desc.bound_resources = {
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 0, 0, "tiledLightsTexture"),
+		};
+		vector<uint8_t> code {
+			#include "Shaders/tiledlights.frag.glsl.spv"
+		};
+		LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+	}
+};
+
+WLightBufferRenderStage::WLightBufferRenderStage(Wasabi* const app, bool mergedPasses) : WRenderStage(app) {
 	m_stageDescription.name = __func__;
-	m_stageDescription.target = RENDER_STAGE_TARGET_BUFFER;
-	m_stageDescription.colorOutputs = std::vector<WRenderStage::OUTPUT_IMAGE>({
-		WRenderStage::OUTPUT_IMAGE("LightBuffer", VK_FORMAT_R16G16B16A16_SFLOAT, WColor(0.0f, 0.0f, 0.0f, 0.0f)),
-	});
+	if (mergedPasses) {
+		// the LightBuffer is an attachment of the G-buffer's render target (see WGBufferRenderStage)
+		m_stageDescription.target = RENDER_STAGE_TARGET_PREVIOUS;
+	} else {
+		m_stageDescription.target = RENDER_STAGE_TARGET_BUFFER;
+		m_stageDescription.colorOutputs = std::vector<WRenderStage::OUTPUT_IMAGE>({
+			WRenderStage::OUTPUT_IMAGE("LightBuffer", VK_FORMAT_R16G16B16A16_SFLOAT, WColor(0.0f, 0.0f, 0.0f, 0.0f)),
+		});
+		m_stageDescription.colorOutputs[0].transient = true; // only read by the scene composition
+	}
+	m_mergedPasses = mergedPasses;
+	m_stageDescription.inputs = std::vector<std::string>({"GBufferViewSpaceNormal", "GBufferDepth", "ShadowAtlas"});
+	m_stageDescription.flags = RENDER_STAGE_FLAG_DYNAMIC_RESOLUTION;
+
+	// the light volumes don't have subpass variants and the tiled pass can't run inside a render pass, the merged
+	// render pass always uses the clustered pass
+	m_tiledLighting = !m_mergedPasses && m_app->GetEngineParam<bool>("tiledDeferredLighting");
+	m_clusteredLighting = m_mergedPasses || (!m_tiledLighting && m_app->GetEngineParam<bool>("clusteredDeferredLighting"));
+	if (!m_tiledLighting && !m_clusteredLighting) {
+		// the light volumes are depth-tested against the G-buffer depth, which is also an input so it is read-only
+		m_stageDescription.depthOutput = WRenderStage::OUTPUT_IMAGE("GBufferDepth");
+	}
+
+	m_depthBoundsTest = false;
+	m_lightClusters = nullptr;
+	m_tiledLightsFX = nullptr;
+	m_tiledLightsMaterial = nullptr;
+	m_tiledLightsImage = nullptr;
 }
 
 WError WLightBufferRenderStage::Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height) {
@@ -202,6 +332,13 @@ WError WLightBufferRenderStage::Initialize(std::vector<WRenderStage*>& previousS
 	m_rasterizationState.depthBiasEnable = VK_FALSE;
 	m_rasterizationState.lineWidth = 1.0f;
 
+	if (m_tiledLighting)
+		return LoadTiledLightsAssets(width, height);
+	if (m_clusteredLighting)
+		return LoadClusteredLightsAssets();
+
+	m_depthBoundsTest = m_app->GetEnabledDeviceFeatures().depthBounds == VK_TRUE;
+
 	WError werr = LoadDirectionalLightsAssets();
 	if (!werr)
 		return werr;
@@ -224,14 +361,87 @@ WError WLightBufferRenderStage::Initialize(std::vector<WRenderStage*>& previousS
 }
 
 WError WLightBufferRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, uint32_t filter) {
-	UNREFERENCED_PARAMETER(renderer);
+	if (m_mergedPasses) {
+		WError err = rt->NextSubpass();
+		if (!err)
+			return err;
+	}
 
-	if (filter & RENDER_FILTER_OBJECTS) {
+	if ((filter & RENDER_FILTER_OBJECTS) && m_tiledLighting) {
+		// the tiled compute pass already lit every pixel (see RecordPassCompute()), copy its result
+		if (m_lightClusters->GetNumLights() > 0) {
+			m_tiledLightsAssets.effect->Bind(rt);
+			m_tiledLightsAssets.perFrameMaterial->Bind(rt);
+			m_tiledLightsAssets.fullscreenSprite->Render(rt);
+		}
+	} else if ((filter & RENDER_FILTER_OBJECTS) && m_clusteredLighting) {
+		// one full-screen pass: every pixel only loops over the lights of its cluster
+		m_lightClusters->Build(renderer->GetGlobalFrameData(rt));
+		WLightClusters::SHADER_PARAMS clusterParams = m_lightClusters->GetShaderParams();
+		if (m_lightClusters->GetNumLights() > 0) {
+			m_clusteredLightsAssets.perFrameMaterial->SetVariableData("clusterGrid", clusterParams.clusterGrid, sizeof(clusterParams.clusterGrid));
+			m_clusteredLightsAssets.perFrameMaterial->SetVariable<WVector4>("clusterDepth", clusterParams.clusterDepth);
+			m_clusteredLightsAssets.effect->Bind(rt);
+			m_clusteredLightsAssets.perFrameMaterial->Bind(rt);
+			m_clusteredLightsAssets.fullscreenSprite->Render(rt);
+		}
+	} else if (filter & RENDER_FILTER_OBJECTS) {
 		WCamera* cam = rt->GetCamera();
+		WMatrix view = cam->GetViewMatrix();
+		WMatrix proj = cam->GetProjectionMatrix();
+		uint32_t numLights = m_app->LightManager->GetEntitiesCount();
+		uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
 
 		for (auto it = m_lightRenderingAssets.begin(); it != m_lightRenderingAssets.end(); it++) {
-			LightTypeAssets lightTypeAssets = it->second;
-			if (lightTypeAssets.materialMap.size()) {
+			LightTypeAssets& lightTypeAssets = it->second;
+			if (lightTypeAssets.lightsBuffer) {
+				// write all visible lights of this type and render their volumes in one instanced draw
+				if (!ReserveLightsBuffer(lightTypeAssets, numLights))
+					continue;
+				WVector4* lightsData;
+				if (lightTypeAssets.lightsBuffer->Map(m_app, bufferIndex, (void**)&lightsData, W_MAP_WRITE) != VK_SUCCESS)
+					continue;
+				uint32_t numInstances = 0;
+				float minDepth = 1.0f, maxDepth = 0.0f;
+				for (uint32_t i = 0; i < numLights; i++) {
+					WLight* light = m_app->LightManager->GetEntityByIndex(i);
+					if (!light || light->Hidden() || (int)light->GetType() != it->first)
+						continue;
+					if (it->first == W_LIGHT_SPOT) {
+						if (!cam->CheckSphereInFrustum(light->GetPosition() + (light->GetLVector() * (light->GetRange() / 2.0f)), light->GetRange() / 2.0f))
+							continue;
+					} else if (!cam->CheckSphereInFrustum(light->GetPosition(), light->GetRange()))
+						continue;
+
+					WColor lightColor = light->GetColor();
+					WVector3 lightDir = WVec3TransformNormal(light->GetLVector(), view);
+					WVector3 lightPos = WVec3TransformCoord(light->GetPosition(), view);
+					float emittingHalfAngle = acosf(light->GetMinCosAngle());
+					float spotRadius = tanf(emittingHalfAngle) * light->GetRange();
+					lightsData[numInstances * 4 + 0] = WVector4(lightColor.r, lightColor.g, lightColor.b, light->GetIntensity());
+					lightsData[numInstances * 4 + 1] = WVector4(lightDir.x, lightDir.y, lightDir.z, light->GetRange());
+					lightsData[numInstances * 4 + 2] = WVector4(lightPos.x, lightPos.y, lightPos.z, light->GetMinCosAngle());
+					lightsData[numInstances * 4 + 3] = WVector4(spotRadius, 0.0f, 0.0f, 0.0f);
+					numInstances++;
+
+					// depth range of the sphere around the light's range (which contains a spot light's cone)
+					float nearZ = std::max(lightPos.z - light->GetRange(), cam->GetMinRange());
+					float farZ = std::min(lightPos.z + light->GetRange(), cam->GetMaxRange());
+					minDepth = std::min(minDepth, WVec3TransformCoord(WVector3(0.0f, 0.0f, nearZ), proj).z);
+					maxDepth = std::max(maxDepth, WVec3TransformCoord(WVector3(0.0f, 0.0f, farZ), proj).z);
+				}
+				lightTypeAssets.lightsBuffer->Unmap(m_app, bufferIndex);
+
+				if (numInstances > 0) {
+					lightTypeAssets.effect->Bind(rt);
+					if (m_depthBoundsTest)
+						vkCmdSetDepthBounds(rt->GetCommnadBuffer(), std::max(minDepth, 0.0f), std::min(std::max(maxDepth, minDepth), 1.0f));
+					lightTypeAssets.perFrameMaterial->SetVariable<WMatrix>("proj", proj);
+					lightTypeAssets.perFrameMaterial->SetVariable<WMatrix>("projInv", WMatrixInverse(proj));
+					lightTypeAssets.perFrameMaterial->Bind(rt);
+					lightTypeAssets.geometry->Draw(rt, std::numeric_limits<uint32_t>::max(), numInstances);
+				}
+			} else if (lightTypeAssets.materialMap.size()) {
 				lightTypeAssets.effect->Bind(rt);
 				lightTypeAssets.perFrameMaterial->SetVariable<WMatrix>("projInv", WMatrixInverse(cam->GetProjectionMatrix()));
 				lightTypeAssets.perFrameMaterial->Bind(rt);
@@ -239,35 +449,17 @@ WError WLightBufferRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, u
 				for (auto materialIt = lightTypeAssets.materialMap.begin(); materialIt != lightTypeAssets.materialMap.end(); materialIt++) {
 					WLight* light = materialIt->first;
 					WMaterial* material = materialIt->second;
-					int lightType = (int)light->GetType();
 
 					if (light->Hidden())
 						continue;
-					if (lightType == W_LIGHT_SPOT) {
-						if (!cam->CheckSphereInFrustum(light->GetPosition() + (light->GetLVector() * (light->GetRange() / 2.0f)), light->GetRange() / 2.0f))
-							continue;
-					} else if (lightType == W_LIGHT_POINT) {
-						if (!cam->CheckSphereInFrustum(light->GetPosition(), light->GetRange()))
-							continue;
-					}
 
 					WColor lightColor = light->GetColor();
-					material->SetVariable<WMatrix>("wvp", light->GetWorldMatrix() * cam->GetViewMatrix() * cam->GetProjectionMatrix());
-					material->SetVariable<WVector3>("lightDir", WVec3TransformNormal(light->GetLVector(), cam->GetViewMatrix()));
-					material->SetVariable<WVector3>("position", WVec3TransformCoord(light->GetPosition(), cam->GetViewMatrix()));
+					material->SetVariable<WVector3>("lightDir", WVec3TransformNormal(light->GetLVector(), view));
 					material->SetVariable<WVector3>("lightColor", WVector3(lightColor.r, lightColor.g, lightColor.b));
 					material->SetVariable<float>("intensity", light->GetIntensity());
-					material->SetVariable<float>("range", light->GetRange());
-					material->SetVariable<float>("minCosAngle", light->GetMinCosAngle());
-					float emittingHalfAngle = acosf(light->GetMinCosAngle());
-					float spotRadius = tanf(emittingHalfAngle) * light->GetRange();
-					material->SetVariable<float>("spotRadius", spotRadius);
 					material->Bind(rt);
 
-					if (lightTypeAssets.fullscreenSprite)
-						lightTypeAssets.fullscreenSprite->Render(rt);
-					if (lightTypeAssets.geometry)
-						lightTypeAssets.geometry->Draw(rt);
+					lightTypeAssets.fullscreenSprite->Render(rt);
 				}
 			}
 		}
@@ -276,25 +468,85 @@ WError WLightBufferRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, u
 	return WError(W_SUCCEEDED);
 }
 
+WError WLightBufferRenderStage::RecordCompute(WRenderer* renderer, VkCommandBuffer cmdBuf) {
+	// the render target's global frame data is only written when it begins, after the compute work
+	return m_lightClusters->RecordBuild(renderer, cmdBuf, renderer->GetUpcomingGlobalFrameData(m_renderTarget));
+}
+
+WError WLightBufferRenderStage::RecordPassCompute(WRenderer* renderer, VkCommandBuffer cmdBuf) {
+	// the shadow stage rendered already, so the lights get this frame's shadow tiles
+	W_GLOBAL_FRAME_DATA frameData = renderer->GetUpcomingGlobalFrameData(m_renderTarget);
+	m_lightClusters->Build(frameData);
+	WLightClusters::SHADER_PARAMS clusterParams = m_lightClusters->GetShaderParams();
+	uint32_t numLights = m_lightClusters->GetNumLights();
+	if (numLights == 0)
+		return WError(W_SUCCEEDED);
+
+	// the G-buffer only covers the dynamic resolution region (see WRenderer::GetResolutionScale())
+	uint32_t size[4] = { (uint32_t)frameData.resolutionScale.z, (uint32_t)frameData.resolutionScale.w, clusterParams.clusterGrid[3], numLights };
+	m_tiledLightsMaterial->SetVariable<WMatrix>("viewMatrix", frameData.viewMatrix);
+	m_tiledLightsMaterial->SetVariable<WMatrix>("projInv", frameData.projectionInverseMatrix);
+	m_tiledLightsMaterial->SetVariable<WVector4>("camDir", frameData.camDirW);
+	m_tiledLightsMaterial->SetVariableData("size", size, sizeof(size));
+
+	// the copy of the previous use of the image must be done before it's written, its contents are not needed
+	VkImageMemoryBarrier imageBarrier = m_tiledLightsImage->GetLayoutTransitionBarrier(VK_IMAGE_LAYOUT_GENERAL, true);
+	imageBarrier.srcAccessMask = 0;
+	imageBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+	WError err = m_tiledLightsFX->BindCompute(cmdBuf);
+	if (!err)
+		return err;
+	err = m_tiledLightsMaterial->BindCompute(cmdBuf);
+	if (!err)
+		return err;
+	m_tiledLightsFX->Dispatch(cmdBuf,
+		(size[0] + W_TILED_LIGHTS_TILE_SIZE - 1) / W_TILED_LIGHTS_TILE_SIZE,
+		(size[1] + W_TILED_LIGHTS_TILE_SIZE - 1) / W_TILED_LIGHTS_TILE_SIZE);
+
+	// the copy in Render() samples the lighting
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+	imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+	return WError(W_SUCCEEDED);
+}
+
 void WLightBufferRenderStage::Cleanup() {
 	WRenderStage::Cleanup();
 	m_app->LightManager->RemoveChangeCallback(m_stageDescription.name);
 	for (auto iter = m_lightRenderingAssets.begin(); iter != m_lightRenderingAssets.end(); iter++)
-		iter->second.Destroy();
+		iter->second.Destroy(m_app);
 	m_lightRenderingAssets.clear();
+	m_clusteredLightsAssets.Destroy(m_app);
+	m_tiledLightsAssets.Destroy(m_app);
+	W_SAFE_REMOVEREF(m_tiledLightsMaterial);
+	W_SAFE_REMOVEREF(m_tiledLightsFX);
+	W_SAFE_REMOVEREF(m_tiledLightsImage);
+	W_SAFE_DELETE(m_lightClusters);
 }
 
 WError WLightBufferRenderStage::Resize(uint32_t width, uint32_t height) {
 	for (auto iter = m_lightRenderingAssets.begin(); iter != m_lightRenderingAssets.end(); iter++)
 		if (iter->second.fullscreenSprite)
 			iter->second.fullscreenSprite->SetSize(WVector2((float)width, (float)height));
+	if (m_clusteredLightsAssets.fullscreenSprite)
+		m_clusteredLightsAssets.fullscreenSprite->SetSize(WVector2((float)width, (float)height));
+	if (m_tiledLightsAssets.fullscreenSprite) {
+		m_tiledLightsAssets.fullscreenSprite->SetSize(WVector2((float)width, (float)height));
+		WError err = CreateTiledLightsImage(width, height);
+		if (!err)
+			return err;
+	}
 	return WRenderStage::Resize(width, height);
 }
 
 void WLightBufferRenderStage::OnLightsChange(WLight* light, bool is_added) {
 	auto iter = m_lightRenderingAssets.find(light->GetType());
-	if (iter == m_lightRenderingAssets.end())
-		return;
+	if (iter == m_lightRenderingAssets.end() || iter->second.lightsBuffer)
+		return; // lights rendered with instanced volumes don't need their own materials
 	LightTypeAssets assets = iter->second;
 
 	if (is_added) {
@@ -318,8 +570,7 @@ WError WLightBufferRenderStage::LoadPointLightsAssets() {
 	pixel_shader->Load();
 
 	assets.effect = new WEffect(m_app);
-	VkPipelineDepthStencilStateCreateInfo depthState = {};
-	assets.effect->SetDepthStencilState(depthState);
+	assets.effect->SetDepthStencilState(GetLightVolumeDepthState(m_depthBoundsTest));
 	assets.effect->SetBlendingState(m_blendState);
 	assets.effect->SetRasterizationState(m_rasterizationState);
 
@@ -327,11 +578,13 @@ WError WLightBufferRenderStage::LoadPointLightsAssets() {
 	if (werr) {
 		werr = assets.effect->BindShader(pixel_shader);
 		if (werr) {
-			werr = assets.effect->BuildPipeline(m_renderTarget);
+			werr = assets.effect->BuildPipelineAsync(m_renderTarget);
 
-			assets.perFrameMaterial = assets.effect->CreateMaterial(1);
-			assets.perFrameMaterial->SetTexture(1, m_app->Renderer->GetRenderTargetImage("GBufferViewSpaceNormal"));
-			assets.perFrameMaterial->SetTexture(2, m_app->Renderer->GetRenderTargetImage("GBufferDepth"));
+			assets.perFrameMaterial = assets.effect->CreateMaterial(0);
+			assets.perFrameMaterial->SetTexture("normalTexture", m_app->Renderer->GetRenderTargetImage("GBufferViewSpaceNormal"));
+			assets.perFrameMaterial->SetTexture("depthTexture", m_app->Renderer->GetRenderTargetImage("GBufferDepth"));
+			if (werr)
+				werr = ReserveLightsBuffer(assets, 64);
 
 			assets.geometry = new OnlyPositionGeometry(m_app);
 			assets.geometry->CreateSphere(1.0f, 10, 10);
@@ -355,8 +608,7 @@ WError WLightBufferRenderStage::LoadSpotLightsAssets() {
 	pixel_shader->Load();
 
 	assets.effect = new WEffect(m_app);
-	VkPipelineDepthStencilStateCreateInfo depthState = {};
-	assets.effect->SetDepthStencilState(depthState);
+	assets.effect->SetDepthStencilState(GetLightVolumeDepthState(m_depthBoundsTest));
 	assets.effect->SetBlendingState(m_blendState);
 	assets.effect->SetRasterizationState(m_rasterizationState);
 
@@ -364,11 +616,13 @@ WError WLightBufferRenderStage::LoadSpotLightsAssets() {
 	if (werr) {
 		werr = assets.effect->BindShader(pixel_shader);
 		if (werr) {
-			werr = assets.effect->BuildPipeline(m_renderTarget);
+			werr = assets.effect->BuildPipelineAsync(m_renderTarget);
 
-			assets.perFrameMaterial = assets.effect->CreateMaterial(1);
-			assets.perFrameMaterial->SetTexture(1, m_app->Renderer->GetRenderTargetImage("GBufferViewSpaceNormal"));
-			assets.perFrameMaterial->SetTexture(2, m_app->Renderer->GetRenderTargetImage("GBufferDepth"));
+			assets.perFrameMaterial = assets.effect->CreateMaterial(0);
+			assets.perFrameMaterial->SetTexture("normalTexture", m_app->Renderer->GetRenderTargetImage("GBufferViewSpaceNormal"));
+			assets.perFrameMaterial->SetTexture("depthTexture", m_app->Renderer->GetRenderTargetImage("GBufferDepth"));
+			if (werr)
+				werr = ReserveLightsBuffer(assets, 64);
 
 			OnlyPositionGeometry* tmpGeometry = new OnlyPositionGeometry(m_app);
 			tmpGeometry->CreateCone(1.0f, 1.0f, 0, 16, W_GEOMETRY_CREATE_VB_DYNAMIC | W_GEOMETRY_CREATE_IB_DYNAMIC);
@@ -419,11 +673,156 @@ WError WLightBufferRenderStage::LoadDirectionalLightsAssets() {
 	return WError(W_SUCCEEDED);
 }
 
-void WLightBufferRenderStage::LightTypeAssets::Destroy() {
+WError WLightBufferRenderStage::LoadClusteredLightsAssets() {
+	m_lightClusters = new WLightClusters(m_app);
+	W_LIGHT_CLUSTERS_BUILD build = m_app->GetEngineParam<bool>("computeLightClusters") ? W_LIGHT_CLUSTERS_BUILD_COMPUTE : W_LIGHT_CLUSTERS_BUILD_CPU;
+	WError werr = m_lightClusters->Initialize(m_app->GetEngineParam<int>("maxLights"), build);
+	if (!werr)
+		return werr;
+	// the cluster lists are then filled in RecordCompute()
+	if (m_lightClusters->IsComputeBuilt())
+		m_stageDescription.flags |= RENDER_STAGE_FLAG_ASYNC_COMPUTE;
+
+	WShader* pixelShader = m_mergedPasses ? (WShader*)new ClusteredLightsSubpassPS(m_app) : (WShader*)new ClusteredLightsPS(m_app);
+	pixelShader->Load();
+
+	m_clusteredLightsAssets.effect = m_app->SpriteManager->CreateSpriteEffect(m_renderTarget, pixelShader, m_blendState, {}, {}, m_mergedPasses ? 1 : 0);
+	W_SAFE_REMOVEREF(pixelShader);
+	if (!m_clusteredLightsAssets.effect)
+		return WError(W_OUTOFMEMORY);
+
+	m_clusteredLightsAssets.perFrameMaterial = m_clusteredLightsAssets.effect->CreateMaterial(0);
+	if (!m_clusteredLightsAssets.perFrameMaterial)
+		return WError(W_OUTOFMEMORY);
+	m_clusteredLightsAssets.perFrameMaterial->SetTexture("normalTexture", m_app->Renderer->GetRenderTargetImage("GBufferViewSpaceNormal"));
+	m_clusteredLightsAssets.perFrameMaterial->SetTexture("depthTexture", m_app->Renderer->GetRenderTargetImage("GBufferDepth"));
+	m_clusteredLightsAssets.perFrameMaterial->SetStorageBuffer("lightsBuffer", m_lightClusters->GetLightsBuffer());
+	m_clusteredLightsAssets.perFrameMaterial->SetStorageBuffer("clustersBuffer", m_lightClusters->GetClustersBuffer());
+	m_clusteredLightsAssets.perFrameMaterial->SetStorageBuffer("lightIndicesBuffer", m_lightClusters->GetLightIndicesBuffer());
+
+	// shadows are only available if the renderer has a shadow stage before this one
+	WShadowRenderStage* shadows = (WShadowRenderStage*)m_app->Renderer->GetRenderStage("WShadowRenderStage");
+	m_lightClusters->SetShadows(shadows);
+	if (shadows) {
+		m_clusteredLightsAssets.perFrameMaterial->SetTexture("shadowAtlas", shadows->GetShadowAtlas());
+		m_clusteredLightsAssets.perFrameMaterial->SetTexture("shadowTilesTexture", shadows->GetShadowTilesTexture());
+	}
+
+	uint32_t windowWidth = m_app->WindowAndInputComponent->GetWindowWidth();
+	uint32_t windowHeight = m_app->WindowAndInputComponent->GetWindowHeight();
+	m_clusteredLightsAssets.fullscreenSprite = m_app->SpriteManager->CreateSprite();
+	m_clusteredLightsAssets.fullscreenSprite->SetSize(WVector2((float)windowWidth, (float)windowHeight));
+	m_clusteredLightsAssets.fullscreenSprite->Hide();
+	m_clusteredLightsAssets.fullscreenSprite->SetName("LightBufferClusteredLightsSprite");
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WLightBufferRenderStage::LoadTiledLightsAssets(uint32_t width, uint32_t height) {
+	// the tiled pass culls the lights itself, it only needs the lights buffer
+	m_lightClusters = new WLightClusters(m_app);
+	WError werr = m_lightClusters->Initialize(m_app->GetEngineParam<int>("maxLights"), W_LIGHT_CLUSTERS_BUILD_LIGHTS_ONLY);
+	if (!werr)
+		return werr;
+	// the lights are accumulated in RecordPassCompute()
+	m_stageDescription.flags |= RENDER_STAGE_FLAG_PASS_COMPUTE;
+
+	WShader* computeShader = new TiledLightsCS(m_app);
+	computeShader->Load();
+	m_tiledLightsFX = new WEffect(m_app);
+	werr = m_tiledLightsFX->BindShader(computeShader);
+	if (werr)
+		werr = m_tiledLightsFX->BuildPipelineAsync(nullptr);
+	W_SAFE_REMOVEREF(computeShader);
+	if (!werr)
+		return werr;
+
+	m_tiledLightsMaterial = m_tiledLightsFX->CreateMaterial(0);
+	if (!m_tiledLightsMaterial)
+		return WError(W_OUTOFMEMORY);
+	m_tiledLightsMaterial->SetTexture("normalTexture", m_app->Renderer->GetRenderTargetImage("GBufferViewSpaceNormal"));
+	m_tiledLightsMaterial->SetTexture("depthTexture", m_app->Renderer->GetRenderTargetImage("GBufferDepth"));
+	m_tiledLightsMaterial->SetStorageBuffer("lightsBuffer", m_lightClusters->GetLightsBuffer());
+
+	// shadows are only available if the renderer has a shadow stage before this one
+	WShadowRenderStage* shadows = (WShadowRenderStage*)m_app->Renderer->GetRenderStage("WShadowRenderStage");
+	m_lightClusters->SetShadows(shadows);
+	if (shadows) {
+		m_tiledLightsMaterial->SetTexture("shadowAtlas", shadows->GetShadowAtlas());
+		m_tiledLightsMaterial->SetTexture("shadowTilesTexture", shadows->GetShadowTilesTexture());
+	}
+
+	WShader* pixelShader = new TiledLightsPS(m_app);
+	pixelShader->Load();
+	m_tiledLightsAssets.effect = m_app->SpriteManager->CreateSpriteEffect(m_renderTarget, pixelShader, m_blendState);
+	W_SAFE_REMOVEREF(pixelShader);
+	if (!m_tiledLightsAssets.effect)
+		return WError(W_OUTOFMEMORY);
+
+	m_tiledLightsAssets.perFrameMaterial = m_tiledLightsAssets.effect->CreateMaterial(0);
+	if (!m_tiledLightsAssets.perFrameMaterial)
+		return WError(W_OUTOFMEMORY);
+
+	m_tiledLightsAssets.fullscreenSprite = m_app->SpriteManager->CreateSprite();
+	m_tiledLightsAssets.fullscreenSprite->SetSize(WVector2((float)width, (float)height));
+	m_tiledLightsAssets.fullscreenSprite->Hide();
+	m_tiledLightsAssets.fullscreenSprite->SetName("LightBufferTiledLightsSprite");
+
+	return CreateTiledLightsImage(width, height);
+}
+
+WError WLightBufferRenderStage::CreateTiledLightsImage(uint32_t width, uint32_t height) {
+	// written by the compute pass and read by the copy, so it has a single mip
+	int oldMips = m_app->GetEngineParam<int>("numGeneratedMips");
+	m_app->SetEngineParam<int>("numGeneratedMips", 1);
+	WImage* image = m_app->ImageManager->CreateImage(nullptr, width, height, VK_FORMAT_R16G16B16A16_SFLOAT, W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_STORAGE);
+	m_app->SetEngineParam<int>("numGeneratedMips", oldMips);
+	if (!image)
+		return WError(W_OUTOFMEMORY);
+
+	W_SAFE_REMOVEREF(m_tiledLightsImage);
+	m_tiledLightsImage = image;
+	WError err = m_tiledLightsMaterial->SetTexture("outputImage", m_tiledLightsImage);
+	if (err)
+		err = m_tiledLightsAssets.perFrameMaterial->SetTexture("tiledLightsTexture", m_tiledLightsImage);
+	return err;
+}
+
+WError WLightBufferRenderStage::ReserveLightsBuffer(LightTypeAssets& assets, uint32_t numLights) {
+	if (assets.lightsBuffer && assets.lightsBufferCapacity >= numLights)
+		return WError(W_SUCCEEDED);
+
+	// grown by doubling, the old buffers are released once the frames using them are done
+	uint32_t capacity = std::max(assets.lightsBufferCapacity, (uint32_t)64);
+	while (capacity < numLights)
+		capacity *= 2;
+
+	WBufferedBuffer* lightsBuffer = new WBufferedBuffer();
+	uint32_t numBuffers = m_app->GetEngineParam<uint32_t>("bufferingCount");
+	VkResult result = lightsBuffer->Create(m_app, numBuffers, capacity * 4 * sizeof(WVector4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nullptr, W_MEMORY_HOST_VISIBLE);
+	if (result != VK_SUCCESS) {
+		W_SAFE_DELETE(lightsBuffer);
+		return WError(W_OUTOFMEMORY);
+	}
+
+	if (assets.lightsBuffer)
+		assets.lightsBuffer->Destroy(m_app);
+	W_SAFE_DELETE(assets.lightsBuffer);
+	assets.lightsBuffer = lightsBuffer;
+	assets.lightsBufferCapacity = capacity;
+	return assets.perFrameMaterial->SetStorageBuffer("lightsBuffer", assets.lightsBuffer);
+}
+
+void WLightBufferRenderStage::LightTypeAssets::Destroy(Wasabi* app) {
 	for (auto it = materialMap.begin(); it != materialMap.end(); it++)
 		W_SAFE_REMOVEREF(it->second);
 	W_SAFE_REMOVEREF(geometry);
 	W_SAFE_REMOVEREF(effect);
 	W_SAFE_REMOVEREF(fullscreenSprite);
+	W_SAFE_REMOVEREF(perFrameMaterial);
+	if (lightsBuffer)
+		lightsBuffer->Destroy(app);
+	W_SAFE_DELETE(lightsBuffer);
+	lightsBufferCapacity = 0;
 	materialMap.clear();
 }
@@ -33,6 +33,7 @@ public:
 			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 5, 1, "depthTexture"),
 			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 6, 1, "backfaceDepthTexture"),
 			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 7, 1, "randomTexture"),
+			WRenderer::GetGlobalFrameBoundResource(),
 		};
 		vector<uint8_t> code {
 			#include "Shaders/scene_composition.frag.glsl.spv"
@@ -41,10 +42,53 @@ public:
 	}
 };
 
-WSceneCompositionRenderStage::WSceneCompositionRenderStage(Wasabi* const app) : WForwardRenderStage(app) {
+class SceneCompositionSubpassPS : public WShader {
+public:
+	SceneCompositionSubpassPS(class Wasabi* const app) : WShader(app) {}
+
+	virtual void Load(bool bSaveData = false) {
+		m_desc.type = W_FRAGMENT_SHADER;
+		m_desc.bound_resources = {
+			W_BOUND_RESOURCE(W_TYPE_UBO, 0, 0, "uboPerFrame", {
+				W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projInv"), // inverse of projection matrix
+			}),
+			W_BOUND_RESOURCE(W_TYPE_UBO, 1, 1, "uboParams", {
+				W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "ambient"), // light ambient color
+				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "SSAOSampleRadius"), // Radius to sample SSAO occluders
+				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "SSAOIntensity"), // Intensity of SSAO
+				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "SSAODistanceScale"), // SSAO distance scaling between occluder and occludees
+				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "SSAOAngleBias"), // SSAO angle "cutoff" (0-1)
+				W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "camFarClip"), // Camera's far clip range
+			}),
+			W_BOUND_RESOURCE(W_TYPE_INPUT_ATTACHMENT, 2, 1, "diffuseTexture"),
+			W_BOUND_RESOURCE(W_TYPE_INPUT_ATTACHMENT, 3, 1, "lightTexture"),
+			W_BOUND_RESOURCE(W_TYPE_INPUT_ATTACHMENT, 4, 1, "normalTexture"),
+			W_BOUND_RESOURCE(W_TYPE_INPUT_ATTACHMENT, 5, 1, "depthTexture"),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 6, 1, "backfaceDepthTexture"),
+			W_BOUND_RESOURCE(W_TYPE_TEXTURE, 7, 1, "randomTexture"),
+			WRenderer::GetGlobalFrameBoundResource(),
+		};
+		vector<uint8_t> code {
+			#include "Shaders/scene_composition_subpass.frag.glsl.spv"
+		};
+		LoadCodeSPIRV((char*)code.data(), (int)code.size(), bSaveData);
+	}
+};
+
+WSceneCompositionRenderStage::WSceneCompositionRenderStage(Wasabi* const app, bool mergedPasses) : WForwardRenderStage(app) {
 	m_stageDescription.name = __func__;
 	m_stageDescription.flags = RENDER_STAGE_FLAG_NONE;
+	if (mergedPasses) {
+		// compose into the "SceneColor" attachment of the G-buffer's render target (see WGBufferRenderStage)
+		m_stageDescription.target = RENDER_STAGE_TARGET_PREVIOUS;
+		m_stageDescription.flags = RENDER_STAGE_FLAG_DYNAMIC_RESOLUTION;
+	}
+	for (auto input : {"GBufferDiffuse", "LightBuffer", "GBufferViewSpaceNormal", "GBufferDepth", "BackfaceDepth"})
+		m_stageDescription.inputs.push_back(input);
 	m_addDefaultEffects = false;
+	m_mergedPasses = mergedPasses;
+	if (mergedPasses)
+		m_subpass = 3; // the forward objects render after the composition (see WGBufferRenderStage)
 
 	m_fullscreenSprite = nullptr;
 	m_effect = nullptr;
@@ -79,10 +123,14 @@ WError WSceneCompositionRenderStage::Initialize(std::vector<WRenderStage*>& prev
 	dss.stencilTestEnable = VK_FALSE;
 	dss.front = dss.back;
 
-	SceneCompositionPS* pixelShader = new SceneCompositionPS(m_app);
+	WShader* pixelShader = m_mergedPasses ? (WShader*)new SceneCompositionSubpassPS(m_app) : (WShader*)new SceneCompositionPS(m_app);
 	pixelShader->Load();
 
-	m_effect = m_app->SpriteManager->CreateSpriteEffect(m_renderTarget, pixelShader, {}, dss);
+	if (m_mergedPasses) {
+		// the third subpass of the G-buffer's render pass reads the depth as an input attachment and keeps it
+		m_effect = m_app->SpriteManager->CreateSpriteEffect(m_renderTarget, pixelShader, {}, {}, {}, 2);
+	} else
+		m_effect = m_app->SpriteManager->CreateSpriteEffect(m_renderTarget, pixelShader, {}, dss);
 	W_SAFE_REMOVEREF(pixelShader);
 	if (!m_effect)
 		return WError(W_OUTOFMEMORY);
@@ -122,6 +170,12 @@ WError WSceneCompositionRenderStage::Render(class WRenderer* renderer, class WRe
 	UNREFERENCED_PARAMETER(renderer);
 	UNREFERENCED_PARAMETER(filter);
 
+	if (m_mergedPasses) {
+		WError err = rt->NextSubpass();
+		if (!err)
+			return err;
+	}
+
 	WCamera* cam = rt->GetCamera();
 	if (abs(m_currentCameraFarPlane - cam->GetMaxRange()) >= W_EPSILON) {
 		m_currentCameraFarPlane = cam->GetMaxRange();
@@ -133,6 +187,12 @@ WError WSceneCompositionRenderStage::Render(class WRenderer* renderer, class WRe
 	m_effect->Bind(rt);
 	m_fullscreenSprite->Render(rt);
 
+	if (m_mergedPasses) {
+		// the forward objects are depth-tested against the G-buffer depth in the last subpass
+		WError err = rt->NextSubpass();
+		if (!err)
+			return err;
+	}
 	return WForwardRenderStage::Render(renderer, rt, filter);
 }
 
@@ -5,6 +5,9 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "../../Common/Shaders/object_utils.glsl"
+#include "../../Common/Shaders/global_frame.glsl"
+#include "../../Common/Shaders/effect_features.glsl"
+#include "../../Common/Shaders/crowd_animation.glsl"
 
 layout(location = 0) in vec3 inPos;
 layout(location = 1) in vec3 inTang;
@@ -14,50 +17,42 @@ layout(location = 4) in uint inTexIndex;
 layout(location = 5) in uvec4 inBoneIndex;
 layout(location = 6) in vec4 inBoneWeight;
 
-struct Light {
-	vec4 color;
-	vec4 dir;
-	vec4 pos;
-	int type;
-};
-
 layout(set = 0, binding = 0) uniform UBO {
-	mat4 worldMatrix;
 	vec4 color;
-	int isInstanced;
-	int isTextured;
 } uboPerObject;
 
-layout(set = 1, binding = 1) uniform LUBO {
-	mat4 viewMatrix;
-	mat4 projectionMatrix;
-	vec3 camDirW;
-	int numLights;
-	Light lights[16];
-} uboPerFrame;
+layout(push_constant) uniform PushConstant {
+	uint objectIndex;
+} pcPerObject;
 
 layout(set = 0, binding = 2) uniform sampler2D animationTexture;
 layout(set = 0, binding = 3) uniform sampler2D instancingTexture;
 
+// the depth prepass runs this same shader, the shading pass tests for equal depth
+invariant gl_Position;
+
 layout(location = 0) out vec2 outUV;
 layout(location = 1) out vec3 outWorldPos;
 layout(location = 2) out vec3 outWorldNorm;
 layout(location = 3) flat out uint outTexIndex;
 void main() {
+	mat4x4 worldMatrix = sceneObjects.objects[pcPerObject.objectIndex].worldMatrix;
+	mat4x4 normalMatrix = sceneObjects.objects[pcPerObject.objectIndex].normalMatrix;
 	mat4x4 animMtx = mat4x4(0.0f);
 	mat4x4 instMtx =
-		uboPerObject.isInstanced == 1
+		isInstanced
 		? LoadMatrixFromTexture(gl_InstanceIndex, instancingTexture, textureSize(instancingTexture, 0).x)
 		: mat4x4(1.0f);
 	if (inBoneWeight.x > 0.001f) {
 		int animationTextureWidth = textureSize(animationTexture, 0).x;
-		animMtx += inBoneWeight.x * LoadMatrixFromTexture(int(inBoneIndex.x), animationTexture, animationTextureWidth);
+		vec3 crowdSample = SampleCrowdAnimation(gl_InstanceIndex, instancingTexture, animationTexture);
+		animMtx += inBoneWeight.x * LoadBoneMatrix(int(inBoneIndex.x), crowdSample, animationTexture, animationTextureWidth);
 		if (inBoneWeight.y > 0.001f) {
-			animMtx += inBoneWeight.y * LoadMatrixFromTexture(int(inBoneIndex.y), animationTexture, animationTextureWidth);
+			animMtx += inBoneWeight.y * LoadBoneMatrix(int(inBoneIndex.y), crowdSample, animationTexture, animationTextureWidth);
 			if (inBoneWeight.z > 0.001f) {
-				animMtx += inBoneWeight.z * LoadMatrixFromTexture(int(inBoneIndex.z), animationTexture, animationTextureWidth);
+				animMtx += inBoneWeight.z * LoadBoneMatrix(int(inBoneIndex.z), crowdSample, animationTexture, animationTextureWidth);
 				if (inBoneWeight.w > 0.001f) {
-					animMtx += inBoneWeight.w * LoadMatrixFromTexture(int(inBoneIndex.w), animationTexture, animationTextureWidth);
+					animMtx += inBoneWeight.w * LoadBoneMatrix(int(inBoneIndex.w), crowdSample, animationTexture, animationTextureWidth);
 				}
 			}
 		}
@@ -67,9 +62,9 @@ void main() {
 	vec4 localPos2 = instMtx * vec4(localPos1.xyz, 1.0);
 	vec4 localNorm1 = animMtx * vec4(inNorm.xyz, 0.0f);
 	vec4 localNorm2 = instMtx * vec4(localNorm1.xyz, 0.0f);
-	outWorldPos = (uboPerObject.worldMatrix * localPos2).xyz;
-	outWorldNorm = (uboPerObject.worldMatrix * localNorm2).xyz;
+	outWorldPos = (worldMatrix * localPos2).xyz;
+	outWorldNorm = (normalMatrix * localNorm2).xyz;
 	outUV = inUV;
 	outTexIndex = inTexIndex;
-	gl_Position = uboPerFrame.projectionMatrix * uboPerFrame.viewMatrix * vec4(outWorldPos, 1.0);
+	gl_Position = uboGlobalFrame.viewProjectionMatrix * vec4(outWorldPos, 1.0);
 }
\ No newline at end of file
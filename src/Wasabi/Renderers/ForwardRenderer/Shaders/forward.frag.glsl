@@ -5,29 +5,24 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "../../Common/Shaders/utils.glsl"
-
-struct Light {
-	vec4 color;
-	vec4 dir;
-	vec4 pos;
-	int type;
-};
+#include "../../Common/Shaders/object_utils.glsl"
+#include "../../Common/Shaders/global_frame.glsl"
+#include "../../Common/Shaders/effect_features.glsl"
+#include "../../Common/Shaders/shadows.glsl"
+// the light clusters buffers are at bindings 6, 7 and 8 of the per-frame set
+#define W_LIGHT_CLUSTERS_SET 1
+#define W_LIGHT_CLUSTERS_BINDING 6
+#include "../../Common/Shaders/light_clusters.glsl"
 
 layout(set = 0, binding = 0) uniform UBO {
-	mat4 worldMatrix;
 	vec4 color;
 	float specularPower;
 	float specularIntensity;
-	int isInstanced;
-	int isTextured;
 } uboPerObject;
 
 layout(set = 1, binding = 1) uniform LUBO {
-	mat4 viewMatrix;
-	mat4 projectionMatrix;
-	vec3 camDirW;
-	int numLights;
-	Light lights[16];
+	uvec4 clusterGrid;
+	vec4 clusterDepth;
 } uboPerFrame;
 
 layout(set = 1, binding = 5) uniform PUBO {
@@ -35,6 +30,8 @@ layout(set = 1, binding = 5) uniform PUBO {
 } uboParams;
 
 layout(set = 0, binding = 4) uniform sampler2D diffuseTexture[8];
+layout(set = 1, binding = 9) uniform sampler2D shadowAtlas;
+layout(set = 1, binding = 10) uniform sampler2D shadowTilesTexture;
 
 layout(location = 0) in vec2 inUV;
 layout(location = 1) in vec3 inWorldPos;
@@ -44,45 +41,19 @@ layout(location = 3) flat in uint inTexIndex;
 layout(location = 0) out vec4 outFragColor;
 
 void main() {
-	vec4 color = texture(diffuseTexture[inTexIndex], inUV) * uboPerObject.isTextured + uboPerObject.color;
-	vec3 totalLighting = vec3(0, 0, 0);
-	for (int i = 0; i < uboPerFrame.numLights; i++) {
-		float lightIntensity = uboPerFrame.lights[i].color.a;
-		vec4 light;
-		if (uboPerFrame.lights[i].type == 0) {
-			light = WasabiDirectionalLight(
-				inWorldPos,
-				inWorldNorm,
-				uboPerFrame.camDirW,
-				uboPerObject.specularPower,
-				uboPerFrame.lights[i].dir.xyz,
-				uboPerFrame.lights[i].color.rgb
-			);
-		} else if (uboPerFrame.lights[i].type == 1) {
-			light = WasabiPointLight(
-				inWorldPos,
-				inWorldNorm,
-				uboPerFrame.camDirW,
-				uboPerObject.specularPower,
-				uboPerFrame.lights[i].pos.xyz,
-				uboPerFrame.lights[i].color.rgb,
-				uboPerFrame.lights[i].dir.a
-			);
-		} else if (uboPerFrame.lights[i].type == 2) {
-			light = WasabiSpotLight(
-				inWorldPos,
-				inWorldNorm,
-				uboPerFrame.camDirW,
-				uboPerObject.specularPower,
-				uboPerFrame.lights[i].pos.xyz,
-				uboPerFrame.lights[i].dir.xyz,
-				uboPerFrame.lights[i].color.rgb,
-				uboPerFrame.lights[i].dir.a, // light range
-				uboPerFrame.lights[i].pos.a // min cosine angle
-			);
-		}
-		totalLighting += light.rgb * lightIntensity + light.rgb * light.a * uboPerObject.specularIntensity;
-	}
+	vec4 color = uboPerObject.color;
+	if (isTextured)
+		color += texture(diffuseTexture[inTexIndex], inUV);
+	vec3 totalLighting = WasabiClusteredLighting(
+		inWorldPos,
+		inWorldNorm,
+		uboPerObject.specularPower,
+		uboPerObject.specularIntensity,
+		uboPerFrame.clusterGrid,
+		uboPerFrame.clusterDepth,
+		shadowAtlas,
+		shadowTilesTexture
+	);
 	vec3 ambientLight = color.rgb * uboParams.ambient.rgb;
 	vec3 lit = color.rgb * totalLighting.rgb;
 	outFragColor = vec4(ambientLight + lit, color.a);
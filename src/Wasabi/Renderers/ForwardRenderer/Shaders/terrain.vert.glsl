@@ -5,6 +5,7 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "../../Common/Shaders/object_utils.glsl"
+#include "../../Common/Shaders/global_frame.glsl"
 
 // per-vertex data
 layout(location = 0) in vec3 inPos;
@@ -13,25 +14,10 @@ layout(location = 2) in vec3 inNorm;
 layout(location = 3) in vec2 inUV;
 layout(location = 4) in uint inTexIndex;
 
-struct Light {
-	vec4 color;
-	vec4 dir;
-	vec4 pos;
-	int type;
-};
-
 layout(set = 0, binding = 0) uniform UBO {
 	mat4 worldMatrix;
 } uboPerTerrain;
 
-layout(set = 1, binding = 1) uniform LUBO {
-	mat4 viewMatrix;
-	mat4 projectionMatrix;
-	vec3 camDirW;
-	int numLights;
-	Light lights[16];
-} uboPerFrame;
-
 layout(push_constant) uniform PushConstant {
 	int geometryOffsetInTexture;
 } pcPerGeometry;
@@ -39,6 +25,9 @@ layout(push_constant) uniform PushConstant {
 layout(set = 0, binding = 2) uniform sampler2D instancingTexture;
 layout(set = 0, binding = 3) uniform usampler2DArray heightTexture;
 
+// the depth prepass runs this same shader, the shading pass tests for equal depth
+invariant gl_Position;
+
 layout(location = 0) out vec2 outUV;
 layout(location = 1) out vec3 outWorldPos;
 layout(location = 2) out vec3 outWorldNorm;
@@ -78,5 +67,5 @@ void main() {
 	outWorldNorm = vec4(inNorm.xyz, 0.0).xyz;
 	outLevel = max(0, level - 1);
 	outAlpha = fineAlpha;
-	gl_Position = uboPerFrame.projectionMatrix * uboPerFrame.viewMatrix * vec4(outWorldPos, 1.0);
+	gl_Position = uboGlobalFrame.viewProjectionMatrix * vec4(outWorldPos, 1.0);
 }
\ No newline at end of file
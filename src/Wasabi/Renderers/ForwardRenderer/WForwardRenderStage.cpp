@@ -1,4 +1,5 @@
 #include "Wasabi/Renderers/ForwardRenderer/WForwardRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WShadowRenderStage.hpp"
 #include "Wasabi/Core/WCore.hpp"
 #include "Wasabi/Renderers/WRenderer.hpp"
 #include "Wasabi/Lights/WLight.hpp"
@@ -10,7 +11,7 @@
 WForwardRenderStageObjectVS::WForwardRenderStageObjectVS(Wasabi* const app) : WShader(app) {}
 
 void WForwardRenderStageObjectVS::Load(bool bSaveData) {
-	int maxLights = m_app->GetEngineParam<int>("maxLights", 0);
+	int maxLights = m_app->GetEngineParam<int>("maxLights");
 	m_desc = GetDesc(maxLights);
 	vector<uint8_t> code {
 		#include "Shaders/forward.vert.glsl.spv"
@@ -19,25 +20,21 @@ void WForwardRenderStageObjectVS::Load(bool bSaveData) {
 }
 
 W_SHADER_DESC WForwardRenderStageObjectVS::GetDesc(int maxLights) {
+	UNREFERENCED_PARAMETER(maxLights);
+
 	W_SHADER_DESC desc;
 	desc.type = W_VERTEX_SHADER;
 	desc.bound_resources = {
 		W_BOUND_RESOURCE(W_TYPE_UBO, 0, 0, "uboPerObject", {
-			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "worldMatrix"), // world
 			W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "color"), // object color
 			W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "specularPower"), // specular power (dot raised to this power)
 			W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "specularIntensity"), // specular intensity (specular term is multiplied by this)
-			W_SHADER_VARIABLE_INFO(W_TYPE_INT, "isInstanced"), // whether or not instancing is enabled
-			W_SHADER_VARIABLE_INFO(W_TYPE_INT, "isTextured"), // whether or not to use diffuse texture
-		}),
-		W_BOUND_RESOURCE(W_TYPE_UBO, 1, 1, "uboPerFrame", {
-			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "viewMatrix"), // view
-			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projectionMatrix"), // projection
-			W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3, "camDirW"),
-			W_SHADER_VARIABLE_INFO(W_TYPE_INT, "numLights"),
-			W_SHADER_VARIABLE_INFO(W_TYPE_STRUCT, maxLights, sizeof(LightStruct), 16, "lights"),
 		}),
+		WRenderer::GetGlobalFrameBoundResource(),
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 3, 0, "instancingTexture"),
+		W_BOUND_RESOURCE(W_TYPE_PUSH_CONSTANT, 0, "pcPerObject", {
+			W_SHADER_VARIABLE_INFO(W_TYPE_UINT, "objectIndex"), // index into the renderer's scene objects buffer
+		}),
 	};
 	desc.input_layouts = { W_INPUT_LAYOUT({
 		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3), // position
@@ -52,7 +49,7 @@ W_SHADER_DESC WForwardRenderStageObjectVS::GetDesc(int maxLights) {
 WForwardRenderStageAnimatedObjectVS::WForwardRenderStageAnimatedObjectVS(Wasabi* const app) : WShader(app) {}
 
 void WForwardRenderStageAnimatedObjectVS::Load(bool bSaveData) {
-	int maxLights = m_app->GetEngineParam<int>("maxLights", 0);
+	int maxLights = m_app->GetEngineParam<int>("maxLights");
 	m_desc = GetDesc(maxLights);
 	vector<uint8_t> code{
 		#include "Shaders/forward-animated.vert.glsl.spv"
@@ -68,6 +65,7 @@ W_SHADER_DESC WForwardRenderStageAnimatedObjectVS::GetDesc(int maxLights) {
 		WForwardRenderStageObjectVS::GetDesc(maxLights).bound_resources[1],
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 2, 0, "animationTexture"),
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 3, 0, "instancingTexture"),
+		WForwardRenderStageObjectVS::GetDesc(maxLights).bound_resources[3],
 	};
 	desc.input_layouts = {
 		WForwardRenderStageObjectVS::GetDesc(maxLights).input_layouts[0], W_INPUT_LAYOUT({
@@ -80,7 +78,7 @@ W_SHADER_DESC WForwardRenderStageAnimatedObjectVS::GetDesc(int maxLights) {
 WForwardRenderStageObjectPS::WForwardRenderStageObjectPS(Wasabi* const app) : WShader(app) {}
 
 void WForwardRenderStageObjectPS::Load(bool bSaveData) {
-	int maxLights = m_app->GetEngineParam<int>("maxLights", 0);
+	int maxLights = m_app->GetEngineParam<int>("maxLights");
 	m_desc = GetDesc(maxLights);
 	vector<uint8_t> code {
 		#include "Shaders/forward.frag.glsl.spv"
@@ -94,10 +92,19 @@ W_SHADER_DESC WForwardRenderStageObjectPS::GetDesc(int maxLights) {
 	desc.bound_resources = {
 		WForwardRenderStageObjectVS::GetDesc(maxLights).bound_resources[0],
 		WForwardRenderStageObjectVS::GetDesc(maxLights).bound_resources[1],
+		W_BOUND_RESOURCE(W_TYPE_UBO, 1, 1, "uboPerFrame", {
+			W_SHADER_VARIABLE_INFO(W_TYPE_UINT, 4, "clusterGrid"), // see WLightClusters::SHADER_PARAMS
+			W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "clusterDepth"),
+		}),
 		W_BOUND_RESOURCE(W_TYPE_UBO, 5, 1, "uboParams", {
 			W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "ambient"), // Ambient lighting
 		}),
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 4, 0, "diffuseTexture", {}, 8),
+		W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 6, 1, "lightsBuffer"), // see WLightClusters
+		W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 7, 1, "clustersBuffer"),
+		W_BOUND_RESOURCE(W_TYPE_STORAGE_BUFFER, 8, 1, "lightIndicesBuffer"),
+		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 9, 1, "shadowAtlas"),
+		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 10, 1, "shadowTilesTexture"),
 	};
 	return desc;
 }
@@ -105,7 +112,7 @@ W_SHADER_DESC WForwardRenderStageObjectPS::GetDesc(int maxLights) {
 WForwardRenderStageTerrainVS::WForwardRenderStageTerrainVS(Wasabi* const app) : WShader(app) {}
 
 void WForwardRenderStageTerrainVS::Load(bool bSaveData) {
-	int maxLights = m_app->GetEngineParam<int>("maxLights", 0);
+	int maxLights = m_app->GetEngineParam<int>("maxLights");
 	m_desc = GetDesc(maxLights);
 	vector<uint8_t> code {
 		#include "Shaders/terrain.vert.glsl.spv"
@@ -114,6 +121,8 @@ void WForwardRenderStageTerrainVS::Load(bool bSaveData) {
 }
 
 W_SHADER_DESC WForwardRenderStageTerrainVS::GetDesc(int maxLights) {
+	UNREFERENCED_PARAMETER(maxLights);
+
 	W_SHADER_DESC desc;
 	desc.type = W_VERTEX_SHADER;
 	desc.bound_resources = {
@@ -122,13 +131,7 @@ W_SHADER_DESC WForwardRenderStageTerrainVS::GetDesc(int maxLights) {
 			W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "specularPower"), // specular power (dot raised to this power)
 			W_SHADER_VARIABLE_INFO(W_TYPE_FLOAT, "specularIntensity"), // specular intensity (specular term is multiplied by this)
 		}),
-		W_BOUND_RESOURCE(W_TYPE_UBO, 1, 1, "uboPerFrame", {
-			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "viewMatrix"), // view
-			W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projectionMatrix"), // projection
-			W_SHADER_VARIABLE_INFO(W_TYPE_VEC_3, "camDirW"),
-			W_SHADER_VARIABLE_INFO(W_TYPE_INT, "numLights"),
-			W_SHADER_VARIABLE_INFO(W_TYPE_STRUCT, maxLights, sizeof(LightStruct), 16, "lights"),
-		}),
+		WRenderer::GetGlobalFrameBoundResource(),
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 2, 0, "instancingTexture"),
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 3, 0, "heightTexture"),
 		W_BOUND_RESOURCE(W_TYPE_PUSH_CONSTANT, 0, "pcPerGeometry", {
@@ -148,7 +151,7 @@ W_SHADER_DESC WForwardRenderStageTerrainVS::GetDesc(int maxLights) {
 WForwardRenderStageTerrainPS::WForwardRenderStageTerrainPS(Wasabi* const app) : WShader(app) {}
 
 void WForwardRenderStageTerrainPS::Load(bool bSaveData) {
-	int maxLights = m_app->GetEngineParam<int>("maxLights", 0);
+	int maxLights = m_app->GetEngineParam<int>("maxLights");
 	m_desc = GetDesc(maxLights);
 	vector<uint8_t> code {
 		#include "Shaders/terrain.frag.glsl.spv"
@@ -162,19 +165,39 @@ W_SHADER_DESC WForwardRenderStageTerrainPS::GetDesc(int maxLights) {
 	desc.bound_resources = {
 		WForwardRenderStageTerrainVS::GetDesc(maxLights).bound_resources[0],
 		WForwardRenderStageTerrainVS::GetDesc(maxLights).bound_resources[1],
+		WForwardRenderStageObjectPS::GetDesc(maxLights).bound_resources[2],
 		W_BOUND_RESOURCE(W_TYPE_TEXTURE, 4, 0, "diffuseTexture"),
+		WForwardRenderStageObjectPS::GetDesc(maxLights).bound_resources[5],
+		WForwardRenderStageObjectPS::GetDesc(maxLights).bound_resources[6],
+		WForwardRenderStageObjectPS::GetDesc(maxLights).bound_resources[7],
+		WForwardRenderStageObjectPS::GetDesc(maxLights).bound_resources[8],
+		WForwardRenderStageObjectPS::GetDesc(maxLights).bound_resources[9],
 	};
 	return desc;
 }
 
-WForwardRenderStage::WForwardRenderStage(Wasabi* const app) : WRenderStage(app) {
+WForwardRenderStage::WForwardRenderStage(Wasabi* const app, bool backbuffer) : WRenderStage(app) {
 	m_stageDescription.name = __func__;
-	m_stageDescription.target = RENDER_STAGE_TARGET_BACK_BUFFER;
-	m_stageDescription.flags = RENDER_STAGE_FLAG_PICKING_RENDER_STAGE;
+	if (backbuffer) {
+		m_stageDescription.target = RENDER_STAGE_TARGET_BACK_BUFFER;
+		m_stageDescription.flags = RENDER_STAGE_FLAG_PICKING_RENDER_STAGE;
+	} else {
+		// render offscreen at the dynamic resolution scale, a WUpscaleRenderStage brings the output to the back buffer
+		m_stageDescription.target = RENDER_STAGE_TARGET_BUFFER;
+		m_stageDescription.colorOutputs = std::vector<WRenderStage::OUTPUT_IMAGE>({
+			WRenderStage::OUTPUT_IMAGE("ForwardColor", VK_FORMAT_R8G8B8A8_UNORM, WColor(0.0f, 0.0f, 0.0f, 0.0f)),
+		});
+		m_stageDescription.depthOutput = WRenderStage::OUTPUT_IMAGE("ForwardDepth", VK_FORMAT_D16_UNORM, WColor(1.0f, 0.0f, 0.0f, 0.0f));
+		m_stageDescription.colorOutputs[0].transient = m_stageDescription.depthOutput.transient = true; // only read by the upscale
+		m_stageDescription.flags = RENDER_STAGE_FLAG_PICKING_RENDER_STAGE | RENDER_STAGE_FLAG_DYNAMIC_RESOLUTION;
+	}
+	m_stageDescription.inputs = std::vector<std::string>({"ShadowAtlas"});
 
-	if (m_app->GetEngineParam<int>("maxLights", -1) == -1)
-		m_app->SetEngineParam<int>("maxLights", 16);
-	m_lights.resize(m_app->GetEngineParam<int>("maxLights"));
+	m_lightClusters = nullptr;
+	m_depthPrepass = false;
+	m_prepassObjectsFragment = nullptr;
+	m_prepassAnimatedObjectsFragment = nullptr;
+	m_prepassTerrainsFragment = nullptr;
 
 	m_objectsFragment = nullptr;
 	m_animatedObjectsFragment = nullptr;
@@ -183,6 +206,7 @@ WForwardRenderStage::WForwardRenderStage(Wasabi* const app) : WRenderStage(app)
 	m_perFrameAnimatedObjectsMaterial = nullptr;
 	m_perFrameTerrainsMaterial = nullptr;
 	m_addDefaultEffects = true;
+	m_subpass = 0;
 }
 
 WError WForwardRenderStage::Initialize(std::vector<WRenderStage*>& previousStages, uint32_t width, uint32_t height) {
@@ -193,64 +217,98 @@ WError WForwardRenderStage::Initialize(std::vector<WRenderStage*>& previousStage
 	WForwardRenderStageObjectVS* vs = new WForwardRenderStageObjectVS(m_app);
 	vs->SetName("DefaultForwardVS");
 	m_app->FileManager->AddDefaultAsset(vs->GetName(), vs);
-	vs->Load();
 
 	WForwardRenderStageAnimatedObjectVS* vsa = new WForwardRenderStageAnimatedObjectVS(m_app);
 	vsa->SetName("DefaultForwardAnimatedVS");
 	m_app->FileManager->AddDefaultAsset(vsa->GetName(), vsa);
-	vsa->Load();
 
 	WForwardRenderStageObjectPS* ps = new WForwardRenderStageObjectPS(m_app);
 	ps->SetName("DefaultForwardPS");
 	m_app->FileManager->AddDefaultAsset(ps->GetName(), ps);
-	ps->Load();
+
+	m_app->ShaderManager->LoadShaders({ vs, vsa, ps });
+
+	// with the depth prepass, the default effects only shade the pixels whose depth matches the prepass
+	m_depthPrepass = m_app->GetEngineParam<bool>("forwardDepthPrepass");
+	VkPipelineDepthStencilStateCreateInfo shadingDepthState = {};
+	shadingDepthState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	shadingDepthState.depthTestEnable = VK_TRUE;
+	shadingDepthState.depthWriteEnable = VK_FALSE;
+	shadingDepthState.depthCompareOp = VK_COMPARE_OP_EQUAL;
+	shadingDepthState.depthBoundsTestEnable = VK_FALSE;
+	shadingDepthState.back.failOp = VK_STENCIL_OP_KEEP;
+	shadingDepthState.back.passOp = VK_STENCIL_OP_KEEP;
+	shadingDepthState.back.compareOp = VK_COMPARE_OP_ALWAYS;
+	shadingDepthState.stencilTestEnable = VK_FALSE;
+	shadingDepthState.front = shadingDepthState.back;
 
 	WEffect* fx = new WEffect(m_app);
 	fx->SetName("DefaultForwardEffect");
 	m_app->FileManager->AddDefaultAsset(fx->GetName(), fx);
+	fx->SetSupportedFeatures(EFFECT_FEATURE_INSTANCED | EFFECT_FEATURE_TEXTURED);
+	fx->SetSubpass(m_subpass);
 
 	WEffect* fxa = new WEffect(m_app);
 	fxa->SetName("DefaultForwardAnimatedEffect");
 	m_app->FileManager->AddDefaultAsset(fxa->GetName(), fxa);
+	fxa->SetSupportedFeatures(EFFECT_FEATURE_INSTANCED | EFFECT_FEATURE_TEXTURED | EFFECT_FEATURE_CROWD_ANIMATED);
+	fxa->SetSubpass(m_subpass);
+	if (m_depthPrepass) {
+		fx->SetDepthStencilState(shadingDepthState);
+		fxa->SetDepthStencilState(shadingDepthState);
+	}
 
 	err = fx->BindShader(vs);
 	if (err) {
 		err = fx->BindShader(ps);
 		if (err) {
-			err = fx->BuildPipeline(m_renderTarget);
+			err = fx->BuildPipelineAsync(m_renderTarget);
 			if (err) {
 				err = fxa->BindShader(vsa);
 				if (err) {
 					err = fxa->BindShader(ps);
 					if (err) {
-						err = fxa->BuildPipeline(m_renderTarget);
+						err = fxa->BuildPipelineAsync(m_renderTarget);
 					}
 				}
 			}
 		}
 	}
+	WEffect* prepassFX = nullptr;
+	WEffect* prepassFXA = nullptr;
+	if (err && m_depthPrepass) {
+		prepassFX = _CreateDepthPrepassEffect("DefaultForwardDepthPrepassEffect", vs, fx->GetSupportedFeatures());
+		prepassFXA = _CreateDepthPrepassEffect("DefaultForwardAnimatedDepthPrepassEffect", vsa, fxa->GetSupportedFeatures());
+		if (!prepassFX || !prepassFXA)
+			err = WError(W_ERRORUNK);
+	}
 	W_SAFE_REMOVEREF(vs);
 	W_SAFE_REMOVEREF(vsa);
 	W_SAFE_REMOVEREF(ps);
 	if (!err) {
 		W_SAFE_REMOVEREF(fx);
 		W_SAFE_REMOVEREF(fxa);
+		W_SAFE_REMOVEREF(prepassFX);
+		W_SAFE_REMOVEREF(prepassFXA);
 		return err;
 	}
 
 	WForwardRenderStageTerrainVS* terrainVS = new WForwardRenderStageTerrainVS(m_app);
 	terrainVS->SetName("DefaultForwardTerrainVS");
 	m_app->FileManager->AddDefaultAsset(terrainVS->GetName(), terrainVS);
-	terrainVS->Load();
 
 	WForwardRenderStageTerrainPS* terrainPS = new WForwardRenderStageTerrainPS(m_app);
 	terrainPS->SetName("DefaultForwardTerrainPS");
 	m_app->FileManager->AddDefaultAsset(terrainPS->GetName(), terrainPS);
-	terrainPS->Load();
+
+	m_app->ShaderManager->LoadShaders({ terrainVS, terrainPS });
 
 	WEffect* terrainFX = new WEffect(m_app);
 	terrainFX->SetName("DefaultForwardTerrainEffect");
 	m_app->FileManager->AddDefaultAsset(terrainFX->GetName(), terrainFX);
+	terrainFX->SetSubpass(m_subpass);
+	if (m_depthPrepass)
+		terrainFX->SetDepthStencilState(shadingDepthState);
 	err = terrainFX->BindShader(terrainVS);
 	if (err) {
 		err = terrainFX->BindShader(terrainPS);
@@ -265,21 +323,37 @@ WError WForwardRenderStage::Initialize(std::vector<WRenderStage*>& previousStage
 			rs.depthBiasEnable = VK_FALSE;
 			rs.lineWidth = 1.0f;
 			terrainFX->SetRasterizationState(rs);*/
-			err = terrainFX->BuildPipeline(m_renderTarget);
+			err = terrainFX->BuildPipelineAsync(m_renderTarget);
 		}
 	}
+	WEffect* prepassTerrainFX = nullptr;
+	if (err && m_depthPrepass) {
+		prepassTerrainFX = _CreateDepthPrepassEffect("DefaultForwardTerrainDepthPrepassEffect", terrainVS, terrainFX->GetSupportedFeatures());
+		if (!prepassTerrainFX)
+			err = WError(W_ERRORUNK);
+	}
 	W_SAFE_REMOVEREF(terrainVS);
 	W_SAFE_REMOVEREF(terrainPS);
 	if (!err) {
 		W_SAFE_REMOVEREF(terrainFX);
+		W_SAFE_REMOVEREF(prepassTerrainFX);
+		W_SAFE_REMOVEREF(prepassFX);
+		W_SAFE_REMOVEREF(prepassFXA);
 		return err;
 	}
 
-	m_objectsFragment = new WObjectsRenderFragment(m_stageDescription.name, false, fx, m_app, EFFECT_RENDER_FLAG_RENDER_FORWARD, m_addDefaultEffects);
-	m_animatedObjectsFragment = new WObjectsRenderFragment(m_stageDescription.name + "-animated", true, fxa, m_app, EFFECT_RENDER_FLAG_RENDER_FORWARD, m_addDefaultEffects);
+	// objects skinned by a WSkinningRenderStage are rendered with the non-animated effect
+	m_objectsFragment = new WObjectsRenderFragment(m_stageDescription.name, false, fx, m_app, EFFECT_RENDER_FLAG_RENDER_FORWARD, m_addDefaultEffects, true);
+	m_animatedObjectsFragment = new WObjectsRenderFragment(m_stageDescription.name + "-animated", true, fxa, m_app, EFFECT_RENDER_FLAG_RENDER_FORWARD, m_addDefaultEffects, true);
 
 	m_terrainsFragment = new WTerrainRenderFragment(m_stageDescription.name, terrainFX, m_app, EFFECT_RENDER_FLAG_RENDER_FORWARD);
 
+	if (m_depthPrepass) {
+		m_prepassObjectsFragment = new WForwardDepthPrepassFragment(m_stageDescription.name + "-prepass", false, prepassFX, fx, m_app);
+		m_prepassAnimatedObjectsFragment = new WForwardDepthPrepassFragment(m_stageDescription.name + "-prepass-animated", true, prepassFXA, fxa, m_app);
+		m_prepassTerrainsFragment = new WForwardTerrainDepthPrepassFragment(m_stageDescription.name + "-prepass", prepassTerrainFX, terrainFX, m_app);
+	}
+
 	m_perFrameObjectsMaterial = m_objectsFragment->GetEffect()->CreateMaterial(1, true);
 	if (!m_perFrameObjectsMaterial) {
 		err = WError(W_ERRORUNK);
@@ -304,6 +378,33 @@ WError WForwardRenderStage::Initialize(std::vector<WRenderStage*>& previousStage
 		m_app->FileManager->AddDefaultAsset(m_perFrameTerrainsMaterial->GetName(), m_perFrameTerrainsMaterial);
 	}
 
+	if (err) {
+		m_lightClusters = new WLightClusters(m_app);
+		W_LIGHT_CLUSTERS_BUILD build = m_app->GetEngineParam<bool>("computeLightClusters") ? W_LIGHT_CLUSTERS_BUILD_COMPUTE : W_LIGHT_CLUSTERS_BUILD_CPU;
+		err = m_lightClusters->Initialize(m_app->GetEngineParam<int>("maxLights"), build);
+		if (err) {
+			// the cluster lists are then filled in RecordCompute()
+			if (m_lightClusters->IsComputeBuilt())
+				m_stageDescription.flags |= RENDER_STAGE_FLAG_ASYNC_COMPUTE;
+
+			// shadows are only available if the renderer has a shadow stage before this one
+			WShadowRenderStage* shadows = (WShadowRenderStage*)m_app->Renderer->GetRenderStage("WShadowRenderStage");
+			m_lightClusters->SetShadows(shadows);
+
+			// the light buffers are rewritten every frame but the buffers themselves never change
+			WMaterial* perFrameMaterials[] = { m_perFrameObjectsMaterial, m_perFrameAnimatedObjectsMaterial, m_perFrameTerrainsMaterial };
+			for (uint32_t i = 0; i < sizeof(perFrameMaterials) / sizeof(perFrameMaterials[0]); i++) {
+				perFrameMaterials[i]->SetStorageBuffer("lightsBuffer", m_lightClusters->GetLightsBuffer());
+				perFrameMaterials[i]->SetStorageBuffer("clustersBuffer", m_lightClusters->GetClustersBuffer());
+				perFrameMaterials[i]->SetStorageBuffer("lightIndicesBuffer", m_lightClusters->GetLightIndicesBuffer());
+				if (shadows) {
+					perFrameMaterials[i]->SetTexture("shadowAtlas", shadows->GetShadowAtlas());
+					perFrameMaterials[i]->SetTexture("shadowTilesTexture", shadows->GetShadowTilesTexture());
+				}
+			}
+		}
+	}
+
 	SetAmbientLight(WColor(0.3f, 0.3f, 0.3f));
 
 	return err;
@@ -317,52 +418,67 @@ void WForwardRenderStage::Cleanup() {
 	W_SAFE_DELETE(m_objectsFragment);
 	W_SAFE_DELETE(m_animatedObjectsFragment);
 	W_SAFE_DELETE(m_terrainsFragment);
+	W_SAFE_DELETE(m_prepassObjectsFragment);
+	W_SAFE_DELETE(m_prepassAnimatedObjectsFragment);
+	W_SAFE_DELETE(m_prepassTerrainsFragment);
+	W_SAFE_DELETE(m_lightClusters);
+}
+
+WEffect* WForwardRenderStage::_CreateDepthPrepassEffect(std::string name, WShader* vs, W_EFFECT_FEATURE_FLAGS features) {
+	WEffect* fx = new WEffect(m_app);
+	fx->SetName(name);
+	m_app->FileManager->AddDefaultAsset(fx->GetName(), fx);
+	fx->SetSupportedFeatures(features);
+	fx->SetSubpass(m_subpass);
+
+	// there is no fragment shader, only the depth is written
+	VkPipelineColorBlendAttachmentState blendState = {};
+	blendState.colorWriteMask = 0;
+	blendState.blendEnable = VK_FALSE;
+	fx->SetBlendingState(blendState);
+
+	WError err = fx->BindShader(vs);
+	if (err)
+		err = fx->BuildPipelineAsync(m_renderTarget);
+	if (!err)
+		W_SAFE_REMOVEREF(fx);
+	return fx;
+}
+
+WError WForwardRenderStage::RecordCompute(WRenderer* renderer, VkCommandBuffer cmdBuf) {
+	// the render target's global frame data is only written when it begins, after the compute work
+	return m_lightClusters->RecordBuild(renderer, cmdBuf, renderer->GetUpcomingGlobalFrameData(m_renderTarget));
 }
 
 WError WForwardRenderStage::Render(WRenderer* renderer, WRenderTarget* rt, uint32_t filter) {
-	WCamera* cam = rt->GetCamera();
-
-	int numLights = 0;
-	for (uint32_t i = 0; (size_t)numLights < m_lights.size(); i++) {
-		WLight* light = m_app->LightManager->GetEntityByIndex(i);
-		if (!light)
-			break;
-		if (!light->Hidden() && light->InCameraView(cam)) {
-			WColor c = light->GetColor();
-			WVector3 l = light->GetLVector();
-			WVector3 p = light->GetPosition();
-			m_lights[numLights].color = WVector4(c.r, c.g, c.b, light->GetIntensity());
-			m_lights[numLights].dir = WVector4(l.x, l.y, l.z, light->GetRange());
-			m_lights[numLights].pos = WVector4(p.x, p.y, p.z, light->GetMinCosAngle());
-			m_lights[numLights].type = (int)light->GetType();
-			numLights++;
+	// assign the visible lights to the clusters of the view, pixel shaders only loop over the lights of their cluster
+	m_lightClusters->Build(renderer->GetGlobalFrameData(rt));
+	WLightClusters::SHADER_PARAMS clusterParams = m_lightClusters->GetShaderParams();
+
+	if (m_depthPrepass) {
+		if (filter & RENDER_FILTER_TERRAIN)
+			m_prepassTerrainsFragment->Render(renderer, rt);
+		if (filter & RENDER_FILTER_OBJECTS) {
+			m_prepassObjectsFragment->Render(renderer, rt);
+			m_prepassAnimatedObjectsFragment->Render(renderer, rt);
 		}
 	}
 
 	if (filter & RENDER_FILTER_TERRAIN) {
 		// create the per-frame UBO data
-		m_perFrameTerrainsMaterial->SetVariable<WMatrix>("viewMatrix", cam->GetViewMatrix());
-		m_perFrameTerrainsMaterial->SetVariable<WMatrix>("projectionMatrix", cam->GetProjectionMatrix());
-		m_perFrameTerrainsMaterial->SetVariable<WVector3>("camDirW", cam->GetLVector());
-		m_perFrameTerrainsMaterial->SetVariable<int>("numLights", numLights);
-		m_perFrameTerrainsMaterial->SetVariableData("lights", m_lights.data(), sizeof(LightStruct) * numLights);
+		m_perFrameTerrainsMaterial->SetVariableData("clusterGrid", clusterParams.clusterGrid, sizeof(clusterParams.clusterGrid));
+		m_perFrameTerrainsMaterial->SetVariable<WVector4>("clusterDepth", clusterParams.clusterDepth);
 
 		m_terrainsFragment->Render(renderer, rt);
 	}
 
 	if (filter & RENDER_FILTER_OBJECTS) {
 		// create the per-frame UBO data
-		m_perFrameObjectsMaterial->SetVariable<WMatrix>("viewMatrix", cam->GetViewMatrix());
-		m_perFrameObjectsMaterial->SetVariable<WMatrix>("projectionMatrix", cam->GetProjectionMatrix());
-		m_perFrameObjectsMaterial->SetVariable<WVector3>("camDirW", cam->GetLVector());
-		m_perFrameObjectsMaterial->SetVariable<int>("numLights", numLights);
-		m_perFrameObjectsMaterial->SetVariableData("lights", m_lights.data(), sizeof(LightStruct) * numLights);
-
-		m_perFrameAnimatedObjectsMaterial->SetVariable<WMatrix>("viewMatrix", cam->GetViewMatrix());
-		m_perFrameAnimatedObjectsMaterial->SetVariable<WMatrix>("projectionMatrix", cam->GetProjectionMatrix());
-		m_perFrameAnimatedObjectsMaterial->SetVariable<WVector3>("camDirW", cam->GetLVector());
-		m_perFrameAnimatedObjectsMaterial->SetVariable<int>("numLights", numLights);
-		m_perFrameAnimatedObjectsMaterial->SetVariableData("lights", m_lights.data(), sizeof(LightStruct) * numLights);
+		m_perFrameObjectsMaterial->SetVariableData("clusterGrid", clusterParams.clusterGrid, sizeof(clusterParams.clusterGrid));
+		m_perFrameObjectsMaterial->SetVariable<WVector4>("clusterDepth", clusterParams.clusterDepth);
+
+		m_perFrameAnimatedObjectsMaterial->SetVariableData("clusterGrid", clusterParams.clusterGrid, sizeof(clusterParams.clusterGrid));
+		m_perFrameAnimatedObjectsMaterial->SetVariable<WVector4>("clusterDepth", clusterParams.clusterDepth);
 
 		m_objectsFragment->Render(renderer, rt);
 
@@ -4,12 +4,41 @@
 #include "Wasabi/Renderers/Common/WSpritesRenderStage.hpp"
 #include "Wasabi/Renderers/Common/WParticlesRenderStage.hpp"
 #include "Wasabi/Renderers/Common/WTextRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WShadowRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WUpscaleRenderStage.hpp"
+#include "Wasabi/Renderers/Common/WSkinningRenderStage.hpp"
 
 WError WInitializeForwardRenderer(Wasabi* app) {
-	return app->Renderer->SetRenderingStages({
+	// animated objects are skinned once per frame for both the shadow and the forward passes
+	bool computeSkinning = app->GetEngineParam<bool>("computeSkinning", false);
+
+	if (app->GetEngineParam<bool>("dynamicResolution", false)) {
+		// the scene is rendered offscreen at the dynamic resolution scale and upscaled to the back buffer
+		std::vector<WRenderStage*> stages = {
+			new WShadowRenderStage(app),
+			new WForwardRenderStage(app, false),
+		};
+		if (computeSkinning)
+			stages.push_back(new WSkinningRenderStage(app));
+		stages.insert(stages.end(), {
+			new WUpscaleRenderStage(app),
+			new WParticlesRenderStage(app),
+			new WSpritesRenderStage(app),
+			new WTextsRenderStage(app),
+		});
+		return app->Renderer->SetRenderingStages(stages);
+	}
+
+	std::vector<WRenderStage*> stages = {
+		new WShadowRenderStage(app),
 		new WForwardRenderStage(app),
+	};
+	if (computeSkinning)
+		stages.push_back(new WSkinningRenderStage(app));
+	stages.insert(stages.end(), {
 		new WParticlesRenderStage(app),
 		new WSpritesRenderStage(app),
 		new WTextsRenderStage(app),
 	});
+	return app->Renderer->SetRenderingStages(stages);
 }
@@ -0,0 +1,280 @@
+#include "Wasabi/Renderers/WRenderGraph.hpp"
+#include "Wasabi/Renderers/WRenderStage.hpp"
+#include "Wasabi/Images/WImage.hpp"
+#include "Wasabi/Images/WRenderTarget.hpp"
+
+/**
+ * Finds the pipeline stages and memory accesses that use an image in a given
+ * layout (only the writes if the use is the source of a barrier).
+ */
+static VkPipelineStageFlags GetLayoutUsage(VkImageLayout layout, bool isSource, VkAccessFlags* access) {
+	switch (layout) {
+	case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+		*access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | (isSource ? 0 : VK_ACCESS_COLOR_ATTACHMENT_READ_BIT);
+		return VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+		*access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | (isSource ? 0 : VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT);
+		return VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+		// a read-only depth attachment that the pass also samples
+		*access = isSource ? 0 : (VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+		return VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+		// sampled inputs can also be read by the compute work of a pass (see WRenderStage::RecordPassCompute())
+		*access = isSource ? 0 : VK_ACCESS_SHADER_READ_BIT;
+		return VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+		*access = VK_ACCESS_TRANSFER_WRITE_BIT;
+		return VK_PIPELINE_STAGE_TRANSFER_BIT;
+	default:
+		*access = 0;
+		return VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	}
+}
+
+WRenderGraph::WRenderGraph(Wasabi* const app) : m_app(app) {
+}
+
+WRenderGraph::~WRenderGraph() {
+	Cleanup();
+}
+
+void WRenderGraph::Cleanup() {
+	for (auto it = m_images.begin(); it != m_images.end(); it++)
+		W_SAFE_REMOVEREF(it->image);
+	m_images.clear();
+	m_resources.clear();
+	m_passes.clear();
+	m_stagePasses.clear();
+}
+
+WError WRenderGraph::Build(const std::vector<WRenderStage*>& stages, uint32_t width, uint32_t height) {
+	Cleanup();
+
+	// split the stages into passes and collect the resources each pass renders to and samples
+	for (uint32_t i = 0; i < stages.size(); i++) {
+		const WRenderStage::STAGE_DESCRIPTION& desc = stages[i]->m_stageDescription;
+		if (desc.target != RENDER_STAGE_TARGET_PREVIOUS || m_passes.size() == 0) {
+			PASS pass = {};
+			pass.firstStage = i;
+			pass.backBuffer = desc.target == RENDER_STAGE_TARGET_BACK_BUFFER;
+			pass.live = pass.backBuffer;
+			m_passes.push_back(pass);
+		}
+		uint32_t passIndex = (uint32_t)m_passes.size() - 1;
+		PASS& pass = m_passes[passIndex];
+		m_stagePasses.push_back(passIndex);
+
+		if (desc.target == RENDER_STAGE_TARGET_BUFFER) {
+			std::vector<const WRenderStage::OUTPUT_IMAGE*> outputs;
+			for (uint32_t o = 0; o < desc.colorOutputs.size(); o++)
+				outputs.push_back(&desc.colorOutputs[o]);
+			if (desc.depthOutput.name != "")
+				outputs.push_back(&desc.depthOutput);
+
+			for (auto output : outputs) {
+				uint32_t resourceIndex = _FindResource(output->name);
+				if (!output->isFromPreviousStage) {
+					if (resourceIndex != UINT_MAX)
+						return WError(W_INVALIDPARAM); // output names must be unique
+
+					RESOURCE resource;
+					resource.name = output->name;
+					resource.producer = stages[i];
+					resource.format = output->format;
+					resource.imageFlags = output->imageFlags;
+					resource.isDepth = output == &desc.depthOutput;
+					resource.transient = output->transient;
+					resource.firstPass = resource.lastPass = passIndex;
+					resource.image = UINT_MAX;
+					resource.sampled = false;
+					resourceIndex = (uint32_t)m_resources.size();
+					m_resources.push_back(resource);
+
+					// non-transient images may be used outside of the frame, their pass is always rendered
+					if (!output->transient)
+						pass.live = true;
+				} else if (resourceIndex == UINT_MAX)
+					return WError(W_NOTVALID);
+				pass.writes.push_back(resourceIndex);
+			}
+		}
+
+		for (auto input : desc.inputs) {
+			// inputs that no previous stage renders are optional (e.g. shadows when there is no shadow stage),
+			// and a pass cannot sample its own attachments
+			uint32_t resourceIndex = _FindResource(input);
+			if (resourceIndex == UINT_MAX || m_resources[resourceIndex].firstPass == passIndex)
+				continue;
+			if (std::find(pass.reads.begin(), pass.reads.end(), resourceIndex) == pass.reads.end())
+				pass.reads.push_back(resourceIndex);
+		}
+	}
+
+	// a live pass keeps the passes that rendered the images it uses alive, those always come before it
+	for (int p = (int)m_passes.size() - 1; p >= 0; p--) {
+		if (!m_passes[p].live)
+			continue;
+		for (auto resourceIndex : m_passes[p].reads)
+			m_passes[m_resources[resourceIndex].firstPass].live = true;
+		for (auto resourceIndex : m_passes[p].writes)
+			m_passes[m_resources[resourceIndex].firstPass].live = true;
+	}
+
+	// lifetimes of the resources in the live passes
+	for (uint32_t p = 0; p < m_passes.size(); p++) {
+		if (!m_passes[p].live)
+			continue;
+		for (auto resourceIndex : m_passes[p].reads) {
+			m_resources[resourceIndex].lastPass = std::max(m_resources[resourceIndex].lastPass, p);
+			m_resources[resourceIndex].sampled = true;
+		}
+		for (auto resourceIndex : m_passes[p].writes)
+			m_resources[resourceIndex].lastPass = std::max(m_resources[resourceIndex].lastPass, p);
+	}
+
+	// assign the transient resources to images, a resource can reuse an image of the same format that is no
+	// longer used when the resource is first rendered. Resources of culled passes are never rendered and can
+	// share any image
+	for (auto& resource : m_resources) {
+		if (!resource.transient)
+			continue;
+		bool live = m_passes[resource.firstPass].live;
+		for (uint32_t i = 0; i < m_images.size() && resource.image == UINT_MAX; i++) {
+			if (m_images[i].format == resource.format && m_images[i].imageFlags == resource.imageFlags && (!live || m_images[i].lastPass < resource.firstPass))
+				resource.image = i;
+		}
+		if (resource.image == UINT_MAX) {
+			TRANSIENT_IMAGE image = {};
+			image.format = resource.format;
+			image.imageFlags = resource.imageFlags;
+			image.lastPass = 0;
+			resource.image = (uint32_t)m_images.size();
+			m_images.push_back(image);
+		}
+		if (live)
+			m_images[resource.image].lastPass = std::max(m_images[resource.image].lastPass, resource.lastPass);
+	}
+
+	for (uint32_t i = 0; i < m_images.size(); i++) {
+		m_images[i].image = m_app->ImageManager->CreateImage(nullptr, width, height, m_images[i].format, m_images[i].imageFlags);
+		if (!m_images[i].image) {
+			Cleanup();
+			return WError(W_OUTOFMEMORY);
+		}
+		m_images[i].image->SetName("RenderGraphImage-" + std::to_string(i));
+	}
+
+	return WError(W_SUCCEEDED);
+}
+
+WError WRenderGraph::Resize(uint32_t width, uint32_t height) {
+	for (auto it = m_images.begin(); it != m_images.end(); it++) {
+		WError status = it->image->CreateFromPixelsArray(nullptr, width, height, it->format, it->imageFlags);
+		if (!status)
+			return status;
+	}
+	return WError(W_SUCCEEDED);
+}
+
+bool WRenderGraph::IsStageCulled(uint32_t stageIndex) const {
+	if (stageIndex >= m_stagePasses.size())
+		return false;
+	return !m_passes[m_stagePasses[stageIndex]].live;
+}
+
+void WRenderGraph::RecordPassBarriers(VkCommandBuffer cmdBuf, uint32_t stageIndex) {
+	if (stageIndex >= m_stagePasses.size())
+		return;
+	uint32_t passIndex = m_stagePasses[stageIndex];
+	const PASS& pass = m_passes[passIndex];
+
+	std::vector<VkImageMemoryBarrier> barriers;
+	VkPipelineStageFlags srcStages = 0;
+	VkPipelineStageFlags dstStages = 0;
+	auto addBarrier = [&barriers, &srcStages, &dstStages](WImage* img, VkImageLayout newLayout, bool discard) {
+		VkImageLayout oldLayout = img->GetViewLayout();
+		if (oldLayout == newLayout)
+			return;
+		VkImageMemoryBarrier barrier = img->GetLayoutTransitionBarrier(newLayout, discard);
+		srcStages |= GetLayoutUsage(oldLayout, true, &barrier.srcAccessMask);
+		dstStages |= GetLayoutUsage(newLayout, false, &barrier.dstAccessMask);
+		barriers.push_back(barrier);
+	};
+
+	auto isRead = [&pass](uint32_t resourceIndex) {
+		return std::find(pass.reads.begin(), pass.reads.end(), resourceIndex) != pass.reads.end();
+	};
+	auto isWritten = [&pass](uint32_t resourceIndex) {
+		return std::find(pass.writes.begin(), pass.writes.end(), resourceIndex) != pass.writes.end();
+	};
+
+	for (auto resourceIndex : pass.reads) {
+		WImage* img = _GetResourceImage(m_resources[resourceIndex]);
+		if (img && !isWritten(resourceIndex))
+			addBarrier(img, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false);
+	}
+	for (auto resourceIndex : pass.writes) {
+		const RESOURCE& resource = m_resources[resourceIndex];
+		WImage* img = _GetResourceImage(resource);
+		// the contents of transient images don't need to be kept before they are first rendered
+		bool discard = resource.transient && resource.firstPass == passIndex;
+		// a depth attachment that the pass also samples is read-only (see WRenderStage::STAGE_DESCRIPTION::inputs)
+		VkImageLayout layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		if (resource.isDepth)
+			layout = isRead(resourceIndex) ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		if (img)
+			addBarrier(img, layout, discard);
+	}
+
+	if (barriers.size() > 0)
+		vkCmdPipelineBarrier(cmdBuf, srcStages, dstStages, 0, 0, nullptr, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
+}
+
+void WRenderGraph::RecordFinalBarriers(VkCommandBuffer cmdBuf) {
+	std::vector<VkImageMemoryBarrier> barriers;
+	VkPipelineStageFlags srcStages = 0;
+	for (auto& resource : m_resources) {
+		// transient images that no pass samples may have been reused by other resources since, and transient
+		// attachments cannot be sampled at all
+		if (!m_passes[resource.firstPass].live || resource.sampled || (resource.transient && m_images[resource.image].lastPass != resource.lastPass))
+			continue;
+		if (resource.imageFlags & W_IMAGE_CREATE_TRANSIENT_ATTACHMENT)
+			continue;
+		WImage* img = _GetResourceImage(resource);
+		VkImageLayout oldLayout = img ? img->GetViewLayout() : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		if (oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+			continue;
+		VkImageMemoryBarrier barrier = img->GetLayoutTransitionBarrier(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		srcStages |= GetLayoutUsage(oldLayout, true, &barrier.srcAccessMask);
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barriers.push_back(barrier);
+	}
+
+	if (barriers.size() > 0)
+		vkCmdPipelineBarrier(cmdBuf, srcStages, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
+}
+
+WImage* WRenderGraph::GetTransientImage(const WRenderStage* stage, std::string name) const {
+	uint32_t resourceIndex = _FindResource(name);
+	if (resourceIndex == UINT_MAX || m_resources[resourceIndex].producer != stage || !m_resources[resourceIndex].transient)
+		return nullptr;
+	return m_images[m_resources[resourceIndex].image].image;
+}
+
+uint32_t WRenderGraph::GetNumTransientImages() const {
+	return (uint32_t)m_images.size();
+}
+
+uint32_t WRenderGraph::_FindResource(std::string name) const {
+	for (uint32_t i = 0; i < m_resources.size(); i++)
+		if (m_resources[i].name == name)
+			return i;
+	return UINT_MAX;
+}
+
+WImage* WRenderGraph::_GetResourceImage(const RESOURCE& resource) const {
+	if (resource.transient)
+		return m_images[resource.image].image;
+	return resource.producer->GetOutputImage(resource.name);
+}
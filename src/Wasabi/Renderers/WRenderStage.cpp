@@ -1,5 +1,6 @@
 #include "Wasabi/Renderers/WRenderStage.hpp"
 #include "Wasabi/Renderers/WRenderer.hpp"
+#include "Wasabi/Renderers/WRenderGraph.hpp"
 #include "Wasabi/Images/WImage.hpp"
 #include "Wasabi/Images/WRenderTarget.hpp"
 
@@ -7,12 +8,16 @@ WRenderStage::OUTPUT_IMAGE::OUTPUT_IMAGE() {
 	name = "";
 	isFromPreviousStage = true;
 	clearColor = WColor(-1000000.0f, -1.0f, -1.0f, -1.0f);
+	transient = false;
+	imageFlags = W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT;
 }
 
 WRenderStage::OUTPUT_IMAGE::OUTPUT_IMAGE(std::string n, WColor clear) {
 	name = n;
 	isFromPreviousStage = true;
 	clearColor = clear;
+	transient = false;
+	imageFlags = W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT;
 }
 
 WRenderStage::OUTPUT_IMAGE::OUTPUT_IMAGE(std::string n, VkFormat f, WColor clear) {
@@ -20,6 +25,8 @@ WRenderStage::OUTPUT_IMAGE::OUTPUT_IMAGE(std::string n, VkFormat f, WColor clear
 	isFromPreviousStage = false;
 	format = f;
 	clearColor = clear;
+	transient = false;
+	imageFlags = W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT;
 }
 
 WRenderStage::WRenderStage(class Wasabi* const app) : m_stageDescription({}) {
@@ -53,6 +60,10 @@ WError WRenderStage::Initialize(std::vector<WRenderStage*>& previousStages, uint
 
 		m_renderTarget = m_app->RenderTargetManager->CreateRenderTarget();
 		m_renderTarget->SetName("RenderTarget-" + m_stageDescription.name);
+		m_renderTarget->SetSubpasses(m_stageDescription.subpasses);
+		const std::vector<std::string>& inputs = m_stageDescription.inputs;
+		m_renderTarget->SetReadOnlyDepth(m_stageDescription.depthOutput.isFromPreviousStage &&
+			std::find(inputs.begin(), inputs.end(), m_stageDescription.depthOutput.name) != inputs.end());
 
 		for (uint32_t i = 0; i < m_stageDescription.colorOutputs.size(); i++) {
 			if (m_stageDescription.colorOutputs[i].name == "")
@@ -93,6 +104,18 @@ WError WRenderStage::Initialize(std::vector<WRenderStage*>& previousStages, uint
 	return Resize(width, height);
 }
 
+WError WRenderStage::RecordCompute(WRenderer* renderer, VkCommandBuffer cmdBuf) {
+	UNREFERENCED_PARAMETER(renderer);
+	UNREFERENCED_PARAMETER(cmdBuf);
+	return WError(W_SUCCEEDED);
+}
+
+WError WRenderStage::RecordPassCompute(WRenderer* renderer, VkCommandBuffer cmdBuf) {
+	UNREFERENCED_PARAMETER(renderer);
+	UNREFERENCED_PARAMETER(cmdBuf);
+	return WError(W_SUCCEEDED);
+}
+
 void WRenderStage::Cleanup() {
 	if (m_stageDescription.target != RENDER_STAGE_TARGET_PREVIOUS)
 		W_SAFE_REMOVEREF(m_renderTarget);
@@ -104,17 +127,27 @@ void WRenderStage::Cleanup() {
 
 WError WRenderStage::Resize(uint32_t width, uint32_t height) {
 	if (m_stageDescription.target == RENDER_STAGE_TARGET_BUFFER) {
+		// transient outputs are allocated (and resized) by the render graph, possibly sharing an image with other
+		// outputs whose lifetimes don't overlap
+		WRenderGraph* graph = m_app->Renderer->GetRenderGraph();
 		OUTPUT_IMAGE desc;
 		for (uint32_t i = 0; i < m_stageDescription.colorOutputs.size(); i++) {
 			desc = m_stageDescription.colorOutputs[i];
 			if (!desc.isFromPreviousStage) {
 				WImage* output = m_colorOutputs[i];
-				if (output) {
-					WError status = output->CreateFromPixelsArray(nullptr, width, height, desc.format, W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT);
+				WImage* graphImage = desc.transient ? graph->GetTransientImage(this, desc.name) : nullptr;
+				if (graphImage) {
+					if (output != graphImage) {
+						W_SAFE_REMOVEREF(m_colorOutputs[i]);
+						graphImage->AddReference();
+						m_colorOutputs[i] = graphImage;
+					}
+				} else if (output) {
+					WError status = output->CreateFromPixelsArray(nullptr, width, height, desc.format, desc.imageFlags);
 					if (!status)
 						return status;
 				} else {
-					m_colorOutputs[i] = m_app->ImageManager->CreateImage(nullptr, width, height, desc.format, W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT);
+					m_colorOutputs[i] = m_app->ImageManager->CreateImage(nullptr, width, height, desc.format, desc.imageFlags);
 					if (!m_colorOutputs[i])
 						return WError(W_OUTOFMEMORY);
 				}
@@ -122,12 +155,19 @@ WError WRenderStage::Resize(uint32_t width, uint32_t height) {
 		}
 		desc = m_stageDescription.depthOutput;
 		if (desc.name != "" && !desc.isFromPreviousStage) {
-			if (m_depthOutput) {
-				WError status = m_depthOutput->CreateFromPixelsArray(nullptr, width, height, desc.format, W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT);
+			WImage* graphImage = desc.transient ? graph->GetTransientImage(this, desc.name) : nullptr;
+			if (graphImage) {
+				if (m_depthOutput != graphImage) {
+					W_SAFE_REMOVEREF(m_depthOutput);
+					graphImage->AddReference();
+					m_depthOutput = graphImage;
+				}
+			} else if (m_depthOutput) {
+				WError status = m_depthOutput->CreateFromPixelsArray(nullptr, width, height, desc.format, desc.imageFlags);
 				if (!status)
 					return status;
 			} else {
-				m_depthOutput = m_app->ImageManager->CreateImage(nullptr, width, height, desc.format, W_IMAGE_CREATE_TEXTURE | W_IMAGE_CREATE_RENDER_TARGET_ATTACHMENT);
+				m_depthOutput = m_app->ImageManager->CreateImage(nullptr, width, height, desc.format, desc.imageFlags);
 				if (!m_depthOutput)
 					return WError(W_OUTOFMEMORY);
 			}
@@ -1,24 +1,350 @@
 #include "Wasabi/Renderers/WRenderer.hpp"
 #include "Wasabi/Renderers/WRenderStage.hpp"
+#include "Wasabi/Renderers/WRenderGraph.hpp"
 #include "Wasabi/Images/WRenderTarget.hpp"
 #include "Wasabi/Images/WImage.hpp"
 #include "Wasabi/Geometries/WGeometry.hpp"
 #include "Wasabi/WindowAndInput/WWindowAndInputComponent.hpp"
+#include "Wasabi/Materials/WEffect.hpp"
+#include "Wasabi/Cameras/WCamera.hpp"
+#include "Wasabi/Lights/WLight.hpp"
+#include "Wasabi/Objects/WObject.hpp"
+#include "Wasabi/Particles/WParticles.hpp"
 
 WRenderer::WRenderer(Wasabi* const app) : m_app(app) {
 	m_queue = VK_NULL_HANDLE;
+	m_swapChain = nullptr;
+	m_presentMode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+	m_computeQueue = VK_NULL_HANDLE;
+	m_computeCommandPool = VK_NULL_HANDLE;
+	m_computeTransferStages = 0;
 	m_sampler = VK_NULL_HANDLE;
+	m_globalFrameSetLayout = VK_NULL_HANDLE;
+	m_emptySetLayout = VK_NULL_HANDLE;
+	m_globalFrameDescriptorPool = VK_NULL_HANDLE;
+	m_globalFrameData = std::vector<W_GLOBAL_FRAME_DATA>(1, W_GLOBAL_FRAME_DATA());
+	m_globalFrameSlotSize = 0;
+	m_maxGlobalFrameSlots = 0;
+	m_maxSceneObjects = 0;
+	m_frameIndex = 0;
+	m_lastFrameTime = 0.0f;
+	m_timestampQueryPool = VK_NULL_HANDLE;
+	m_timestampPeriod = 0.0f;
+	m_gpuFrameTime = 0.0f;
+	m_resolutionScale = 1.0f;
+	m_scaledWidth = m_scaledHeight = 0;
+	m_renderGraph = new WRenderGraph(app);
 }
 
 void WRenderer::Cleanup() {
 	m_app->MemoryManager->ReleaseSampler(m_sampler, m_app->GetCurrentBufferingIndex());
 	if (m_queue)
 		vkQueueWaitIdle(m_queue);
+	if (m_computeQueue)
+		vkQueueWaitIdle(m_computeQueue);
 	m_perBufferResources.Destroy(m_app);
+	if (m_computeCommandPool)
+		vkDestroyCommandPool(m_device, m_computeCommandPool, nullptr);
+	m_computeCommandPool = VK_NULL_HANDLE;
+	_DestroyTimestampQueries();
 	SetRenderingStages(std::vector<WRenderStage*>({}));
+	W_SAFE_DELETE(m_renderGraph);
+	_DestroyGlobalFrameResources();
 }
 
-VkResult WRenderer::PerBufferResources::Create(Wasabi* app, uint32_t numBuffers) {
+WError WRenderer::_CreateGlobalFrameResources() {
+	_DestroyGlobalFrameResources();
+
+	uint32_t numBuffers = m_app->GetEngineParam<uint32_t>("bufferingCount");
+
+	// one slot for the main camera and one for every render target, each bound with its own dynamic offset
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(m_app->GetVulkanPhysicalDevice(), &deviceProperties);
+	uint32_t alignment = (uint32_t)std::max(deviceProperties.limits.minUniformBufferOffsetAlignment, (VkDeviceSize)1);
+	m_globalFrameSlotSize = ((uint32_t)sizeof(W_GLOBAL_FRAME_DATA) + alignment - 1) / alignment * alignment;
+	m_maxGlobalFrameSlots = m_app->GetEngineParam<uint32_t>("maxRenderTargets", 128) + 1;
+	VkResult err = m_globalFrameBuffer.Create(m_app, numBuffers, (size_t)m_globalFrameSlotSize * m_maxGlobalFrameSlots, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, nullptr, W_MEMORY_HOST_VISIBLE);
+	if (err != VK_SUCCESS)
+		return WError(W_OUTOFMEMORY);
+
+	m_maxSceneObjects = std::max(m_app->GetEngineParam<uint32_t>("maxSceneObjects", 16384), (uint32_t)1);
+	err = m_sceneObjectsBuffer.Create(m_app, numBuffers, sizeof(W_SCENE_OBJECT_DATA) * m_maxSceneObjects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nullptr, W_MEMORY_HOST_VISIBLE);
+	if (err != VK_SUCCESS)
+		return WError(W_OUTOFMEMORY);
+
+	// the new buffers have no data, so all the allocated scene objects need to be written to them
+	m_dirtySceneObjects.clear();
+	for (uint32_t i = 0; i < m_sceneObjects.size(); i++) {
+		m_sceneObjectsPendingWrites[i] = (uint8_t)numBuffers;
+		m_dirtySceneObjects.push_back(i);
+	}
+
+	VkDescriptorSetLayoutBinding layoutBindings[2] = {};
+	layoutBindings[0].binding = 0;
+	layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	layoutBindings[0].descriptorCount = 1;
+	layoutBindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+	layoutBindings[1].binding = W_SCENE_OBJECTS_BINDING_INDEX;
+	layoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	layoutBindings[1].descriptorCount = 1;
+	layoutBindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo = {};
+	descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	descriptorSetLayoutInfo.bindingCount = 2;
+	descriptorSetLayoutInfo.pBindings = layoutBindings;
+	err = vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutInfo, nullptr, &m_globalFrameSetLayout);
+	if (err != VK_SUCCESS)
+		return WError(W_FAILEDTOCREATEDESCRIPTORSETLAYOUT);
+
+	descriptorSetLayoutInfo.bindingCount = 0;
+	descriptorSetLayoutInfo.pBindings = nullptr;
+	err = vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutInfo, nullptr, &m_emptySetLayout);
+	if (err != VK_SUCCESS)
+		return WError(W_FAILEDTOCREATEDESCRIPTORSETLAYOUT);
+
+	VkDescriptorPoolSize poolSizes[2] = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[0].descriptorCount = numBuffers;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = numBuffers;
+
+	VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+	descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolInfo.poolSizeCount = 2;
+	descriptorPoolInfo.pPoolSizes = poolSizes;
+	descriptorPoolInfo.maxSets = numBuffers;
+	descriptorPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	err = vkCreateDescriptorPool(m_device, &descriptorPoolInfo, nullptr, &m_globalFrameDescriptorPool);
+	if (err != VK_SUCCESS)
+		return WError(W_OUTOFMEMORY);
+
+	m_globalFrameSets.resize(numBuffers);
+	std::vector<VkDescriptorSetLayout> layouts(numBuffers, m_globalFrameSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_globalFrameDescriptorPool;
+	allocInfo.descriptorSetCount = numBuffers;
+	allocInfo.pSetLayouts = layouts.data();
+	err = vkAllocateDescriptorSets(m_device, &allocInfo, m_globalFrameSets.data());
+	if (err != VK_SUCCESS) {
+		m_globalFrameSets.clear();
+		return WError(W_OUTOFMEMORY);
+	}
+
+	// the buffers never change, so the descriptor sets are written only once
+	std::vector<VkDescriptorBufferInfo> bufferInfos(numBuffers * 2);
+	std::vector<VkWriteDescriptorSet> writes(numBuffers * 2);
+	for (uint32_t i = 0; i < numBuffers; i++) {
+		bufferInfos[i * 2 + 0].buffer = m_globalFrameBuffer.GetBuffer(m_app, i);
+		bufferInfos[i * 2 + 0].offset = 0;
+		bufferInfos[i * 2 + 0].range = sizeof(W_GLOBAL_FRAME_DATA);
+		bufferInfos[i * 2 + 1].buffer = m_sceneObjectsBuffer.GetBuffer(m_app, i);
+		bufferInfos[i * 2 + 1].offset = 0;
+		bufferInfos[i * 2 + 1].range = VK_WHOLE_SIZE;
+
+		for (uint32_t j = 0; j < 2; j++) {
+			writes[i * 2 + j] = {};
+			writes[i * 2 + j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i * 2 + j].dstSet = m_globalFrameSets[i];
+			writes[i * 2 + j].dstBinding = layoutBindings[j].binding;
+			writes[i * 2 + j].descriptorCount = 1;
+			writes[i * 2 + j].descriptorType = layoutBindings[j].descriptorType;
+			writes[i * 2 + j].pBufferInfo = &bufferInfos[i * 2 + j];
+		}
+	}
+	vkUpdateDescriptorSets(m_device, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+
+	return WError(W_SUCCEEDED);
+}
+
+void WRenderer::_DestroyGlobalFrameResources() {
+	uint32_t bufferIndex = m_app->GetCurrentBufferingIndex();
+	for (auto it = m_globalFrameSets.begin(); it != m_globalFrameSets.end(); it++)
+		m_app->MemoryManager->ReleaseDescriptorSet(*it, m_globalFrameDescriptorPool, bufferIndex);
+	m_globalFrameSets.clear();
+	m_app->MemoryManager->ReleaseDescriptorPool(m_globalFrameDescriptorPool, bufferIndex);
+	m_app->MemoryManager->ReleaseDescriptorSetLayout(m_globalFrameSetLayout, bufferIndex);
+	m_app->MemoryManager->ReleaseDescriptorSetLayout(m_emptySetLayout, bufferIndex);
+	m_globalFrameBuffer.Destroy(m_app);
+	m_sceneObjectsBuffer.Destroy(m_app);
+}
+
+void WRenderer::_UpdateGlobalFrameData() {
+	WCamera* cam = nullptr;
+	WRenderTarget* pickingRT = GetRenderTarget(m_pickingRenderStageName);
+	if (pickingRT)
+		cam = pickingRT->GetCamera();
+	if (!cam)
+		cam = m_app->CameraManager->GetDefaultCamera();
+
+	float curTime = m_app->Timer.GetElapsedTime();
+
+	W_GLOBAL_FRAME_DATA& frameData = m_globalFrameData[0];
+	frameData.time = WVector4(curTime, curTime - m_lastFrameTime, (float)m_frameIndex, 0.0f);
+	frameData.resolution = WVector4((float)m_width, (float)m_height, 1.0f / (float)m_width, 1.0f / (float)m_height);
+	frameData.resolutionScale = WVector4((float)m_scaledWidth / (float)m_width, (float)m_scaledHeight / (float)m_height, (float)m_scaledWidth, (float)m_scaledHeight);
+	frameData.numLights = 0;
+	for (uint32_t i = 0; ; i++) {
+		WLight* light = m_app->LightManager->GetEntityByIndex(i);
+		if (!light)
+			break;
+		if (!light->Hidden())
+			frameData.numLights++;
+	}
+
+	m_lastFrameTime = curTime;
+	m_frameIndex++;
+
+	_WriteGlobalFrameSlot(0, cam);
+}
+
+uint32_t WRenderer::_AllocateGlobalFrameSlot() {
+	uint32_t slot;
+	if (m_freeGlobalFrameSlots.size() > 0) {
+		slot = m_freeGlobalFrameSlots.back();
+		m_freeGlobalFrameSlots.pop_back();
+	} else {
+		if (m_globalFrameData.size() >= m_maxGlobalFrameSlots)
+			return 0;
+		slot = (uint32_t)m_globalFrameData.size();
+		m_globalFrameData.push_back(m_globalFrameData[0]);
+	}
+	return slot;
+}
+
+void WRenderer::_FreeGlobalFrameSlot(uint32_t slot) {
+	if (slot > 0 && slot < m_globalFrameData.size())
+		m_freeGlobalFrameSlots.push_back(slot);
+}
+
+void WRenderer::_WriteGlobalFrameSlot(uint32_t slot, WCamera* cam) {
+	if (slot >= m_globalFrameData.size() || slot >= m_maxGlobalFrameSlots)
+		return;
+
+	W_GLOBAL_FRAME_DATA& frameData = m_globalFrameData[slot];
+	if (slot != 0)
+		frameData = m_globalFrameData[0];
+	if (cam)
+		_SetGlobalFrameCamera(frameData, cam);
+
+	char* pBufferData;
+	if (m_globalFrameBuffer.Map(m_app, m_perBufferResources.curIndex, (void**)&pBufferData, W_MAP_WRITE) == VK_SUCCESS) {
+		memcpy(pBufferData + (size_t)slot * m_globalFrameSlotSize, &frameData, sizeof(W_GLOBAL_FRAME_DATA));
+		m_globalFrameBuffer.Unmap(m_app, m_perBufferResources.curIndex);
+	}
+}
+
+void WRenderer::_SetGlobalFrameCamera(W_GLOBAL_FRAME_DATA& frameData, WCamera* cam) {
+	frameData.viewMatrix = cam->GetViewMatrix();
+	frameData.projectionMatrix = cam->GetProjectionMatrix();
+	frameData.viewProjectionMatrix = frameData.viewMatrix * frameData.projectionMatrix;
+	frameData.projectionInverseMatrix = WMatrixInverse(frameData.projectionMatrix);
+	WVector3 camPos = cam->GetPosition();
+	WVector3 camDir = cam->GetLVector();
+	frameData.camPosW = WVector4(camPos.x, camPos.y, camPos.z, cam->GetMinRange());
+	frameData.camDirW = WVector4(camDir.x, camDir.y, camDir.z, cam->GetMaxRange());
+}
+
+void WRenderer::_CreateTimestampQueries() {
+	_DestroyTimestampQueries();
+
+	if (!m_app->GetEngineParam<bool>("dynamicResolution", false))
+		return;
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(m_app->GetVulkanPhysicalDevice(), &deviceProperties);
+	if (!deviceProperties.limits.timestampComputeAndGraphics)
+		return; // the scale will stay at 1
+
+	uint32_t numBuffers = (uint32_t)m_perBufferResources.primaryCommandBuffers.size();
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = numBuffers * 2;
+	if (vkCreateQueryPool(m_device, &queryPoolInfo, nullptr, &m_timestampQueryPool) != VK_SUCCESS) {
+		m_timestampQueryPool = VK_NULL_HANDLE;
+		return;
+	}
+
+	m_timestampPeriod = deviceProperties.limits.timestampPeriod;
+	m_timestampScales = std::vector<float>(numBuffers, 0.0f);
+}
+
+void WRenderer::_DestroyTimestampQueries() {
+	// only called after the device is idle, so the queries are not in use
+	if (m_timestampQueryPool)
+		vkDestroyQueryPool(m_device, m_timestampQueryPool, nullptr);
+	m_timestampQueryPool = VK_NULL_HANDLE;
+	m_timestampScales.clear();
+	m_gpuFrameTime = 0.0f;
+	m_resolutionScale = 1.0f;
+}
+
+void WRenderer::_UpdateResolutionScale() {
+	uint32_t curIndex = m_perBufferResources.curIndex;
+	if (m_timestampQueryPool && m_timestampScales[curIndex] > 0.0f) {
+		// the fence of this buffering index is signalled, so the queries of the frame that last used it are available
+		uint64_t timestamps[2];
+		VkResult err = vkGetQueryPoolResults(m_device, m_timestampQueryPool, curIndex * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (err == VK_SUCCESS && timestamps[1] > timestamps[0]) {
+			m_gpuFrameTime = (float)((double)(timestamps[1] - timestamps[0]) * (double)m_timestampPeriod / 1000000.0);
+
+			// the GPU cost of the scaled stages grows with their number of pixels (the square of the scale). Aim
+			// slightly under the target and only move part of the way there every frame so the scale doesn't oscillate
+			float targetTime = (float)std::max(m_app->GetEngineParam<int>("targetGPUFrameTime", 16), 1);
+			float minScale = std::min(std::max((float)m_app->GetEngineParam<int>("minResolutionScale", 50) / 100.0f, 0.1f), 1.0f);
+			float measuredScale = m_timestampScales[curIndex];
+			float idealScale = measuredScale * sqrtf(targetTime * 0.9f / std::max(m_gpuFrameTime, 0.001f));
+			m_resolutionScale += (idealScale - m_resolutionScale) * 0.1f;
+			m_resolutionScale = std::min(std::max(m_resolutionScale, minScale), 1.0f);
+		}
+	}
+
+	m_scaledWidth = std::max((uint32_t)((float)m_width * m_resolutionScale + 0.5f), (uint32_t)1);
+	m_scaledHeight = std::max((uint32_t)((float)m_height * m_resolutionScale + 0.5f), (uint32_t)1);
+}
+
+void WRenderer::_SetStageViewport(bool scaled) {
+	uint32_t width = scaled ? m_scaledWidth : m_width;
+	uint32_t height = scaled ? m_scaledHeight : m_height;
+	VkCommandBuffer cmdBuffer = m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex];
+
+	VkViewport viewport = vkTools::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+	vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor = vkTools::initializers::rect2D(width, height, 0, 0);
+	vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+}
+
+void WRenderer::_UpdateSceneObjects() {
+	if (m_dirtySceneObjects.size() == 0 || !m_sceneObjectsBuffer.Valid())
+		return;
+
+	W_SCENE_OBJECT_DATA* pBufferData;
+	if (m_sceneObjectsBuffer.Map(m_app, m_perBufferResources.curIndex, (void**)&pBufferData, W_MAP_WRITE) != VK_SUCCESS)
+		return;
+
+	// each dirty object is written once to every buffered frame's buffer, then it is removed from the list.
+	// Objects allocated beyond the capacity of the buffer (if "maxSceneObjects" was lowered after they
+	// were allocated) are never written
+	uint32_t numStillDirty = 0;
+	for (uint32_t i = 0; i < m_dirtySceneObjects.size(); i++) {
+		uint32_t index = m_dirtySceneObjects[i];
+		if (index >= m_maxSceneObjects) {
+			m_sceneObjectsPendingWrites[index] = 0;
+			continue;
+		}
+		pBufferData[index] = m_sceneObjects[index];
+		if (--m_sceneObjectsPendingWrites[index] > 0)
+			m_dirtySceneObjects[numStillDirty++] = index;
+	}
+	m_dirtySceneObjects.resize(numStillDirty);
+
+	m_sceneObjectsBuffer.Unmap(m_app, m_perBufferResources.curIndex);
+}
+
+VkResult WRenderer::PerBufferResources::Create(Wasabi* app, uint32_t numBuffers, VkCommandPool computePool) {
 	Destroy(app);
 	VkDevice device = app->GetVulkanDevice();
 	VkResult err = VK_SUCCESS;
@@ -56,6 +382,24 @@ VkResult WRenderer::PerBufferResources::Create(Wasabi* app, uint32_t numBuffers)
 			break;
 		memoryFences.push_back(fence);
 	}
+	if (err || computePool == VK_NULL_HANDLE)
+		return err;
+
+	// the compute queue has its own command buffers (from a pool of its family) and signals the graphics queue
+	computeCommandPool = computePool;
+	cmdBufAllocateInfo.commandPool = computePool;
+	computeCommandBuffers.resize(numBuffers);
+	err = vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, computeCommandBuffers.data());
+	if (err) {
+		computeCommandBuffers.clear();
+		return err;
+	}
+	for (uint32_t i = 0; i < numBuffers; i++) {
+		err = vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &sem);
+		if (err)
+			break;
+		computeComplete.push_back(sem);
+	}
 	return err;
 }
 
@@ -72,6 +416,12 @@ void WRenderer::PerBufferResources::Destroy(Wasabi* app) {
 	for (auto it = memoryFences.begin(); it != memoryFences.end(); it++)
 		app->MemoryManager->ReleaseFence(*it, app->GetCurrentBufferingIndex());
 	memoryFences.clear();
+	if (computeCommandBuffers.size() > 0)
+		vkFreeCommandBuffers(app->GetVulkanDevice(), computeCommandPool, (uint32_t)computeCommandBuffers.size(), computeCommandBuffers.data());
+	computeCommandBuffers.clear();
+	for (auto it = computeComplete.begin(); it != computeComplete.end(); it++)
+		app->MemoryManager->ReleaseSemaphore(*it, app->GetCurrentBufferingIndex());
+	computeComplete.clear();
 }
 
 WError WRenderer::Initialize() {
@@ -80,6 +430,19 @@ WError WRenderer::Initialize() {
 	m_device = m_app->GetVulkanDevice();
 	m_queue = m_app->GetVulkanGraphicsQeueue();
 	m_swapChain = m_app->GetSwapChain();
+	m_presentMode = (VkPresentModeKHR)m_app->GetEngineParam<int>("presentMode", VK_PRESENT_MODE_MAX_ENUM_KHR);
+
+	//
+	// Create the command pool of the compute queue (if the engine has a separate one)
+	//
+	m_computeQueue = m_app->GetVulkanComputeQueue();
+	if (m_computeQueue) {
+		VkCommandPoolCreateInfo cmdPoolInfo = vkTools::initializers::commandPoolCreateInfo();
+		cmdPoolInfo.queueFamilyIndex = m_app->GetVulkanComputeQueueFamily();
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		if (vkCreateCommandPool(m_device, &cmdPoolInfo, nullptr, &m_computeCommandPool) != VK_SUCCESS)
+			return WError(W_OUTOFMEMORY);
+	}
 
 	//
 	// Create the texture sampler
@@ -104,6 +467,13 @@ WError WRenderer::Initialize() {
 	if (err != VK_SUCCESS)
 		return WError(W_OUTOFMEMORY);
 
+	//
+	// Create the global per-frame UBO (shared by all effects)
+	//
+	WError werr = _CreateGlobalFrameResources();
+	if (!werr)
+		return werr;
+
 	//
 	// Setup swap chain and render target
 	//
@@ -124,6 +494,20 @@ void WRenderer::Render() {
 	m_app->ImageManager->UpdateDynamicImages(m_perBufferResources.curIndex);
 	m_app->GeometryManager->UpdateDynamicGeometries(m_perBufferResources.curIndex);
 
+	// pick the resolution scale of this frame before the global frame data (which holds it) is written
+	_UpdateResolutionScale();
+
+	// write the engine-wide per-frame UBO once, all effects read it at W_GLOBAL_FRAME_SET_INDEX
+	_UpdateGlobalFrameData();
+
+	// upload only the scene objects that changed since they were last written to this buffer
+	m_app->ObjectManager->UpdateSceneObjects();
+	_UpdateSceneObjects();
+
+	// update the particle systems on the worker threads, now that their instance buffers for this index are free
+	if (m_particlesRenderStageName != "")
+		m_app->ParticlesManager->Update(GetRenderTarget(m_particlesRenderStageName));
+
 	err = vkResetCommandBuffer(m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex], 0);
 	if (err)
 		return;
@@ -133,6 +517,14 @@ void WRenderer::Render() {
 	if (err)
 		return;
 
+	if (m_timestampQueryPool) {
+		vkCmdResetQueryPool(m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex], m_timestampQueryPool, m_perBufferResources.curIndex * 2, 2);
+		vkCmdWriteTimestamp(m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_timestampQueryPool, m_perBufferResources.curIndex * 2);
+	}
+
+	// the compute work of the stages goes first (on the compute queue if there is one)
+	bool computeSubmitted = _RecordCompute(m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex]);
+
 	VkImageSubresourceRange subresourceRange = {};
 	subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	subresourceRange.baseArrayLayer = 0;
@@ -160,22 +552,43 @@ void WRenderer::Render() {
 		1, &presentImageBarrier
 	);
 
+	// stages flagged for dynamic resolution only render to the scaled region of their targets, Begin() always
+	// sets the full viewport so it only needs to be changed when a stage differs from the previous one.
+	// The render graph skips the stages that don't contribute to the frame and transitions the images of every
+	// pass before it begins
+	bool scaleStages = m_scaledWidth != m_width || m_scaledHeight != m_height;
+	bool viewportScaled = false;
 	WRenderTarget* currentRT = nullptr;
-	for (auto it = m_renderStages.begin(); it != m_renderStages.end(); it++) {
-		WRenderStage* stage = *it;
+	for (uint32_t i = 0; i < m_renderStages.size(); i++) {
+		WRenderStage* stage = m_renderStages[i];
+		if (m_renderGraph->IsStageCulled(i))
+			continue;
 		if (stage->m_stageDescription.target != RENDER_STAGE_TARGET_PREVIOUS) {
 			if (currentRT)
 				currentRT->End();
+			m_renderGraph->RecordPassBarriers(m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex], i);
+			if (stage->m_stageDescription.flags & RENDER_STAGE_FLAG_PASS_COMPUTE) {
+				WError status = stage->RecordPassCompute(this, m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex]);
+				if (!status)
+					return;
+			}
 			currentRT = stage->m_renderTarget;
 			WError status = currentRT->Begin();
 			if (!status)
 				return;
+			viewportScaled = false;
+		}
+		bool stageScaled = scaleStages && (stage->m_stageDescription.flags & RENDER_STAGE_FLAG_DYNAMIC_RESOLUTION);
+		if (stageScaled != viewportScaled) {
+			_SetStageViewport(stageScaled);
+			viewportScaled = stageScaled;
 		}
 		WError status = stage->Render(this, currentRT, std::numeric_limits<uint32_t>::max());
 		if (!status)
 			return;
 	}
 	currentRT->End();
+	m_renderGraph->RecordFinalBarriers(m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex]);
 
 	presentImageBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 	presentImageBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
@@ -190,6 +603,9 @@ void WRenderer::Render() {
 		1, &presentImageBarrier
 	);
 
+	if (m_timestampQueryPool)
+		vkCmdWriteTimestamp(m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestampQueryPool, m_perBufferResources.curIndex * 2 + 1);
+
 	err = vkEndCommandBuffer(m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex]);
 	if (err)
 		return;
@@ -200,26 +616,86 @@ void WRenderer::Render() {
 	if (err)
 		return;
 
-	// Command buffer to be sumitted to the queue
-	VkPipelineStageFlags submitPipelineStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	// Command buffer to be sumitted to the queue, the stages that read the outputs of the compute work wait for it
+	std::array<VkPipelineStageFlags, 2> submitPipelineStages = {
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		m_computeTransferStages ? m_computeTransferStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+	};
+	std::array<VkSemaphore, 2> waitSemaphores = { m_perBufferResources.presentComplete[m_perBufferResources.curIndex], VK_NULL_HANDLE };
+	if (computeSubmitted)
+		waitSemaphores[1] = m_perBufferResources.computeComplete[m_perBufferResources.curIndex];
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.pWaitDstStageMask = &submitPipelineStages;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &m_perBufferResources.presentComplete[m_perBufferResources.curIndex];
+	submitInfo.pWaitDstStageMask = submitPipelineStages.data();
+	submitInfo.waitSemaphoreCount = computeSubmitted ? 2 : 1;
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = &m_perBufferResources.renderComplete[m_perBufferResources.curIndex];
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &m_perBufferResources.primaryCommandBuffers[m_perBufferResources.curIndex];
 
 	// Submit to queue
-	if (vkQueueSubmit(m_queue, 1, &submitInfo, m_perBufferResources.memoryFences[m_perBufferResources.curIndex]) == VK_SUCCESS)
+	if (vkQueueSubmit(m_queue, 1, &submitInfo, m_perBufferResources.memoryFences[m_perBufferResources.curIndex]) == VK_SUCCESS) {
+		if (m_timestampQueryPool)
+			m_timestampScales[m_perBufferResources.curIndex] = m_resolutionScale;
 		err = m_swapChain->queuePresent(m_queue, currentSwapchainIndex, m_perBufferResources.renderComplete[m_perBufferResources.curIndex]);
+	}
 
 	// increment the current semaphores index (round-robin) for the next frame
 	m_perBufferResources.curIndex = (m_perBufferResources.curIndex + 1) % m_perBufferResources.presentComplete.size();
 }
 
+bool WRenderer::_RecordCompute(VkCommandBuffer graphicsCmdBuf) {
+	uint32_t curIndex = m_perBufferResources.curIndex;
+	VkCommandBuffer computeCmdBuf = m_computeQueue ? m_perBufferResources.computeCommandBuffers[curIndex] : graphicsCmdBuf;
+	bool recording = false;
+	m_computeBufferTransfers.clear();
+	m_computeImageTransfers.clear();
+	m_computeTransferStages = 0;
+
+	for (uint32_t i = 0; i < m_renderStages.size(); i++) {
+		WRenderStage* stage = m_renderStages[i];
+		if (m_renderGraph->IsStageCulled(i) || !(stage->m_stageDescription.flags & RENDER_STAGE_FLAG_ASYNC_COMPUTE))
+			continue;
+		if (!recording && m_computeQueue) {
+			VkCommandBufferBeginInfo cmdBufInfo = vkTools::initializers::commandBufferBeginInfo();
+			if (vkResetCommandBuffer(computeCmdBuf, 0) != VK_SUCCESS || vkBeginCommandBuffer(computeCmdBuf, &cmdBufInfo) != VK_SUCCESS)
+				return false;
+		}
+		recording = true;
+		stage->RecordCompute(this, computeCmdBuf);
+	}
+	if (!recording)
+		return false;
+
+	if (m_computeTransferStages && !m_computeQueue) {
+		// same queue: an execution and memory dependency between the compute work and the rendering
+		vkCmdPipelineBarrier(graphicsCmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, m_computeTransferStages, 0,
+			0, nullptr,
+			(uint32_t)m_computeBufferTransfers.size(), m_computeBufferTransfers.data(),
+			(uint32_t)m_computeImageTransfers.size(), m_computeImageTransfers.data());
+	}
+	// on the compute queue, the graphics submission waits for the compute semaphore at the reading stages, which
+	// makes the writes visible to the rendering. If the compute queue is of another family, the resources that
+	// both queues use are created with VK_SHARING_MODE_CONCURRENT (see WBufferedBuffer and WBufferedImage), so
+	// neither the resources written by the compute work nor the ones it reads (vertex buffers, bone textures,
+	// ...) need their ownership transferred
+
+	if (!m_computeQueue)
+		return false;
+
+	if (vkEndCommandBuffer(computeCmdBuf) != VK_SUCCESS)
+		return false;
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &computeCmdBuf;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &m_perBufferResources.computeComplete[curIndex];
+	return vkQueueSubmit(m_computeQueue, 1, &submitInfo, VK_NULL_HANDLE) == VK_SUCCESS;
+}
+
 WError WRenderer::Resize(uint32_t width, uint32_t height) {
 	if (m_width == width && m_height == height)
 		return W_SUCCEEDED;
@@ -251,7 +727,7 @@ WError WRenderer::Resize(uint32_t width, uint32_t height) {
 	err = vkBeginCommandBuffer(cmdBuf, &cmdBufInfo);
 	if (!err) {
 		// record swapchain creation commands
-		m_swapChain->create(cmdBuf, &m_width, &m_height, m_app->GetEngineParam<uint32_t>("bufferingCount"));
+		m_swapChain->create(cmdBuf, &m_width, &m_height, m_app->GetEngineParam<uint32_t>("bufferingCount"), m_presentMode);
 
 		// end command buffer
 		err = vkEndCommandBuffer(cmdBuf);
@@ -274,9 +750,19 @@ WError WRenderer::Resize(uint32_t width, uint32_t height) {
 	vkDeviceWaitIdle(m_device);
 
 	// remake our semaphores
-	if (m_perBufferResources.Create(m_app, m_swapChain->imageCount))
+	if (m_perBufferResources.Create(m_app, m_swapChain->imageCount, m_computeCommandPool))
 		return WError(W_ERRORUNK);
 
+	// remake the GPU frame timers, the dynamic resolution scale starts over
+	_CreateTimestampQueries();
+	m_scaledWidth = m_width;
+	m_scaledHeight = m_height;
+
+	// the images shared by the stages are resized first so that the stages recreate their targets with them
+	WError graphErr = m_renderGraph->Resize(m_width, m_height);
+	if (!graphErr)
+		return graphErr;
+
 	for (auto it = m_renderStages.begin(); it != m_renderStages.end(); it++) {
 		WError werr = (*it)->Resize(m_width, m_height);
 		vkDeviceWaitIdle(m_device);
@@ -292,6 +778,7 @@ WError WRenderer::SetRenderingStages(std::vector<WRenderStage*> stages) {
 		(*it)->Cleanup();
 	m_renderStages.clear();
 	m_renderStageMap.clear();
+	m_renderGraph->Cleanup();
 
 	m_spritesRenderStageName = "";
 	m_textsRenderStageName = "";
@@ -317,6 +804,13 @@ WError WRenderer::SetRenderingStages(std::vector<WRenderStage*> stages) {
 
 		uint32_t w = m_app->WindowAndInputComponent->GetWindowWidth();
 		uint32_t h = m_app->WindowAndInputComponent->GetWindowHeight();
+
+		// the graph is built from the stage descriptions before the stages are initialized since it allocates
+		// their transient outputs
+		WError graphErr = m_renderGraph->Build(stages, w, h);
+		if (!graphErr)
+			return graphErr;
+
 		for (uint32_t i = 0; i < stages.size(); i++) {
 			m_renderStages.push_back(stages[i]);
 			m_renderStageMap.insert(std::make_pair(stages[i]->m_stageDescription.name, stages[i]));
@@ -336,6 +830,8 @@ WError WRenderer::SetRenderingStages(std::vector<WRenderStage*> stages) {
 				SetRenderingStages(std::vector<WRenderStage*>({}));
 				return err;
 			}
+			if (stages[i]->m_stageDescription.target == RENDER_STAGE_TARGET_BUFFER)
+				stages[i]->m_renderTarget->SetAutomaticLayoutTransitions(false);
 		}
 	}
 
@@ -387,6 +883,10 @@ WImage* WRenderer::GetRenderTargetImage(std::string imageName) const {
 	return nullptr;
 }
 
+WRenderGraph* WRenderer::GetRenderGraph() const {
+	return m_renderGraph;
+}
+
 VulkanSwapChain* WRenderer::GetSwapchain() const {
 	return m_swapChain;
 }
@@ -403,6 +903,150 @@ VkQueue WRenderer::GetQueue() const {
 	return m_queue;
 }
 
+VkDescriptorSetLayout WRenderer::GetGlobalFrameDescriptorSetLayout() const {
+	return m_globalFrameSetLayout;
+}
+
+VkDescriptorSetLayout WRenderer::GetEmptyDescriptorSetLayout() const {
+	return m_emptySetLayout;
+}
+
+VkDescriptorSet WRenderer::GetGlobalFrameDescriptorSet() const {
+	return m_globalFrameSets[m_perBufferResources.curIndex];
+}
+
+uint32_t WRenderer::GetGlobalFrameOffset(WRenderTarget* rt) const {
+	uint32_t slot = rt ? rt->m_globalFrameSlot : 0;
+	return slot < m_maxGlobalFrameSlots ? slot * m_globalFrameSlotSize : 0;
+}
+
+const W_GLOBAL_FRAME_DATA& WRenderer::GetGlobalFrameData(WRenderTarget* rt) const {
+	uint32_t slot = rt ? rt->m_globalFrameSlot : 0;
+	return m_globalFrameData[slot < m_globalFrameData.size() ? slot : 0];
+}
+
+W_GLOBAL_FRAME_DATA WRenderer::GetUpcomingGlobalFrameData(WRenderTarget* rt) {
+	W_GLOBAL_FRAME_DATA frameData = m_globalFrameData[0];
+	WCamera* cam = rt ? rt->m_camera : nullptr;
+	if (cam) {
+		// same as WRenderTarget::Begin(), which will write this data
+		cam->Render(rt->m_width, rt->m_height);
+		_SetGlobalFrameCamera(frameData, cam);
+	}
+	return frameData;
+}
+
+float WRenderer::GetResolutionScale() const {
+	return m_resolutionScale;
+}
+
+float WRenderer::GetGPUFrameTime() const {
+	return m_gpuFrameTime;
+}
+
+WError WRenderer::SetPresentMode(VkPresentModeKHR mode) {
+	m_presentMode = mode;
+	if (!m_swapChain || m_swapChain->swapChain == VK_NULL_HANDLE)
+		return WError(W_SUCCEEDED); // used when the swap chain is created
+
+	// force Resize() to re-create the swap chain at the current size
+	uint32_t width = m_width, height = m_height;
+	m_width = m_height = 0;
+	return Resize(width, height);
+}
+
+VkPresentModeKHR WRenderer::GetPresentMode() const {
+	return m_swapChain ? m_swapChain->presentMode : m_presentMode;
+}
+
+bool WRenderer::HasAsyncCompute() const {
+	return m_computeQueue != VK_NULL_HANDLE;
+}
+
+void WRenderer::TransferComputeBuffer(VkBuffer buffer, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess) {
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	m_computeBufferTransfers.push_back(barrier);
+	m_computeTransferStages |= dstStages;
+}
+
+void WRenderer::TransferComputeImage(VkImage image, VkImageSubresourceRange range, VkImageLayout layout, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess) {
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+	barrier.oldLayout = layout;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+	m_computeImageTransfers.push_back(barrier);
+	m_computeTransferStages |= dstStages;
+}
+
+W_BOUND_RESOURCE WRenderer::GetGlobalFrameBoundResource() {
+	return W_BOUND_RESOURCE(W_TYPE_UBO, 0, W_GLOBAL_FRAME_SET_INDEX, "uboGlobalFrame", {
+		W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "viewMatrix"),
+		W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projectionMatrix"),
+		W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "viewProjectionMatrix"),
+		W_SHADER_VARIABLE_INFO(W_TYPE_MAT4X4, "projectionInverseMatrix"),
+		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "camPosW"),
+		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "camDirW"),
+		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "time"),
+		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "resolution"),
+		W_SHADER_VARIABLE_INFO(W_TYPE_VEC_4, "resolutionScale"),
+		W_SHADER_VARIABLE_INFO(W_TYPE_INT, "numLights"),
+	});
+}
+
+uint32_t WRenderer::AllocateSceneObject() {
+	uint32_t index;
+	if (m_freeSceneObjects.size() > 0) {
+		index = m_freeSceneObjects.back();
+		m_freeSceneObjects.pop_back();
+	} else {
+		// before the buffer is created its capacity is taken from the engine parameter it will be created with
+		uint32_t maxSceneObjects = m_maxSceneObjects > 0 ? m_maxSceneObjects : std::max(m_app->GetEngineParam<uint32_t>("maxSceneObjects", 16384), (uint32_t)1);
+		if (m_sceneObjects.size() >= maxSceneObjects)
+			return W_INVALID_SCENE_OBJECT_INDEX;
+		index = (uint32_t)m_sceneObjects.size();
+		m_sceneObjects.push_back(W_SCENE_OBJECT_DATA());
+		m_sceneObjectsPendingWrites.push_back(0);
+	}
+
+	UpdateSceneObject(index, W_SCENE_OBJECT_DATA());
+	return index;
+}
+
+void WRenderer::FreeSceneObject(uint32_t index) {
+	if (index >= m_sceneObjects.size())
+		return;
+
+	if (m_sceneObjectsPendingWrites[index] > 0) {
+		m_sceneObjectsPendingWrites[index] = 0;
+		m_dirtySceneObjects.erase(std::find(m_dirtySceneObjects.begin(), m_dirtySceneObjects.end(), index));
+	}
+	m_freeSceneObjects.push_back(index);
+}
+
+void WRenderer::UpdateSceneObject(uint32_t index, const W_SCENE_OBJECT_DATA& data) {
+	if (index >= m_sceneObjects.size())
+		return;
+
+	m_sceneObjects[index] = data;
+	if (m_sceneObjectsPendingWrites[index] == 0)
+		m_dirtySceneObjects.push_back(index);
+	m_sceneObjectsPendingWrites[index] = (uint8_t)std::max(m_globalFrameSets.size(), (size_t)1);
+}
+
 VkSampler WRenderer::GetTextureSampler(W_TEXTURE_SAMPLER_TYPE type) const {
 	UNREFERENCED_PARAMETER(type);
 	return m_sampler;
@@ -151,7 +151,8 @@ WEffect* WSpriteManager::CreateSpriteEffect(
 	WShader* ps,
 	VkPipelineColorBlendAttachmentState bs,
 	VkPipelineDepthStencilStateCreateInfo dss,
-	VkPipelineRasterizationStateCreateInfo rs
+	VkPipelineRasterizationStateCreateInfo rs,
+	uint32_t subpass
 ) const {
 	WEffect* spriteFX = new WEffect(m_app);
 	WError err = spriteFX->BindShader(m_spriteVertexShader);
@@ -199,6 +200,7 @@ WEffect* WSpriteManager::CreateSpriteEffect(
 	spriteFX->SetRasterizationState(rs);
 
 	spriteFX->SetPrimitiveTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP); // we use a triangle strip with not index buffer
+	spriteFX->SetSubpass(subpass);
 
 	err = spriteFX->BuildPipeline(rt ? rt : m_app->Renderer->GetRenderTarget(m_app->Renderer->GetSpritesRenderStageName()));
 
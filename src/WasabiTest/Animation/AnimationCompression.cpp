@@ -0,0 +1,150 @@
+#include "Animation/AnimationCompression.hpp"
+#include <fstream>
+#include <map>
+
+#define POSITION_ERROR 0.001f
+#define ROTATION_ERROR 0.002f
+
+/**
+ * Collects the bones of a keyframe by their index.
+ */
+static void CollectBones(WBone* bone, std::map<uint32_t, WBone*>& bones) {
+	bones[bone->GetIndex()] = bone;
+	for (uint32_t i = 0; i < bone->GetNumChildren(); i++)
+		CollectBones(bone->GetChild(i), bones);
+}
+
+static WQuaternion BoneRotation(WBone* bone) {
+	WVector3 r = bone->GetRVector();
+	WVector3 u = bone->GetUVector();
+	WVector3 l = bone->GetLVector();
+	return WQuaternionRotationMatrix(WMatrix(r.x, r.y, r.z, 0.0f,
+											 u.x, u.y, u.z, 0.0f,
+											 l.x, l.y, l.z, 0.0f,
+											 0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+/**
+ * Angle between two rotations, from the chord between the quaternions (acos
+ * of their dot product loses too much precision for small angles).
+ */
+static float RotationAngle(WQuaternion a, WQuaternion b) {
+	float dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+	float sign = dot < 0.0f ? -1.0f : 1.0f;
+	float chord = 0.0f;
+	for (uint32_t c = 0; c < 4; c++)
+		chord += (a.components[c] - b.components[c] * sign) * (a.components[c] - b.components[c] * sign);
+	return 4.0f * asinf(fmin(sqrtf(chord) / 2.0f, 1.0f));
+}
+
+AnimationCompressionDemo::AnimationCompressionDemo(Wasabi* const app) : WTestState(app) {
+	character = nullptr;
+	maxPositionError = maxRotationError = 0.0f;
+}
+
+void AnimationCompressionDemo::Load() {
+	WSkeleton* animation;
+	WGeometry* geometry;
+	WFile file(m_app);
+	CheckError(file.Open("media/dante.WSBI"));
+	CheckError(file.LoadAsset<WSkeleton>("dante-animation", &animation, WSkeleton::LoadArgs()));
+	CheckError(file.LoadAsset<WGeometry>("dante-geometry", &geometry, WGeometry::LoadArgs()));
+	file.Close();
+
+	// empty out the file
+	std::fstream f;
+	f.open("media/WSkeleton.WSBI", ios::out);
+	f.close();
+
+	std::string animationName = animation->GetName();
+	animation->SetCompression(true, POSITION_ERROR, ROTATION_ERROR);
+	CheckError(file.Open("media/WSkeleton.WSBI"));
+	CheckError(file.SaveAsset(animation));
+	file.Close();
+
+	WSkeleton* compressed;
+	CheckError(file.Open("media/WSkeleton.WSBI"));
+	CheckError(file.LoadAsset<WSkeleton>(animationName, &compressed, WSkeleton::LoadArgs(), "-compressed"));
+	file.Close();
+
+	// collect the bones of every keyframe of both skeletons
+	std::vector<std::map<uint32_t, WBone*>> frames, compressedFrames;
+	for (uint32_t frame = 0; animation->GetKeyFrame(frame); frame++) {
+		WBone* compressedFrame = compressed->GetKeyFrame(frame);
+		assert(compressedFrame != nullptr);
+		frames.push_back(std::map<uint32_t, WBone*>());
+		compressedFrames.push_back(std::map<uint32_t, WBone*>());
+		CollectBones(animation->GetKeyFrame(frame), frames.back());
+		CollectBones(compressedFrame, compressedFrames.back());
+		assert(frames.back().size() == compressedFrames.back().size());
+	}
+	assert(frames.size() > 0 && compressed->GetKeyFrame((uint32_t)frames.size()) == nullptr);
+
+	// Positions are quantized to 16 bits per component over the range of their
+	// track, and the interpolated frames move by at most as much as their keys
+	std::map<uint32_t, float> positionBounds;
+	for (auto it = frames[0].begin(); it != frames[0].end(); it++) {
+		WVector3 rangeMin = it->second->GetPosition(), rangeMax = rangeMin;
+		for (uint32_t frame = 1; frame < frames.size(); frame++) {
+			WVector3 position = frames[frame][it->first]->GetPosition();
+			for (uint32_t c = 0; c < 3; c++) {
+				rangeMin.components[c] = fmin(rangeMin.components[c], position.components[c]);
+				rangeMax.components[c] = fmax(rangeMax.components[c], position.components[c]);
+			}
+		}
+		float quantization = WVec3Length(rangeMax - rangeMin) / 65535.0f / 2.0f;
+		positionBounds[it->first] = POSITION_ERROR + quantization + 1e-5f * (1.0f + WVec3Length(rangeMax));
+	}
+
+	// Rotations keep the three smallest quaternion components in 15 bits over
+	// [-1/sqrt(2), 1/sqrt(2)], which changes the quaternion by at most
+	// 4 * 1/sqrt(2)/32767 (the largest component follows from the others)
+	// and the angle by twice that
+	float rotationBound = ROTATION_ERROR + 8.0f / sqrtf(2.0f) / 32767.0f + 1e-4f;
+
+	maxPositionError = maxRotationError = 0.0f;
+	for (uint32_t frame = 0; frame < frames.size(); frame++) {
+		for (auto it = frames[frame].begin(); it != frames[frame].end(); it++) {
+			WBone* bone = it->second;
+			assert(compressedFrames[frame].find(it->first) != compressedFrames[frame].end());
+			WBone* compressedBone = compressedFrames[frame][it->first];
+
+			float positionError = WVec3Length(bone->GetPosition() - compressedBone->GetPosition());
+			float rotationError = RotationAngle(BoneRotation(bone), BoneRotation(compressedBone));
+			assert(positionError <= positionBounds[it->first]);
+			assert(rotationError <= rotationBound);
+			maxPositionError = fmax(maxPositionError, positionError);
+			maxRotationError = fmax(maxRotationError, rotationError);
+		}
+	}
+	animation->RemoveReference();
+
+	character = m_app->ObjectManager->CreateObject();
+	assert(character != nullptr);
+	CheckError(character->SetGeometry(geometry));
+	WImage* texture = m_app->ImageManager->CreateImage("media/dante.png");
+	assert(texture != nullptr);
+	CheckError(character->GetMaterials().SetTexture("diffuseTexture", texture));
+
+	((WasabiTester*)m_app)->SetCameraPosition(WVector3(0, geometry->GetMaxPoint().y / 2, 0));
+
+	geometry->RemoveReference();
+	texture->RemoveReference();
+
+	CheckError(character->SetAnimation(compressed));
+	compressed->SetPlaySpeed(20.0f);
+	compressed->Loop();
+	compressed->RemoveReference();
+}
+
+void AnimationCompressionDemo::Update(float fDeltaTime) {
+	UNREFERENCED_PARAMETER(fDeltaTime);
+
+	char title[128];
+	sprintf_s(title, 128, "Max position error: %.6f\nMax rotation error: %.6f", maxPositionError, maxRotationError);
+	m_app->TextComponent->RenderText(title, 5.0f, 5.0f, 32, 1);
+}
+
+void AnimationCompressionDemo::Cleanup() {
+	W_SAFE_REMOVEREF(character);
+}
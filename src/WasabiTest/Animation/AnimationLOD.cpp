@@ -0,0 +1,72 @@
+#include "Animation/AnimationLOD.hpp"
+
+AnimationLODDemo::AnimationLODDemo(Wasabi* const app) : WTestState(app) {
+	visibleCharacter = nullptr;
+	offscreenCharacter = nullptr;
+	framesOffscreen = 0;
+}
+
+void AnimationLODDemo::Load() {
+	// every character gets its own copy of the animation, so they get their own LOD
+	WSkeleton* visibleAnimation;
+	WSkeleton* offscreenAnimation;
+	WGeometry* geometry;
+	WFile file(m_app);
+	CheckError(file.Open("media/dante.WSBI"));
+	CheckError(file.LoadAsset<WSkeleton>("dante-animation", &visibleAnimation, WSkeleton::LoadArgs(), "-visible"));
+	CheckError(file.LoadAsset<WSkeleton>("dante-animation", &offscreenAnimation, WSkeleton::LoadArgs(), "-offscreen"));
+	CheckError(file.LoadAsset<WGeometry>("dante-geometry", &geometry, WGeometry::LoadArgs()));
+	file.Close();
+
+	WImage* texture = m_app->ImageManager->CreateImage("media/dante.png");
+	assert(texture != nullptr);
+
+	visibleCharacter = m_app->ObjectManager->CreateObject();
+	offscreenCharacter = m_app->ObjectManager->CreateObject();
+	assert(visibleCharacter != nullptr && offscreenCharacter != nullptr);
+	for (auto character : { visibleCharacter, offscreenCharacter }) {
+		CheckError(character->SetGeometry(geometry));
+		CheckError(character->GetMaterials().SetTexture("diffuseTexture", texture));
+	}
+	CheckError(visibleCharacter->SetAnimation(visibleAnimation));
+	CheckError(offscreenCharacter->SetAnimation(offscreenAnimation));
+
+	// the default light points along (0, -1, -1), the second character is above the camera's view towards
+	// the light so it casts a shadow in the cascade that covers the first one
+	WVector3 center = WVector3(0, geometry->GetMaxPoint().y / 2, 0);
+	((WasabiTester*)m_app)->SetCameraPosition(center);
+	offscreenCharacter->SetPosition(center + WVec3Normalize(WVector3(0.0f, 1.0f, 1.0f)) * 20.0f);
+
+	geometry->RemoveReference();
+	texture->RemoveReference();
+
+	for (auto animation : { visibleAnimation, offscreenAnimation }) {
+		animation->SetPlaySpeed(20.0f);
+		animation->Loop();
+		animation->RemoveReference();
+	}
+}
+
+void AnimationLODDemo::Update(float fDeltaTime) {
+	UNREFERENCED_PARAMETER(fDeltaTime);
+
+	// the LOD is picked from the visibility reported in the previous frame, so the character must have been
+	// outside the view (the camera can be moved with the mouse) for two frames
+	WCamera* cam = m_app->CameraManager->GetDefaultCamera();
+	framesOffscreen = offscreenCharacter->InCameraView(cam) ? 0 : framesOffscreen + 1;
+	W_ANIMATION_LOD lod = offscreenCharacter->GetAnimation()->GetLOD();
+	if (framesOffscreen > 2 && m_app->GetEngineParam<bool>("animationLOD")) {
+		assert(lod.updateInterval == std::max(m_app->GetEngineParam<uint32_t>("animationLODMaxInterval"), 1u));
+		assert(lod.maxBoneDepth == m_app->GetEngineParam<uint32_t>("animationLODBoneDepth"));
+	}
+
+	W_ANIMATION_LOD visibleLod = visibleCharacter->GetAnimation()->GetLOD();
+	char title[128];
+	sprintf_s(title, 128, "Visible update interval: %u\nOff-screen update interval: %u", visibleLod.updateInterval, lod.updateInterval);
+	m_app->TextComponent->RenderText(title, 5.0f, 40.0f, 32, 1);
+}
+
+void AnimationLODDemo::Cleanup() {
+	W_SAFE_REMOVEREF(visibleCharacter);
+	W_SAFE_REMOVEREF(offscreenCharacter);
+}
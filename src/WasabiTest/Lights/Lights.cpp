@@ -41,7 +41,7 @@ void LightsDemo::Load() {
 	// hide default light
 	m_app->LightManager->GetDefaultLight()->Hide();
 
-	int maxLights = std::min(m_app->GetEngineParam<int>("maxLights", INT_MAX), 8);
+	int maxLights = std::min(m_app->GetEngineParam<int>("maxLights"), 8);
 	WColor colors[] = {
 		WColor(1, 0, 0),
 		WColor(0, 1, 0),
@@ -82,12 +82,12 @@ void LightsDemo::Load() {
 void LightsDemo::SetSceneProperties() {
 	if (m_plain) {
 		m_plain->GetMaterials().SetVariable<WColor>("color", WColor(0.4f, 0.4f, 0.4f));
-		m_plain->GetMaterials().SetVariable<int>("isTextured", 0);
+		m_plain->GetMaterials().SetFeatures(EFFECT_FEATURE_NONE);
 	}
 
 	for (auto box : m_boxes) {
 		box->GetMaterials().SetVariable<WColor>("color", WColor(0.7f, 0.7f, 0.7f));
-		box->GetMaterials().SetVariable<int>("isTextured", 0);
+		box->GetMaterials().SetFeatures(EFFECT_FEATURE_NONE);
 	}
 }
 
@@ -104,12 +104,21 @@ void LightsDemo::Update(float fDeltaTime) {
 		SetSceneProperties();
 	}
 
+	// 3 and 4 switch between filling the light clusters on the CPU and in a compute pass
+	bool computeClusters = m_app->GetEngineParam<bool>("computeLightClusters");
+	if ((m_app->WindowAndInputComponent->KeyDown('3') && computeClusters) || (m_app->WindowAndInputComponent->KeyDown('4') && !computeClusters)) {
+		computeClusters = !computeClusters;
+		m_app->SetEngineParam<bool>("computeLightClusters", computeClusters);
+		SetupRenderer();
+		SetSceneProperties();
+	}
+
 	for (auto it = m_boxes.begin(); it != m_boxes.end(); it++) {
 		// WObject* box = *it;
 		// box->Yaw(10.0f * fDeltaTime);
 	}
 
-	m_app->TextComponent->RenderText(m_isDeferred ? "Deferred" : "Forward", 5, 46, 32);
+	m_app->TextComponent->RenderText(std::string(m_isDeferred ? "Deferred" : "Forward") + (computeClusters ? ", compute clusters" : ", CPU clusters"), 5, 46, 32);
 }
 
 void LightsDemo::Cleanup() {
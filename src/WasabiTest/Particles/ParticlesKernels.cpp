@@ -0,0 +1,79 @@
+#include "Particles/ParticlesKernels.hpp"
+
+#define NUM_TRIALS 200
+
+static float RandomFloat(float minValue, float maxValue) {
+	return minValue + (maxValue - minValue) * ((float)rand() / (float)RAND_MAX);
+}
+
+static bool SameFloats(const std::vector<float>& a, const std::vector<float>& b, uint32_t n) {
+	return n == 0 || memcmp(a.data(), b.data(), n * sizeof(float)) == 0;
+}
+
+ParticlesKernelsDemo::ParticlesKernelsDemo(Wasabi* const app) : WTestState(app) {
+}
+
+void ParticlesKernelsDemo::Load() {
+	const WParticlesKernels* scalar = WParticlesKernels::Get(W_PARTICLES_KERNELS_SCALAR);
+	assert(scalar != nullptr);
+
+	const char* names[] = { "Scalar", "SSE4.1", "AVX2" };
+	m_results = "";
+	srand(1);
+	for (int isa = W_PARTICLES_KERNELS_SSE41; isa <= W_PARTICLES_KERNELS_AVX2; isa++) {
+		const WParticlesKernels* kernels = WParticlesKernels::Get((W_PARTICLES_KERNELS_ISA)isa);
+		if (!kernels) {
+			m_results += std::string(names[isa]) + ": not supported\n";
+			continue;
+		}
+
+		for (uint32_t trial = 0; trial < NUM_TRIALS; trial++) {
+			// odd sizes so that the scalar tails of the SIMD kernels run too
+			uint32_t n = (uint32_t)rand() % (W_PARTICLES_BATCH_SIZE + 1);
+			float curTime = RandomFloat(0.0f, 10.0f);
+			float deltaTime = RandomFloat(0.0f, 0.5f);
+			std::vector<float> spawnTime(n), lifetime(n), vel(n), pos(n);
+			for (uint32_t i = 0; i < n; i++) {
+				spawnTime[i] = RandomFloat(0.0f, 10.0f);
+				// some particles die right away, including with a zero lifetime
+				lifetime[i] = rand() % 32 == 0 ? 0.0f : RandomFloat(0.0f, 5.0f);
+				vel[i] = RandomFloat(-10.0f, 10.0f);
+				pos[i] = RandomFloat(-100.0f, 100.0f);
+			}
+
+			std::vector<float> age(n), expectedAge(n);
+			std::vector<uint8_t> alive(n), expectedAlive(n);
+			uint32_t numAlive = kernels->Age(curTime, spawnTime.data(), lifetime.data(), age.data(), alive.data(), n);
+			uint32_t expectedNumAlive = scalar->Age(curTime, spawnTime.data(), lifetime.data(), expectedAge.data(), expectedAlive.data(), n);
+			assert(numAlive == expectedNumAlive);
+			assert(SameFloats(age, expectedAge, n));
+			assert(alive == expectedAlive);
+
+			std::vector<float> compacted = pos, expectedCompacted = pos;
+			kernels->Compact(compacted.data(), expectedAlive.data(), n);
+			scalar->Compact(expectedCompacted.data(), expectedAlive.data(), n);
+			assert(SameFloats(compacted, expectedCompacted, expectedNumAlive));
+
+			std::vector<float> integrated = pos, expectedIntegrated = pos;
+			kernels->Integrate(curTime, deltaTime, spawnTime.data(), vel.data(), integrated.data(), n);
+			scalar->Integrate(curTime, deltaTime, spawnTime.data(), vel.data(), expectedIntegrated.data(), n);
+			assert(SameFloats(integrated, expectedIntegrated, n));
+		}
+		m_results += std::string(names[isa]) + ": matches the scalar kernels\n";
+	}
+
+	const WParticlesKernels* best = WParticlesKernels::GetBest();
+	for (int isa = W_PARTICLES_KERNELS_SCALAR; isa <= W_PARTICLES_KERNELS_AVX2; isa++) {
+		if (WParticlesKernels::Get((W_PARTICLES_KERNELS_ISA)isa) == best)
+			m_results += std::string("Particles use ") + names[isa];
+	}
+}
+
+void ParticlesKernelsDemo::Update(float fDeltaTime) {
+	UNREFERENCED_PARAMETER(fDeltaTime);
+
+	m_app->TextComponent->RenderText(m_results, 5.0f, 5.0f, 32, 1);
+}
+
+void ParticlesKernelsDemo::Cleanup() {
+}
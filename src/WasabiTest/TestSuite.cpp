@@ -8,10 +8,13 @@
  * OPTIONS:
  * - RenderTargetTextureDemo
  * - AnimationDemo
+ * - AnimationCompressionDemo
+ * - AnimationLODDemo
  * - SoundDemo
  * - InstancingDemo
  * - LightsDemo
  * - ParticlesDemo
+ * - ParticlesKernelsDemo
  * - TerrainDemo
  * - SpritesDemo
  * - PhysicsDemo
@@ -20,10 +23,13 @@
 
 #include "RenderTargetTexture/RenderTargetTexture.hpp"
 #include "Animation/Animation.hpp"
+#include "Animation/AnimationCompression.hpp"
+#include "Animation/AnimationLOD.hpp"
 #include "Sound/Sound.hpp"
 #include "Instancing/Instancing.hpp"
 #include "Lights/Lights.hpp"
 #include "Particles/Particles.hpp"
+#include "Particles/ParticlesKernels.hpp"
 #include "Terrain/Terrain.hpp"
 #include "Sprites/Sprites.hpp"
 #include "Physics/Physics.hpp"